@@ -0,0 +1,103 @@
+//
+// bench-cache.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "bench.h"
+#include "clib-cache.h"
+#include "copy/copy.h"
+#include "fs/fs.h"
+#include "mkdirp/mkdirp.h"
+#include "rimraf/rimraf.h"
+#include <unistd.h>
+
+#define FILES 24
+#define FILE_SIZE 4096
+
+static char root[] = "/tmp/clib-bench-XXXXXX";
+static char tree[256];
+static char target[256];
+
+/**
+ * Writes a package of `FILES` sources, a few of them in a subdirectory,
+ * the way packages with an `src` dir and headers look.
+ */
+
+static int write_tree(const char *dir) {
+  char content[FILE_SIZE + 1];
+  char path[512];
+
+  memset(content, 'x', FILE_SIZE);
+  content[FILE_SIZE] = '\0';
+
+  snprintf(path, sizeof(path), "%s/include", dir);
+  if (0 != mkdirp(path, 0777)) {
+    return -1;
+  }
+
+  for (int i = 0; i < FILES; i++) {
+    snprintf(path, sizeof(path), "%s/%sfile-%d.%c", dir,
+             i % 4 ? "" : "include/", i, i % 4 ? 'c' : 'h');
+    // the file number keeps them apart in the content store
+    snprintf(content, sizeof(content), "// %d\n", i);
+    content[strlen(content)] = 'x';
+    if (-1 == fs_write(path, content)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void copy_tree(void *data) {
+  if (0 != copy_dir(tree, target)) {
+    fprintf(stderr, "failed to copy %s\n", tree);
+    exit(1);
+  }
+}
+
+static void load_package(void *data) {
+  if (0 != clib_cache_load_package("bench", "package", "1.0.0", target)) {
+    fprintf(stderr, "failed to load the package from the cache\n");
+    exit(1);
+  }
+}
+
+int main(void) {
+  char home[256];
+  int rc = 1;
+
+  if (NULL == mkdtemp(root)) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  // the cache lives in the home directory
+  snprintf(home, sizeof(home), "%s/home", root);
+  snprintf(tree, sizeof(tree), "%s/tree", root);
+  snprintf(target, sizeof(target), "%s/target", root);
+  setenv("HOME", home, 1);
+
+  if (0 != write_tree(tree) || 0 != clib_cache_init(60)) {
+    fprintf(stderr, "unable to set up %s\n", root);
+    goto cleanup;
+  }
+
+  // into a tree that is there already, as with a reinstall
+  bench("copy_dir", copy_tree, NULL);
+  rimraf(target);
+
+  if (0 != clib_cache_save_package("bench", "package", "1.0.0", tree)) {
+    fprintf(stderr, "unable to cache %s\n", tree);
+    goto cleanup;
+  }
+
+  bench("clib_cache_load_package", load_package, NULL);
+  rc = 0;
+
+cleanup:
+  rimraf(root);
+  return rc;
+}
@@ -0,0 +1,182 @@
+//
+// bench-install.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "bench.h"
+#include "clib-cache.h"
+#include "clib-mirror.h"
+#include "clib-package.h"
+#include "fixture-server.h"
+#include "fs/fs.h"
+#include "mkdirp/mkdirp.h"
+#include "rimraf/rimraf.h"
+#include <curl/curl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SOURCES 6
+#define SOURCE_SIZE 4096
+
+static char root[] = "/tmp/clib-bench-XXXXXX";
+static char fixtures[256];
+static char deps[256];
+
+static const char *packages[] = {"app", "dep-a", "dep-b"};
+
+/**
+ * Writes the manifest and sources of `name` where a mirror of
+ * raw.githubusercontent.com would have them. The app depends on the rest.
+ */
+
+static int write_package(const char *name) {
+  char content[SOURCE_SIZE + 1];
+  char manifest[1024];
+  char path[512];
+  int length = 0;
+
+  snprintf(path, sizeof(path), "%s/bench/%s/1.0.0/src", fixtures, name);
+  if (0 != mkdirp(path, 0777)) {
+    return -1;
+  }
+
+  length = snprintf(manifest, sizeof(manifest),
+                    "{\"name\":\"%s\",\"version\":\"1.0.0\","
+                    "\"repo\":\"bench/%s\",\"src\":[",
+                    name, name);
+
+  memset(content, 'x', SOURCE_SIZE);
+  content[SOURCE_SIZE] = '\0';
+
+  for (int i = 0; i < SOURCES; i++) {
+    snprintf(path, sizeof(path), "%s/bench/%s/1.0.0/src/%s-%d.c", fixtures,
+             name, name, i);
+    if (-1 == fs_write(path, content)) {
+      return -1;
+    }
+    length += snprintf(manifest + length, sizeof(manifest) - length,
+                       "%s\"src/%s-%d.c\"", i ? "," : "", name, i);
+  }
+
+  if (0 == strcmp("app", name)) {
+    length += snprintf(manifest + length, sizeof(manifest) - length,
+                       "],\"dependencies\":{\"bench/dep-a\":\"1.0.0\","
+                       "\"bench/dep-b\":\"1.0.0\"}}");
+  } else {
+    length += snprintf(manifest + length, sizeof(manifest) - length, "]}");
+  }
+
+  snprintf(path, sizeof(path), "%s/bench/%s/1.0.0/clib.json", fixtures, name);
+  return -1 == fs_write(path, manifest) ? -1 : 0;
+}
+
+/**
+ * Points the installs at a server of the fixtures started with `server`,
+ * stopping the one before it.
+ */
+
+static pid_t serve(pid_t previous, fixture_server_opts_t server) {
+  char mirror[64];
+  pid_t pid = -1;
+  int port = 0;
+
+  if (previous > 0) {
+    kill(previous, SIGTERM);
+    waitpid(previous, NULL, 0);
+  }
+
+  server.root = fixtures;
+  if (-1 == (pid = fixture_server_start(server, &port))) {
+    return -1;
+  }
+
+  // every request goes to the fixtures, none to GitHub
+  snprintf(mirror, sizeof(mirror), "http://127.0.0.1:%d", port);
+  setenv("CLIB_MIRRORS", mirror, 1);
+  clib_mirror_cleanup();
+  return pid;
+}
+
+static void install(void *data) {
+  clib_package_t *pkg = clib_package_new_from_slug("bench/app@1.0.0", 0);
+
+  if (!pkg || 0 != clib_package_install(pkg, deps, 0)) {
+    fprintf(stderr, "failed to install bench/app\n");
+    exit(1);
+  }
+
+  clib_package_free(pkg);
+}
+
+int main(void) {
+  clib_package_opts_t opts = {0};
+  fixture_server_opts_t lan = {0};
+  fixture_server_opts_t wan = {0};
+  char home[256];
+  pid_t server = -1;
+  int rc = 1;
+
+  if (NULL == mkdtemp(root)) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  snprintf(home, sizeof(home), "%s/home", root);
+  snprintf(fixtures, sizeof(fixtures), "%s/fixtures", root);
+  snprintf(deps, sizeof(deps), "%s/deps", root);
+  setenv("HOME", home, 1);
+  setenv("CLIB_MIRRORS_ONLY", "1", 1);
+
+  for (size_t i = 0; i < sizeof(packages) / sizeof(packages[0]); i++) {
+    if (0 != write_package(packages[i])) {
+      fprintf(stderr, "unable to write the fixtures in %s\n", fixtures);
+      goto cleanup;
+    }
+  }
+
+  if (-1 == (server = serve(server, lan))) {
+    perror("serve");
+    goto cleanup;
+  }
+
+  curl_global_init(CURL_GLOBAL_ALL);
+  clib_cache_init(60 * 60);
+
+  // installs again and again, fetching everything each time
+  opts.skip_cache = 1;
+  opts.force = 1;
+  opts.concurrency = 4;
+  clib_package_set_opts(opts);
+  bench("clib_package_install (network)", install, NULL);
+
+  // from further away, where waiting on the network is what it's about
+  wan.latency_ms = 20;
+  wan.bandwidth = 8 << 20;
+  if (-1 == (server = serve(server, wan))) {
+    perror("serve");
+    goto cleanup;
+  }
+
+  bench("clib_package_install (wan)", install, NULL);
+
+  // and then from what those left in the cache
+  opts.skip_cache = 0;
+  clib_package_set_opts(opts);
+  bench("clib_package_install (cache)", install, NULL);
+
+  clib_package_cleanup();
+  curl_global_cleanup();
+  rc = 0;
+
+cleanup:
+  if (server > 0) {
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+  }
+
+  rimraf(root);
+  return rc;
+}
@@ -0,0 +1,34 @@
+//
+// bench-manifest.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "bench.h"
+#include "clib-package.h"
+#include "fs/fs.h"
+
+static void parse_manifest(void *data) {
+  clib_package_t *pkg = clib_package_new(data, 0);
+  if (!pkg) {
+    fprintf(stderr, "failed to parse the manifest\n");
+    exit(1);
+  }
+  clib_package_free(pkg);
+}
+
+int main(void) {
+  // the manifest of clib itself, with its two dozen dependencies
+  char *json = fs_read("../clib.json");
+  if (!json) {
+    fprintf(stderr, "unable to read ../clib.json\n");
+    return 1;
+  }
+
+  bench("clib_package_new", parse_manifest, json);
+
+  free(json);
+  clib_package_cleanup();
+  return 0;
+}
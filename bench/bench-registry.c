@@ -0,0 +1,170 @@
+//
+// bench-registry.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "bench.h"
+#include "clib-search-index.h"
+#include "parson/parson.h"
+#include "strbuf/strbuf.h"
+#include "wiki-registry/wiki-registry.h"
+
+// about the size of the real registry
+#define CATEGORIES 48
+#define PACKAGES_PER_CATEGORY 32
+
+static const char *words[] = {
+    "json",   "parser", "string", "buffer", "hash",   "table",  "list",
+    "linked", "fast",   "simple", "utf-8",  "http",   "client", "server",
+    "thread", "pool",   "queue",  "vector", "tiny",   "file",   "path",
+    "regex",  "base64", "crypto", "sha256", "time",   "date",   "random",
+    "logger", "color",  "term",   "test",   "assert", "memory", "arena",
+    "socket", "event",  "loop",   "async",  "math",   "matrix", "bitset",
+};
+
+#define WORDS (sizeof(words) / sizeof(words[0]))
+
+static void append_words(strbuf_t *page, unsigned int seed, int count) {
+  for (int i = 0; i < count; i++) {
+    seed = seed * 1103515245 + 12345;
+    if (i) strbuf_append_char(page, ' ');
+    strbuf_append(page, words[(seed >> 16) % WORDS]);
+  }
+}
+
+/**
+ * A page in the shape of the Packages page of the wiki: the categories as
+ * `h2`s in the `wiki-body`, each followed by a list of "repo - description"
+ * items, among the markup of the rest of the page.
+ */
+
+static char *registry_page(void) {
+  strbuf_t page = STRBUF_INIT;
+  char line[256];
+
+  strbuf_append(&page, "<!DOCTYPE html>\n<html lang=\"en\"><head>"
+                       "<meta charset=\"utf-8\"><title>Packages</title>"
+                       "<link rel=\"stylesheet\" href=\"/assets/github.css\">"
+                       "</head>\n<body class=\"logged-out\">\n"
+                       "<header class=\"Header\"><nav><a href=\"/\">GitHub</a>"
+                       "</nav></header>\n<div class=\"wiki-wrapper\">\n"
+                       "<div class=\"markdown-body\" id=\"wiki-body\">\n");
+
+  for (int c = 0; c < CATEGORIES; c++) {
+    strbuf_append(&page, "<h2><a id=\"user-content-c\" class=\"anchor\" "
+                         "href=\"#c\"></a>");
+    append_words(&page, c, 2);
+    strbuf_append(&page, "</h2>\n<ul>\n");
+
+    for (int p = 0; p < PACKAGES_PER_CATEGORY; p++) {
+      int n = c * PACKAGES_PER_CATEGORY + p;
+      snprintf(line, sizeof(line),
+               "<li><a href=\"https://github.com/author%d/package-%d\">"
+               "author%d/package-%d</a> - ",
+               n % 97, n, n % 97, n);
+      strbuf_append(&page, line);
+      append_words(&page, n, 6 + n % 7);
+      strbuf_append(&page, " &amp; more</li>\n");
+    }
+
+    strbuf_append(&page, "</ul>\n");
+  }
+
+  strbuf_append(&page, "</div>\n</div>\n<footer>&copy; GitHub</footer>"
+                       "</body></html>\n");
+  return strbuf_detach(&page);
+}
+
+static void free_packages(list_t *pkgs) {
+  list_iterator_t *it = list_iterator_new(pkgs, LIST_HEAD);
+  list_node_t *node = NULL;
+
+  while ((node = list_iterator_next(it))) {
+    wiki_package_free(node->val);
+  }
+
+  list_iterator_destroy(it);
+  list_destroy(pkgs);
+}
+
+static void parse_registry(void *data) {
+  list_t *pkgs = wiki_registry_parse(data);
+  if (!pkgs || CATEGORIES * PACKAGES_PER_CATEGORY != pkgs->len) {
+    fprintf(stderr, "failed to parse the registry\n");
+    exit(1);
+  }
+  free_packages(pkgs);
+}
+
+typedef struct {
+  clib_search_index_t *index;
+  char *terms[2];
+  int count;
+} search_t;
+
+static void query_index(void *data) {
+  search_t *search = data;
+  int found = 0;
+  free(clib_search_index_query(search->index, search->count, search->terms,
+                               &found));
+}
+
+static void rank_index(void *data) {
+  search_t *search = data;
+  int found = 0;
+  free(clib_search_index_rank(search->index, search->count, search->terms, 20,
+                              &found));
+}
+
+static void build_index(void *data) {
+  char *packages = NULL;
+  char *trigrams = NULL;
+
+  if (0 != clib_search_index_build(data, &packages, &trigrams)) {
+    fprintf(stderr, "failed to build the search index\n");
+    exit(1);
+  }
+
+  json_free_serialized_string(packages);
+  free(trigrams);
+}
+
+int main(void) {
+  char *page = registry_page();
+  list_t *pkgs = NULL;
+  char *packages = NULL;
+  char *trigrams = NULL;
+  search_t search = {0};
+
+  bench("wiki_registry_parse", parse_registry, page);
+
+  pkgs = wiki_registry_parse(page);
+  bench("clib_search_index_build", build_index, pkgs);
+
+  if (0 != clib_search_index_build(pkgs, &packages, &trigrams) ||
+      !(search.index = clib_search_index_parse(
+            packages, (fs_mapping){trigrams, strlen(trigrams), 0}))) {
+    fprintf(stderr, "failed to build the search index\n");
+    return 1;
+  }
+
+  search.terms[0] = "json";
+  search.count = 1;
+  bench("clib_search_index_query json", query_index, &search);
+
+  search.terms[1] = "buffer";
+  search.count = 2;
+  bench("clib_search_index_query json buffer", query_index, &search);
+
+  search.terms[0] = "strng";
+  search.count = 1;
+  bench("clib_search_index_rank strng", rank_index, &search);
+
+  clib_search_index_free(search.index);
+  json_free_serialized_string(packages);
+  free_packages(pkgs);
+  free(page);
+  return 0;
+}
@@ -0,0 +1,116 @@
+//
+// bench.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef BENCH_H
+#define BENCH_H 1
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Microbenchmarks of the hot paths of clib. Each one repeats an
+ * operation for about `BENCH_TIME` milliseconds, 500 by default, and
+ * prints the time one took and, when linked with `--wrap` for the
+ * allocator, the allocations clib made for it. Only the allocations of
+ * clib and its deps are counted, not those of libc or libcurl.
+ */
+
+typedef void (*bench_fn)(void *data);
+
+static unsigned long long bench_allocs = 0;
+static unsigned long long bench_bytes = 0;
+
+#ifdef BENCH_ALLOCS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static void bench_count(size_t size) {
+  __sync_fetch_and_add(&bench_allocs, 1);
+  __sync_fetch_and_add(&bench_bytes, size);
+}
+
+void *__wrap_malloc(size_t size) {
+  bench_count(size);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  bench_count(count * size);
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  bench_count(size);
+  return __real_realloc(ptr, size);
+}
+#endif
+
+static uint64_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Runs `fn` with `data` until it has taken the time budget, growing the
+ * number of runs from what the previous round took, and prints `name`
+ * with the cost of one run.
+ */
+
+static void bench(const char *name, bench_fn fn, void *data) {
+  const char *env = getenv("BENCH_TIME");
+  uint64_t budget = (env && atol(env) > 0 ? atol(env) : 500) * 1000000ULL;
+  unsigned long long allocs = 0;
+  unsigned long long bytes = 0;
+  uint64_t elapsed = 0;
+  long runs = 1;
+
+  // the first run fills caches and lazily created state
+  fn(data);
+
+  for (;;) {
+    allocs = bench_allocs;
+    bytes = bench_bytes;
+
+    uint64_t start = bench_now();
+    for (long i = 0; i < runs; i++) {
+      fn(data);
+    }
+    elapsed = bench_now() - start;
+
+    allocs = bench_allocs - allocs;
+    bytes = bench_bytes - bytes;
+
+    if (elapsed >= budget || runs >= 1000000000L) {
+      break;
+    }
+
+    // aim a little past the budget, growing at most a hundredfold
+    double next = elapsed ? 1.2 * runs * budget / elapsed : 100.0 * runs;
+    runs = next > 100.0 * runs ? 100 * runs
+           : next < runs + 1   ? runs + 1
+                               : (long)next;
+  }
+
+  printf("%-40s %10ld %14.0f ns/op", name, runs, (double)elapsed / runs);
+#ifdef BENCH_ALLOCS
+  printf(" %10.1f allocs/op %12.0f B/op", (double)allocs / runs,
+         (double)bytes / runs);
+#endif
+  printf("\n");
+  fflush(stdout);
+}
+
+#endif
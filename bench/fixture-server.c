@@ -0,0 +1,268 @@
+//
+// fixture-server.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "fixture-server.h"
+#include "fs/fs.h"
+#include "http-get/http-get.h"
+#include "mkdirp/mkdirp.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// bandwidth is spent in slices of this many milliseconds
+#define SLICE_MS 10
+
+static void send_status(int fd, const char *status) {
+  char header[256];
+  snprintf(header, sizeof(header),
+           "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+           status);
+  (void)!write(fd, header, strlen(header));
+}
+
+/**
+ * Writes `length` bytes of `buffer` to `fd`, no faster than `bandwidth`
+ * bytes a second when that is set.
+ *
+ * @return 0 on success, -1 when the client went away
+ */
+
+static int send_throttled(int fd, const char *buffer, size_t length,
+                          unsigned long bandwidth) {
+  size_t slice = bandwidth ? bandwidth * SLICE_MS / 1000 : length;
+  ssize_t n = 0;
+
+  if (0 == slice) {
+    slice = 1;
+  }
+
+  while (length > 0) {
+    size_t size = length < slice ? length : slice;
+    if (0 >= (n = write(fd, buffer, size))) {
+      return -1;
+    }
+    buffer += n;
+    length -= n;
+    if (bandwidth) {
+      usleep(SLICE_MS * 1000);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Fetches `url` from the upstream into `path`, through a file of its own
+ * so that a concurrent request never serves half of it.
+ *
+ * @return The status of the upstream response, or 0 on error
+ */
+
+static long record(const char *upstream, const char *url, const char *path) {
+  http_get_response_t *res = NULL;
+  char *location = NULL;
+  char *dir = NULL;
+  char *tmp = NULL;
+  long status = 0;
+
+  if (!(location = malloc(strlen(upstream) + strlen(url) + 1)) ||
+      !(tmp = malloc(strlen(path) + 32)) || !(dir = strdup(path))) {
+    goto cleanup;
+  }
+
+  sprintf(location, "%s%s", upstream, url);
+  sprintf(tmp, "%s.%d.tmp", path, (int)getpid());
+
+  if (!(res = http_get(location))) {
+    goto cleanup;
+  }
+
+  status = res->status;
+
+  if (res->ok) {
+    if (0 != mkdirp(dirname(dir), 0777) ||
+        -1 == fs_nwrite(tmp, res->data, res->size) || 0 != rename(tmp, path)) {
+      unlink(tmp);
+      status = 0;
+    }
+  }
+
+cleanup:
+  if (res) {
+    http_get_free(res);
+  }
+  free(location);
+  free(dir);
+  free(tmp);
+  return status;
+}
+
+/**
+ * Answers one request on `fd` with the file under `root` at its path,
+ * closing the connection after it.
+ */
+
+static void respond(int fd, fixture_server_opts_t opts, int fail) {
+  char request[4096];
+  char header[256];
+  char path[sizeof(request) + 256];
+  char *url = NULL;
+  char *end = NULL;
+  char *content = NULL;
+  size_t length = 0;
+  ssize_t n = 0;
+  struct stat stats;
+  long status = 0;
+
+  while (length < sizeof(request) - 1 &&
+         0 < (n = read(fd, request + length, sizeof(request) - 1 - length))) {
+    length += n;
+    request[length] = '\0';
+    if (strstr(request, "\r\n\r\n")) {
+      break;
+    }
+  }
+
+  request[length] = '\0';
+
+  if (opts.latency_ms) {
+    usleep(opts.latency_ms * 1000);
+  }
+
+  if (fail) {
+    send_status(fd, "503 Service Unavailable");
+    return;
+  }
+
+  if (0 != strncmp(request, "GET ", 4) || !(end = strpbrk(request + 4, " ?")) ||
+      strstr(request, "..")) {
+    send_status(fd, "400 Bad Request");
+    return;
+  }
+
+  *end = '\0';
+  url = request + 4;
+  while ('/' == url[0] && '/' == url[1]) {
+    url++;
+  }
+
+  snprintf(path, sizeof(path), "%s%s", opts.root, url);
+
+  if (opts.upstream && 0 != stat(path, &stats)) {
+    status = record(opts.upstream, url, path);
+    if (0 == status) {
+      send_status(fd, "502 Bad Gateway");
+      return;
+    }
+  }
+
+  if (0 != stat(path, &stats) || !S_ISREG(stats.st_mode) ||
+      !(content = fs_read(path))) {
+    send_status(fd, "404 Not Found");
+    return;
+  }
+
+  snprintf(header, sizeof(header),
+           "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\n"
+           "Connection: close\r\n\r\n",
+           (long long)stats.st_size);
+
+  if (0 == send_throttled(fd, header, strlen(header), 0)) {
+    send_throttled(fd, content, stats.st_size, opts.bandwidth);
+  }
+
+  free(content);
+}
+
+int fixture_server_listen(int port, int *bound) {
+  struct sockaddr_in address = {0};
+  socklen_t size = sizeof(address);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int yes = 1;
+
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+
+  if (-1 == fd) {
+    return -1;
+  }
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  if (0 != bind(fd, (struct sockaddr *)&address, sizeof(address)) ||
+      0 != listen(fd, 128) ||
+      0 != getsockname(fd, (struct sockaddr *)&address, &size)) {
+    close(fd);
+    return -1;
+  }
+
+  if (bound) {
+    *bound = ntohs(address.sin_port);
+  }
+
+  return fd;
+}
+
+void fixture_server_run(int fd, fixture_server_opts_t opts) {
+  unsigned int state = opts.seed;
+
+  // no zombies of the connections
+  signal(SIGCHLD, SIG_IGN);
+
+  for (;;) {
+    int client = accept(fd, NULL, NULL);
+    int fail = 0;
+
+    if (-1 == client) {
+      continue;
+    }
+
+    if (opts.requests) {
+      __sync_fetch_and_add(opts.requests, 1);
+    }
+
+    // drawn here, in the order of the connections, so that a seed fails
+    // the same ones every time
+    state = state * 1103515245 + 12345;
+    fail = opts.error_rate && (state >> 16) % 100 < opts.error_rate;
+
+    if (0 == fork()) {
+      close(fd);
+      respond(client, opts, fail);
+      close(client);
+      _exit(0);
+    }
+
+    close(client);
+  }
+}
+
+pid_t fixture_server_start(fixture_server_opts_t opts, int *port) {
+  int fd = fixture_server_listen(0, port);
+  pid_t pid = -1;
+
+  if (-1 == fd) {
+    return -1;
+  }
+
+  if (0 == (pid = fork())) {
+    fixture_server_run(fd, opts);
+    _exit(0);
+  }
+
+  close(fd);
+  return pid;
+}
@@ -0,0 +1,60 @@
+//
+// fixture-server.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef FIXTURE_SERVER_H
+#define FIXTURE_SERVER_H 1
+
+#include <sys/types.h>
+
+/**
+ * A server of the files under `root` as a mirror of
+ * raw.githubusercontent.com, for installs that don't leave the machine.
+ *
+ * With an `upstream`, what is missing is fetched from there and recorded
+ * under `root` first. Every response waits `latency_ms`, is sent at no
+ * more than `bandwidth` bytes a second when that is set, and fails with a
+ * 503 for `error_rate` percent of the connections, picked by `seed` in
+ * the order they come in. Each connection takes one request, counted
+ * into `*requests` when it's set, which is to be in memory shared with
+ * whoever reads it, the server running in a process of its own.
+ */
+
+typedef struct {
+  const char *root;
+  const char *upstream;
+  unsigned int latency_ms;
+  unsigned long bandwidth;
+  unsigned int error_rate;
+  unsigned int seed;
+  unsigned long *requests;
+} fixture_server_opts_t;
+
+/**
+ * Listens on `port` of the loopback interface, any free one when 0,
+ * storing the one it got in `bound`.
+ *
+ * @return The socket, or -1 on error
+ */
+
+int fixture_server_listen(int port, int *bound);
+
+/**
+ * Answers the connections to `fd` until the process is ended, each in a
+ * process of its own.
+ */
+
+void fixture_server_run(int fd, fixture_server_opts_t opts);
+
+/**
+ * Starts a server on a free port, in a process of its own.
+ *
+ * @return The process, or -1 on error
+ */
+
+pid_t fixture_server_start(fixture_server_opts_t opts, int *port);
+
+#endif
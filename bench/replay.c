@@ -0,0 +1,85 @@
+//
+// replay.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "commander/commander.h"
+#include "fixture-server.h"
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define GITHUB_CONTENT "https://raw.githubusercontent.com"
+
+static fixture_server_opts_t opts = {0};
+static int port = 0;
+
+static void setopt_record(command_t *self) { opts.upstream = GITHUB_CONTENT; }
+
+static void setopt_port(command_t *self) { port = atoi(self->arg); }
+
+static void setopt_latency(command_t *self) {
+  opts.latency_ms = strtoul(self->arg, NULL, 10);
+}
+
+static void setopt_bandwidth(command_t *self) {
+  opts.bandwidth = strtoul(self->arg, NULL, 10);
+}
+
+static void setopt_errors(command_t *self) {
+  opts.error_rate = strtoul(self->arg, NULL, 10);
+}
+
+static void setopt_seed(command_t *self) {
+  opts.seed = strtoul(self->arg, NULL, 10);
+}
+
+int main(int argc, char **argv) {
+  command_t program;
+  int bound = 0;
+  int fd = -1;
+
+  command_init(&program, "replay", "0.0.0");
+  program.usage = "[options] <dir>";
+
+  command_option(&program, "-r", "--record",
+                 "fetch what is missing from GitHub and keep it", setopt_record);
+  command_option(&program, "-p", "--port <port>",
+                 "listen on <port> (default: any free one)", setopt_port);
+  command_option(&program, "-l", "--latency <ms>",
+                 "wait <ms> before every response", setopt_latency);
+  command_option(&program, "-b", "--bandwidth <bytes>",
+                 "send no more than <bytes> a second", setopt_bandwidth);
+  command_option(&program, "-e", "--errors <percent>",
+                 "fail <percent> of the requests with a 503", setopt_errors);
+  command_option(&program, "-s", "--seed <number>",
+                 "pick the failing requests with <number>", setopt_seed);
+
+  command_parse(&program, argc, argv);
+
+  if (1 != program.argc) {
+    command_help(&program);
+  }
+
+  opts.root = program.argv[0];
+
+  if (opts.upstream) {
+    curl_global_init(CURL_GLOBAL_ALL);
+  }
+
+  if (-1 == (fd = fixture_server_listen(port, &bound))) {
+    perror("listen");
+    command_free(&program);
+    return 1;
+  }
+
+  // what CLIB_MIRRORS is to be set to
+  printf("http://127.0.0.1:%d\n", bound);
+  fflush(stdout);
+
+  fixture_server_run(fd, opts);
+  command_free(&program);
+  return 0;
+}
@@ -0,0 +1,594 @@
+//
+// scale.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _DEFAULT_SOURCE
+
+#include "commander/commander.h"
+#include "fixture-server.h"
+#include "fs/fs.h"
+#include "mkdirp/mkdirp.h"
+#include "rimraf/rimraf.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// what the packages are called, as "scale/pkg-<n>"
+#define AUTHOR "scale"
+
+// every generated package builds its sources with this
+#define MAKEFILE                                                               \
+  "OBJS = $(patsubst %.c,%.o,$(wildcard *.c))\n"                               \
+  "\n"                                                                         \
+  "all: $(OBJS)\n"
+
+static struct {
+  const char *packages;
+  const char *concurrency;
+  const char *bin;
+  int depth;
+  int fan_out;
+  int shared;
+  int files;
+  int file_size;
+  unsigned int seed;
+  int keep;
+  int verbose;
+} opts = {"10,100,1000", "1,4,16", "..", 6, 4, 30, 4, 1024, 1, 0, 0};
+
+static fixture_server_opts_t server = {0};
+
+// the binaries of `opts.bin`, made absolute
+static char bin[PATH_MAX];
+
+static char root[] = "/tmp/clib-scale-XXXXXX";
+
+/**
+ * The project and the packages of a generated registry, the project
+ * being the first, at level 0.
+ */
+typedef struct {
+  int count;
+  int *level;
+  int *deps; // `opts.fan_out` a package, the first `deps_count` used
+  int *deps_count;
+  int edges;
+  int shared;
+} graph_t;
+
+typedef struct {
+  double wall_ms;
+  unsigned long requests;
+  long rss_kb;
+  int rc;
+} result_t;
+
+static void setopt_packages(command_t *self) { opts.packages = self->arg; }
+
+static void setopt_concurrency(command_t *self) {
+  opts.concurrency = self->arg;
+}
+
+static void setopt_bin(command_t *self) { opts.bin = self->arg; }
+
+static void setopt_depth(command_t *self) { opts.depth = atoi(self->arg); }
+
+static void setopt_fan_out(command_t *self) {
+  opts.fan_out = atoi(self->arg);
+}
+
+static void setopt_shared(command_t *self) { opts.shared = atoi(self->arg); }
+
+static void setopt_files(command_t *self) { opts.files = atoi(self->arg); }
+
+static void setopt_file_size(command_t *self) {
+  opts.file_size = atoi(self->arg);
+}
+
+static void setopt_seed(command_t *self) {
+  opts.seed = strtoul(self->arg, NULL, 10);
+}
+
+static void setopt_latency(command_t *self) {
+  server.latency_ms = strtoul(self->arg, NULL, 10);
+}
+
+static void setopt_bandwidth(command_t *self) {
+  server.bandwidth = strtoul(self->arg, NULL, 10);
+}
+
+static void setopt_keep(command_t *self) { opts.keep = 1; }
+
+static void setopt_verbose(command_t *self) { opts.verbose = 1; }
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @return The next number of the sequence `opts.seed` starts, so that a
+ * seed makes the same registry every time
+ */
+
+static unsigned int next_random(void) {
+  opts.seed = opts.seed * 1103515245 + 12345;
+  return (opts.seed >> 16) & 0x7fff;
+}
+
+static int has_dep(graph_t *graph, int package, int dep) {
+  for (int i = 0; i < graph->deps_count[package]; i++) {
+    if (dep == graph->deps[package * opts.fan_out + i]) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Makes a graph of up to `count` packages, level by level: each package
+ * above `opts.depth` depends on `opts.fan_out` packages of the level
+ * below it, `opts.shared` percent of them being ones that another
+ * package of its level depends on already, the others new. Fewer
+ * packages are made when depth and fan-out don't leave room for `count`.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int make_graph(graph_t *graph, int count) {
+  size_t size = (size_t)count + 1;
+  int *first = NULL; // of each level
+  int total = 1;
+
+  memset(graph, 0, sizeof(*graph));
+  graph->level = calloc(size, sizeof(int));
+  graph->deps = calloc(size * opts.fan_out, sizeof(int));
+  graph->deps_count = calloc(size, sizeof(int));
+  first = calloc(opts.depth + 2, sizeof(int));
+
+  if (!graph->level || !graph->deps || !graph->deps_count || !first) {
+    free(first);
+    return -1;
+  }
+
+  for (int i = 0; i < opts.depth + 2; i++) {
+    first[i] = -1;
+  }
+
+  // the packages are made in the order of their levels, so a level is
+  // the range from its first package up to the last one made
+  for (int package = 0; package < total && total < (int)size; package++) {
+    int below = graph->level[package] + 1;
+
+    if (below > opts.depth) {
+      break;
+    }
+
+    for (int i = 0; i < opts.fan_out && total < (int)size; i++) {
+      int dep = -1;
+
+      if (-1 != first[below] && (int)(next_random() % 100) < opts.shared) {
+        dep = first[below] + (int)(next_random() % (total - first[below]));
+        dep = has_dep(graph, package, dep) ? -1 : dep;
+        graph->shared += -1 != dep;
+      }
+
+      if (-1 == dep) {
+        dep = total++;
+        graph->level[dep] = below;
+        if (-1 == first[below]) {
+          first[below] = dep;
+        }
+      }
+
+      graph->deps[package * opts.fan_out + graph->deps_count[package]++] =
+          dep;
+      graph->edges++;
+    }
+  }
+
+  graph->count = total;
+  free(first);
+  return 0;
+}
+
+static void free_graph(graph_t *graph) {
+  free(graph->level);
+  free(graph->deps);
+  free(graph->deps_count);
+}
+
+/**
+ * Writes the manifest of `package` to `path`, with the sources, makefile
+ * and configure command of a generated package unless it's the project.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int write_manifest(graph_t *graph, int package, const char *path) {
+  FILE *file = fopen(path, "w");
+  int rc = 0;
+
+  if (!file) {
+    return -1;
+  }
+
+  if (0 == package) {
+    fprintf(file, "{\"name\":\"scale\",\"version\":\"0.0.0\","
+                  "\"repo\":\"" AUTHOR "/project\",\"src\":[]");
+  } else {
+    fprintf(file,
+            "{\"name\":\"pkg-%d\",\"version\":\"1.0.0\","
+            "\"repo\":\"" AUTHOR "/pkg-%d\",\"makefile\":\"Makefile\","
+            "\"configure\":\"true\",\"src\":[",
+            package, package);
+
+    for (int i = 0; i < opts.files; i++) {
+      fprintf(file, "%s\"src/pkg-%d-%d.c\"", i ? "," : "", package, i);
+    }
+
+    fprintf(file, "]");
+  }
+
+  fprintf(file, ",\"dependencies\":{");
+
+  for (int i = 0; i < graph->deps_count[package]; i++) {
+    fprintf(file, "%s\"" AUTHOR "/pkg-%d\":\"1.0.0\"", i ? "," : "",
+            graph->deps[package * opts.fan_out + i]);
+  }
+
+  fprintf(file, "}}\n");
+
+  if (ferror(file)) {
+    rc = -1;
+  }
+
+  return 0 == fclose(file) ? rc : -1;
+}
+
+/**
+ * Writes a source of `opts.file_size` bytes or so, a function padded
+ * with a comment.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int write_source(const char *path, int package, int index) {
+  FILE *file = fopen(path, "w");
+  long written = 0;
+  int rc = 0;
+
+  if (!file) {
+    return -1;
+  }
+
+  written = fprintf(file, "int pkg_%d_%d(void) { return %d; }\n/*\n",
+                    package, index, index);
+
+  for (; written < opts.file_size - 3; written += 64) {
+    fprintf(file, "%.63s\n",
+            "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+  }
+
+  fprintf(file, "*/\n");
+
+  if (ferror(file)) {
+    rc = -1;
+  }
+
+  return 0 == fclose(file) ? rc : -1;
+}
+
+/**
+ * Lays out the packages of `graph` under `fixtures` where a mirror of
+ * raw.githubusercontent.com would have them.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int write_registry(graph_t *graph, const char *fixtures) {
+  char path[256];
+
+  for (int package = 1; package < graph->count; package++) {
+    snprintf(path, sizeof(path), "%s/" AUTHOR "/pkg-%d/1.0.0/src", fixtures,
+             package);
+
+    if (0 != mkdirp(path, 0777)) {
+      return -1;
+    }
+
+    for (int i = 0; i < opts.files; i++) {
+      snprintf(path, sizeof(path),
+               "%s/" AUTHOR "/pkg-%d/1.0.0/src/pkg-%d-%d.c", fixtures,
+               package, package, i);
+
+      if (0 != write_source(path, package, i)) {
+        return -1;
+      }
+    }
+
+    snprintf(path, sizeof(path), "%s/" AUTHOR "/pkg-%d/1.0.0/Makefile",
+             fixtures, package);
+
+    if (-1 == fs_write(path, MAKEFILE)) {
+      return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/" AUTHOR "/pkg-%d/1.0.0/clib.json",
+             fixtures, package);
+
+    if (0 != write_manifest(graph, package, path)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Runs the command `name` of `bin` in `dir` with `concurrency` and
+ * `HOME` set to `home`, and measures it: its wall time, the requests the
+ * server got meanwhile and its peak RSS, along with what it ran.
+ *
+ * @return 0 when it could be run, -1 otherwise
+ */
+
+static int run(const char *name, int concurrency, const char *dir,
+               const char *home, result_t *result) {
+  char command[PATH_MAX + 16];
+  char jobs[16];
+  char *argv[] = {command, "--concurrency", jobs, NULL};
+  unsigned long requests = __sync_fetch_and_add(server.requests, 0);
+  struct rusage usage;
+  double started = now_ms();
+  int status = 0;
+  pid_t pid = 0;
+
+  snprintf(command, sizeof(command), "%s/clib-%s", bin, name);
+  snprintf(jobs, sizeof(jobs), "%d", concurrency);
+
+  fflush(NULL);
+
+  if (-1 == (pid = fork())) {
+    return -1;
+  }
+
+  if (0 == pid) {
+    if (0 != chdir(dir)) {
+      _exit(127);
+    }
+
+    setenv("HOME", home, 1);
+
+    if (!opts.verbose) {
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+    }
+
+    execv(command, argv);
+    _exit(127);
+  }
+
+  memset(&usage, 0, sizeof(usage));
+
+  if (-1 == wait4(pid, &status, 0, &usage)) {
+    return -1;
+  }
+
+  result->wall_ms = now_ms() - started;
+  result->requests = __sync_fetch_and_add(server.requests, 0) - requests;
+#ifdef __APPLE__
+  result->rss_kb = usage.ru_maxrss / 1024;
+#else
+  result->rss_kb = usage.ru_maxrss;
+#endif
+  result->rc = WIFEXITED(status) ? WEXITSTATUS(status) : 128;
+  return 0;
+}
+
+/**
+ * Installs, configures and builds the project of a registry of `count`
+ * packages, from scratch with each of the concurrencies, printing a line
+ * for each command.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int measure(int count) {
+  static const char *commands[] = {"install", "configure", "build"};
+  char fixtures[64];
+  char project[64];
+  char home[80];
+  char manifest[80];
+  char mirror[64];
+  const char *p = opts.concurrency;
+  graph_t graph;
+  pid_t pid = -1;
+  int port = 0;
+  int rc = -1;
+
+  if (0 != make_graph(&graph, count)) {
+    free_graph(&graph);
+    return -1;
+  }
+
+  snprintf(fixtures, sizeof(fixtures), "%s/registry-%d", root, count);
+
+  if (0 != write_registry(&graph, fixtures)) {
+    fprintf(stderr, "unable to write the registry in %s\n", fixtures);
+    goto cleanup;
+  }
+
+  printf("# %d packages, %d dependencies, %d of them shared\n",
+         graph.count - 1, graph.edges, graph.shared);
+
+  server.root = fixtures;
+  if (-1 == (pid = fixture_server_start(server, &port))) {
+    perror("serve");
+    goto cleanup;
+  }
+
+  snprintf(mirror, sizeof(mirror), "http://127.0.0.1:%d", port);
+  setenv("CLIB_MIRRORS", mirror, 1);
+
+  while (*p) {
+    int concurrency = atoi(p);
+
+    snprintf(project, sizeof(project), "%s/project-%d-%d", root, count,
+             concurrency);
+    snprintf(home, sizeof(home), "%s/home", project);
+    snprintf(manifest, sizeof(manifest), "%s/clib.json", project);
+
+    // a cache of its own, cold
+    if (0 != mkdirp(home, 0777) || 0 != write_manifest(&graph, 0, manifest)) {
+      fprintf(stderr, "unable to write the project in %s\n", project);
+      goto cleanup;
+    }
+
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+      result_t result;
+
+      if (0 != run(commands[i], concurrency, project, home, &result)) {
+        perror(commands[i]);
+        goto cleanup;
+      }
+
+      printf("%8d %11d  %-9s %10.1f %8lu %11ld %3d\n", graph.count - 1,
+             concurrency, commands[i], result.wall_ms, result.requests,
+             result.rss_kb, result.rc);
+      fflush(stdout);
+    }
+
+    p += strcspn(p, ",");
+    p += ',' == *p;
+  }
+
+  rc = 0;
+
+cleanup:
+  if (pid > 0) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+  }
+
+  free_graph(&graph);
+  return rc;
+}
+
+int main(int argc, char **argv) {
+  command_t program;
+  char install[PATH_MAX + 16];
+  const char *p = NULL;
+  int rc = 1;
+
+  command_init(&program, "scale", "0.0.0");
+  program.usage = "[options]";
+
+  command_option(&program, "-n", "--packages <n,...>",
+                 "sizes of the registries (default: 10,100,1000)",
+                 setopt_packages);
+  command_option(&program, "-C", "--concurrency <n,...>",
+                 "concurrencies to run the commands with (default: 1,4,16)",
+                 setopt_concurrency);
+  command_option(&program, "-d", "--depth <n>",
+                 "levels of dependencies at most (default: 6)", setopt_depth);
+  command_option(&program, "-f", "--fan-out <n>",
+                 "dependencies of each package (default: 4)", setopt_fan_out);
+  command_option(&program, "-s", "--shared <percent>",
+                 "dependencies on a package depended on already "
+                 "(default: 30)",
+                 setopt_shared);
+  command_option(&program, "-F", "--files <n>",
+                 "sources of each package (default: 4)", setopt_files);
+  command_option(&program, "-S", "--file-size <bytes>",
+                 "size of each source (default: 1024)", setopt_file_size);
+  command_option(&program, "-r", "--seed <number>",
+                 "make the registry with <number> (default: 1)", setopt_seed);
+  command_option(&program, "-l", "--latency <ms>",
+                 "wait <ms> before every response", setopt_latency);
+  command_option(&program, "-b", "--bandwidth <bytes>",
+                 "send no more than <bytes> a second", setopt_bandwidth);
+  command_option(&program, "-B", "--bin <dir>",
+                 "where the clib commands are (default: ..)", setopt_bin);
+  command_option(&program, "-k", "--keep",
+                 "keep the registries and projects", setopt_keep);
+  command_option(&program, "-v", "--verbose",
+                 "show the output of the commands", setopt_verbose);
+
+  command_parse(&program, argc, argv);
+
+  if (opts.depth < 1 || opts.fan_out < 1 || opts.files < 0 ||
+      opts.shared < 0 || opts.shared > 100) {
+    command_help(&program);
+  }
+
+  snprintf(install, sizeof(install), "%s/clib-install", opts.bin);
+
+  if (!realpath(opts.bin, bin) || 0 != access(install, X_OK)) {
+    fprintf(stderr, "no clib commands in %s, build them first\n", opts.bin);
+    command_free(&program);
+    return 1;
+  }
+
+  // counted by the server, which runs in a process of its own
+  server.requests = mmap(NULL, sizeof(unsigned long), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (MAP_FAILED == server.requests || NULL == mkdtemp(root)) {
+    perror("scale");
+    command_free(&program);
+    return 1;
+  }
+
+  // every request goes to the registry, and from this process
+  setenv("CLIB_MIRRORS_ONLY", "1", 1);
+  setenv("CLIB_NO_DAEMON", "1", 1);
+
+  printf("%8s %11s  %-9s %10s %8s %11s %3s\n", "packages", "concurrency",
+         "command", "wall ms", "requests", "peak RSS KB", "rc");
+
+  for (p = opts.packages; *p;) {
+    if (0 != measure(atoi(p))) {
+      goto cleanup;
+    }
+
+    p += strcspn(p, ",");
+    p += ',' == *p;
+  }
+
+  rc = 0;
+
+cleanup:
+  if (opts.keep) {
+    fprintf(stderr, "kept %s\n", root);
+  } else {
+    rimraf(root);
+  }
+
+  command_free(&program);
+  return rc;
+}
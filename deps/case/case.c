@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include "str-find/str-find.h"
 #include "case.h"
 
 #define CASE_MODIFIER     0x20
@@ -52,3 +53,8 @@ case_camel(char *str) {
 
   return str;
 }
+
+char *
+case_find(const char *str, const char *sub) {
+  return (char *) str_case_find(str, strlen(str), sub, strlen(sub));
+}
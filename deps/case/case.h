@@ -19,4 +19,13 @@ case_lower(char *);
 char *
 case_camel(char *);
 
+/**
+ * Finds `sub` in `str` ignoring the case of ASCII letters, without
+ * copying either.
+ *
+ * @return The first occurrence in `str`, or NULL
+ */
+char *
+case_find(const char *str, const char *sub);
+
 #endif
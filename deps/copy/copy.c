@@ -1,65 +1,178 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "dir-iter/dir-iter.h"
 #include "fs/fs.h"
-#include "tinydir/tinydir.h"
 #include "copy.h"
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
-#define is_dot_file(file) 0 == strcmp(".", file.name) || 0 == strcmp("..", file.name)
-#define check_err(x) if (0 != (err = x)) break;
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
 
+#if defined(__APPLE__)
+#include <copyfile.h>
+#endif
 
-int copy_file(char *from, char *to)
+
+#define COPY_BUFFER_SIZE 65536
+
+
+/**
+ * Plain buffered copy, binary safe on every platform
+ */
+static int copy_stream(FILE *from, FILE *to)
 {
-    char *content = fs_read(from);
-    if (!content) {
-        return -1;
+    char buffer[COPY_BUFFER_SIZE];
+    size_t n;
+
+    while ((n = fread(buffer, 1, sizeof(buffer), from)) > 0) {
+        if (n != fwrite(buffer, 1, n, to)) {
+            return -1;
+        }
     }
-    fs_write(to, content);
-    free(content);
 
-    return 0;
+    return ferror(from) ? -1 : 0;
 }
 
-static void check_dir(char *dir)
+#if defined(__linux__)
+/**
+ * Copy in the kernel, with copy_file_range() where the kernel has it
+ * (which also reflinks on file systems that support it) and sendfile()
+ * otherwise.
+ *
+ * @return 0 on success, 1 if the caller should fall back to a plain copy
+ *         of the remaining bytes, -1 on error
+ */
+static int copy_kernel(int in, int out, off_t size)
 {
-    if (0 != fs_exists(dir)) {
-        fs_mkdir(dir, 0700);
+    off_t left = size;
+
+#if defined(SYS_copy_file_range)
+    while (left > 0) {
+        ssize_t n = syscall(SYS_copy_file_range, in, NULL, out, NULL, (size_t)left, 0);
+
+        if (n < 0) {
+            if (EINTR == errno) continue;
+            if (ENOSYS == errno || EXDEV == errno || EINVAL == errno || EOPNOTSUPP == errno) break;
+            return -1;
+        }
+
+        // the source shrank under us
+        if (0 == n) return 0;
+        left -= n;
+    }
+#endif
+
+    while (left > 0) {
+        ssize_t n = sendfile(out, in, NULL, (size_t)left);
+
+        if (n < 0) {
+            if (EINTR == errno) continue;
+            if (ENOSYS == errno || EINVAL == errno) return 1;
+            return -1;
+        }
+
+        if (0 == n) return 0;
+        left -= n;
     }
+
+    return 0;
 }
+#endif
 
-static int copy(tinydir_file file, char *target_dir)
+int copy_file(char *from, char *to)
 {
-    char target_path[strlen(target_dir) + strlen(file.name) + 2];
+#if defined(__APPLE__)
+    // clones on APFS, copies elsewhere, and keeps the mode bits
+    return 0 == copyfile(from, to, NULL, COPYFILE_DATA | COPYFILE_STAT | COPYFILE_CLONE) ? 0 : -1;
+#else
+    struct stat st;
+    int err = 0;
+    FILE *in = fopen(from, "rb");
+    FILE *out = NULL;
+
+    if (!in) {
+        return -1;
+    }
+
+    if (0 != fstat(fileno(in), &st) || !(out = fopen(to, "wb"))) {
+        fclose(in);
+        return -1;
+    }
+
+#if defined(__linux__)
+    err = copy_kernel(fileno(in), fileno(out), st.st_size);
+
+    // the offsets moved along with the kernel copy
+    if (1 == err) {
+        err = copy_stream(in, out);
+    }
+#else
+    err = copy_stream(in, out);
+#endif
 
-    sprintf(target_path, "%s/%s", target_dir, file.name);
+#ifndef _WIN32
+    if (0 == err && 0 != fchmod(fileno(out), st.st_mode & 07777)) {
+        err = -1;
+    }
+#else
+    if (0 == err) {
+        chmod(to, st.st_mode & (S_IREAD | S_IWRITE));
+    }
+#endif
 
-    if (file.is_dir) {
-        return copy_dir(file.path, target_path);
+    fclose(in);
+    if (0 != fclose(out)) {
+        err = -1;
     }
 
-    return copy_file(file.path, target_path);
+    return err;
+#endif
+}
+
+static void check_dir(char *dir)
+{
+    if (0 != fs_exists(dir)) {
+        fs_mkdir(dir, 0700);
+    }
 }
 
 int copy_dir(char *dir_path, char *target_dir)
 {
+    size_t dir_len = strlen(dir_path);
+    size_t target_len = strlen(target_dir);
+    dir_iter_t dir;
     int err = 0;
-    tinydir_dir dir;
-    tinydir_file file;
-    tinydir_open(&dir, dir_path);
+
+    if (0 != dir_iter_open(&dir, dir_path)) {
+        return -1;
+    }
     check_dir(target_dir);
 
-    while (dir.has_next) {
-        check_err(tinydir_readfile(&dir, &file));
+    while (0 == err && dir_iter_next(&dir)) {
+        size_t len = strlen(dir.name);
+        char path[dir_len + len + 2];
+        char target_path[target_len + len + 2];
 
-        if (is_dot_file(file)) {
-            goto next;
-        }
-        check_err(copy(file, target_dir));
+        sprintf(path, "%s/%s", dir_path, dir.name);
+        sprintf(target_path, "%s/%s", target_dir, dir.name);
 
-        next:
-        check_err(tinydir_next(&dir));
+        err = dir.is_dir
+            ? copy_dir(path, target_path)
+            : copy_file(path, target_path);
     }
-    tinydir_close(&dir);
+    dir_iter_close(&dir);
 
     return err;
 }
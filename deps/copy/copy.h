@@ -3,7 +3,8 @@
 
 
 /**
- *  Copies one file
+ *  Copies one file, binary safe and keeping its mode bits. Uses
+ *  copy_file_range(2)/sendfile(2) on Linux and copyfile(3) on macOS.
  *
  *  @example copy_file("./dir/file.txt", "./target_dir/file.txt");
  *           "./target_dir/file.txt" will be created if it doesn't exist
@@ -0,0 +1,104 @@
+//
+// dir-iter.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "dir-iter.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+#define is_dot(name) ('.' == (name)[0] \
+  && (0 == (name)[1] || ('.' == (name)[1] && 0 == (name)[2])))
+
+#ifdef _WIN32
+
+int
+dir_iter_open(dir_iter_t *iter, const char *path) {
+  size_t len = strlen(path);
+  char pattern[MAX_PATH];
+
+  memset(iter, 0, sizeof(dir_iter_t));
+  if (len + 3 > sizeof(pattern)) return -1;
+  memcpy(pattern, path, len);
+  memcpy(pattern + len, "\\*", 3);
+
+  // no short names, and bigger batches from the file system
+  iter->handle = FindFirstFileExA(pattern, FindExInfoBasic, &iter->data,
+                                  FindExSearchNameMatch, NULL,
+                                  FIND_FIRST_EX_LARGE_FETCH);
+  if (INVALID_HANDLE_VALUE == iter->handle) return -1;
+  iter->first = 1;
+  return 0;
+}
+
+int
+dir_iter_next(dir_iter_t *iter) {
+  for (;;) {
+    if (!iter->first && !FindNextFileA(iter->handle, &iter->data)) return 0;
+    iter->first = 0;
+    if (is_dot(iter->data.cFileName)) continue;
+    iter->name = iter->data.cFileName;
+    iter->is_dir = (iter->data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      && !(iter->data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
+    return 1;
+  }
+}
+
+void
+dir_iter_close(dir_iter_t *iter) {
+  if (INVALID_HANDLE_VALUE != iter->handle) FindClose(iter->handle);
+  iter->handle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+int
+dir_iter_open(dir_iter_t *iter, const char *path) {
+  memset(iter, 0, sizeof(dir_iter_t));
+  iter->dir = opendir(path);
+  return NULL == iter->dir ? -1 : 0;
+}
+
+int
+dir_iter_next(dir_iter_t *iter) {
+  struct dirent *entry = NULL;
+  struct stat st;
+
+  while ((entry = readdir(iter->dir))) {
+    if (is_dot(entry->d_name)) continue;
+    iter->name = entry->d_name;
+#ifdef DT_UNKNOWN
+    if (DT_UNKNOWN != entry->d_type) {
+      iter->is_dir = DT_DIR == entry->d_type;
+      return 1;
+    }
+#endif
+    // only some file systems leave it to us
+    if (0 != fstatat(dirfd(iter->dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+      return 0;
+    }
+    iter->is_dir = S_ISDIR(st.st_mode);
+    return 1;
+  }
+
+  return 0;
+}
+
+void
+dir_iter_close(dir_iter_t *iter) {
+  if (iter->dir) closedir(iter->dir);
+  iter->dir = NULL;
+}
+
+#endif
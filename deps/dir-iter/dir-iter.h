@@ -0,0 +1,54 @@
+//
+// dir-iter.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef DIR_ITER_H
+#define DIR_ITER_H 1
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+/*
+ * The entries of a directory, told apart from the listing itself
+ * wherever the system says what they are, rather than with a stat()
+ * of each. Links are never followed.
+ */
+
+typedef struct {
+#ifdef _WIN32
+  HANDLE handle;
+  WIN32_FIND_DATAA data;
+  int first;
+#else
+  DIR *dir;
+#endif
+  const char *name;
+  int is_dir;
+} dir_iter_t;
+
+/*
+ * Start listing `path`. -1 on failure.
+ */
+
+int
+dir_iter_open(dir_iter_t *iter, const char *path);
+
+/*
+ * Move to the next entry, skipping "." and "..", and fill in `name`,
+ * which lasts until the next call, and `is_dir`. 0 at the end or on
+ * failure, 1 otherwise.
+ */
+
+int
+dir_iter_next(dir_iter_t *iter);
+
+void
+dir_iter_close(dir_iter_t *iter);
+
+#endif
@@ -15,6 +15,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 #include "fs.h"
 
 void
@@ -86,14 +91,14 @@ fs_lstat (const char *path) {
 
 
 int
-fs_ftruncate (FILE *file, int len) {
+fs_ftruncate (FILE *file, size_t len) {
   int fd = fileno(file);
   return ftruncate(fd, (off_t) len);
 }
 
 
 int
-fs_truncate (const char *path, int len) {
+fs_truncate (const char *path, size_t len) {
 #ifdef _WIN32
   int ret = -1;
   int fd = open(path, O_RDWR | O_CREAT, S_IREAD | S_IWRITE);
@@ -144,25 +149,80 @@ fs_lchown (const char *path, int uid, int gid) {
 
 size_t
 fs_size (const char *path) {
-  size_t size;
-  FILE *file = fs_open(path, FS_OPEN_READ);
-  if (NULL == file) return -1;
-  fseek(file, 0, SEEK_END);
-  size = ftell(file);
-  fs_close(file);
-  return size;
+  fs_stats stats;
+  if (-1 == stat(path, &stats)) return -1;
+  return (size_t) stats.st_size;
 }
 
 
 size_t
 fs_fsize (FILE *file) {
-  // store current position
-  unsigned long pos = ftell(file);
-  rewind(file);
-  fseek(file, 0, SEEK_END);
-  size_t size = ftell(file);
-  fseek(file, pos, SEEK_SET);
-  return size;
+  fs_stats stats;
+  if (-1 == fstat(fileno(file), &stats)) return -1;
+  return (size_t) stats.st_size;
+}
+
+
+/*
+ * Reads up to `len` bytes into `buffer`,
+ * going on after short reads and interrupts.
+ * Stops short only at the end of the file or
+ * on an error, which `ferror()` tells apart
+ */
+
+static size_t
+fs_fread_all (FILE *file, char *buffer, size_t len) {
+  size_t n = 0;
+  while (n < len) {
+    n += fread(buffer + n, 1, len - n, file);
+    if (n == len || feof(file)) break;
+    if (ferror(file)) {
+      if (EINTR != errno) break;
+      clearerr(file);
+    }
+  }
+  return n;
+}
+
+
+/*
+ * Reads the rest of a file, sized by `fstat()`
+ * up front so a regular file takes a single
+ * pass, and grown for anything that isn't
+ */
+
+static char *
+fs_fread_size (FILE *file, size_t *size) {
+  fs_stats stats;
+  size_t cap = BUFSIZ;
+  size_t len = 0;
+
+  // one more than the size, so the end is found in the same pass
+  if (0 == fstat(fileno(file), &stats) && stats.st_size > 0) {
+    cap = (size_t) stats.st_size + 1;
+  }
+
+  char *buffer = (char*) malloc(cap + 1);
+  if (NULL == buffer) return NULL;
+
+  while ((len += fs_fread_all(file, buffer + len, cap - len)) == cap) {
+    char *grown = (char*) realloc(buffer, cap * 2 + 1);
+    if (NULL == grown) {
+      free(buffer);
+      return NULL;
+    }
+    buffer = grown;
+    cap *= 2;
+  }
+
+  if (ferror(file)) {
+    free(buffer);
+    return NULL;
+  }
+
+  buffer[len] = '\0';
+  if (NULL != size) *size = len;
+  return buffer;
 }
 
 
@@ -177,7 +237,7 @@ fs_read (const char *path) {
 
 
 char *
-fs_nread (const char *path, int len) {
+fs_nread (const char *path, size_t len) {
   FILE *file = fs_open(path, FS_OPEN_READ);
   if (NULL == file) return NULL;
   char *buffer = fs_fnread(file, len);
@@ -186,47 +246,158 @@ fs_nread (const char *path, int len) {
 }
 
 
+ssize_t
+fs_read_into (const char *path, char *buffer, size_t size) {
+  if (0 == size) return -1;
+  FILE *file = fs_open(path, FS_OPEN_READ);
+  if (NULL == file) return -1;
+  size_t n = fs_fread_all(file, buffer, size - 1);
+  int failed = ferror(file);
+  fs_close(file);
+  if (failed) return -1;
+  buffer[n] = '\0';
+  return (ssize_t) n;
+}
+
+
 char *
 fs_fread (FILE *file) {
-  size_t fsize = fs_fsize(file);
-  return fs_fnread(file, fsize);
+  return fs_fread_size(file, NULL);
 }
 
 
 char *
-fs_fnread (FILE *file, int len) {
+fs_fnread (FILE *file, size_t len) {
   char *buffer = (char*) malloc(sizeof(char) * (len + 1));
-  size_t n = fread(buffer, 1, len, file);
+  if (NULL == buffer) return NULL;
+  size_t n = fs_fread_all(file, buffer, len);
   buffer[n] = '\0';
   return buffer;
 }
 
 
+static int
+fs_map_read (const char *path, fs_mapping *mapping) {
+  FILE *file = fs_open(path, FS_OPEN_READ);
+  if (NULL == file) return -1;
+  size_t size = 0;
+  char *data = fs_fread_size(file, &size);
+  fs_close(file);
+  if (NULL == data) return -1;
+  mapping->data = data;
+  mapping->size = size;
+  mapping->mapped = 0;
+  return 0;
+}
+
+
 int
+fs_map (const char *path, fs_mapping *mapping) {
+  memset(mapping, 0, sizeof(fs_mapping));
+#ifdef _WIN32
+  LARGE_INTEGER length;
+  SYSTEM_INFO info;
+  HANDLE file = CreateFileA(path, GENERIC_READ,
+      FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL, NULL);
+  if (INVALID_HANDLE_VALUE == file) return -1;
+  if (!GetFileSizeEx(file, &length)) {
+    CloseHandle(file);
+    return -1;
+  }
+  size_t size = (size_t) length.QuadPart;
+  GetSystemInfo(&info);
+  // the rest of the last page is zeroed, unless there is none
+  if (0 != size % info.dwPageSize) {
+    HANDLE view = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    char *data = view ? (char*) MapViewOfFile(view, FILE_MAP_COPY, 0, 0, size) : NULL;
+    if (view) CloseHandle(view);
+    if (NULL != data) {
+      CloseHandle(file);
+      mapping->data = data;
+      mapping->size = size;
+      mapping->mapped = 1;
+      return 0;
+    }
+  }
+  CloseHandle(file);
+  return fs_map_read(path, mapping);
+#else
+  fs_stats stats;
+  int fd = open(path, O_RDONLY);
+  if (-1 == fd) return -1;
+  if (-1 == fstat(fd, &stats)) {
+    close(fd);
+    return -1;
+  }
+  size_t size = (size_t) stats.st_size;
+  long page = sysconf(_SC_PAGESIZE);
+  // the rest of the last page is zeroed, unless there is none
+  if (S_ISREG(stats.st_mode) && page > 0 && 0 != size % (size_t) page) {
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED != data) {
+      close(fd);
+      mapping->data = (char*) data;
+      mapping->size = size;
+      mapping->mapped = 1;
+      return 0;
+    }
+  }
+  close(fd);
+  return fs_map_read(path, mapping);
+#endif
+}
+
+
+void
+fs_unmap (fs_mapping *mapping) {
+  if (NULL == mapping || NULL == mapping->data) return;
+  if (mapping->mapped) {
+#ifdef _WIN32
+    UnmapViewOfFile(mapping->data);
+#else
+    munmap(mapping->data, mapping->size);
+#endif
+  } else {
+    free(mapping->data);
+  }
+  memset(mapping, 0, sizeof(fs_mapping));
+}
+
+
+ssize_t
 fs_write (const char *path, const char *buffer) {
   return fs_nwrite(path, buffer, strlen(buffer));
 }
 
 
-int
-fs_nwrite (const char *path, const char *buffer, int len) {
+ssize_t
+fs_nwrite (const char *path, const char *buffer, size_t len) {
   FILE *file = fs_open(path, FS_OPEN_WRITE);
   if (NULL == file) return -1;
-  int result = fs_fnwrite(file, buffer, len);
-  fclose(file);
+  ssize_t result = fs_fnwrite(file, buffer, len);
+  // what is still buffered only fails to be written here
+  if (0 != fclose(file)) return -1;
   return result;
 }
 
 
-int
+ssize_t
 fs_fwrite (FILE *file, const char *buffer) {
   return fs_fnwrite(file, buffer, strlen(buffer));
 }
 
 
-int
-fs_fnwrite (FILE *file, const char *buffer, int len) {
-  return (int) fwrite(buffer, 1, len, file);
+ssize_t
+fs_fnwrite (FILE *file, const char *buffer, size_t len) {
+  size_t n = 0;
+  while (n < len) {
+    n += fwrite(buffer + n, 1, len - n, file);
+    if (n == len) break;
+    if (!ferror(file) || EINTR != errno) return -1;
+    clearerr(file);
+  }
+  return (ssize_t) n;
 }
 
 
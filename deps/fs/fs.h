@@ -10,6 +10,7 @@
 
 
 #include <stdio.h>
+#include <sys/types.h>
 #include <sys/stat.h>
 
 #ifdef _WIN32
@@ -25,6 +26,20 @@
 typedef struct stat fs_stats;
 
 
+/**
+ * The contents of a file, mapped into memory
+ * when possible and read otherwise. The byte
+ * after the last one is always 0, so `data`
+ * can be used as a string too.
+ */
+
+typedef struct {
+  char *data;
+  size_t size;
+  int mapped;
+} fs_mapping;
+
+
 
 /**
  * Prints the last error to stderr
@@ -90,7 +105,7 @@ fs_lstat (const char *path);
  */
 
 int
-fs_ftruncate (FILE *file, int len);
+fs_ftruncate (FILE *file, size_t len);
 
 
 /**
@@ -99,7 +114,7 @@ fs_ftruncate (FILE *file, int len);
  */
 
 int
-fs_truncate (const char *path, int len);
+fs_truncate (const char *path, size_t len);
 
 
 /**
@@ -124,7 +139,8 @@ fs_fchown (FILE *file, int uid, int gid);
 
 /**
  * Returns the size of a file from
- * a given file path
+ * a given file path, or `(size_t) -1`
+ * on failure
  */
 
 size_t
@@ -133,7 +149,8 @@ fs_size (const char *path);
 
 /**
  * Returns the size of a file
- * from a given file descriptor
+ * from a given file descriptor,
+ * or `(size_t) -1` on failure
  */
 
 size_t
@@ -166,12 +183,24 @@ fs_read (const char *path);
  */
 
 char *
-fs_nread (const char *path, int len);
+fs_nread (const char *path, size_t len);
 
 
 /**
- * Reads a file by a given
- * file descriptor
+ * Reads at most `size - 1` bytes of a
+ * file by a given file path into `buffer`,
+ * and terminates them. Returns how many
+ * were read or -1 on failure
+ */
+
+ssize_t
+fs_read_into (const char *path, char *buffer, size_t size);
+
+
+/**
+ * Reads the rest of a file by a
+ * given file descriptor. Returns
+ * NULL on failure
  */
 
 char *
@@ -185,43 +214,68 @@ fs_fread (FILE *file);
  */
 
 char *
-fs_fnread (FILE *file, int len);
+fs_fnread (FILE *file, size_t len);
 
 
 /**
- * Writes a buffer
- * to a given file path
+ * Maps a file by a given file path
+ * into `mapping`, privately: changes
+ * to it are never written back. Returns
+ * 0 on success or -1 on failure
  */
 
 int
+fs_map (const char *path, fs_mapping *mapping);
+
+
+/**
+ * Releases a mapping made by `fs_map()`,
+ * or one whose `data` was allocated with
+ * `malloc()` and isn't `mapped`
+ */
+
+void
+fs_unmap (fs_mapping *mapping);
+
+
+/**
+ * Writes a buffer
+ * to a given file path. Returns the
+ * number of bytes written or -1 on
+ * failure
+ */
+
+ssize_t
 fs_write (const char *path, const char *buffer);
 
 
 /**
  * Writes `n` bytes of a buffer to a given
- * file path
+ * file path. Returns `n` or -1 on failure
  */
 
-int
-fs_nwrite (const char *path, const char *buffer, int len);
+ssize_t
+fs_nwrite (const char *path, const char *buffer, size_t len);
 
 
 /**
  * Writes a buffer to a given
- * file stream
+ * file stream. Returns the number of
+ * bytes written or -1 on failure
  */
 
-int
+ssize_t
 fs_fwrite (FILE *file, const char *buffer);
 
 
 /**
  * Writes `n` bytes of a buffer
- * to a given file stream
+ * to a given file stream. Returns `n`
+ * or -1 on failure
  */
 
-int
-fs_fnwrite (FILE *file, const char *buffer, int len);
+ssize_t
+fs_fnwrite (FILE *file, const char *buffer, size_t len);
 
 
 /**
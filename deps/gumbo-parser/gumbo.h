@@ -741,10 +741,19 @@ typedef struct GumboInternalOptions {
    * The maximum number of errors before the parser stops recording them.  This
    * is provided so that if the page is totally borked, we don't completely fill
    * up the errors vector and exhaust memory with useless redundant errors.  Set
-   * to -1 to disable the limit.
+   * to -1 to disable the limit, or to 0 to not build any errors at all.
    * Default: -1
    */
   int max_errors;
+
+  /**
+   * Called with each element as it is closed, parsing stops after the first
+   * one it returns true for.  The output then holds the document up to there,
+   * with the elements still open closed implicitly.  This lets a caller that
+   * only needs one part of a page skip the rest of it.
+   * Default: NULL.
+   */
+  bool (*stop_after)(void* userdata, const GumboNode* element);
 } GumboOptions;
 
 /** Default options struct; use this with gumbo_parse_with_options. */
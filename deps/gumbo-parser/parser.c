@@ -53,6 +53,7 @@ const GumboOptions kGumboDefaultOptions = {
   8,
   false,
   -1,
+  NULL,
 };
 
 static const GumboStringPiece kDoctypeHtml = GUMBO_STRING("html");
@@ -398,6 +399,9 @@ typedef struct GumboInternalParserState {
   // flag appropriately.
   bool _closed_body_tag;
   bool _closed_html_tag;
+
+  // Set once the stop_after option asked for the parse to stop.
+  bool _stopped;
 } GumboParserState;
 
 static bool token_has_attribute(const GumboToken* token, const char* name) {
@@ -492,6 +496,7 @@ static void parser_state_init(GumboParser* parser) {
   parser_state->_current_token = NULL;
   parser_state->_closed_body_tag = false;
   parser_state->_closed_html_tag = false;
+  parser_state->_stopped = false;
   parser->_parser_state = parser_state;
 }
 
@@ -847,8 +852,7 @@ static void maybe_flush_text_node_buffer(GumboParser* parser) {
   gumbo_debug("Flushing text node buffer of %.*s.\n",
              (int) buffer_state->_buffer.length, buffer_state->_buffer.data);
 
-  gumbo_string_buffer_destroy(parser, &buffer_state->_buffer);
-  gumbo_string_buffer_init(parser, &buffer_state->_buffer);
+  gumbo_string_buffer_clear(parser, &buffer_state->_buffer);
   buffer_state->_type = GUMBO_NODE_WHITESPACE;
   assert(buffer_state->_buffer.length == 0);
 }
@@ -887,6 +891,11 @@ static GumboNode* pop_current_node(GumboParser* parser) {
   if (!is_closed_body_or_html_tag) {
     record_end_of_element(state->_current_token, &current_node->v.element);
   }
+  const GumboOptions* options = parser->_options;
+  if (options->stop_after && !state->_stopped &&
+      options->stop_after(options->userdata, current_node)) {
+    state->_stopped = true;
+  }
   return current_node;
 }
 
@@ -931,7 +940,7 @@ void clear_stack_to_table_body_context(GumboParser* parser) {
 static GumboNode* create_element(GumboParser* parser, GumboTag tag) {
   GumboNode* node = create_node(parser, GUMBO_NODE_ELEMENT);
   GumboElement* element = &node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
+  gumbo_vector_init(parser, 0, &element->children);
   gumbo_vector_init(parser, 0, &element->attributes);
   element->tag = tag;
   element->tag_namespace = GUMBO_NAMESPACE_HTML;
@@ -950,7 +959,7 @@ static GumboNode* create_element_from_token(
 
   GumboNode* node = create_node(parser, GUMBO_NODE_ELEMENT);
   GumboElement* element = &node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
+  gumbo_vector_init(parser, 0, &element->children);
   element->attributes = start_tag->attributes;
   element->tag = start_tag->tag;
   element->tag_namespace = tag_namespace;
@@ -1069,6 +1078,33 @@ static void insert_text_token(GumboParser* parser, GumboToken* token) {
   gumbo_debug("Inserting text token '%c'.\n", token->v.character);
 }
 
+// Inserts the run of plain text that follows a character token in the body
+// all at once, rather than lexing and handling it a token per character.  In
+// the body that is all each of the tokens would do, after the first one has
+// reconstructed the active formatting elements.
+static void insert_text_run(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  const GumboNode* current_node = get_current_node(parser);
+  GumboStringPiece run;
+  if (state->_insertion_mode != GUMBO_INSERTION_MODE_IN_BODY ||
+      state->_reprocess_current_token || !current_node ||
+      current_node->v.element.tag_namespace != GUMBO_NAMESPACE_HTML ||
+      !gumbo_tokenizer_consume_text_run(parser, &run)) {
+    return;
+  }
+
+  TextNodeBufferState* buffer_state = &state->_text_node;
+  gumbo_string_buffer_append_string(parser, &run, &buffer_state->_buffer);
+  for (size_t i = 0; i < run.length; ++i) {
+    if (!strchr(" \t\n\f", run.data[i])) {
+      buffer_state->_type = GUMBO_NODE_TEXT;
+      set_frameset_not_ok(parser);
+      break;
+    }
+  }
+  gumbo_debug("Inserting text run of %d bytes.\n", (int) run.length);
+}
+
 // http://www.whatwg.org/specs/web-apps/current-work/complete/tokenization.html#generic-rcdata-element-parsing-algorithm
 static void run_generic_parsing_algorithm(
     GumboParser* parser, GumboToken* token, GumboTokenizerEnum lexer_state) {
@@ -1179,7 +1215,7 @@ GumboNode* clone_node(
   new_node->parse_flags &= ~GUMBO_INSERTION_IMPLICIT_END_TAG;
   new_node->parse_flags |= reason | GUMBO_INSERTION_BY_PARSER;
   GumboElement* element = &new_node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
+  gumbo_vector_init(parser, 0, &element->children);
 
   const GumboVector* old_attributes = &node->v.element.attributes;
   gumbo_vector_init(parser, old_attributes->length, &element->attributes);
@@ -2321,11 +2357,13 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
   } else if (token->type == GUMBO_TOKEN_WHITESPACE) {
     reconstruct_active_formatting_elements(parser);
     insert_text_token(parser, token);
+    insert_text_run(parser);
     return true;
   } else if (token->type == GUMBO_TOKEN_CHARACTER) {
     reconstruct_active_formatting_elements(parser);
     insert_text_token(parser, token);
     set_frameset_not_ok(parser);
+    insert_text_run(parser);
     return true;
   } else if (token->type == GUMBO_TOKEN_COMMENT) {
     append_comment_node(parser, get_current_node(parser), token);
@@ -3882,7 +3920,7 @@ GumboOutput* gumbo_parse_with_options(
     assert(loop_count < 1000000000);
 
   } while ((token.type != GUMBO_TOKEN_EOF || state->_reprocess_current_token) &&
-           !(options->stop_on_first_error && has_error));
+           !(options->stop_on_first_error && has_error) && !state->_stopped);
 
   finish_parsing(&parser);
   // For API uniformity reasons, if the doctype still has nulls, convert them to
@@ -18,12 +18,10 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <string.h>
 #include <strings.h>    // For strcasecmp.
 
 // NOTE(jdtang): Keep this in sync with the GumboTag enum in the header.
-// TODO(jdtang): Investigate whether there're efficiency benefits to putting the
-// most common tag names first, or to putting them in alphabetical order and
-// using a binary search.
 const char* kGumboTagNames[] = {
   "html",
   "head",
@@ -178,6 +176,85 @@ const char* kGumboTagNames[] = {
   "",                   // TAG_LAST
 };
 
+// A perfect hash of the lowercase tag names above, for gumbo_tag_enum: the
+// name's length, first, second and last characters, multiplied by
+// kGumboTagHashSeed, pick the only tag the name can be, which one compare
+// then confirms.  Generated from the table above, and to be regenerated with
+// it.
+#define GUMBO_TAG_MAX_LENGTH 14
+#define GUMBO_TAG_HASH_BITS 10
+static const unsigned int kGumboTagHashSeed = 0x1abf4517u;
+static const unsigned char kGumboTagHash[1 << GUMBO_TAG_HASH_BITS] = {
+    149, 149, 149, 149, 149, 143, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    132, 87, 149, 147, 149, 149, 149, 149, 149, 149, 149, 48, 149, 149, 149,
+    149, 149, 149, 58, 149, 23, 149, 120, 149, 149, 149, 60, 149, 149, 149, 149,
+    11, 149, 149, 149, 149, 149, 149, 149, 149, 149, 134, 149, 149, 113, 149,
+    149, 4, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 149, 109, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 142, 108, 149, 149, 149, 149, 121, 149, 149,
+    149, 80, 14, 149, 149, 41, 149, 149, 61, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 140, 149, 149, 149, 57, 0, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 101, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 112, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 75, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 136, 21, 149, 149,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 89,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 86, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 111, 149, 149, 149, 129, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 100, 149, 149, 149, 35, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 17, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 90, 149, 149, 149, 13, 149,
+    149, 149, 149, 149, 94, 149, 149, 149, 104, 149, 149, 39, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 110, 149, 149, 149, 149,
+    130, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    123, 91, 149, 149, 149, 149, 149, 149, 149, 149, 92, 149, 20, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 43, 149, 149, 149, 149, 1, 149, 149, 149, 149, 149, 149, 149,
+    149, 82, 149, 149, 149, 105, 149, 149, 83, 149, 149, 149, 149, 149, 149, 73,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 8,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    50, 149, 149, 84, 149, 149, 149, 144, 149, 149, 149, 149, 149, 149, 74, 149,
+    149, 149, 149, 71, 149, 149, 66, 46, 149, 149, 149, 149, 149, 95, 149, 149,
+    149, 149, 65, 133, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 119,
+    149, 149, 70, 149, 10, 149, 149, 149, 149, 149, 149, 149, 36, 149, 30, 149,
+    115, 149, 149, 149, 149, 149, 149, 149, 149, 28, 149, 149, 149, 149, 149,
+    149, 149, 64, 149, 149, 149, 49, 149, 149, 149, 149, 141, 149, 149, 149,
+    149, 149, 149, 149, 99, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 24, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 15, 149, 149, 149, 149, 149, 77, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 145, 149, 149, 149, 117, 149, 149, 107, 149, 149, 149, 42,
+    149, 149, 149, 149, 149, 149, 79, 128, 149, 149, 149, 149, 85, 149, 78, 52,
+    47, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 149, 2, 149, 149, 148, 149, 127, 149, 149,
+    149, 149, 149, 149, 118, 149, 54, 18, 149, 149, 149, 149, 149, 149, 149,
+    149, 122, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 137, 149, 149,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 59, 149, 149, 33, 149, 149,
+    149, 149, 139, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 114, 149, 31, 62, 149, 149, 149, 149, 149, 72, 149, 149, 149, 149, 45,
+    149, 149, 149, 149, 7, 88, 53, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 116, 149, 149,
+    149, 125, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 126, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 124, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 96, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    32, 149, 149, 149, 149, 149, 149, 149, 149, 68, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 12, 149, 149, 44, 149, 149, 149, 149, 149,
+    146, 106, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 97, 149, 6, 149, 149, 149, 149, 5, 22, 149, 149,
+    149, 27, 149, 149, 9, 149, 149, 149, 149, 149, 149, 149, 149, 149, 25, 149,
+    149, 149, 103, 149, 149, 149, 149, 149, 149, 149, 135, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 55, 149, 149, 149,
+    149, 149, 149, 40, 149, 149, 149, 149, 149, 102, 149, 149, 149, 3, 149, 149,
+    149, 149, 34, 149, 51, 16, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 67, 149, 149, 149, 37, 149, 149, 26, 149, 149, 149,
+    149, 149, 149, 149, 138, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 98, 149, 149, 149, 149, 93, 149, 149, 149, 149, 149, 149, 149, 149,
+    149, 63, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 149, 38, 149,
+    149, 149, 149, 149, 149, 149, 149, 149, 149, 19, 149, 149, 149, 149, 149,
+    149, 149, 149, 149, 149, 56, 69, 149, 149, 29, 81, 149, 149, 76, 149, 149,
+    131,
+};
+
 const char* gumbo_normalized_tagname(GumboTag tag) {
   assert(tag <= GUMBO_TAG_LAST);
   return kGumboTagNames[tag];
@@ -212,14 +289,23 @@ void gumbo_tag_from_original_text(GumboStringPiece* text) {
   }
 }
 
+static unsigned int gumbo_tag_hash(const char* tagname, size_t length) {
+  unsigned int key = (unsigned int) length |
+      (unsigned int) tolower((unsigned char) tagname[0]) << 8 |
+      (unsigned int) tolower((unsigned char) tagname[1]) << 16 |
+      (unsigned int) tolower((unsigned char) tagname[length - 1]) << 24;
+  return (unsigned int) (key * kGumboTagHashSeed) >>
+      (32 - GUMBO_TAG_HASH_BITS);
+}
+
 GumboTag gumbo_tag_enum(const char* tagname) {
-  for (int i = 0; i < GUMBO_TAG_LAST; ++i) {
-    // TODO(jdtang): strcasecmp is non-portable, so if we want to support
-    // non-GCC compilers, we'll need some #ifdef magic.  This source already has
-    // pretty significant issues with MSVC6 anyway.
-    if (strcasecmp(tagname, kGumboTagNames[i]) == 0) {
-      return i;
-    }
+  size_t length = strlen(tagname);
+  if (length == 0 || length > GUMBO_TAG_MAX_LENGTH) {
+    return GUMBO_TAG_UNKNOWN;
   }
-  return GUMBO_TAG_UNKNOWN;
+  GumboTag tag = kGumboTagHash[gumbo_tag_hash(tagname, length)];
+  // TODO(jdtang): strcasecmp is non-portable, so if we want to support
+  // non-GCC compilers, we'll need some #ifdef magic.  This source already has
+  // pretty significant issues with MSVC6 anyway.
+  return strcasecmp(tagname, kGumboTagNames[tag]) == 0 ? tag : GUMBO_TAG_UNKNOWN;
 }
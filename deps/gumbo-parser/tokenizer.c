@@ -49,6 +49,12 @@
 #include <stdbool.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #include "attribute.h"
 #include "char_ref.h"
 #include "error.h"
@@ -348,12 +354,10 @@ static void clear_temporary_buffer(GumboParser* parser) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   assert(!tokenizer->_temporary_buffer_emit);
   utf8iterator_mark(&tokenizer->_input);
-  gumbo_string_buffer_destroy(parser, &tokenizer->_temporary_buffer);
-  gumbo_string_buffer_init(parser, &tokenizer->_temporary_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_temporary_buffer);
   // The temporary buffer and script data buffer are the same object in the
   // spec, so the script data buffer should be cleared as well.
-  gumbo_string_buffer_destroy(parser, &tokenizer->_script_data_buffer);
-  gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_script_data_buffer);
 }
 
 // Appends a codepoint to the temporary buffer.
@@ -547,7 +551,6 @@ static StateResult emit_current_tag(GumboParser* parser, GumboToken* output) {
     gumbo_debug("Emitted end tag %s.\n",
                gumbo_normalized_tagname(tag_state->_tag));
   }
-  gumbo_string_buffer_destroy(parser, &tag_state->_buffer);
   finish_token(parser, output);
   gumbo_debug("Original text = %.*s.\n", output->original_text.length, output->original_text.data);
   assert(output->original_text.length >= 2);
@@ -567,7 +570,6 @@ static void abandon_current_tag(GumboParser* parser) {
   }
   gumbo_parser_deallocate(parser, tag_state->_attributes.data);
   mark_tag_state_as_empty(tag_state);
-  gumbo_string_buffer_destroy(parser, &tag_state->_buffer);
   gumbo_debug("Abandoning current tag.\n");
 }
 
@@ -664,12 +666,13 @@ static void append_char_to_tag_buffer(GumboParser* parser, int codepoint,
 }
 
 // (Re-)initialize the tag buffer.  This also resets the original_text pointer
-// and _start_pos field to point to the current position.
+// and _start_pos field to point to the current position.  The buffer itself
+// lives as long as the tokenizer, and is only emptied here.
 static void initialize_tag_buffer(GumboParser* parser) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   GumboTagState* tag_state = &tokenizer->_tag_state;
 
-  gumbo_string_buffer_init(parser, &tag_state->_buffer);
+  gumbo_string_buffer_clear(parser, &tag_state->_buffer);
   reset_tag_buffer_start_point(parser);
 }
 
@@ -688,7 +691,9 @@ static void start_new_tag(GumboParser* parser, bool is_start_tag) {
   gumbo_string_buffer_append_codepoint(parser, c, &tag_state->_buffer);
 
   assert(tag_state->_attributes.data == NULL);
-  gumbo_vector_init(parser, 4, &tag_state->_attributes);
+  // Most tags, and all end tags, have no attributes, so the attribute vector
+  // is only allocated with the first of them.
+  gumbo_vector_init(parser, 0, &tag_state->_attributes);
   tag_state->_drop_next_attr_value = false;
   tag_state->_is_start_tag = is_start_tag;
   tag_state->_is_self_closing = false;
@@ -729,10 +734,8 @@ static void copy_over_original_tag_text(
   utf8iterator_get_position(&tokenizer->_input, end_pos);
 }
 
-// Releases and then re-initializes the tag buffer.
+// Empties and then re-initializes the tag buffer.
 static void reinitialize_tag_buffer(GumboParser* parser) {
-  gumbo_parser_deallocate(
-      parser, parser->_tokenizer_state->_tag_state._buffer.data);
   initialize_tag_buffer(parser);
 }
 
@@ -754,6 +757,8 @@ static void add_duplicate_attr_error(GumboParser* parser, const char* attr_name,
                                      int original_index, int new_index) {
   GumboError* error = gumbo_add_error(parser);
   if (!error) {
+    // The name is dropped all the same.
+    reinitialize_tag_buffer(parser);
     return;
   }
   GumboTagState* tag_state = &parser->_tokenizer_state->_tag_state;
@@ -777,8 +782,6 @@ static bool finish_attribute_name(GumboParser* parser) {
   GumboTagState* tag_state = &tokenizer->_tag_state;
   // May've been set by a previous attribute without a value; reset it here.
   tag_state->_drop_next_attr_value = false;
-  assert(tag_state->_attributes.data);
-  assert(tag_state->_attributes.capacity);
 
   GumboVector* /* GumboAttribute* */ attributes = &tag_state->_attributes;
   for (int i = 0; i < attributes->length; ++i) {
@@ -855,6 +858,7 @@ void gumbo_tokenizer_state_init(
   tokenizer->_temporary_buffer_emit = NULL;
 
   mark_tag_state_as_empty(&tokenizer->_tag_state);
+  gumbo_string_buffer_init(parser, &tokenizer->_tag_state._buffer);
 
   gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
   tokenizer->_token_start = text;
@@ -870,6 +874,7 @@ void gumbo_tokenizer_state_destroy(GumboParser* parser) {
   assert(tokenizer->_doc_type_state.system_identifier == NULL);
   gumbo_string_buffer_destroy(parser, &tokenizer->_temporary_buffer);
   gumbo_string_buffer_destroy(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_destroy(parser, &tokenizer->_tag_state._buffer);
   gumbo_parser_deallocate(parser, tokenizer);
 }
 
@@ -1586,8 +1591,7 @@ static StateResult handle_script_double_escaped_lt_state(
     int c, GumboToken* output) {
   if (c == '/') {
     gumbo_tokenizer_set_state(parser, GUMBO_LEX_SCRIPT_DOUBLE_ESCAPED_END);
-    gumbo_string_buffer_destroy(parser, &tokenizer->_script_data_buffer);
-    gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+    gumbo_string_buffer_clear(parser, &tokenizer->_script_data_buffer);
     return emit_current_char(parser, output);
   } else {
     gumbo_tokenizer_set_state(parser, GUMBO_LEX_SCRIPT_DOUBLE_ESCAPED);
@@ -2947,6 +2951,104 @@ bool gumbo_lex(GumboParser* parser, GumboToken* output) {
   }
 }
 
+// Whether the byte is a character the data state emits as a token with no
+// further ado: printable ASCII and whitespace, but not markup, a character
+// reference, a carriage return or null.
+static bool is_plain_text(unsigned char c) {
+  return (c >= 0x20 && c < 0x7F && c != '<' && c != '&') ||
+         c == '\t' || c == '\n' || c == '\f';
+}
+
+// Returns the number of plain text bytes at 'start', before 'end': plain
+// ASCII, and non-ASCII characters that decode without error.  ASCII is
+// scanned 16 bytes at a time where the vector instructions are known to be
+// there, and the rest a character at a time.
+static size_t text_run_length(const char* start, const char* end) {
+  const char* p = start;
+#if defined(__SSE2__)
+  const __m128i control = _mm_set1_epi8(0x1F);
+  const __m128i del = _mm_set1_epi8(0x7F);
+  const __m128i lt = _mm_set1_epi8('<');
+  const __m128i amp = _mm_set1_epi8('&');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i ff = _mm_set1_epi8('\f');
+#endif
+  while (p < end) {
+#if defined(__SSE2__)
+    if (end - p >= 16) {
+      __m128i bytes = _mm_loadu_si128((const __m128i*) p);
+      // The comparison is signed, so it leaves out non-ASCII bytes too.
+      __m128i plain = _mm_cmpgt_epi8(bytes, control);
+      __m128i special = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(bytes, lt), _mm_cmpeq_epi8(bytes, amp)),
+          _mm_cmpeq_epi8(bytes, del));
+      __m128i space = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(bytes, tab), _mm_cmpeq_epi8(bytes, lf)),
+          _mm_cmpeq_epi8(bytes, ff));
+      plain = _mm_or_si128(_mm_andnot_si128(special, plain), space);
+      int mask = _mm_movemask_epi8(plain);
+      if (mask == 0xFFFF) {
+        p += 16;
+        continue;
+      }
+      // To the first byte that isn't plain ASCII.
+      p += __builtin_ctz(~mask);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    if (end - p >= 16) {
+      uint8x16_t bytes = vld1q_u8((const uint8_t*) p);
+      uint8x16_t plain = vandq_u8(vcgeq_u8(bytes, vdupq_n_u8(0x20)),
+                                  vcltq_u8(bytes, vdupq_n_u8(0x7F)));
+      uint8x16_t special = vorrq_u8(vceqq_u8(bytes, vdupq_n_u8('<')),
+                                    vceqq_u8(bytes, vdupq_n_u8('&')));
+      uint8x16_t space = vorrq_u8(
+          vorrq_u8(vceqq_u8(bytes, vdupq_n_u8('\t')),
+                   vceqq_u8(bytes, vdupq_n_u8('\n'))),
+          vceqq_u8(bytes, vdupq_n_u8('\f')));
+      plain = vorrq_u8(vbicq_u8(plain, special), space);
+      if (vminvq_u8(plain) == 0xFF) {
+        p += 16;
+        continue;
+      }
+    }
+#endif
+    unsigned char c = (unsigned char) *p;
+    if (is_plain_text(c)) {
+      ++p;
+      continue;
+    }
+    int width = c >= 0x80 ? utf8_valid_char_width(p, end) : 0;
+    if (width == 0) {
+      break;
+    }
+    p += width;
+  }
+  return p - start;
+}
+
+bool gumbo_tokenizer_consume_text_run(
+    GumboParser* parser, GumboStringPiece* run) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
+  Utf8Iterator* input = &tokenizer->_input;
+  if (tokenizer->_state != GUMBO_LEX_DATA ||
+      tokenizer->_reconsume_current_input ||
+      tokenizer->_buffered_emit_char != kGumboNoChar ||
+      tokenizer->_temporary_buffer_emit) {
+    return false;
+  }
+
+  run->data = utf8iterator_get_char_pointer(input);
+  run->length =
+      text_run_length(run->data, utf8iterator_get_end_pointer(input));
+  if (run->length == 0) {
+    return false;
+  }
+  utf8iterator_skip(input, run->length);
+  reset_token_start_point(tokenizer);
+  return true;
+}
+
 void gumbo_token_destroy(GumboParser* parser, GumboToken* token) {
   if (!token) return;
 
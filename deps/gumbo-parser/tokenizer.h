@@ -106,6 +106,15 @@ void gumbo_tokenizer_set_is_current_node_foreign(
 //   gumbo_tokenizer_state_destroy(&parser);
 bool gumbo_lex(struct GumboInternalParser* parser, GumboToken* output);
 
+// Consumes the run of plain text following a character token emitted in the
+// data state, which would otherwise be lexed into a token per character, and
+// points 'run' at it.  The run ends before any markup, character reference,
+// carriage return, null, control character or invalid UTF-8, so each of its
+// characters would be a character or whitespace token with no parse error.  Returns false, having
+// consumed nothing, if there's no such run.
+bool gumbo_tokenizer_consume_text_run(
+    struct GumboInternalParser* parser, GumboStringPiece* run);
+
 // Frees the internally-allocated pointers within an GumboToken.  Note that this
 // doesn't free the token itself, since oftentimes it will be allocated on the
 // stack.  A simple call to free() (or GumboParser->deallocator, if
@@ -29,6 +29,11 @@
 
 const int kUtf8ReplacementChar = 0xFFFD;
 
+// Whether any byte of the 64-bit word 'x' is 'b'.
+#define HAS_BYTE(x, b) \
+  ((((x) ^ (0x0101010101010101ULL * (b))) - 0x0101010101010101ULL) & \
+   ~((x) ^ (0x0101010101010101ULL * (b))) & 0x8080808080808080ULL)
+
 // Reference material:
 // Wikipedia: http://en.wikipedia.org/wiki/UTF-8#Description
 // RFC 3629: http://tools.ietf.org/html/rfc3629
@@ -68,7 +73,17 @@ static void read_char(Utf8Iterator* iter) {
   int is_bad_char = false;
 
   c = (unsigned char) *iter->_start;
-  if (c < 0x80) {
+  if (c < 0x80 && c != '\r') {
+    // The common case, which needs no decoding.
+    iter->_width = 1;
+    if (utf8_is_invalid_code_point(c)) {
+      add_error(iter, GUMBO_ERR_UTF8_INVALID);
+      iter->_current = kUtf8ReplacementChar;
+    } else {
+      iter->_current = c;
+    }
+    return;
+  } else if (c < 0x80) {
     // Valid one-byte sequence.
     iter->_width = 1;
     mask = 0xFF;
@@ -190,6 +205,32 @@ bool utf8_is_invalid_code_point(int c) {
       ((c & 0xFFFF) == 0xFFFE) || ((c & 0xFFFF) == 0xFFFF);
 }
 
+int utf8_valid_char_width(const char* c, const char* end) {
+  unsigned char lead = (unsigned char) c[0];
+  int width = lead >= 0xC2 && lead < 0xE0 ? 2 :
+              lead >= 0xE0 && lead < 0xF0 ? 3 :
+              lead >= 0xF0 && lead < 0xF5 ? 4 : 0;
+  // The smallest code point of each width, shorter ones are overlong.
+  static const int kMinimum[] = {0, 0, 0x80, 0x800, 0x10000};
+  if (width == 0 || end - c < width) {
+    return 0;
+  }
+  int code_point = lead & (0xFF >> (width + 1));
+  for (int i = 1; i < width; ++i) {
+    unsigned char next = (unsigned char) c[i];
+    if (next < 0x80 || next > 0xBF) {
+      return 0;
+    }
+    code_point = (code_point << 6) | (next & 0x3F);
+  }
+  if (code_point < kMinimum[width] || code_point > 0x10FFFF ||
+      (code_point >= 0xD800 && code_point <= 0xDFFF) ||
+      utf8_is_invalid_code_point(code_point)) {
+    return 0;
+  }
+  return width;
+}
+
 void utf8iterator_init(
     GumboParser* parser, const char* source, size_t source_length,
     Utf8Iterator* iter) {
@@ -232,6 +273,47 @@ const char* utf8iterator_get_char_pointer(const Utf8Iterator* iter) {
   return iter->_start;
 }
 
+const char* utf8iterator_get_end_pointer(const Utf8Iterator* iter) {
+  return iter->_end;
+}
+
+void utf8iterator_skip(Utf8Iterator* iter, size_t length) {
+  const char* end = iter->_start + length;
+  assert(end <= iter->_end);
+  // As update_position would, a character at a time, with the continuation
+  // bytes part of the character before them.  Runs of eight ASCII bytes with
+  // no line feed or tab are counted at once.
+  while (iter->_start < end) {
+    if (end - iter->_start >= 8) {
+      uint64_t word;
+      memcpy(&word, iter->_start, sizeof(word));
+      if (!(word & 0x8080808080808080ULL) && !HAS_BYTE(word, '\n') &&
+          !HAS_BYTE(word, '\t')) {
+        iter->_pos.offset += 8;
+        iter->_pos.column += 8;
+        iter->_start += 8;
+        continue;
+      }
+    }
+    unsigned char c = (unsigned char) *iter->_start++;
+    ++iter->_pos.offset;
+    if (c == '\n') {
+      ++iter->_pos.line;
+      iter->_pos.column = 1;
+    } else if (c == '\t') {
+      int tab_stop = iter->_parser->_options->tab_stop;
+      iter->_pos.column = ((iter->_pos.column / tab_stop) + 1) * tab_stop;
+    } else if (c < 0x80 || c >= 0xC0) {
+      ++iter->_pos.column;
+    }
+  }
+  if (iter->_start < iter->_end) {
+    read_char(iter);
+  } else {  // EOF
+    iter->_current = -1;
+  }
+}
+
 bool utf8iterator_maybe_consume_match(
     Utf8Iterator* iter, const char* prefix, size_t length,
     bool case_sensitive) {
@@ -79,6 +79,10 @@ typedef struct GumboInternalUtf8Iterator {
 // forbidden by the HTML5 spec, such as NUL bytes and undefined control chars.
 bool utf8_is_invalid_code_point(int c);
 
+// Returns the width of the UTF-8 sequence at 'c', before 'end', if it is a
+// non-ASCII character that decodes without error, and 0 otherwise.
+int utf8_valid_char_width(const char* c, const char* end);
+
 // Initializes a new Utf8Iterator from the given byte buffer.  The source does
 // not have to be NUL-terminated, but the length must be passed in explicitly.
 void utf8iterator_init(
@@ -98,6 +102,15 @@ void utf8iterator_get_position(
 // Retrieves a character pointer to the start of the current character.
 const char* utf8iterator_get_char_pointer(const Utf8Iterator* iter);
 
+// Retrieves a character pointer past the end of the input.
+const char* utf8iterator_get_end_pointer(const Utf8Iterator* iter);
+
+// Advances the iterator past the 'length' bytes starting at the current
+// character, as calling utf8iterator_next for each of their characters would.
+// They must all be characters that decode without error and that aren't
+// carriage returns, so none of them needs decoding again.
+void utf8iterator_skip(Utf8Iterator* iter, size_t length);
+
 // If the upcoming text in the buffer matches the specified prefix (which has
 // length 'length'), consume it and return true.  Otherwise, return false with
 // no other effects.  If the length of the string would overflow the buffer,
@@ -5,50 +5,56 @@
 #include "gumbo-text-content.h"
 
 /**
- * Maximum number of text nodes.
+ * Append `length` bytes of `str` to `self`, keeping it
+ * null-terminated.
+ *
+ * Returns 0 on success, -1 on malloc failure
  */
 
-#define GUMBO_TEXT_CONTENT_MAX 1024
-
-typedef struct {
-  const char *nodes[GUMBO_TEXT_CONTENT_MAX];
-  size_t length;
-} text_nodes_t;
+int
+gumbo_text_append(gumbo_text_t *self, const char *str, size_t length) {
+  if (self->length + length + 1 > self->size) {
+    size_t size = self->size ? self->size : 256;
+    while (size < self->length + length + 1) size *= 2;
+    char *data = realloc(self->data, size);
+    if (!data) return -1;
+    self->data = data;
+    self->size = size;
+  }
+  memcpy(self->data + self->length, str, length);
+  self->length += length;
+  self->data[self->length] = '\0';
+  return 0;
+}
 
 /**
- * Get a `text_nodes_t` instance of all text nodes
- * contained in given `root` node.
+ * Append all text contained in the given `root` node to
+ * `text`, much like `Node#textContent`, without allocating
+ * unless `text` has to grow. The text starts at the
+ * `length` `text` had before.
+ *
+ * Returns 0 on success, -1 on malloc failure
  */
 
-static text_nodes_t *
-get_text_nodes(GumboNode *root) {
-  text_nodes_t *nodes = malloc(sizeof(text_nodes_t));
-  if (!nodes) return NULL;
-  nodes->length = 0;
-
+int
+gumbo_text_content_append(GumboNode *root, gumbo_text_t *text) {
   GumboVector *children = &root->v.element.children;
 
+  // an empty node still has an empty string
+  if (0 != gumbo_text_append(text, "", 0)) return -1;
+
   for (size_t i = 0; i < children->length; i++) {
     GumboNode *child = children->data[i];
     if (GUMBO_NODE_TEXT == child->type) {
-      nodes->nodes[nodes->length++] = child->v.text.text;
+      const char *str = child->v.text.text;
+      if (0 != gumbo_text_append(text, str, strlen(str))) return -1;
     } else if (GUMBO_NODE_ELEMENT == child->type) {
-      text_nodes_t *child_nodes = get_text_nodes(child);
-      // exit loop on malloc failure
-      if (!child_nodes) break;
-      // join children with our node
-      if (child_nodes->length) {
-        for (size_t j = 0; j < child_nodes->length; j++) {
-          nodes->nodes[nodes->length++] = child_nodes->nodes[j];
-        }
-      }
-      free(child_nodes);
+      if (0 != gumbo_text_content_append(child, text)) return -1;
     }
   }
-  return nodes;
+  return 0;
 }
 
-
 /**
  * Get all text contained in the given `root` node, much
  * like `Node#textContent`.
@@ -56,31 +62,11 @@ get_text_nodes(GumboNode *root) {
 
 char *
 gumbo_text_content(GumboNode *node) {
-  text_nodes_t *text_nodes = NULL;
-  char *text_content = NULL;
-  size_t length = 1;
-  int pos = 0;
-
-  text_nodes = get_text_nodes(node);
-  if (!text_nodes) goto cleanup;
+  gumbo_text_t text = {0};
 
-  // calculate total length of all text
-  for (size_t i = 0; i < text_nodes->length; i++) {
-    length += strlen(text_nodes->nodes[i]);
+  if (0 != gumbo_text_content_append(node, &text)) {
+    free(text.data);
+    return NULL;
   }
-
-  text_content = malloc(length);
-  if (!text_content) goto cleanup;
-  *text_content = '\0';
-  // join all text nodes
-  for (size_t i = 0; i < text_nodes->length; i++) {
-    size_t l = strlen(text_nodes->nodes[i]);
-    strncat(&text_content[pos], text_nodes->nodes[i], l);
-    pos += l;
-    text_content[pos] = '\0';
-  }
-
-cleanup:
-  free(text_nodes);
-  return text_content;
+  return text.data;
 }
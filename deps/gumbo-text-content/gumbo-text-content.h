@@ -2,9 +2,26 @@
 #ifndef GUMBO_TEXT_CONTENT_H
 #define GUMBO_TEXT_CONTENT_H 1
 
+#include <stddef.h>
 #include "gumbo-parser/gumbo.h"
 
+/**
+ * A growing string, which the text content is appended to.
+ */
+
+typedef struct {
+  char *data;
+  size_t length;
+  size_t size;
+} gumbo_text_t;
+
 char *
 gumbo_text_content(GumboNode *);
 
+int
+gumbo_text_content_append(GumboNode *, gumbo_text_t *);
+
+int
+gumbo_text_append(gumbo_text_t *, const char *, size_t);
+
 #endif
@@ -0,0 +1,353 @@
+//
+// concurrent-hash.c
+//
+// Copyright (c) 2021 clib authors
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "concurrent-hash.h"
+
+#define MIN_CAPACITY 16
+
+#ifdef HAVE_PTHREADS
+#define LOCK(stripe) pthread_mutex_lock(&(stripe)->mutex)
+#define UNLOCK(stripe) pthread_mutex_unlock(&(stripe)->mutex)
+#else
+#define LOCK(stripe)
+#define UNLOCK(stripe)
+#endif
+
+static unsigned int
+hash_key(const char *key) {
+  unsigned int hash = 5381;
+  while (*key) hash = hash * 33 + (unsigned char) *key++;
+  return hash;
+}
+
+/*
+ * The stripe of `hash`, whose buckets are picked by its other bits.
+ */
+
+static concurrent_hash_stripe_t *
+stripe_of(concurrent_hash_t *self, unsigned int hash) {
+  return &self->stripes[hash % CONCURRENT_HASH_STRIPES];
+}
+
+static size_t
+bucket_of(concurrent_hash_stripe_t *stripe, unsigned int hash) {
+  return (hash / CONCURRENT_HASH_STRIPES) & (stripe->capacity - 1);
+}
+
+/*
+ * Find `key` in `stripe`, which must be locked.
+ */
+
+static concurrent_hash_node_t *
+find(concurrent_hash_stripe_t *stripe, const char *key, unsigned int hash) {
+  if (0 == stripe->capacity) return NULL;
+
+  concurrent_hash_node_t *node = stripe->buckets[bucket_of(stripe, hash)];
+  for (; node; node = node->next) {
+    if (node->hash == hash && 0 == strcmp(node->key, key)) return node;
+  }
+
+  return NULL;
+}
+
+/*
+ * Add a new pair to `stripe`, which must be locked, growing it to keep
+ * about one node per bucket. -1 on failure.
+ */
+
+static int
+add(concurrent_hash_stripe_t *stripe, const char *key, unsigned int hash, void *val) {
+  size_t length = strlen(key);
+  concurrent_hash_node_t *node = NULL;
+
+  if (stripe->count >= stripe->capacity) {
+    size_t capacity = stripe->capacity ? stripe->capacity * 2 : MIN_CAPACITY;
+    concurrent_hash_node_t **buckets = calloc(capacity, sizeof(*buckets));
+    if (!buckets) return -1;
+
+    for (size_t i = 0; i < stripe->capacity; i++) {
+      concurrent_hash_node_t *next = NULL;
+      for (node = stripe->buckets[i]; node; node = next) {
+        size_t b = (node->hash / CONCURRENT_HASH_STRIPES) & (capacity - 1);
+        next = node->next;
+        node->next = buckets[b];
+        buckets[b] = node;
+      }
+    }
+
+    free(stripe->buckets);
+    stripe->buckets = buckets;
+    stripe->capacity = capacity;
+  }
+
+  if (!(node = malloc(sizeof(*node) + length + 1))) return -1;
+  memcpy(node->key, key, length + 1);
+  node->hash = hash;
+  node->val = val;
+
+  size_t b = bucket_of(stripe, hash);
+  node->next = stripe->buckets[b];
+  stripe->buckets[b] = node;
+  stripe->count++;
+  return 0;
+}
+
+/*
+ * Allocate a new hash. NULL on failure.
+ */
+
+concurrent_hash_t *
+concurrent_hash_new(void) {
+  concurrent_hash_t *self = calloc(1, sizeof(concurrent_hash_t));
+  if (!self) return NULL;
+
+#ifdef HAVE_PTHREADS
+  for (int i = 0; i < CONCURRENT_HASH_STRIPES; i++) {
+    pthread_mutex_init(&self->stripes[i].mutex, NULL);
+  }
+#endif
+
+  return self;
+}
+
+/*
+ * Destroy the hash and its copies of the keys.
+ */
+
+void
+concurrent_hash_free(concurrent_hash_t *self) {
+  if (!self) return;
+
+  for (int i = 0; i < CONCURRENT_HASH_STRIPES; i++) {
+    concurrent_hash_stripe_t *stripe = &self->stripes[i];
+    for (size_t b = 0; b < stripe->capacity; b++) {
+      concurrent_hash_node_t *next = NULL;
+      for (concurrent_hash_node_t *node = stripe->buckets[b]; node; node = next) {
+        next = node->next;
+        free(node);
+      }
+    }
+    free(stripe->buckets);
+#ifdef HAVE_PTHREADS
+    pthread_mutex_destroy(&stripe->mutex);
+#endif
+  }
+
+  free(self);
+}
+
+/*
+ * Set hash `key` to `val`, copying `key`. -1 on failure.
+ */
+
+int
+concurrent_hash_set(concurrent_hash_t *self, const char *key, void *val) {
+  unsigned int hash = hash_key(key);
+  concurrent_hash_stripe_t *stripe = stripe_of(self, hash);
+  concurrent_hash_node_t *node = NULL;
+  int rc = 0;
+
+  LOCK(stripe);
+  if ((node = find(stripe, key, hash))) {
+    node->val = val;
+  } else {
+    rc = add(stripe, key, hash, val);
+  }
+  UNLOCK(stripe);
+
+  return rc;
+}
+
+/*
+ * Set hash `key` to `val` unless it is set already, checking and
+ * setting at once. 1 if it was set, 0 if `key` was there, -1 on failure.
+ */
+
+int
+concurrent_hash_insert(concurrent_hash_t *self, const char *key, void *val) {
+  unsigned int hash = hash_key(key);
+  concurrent_hash_stripe_t *stripe = stripe_of(self, hash);
+  int rc = 0;
+
+  LOCK(stripe);
+  if (!find(stripe, key, hash)) {
+    rc = -1 == add(stripe, key, hash, val) ? -1 : 1;
+  }
+  UNLOCK(stripe);
+
+  return rc;
+}
+
+/*
+ * Get hash `key`, or NULL.
+ */
+
+void *
+concurrent_hash_get(concurrent_hash_t *self, const char *key) {
+  unsigned int hash = hash_key(key);
+  concurrent_hash_stripe_t *stripe = stripe_of(self, hash);
+  concurrent_hash_node_t *node = NULL;
+  void *val = NULL;
+
+  LOCK(stripe);
+  if ((node = find(stripe, key, hash))) val = node->val;
+  UNLOCK(stripe);
+
+  return val;
+}
+
+/*
+ * Remove hash `key`, freeing its copy of the key. Its value, or NULL.
+ */
+
+void *
+concurrent_hash_del(concurrent_hash_t *self, const char *key) {
+  unsigned int hash = hash_key(key);
+  concurrent_hash_stripe_t *stripe = stripe_of(self, hash);
+  concurrent_hash_node_t **link = NULL;
+  void *val = NULL;
+
+  LOCK(stripe);
+  if (stripe->capacity) {
+    link = &stripe->buckets[bucket_of(stripe, hash)];
+    for (; *link; link = &(*link)->next) {
+      concurrent_hash_node_t *node = *link;
+      if (node->hash == hash && 0 == strcmp(node->key, key)) {
+        *link = node->next;
+        val = node->val;
+        stripe->count--;
+        free(node);
+        break;
+      }
+    }
+  }
+  UNLOCK(stripe);
+
+  return val;
+}
+
+/*
+ * Remove every pair, keeping the buckets for what comes next.
+ */
+
+void
+concurrent_hash_clear(concurrent_hash_t *self) {
+  for (int i = 0; i < CONCURRENT_HASH_STRIPES; i++) {
+    concurrent_hash_stripe_t *stripe = &self->stripes[i];
+    LOCK(stripe);
+    for (size_t b = 0; b < stripe->capacity; b++) {
+      concurrent_hash_node_t *next = NULL;
+      for (concurrent_hash_node_t *node = stripe->buckets[b]; node; node = next) {
+        next = node->next;
+        free(node);
+      }
+      stripe->buckets[b] = NULL;
+    }
+    stripe->count = 0;
+    UNLOCK(stripe);
+  }
+}
+
+/*
+ * Hash size.
+ */
+
+size_t
+concurrent_hash_size(concurrent_hash_t *self) {
+  size_t size = 0;
+
+  for (int i = 0; i < CONCURRENT_HASH_STRIPES; i++) {
+    LOCK(&self->stripes[i]);
+    size += self->stripes[i].count;
+    UNLOCK(&self->stripes[i]);
+  }
+
+  return size;
+}
+
+// tests
+
+#ifdef TEST_CONCURRENT_HASH
+
+#include <stdio.h>
+#include <assert.h>
+
+void
+test_concurrent_hash_set() {
+  concurrent_hash_t *hash = concurrent_hash_new();
+  char key[] = "name";
+  assert(0 == concurrent_hash_size(hash));
+
+  assert(0 == concurrent_hash_set(hash, key, "tobi"));
+  assert(0 == concurrent_hash_set(hash, "species", "ferret"));
+  key[0] = 'N';
+  assert(2 == concurrent_hash_size(hash));
+
+  assert(0 == strcmp("tobi", concurrent_hash_get(hash, "name")));
+  assert(0 == concurrent_hash_set(hash, "name", "loki"));
+  assert(0 == strcmp("loki", concurrent_hash_get(hash, "name")));
+  assert(NULL == concurrent_hash_get(hash, "Name"));
+  concurrent_hash_free(hash);
+}
+
+void
+test_concurrent_hash_insert() {
+  concurrent_hash_t *hash = concurrent_hash_new();
+  assert(1 == concurrent_hash_insert(hash, "foo", "bar"));
+  assert(0 == concurrent_hash_insert(hash, "foo", "baz"));
+  assert(0 == strcmp("bar", concurrent_hash_get(hash, "foo")));
+  concurrent_hash_free(hash);
+}
+
+void
+test_concurrent_hash_each() {
+  concurrent_hash_t *hash = concurrent_hash_new();
+  char key[16];
+  int n = 0;
+
+  for (int i = 0; i < 1000; i++) {
+    sprintf(key, "%d", i);
+    assert(1 == concurrent_hash_insert(hash, key, "t"));
+  }
+
+  assert(1000 == concurrent_hash_size(hash));
+  concurrent_hash_each(hash, {
+    assert(atoi(key) < 1000);
+    assert(0 == strcmp("t", val));
+    n++;
+  });
+
+  assert(1000 == n);
+  concurrent_hash_free(hash);
+}
+
+void
+test_concurrent_hash_clear() {
+  concurrent_hash_t *hash = concurrent_hash_new();
+  concurrent_hash_clear(hash);
+  assert(1 == concurrent_hash_insert(hash, "foo", "bar"));
+  assert(1 == concurrent_hash_insert(hash, "baz", "qux"));
+  concurrent_hash_clear(hash);
+  assert(0 == concurrent_hash_size(hash));
+  assert(NULL == concurrent_hash_get(hash, "foo"));
+  assert(1 == concurrent_hash_insert(hash, "foo", "baz"));
+  assert(0 == strcmp("baz", concurrent_hash_get(hash, "foo")));
+  concurrent_hash_free(hash);
+}
+
+int
+main(){
+  test_concurrent_hash_set();
+  test_concurrent_hash_insert();
+  test_concurrent_hash_each();
+  test_concurrent_hash_clear();
+  printf("\n  \e[32m✓ \e[90mok\e[0m\n\n");
+  return 0;
+}
+
+#endif
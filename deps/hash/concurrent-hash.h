@@ -0,0 +1,114 @@
+//
+// concurrent-hash.h
+//
+// Copyright (c) 2021 clib authors
+//
+
+#ifndef CONCURRENT_HASH
+#define CONCURRENT_HASH
+
+#include <stddef.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+/*
+ * Keys are spread over this many tables, each with its own lock, so
+ * threads working on different keys rarely wait for each other.
+ */
+
+#define CONCURRENT_HASH_STRIPES 16
+
+/*
+ * A pair, its key copied along with it.
+ */
+
+typedef struct concurrent_hash_node {
+  struct concurrent_hash_node *next;
+  unsigned int hash;
+  void *val;
+  char key[];
+} concurrent_hash_node_t;
+
+/*
+ * One of the chained tables.
+ */
+
+typedef struct {
+  concurrent_hash_node_t **buckets;
+  size_t capacity;
+  size_t count;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t mutex;
+#endif
+} concurrent_hash_stripe_t;
+
+/*
+ * Hash type, safe to share between threads.
+ */
+
+typedef struct {
+  concurrent_hash_stripe_t stripes[CONCURRENT_HASH_STRIPES];
+} concurrent_hash_t;
+
+/*
+ * Iterate hash keys and ptrs, populating `key` and `val`. Unlike the
+ * other functions it takes no lock, so nothing may change the hash
+ * meanwhile.
+ */
+
+#define concurrent_hash_each(self, block) { \
+    const char *key; \
+    void *val; \
+    for (int _s = 0; _s < CONCURRENT_HASH_STRIPES; _s++) { \
+      concurrent_hash_stripe_t *_stripe = &(self)->stripes[_s]; \
+      for (size_t _b = 0; _b < _stripe->capacity; _b++) { \
+        concurrent_hash_node_t *_n = _stripe->buckets[_b]; \
+        for (; _n; _n = _n->next) { \
+          key = _n->key; \
+          val = _n->val; \
+          block; \
+        } \
+      } \
+    } \
+  }
+
+/*
+ * Iterate hash ptrs, populating `val`, taking no lock either.
+ */
+
+#define concurrent_hash_each_val(self, block) { \
+    concurrent_hash_each(self, { \
+      (void) key; \
+      block; \
+    }); \
+  }
+
+// protos
+
+concurrent_hash_t *
+concurrent_hash_new(void);
+
+void
+concurrent_hash_free(concurrent_hash_t *self);
+
+int
+concurrent_hash_set(concurrent_hash_t *self, const char *key, void *val);
+
+int
+concurrent_hash_insert(concurrent_hash_t *self, const char *key, void *val);
+
+void *
+concurrent_hash_get(concurrent_hash_t *self, const char *key);
+
+void *
+concurrent_hash_del(concurrent_hash_t *self, const char *key);
+
+void
+concurrent_hash_clear(concurrent_hash_t *self);
+
+size_t
+concurrent_hash_size(concurrent_hash_t *self);
+
+#endif /* CONCURRENT_HASH */
@@ -6,33 +6,431 @@
 // MIT licensed
 //
 
+// mkstemp()
+#define _DEFAULT_SOURCE
+
 #include <curl/curl.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "strdup/strdup.h"
 #include "http-get.h"
 
+/**
+ * Options shared by every request: attach the `share` handle so the
+ * connection cache, DNS and TLS sessions are reused, and prefer HTTP/2
+ * so concurrent requests to one host multiplex over a single connection.
+ */
+
+static int http_get_compression = 1;
+
+static int http_get_http3 = 0;
+
+static http_get_stats_t http_get_totals;
+
+static http_get_observer_t http_get_observer = NULL;
+
+static http_get_acquire_t http_get_acquire = NULL;
+static http_get_release_t http_get_release = NULL;
+
+static http_get_prepare_t http_get_prepare = NULL;
+
+static long http_get_connect_timeout = 0;
+static long http_get_timeout = 0;
+static long http_get_low_speed_limit = 0;
+static long http_get_low_speed_time = 0;
+
+static http_get_memory_t http_get_held;
+
+#ifdef __GNUC__
+#define HTTP_GET_COUNT(field, n) __sync_fetch_and_add(&http_get_totals.field, (n))
+#define HTTP_GET_HELD(field, n) __sync_add_and_fetch(&http_get_held.field, (n))
+#define HTTP_GET_UNHELD(field, n) __sync_sub_and_fetch(&http_get_held.field, (n))
+#else
+#define HTTP_GET_COUNT(field, n) (http_get_totals.field += (n))
+#define HTTP_GET_HELD(field, n) (http_get_held.field += (n))
+#define HTTP_GET_UNHELD(field, n) (http_get_held.field -= (n))
+#endif
+
+/**
+ * Enable or disable negotiating a compressed `Content-Encoding`
+ */
+
+void http_get_set_compression(int enabled) {
+  http_get_compression = enabled;
+}
+
+/**
+ * Let servers that advertise HTTP/3 with `Alt-Svc` move the requests made
+ * from now on to it, when this libcurl can speak it
+ */
+
+void http_get_set_http3(int enabled) {
+#if LIBCURL_VERSION_NUM >= 0x074200
+  http_get_http3 = enabled &&
+                   (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP3);
+#else
+  (void) enabled;
+#endif
+}
+
+/**
+ * Copy the byte counters of every request performed so far into `stats`
+ */
+
+void http_get_stats(http_get_stats_t *stats) {
+  stats->requests = HTTP_GET_COUNT(requests, 0);
+  stats->wire_bytes = HTTP_GET_COUNT(wire_bytes, 0);
+  stats->body_bytes = HTTP_GET_COUNT(body_bytes, 0);
+}
+
+/**
+ * Count the bodies of in-memory requests against a budget of `bytes`, or
+ * against none when 0
+ */
+
+void http_get_set_memory_budget(size_t bytes) {
+  http_get_held.budget = bytes;
+}
+
+/**
+ * Copy what the bodies of in-memory requests take into `memory`
+ */
+
+void http_get_memory(http_get_memory_t *memory) {
+  memory->budget = http_get_held.budget;
+  memory->buffered = HTTP_GET_HELD(buffered, 0);
+  memory->peak = HTTP_GET_HELD(peak, 0);
+  memory->spilled = HTTP_GET_HELD(spilled, 0);
+  memory->spilled_bytes = HTTP_GET_HELD(spilled_bytes, 0);
+}
+
+int http_get_memory_exhausted(void) {
+  return http_get_held.budget && HTTP_GET_HELD(buffered, 0) >= http_get_held.budget;
+}
+
+/**
+ * Count `n` more bytes of bodies in memory, and the most there were
+ */
+
+static void http_get_hold(size_t n) {
+  unsigned long long now = HTTP_GET_HELD(buffered, n);
+#ifdef __GNUC__
+  unsigned long long peak = http_get_held.peak;
+  while (now > peak && !__sync_bool_compare_and_swap(&http_get_held.peak, peak, now)) {
+    peak = http_get_held.peak;
+  }
+#else
+  if (now > http_get_held.peak) http_get_held.peak = now;
+#endif
+}
+
+/**
+ * Tell `observer` about every request finished from now on, or nobody
+ * when it is NULL
+ */
+
+void http_get_set_observer(http_get_observer_t observer) {
+  http_get_observer = observer;
+}
+
+/**
+ * Pace the requests performed from now on with `acquire` and `release`,
+ * or not at all when they are NULL
+ */
+
+void http_get_set_limiter(http_get_acquire_t acquire, http_get_release_t release) {
+  http_get_acquire = acquire;
+  http_get_release = release;
+}
+
+/**
+ * Let `prepare` set further options of every request to be made from
+ * now on, or none when it is NULL
+ */
+
+void http_get_set_prepare(http_get_prepare_t prepare) {
+  http_get_prepare = prepare;
+}
+
+/**
+ * Give up on requests that take longer than `connect` seconds to connect
+ * or `total` seconds altogether, or that receive less than
+ * `low_speed_limit` bytes per second for `low_speed_time` seconds. 0
+ * leaves a limit off.
+ */
+
+void http_get_set_timeouts(long connect, long total, long low_speed_limit, long low_speed_time) {
+  http_get_connect_timeout = connect > 0 ? connect : 0;
+  http_get_timeout = total > 0 ? total : 0;
+  http_get_low_speed_limit = low_speed_limit > 0 ? low_speed_limit : 0;
+  http_get_low_speed_time = low_speed_time > 0 ? low_speed_time : 0;
+}
+
+/**
+ * Whether a request that ended with `code` ran into a timeout, and is
+ * worth another try over a new connection
+ */
+
+int http_get_stalled(int code) {
+#if LIBCURL_VERSION_NUM >= 0x074500
+  // what HTTP/3 couldn't do is tried again over TCP
+  if (CURLE_HTTP3 == code || CURLE_QUIC_CONNECT_ERROR == code) return 1;
+#endif
+  return CURLE_OPERATION_TIMEDOUT == code;
+}
+
+/**
+ * Have `req`, another try of a request that stalled, go over a new
+ * connection, and over TCP rather than HTTP/3
+ */
+
+void http_get_reconnect(void *req) {
+  curl_easy_setopt(req, CURLOPT_FRESH_CONNECT, 1L);
+#if LIBCURL_VERSION_NUM >= 0x074001
+  curl_easy_setopt(req, CURLOPT_ALTSVC_CTRL, (long) (CURLALTSVC_H1 | CURLALTSVC_H2));
+#endif
+}
+
+/**
+ * Seconds a finished request was asked to wait before the next one, 0
+ * when the server didn't say
+ */
+
+static long http_get_retry_after(CURL *req) {
+#if LIBCURL_VERSION_NUM >= 0x074200
+  curl_off_t seconds = 0;
+  if (CURLE_OK == curl_easy_getinfo(req, CURLINFO_RETRY_AFTER, &seconds) && seconds > 0) {
+    return (long) seconds;
+  }
+#else
+  (void) req;
+#endif
+  return 0;
+}
+
+static void http_get_limit_acquire(const char *url) {
+  if (http_get_acquire) http_get_acquire(url);
+}
+
+static void http_get_limit_release(const char *url, long status, long retry_after) {
+  if (http_get_acquire && http_get_release) http_get_release(url, status, retry_after);
+}
+
+/**
+ * Account a finished request that delivered `body` decoded bytes
+ */
+
+static void http_get_account(CURL *req, size_t body) {
+#if LIBCURL_VERSION_NUM >= 0x073700
+  curl_off_t wire = 0;
+  curl_easy_getinfo(req, CURLINFO_SIZE_DOWNLOAD_T, &wire);
+#else
+  double wire = 0;
+  curl_easy_getinfo(req, CURLINFO_SIZE_DOWNLOAD, &wire);
+#endif
+  HTTP_GET_COUNT(requests, 1);
+  HTTP_GET_COUNT(wire_bytes, (unsigned long long) wire);
+  HTTP_GET_COUNT(body_bytes, (unsigned long long) body);
+
+  if (http_get_observer) {
+    char *url = NULL;
+    long status = 0;
+    long connects = 0;
+    double seconds = 0;
+    curl_easy_getinfo(req, CURLINFO_EFFECTIVE_URL, &url);
+    curl_easy_getinfo(req, CURLINFO_RESPONSE_CODE, &status);
+    // an answer without a new connection came over one that was open
+    curl_easy_getinfo(req, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(req, CURLINFO_TOTAL_TIME, &seconds);
+    http_get_observer(url, status, (unsigned long long) wire,
+                      (unsigned long long) body, status && 0 == connects,
+                      seconds);
+  }
+}
+
+static void http_get_setopt_defaults(CURL *req, const char *url, CURLSH *share) {
+  if (share) {
+    curl_easy_setopt(req, CURLOPT_SHARE, share);
+  }
+
+  // "" offers every encoding this libcurl can decode (gzip, brotli, ...)
+  if (http_get_compression) {
+    curl_easy_setopt(req, CURLOPT_ACCEPT_ENCODING, "");
+  }
+
+#if LIBCURL_VERSION_NUM >= 0x072f00
+  curl_easy_setopt(req, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+#endif
+
+  // the protocols a server may move a request to with `Alt-Svc`, which
+  // is only HTTP/3 when asked for
+#if LIBCURL_VERSION_NUM >= 0x074001
+  curl_easy_setopt(req, CURLOPT_ALTSVC_CTRL,
+                   (long) (CURLALTSVC_H1 | CURLALTSVC_H2 |
+                           (http_get_http3 ? CURLALTSVC_H3 : 0)));
+#endif
+
+  if (http_get_connect_timeout) {
+    curl_easy_setopt(req, CURLOPT_CONNECTTIMEOUT, http_get_connect_timeout);
+  }
+
+  if (http_get_timeout) {
+    curl_easy_setopt(req, CURLOPT_TIMEOUT, http_get_timeout);
+  }
+
+  if (http_get_low_speed_limit && http_get_low_speed_time) {
+    curl_easy_setopt(req, CURLOPT_LOW_SPEED_LIMIT, http_get_low_speed_limit);
+    curl_easy_setopt(req, CURLOPT_LOW_SPEED_TIME, http_get_low_speed_time);
+  }
+
+  if (http_get_prepare) {
+    http_get_prepare(req, url);
+  }
+}
+
+#ifndef _WIN32
+/**
+ * Move what `ctx` received so far out of memory into an unlinked file,
+ * where the rest of the body goes too
+ */
+
+static int http_get_spill(http_get_transfer_t *ctx) {
+  http_get_response_t *res = ctx->res;
+  const char *dir = getenv("TMPDIR");
+  if (!dir || !*dir) dir = "/tmp";
+
+  char *path = malloc(strlen(dir) + sizeof("/http-get-XXXXXX"));
+  if (!path) return -1;
+  sprintf(path, "%s/http-get-XXXXXX", dir);
+
+  int fd = mkstemp(path);
+  if (-1 != fd) unlink(path);
+  free(path);
+
+  FILE *fp = -1 == fd ? NULL : fdopen(fd, "w+b");
+  if (!fp) {
+    if (-1 != fd) close(fd);
+    return -1;
+  }
+
+  if (res->size > 0 && res->size != fwrite(res->data, 1, res->size, fp)) {
+    fclose(fp);
+    return -1;
+  }
+
+  free(res->data);
+  res->data = NULL;
+  HTTP_GET_UNHELD(buffered, res->held);
+  res->held = ctx->capacity = 0;
+  ctx->spill = fp;
+  HTTP_GET_HELD(spilled, 1);
+  return 0;
+}
+
+/**
+ * Map the spilled body of `ctx` as its `data`, with the terminating zero
+ * a body in memory has too
+ */
+
+static int http_get_map(http_get_transfer_t *ctx) {
+  http_get_response_t *res = ctx->res;
+  FILE *fp = ctx->spill;
+  void *map = MAP_FAILED;
+
+  ctx->spill = NULL;
+  if (EOF != fputc(0, fp) && 0 == fflush(fp)) {
+    map = mmap(NULL, res->size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+  }
+  fclose(fp);
+
+  if (MAP_FAILED == map) return -1;
+
+  res->data = map;
+  res->mapped = res->size + 1;
+  HTTP_GET_HELD(spilled_bytes, res->size);
+  return 0;
+}
+#endif
+
+/**
+ * Make room for `len` more bytes plus the terminating NUL in `res->data`.
+ * The first allocation is sized from the announced Content-Length, later
+ * ones double the capacity so large bodies are copied O(log n) times,
+ * unless the body is spilled to disk for the memory budget.
+ */
+
+static int http_get_reserve(http_get_transfer_t *ctx, size_t len) {
+  http_get_response_t *res = ctx->res;
+  size_t needed = res->size + len + 1;
+
+  if (needed <= ctx->capacity) return 0;
+
+  size_t capacity = ctx->capacity ? ctx->capacity * 2 : 0;
+
+  if (0 == ctx->capacity) {
+#if LIBCURL_VERSION_NUM >= 0x073700
+    curl_off_t length = -1;
+    curl_easy_getinfo(ctx->req, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+    if (length > 0) capacity = (size_t) length + 1;
+#else
+    double length = -1;
+    curl_easy_getinfo(ctx->req, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length);
+    if (length > 0) capacity = (size_t) length + 1;
+#endif
+  }
+
+  if (capacity < needed) capacity = needed;
+
+#ifndef _WIN32
+  // a body that doesn't fit the budget goes to disk instead
+  size_t budget = http_get_held.budget;
+  if (budget && (capacity > budget / HTTP_GET_SPILL_SHARE ||
+                 HTTP_GET_HELD(buffered, 0) + capacity - ctx->capacity > budget)) {
+    return http_get_spill(ctx);
+  }
+#endif
+
+  void *ptr = realloc(res->data, capacity);
+  if (NULL == ptr) {
+    fprintf(stderr, "not enough memory!");
+    return -1;
+  }
+
+  http_get_hold(capacity - ctx->capacity);
+  res->data = ptr;
+  res->held = ctx->capacity = capacity;
+  return 0;
+}
+
 /**
  * HTTP GET write callback
  */
 
 static size_t http_get_cb(void *contents, size_t size, size_t nmemb, void *userp) {
   size_t realsize = size * nmemb;
-  http_get_response_t *res = userp;
+  http_get_transfer_t *ctx = userp;
+  http_get_response_t *res = ctx->res;
 
-  if (0 == res->data) {
-    res->data = malloc(realsize + 1);
-  } else {
-    void *ptr = realloc(res->data, res->size + realsize + 1);
+  if (ctx->stream) {
+    if (0 != ctx->stream(contents, realsize, ctx->data)) return 0;
+    res->size += realsize;
+    return realsize;
+  }
 
-    if (NULL == ptr) {
-      fprintf(stderr, "not enough memory!");
-      return 0;
-    }
+  if (!ctx->spill && 0 != http_get_reserve(ctx, realsize)) return 0;
 
-    res->data = ptr;
+  if (ctx->spill) {
+    if (realsize != fwrite(contents, 1, realsize, ctx->spill)) return 0;
+    res->size += realsize;
+    return realsize;
   }
 
-  memset(res->data + res->size, 0, realsize);
   memcpy(res->data + res->size, contents, realsize);
   res->size += realsize;
   res->data[res->size] = 0;
@@ -40,32 +438,202 @@ static size_t http_get_cb(void *contents, size_t size, size_t nmemb, void *userp
   return realsize;
 }
 
-http_get_response_t *http_get_shared(const char *url, CURLSH *share) {
-  CURL *req = curl_easy_init();
+/**
+ * Copy the value of a `name: value` header `line` of `len` bytes,
+ * without the trailing CRLF, or return NULL if `line` is another header
+ */
 
-  http_get_response_t *res = malloc(sizeof(http_get_response_t));
-  memset(res, 0, sizeof(http_get_response_t));
+static char *http_get_header_value(const char *line, size_t len, const char *name) {
+  size_t n = strlen(name);
+  if (len <= n || 0 != strncasecmp(line, name, n) || ':' != line[n]) return NULL;
 
-  if (share) {
-    curl_easy_setopt(req, CURLOPT_SHARE, share);
+  const char *start = line + n + 1;
+  const char *end = line + len;
+  while (start < end && (' ' == *start || '\t' == *start)) start++;
+  while (end > start && ('\r' == end[-1] || '\n' == end[-1] || ' ' == end[-1])) end--;
+
+  char *value = malloc(end - start + 1);
+  if (!value) return NULL;
+  memcpy(value, start, end - start);
+  value[end - start] = 0;
+  return value;
+}
+
+/**
+ * HTTP GET header callback, keeps the cache validators of the response
+ */
+
+static size_t http_get_header_cb(char *buffer, size_t size, size_t nitems, void *userp) {
+  size_t len = size * nitems;
+  http_get_response_t *res = userp;
+  char *value = NULL;
+
+  if ((value = http_get_header_value(buffer, len, "ETag"))) {
+    free(res->etag);
+    res->etag = value;
+  } else if ((value = http_get_header_value(buffer, len, "Last-Modified"))) {
+    free(res->last_modified);
+    res->last_modified = value;
+  }
+
+  return len;
+}
+
+static http_get_transfer_t *http_get_transfer_create(const char *url, CURLSH *share,
+                                                     const char *etag, const char *last_modified,
+                                                     http_get_stream_cb stream, void *data) {
+  struct curl_slist *headers = NULL;
+  char *header = NULL;
+
+  http_get_transfer_t *ctx = malloc(sizeof(http_get_transfer_t));
+  if (!ctx) return NULL;
+  memset(ctx, 0, sizeof(http_get_transfer_t));
+
+  ctx->stream = stream;
+  ctx->data = data;
+
+  if (!(ctx->res = malloc(sizeof(http_get_response_t)))) {
+    http_get_transfer_free(ctx);
+    return NULL;
+  }
+  memset(ctx->res, 0, sizeof(http_get_response_t));
+
+  CURL *req = ctx->req = curl_easy_init();
+  if (!req) {
+    http_get_transfer_free(ctx);
+    return NULL;
+  }
+
+  http_get_setopt_defaults(req, url, share);
+
+  if (etag && (header = malloc(strlen(etag) + sizeof("If-None-Match: ")))) {
+    sprintf(header, "If-None-Match: %s", etag);
+    headers = curl_slist_append(headers, header);
+    free(header);
+  }
+
+  if (last_modified && (header = malloc(strlen(last_modified) + sizeof("If-Modified-Since: ")))) {
+    sprintf(header, "If-Modified-Since: %s", last_modified);
+    headers = curl_slist_append(headers, header);
+    free(header);
+  }
+
+  if (headers) {
+    curl_easy_setopt(req, CURLOPT_HTTPHEADER, headers);
+    ctx->headers = headers;
   }
 
   curl_easy_setopt(req, CURLOPT_URL, url);
   curl_easy_setopt(req, CURLOPT_HTTPGET, 1);
   curl_easy_setopt(req, CURLOPT_FOLLOWLOCATION, 1);
   curl_easy_setopt(req, CURLOPT_WRITEFUNCTION, http_get_cb);
-  curl_easy_setopt(req, CURLOPT_WRITEDATA, (void *) res);
+  curl_easy_setopt(req, CURLOPT_WRITEDATA, (void *) ctx);
+  curl_easy_setopt(req, CURLOPT_HEADERFUNCTION, http_get_header_cb);
+  curl_easy_setopt(req, CURLOPT_HEADERDATA, (void *) ctx->res);
   curl_easy_setopt(req, CURLOPT_USERAGENT, "http-get.c/"HTTP_GET_VERSION);
+  curl_easy_setopt(req, CURLOPT_PRIVATE, ctx);
+
+  return ctx;
+}
+
+/**
+ * Prepare a conditional in-memory GET of `url` without performing it
+ */
+
+http_get_transfer_t *http_get_transfer_new(const char *url, CURLSH *share,
+                                           const char *etag, const char *last_modified) {
+  return http_get_transfer_create(url, share, etag, last_modified, NULL, NULL);
+}
+
+/**
+ * Complete a performed `transfer` that ended with the `CURLcode` `code`,
+ * free it and return its response
+ */
 
-  int c = curl_easy_perform(req);
+http_get_response_t *http_get_transfer_finish(http_get_transfer_t *ctx, int code) {
+  if (NULL == ctx) return NULL;
 
-  curl_easy_getinfo(req, CURLINFO_RESPONSE_CODE, &res->status);
-  res->ok = (200 == res->status && CURLE_ABORTED_BY_CALLBACK != c) ? 1 : 0;
-  curl_easy_cleanup(req);
+  http_get_response_t *res = ctx->res;
+  curl_easy_getinfo(ctx->req, CURLINFO_RESPONSE_CODE, &res->status);
+  res->retry_after = http_get_retry_after(ctx->req);
+#ifndef _WIN32
+  if (ctx->spill && 0 != http_get_map(ctx)) {
+    res->size = 0;
+    if (CURLE_OK == code) code = CURLE_WRITE_ERROR;
+  }
+#endif
+  res->code = code;
+  res->ok = (200 == res->status && CURLE_OK == code) ? 1 : 0;
+  http_get_account(ctx->req, res->size);
 
+  ctx->res = NULL;
+  http_get_transfer_free(ctx);
   return res;
 }
 
+/**
+ * Free an unfinished `transfer` and its partial response
+ */
+
+void http_get_transfer_free(http_get_transfer_t *ctx) {
+  if (NULL == ctx) return;
+  if (ctx->req) curl_easy_cleanup(ctx->req);
+  if (ctx->spill) fclose(ctx->spill);
+  curl_slist_free_all(ctx->headers);
+  http_get_free(ctx->res);
+  free(ctx);
+}
+
+static http_get_response_t *http_get_request(const char *url, CURLSH *share,
+                                             const char *etag, const char *last_modified,
+                                             http_get_stream_cb stream, void *data) {
+  for (int attempt = 0;; attempt++) {
+    http_get_transfer_t *ctx = http_get_transfer_create(url, share, etag, last_modified, stream, data);
+    if (!ctx) return NULL;
+
+    // the connection that stalled may be stuck still, don't wait on it again
+    if (attempt > 0) http_get_reconnect(ctx->req);
+
+    http_get_limit_acquire(url);
+    int c = curl_easy_perform(ctx->req);
+    http_get_response_t *res = http_get_transfer_finish(ctx, c);
+    http_get_limit_release(url, res ? res->status : 0, res ? res->retry_after : 0);
+
+    // what was streamed already can't be taken back
+    if (stream || attempt >= HTTP_GET_STALL_RETRIES || !http_get_stalled(c)) {
+      return res;
+    }
+
+    http_get_free(res);
+  }
+}
+
+/**
+ * Perform an HTTP(S) GET on `url` that the server may answer with
+ * `304 Not Modified` when `etag` or `last_modified` (either may be NULL)
+ * still describe its current version
+ */
+
+http_get_response_t *http_get_conditional_shared(const char *url, CURLSH *share,
+                                                 const char *etag, const char *last_modified) {
+  return http_get_request(url, share, etag, last_modified, NULL, NULL);
+}
+
+/**
+ * Perform an HTTP(S) GET on `url` handing each chunk of the body to
+ * `stream` as it arrives instead of buffering it.  The returned
+ * response has no `data`, only the status and the body size.
+ */
+
+http_get_response_t *http_get_stream_shared(const char *url, CURLSH *share,
+                                            http_get_stream_cb stream, void *data) {
+  return http_get_request(url, share, NULL, NULL, stream, data);
+}
+
+http_get_response_t *http_get_shared(const char *url, CURLSH *share) {
+  return http_get_request(url, share, NULL, NULL, NULL, NULL);
+}
+
 /**
  * Perform an HTTP(S) GET on `url`
  */
@@ -75,44 +643,207 @@ http_get_response_t *http_get(const char *url) {
 }
 
 /**
- * HTTP GET file write callback
+ * HTTP GET file write callback, buffered by stdio
  */
 
-static size_t http_get_file_cb(void *ptr, size_t size, size_t nmemb, void *stream) {
-  fflush(stream);
-  size_t n = fwrite(ptr, size, nmemb, stream);
+static size_t http_get_file_cb(void *ptr, size_t size, size_t nmemb, void *userp) {
+  http_get_file_transfer_t *transfer = userp;
+  size_t n = fwrite(ptr, size, nmemb, transfer->fp) * size;
+  transfer->size += n;
   return n;
 }
 
 /**
- * Request `url` and save to `file`
+ * File transfer header callback, keeps the ETag the file was served with
  */
 
-int http_get_file_shared(const char *url, const char *file, CURLSH *share) {
-  CURL *req = curl_easy_init();
-  if (!req) return -1;
+static size_t http_get_file_header_cb(char *buffer, size_t size, size_t nitems, void *userp) {
+  size_t len = size * nitems;
+  http_get_file_transfer_t *transfer = userp;
+  char *value = NULL;
 
-  FILE *fp = fopen(file, "wb");
-  if (!fp) return -1;
+  if ((value = http_get_header_value(buffer, len, "ETag"))) {
+    free(transfer->etag);
+    transfer->etag = value;
+  }
 
-  if (share) {
-    curl_easy_setopt(req, CURLOPT_SHARE, share);
+  return len;
+}
+
+static http_get_file_transfer_t *http_get_file_transfer_create(const char *url, const char *file,
+                                                               CURLSH *share, int resume) {
+  http_get_file_transfer_t *transfer = malloc(sizeof(http_get_file_transfer_t));
+  if (!transfer) return NULL;
+  memset(transfer, 0, sizeof(http_get_file_transfer_t));
+
+  transfer->file = strdup(file);
+  transfer->tmp = malloc(strlen(file) + sizeof(HTTP_GET_PART_SUFFIX));
+  transfer->buffer = malloc(HTTP_GET_FILE_BUFFER_SIZE);
+  if (!transfer->file || !transfer->tmp || !transfer->buffer) {
+    http_get_file_transfer_free(transfer);
+    return NULL;
+  }
+
+  sprintf(transfer->tmp, "%s" HTTP_GET_PART_SUFFIX, file);
+  transfer->resume = resume;
+
+  if (resume) {
+    struct stat st;
+    if (0 == stat(transfer->tmp, &st) && st.st_size > 0) {
+      transfer->offset = (long long) st.st_size;
+    }
+  }
+
+  if (!(transfer->req = curl_easy_init())) {
+    http_get_file_transfer_free(transfer);
+    return NULL;
+  }
+
+  if (!(transfer->fp = fopen(transfer->tmp, transfer->offset > 0 ? "ab" : "wb"))) {
+    http_get_file_transfer_free(transfer);
+    return NULL;
+  }
+
+  setvbuf(transfer->fp, transfer->buffer, _IOFBF, HTTP_GET_FILE_BUFFER_SIZE);
+
+  CURL *req = transfer->req;
+  http_get_setopt_defaults(req, url, share);
+
+  // byte ranges refer to the encoded body, keep it identity encoded
+  if (resume) {
+    curl_easy_setopt(req, CURLOPT_ACCEPT_ENCODING, NULL);
   }
 
   curl_easy_setopt(req, CURLOPT_URL, url);
   curl_easy_setopt(req, CURLOPT_HTTPGET, 1);
   curl_easy_setopt(req, CURLOPT_FOLLOWLOCATION, 1);
   curl_easy_setopt(req, CURLOPT_WRITEFUNCTION, http_get_file_cb);
-  curl_easy_setopt(req, CURLOPT_WRITEDATA, fp);
-  int res = curl_easy_perform(req);
+  curl_easy_setopt(req, CURLOPT_WRITEDATA, transfer);
+  curl_easy_setopt(req, CURLOPT_HEADERFUNCTION, http_get_file_header_cb);
+  curl_easy_setopt(req, CURLOPT_HEADERDATA, transfer);
+  curl_easy_setopt(req, CURLOPT_PRIVATE, transfer);
 
-  long status;
-  curl_easy_getinfo(req, CURLINFO_RESPONSE_CODE, &status);
+  if (transfer->offset > 0) {
+    curl_easy_setopt(req, CURLOPT_RESUME_FROM_LARGE, (curl_off_t) transfer->offset);
+  }
 
-  curl_easy_cleanup(req);
-  fclose(fp);
+  return transfer;
+}
+
+/**
+ * Prepare a transfer of `url` into `file` without performing it.
+ * The body is written to `<file>.part` and only renamed to `file` once
+ * the transfer succeeded, so failures never leave a truncated `file`.
+ */
+
+http_get_file_transfer_t *http_get_file_transfer_new(const char *url, const char *file, CURLSH *share) {
+  return http_get_file_transfer_create(url, file, share, 0);
+}
+
+/**
+ * Like `http_get_file_transfer_new()`, but continue an earlier download
+ * from the end of an existing `<file>.part` with a range request, and
+ * keep the partial file when the connection drops so a retry can resume.
+ */
+
+http_get_file_transfer_t *http_get_file_transfer_new_resumable(const char *url, const char *file, CURLSH *share) {
+  return http_get_file_transfer_create(url, file, share, 1);
+}
+
+/**
+ * Collect the status of a performed `transfer`, close its file and move
+ * it into place, or remove it when the transfer failed.
+ * `code` is the `CURLcode` the transfer completed with.
+ */
 
-  return (200 == status && CURLE_ABORTED_BY_CALLBACK != res) ? 0 : -1;
+int http_get_file_transfer_finish(http_get_file_transfer_t *transfer, int code) {
+  if (NULL == transfer) return -1;
+
+  curl_easy_getinfo(transfer->req, CURLINFO_RESPONSE_CODE, &transfer->status);
+  transfer->retry_after = http_get_retry_after(transfer->req);
+  http_get_account(transfer->req, transfer->size);
+  transfer->ok = (CURLE_OK == code &&
+                  (200 == transfer->status ||
+                   (206 == transfer->status && transfer->offset > 0))) ? 1 : 0;
+
+  if (transfer->fp) {
+    if (0 != fclose(transfer->fp)) transfer->ok = 0;
+    transfer->fp = NULL;
+  }
+
+  if (transfer->ok) {
+#ifdef _WIN32
+    remove(transfer->file);
+#endif
+    if (0 != rename(transfer->tmp, transfer->file)) transfer->ok = 0;
+  }
+
+  // an interrupted body can be continued later, anything else (including
+  // a server that refuses the range) starts over
+  if (!transfer->ok) {
+    int partial = CURLE_RANGE_ERROR != code &&
+                  (0 == transfer->status || 200 == transfer->status || 206 == transfer->status);
+    if (!transfer->resume || !partial) remove(transfer->tmp);
+  }
+
+  return transfer->ok ? 0 : -1;
+}
+
+/**
+ * Free the given `transfer`, discarding its file if it was never finished
+ */
+
+void http_get_file_transfer_free(http_get_file_transfer_t *transfer) {
+  if (NULL == transfer) return;
+  if (transfer->fp) {
+    fclose(transfer->fp);
+    remove(transfer->tmp);
+  }
+  if (transfer->req) curl_easy_cleanup(transfer->req);
+  free(transfer->buffer);
+  free(transfer->file);
+  free(transfer->tmp);
+  free(transfer->etag);
+  free(transfer);
+}
+
+static int http_get_file_perform(const char *url, const char *file, CURLSH *share, int resume) {
+  int rc = -1;
+
+  for (int attempt = 0; attempt <= HTTP_GET_STALL_RETRIES; attempt++) {
+    http_get_file_transfer_t *transfer = http_get_file_transfer_create(url, file, share, resume);
+    if (!transfer) return -1;
+
+    // a resumable transfer continues where the stalled one stopped
+    if (attempt > 0) http_get_reconnect(transfer->req);
+
+    http_get_limit_acquire(url);
+    int res = curl_easy_perform(transfer->req);
+    rc = http_get_file_transfer_finish(transfer, res);
+    http_get_limit_release(url, transfer->status, transfer->retry_after);
+
+    http_get_file_transfer_free(transfer);
+
+    if (0 == rc || !http_get_stalled(res)) break;
+  }
+
+  return rc;
+}
+
+/**
+ * Request `url` and save to `file`
+ */
+
+int http_get_file_shared(const char *url, const char *file, CURLSH *share) {
+  return http_get_file_perform(url, file, share, 0);
+}
+
+/**
+ * Request `url` and save to `file`, resuming an earlier partial download
+ */
+
+int http_get_file_resume_shared(const char *url, const char *file, CURLSH *share) {
+  return http_get_file_perform(url, file, share, 1);
 }
 
 int http_get_file(const char *url, const char *file) {
@@ -125,8 +856,17 @@ int http_get_file(const char *url, const char *file) {
 
 void http_get_free(http_get_response_t *res) {
   if (NULL == res) return;
+#ifndef _WIN32
+  if (res->mapped) {
+    munmap(res->data, res->mapped);
+    res->data = NULL;
+  }
+#endif
   if (NULL != res->data) free(res->data);
+  if (res->held) HTTP_GET_UNHELD(buffered, res->held);
   res->data = NULL;
+  free(res->etag);
+  free(res->last_modified);
   res->size = 0;
   free(res);
 }
@@ -10,6 +10,7 @@
 #ifndef HTTP_GET_H
 #define HTTP_GET_H 1
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #define HTTP_GET_VERSION "0.4.0"
@@ -19,14 +20,184 @@ typedef struct {
   size_t size;
   long status;
   int ok;
+  char *etag;
+  char *last_modified;
+  long retry_after;
+  int code; // the CURLcode the request ended with
+  size_t held;   // bytes of `data` counted as buffered, see http_get_memory()
+  size_t mapped; // when not 0, `data` maps as many bytes of a spilled body
 } http_get_response_t;
 
 http_get_response_t *http_get(const char *);
 http_get_response_t *http_get_shared(const char *, void *);
+http_get_response_t *http_get_conditional_shared(const char *, void *, const char *, const char *);
+
+/**
+ * Receives the body of a streamed request chunk by chunk, return
+ * non-zero to abort the transfer.
+ */
+
+typedef int (*http_get_stream_cb)(const char *, size_t, void *);
+
+http_get_response_t *http_get_stream_shared(const char *, void *, http_get_stream_cb, void *);
+
+/**
+ * A single in-memory GET that is driven by the caller, for example
+ * through a `curl_multi` handle.  `req` is the configured easy handle.
+ */
+
+typedef struct {
+  void *req;
+  void *headers;
+  http_get_response_t *res;
+  size_t capacity;
+  http_get_stream_cb stream;
+  void *data;
+  FILE *spill; // where the body goes once it doesn't fit the memory budget
+} http_get_transfer_t;
+
+http_get_transfer_t *http_get_transfer_new(const char *, void *, const char *, const char *);
+http_get_response_t *http_get_transfer_finish(http_get_transfer_t *, int);
+void http_get_transfer_free(http_get_transfer_t *);
 
 int http_get_file(const char *, const char *);
 int http_get_file_shared(const char *, const char *, void *);
+int http_get_file_resume_shared(const char *, const char *, void *);
 
 void http_get_free(http_get_response_t *);
 
+/**
+ * Byte counters across all requests: `wire_bytes` is what was received,
+ * `body_bytes` what was left after content decoding.
+ */
+
+typedef struct {
+  unsigned long long requests;
+  unsigned long long wire_bytes;
+  unsigned long long body_bytes;
+} http_get_stats_t;
+
+void http_get_set_compression(int);
+void http_get_stats(http_get_stats_t *);
+
+/**
+ * The bodies of in-memory requests count against a budget of `bytes`, 0
+ * for none, which is the default. A body that would take more than the
+ * budget has left, or more than `HTTP_GET_SPILL_SHARE`th of it on its
+ * own, is written to an unlinked file in `$TMPDIR` instead, which `data`
+ * maps once it is in. The bytes of a body count until it is freed.
+ */
+
+#define HTTP_GET_SPILL_SHARE 4
+
+typedef struct {
+  unsigned long long budget;
+  unsigned long long buffered; // what the bodies take now
+  unsigned long long peak;     // the most they took at once
+  unsigned long long spilled;  // bodies written to disk
+  unsigned long long spilled_bytes;
+} http_get_memory_t;
+
+void http_get_set_memory_budget(size_t);
+void http_get_memory(http_get_memory_t *);
+
+/**
+ * Whether the bodies in memory take the whole budget, for those driving
+ * transfers to hold new ones back until some are freed.
+ */
+
+int http_get_memory_exhausted(void);
+
+/**
+ * Off by default: lets a server that advertises HTTP/3 with `Alt-Svc`
+ * move later requests to it, when libcurl was built with it.
+ */
+
+void http_get_set_http3(int);
+
+/**
+ * Told about every finished request, on the thread that finished it:
+ * its `status`, the bytes it received and kept, whether it reused a
+ * connection, and how many seconds it took.
+ */
+
+typedef void (*http_get_observer_t)(const char *url, long status,
+                                    unsigned long long wire_bytes,
+                                    unsigned long long body_bytes,
+                                    int reused, double seconds);
+
+void http_get_set_observer(http_get_observer_t);
+
+/**
+ * Paces the requests that `http_get*()` perform itself: `acquire` is
+ * called with the url before a request starts and may block until it
+ * is allowed to, `release` once it is over with its `status` and the
+ * seconds the server asked to wait (`Retry-After`), or 0.  Transfers
+ * driven by the caller are paced by the caller.
+ */
+
+typedef void (*http_get_acquire_t)(const char *url);
+typedef void (*http_get_release_t)(const char *url, long status, long retry_after);
+
+void http_get_set_limiter(http_get_acquire_t, http_get_release_t);
+
+/**
+ * Called with the easy handle of every request, `http_get*()` or driven
+ * by the caller, and its url once the defaults are set, to set more.
+ */
+
+typedef void (*http_get_prepare_t)(void *req, const char *url);
+
+void http_get_set_prepare(http_get_prepare_t);
+
+/**
+ * Limits every request made from now on: the seconds to connect, the
+ * seconds for the whole request, and the bytes per second below which a
+ * transfer that lasts for `low_speed_time` seconds is aborted as stalled.
+ * 0 leaves a limit off, which they all are by default.
+ *
+ * `http_get*()` try a request that ran into one of them again over a new
+ * connection, up to `HTTP_GET_STALL_RETRIES` times, as they do one that
+ * failed over HTTP/3, which the new try leaves out. Callers driving
+ * transfers themselves can tell with `http_get_stalled()`, and have the
+ * next try do the same with `http_get_reconnect()`.
+ */
+
+#define HTTP_GET_STALL_RETRIES 1
+
+void http_get_set_timeouts(long connect, long total, long low_speed_limit, long low_speed_time);
+
+int http_get_stalled(int code);
+
+void http_get_reconnect(void *req);
+
+#define HTTP_GET_PART_SUFFIX ".part"
+#define HTTP_GET_FILE_BUFFER_SIZE (64 * 1024)
+
+/**
+ * A single file download that is driven by the caller, for example
+ * through a `curl_multi` handle.  `req` is the configured easy handle,
+ * the body lands in `tmp` until the transfer is finished.
+ */
+
+typedef struct {
+  void *req;
+  FILE *fp;
+  char *file;
+  char *tmp;
+  char *buffer;
+  long long offset;
+  size_t size;
+  int resume;
+  long status;
+  long retry_after;
+  char *etag; // the ETag the file was served with, or NULL
+  int ok;
+} http_get_file_transfer_t;
+
+http_get_file_transfer_t *http_get_file_transfer_new(const char *, const char *, void *);
+http_get_file_transfer_t *http_get_file_transfer_new_resumable(const char *, const char *, void *);
+int http_get_file_transfer_finish(http_get_file_transfer_t *, int);
+void http_get_file_transfer_free(http_get_file_transfer_t *);
+
 #endif
@@ -109,8 +109,20 @@ list_remove(list_t *self, list_node_t *node);
 void
 list_destroy(list_t *self);
 
+/*
+ * Iterate over the nodes of `list` from head to tail, setting `node` to
+ * each of them. Nodes must not be removed from `list` on the way.
+ */
+
+#define list_each(list, node) \
+  for ((node) = (list)->head; (node); (node) = (node)->next)
+
 // list_t iterator prototypes.
 
+void
+list_iterator_init(list_iterator_t *self, list_t *list,
+                   list_direction_t direction);
+
 list_iterator_t *
 list_iterator_new(list_t *list, list_direction_t direction);
 
@@ -7,6 +7,20 @@
 
 #include "list.h"
 
+/*
+ * Initialize the list_iterator_t `self`, which may live on
+ * the stack, to start at the head or the tail of `list`.
+ */
+
+void
+list_iterator_init(list_iterator_t *self, list_t *list,
+                   list_direction_t direction) {
+  self->next = direction == LIST_HEAD
+    ? list->head
+    : list->tail;
+  self->direction = direction;
+}
+
 /*
  * Allocate a new list_iterator_t. NULL on failure.
  * Accepts a direction, which may be LIST_HEAD or LIST_TAIL.
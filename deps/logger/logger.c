@@ -0,0 +1,241 @@
+//
+// logger.c
+//
+// Copyright (c) 2014 Stephen Mathieson
+// MIT licensed
+//
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+#else
+#include <unistd.h>
+#endif
+
+#include "logger.h"
+
+// lines up to this long are put together on the stack
+#define LOGGER_LINE_MAX 512
+
+// the colors console-colors gave the types, and the messages
+static const char *type_colors[] = {"\x1B[96m", "\x1B[33m", "\x1B[31m"};
+static const char *level_names[] = {"info", "warn", "error"};
+#define LOGGER_TEXT_COLOR "\x1B[90m"
+#define LOGGER_RESET "\x1B[39m"
+
+// -1 until first asked for; threads racing to set them agree on the value
+static int format = -1;
+static int stdout_colors = -1;
+static int stderr_colors = -1;
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+  int failed;
+  char stack[LOGGER_LINE_MAX];
+} line_t;
+
+static void line_init(line_t *line) {
+  line->data = line->stack;
+  line->len = 0;
+  line->cap = sizeof(line->stack);
+  line->failed = 0;
+}
+
+static void line_free(line_t *line) {
+  if (line->data != line->stack) free(line->data);
+}
+
+static int line_reserve(line_t *line, size_t n) {
+  if (line->failed) return -1;
+  if (line->len + n + 1 <= line->cap) return 0;
+
+  size_t cap = (line->len + n + 1) * 2;
+  char *data = line->data == line->stack
+    ? malloc(cap)
+    : realloc(line->data, cap);
+
+  if (!data) {
+    line->failed = 1;
+    return -1;
+  }
+
+  if (line->data == line->stack) memcpy(data, line->stack, line->len);
+  line->data = data;
+  line->cap = cap;
+  return 0;
+}
+
+static void line_append_n(line_t *line, const char *s, size_t n) {
+  if (0 != line_reserve(line, n)) return;
+  memcpy(line->data + line->len, s, n);
+  line->len += n;
+  line->data[line->len] = '\0';
+}
+
+static void line_append(line_t *line, const char *s) {
+  line_append_n(line, s, strlen(s));
+}
+
+static void line_vprintf(line_t *line, const char *fmt, va_list ap) {
+  va_list copy;
+  int n = 0;
+
+  if (line->failed) return;
+
+  va_copy(copy, ap);
+  n = vsnprintf(line->data + line->len, line->cap - line->len, fmt, copy);
+  va_end(copy);
+
+  if (n < 0) {
+    line->failed = 1;
+    return;
+  }
+
+  // it didn't fit, so once more with room for all of it
+  if ((size_t) n >= line->cap - line->len) {
+    if (0 != line_reserve(line, n)) return;
+    va_copy(copy, ap);
+    vsnprintf(line->data + line->len, line->cap - line->len, fmt, copy);
+    va_end(copy);
+  }
+
+  line->len += n;
+}
+
+static void line_printf(line_t *line, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  line_vprintf(line, fmt, ap);
+  va_end(ap);
+}
+
+static void line_append_json(line_t *line, const char *s) {
+  static const char hex[] = "0123456789abcdef";
+  const char *run = s;
+
+  line_append(line, "\"");
+
+  for (; *s; s++) {
+    unsigned char c = (unsigned char) *s;
+    char escape[7] = "\\u00";
+
+    if ('"' != c && '\\' != c && c >= 0x20) continue;
+
+    line_append_n(line, run, s - run);
+    run = s + 1;
+
+    if ('"' == c || '\\' == c) {
+      escape[1] = c;
+      escape[2] = '\0';
+    } else if ('\n' == c) {
+      strcpy(escape + 1, "n");
+    } else if ('\t' == c) {
+      strcpy(escape + 1, "t");
+    } else {
+      escape[4] = hex[c >> 4];
+      escape[5] = hex[c & 0xf];
+      escape[6] = '\0';
+    }
+
+    line_append(line, escape);
+  }
+
+  line_append_n(line, run, s - run);
+  line_append(line, "\"");
+}
+
+void logger_set_format(logger_format_t value) {
+  format = value;
+}
+
+static logger_format_t get_format(void) {
+  if (-1 == format) {
+    const char *env = getenv("CLIB_LOG_FORMAT");
+    format = env && 0 == strcmp("json", env)
+      ? LOGGER_FORMAT_JSON
+      : LOGGER_FORMAT_TEXT;
+  }
+
+  return (logger_format_t) format;
+}
+
+static int has_colors(FILE *stream) {
+  const char *no_color = getenv("NO_COLOR");
+
+  if (no_color && *no_color) return 0;
+
+#ifdef _WIN32
+  HANDLE console = GetStdHandle(stream == stdout
+    ? STD_OUTPUT_HANDLE
+    : STD_ERROR_HANDLE);
+  DWORD mode = 0;
+
+  return INVALID_HANDLE_VALUE != console
+    && GetConsoleMode(console, &mode)
+    && SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#else
+  return isatty(fileno(stream));
+#endif
+}
+
+/**
+ * Whether `stream` takes colors, asked once for each of them
+ */
+
+static int use_colors(FILE *stream) {
+  int *colors = stream == stdout ? &stdout_colors : &stderr_colors;
+
+  if (-1 == *colors) *colors = has_colors(stream);
+  return *colors;
+}
+
+void logger_log(logger_level_t level, const char *type_fmt, const char *type,
+                const char *fmt, ...) {
+  FILE *stream = LOGGER_ERROR == level ? stderr : stdout;
+  line_t line;
+  va_list ap;
+
+  line_init(&line);
+  va_start(ap, fmt);
+
+  if (LOGGER_FORMAT_JSON == get_format()) {
+    line_t message;
+
+    line_init(&message);
+    line_vprintf(&message, fmt, ap);
+
+    line_printf(&line, "{\"level\":\"%s\",\"type\":", level_names[level]);
+    line_append_json(&line, type ? type : "");
+    line_append(&line, ",\"message\":");
+    line_append_json(&line, message.failed ? "" : message.data);
+    line_printf(&line, ",\"time\":%lld}\n", (long long) time(NULL));
+    line_free(&message);
+  } else {
+    int colors = use_colors(stream);
+
+    if (colors) line_append(&line, type_colors[level]);
+    line_printf(&line, type_fmt, type);
+    if (colors) line_append(&line, LOGGER_RESET);
+    line_append(&line, " : ");
+    if (colors) line_append(&line, LOGGER_TEXT_COLOR);
+    line_vprintf(&line, fmt, ap);
+    if (colors) line_append(&line, LOGGER_RESET);
+    line_append(&line, "\n");
+  }
+
+  va_end(ap);
+
+  // a single write holds the lock of the stream for all of the line
+  if (!line.failed) fwrite(line.data, 1, line.len, stream);
+  line_free(&line);
+}
@@ -1,4 +1,3 @@
-
 //
 // logger.h
 //
@@ -10,43 +9,59 @@
 #define CLIB_LOGGER_H 1
 
 #include <stdio.h>
-#include "console-colors/console-colors.h"
 
 #ifndef CLIB_LOGGER_FMT
 #  define CLIB_LOGGER_FMT "  %10s"
 #endif
 
+typedef enum {
+  LOGGER_INFO,
+  LOGGER_WARN,
+  LOGGER_ERROR
+} logger_level_t;
+
+typedef enum {
+  LOGGER_FORMAT_TEXT,
+  // a JSON object per line: {"level":..,"type":..,"message":..,"time":..}
+  LOGGER_FORMAT_JSON
+} logger_format_t;
+
+/**
+ * Log a message of `level` to stdout, or to stderr for errors. The whole
+ * line is put together first and written with a single call, so lines
+ * logged by several threads at once never run into each other. Colors
+ * are only used on a terminal, unless `NO_COLOR` is set.
+ */
+
+void logger_log(logger_level_t level, const char *type_fmt, const char *type,
+                const char *fmt, ...);
+
+/**
+ * Log in `format` from now on. It is text by default, or JSON lines when
+ * the `CLIB_LOG_FORMAT` environment variable is "json".
+ */
+
+void logger_set_format(logger_format_t format);
+
 /**
  * Log an info message to stdout.
  */
 
-#define logger_info(type, ...) ({                          \
-  cc_fprintf(CC_FG_CYAN, stdout, CLIB_LOGGER_FMT, type);   \
-  fprintf(stdout, " : ");                                  \
-  cc_fprintf(CC_FG_DARK_GRAY, stdout, __VA_ARGS__);        \
-  fprintf(stdout, "\n");                                   \
-});
+#define logger_info(type, ...) \
+  logger_log(LOGGER_INFO, CLIB_LOGGER_FMT, type, __VA_ARGS__)
 
 /**
  * Log a warning to stdout.
  */
 
-#define logger_warn(type, ...) ({                               \
-  cc_fprintf(CC_FG_DARK_YELLOW, stdout, CLIB_LOGGER_FMT, type); \
-  fprintf(stdout, " : ");                                       \
-  cc_fprintf(CC_FG_DARK_GRAY, stdout, __VA_ARGS__);             \
-  fprintf(stdout, "\n");                                        \
-});
+#define logger_warn(type, ...) \
+  logger_log(LOGGER_WARN, CLIB_LOGGER_FMT, type, __VA_ARGS__)
 
 /**
  * Log an error message to stderr.
  */
 
-#define logger_error(type, ...) ({                           \
-  cc_fprintf(CC_FG_DARK_RED, stderr, CLIB_LOGGER_FMT, type); \
-  fprintf(stderr, " : ");                                    \
-  cc_fprintf(CC_FG_DARK_GRAY, stderr, __VA_ARGS__);          \
-  fprintf(stderr, "\n");                                     \
-});
+#define logger_error(type, ...) \
+  logger_log(LOGGER_ERROR, CLIB_LOGGER_FMT, type, __VA_ARGS__)
 
 #endif
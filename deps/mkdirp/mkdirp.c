@@ -10,7 +10,6 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
-#include "strdup/strdup.h"
 #include "path-normalize/path-normalize.h"
 #include "mkdirp.h"
 
@@ -20,49 +19,67 @@
 #define PATH_SEPARATOR   '/'
 #endif
 
+/*
+ * `mkdir(path, mode)`, where it's fine for `path` to exist
+ */
+
+static int
+make(const char *path, mode_t mode) {
+#ifdef _WIN32
+  // http://msdn.microsoft.com/en-us/library/2fkk4dzw.aspx
+  int rc = mkdir(path);
+#else
+  int rc = mkdir(path, mode);
+#endif
+  return 0 == rc || EEXIST == errno ? 0 : -1;
+}
+
 /*
  * Recursively `mkdir(path, mode)`
+ *
+ * The directory itself is tried first, as its parents usually exist,
+ * and only if they don't is the path cut back a separator at a time
+ * until a parent can be made, then put back together making the rest.
  */
 
 int
 mkdirp(const char *path, mode_t mode) {
   char *pathname = NULL;
-  char *parent = NULL;
+  char *end = NULL;
+  char *p = NULL;
 
   if (NULL == path) return -1;
 
   pathname = path_normalize(path);
-  if (NULL == pathname) goto fail;
+  if (NULL == pathname) return -1;
 
-  parent = strdup(pathname);
-  if (NULL == parent) goto fail;
+  if (0 == make(pathname, mode)) goto done;
+  if (ENOENT != errno) goto fail;
 
-  char *p = parent + strlen(parent);
-  while (PATH_SEPARATOR != *p && p != parent) {
-    p--;
-  }
-  *p = '\0';
+  end = pathname + strlen(pathname);
+  p = end;
 
-  // make parent dir
-  if (p != parent && 0 != mkdirp(parent, mode)) goto fail;
-  free(parent);
+  // walk up to the first parent that can be made
+  for (;;) {
+    while (p != pathname && PATH_SEPARATOR != *p) p--;
+    if (p == pathname) goto fail;
+    *p = '\0';
+    if (0 == make(pathname, mode)) break;
+    if (ENOENT != errno) goto fail;
+  }
 
-  // make this one if parent has been made
-  #ifdef _WIN32
-    // http://msdn.microsoft.com/en-us/library/2fkk4dzw.aspx
-    int rc = mkdir(pathname);
-  #else
-    int rc = mkdir(pathname, mode);
-  #endif
+  // and back down, making each of the rest
+  while (p != end) {
+    *p = PATH_SEPARATOR;
+    if (0 != make(pathname, mode)) goto fail;
+    p += strlen(p);
+  }
 
+done:
   free(pathname);
-
-  return 0 == rc || EEXIST == errno
-    ? 0
-    : -1;
+  return 0;
 
 fail:
   free(pathname);
-  free(parent);
   return -1;
 }
@@ -8,6 +8,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "str-find/str-find.h"
 #include "occurrences.h"
 
 /*
@@ -18,11 +19,14 @@ size_t
 occurrences(const char *needle, const char *haystack) {
   if (NULL == needle || NULL == haystack) return -1;
 
-  char *pos = (char *)haystack;
+  const char *pos = haystack;
+  const char *end = haystack + strlen(haystack);
   size_t i = 0;
   size_t l = strlen(needle);
 
-  while ((pos = strstr(pos, needle))) {
+  if (0 == l) return 0;
+
+  while ((pos = str_find(pos, end - pos, needle, l))) {
     pos += l;
     i++;
   }
@@ -7,97 +7,65 @@
 //
 
 #include <string.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include "strdup/strdup.h"
 #include "substr/substr.h"
 #include "parse-repo.h"
 
-char *
-parse_repo_owner(const char *slug, const char *fallback) {
-  char *copy = NULL;
-  char *owner = NULL;
-
-  if (NULL == slug) return NULL;
-  if (0 == strlen(slug)) return NULL;
-  if (!(copy = strdup(slug))) return NULL;
-
-  if ((owner = strchr(copy, '/'))) {
-    int delta = owner - copy;
-    if (!delta) {
-      free(copy);
-      return NULL;
-    }
-
-    char *tmp = substr(copy, 0, delta);
-    free(copy);
-    return tmp;
+int
+parse_repo(const char *slug, parse_repo_t *repo) {
+  const char *p = slug;
+  const char *slash = NULL;
+
+  memset(repo, 0, sizeof(parse_repo_t));
+  if (NULL == slug) return -1;
+
+  for (; *p && '@' != *p; p++) {
+    if ('/' == *p && NULL == slash) slash = p;
   }
 
-  if (fallback && 0 < strlen(copy) && '@' != copy[0]) {
-    owner = strdup(fallback);
+  if (slash) {
+    repo->owner.length = slash - slug;
+    repo->name.offset = slash - slug + 1;
   }
 
-  free(copy);
-  return owner;
+  repo->name.length = p - slug - repo->name.offset;
+
+  if ('@' == *p) {
+    repo->version.offset = p - slug + 1;
+    repo->version.length = strlen(p + 1);
+    if (0 == repo->version.length) return -1;
+  }
+
+  if (slash && 0 == repo->owner.length) return -1;
+  return 0 == repo->name.length ? -1 : 0;
 }
 
 char *
-parse_repo_name(const char *slug) {
-  char *owner = NULL;
-  char *copy = NULL;
-  char *name = NULL;
-  char *version = NULL;
-
-  if (NULL == slug) return NULL;
-  if (0 == strlen(slug)) return NULL;
-  if (!(copy = strdup(slug))) return NULL;
-
-  if ((version = strchr(copy, '@'))) {
-    int delta = version - copy;
-    char *tmp = substr(copy, 0, delta);
-    free(copy);
-    if (!tmp) return NULL;
-    copy = tmp;
-  }
+parse_repo_owner(const char *slug, const char *fallback) {
+  parse_repo_t repo;
 
-  if ((owner = strchr(copy, '/'))) {
-    int delta = owner - copy;
-    if (!delta) {
-      free(copy);
-      return NULL;
-    }
+  if (-1 == parse_repo(slug, &repo)) return NULL;
+  if (repo.owner.length) return substr_n(slug, repo.owner.length, 0, -1);
+  return fallback ? strdup(fallback) : NULL;
+}
 
-    char *tmp = substr(copy, delta + 1, -1);
-    free(copy);
-    copy = tmp;
-  }
+char *
+parse_repo_name(const char *slug) {
+  parse_repo_t repo;
 
-  if (copy) name = strdup(copy);
-  free(copy);
-  return name;
+  if (-1 == parse_repo(slug, &repo)) return NULL;
+  return substr_n(slug + repo.name.offset, repo.name.length, 0, -1);
 }
 
 char *
 parse_repo_version(const char *slug, const char *fallback) {
-  // malformed slugs
-  if (NULL == slug) return NULL;
-  if (0 == strlen(slug)) return NULL;
-  char *name = parse_repo_name(slug);
-  if (NULL == name) return NULL;
-  free(name);
-
-  char *version = strchr(slug, '@');
-  if (version) {
-    version++;
-    // malformed
-    if (0 == strlen(version)) return NULL;
-    // * <-> master
-    if ('*' == version[0]) return strdup("master");
-    return strdup(version);
-  }
+  parse_repo_t repo;
+
+  if (-1 == parse_repo(slug, &repo)) return NULL;
+  if (0 == repo.version.length) return fallback ? strdup(fallback) : NULL;
 
-  version = NULL;
-  if (fallback) version = strdup(fallback);
-  return version;
+  // * <-> master
+  if ('*' == slug[repo.version.offset]) return strdup("master");
+  return strdup(slug + repo.version.offset);
 }
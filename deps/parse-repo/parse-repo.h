@@ -9,6 +9,41 @@
 #ifndef PARSE_REPO_H
 #define PARSE_REPO_H 1
 
+#include <stddef.h>
+
+/**
+ * Where a part of a slug is, `length` being 0 when
+ * the slug doesn't have it.
+ */
+
+typedef struct {
+  size_t offset;
+  size_t length;
+} parse_repo_span_t;
+
+/**
+ * The parts of an `owner/name@version` slug.
+ */
+
+typedef struct {
+  parse_repo_span_t owner;
+  parse_repo_span_t name;
+  parse_repo_span_t version;
+} parse_repo_t;
+
+/**
+ * Find the owner, name and version in the given slug,
+ * in one pass and without copying them.  The owner
+ * and the version are optional, a `*` version is left
+ * as is.
+ *
+ * Returns -1 when the slug is malformed: empty, or
+ * with an empty owner, name or version.
+ */
+
+int
+parse_repo(const char *, parse_repo_t *);
+
 /**
  * Parse the repo owner from the given slug.  If
  * no owner is provided and `fallback != NULL`,
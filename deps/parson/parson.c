@@ -32,9 +32,32 @@
 #include <ctype.h>
 #include <math.h>
 
+/* Strings are scanned by aligned blocks, which may read past their end.
+   That is safe, but not to the address sanitizer. */
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define PARSON_ASAN
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#define PARSON_ASAN
+#endif
+
+#if defined(__SSE2__) && !defined(PARSON_ASAN)
+#define PARSON_SCAN_SSE2
+#include <stdint.h>
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !defined(PARSON_ASAN)
+#define PARSON_SCAN_NEON
+#include <stdint.h>
+#include <arm_neon.h>
+#endif
+
 #define STARTING_CAPACITY         15
 #define ARRAY_MAX_CAPACITY    122880 /* 15*(2^13) */
 #define OBJECT_MAX_CAPACITY      960 /* 15*(2^6)  */
+#define OBJECT_HASH_THRESHOLD     16 /* objects with more names get a hash index */
+#define OBJECT_NOT_FOUND      ((size_t)-1)
 #define MAX_NESTING               19
 #define DOUBLE_SERIALIZATION_FORMAT "%f"
 
@@ -71,6 +94,8 @@ struct json_object_t {
     JSON_Value **values;
     size_t       count;
     size_t       capacity;
+    size_t      *cells;          /* hash index of names, 1 + their index, 0 if empty; NULL if small */
+    size_t       cells_capacity; /* power of 2, at least twice capacity */
 };
 
 struct json_array_t {
@@ -95,6 +120,8 @@ static JSON_Object * json_object_init(void);
 static JSON_Status   json_object_add(JSON_Object *object, const char *name, JSON_Value *value);
 static JSON_Status   json_object_resize(JSON_Object *object, size_t new_capacity);
 static JSON_Value  * json_object_nget_value(const JSON_Object *object, const char *name, size_t n);
+static size_t        json_object_nget_index(const JSON_Object *object, const char *name, size_t n);
+static void          json_object_reindex(JSON_Object *object);
 static void          json_object_free(JSON_Object *object);
 
 /* JSON Array */
@@ -108,6 +135,7 @@ static JSON_Value * json_value_init_string_no_copy(char *string);
 
 /* Parser */
 static void         skip_quotes(const char **string);
+static const char * scan_string(const char *string);
 static int          parse_utf_16(const char **unprocessed, char **processed);
 static char *       process_string(const char *input, size_t len);
 static char *       get_quoted_string(const char **string);
@@ -295,9 +323,51 @@ static JSON_Object * json_object_init(void) {
     new_obj->values = (JSON_Value**)NULL;
     new_obj->capacity = 0;
     new_obj->count = 0;
+    new_obj->cells = (size_t*)NULL;
+    new_obj->cells_capacity = 0;
     return new_obj;
 }
 
+static size_t hash_name(const char *name, size_t n) {
+    size_t hash = 2166136261u; /* FNV-1a */
+    size_t i;
+    for (i = 0; i < n; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void json_object_index_name(JSON_Object *object, size_t index) {
+    size_t mask = object->cells_capacity - 1;
+    const char *name = object->names[index];
+    size_t cell = hash_name(name, strlen(name)) & mask;
+    while (object->cells[cell] != 0) {
+        cell = (cell + 1) & mask;
+    }
+    object->cells[cell] = index + 1;
+}
+
+/* (Re)builds the hash index of large objects, and drops it for small ones.
+   Without memory for it, names are looked up one by one as in small ones. */
+static void json_object_reindex(JSON_Object *object) {
+    size_t cells_capacity = 1, i;
+    parson_free(object->cells);
+    object->cells = (size_t*)NULL;
+    object->cells_capacity = 0;
+    if (object->count <= OBJECT_HASH_THRESHOLD)
+        return;
+    while (cells_capacity < object->capacity * 2)
+        cells_capacity *= 2;
+    object->cells = (size_t*)parson_malloc(cells_capacity * sizeof(size_t));
+    if (object->cells == NULL)
+        return;
+    memset(object->cells, 0, cells_capacity * sizeof(size_t));
+    object->cells_capacity = cells_capacity;
+    for (i = 0; i < object->count; i++) {
+        json_object_index_name(object, i);
+    }
+}
+
 static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_Value *value) {
     size_t index = 0;
     if (object == NULL || name == NULL || value == NULL) {
@@ -318,6 +388,11 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
         return JSONFailure;
     object->values[index] = value;
     object->count++;
+    if (object->cells != NULL) {
+        json_object_index_name(object, index);
+    } else if (object->count > OBJECT_HASH_THRESHOLD) {
+        json_object_reindex(object);
+    }
     return JSONSuccess;
 }
 
@@ -350,19 +425,37 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
     object->names = temp_names;
     object->values = temp_values;
     object->capacity = new_capacity;
+    if (object->cells != NULL)
+        json_object_reindex(object);
     return JSONSuccess;
 }
 
-static JSON_Value * json_object_nget_value(const JSON_Object *object, const char *name, size_t n) {
-    size_t i, name_length;
-    for (i = 0; i < json_object_get_count(object); i++) {
+static size_t json_object_nget_index(const JSON_Object *object, const char *name, size_t n) {
+    size_t i, name_length, mask, cell;
+    if (object == NULL)
+        return OBJECT_NOT_FOUND;
+    if (object->cells != NULL) {
+        mask = object->cells_capacity - 1;
+        for (cell = hash_name(name, n) & mask; object->cells[cell] != 0; cell = (cell + 1) & mask) {
+            i = object->cells[cell] - 1;
+            if (strncmp(object->names[i], name, n) == 0 && object->names[i][n] == '\0')
+                return i;
+        }
+        return OBJECT_NOT_FOUND;
+    }
+    for (i = 0; i < object->count; i++) {
         name_length = strlen(object->names[i]);
         if (name_length != n)
             continue;
         if (strncmp(object->names[i], name, n) == 0)
-            return object->values[i];
+            return i;
     }
-    return NULL;
+    return OBJECT_NOT_FOUND;
+}
+
+static JSON_Value * json_object_nget_value(const JSON_Object *object, const char *name, size_t n) {
+    size_t i = json_object_nget_index(object, name, n);
+    return i == OBJECT_NOT_FOUND ? NULL : object->values[i];
 }
 
 static void json_object_free(JSON_Object *object) {
@@ -372,6 +465,7 @@ static void json_object_free(JSON_Object *object) {
     }
     parson_free(object->names);
     parson_free(object->values);
+    parson_free(object->cells);
     parson_free(object);
 }
 
@@ -450,6 +544,66 @@ static void skip_quotes(const char **string) {
     SKIP_CHAR(string);
 }
 
+/* Returns the first quote, backslash or control character from string on,
+   which ends a run that needs no unescaping. Aligned blocks of 16 bytes are
+   tested at once where the vector instructions are known to be there: they
+   don't cross a page, so reading past the terminating '\0' is safe. */
+static const char * scan_string(const char *string) {
+#if defined(PARSON_SCAN_SSE2)
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    const char *block = (const char*)((uintptr_t)string & ~(uintptr_t)15);
+    unsigned int skip = (unsigned int)(string - block);
+    unsigned int mask = 0;
+    for (;;) {
+        __m128i bytes = _mm_load_si128((const __m128i*)block);
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, quote),
+                         _mm_cmpeq_epi8(bytes, backslash)),
+            /* unsigned bytes up to 0x1F */
+            _mm_cmpeq_epi8(_mm_max_epu8(bytes, control), control));
+        /* leaves out the bytes of the block before string */
+        mask = ((unsigned int)_mm_movemask_epi8(special) >> skip) << skip;
+        if (mask != 0) {
+            return block + __builtin_ctz(mask);
+        }
+        block += 16;
+        skip = 0;
+    }
+#else
+#if defined(PARSON_SCAN_NEON)
+    const char *block = (const char*)((uintptr_t)string & ~(uintptr_t)15);
+    if (block != string) {
+        block += 16;
+    }
+    while (string < block) {
+        if (*string == '\"' || *string == '\\' ||
+            (unsigned char)*string < 0x20) {
+            return string;
+        }
+        string++;
+    }
+    for (;;) {
+        uint8x16_t bytes = vld1q_u8((const uint8_t*)string);
+        uint8x16_t special = vorrq_u8(
+            vorrq_u8(vceqq_u8(bytes, vdupq_n_u8('\"')),
+                     vceqq_u8(bytes, vdupq_n_u8('\\'))),
+            vcltq_u8(bytes, vdupq_n_u8(0x20)));
+        if (vmaxvq_u8(special) != 0) {
+            break;
+        }
+        string += 16;
+    }
+#endif
+    while (*string != '\"' && *string != '\\' &&
+           (unsigned char)*string >= 0x20) {
+        string++;
+    }
+    return string;
+#endif
+}
+
 static int parse_utf_16(const char **unprocessed, char **processed) {
     unsigned int cp, lead, trail;
     char *processed_ptr = *processed;
@@ -494,11 +648,12 @@ static int parse_utf_16(const char **unprocessed, char **processed) {
 Example: "\u006Corem ipsum" -> lorem ipsum */
 static char* process_string(const char *input, size_t len) {
     const char *input_ptr = input;
-    size_t initial_size = (len + 1) * sizeof(char);
-    size_t final_size = 0;
-    char *output = (char*)parson_malloc(initial_size);
+    /* unescaping only ever shortens it, by a few bytes at most for a
+       string with escapes: not worth another allocation and copy */
+    char *output = (char*)parson_malloc((len + 1) * sizeof(char));
     char *output_ptr = output;
-    char *resized_output = NULL;
+    if (output == NULL)
+        return NULL;
     while ((*input_ptr != '\0') && (size_t)(input_ptr - input) < len) {
         if (*input_ptr == '\\') {
             input_ptr++;
@@ -527,14 +682,7 @@ static char* process_string(const char *input, size_t len) {
         input_ptr++;
     }
     *output_ptr = '\0';
-    /* resize to new length */
-    final_size = (size_t)(output_ptr-output) + 1;
-    resized_output = (char*)parson_malloc(final_size);
-    if (resized_output == NULL)
-        goto error;
-    memcpy(resized_output, output, final_size);
-    parson_free(output);
-    return resized_output;
+    return output;
 error:
     parson_free(output);
     return NULL;
@@ -544,7 +692,19 @@ error:
    skips passed argument to a matching quote. */
 static char * get_quoted_string(const char **string) {
     const char *string_start = *string;
+    const char *string_end = scan_string(string_start + 1);
     size_t string_len = 0;
+    char *output = NULL;
+    if (*string_end == '\"') { /* nothing to unescape, as in most strings */
+        string_len = string_end - string_start - 1;
+        output = (char*)parson_malloc(string_len + 1);
+        if (output == NULL)
+            return NULL;
+        memcpy(output, string_start + 1, string_len);
+        output[string_len] = '\0';
+        *string = string_end + 1;
+        return output;
+    }
     skip_quotes(string);
     if (**string == '\0')
         return NULL;
@@ -1458,15 +1618,12 @@ JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Va
     JSON_Value *old_value;
     if (object == NULL || name == NULL || value == NULL)
         return JSONFailure;
-    old_value = json_object_get_value(object, name);
-    if (old_value != NULL) { /* free and overwrite old value */
+    i = json_object_nget_index(object, name, strlen(name));
+    if (i != OBJECT_NOT_FOUND) { /* free and overwrite old value */
+        old_value = object->values[i];
         json_value_free(old_value);
-        for (i = 0; i < json_object_get_count(object); i++) {
-            if (strcmp(object->names[i], name) == 0) {
-                object->values[i] = value;
-                return JSONSuccess;
-            }
-        }
+        object->values[i] = value;
+        return JSONSuccess;
     }
     /* add new key value pair */
     return json_object_add(object, name, value);
@@ -1565,22 +1722,22 @@ JSON_Status json_object_dotset_null(JSON_Object *object, const char *name) {
 
 JSON_Status json_object_remove(JSON_Object *object, const char *name) {
     size_t i = 0, last_item_index = 0;
-    if (object == NULL || json_object_get_value(object, name) == NULL)
+    if (object == NULL || name == NULL)
+        return JSONFailure;
+    i = json_object_nget_index(object, name, strlen(name));
+    if (i == OBJECT_NOT_FOUND)
         return JSONFailure;
     last_item_index = json_object_get_count(object) - 1;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        if (strcmp(object->names[i], name) == 0) {
-            parson_free(object->names[i]);
-            json_value_free(object->values[i]);
-            if (i != last_item_index) { /* Replace key value pair with one from the end */
-                object->names[i] = object->names[last_item_index];
-                object->values[i] = object->values[last_item_index];
-            }
-            object->count -= 1;
-            return JSONSuccess;
-        }
-    }
-    return JSONFailure; /* No execution path should end here */
+    parson_free(object->names[i]);
+    json_value_free(object->values[i]);
+    if (i != last_item_index) { /* Replace key value pair with one from the end */
+        object->names[i] = object->names[last_item_index];
+        object->values[i] = object->values[last_item_index];
+    }
+    object->count -= 1;
+    /* the index of the moved pair changed */
+    json_object_reindex(object);
+    return JSONSuccess;
 }
 
 JSON_Status json_object_dotremove(JSON_Object *object, const char *name) {
@@ -1611,6 +1768,7 @@ JSON_Status json_object_clear(JSON_Object *object) {
         json_value_free(object->values[i]);
     }
     object->count = 0;
+    json_object_reindex(object);
     return JSONSuccess;
 }
 
@@ -8,9 +8,6 @@
 
 #include <string.h>
 #include <stdlib.h>
-#include "strdup/strdup.h"
-#include "str-ends-with/str-ends-with.h"
-#include "str-starts-with/str-starts-with.h"
 #include "path-join.h"
 
 #ifdef _WIN32
@@ -25,29 +22,38 @@
 
 char *
 path_join(const char *dir, const char *file) {
-  int size = strlen(dir) + strlen(file) + 2;
-  char *buf = malloc(size * sizeof(char));
+  return path_join_n(dir, strlen(dir), file, strlen(file));
+}
+
+/*
+ * Join the `dir_len` bytes of `dir` with the `file_len` bytes of `file`
+ */
+
+char *
+path_join_n(const char *dir, size_t dir_len, const char *file, size_t file_len) {
+  size_t sep_len = strlen(PATH_JOIN_SEPERATOR);
+  char *buf = malloc(dir_len + sep_len + file_len + 1);
+  char *end = buf;
   if (NULL == buf) return NULL;
 
-  strcpy(buf, dir);
+  memcpy(end, dir, dir_len);
+  end += dir_len;
 
   // add the sep if necessary
-  if (!str_ends_with(dir, PATH_JOIN_SEPERATOR)) {
-    strcat(buf, PATH_JOIN_SEPERATOR);
+  if (dir_len < sep_len
+      || 0 != memcmp(dir + dir_len - sep_len, PATH_JOIN_SEPERATOR, sep_len)) {
+    memcpy(end, PATH_JOIN_SEPERATOR, sep_len);
+    end += sep_len;
   }
 
   // remove the sep if necessary
-  if (str_starts_with(file, PATH_JOIN_SEPERATOR)) {
-    char *filecopy = strdup(file);
-    if (NULL == filecopy) {
-      free(buf);
-      return NULL;
-    }
-    strcat(buf, ++filecopy);
-    free(--filecopy);
-  } else {
-    strcat(buf, file);
+  if (file_len >= sep_len
+      && 0 == memcmp(file, PATH_JOIN_SEPERATOR, sep_len)) {
+    file += sep_len;
+    file_len -= sep_len;
   }
 
+  memcpy(end, file, file_len);
+  end[file_len] = '\0';
   return buf;
 }
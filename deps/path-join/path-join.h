@@ -10,7 +10,12 @@
 #ifndef PATH_JOIN_H
 #define PATH_JOIN_H 1
 
+#include <stddef.h>
+
 char *
 path_join(const char *, const char *);
 
+char *
+path_join_n(const char *, size_t, const char *, size_t);
+
 #endif
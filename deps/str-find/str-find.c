@@ -0,0 +1,143 @@
+//
+// str-find.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include <string.h>
+#include "str-find.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#define FOLD(c) ((unsigned char) (c) - 'A' < 26u \
+                  ? (unsigned char) (c) | 0x20 \
+                  : (unsigned char) (c))
+
+/*
+ * Whether the needle is at `at`, given its first and last bytes are
+ */
+
+static int
+matches(const char *at, const char *needle, size_t n, int fold) {
+  if (!fold) return n < 3 || 0 == memcmp(at + 1, needle + 1, n - 2);
+  for (size_t j = 1; j + 1 < n; j++) {
+    if (FOLD(at[j]) != FOLD(needle[j])) return 0;
+  }
+  return 1;
+}
+
+/*
+ * The first and last bytes of the needle rule most places out, several
+ * at a time where the vector instructions are known to be there, and a
+ * byte at a time for the rest.
+ */
+
+static const char *
+find(const char *h, size_t len, const char *needle, size_t n, int fold) {
+  if (0 == n) return h;
+  if (len < n) return NULL;
+
+  unsigned char first = fold ? FOLD(needle[0]) : (unsigned char) needle[0];
+  unsigned char last = fold ? FOLD(needle[n - 1]) : (unsigned char) needle[n - 1];
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  const __m256i vfirst = _mm256_set1_epi8((char) first);
+  const __m256i vlast = _mm256_set1_epi8((char) last);
+  const __m256i before_a = _mm256_set1_epi8('A' - 1);
+  const __m256i after_z = _mm256_set1_epi8('Z' + 1);
+  const __m256i lower = _mm256_set1_epi8(0x20);
+
+  for (; i + n - 1 + 32 <= len; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (h + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *) (h + i + n - 1));
+    if (fold) {
+      // signed, so bytes past ASCII are never upper case
+      a = _mm256_or_si256(a, _mm256_and_si256(lower, _mm256_and_si256(
+        _mm256_cmpgt_epi8(a, before_a), _mm256_cmpgt_epi8(after_z, a))));
+      b = _mm256_or_si256(b, _mm256_and_si256(lower, _mm256_and_si256(
+        _mm256_cmpgt_epi8(b, before_a), _mm256_cmpgt_epi8(after_z, b))));
+    }
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_and_si256(
+      _mm256_cmpeq_epi8(a, vfirst), _mm256_cmpeq_epi8(b, vlast)));
+    for (; mask; mask &= mask - 1) {
+      const char *at = h + i + __builtin_ctz(mask);
+      if (matches(at, needle, n, fold)) return at;
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i vfirst = _mm_set1_epi8((char) first);
+  const __m128i vlast = _mm_set1_epi8((char) last);
+  const __m128i before_a = _mm_set1_epi8('A' - 1);
+  const __m128i after_z = _mm_set1_epi8('Z' + 1);
+  const __m128i lower = _mm_set1_epi8(0x20);
+
+  for (; i + n - 1 + 16 <= len; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *) (h + i));
+    __m128i b = _mm_loadu_si128((const __m128i *) (h + i + n - 1));
+    if (fold) {
+      // signed, so bytes past ASCII are never upper case
+      a = _mm_or_si128(a, _mm_and_si128(lower, _mm_and_si128(
+        _mm_cmpgt_epi8(a, before_a), _mm_cmplt_epi8(a, after_z))));
+      b = _mm_or_si128(b, _mm_and_si128(lower, _mm_and_si128(
+        _mm_cmpgt_epi8(b, before_a), _mm_cmplt_epi8(b, after_z))));
+    }
+    unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_and_si128(
+      _mm_cmpeq_epi8(a, vfirst), _mm_cmpeq_epi8(b, vlast)));
+    for (; mask; mask &= mask - 1) {
+      const char *at = h + i + __builtin_ctz(mask);
+      if (matches(at, needle, n, fold)) return at;
+    }
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t vfirst = vdupq_n_u8(first);
+  const uint8x16_t vlast = vdupq_n_u8(last);
+
+  for (; i + n - 1 + 16 <= len; i += 16) {
+    uint8x16_t a = vld1q_u8((const uint8_t *) (h + i));
+    uint8x16_t b = vld1q_u8((const uint8_t *) (h + i + n - 1));
+    if (fold) {
+      a = vorrq_u8(a, vandq_u8(vdupq_n_u8(0x20),
+        vcltq_u8(vsubq_u8(a, vdupq_n_u8('A')), vdupq_n_u8(26))));
+      b = vorrq_u8(b, vandq_u8(vdupq_n_u8(0x20),
+        vcltq_u8(vsubq_u8(b, vdupq_n_u8('A')), vdupq_n_u8(26))));
+    }
+    uint8x16_t found = vandq_u8(vceqq_u8(a, vfirst), vceqq_u8(b, vlast));
+    if (0 == vmaxvq_u8(found)) continue;
+    for (size_t k = i; k < i + 16; k++) {
+      if (first == (fold ? FOLD(h[k]) : (unsigned char) h[k])
+          && last == (fold ? FOLD(h[k + n - 1]) : (unsigned char) h[k + n - 1])
+          && matches(h + k, needle, n, fold)) {
+        return h + k;
+      }
+    }
+  }
+#endif
+
+  for (; i <= len - n; i++) {
+    if (first != (fold ? FOLD(h[i]) : (unsigned char) h[i])) continue;
+    if (last != (fold ? FOLD(h[i + n - 1]) : (unsigned char) h[i + n - 1])) continue;
+    if (matches(h + i, needle, n, fold)) return h + i;
+  }
+
+  return NULL;
+}
+
+const char *
+str_find(const char *haystack, size_t haystack_len,
+         const char *needle, size_t needle_len) {
+  return find(haystack, haystack_len, needle, needle_len, 0);
+}
+
+const char *
+str_case_find(const char *haystack, size_t haystack_len,
+              const char *needle, size_t needle_len) {
+  return find(haystack, haystack_len, needle, needle_len, 1);
+}
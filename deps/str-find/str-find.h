@@ -0,0 +1,31 @@
+//
+// str-find.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef STR_FIND_H
+#define STR_FIND_H 1
+
+#include <stddef.h>
+
+/**
+ * Find the first `needle_len` bytes of `needle` in the first
+ * `haystack_len` bytes of `haystack`.  Returns where they start,
+ * `haystack` for an empty needle, or NULL.
+ */
+
+const char *
+str_find(const char *haystack, size_t haystack_len,
+         const char *needle, size_t needle_len);
+
+/**
+ * Like `str_find()`, ignoring the case of ASCII letters.
+ */
+
+const char *
+str_case_find(const char *haystack, size_t haystack_len,
+              const char *needle, size_t needle_len);
+
+#endif
@@ -8,7 +8,7 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include "occurrences/occurrences.h"
+#include "str-find/str-find.h"
 #include "strdup/strdup.h"
 #include "str-replace.h"
 
@@ -18,31 +18,37 @@
 
 char *
 str_replace(const char *str, const char *sub, const char *replace) {
-  char *pos = (char *) str;
-  int count = occurrences(sub, str);
-
-  if (0 >= count) return strdup(str);
+  size_t str_len = strlen(str);
+  size_t sub_len = strlen(sub);
+  size_t replace_len = strlen(replace);
+  const char *end = str + str_len;
+  const char *pos = str;
+  const char *current = NULL;
+  size_t count = 0;
+
+  if (0 == sub_len) return strdup(str);
+
+  while ((current = str_find(pos, end - pos, sub, sub_len))) {
+    pos = current + sub_len;
+    count++;
+  }
 
-  int size = (
-        strlen(str)
-      - (strlen(sub) * count)
-      + strlen(replace) * count
-    ) + 1;
+  if (0 == count) return strdup(str);
 
-  char *result = (char *) malloc(size);
+  char *result = malloc(str_len - sub_len * count + replace_len * count + 1);
   if (NULL == result) return NULL;
-  memset(result, '\0', size);
-  char *current;
-  while ((current = strstr(pos, sub))) {
-    int len = current - pos;
-    strncat(result, pos, len);
-    strncat(result, replace, strlen(replace));
-    pos = current + strlen(sub);
-  }
 
-  if (pos != (str + strlen(str))) {
-    strncat(result, pos, (str - pos));
+  char *out = result;
+  pos = str;
+  while ((current = str_find(pos, end - pos, sub, sub_len))) {
+    memcpy(out, pos, current - pos);
+    out += current - pos;
+    memcpy(out, replace, replace_len);
+    out += replace_len;
+    pos = current + sub_len;
   }
 
+  memcpy(out, pos, end - pos);
+  out[end - pos] = '\0';
   return result;
 }
@@ -0,0 +1,157 @@
+//
+// strbuf.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "strbuf.h"
+
+#define STRBUF_MIN_CAP 64
+
+/*
+ * View `str`
+ */
+
+strview_t
+strview(const char *str) {
+  strview_t view = { str, str ? strlen(str) : 0 };
+  return view;
+}
+
+/*
+ * View the `len` bytes at `str`
+ */
+
+strview_t
+strview_n(const char *str, size_t len) {
+  strview_t view = { str, len };
+  return view;
+}
+
+/*
+ * Copy `view` into a new NUL terminated string
+ */
+
+char *
+strview_dup(strview_t view) {
+  char *str = malloc(view.len + 1);
+  if (NULL == str) return NULL;
+  if (view.len) memcpy(str, view.data, view.len);
+  str[view.len] = '\0';
+  return str;
+}
+
+/*
+ * Make room for `extra` more bytes in `buf`, and its terminator.
+ * Returns -1 on failure
+ */
+
+int
+strbuf_grow(strbuf_t *buf, size_t extra) {
+  size_t need = buf->len + extra + 1;
+  if (need <= buf->cap) return 0;
+
+  size_t cap = buf->cap ? buf->cap : STRBUF_MIN_CAP;
+  while (cap < need) cap *= 2;
+
+  char *data = realloc(buf->data, cap);
+  if (NULL == data) return -1;
+
+  buf->data = data;
+  buf->cap = cap;
+  return 0;
+}
+
+/*
+ * Append the `len` bytes at `str` to `buf`
+ */
+
+int
+strbuf_append_n(strbuf_t *buf, const char *str, size_t len) {
+  if (-1 == strbuf_grow(buf, len)) return -1;
+  if (len) memcpy(buf->data + buf->len, str, len);
+  buf->len += len;
+  buf->data[buf->len] = '\0';
+  return 0;
+}
+
+/*
+ * Append `str` to `buf`
+ */
+
+int
+strbuf_append(strbuf_t *buf, const char *str) {
+  return strbuf_append_n(buf, str, strlen(str));
+}
+
+/*
+ * Append `view` to `buf`
+ */
+
+int
+strbuf_append_view(strbuf_t *buf, strview_t view) {
+  return strbuf_append_n(buf, view.data, view.len);
+}
+
+/*
+ * Append `c` to `buf`
+ */
+
+int
+strbuf_append_char(strbuf_t *buf, char c) {
+  return strbuf_append_n(buf, &c, 1);
+}
+
+/*
+ * Append the `count` strings of `array` to `buf`, separated by `sep`
+ */
+
+int
+strbuf_join(strbuf_t *buf, const char *array[], int count, char sep) {
+  for (int i = 0; i < count; i++) {
+    if (i > 0 && -1 == strbuf_append_char(buf, sep)) return -1;
+    if (-1 == strbuf_append(buf, array[i])) return -1;
+  }
+  return 0;
+}
+
+/*
+ * Shorten `buf` to `len` bytes, keeping its memory for what comes next
+ */
+
+void
+strbuf_truncate(strbuf_t *buf, size_t len) {
+  if (len >= buf->len) return;
+  buf->len = len;
+  buf->data[len] = '\0';
+}
+
+/*
+ * Take the string out of `buf`, leaving it empty. The string is "" if
+ * nothing was appended, NULL on failure
+ */
+
+char *
+strbuf_detach(strbuf_t *buf) {
+  char *data = buf->data;
+  if (NULL == data && (data = malloc(1))) data[0] = '\0';
+  buf->data = NULL;
+  buf->len = 0;
+  buf->cap = 0;
+  return data;
+}
+
+/*
+ * Free the string of `buf`, leaving it empty
+ */
+
+void
+strbuf_free(strbuf_t *buf) {
+  free(buf->data);
+  buf->data = NULL;
+  buf->len = 0;
+  buf->cap = 0;
+}
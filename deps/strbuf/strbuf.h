@@ -0,0 +1,71 @@
+//
+// strbuf.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef STRBUF_H
+#define STRBUF_H 1
+
+#include <stddef.h>
+
+/*
+ * A string that is always NUL terminated once anything was appended,
+ * and knows its length, so appending doesn't walk it again.
+ */
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} strbuf_t;
+
+/*
+ * A string that isn't copied, nor NUL terminated.
+ */
+
+typedef struct {
+  const char *data;
+  size_t len;
+} strview_t;
+
+#define STRBUF_INIT { NULL, 0, 0 }
+
+strview_t
+strview(const char *);
+
+strview_t
+strview_n(const char *, size_t);
+
+char *
+strview_dup(strview_t);
+
+int
+strbuf_grow(strbuf_t *, size_t);
+
+int
+strbuf_append_n(strbuf_t *, const char *, size_t);
+
+int
+strbuf_append(strbuf_t *, const char *);
+
+int
+strbuf_append_view(strbuf_t *, strview_t);
+
+int
+strbuf_append_char(strbuf_t *, char);
+
+int
+strbuf_join(strbuf_t *, const char *[], int, char);
+
+void
+strbuf_truncate(strbuf_t *, size_t);
+
+char *
+strbuf_detach(strbuf_t *);
+
+void
+strbuf_free(strbuf_t *);
+
+#endif
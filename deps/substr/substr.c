@@ -8,7 +8,6 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include "strdup/strdup.h"
 #include "substr.h"
 
 /*
@@ -17,19 +16,28 @@
 
 char *
 substr(const char *str, int start, int end) {
+  return substr_n(str, strlen(str), start, end);
+}
+
+/*
+ * Get a substring of the `len` bytes of `str` from `start` to `end`
+ */
+
+char *
+substr_n(const char *str, size_t len, int start, int end) {
   if (0 > start) return NULL;
-  int len = strlen(str);
   // -1 == length of string
   if (-1 == end) end = len;
   if (end <= start) return NULL;
-  int diff = end - start;
-  if (len == diff) return strdup(str);
-  if (len < start) return NULL;
-  if (len + 1 < end) return NULL;
+  size_t diff = end - start;
+  if (len == diff) start = 0;
+  else if (len < (size_t) start) return NULL;
+  else if (len + 1 < (size_t) end) return NULL;
 
-  char *res = malloc(sizeof(char) * diff + 1);
+  size_t n = len - start < diff ? len - start : diff;
+  char *res = malloc(diff + 1);
   if (NULL == res) return NULL;
-  memset(res, '\0', diff + 1);
-  strncpy(res, str + start, diff);
+  memcpy(res, str + start, n);
+  memset(res + n, '\0', diff + 1 - n);
   return res;
 }
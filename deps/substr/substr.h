@@ -10,6 +10,9 @@
 #ifndef SUBSTR_H
 #define SUBSTR_H 1
 
+#include <stddef.h>
+
 char *substr(const char *, int, int);
+char *substr_n(const char *, size_t, int, int);
 
 #endif
@@ -7,16 +7,14 @@
 //
 
 #include <curl/curl.h>
+#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 #include "gumbo-parser/gumbo.h"
 #include "gumbo-text-content/gumbo-text-content.h"
 #include "gumbo-get-element-by-id/get-element-by-id.h"
-#include "gumbo-get-elements-by-tag-name/get-elements-by-tag-name.h"
 #include "http-get/http-get.h"
 #include "list/list.h"
-#include "substr/substr.h"
-#include "strdup/strdup.h"
 #include "case/case.h"
 #include "trim/trim.h"
 #include "wiki-registry.h"
@@ -26,126 +24,818 @@
 //
 
 /**
- * Create a new wiki package.
+ * Returns the bytes between `start` and `end` without the whitespace
+ * around them, setting `length`.
+ */
+
+static const char *
+trimmed(const char *start, const char *end, size_t *length) {
+  while (start < end && isspace((unsigned char) *start)) start++;
+  while (end > start && isspace((unsigned char) end[-1])) end--;
+  *length = end - start;
+  return start;
+}
+
+/**
+ * Create a new wiki package of `repo`, `description` and `category`,
+ * with its strings in the same allocation, after the package.
  */
 
 static wiki_package_t *
-wiki_package_new() {
-  wiki_package_t *pkg = malloc(sizeof(wiki_package_t));
-  if (pkg) {
-    pkg->repo = NULL;
-    pkg->href = NULL;
-    pkg->description = NULL;
-    pkg->category = NULL;
-  }
+package_new(const char *repo, size_t repo_length, const char *description,
+            size_t description_length, const char *category) {
+  static const char github[] = "https://github.com/";
+  size_t category_length = strlen(category);
+  wiki_package_t *pkg = malloc(sizeof(wiki_package_t) + repo_length + 1 +
+                               sizeof(github) + repo_length +
+                               description_length + 1 + category_length + 1);
+  if (!pkg) return NULL;
+
+  char *p = (char *) (pkg + 1);
+  pkg->repo = p;
+  memcpy(p, repo, repo_length);
+  p[repo_length] = '\0';
+  p += repo_length + 1;
+
+  pkg->href = p;
+  memcpy(p, github, sizeof(github) - 1);
+  memcpy(p + sizeof(github) - 1, repo, repo_length);
+  p[sizeof(github) - 1 + repo_length] = '\0';
+  p += sizeof(github) + repo_length;
+
+  pkg->description = p;
+  memcpy(p, description, description_length);
+  p[description_length] = '\0';
+  p += description_length + 1;
+
+  pkg->category = p;
+  memcpy(p, category, category_length + 1);
   return pkg;
 }
 
 /**
- * Add `href` to the given `package`.
+ * Parse the text of a wiki `li`, `length` bytes, into a package of
+ * `category`.
+ *
+ * Returns the package, or NULL if the text isn't one or on malloc failure
+ */
+
+static wiki_package_t *
+parse_package(const char *text, size_t length, const char *category) {
+  const char *end = text + length;
+  size_t repo_length = 0;
+  size_t description_length = 0;
+
+  // TODO support unicode dashes
+  const char *tok = strstr(text, " - ");
+  if (!tok) return NULL;
+
+  const char *repo = trimmed(text, tok, &repo_length);
+  const char *description = trimmed(tok + 3, end, &description_length);
+  return package_new(repo, repo_length, description, description_length,
+                     category);
+}
+
+/**
+ * Free the packages of `pkgs`, and the list.
  */
 
 static void
-add_package_href(wiki_package_t *self) {
-  size_t len = strlen(self->repo) + 20; // https://github.com/ \0
-  self->href = malloc(len);
-  if (self->href)
-    sprintf(self->href, "https://github.com/%s", self->repo);
+free_packages(list_t *pkgs) {
+  list_node_t *node;
+  list_each(pkgs, node) {
+    wiki_package_free(node->val);
+  }
+  list_destroy(pkgs);
 }
 
 /**
- * Parse the given wiki `li` into a package.
+ * The growing string of gumbo-text-content, for the text of what is
+ * extracted.
  */
 
-static wiki_package_t *
-parse_li(GumboNode *li) {
-  wiki_package_t *self = wiki_package_new();
-  char *text = NULL;
+typedef gumbo_text_t text_t;
 
-  if (!self) goto cleanup;
+#define text_append gumbo_text_append
 
-  text = gumbo_text_content(li);
-  if (!text) goto cleanup;
+static void
+text_reset(text_t *self) {
+  self->length = 0;
+  if (self->data) self->data[0] = '\0';
+}
 
-  // TODO support unicode dashes
-  char *tok = strstr(text, " - ");
-  if (!tok) goto cleanup;
+/**
+ * Append the character `code` to `self` as UTF-8.
+ */
 
-  int pos = tok - text;
-  self->repo = substr(text, 0, pos);
-  self->description = substr(text, pos + 3, -1);
-  if (!self->repo || !self->description) goto cleanup;
-  trim(self->description);
-  trim(self->repo);
+static int
+text_append_code(text_t *self, unsigned long code) {
+  char utf8[4];
+  size_t length = 0;
 
-  add_package_href(self);
+  if (code < 0x80) {
+    utf8[length++] = (char) code;
+  } else if (code < 0x800) {
+    utf8[length++] = (char) (0xc0 | code >> 6);
+    utf8[length++] = (char) (0x80 | (code & 0x3f));
+  } else if (code < 0x10000) {
+    utf8[length++] = (char) (0xe0 | code >> 12);
+    utf8[length++] = (char) (0x80 | (code >> 6 & 0x3f));
+    utf8[length++] = (char) (0x80 | (code & 0x3f));
+  } else {
+    utf8[length++] = (char) (0xf0 | code >> 18);
+    utf8[length++] = (char) (0x80 | (code >> 12 & 0x3f));
+    utf8[length++] = (char) (0x80 | (code >> 6 & 0x3f));
+    utf8[length++] = (char) (0x80 | (code & 0x3f));
+  }
 
-cleanup:
-  free(text);
-  return self;
+  return text_append(self, utf8, length);
 }
 
 /**
- * Parse a list of packages from the given `html`
+ * Append the character reference at `amp` to `self`, decoded as gumbo
+ * would. Only the common references are known, for the others the
+ * page is left to gumbo.
+ *
+ * Returns the end of the reference, or NULL
  */
 
-list_t *
-wiki_registry_parse(const char *html) {
-  GumboOutput *output = gumbo_parse(html);
-  list_t *pkgs = list_new();
+static const char *
+text_append_reference(text_t *self, const char *amp, const char *end) {
+  static const char *names[] = {"amp;", "lt;", "gt;", "quot;", "apos;",
+                                "nbsp;", NULL};
+  static const char *values[] = {"&", "<", ">", "\"", "'", "\xc2\xa0"};
+  const char *p = amp + 1;
 
-  GumboNode *body = gumbo_get_element_by_id("wiki-body", output->root);
-  if (body) {
-    // grab all category `<h2 />`s
-    list_t *h2s = gumbo_get_elements_by_tag_name("h2", body);
-    list_node_t *heading_node;
-    list_iterator_t *heading_iterator = list_iterator_new(h2s, LIST_HEAD);
-    while ((heading_node = list_iterator_next(heading_iterator))) {
-      GumboNode *heading = (GumboNode *) heading_node->val;
-      char *category = gumbo_text_content(heading);
-      // die if we failed to parse a category, as it's
-      // almost certinaly a malloc error
-      if (!category) break;
-      trim(case_lower(category));
-      GumboVector *siblings = &heading->parent->v.element.children;
-      size_t pos = heading->index_within_parent;
-
-      // skip elements until the UL
-      // TODO: don't hardcode position here
-      // 2:
-      //   1 - whitespace
-      //   2 - actual node
-      GumboNode *ul = siblings->data[pos + 2];
-      if (GUMBO_TAG_UL != ul->v.element.tag) {
-        free(category);
+  if (p < end && '#' == *p) {
+    int hex = ++p < end && ('x' == *p || 'X' == *p);
+    unsigned long code = 0;
+    const char *digits = p += hex;
+
+    for (; p < end && code <= 0x10ffff; p++) {
+      int c = tolower((unsigned char) *p);
+      if (isdigit(c)) code = code * (hex ? 16 : 10) + c - '0';
+      else if (hex && isxdigit(c)) code = code * 16 + c - 'a' + 10;
+      else break;
+    }
+
+    // gumbo replaces the invalid ones, and maps some to windows-1252
+    if (p == digits || p == end || ';' != *p || 0 == code ||
+        code > 0x10ffff || (code >= 0x80 && code <= 0x9f) ||
+        (code >= 0xd800 && code <= 0xdfff)) {
+      return NULL;
+    }
+
+    return 0 == text_append_code(self, code) ? p + 1 : NULL;
+  }
+
+  if (p == end || !isalnum((unsigned char) *p)) {
+    return 0 == text_append(self, "&", 1) ? p : NULL;
+  }
+
+  for (int i = 0; names[i]; i++) {
+    size_t length = strlen(names[i]);
+    if ((size_t) (end - p) >= length && 0 == strncmp(p, names[i], length)) {
+      if (0 != text_append(self, values[i], strlen(values[i]))) return NULL;
+      return p + length;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Append the text between `start` and `end` to `self`, unless it's only
+ * whitespace, which gumbo leaves out of the text content.
+ */
+
+static int
+text_append_html(text_t *self, const char *start, const char *end) {
+  const char *p = start;
+
+  while (p < end && strchr(" \t\n\f", *p)) p++;
+  if (p == end) return 0;
+
+  // gumbo normalizes the newlines
+  if (memchr(start, '\r', end - start)) return -1;
+
+  for (p = start; p < end;) {
+    const char *amp = memchr(p, '&', end - p);
+    const char *stop = amp ? amp : end;
+
+    if (0 != text_append(self, p, stop - p)) return -1;
+    if (!amp) break;
+    if (!(p = text_append_reference(self, amp, end))) return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Read the tag at `html`, its lowercase `name`, cut to `size`, and
+ * whether it is `closing`.
+ *
+ * Returns the end of the tag, or NULL if it isn't one
+ */
+
+static const char *
+read_tag(const char *html, char *name, size_t size, int *closing) {
+  const char *p = html + 1;
+  size_t length = 0;
+
+  *closing = '/' == *p;
+  if (*closing) p++;
+  if (!isalpha((unsigned char) *p)) return NULL;
+
+  for (; *p && !strchr(" \t\n\f\r/>", *p); p++) {
+    if (length + 1 < size) name[length++] = tolower((unsigned char) *p);
+  }
+  name[length] = '\0';
+
+  while (*p && '>' != *p) {
+    if ('"' == *p || '\'' == *p) {
+      const char *quote = strchr(p + 1, *p);
+      if (!quote) return NULL;
+      p = quote;
+    }
+    p++;
+  }
+
+  return *p ? p + 1 : NULL;
+}
+
+/**
+ * Returns the next markup at or after `html`, or its end.
+ */
+
+static const char *
+next_markup(const char *html) {
+  const char *p = html;
+  while ((p = strchr(p, '<'))) {
+    if (isalpha((unsigned char) p[1]) || strchr("/!?", p[1])) return p;
+    p++;
+  }
+  return html + strlen(html);
+}
+
+/**
+ * The elements whose text isn't markup, which are left to gumbo.
+ */
+
+static int
+is_raw_text(const char *name) {
+  static const char *names[] = {"script", "style", "textarea", "title",
+                                "xmp", "iframe", "noembed", "noframes",
+                                "noscript", "plaintext", NULL};
+  for (int i = 0; names[i]; i++) {
+    if (0 == strcmp(name, names[i])) return 1;
+  }
+  return 0;
+}
+
+/**
+ * Where the extraction is, in the `wiki-body`.
+ */
+
+typedef enum {
+  EXTRACT_NONE,
+  EXTRACT_HEADING,
+  EXTRACT_AFTER_HEADING,
+  EXTRACT_LIST,
+  EXTRACT_ITEM
+} extract_state_t;
+
+/**
+ * Add the package in the text of the item to `pkgs`.
+ */
+
+static int
+add_package(list_t *pkgs, text_t *item, const char *category) {
+  int failed = 0;
+  // items which aren't packages are skipped
+  if (item->data && strstr(item->data, " - ")) {
+    wiki_package_t *package =
+        parse_package(item->data, item->length, category);
+    if (package) list_rpush(pkgs, list_node_new(package));
+    failed = !package;
+  }
+  text_reset(item);
+  return failed ? -1 : 0;
+}
+
+/**
+ * Extract the packages from the `wiki-body` of `html` in one pass,
+ * without building its DOM: the text of each `h2` is a category, with
+ * the `li`s of the `ul` following it. Anything the pass doesn't expect
+ * there, like nested lists or scripts, and it gives up.
+ *
+ * Returns the packages, or NULL if `html` needs a full parse
+ */
+
+static list_t *
+extract_packages(const char *html) {
+  extract_state_t state = EXTRACT_NONE;
+  text_t category = {0};
+  text_t item = {0};
+  char body[16];
+  char name[16];
+  int closing = 0;
+  int depth = 1;
+  int failed = 0;
+  const char *p = NULL;
+  const char *id = strstr(html, "id=\"wiki-body\"");
+  list_t *pkgs = NULL;
+
+  if (!id) return NULL;
+
+  // the tag with the id
+  for (p = id; p > html && '<' != *p; p--);
+  if ('<' != *p || !(p = read_tag(p, body, sizeof(body), &closing)) ||
+      closing || p <= id) {
+    return NULL;
+  }
+
+  if (!(pkgs = list_new())) return NULL;
+
+  while (!failed && *p && depth > 0) {
+    if ('<' != *p) {
+      const char *end = next_markup(p);
+      if (EXTRACT_HEADING == state) {
+        failed = text_append_html(&category, p, end);
+      } else if (EXTRACT_ITEM == state) {
+        failed = text_append_html(&item, p, end);
+      } else if (EXTRACT_AFTER_HEADING == state) {
+        // the heading has to be followed by the list
+        while (p < end && strchr(" \t\n\f\r", *p)) p++;
+        if (p < end) state = EXTRACT_NONE;
+      }
+      p = end;
+      continue;
+    }
+
+    if (0 == strncmp(p, "<!--", 4)) {
+      const char *end = strstr(p + 4, "-->");
+      if (!end) break;
+      p = end + 3;
+      continue;
+    }
+
+    const char *end = read_tag(p, name, sizeof(name), &closing);
+    if (!end || is_raw_text(name)) break;
+    p = end;
+
+    if (0 == strcmp(name, body)) depth += closing ? -1 : 1;
+    if (0 == depth) break;
+
+    int list = 0 == strcmp(name, "ul") || 0 == strcmp(name, "ol");
+    int li = 0 == strcmp(name, "li");
+    int h2 = 0 == strcmp(name, "h2");
+
+    if (EXTRACT_AFTER_HEADING == state) {
+      if (!closing && 0 == strcmp(name, "ul")) {
+        state = EXTRACT_LIST;
         continue;
       }
+      state = EXTRACT_NONE;
+    }
 
-      list_t *lis = gumbo_get_elements_by_tag_name("li", ul);
-      list_iterator_t *li_iterator = list_iterator_new(lis, LIST_HEAD);
-      list_node_t *li_node;
-      while ((li_node = list_iterator_next(li_iterator))) {
-        wiki_package_t *package = parse_li(li_node->val);
-        if (package && package->description) {
-          package->category = strdup(category);
-          list_rpush(pkgs, list_node_new(package));
-        } else {
-          // failed to parse package
-          if (package) wiki_package_free(package);
+    switch (state) {
+      case EXTRACT_NONE:
+        if (h2 && !closing) {
+          text_reset(&category);
+          state = EXTRACT_HEADING;
+        }
+        break;
+      case EXTRACT_HEADING:
+        if (h2 && closing) {
+          if (0 != text_append(&category, "", 0)) failed = 1;
+          else trim(case_lower(category.data));
+          state = EXTRACT_AFTER_HEADING;
+        } else if (h2 || list || li) {
+          failed = 1;
+        }
+        break;
+      case EXTRACT_LIST:
+        if (li && !closing) {
+          text_reset(&item);
+          state = EXTRACT_ITEM;
+        } else if (list && closing) {
+          state = EXTRACT_NONE;
+        } else if (list || h2 || li) {
+          failed = 1;
+        }
+        break;
+      case EXTRACT_ITEM:
+        if (li || (list && closing)) {
+          failed = add_package(pkgs, &item, category.data);
+          state = li && closing ? EXTRACT_LIST
+                  : li          ? EXTRACT_ITEM
+                                : EXTRACT_NONE;
+        } else if (list || h2) {
+          failed = 1;
         }
+        break;
+      default:
+        break;
+    }
+  }
+
+  free(category.data);
+  free(item.data);
+
+  // unless all of the body was read, without surprises, let gumbo do it
+  if (failed || 0 != depth || EXTRACT_LIST == state ||
+      EXTRACT_ITEM == state || 0 == pkgs->len) {
+    free_packages(pkgs);
+    return NULL;
+  }
+
+  return pkgs;
+}
+
+/**
+ * The memory of a gumbo parse, given out in order from large chunks,
+ * which are all released at once after it.
+ */
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(size) \
+  (((size) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t used;
+  size_t size;
+} arena_chunk_t;
+
+typedef struct {
+  arena_chunk_t *chunks;
+} arena_t;
+
+#define ARENA_HEADER ARENA_ROUND(sizeof(arena_chunk_t))
+
+static void *
+arena_allocate(void *userdata, size_t size) {
+  arena_t *self = userdata;
+  arena_chunk_t *chunk = self->chunks;
+
+  size = ARENA_ROUND(size ? size : 1);
+
+  if (!chunk || chunk->size - chunk->used < size) {
+    size_t chunk_size = size > ARENA_CHUNK_SIZE - ARENA_HEADER
+                            ? ARENA_HEADER + size
+                            : ARENA_CHUNK_SIZE;
+
+    if (!(chunk = malloc(chunk_size))) return NULL;
+    chunk->used = ARENA_HEADER;
+    chunk->size = chunk_size;
+
+    // a chunk of its own for what's too large goes under the current
+    if (self->chunks && ARENA_HEADER + size == chunk_size) {
+      chunk->next = self->chunks->next;
+      self->chunks->next = chunk;
+    } else {
+      chunk->next = self->chunks;
+      self->chunks = chunk;
+    }
+  }
+
+  void *ptr = (char *) chunk + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+/**
+ * Nothing is freed before the parse is done with.
+ */
+
+static void
+arena_deallocate(void *userdata, void *ptr) {
+  (void) userdata;
+  (void) ptr;
+}
+
+static void
+arena_release(arena_t *self) {
+  arena_chunk_t *chunk = self->chunks;
+  while (chunk) {
+    arena_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  self->chunks = NULL;
+}
+
+/**
+ * Whether `element` is the `wiki-body`, after which nothing is read.
+ */
+
+static bool
+is_wiki_body(void *userdata, const GumboNode *element) {
+  GumboAttribute *id =
+      gumbo_get_attribute(&element->v.element.attributes, "id");
+  return id && 0 == strcmp("wiki-body", id->value);
+}
+
+/**
+ * A node the walk is in, or is to come to, with where its text starts,
+ * or its category, and, for an `li`, what its package goes after.
+ */
+
+typedef struct {
+  GumboNode *node;
+  size_t start;
+  list_node_t *mark;
+} open_node_t;
+
+typedef struct {
+  open_node_t *data;
+  size_t length;
+  size_t size;
+} open_nodes_t;
+
+/**
+ * Where the walk of the `wiki-body` is: in the `headings` open, with
+ * their text in `heading`, before the `pending` lists that follow the
+ * ones closed, in the `lists` open, with their categories in
+ * `categories`, and in the `items` open, with their text in `item`.
+ */
+
+typedef struct {
+  list_t *pkgs;
+  gumbo_text_t heading;
+  gumbo_text_t categories;
+  gumbo_text_t item;
+  open_nodes_t headings;
+  open_nodes_t pending;
+  open_nodes_t lists;
+  open_nodes_t items;
+} walk_t;
+
+/**
+ * Push `node`, starting at `start`, onto `self`.
+ *
+ * Returns the new top, or NULL on malloc failure
+ */
+
+static open_node_t *
+open_nodes_push(open_nodes_t *self, GumboNode *node, size_t start) {
+  if (self->length == self->size) {
+    size_t size = self->size ? 2 * self->size : 8;
+    open_node_t *data = realloc(self->data, size * sizeof(open_node_t));
+    if (!data) return NULL;
+    self->data = data;
+    self->size = size;
+  }
+  open_node_t *top = &self->data[self->length++];
+  top->node = node;
+  top->start = start;
+  top->mark = NULL;
+  return top;
+}
+
+/**
+ * Returns the top of `self` when it is `node`, NULL otherwise.
+ */
+
+static open_node_t *
+open_nodes_top(open_nodes_t *self, GumboNode *node) {
+  if (0 == self->length) return NULL;
+  open_node_t *top = &self->data[self->length - 1];
+  return node == top->node ? top : NULL;
+}
+
+/**
+ * Insert `pkg` into `pkgs` after `mark`, or first when it is NULL.
+ */
+
+static int
+insert_package(list_t *pkgs, list_node_t *mark, wiki_package_t *pkg) {
+  list_node_t *node = list_node_new(pkg);
+  if (!node) return -1;
+
+  if (!mark) return list_lpush(pkgs, node) ? 0 : -1;
+  if (mark == pkgs->tail) return list_rpush(pkgs, node) ? 0 : -1;
+
+  node->prev = mark;
+  node->next = mark->next;
+  mark->next->prev = node;
+  mark->next = node;
+  pkgs->len++;
+  return 0;
+}
+
+/**
+ * Enter `node`: collect its text, or open the heading, list or item it is.
+ *
+ * Returns 0 on success, -1 on malloc failure
+ */
+
+static int
+walk_enter(walk_t *self, GumboNode *node) {
+  if (GUMBO_NODE_TEXT == node->type) {
+    const char *text = node->v.text.text;
+    size_t length = strlen(text);
+    if (self->headings.length &&
+        0 != gumbo_text_append(&self->heading, text, length)) return -1;
+    if (self->items.length &&
+        0 != gumbo_text_append(&self->item, text, length)) return -1;
+    return 0;
+  }
+
+  if (GUMBO_NODE_ELEMENT != node->type) return 0;
+
+  GumboTag tag = node->v.element.tag;
+
+  if (GUMBO_TAG_H2 == tag) {
+    if (!open_nodes_push(&self->headings, node, self->heading.length)) {
+      return -1;
+    }
+    // an empty heading still has an empty category
+    return gumbo_text_append(&self->heading, "", 0);
+  }
+
+  // a list follows each of the headings closed, mostly only the last one
+  for (size_t i = self->pending.length; i-- > 0;) {
+    open_node_t *list = &self->pending.data[i];
+    if (node != list->node) continue;
+    if (!open_nodes_push(&self->lists, node, list->start)) return -1;
+    *list = self->pending.data[--self->pending.length];
+    break;
+  }
+
+  if (GUMBO_TAG_LI == tag && self->lists.length) {
+    if (0 == self->items.length) self->item.length = 0;
+    open_node_t *item =
+        open_nodes_push(&self->items, node, self->item.length);
+    if (!item) return -1;
+    item->mark = self->pkgs->tail;
+    return gumbo_text_append(&self->item, "", 0);
+  }
+
+  return 0;
+}
+
+/**
+ * Leave `node`: close the heading, list or item it is, parsing the item.
+ *
+ * Returns 0 on success, -1 on malloc failure
+ */
+
+static int
+walk_leave(walk_t *self, GumboNode *node) {
+  open_node_t *top = NULL;
+
+  if ((top = open_nodes_top(&self->headings, node))) {
+    size_t start = top->start;
+    self->headings.length--;
+
+    // the list of the category follows the heading
+    // TODO: don't hardcode position here
+    // 2:
+    //   1 - whitespace
+    //   2 - actual node
+    GumboVector *siblings = &node->parent->v.element.children;
+    size_t pos = node->index_within_parent;
+    GumboNode *ul = pos + 2 < siblings->length ? siblings->data[pos + 2]
+                                               : NULL;
+
+    if (ul && GUMBO_NODE_ELEMENT == ul->type &&
+        GUMBO_TAG_UL == ul->v.element.tag) {
+      // the text of the heading is in that of those it is in
+      size_t category = self->categories.length;
+      if (0 != gumbo_text_append(&self->categories,
+                                 self->heading.data + start,
+                                 self->heading.length - start + 1) ||
+          !open_nodes_push(&self->pending, ul, category)) return -1;
+      char *text = self->categories.data + category;
+      trim(case_lower(text));
+      self->categories.length = category + strlen(text) + 1;
+    }
+
+    if (0 == self->headings.length) self->heading.length = 0;
+  } else if ((top = open_nodes_top(&self->lists, node))) {
+    self->lists.length--;
+  } else if ((top = open_nodes_top(&self->items, node))) {
+    self->items.length--;
+    const char *category = self->categories.data +
+                           self->lists.data[self->lists.length - 1].start;
+    wiki_package_t *pkg = parse_package(self->item.data + top->start,
+                                        self->item.length - top->start,
+                                        category);
+    // skip what failed to parse
+    if (pkg && 0 != insert_package(self->pkgs, top->mark, pkg)) {
+      wiki_package_free(pkg);
+      return -1;
+    }
+  }
+
+  // no category is of use once all the lists are over
+  if (0 == self->pending.length && 0 == self->lists.length) {
+    self->categories.length = 0;
+  }
+
+  return 0;
+}
+
+/**
+ * Walk `body` once, in document order and without recursing: the text
+ * of each `h2` is a category, and each `li` in the `ul` after it a
+ * package of the innermost of those, the `li`s in other `li`s after
+ * theirs.
+ *
+ * Returns 0 on success, -1 on malloc failure
+ */
+
+static int
+walk_body(GumboNode *body, list_t *pkgs) {
+  walk_t walk = {pkgs};
+  GumboNode *node = body;
+  int rc = 0;
+
+  while (node) {
+    if (0 != (rc = walk_enter(&walk, node))) break;
+
+    GumboVector *children = &node->v.element.children;
+    if (GUMBO_NODE_ELEMENT == node->type && children->length) {
+      node = children->data[0];
+      continue;
+    }
+
+    // leave the node, and the parents it was the last child of
+    for (;;) {
+      if (0 != (rc = walk_leave(&walk, node)) || node == body) {
+        node = NULL;
+        break;
       }
-      list_iterator_destroy(li_iterator);
-      list_destroy(lis);
-      free(category);
+
+      GumboVector *siblings = &node->parent->v.element.children;
+      size_t next = node->index_within_parent + 1;
+      if (next < siblings->length) {
+        node = siblings->data[next];
+        break;
+      }
+      node = node->parent;
     }
-    list_iterator_destroy(heading_iterator);
-    list_destroy(h2s);
   }
 
-  gumbo_destroy_output(&kGumboDefaultOptions, output);
+  free(walk.heading.data);
+  free(walk.categories.data);
+  free(walk.item.data);
+  free(walk.headings.data);
+  free(walk.pending.data);
+  free(walk.lists.data);
+  free(walk.items.data);
+  return rc;
+}
+
+/**
+ * Parse a list of packages from the DOM of the given `html`
+ */
+
+static list_t *
+parse_document(const char *html) {
+  // tens of thousands of nodes, strings and vectors, freed all together
+  arena_t arena = {NULL};
+  GumboOptions options = kGumboDefaultOptions;
+  options.allocator = arena_allocate;
+  options.deallocator = arena_deallocate;
+  options.userdata = &arena;
+  // the errors of a page are of no use here, nor what follows the list
+  options.max_errors = 0;
+  options.stop_after = is_wiki_body;
+
+  GumboOutput *output = gumbo_parse_with_options(&options, html,
+                                                 strlen(html));
+  list_t *pkgs = list_new();
+
+  if (!output || !pkgs) {
+    arena_release(&arena);
+    return pkgs;
+  }
+
+  GumboNode *body = gumbo_get_element_by_id("wiki-body", output->root);
+  // die at the first malloc error, keeping what was parsed before it
+  if (body) walk_body(body, pkgs);
+
+  // the output is all in the arena
+  arena_release(&arena);
   return pkgs;
 }
 
+/**
+ * Parse a list of packages from the given `html`, only reading its
+ * `wiki-body` when it looks as expected, and the whole document when
+ * it doesn't.
+ */
+
+list_t *
+wiki_registry_parse(const char *html) {
+  list_t *pkgs = extract_packages(html);
+  return pkgs ? pkgs : parse_document(html);
+}
+
 /**
  * Get a list of packages from the given GitHub wiki `url`.
  */
@@ -161,14 +851,22 @@ wiki_registry(const char *url) {
 }
 
 /**
- * Free a wiki_package_t.
+ * Create a new wiki package, as a package of the wiki would be, with the
+ * `href` of its `repo` on GitHub.
+ */
+
+wiki_package_t *
+wiki_package_new(const char *repo, const char *description,
+                 const char *category) {
+  return package_new(repo, strlen(repo), description, strlen(description),
+                     category);
+}
+
+/**
+ * Free a wiki_package_t, and its strings along with it.
  */
 
 void
 wiki_package_free(wiki_package_t *pkg) {
-  free(pkg->repo);
-  free(pkg->href);
-  free(pkg->description);
-  free(pkg->category);
   free(pkg);
 }
@@ -25,6 +25,9 @@ wiki_registry(const char *);
 list_t *
 wiki_registry_parse(const char *);
 
+wiki_package_t *
+wiki_package_new(const char *, const char *, const char *);
+
 void
 wiki_package_free(wiki_package_t *);
 
@@ -1,47 +1,35 @@
 
 #include <stdlib.h>
+#include <string.h>
+#include "str-find/str-find.h"
 #include "wildcardcmp.h"
 
 int
 wildcardcmp(const char *pattern, const char *string) {
-  const char *w = NULL; // last `*`
-  const char *s = NULL; // last checked char
+  const char *star = NULL;
 
   // malformed
   if (!pattern || !string) return 0;
+  if (!(star = strchr(pattern, '*'))) return 0 == strcmp(pattern, string);
 
-  // loop 1 char at a time
-  while (1) {
-    if (!*string) {
-      if (!*pattern) return 1;
-      if ('*' == *pattern) {
-        pattern++;
-        continue;
-      }
-      if (!*s) return 0;
-      string = s++;
-      pattern = w;
-      continue;
-    } else {
-      if (*pattern != *string) {
-        if ('*' == *pattern) {
-          w = ++pattern;
-          s = string;
-          // "*" -> "foobar"
-          if (*pattern) continue;
-          return 1;
-        } else if (w) {
-          string++;
-          // "*ooba*" -> "foobar"
-          continue;
-        }
-        return 0;
-      }
-    }
+  const char *end = string + strlen(string);
+  size_t n = star - pattern;
 
-    string++;
-    pattern++;
+  // "foo*" -> "foobar"
+  if (n > (size_t) (end - string)) return 0;
+  if (0 != memcmp(pattern, string, n)) return 0;
+  string += n;
+  pattern = star + 1;
+
+  // "*oo*a*" -> "foobar", each part as early as it can be
+  while ((star = strchr(pattern, '*'))) {
+    n = star - pattern;
+    if (!(string = str_find(string, end - string, pattern, n))) return 0;
+    string += n;
+    pattern = star + 1;
   }
 
-  return 1;
+  // "*bar" -> "foobar"
+  n = strlen(pattern);
+  return n <= (size_t) (end - string) && 0 == memcmp(end - n, pattern, n);
 }
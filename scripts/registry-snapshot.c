@@ -0,0 +1,97 @@
+//
+// registry-snapshot.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+// Writes the snapshot of the registry that clib-search starts from, see
+// src/common/clib-snapshot.h:
+//
+//   registry-snapshot <header> [file]
+//
+// The registry is read from `file`, a saved packages page of the wiki or
+// a JSON registry, and fetched from the wiki otherwise.
+
+#include "common/clib-registry.h"
+#include "common/clib-search-index.h"
+#include "common/clib-snapshot.h"
+#include "fs/fs.h"
+#include "http-get/http-get.h"
+#include "parson/parson.h"
+#include "wiki-registry/wiki-registry.h"
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLIB_WIKI_URL "https://github.com/clibs/clib/wiki/Packages"
+
+static list_t *read_packages(const char *file) {
+  http_get_response_t *res = NULL;
+  list_t *pkgs = NULL;
+  char *data = NULL;
+
+  if (file) {
+    if ((data = fs_read(file))) {
+      pkgs = clib_registry_parse(data, strlen(data));
+      free(data);
+    }
+
+    // not a registry after all, so a page of the wiki
+    if (!pkgs && (data = fs_read(file))) {
+      pkgs = wiki_registry_parse(data);
+      free(data);
+    }
+
+    return pkgs;
+  }
+
+  curl_global_init(CURL_GLOBAL_ALL);
+  res = http_get(CLIB_WIKI_URL);
+
+  if (res && res->ok) {
+    pkgs = wiki_registry_parse(res->data);
+  }
+
+  http_get_free(res);
+  curl_global_cleanup();
+  return pkgs;
+}
+
+int main(int argc, char *argv[]) {
+  list_iterator_t *it = NULL;
+  list_node_t *node = NULL;
+  list_t *pkgs = NULL;
+  char *packages = NULL;
+  char *trigrams = NULL;
+  int rc = 1;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <header> [file]\n", argv[0]);
+    return 1;
+  }
+
+  if (!(pkgs = read_packages(argc > 2 ? argv[2] : NULL))) {
+    fprintf(stderr, "%s: no packages in the registry\n", argv[0]);
+    return 1;
+  }
+
+  if (0 == clib_search_index_build(pkgs, &packages, &trigrams) &&
+      0 == clib_snapshot_write(argv[1], packages, trigrams)) {
+    printf("%s: %d packages\n", argv[1], (int)pkgs->len);
+    rc = 0;
+  }
+
+  json_free_serialized_string(packages);
+  free(trigrams);
+
+  it = list_iterator_new(pkgs, LIST_HEAD);
+  while ((node = list_iterator_next(it))) {
+    wiki_package_free(node->val);
+  }
+  list_iterator_destroy(it);
+  list_destroy(pkgs);
+
+  return rc;
+}
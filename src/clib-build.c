@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <libgen.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -24,21 +25,38 @@
 #include <direct.h>
 #define getcwd _getcwd
 #else
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #endif
 
 #include "common/clib-cache.h"
+#include "common/clib-dns.h"
+#include "common/clib-hash.h"
+#include "common/clib-jobserver.h"
+#include "common/clib-metrics.h"
 #include "common/clib-package.h"
+#include "common/clib-pool.h"
+#include "common/clib-ratelimit.h"
+#include "common/clib-profile.h"
+#include "common/clib-spawn.h"
+#include "common/clib-trace.h"
+#include "common/clib-tree.h"
+#include "common/clib-walk.h"
+#include "common/clib-watch.h"
 
 #include <asprintf/asprintf.h>
 #include <commander/commander.h>
+#include <copy/copy.h>
 #include <debug/debug.h>
 #include <fs/fs.h>
+#include <hash/concurrent-hash.h>
 #include <hash/hash.h>
 #include <list/list.h>
 #include <logger/logger.h>
+#include <mkdirp/mkdirp.h>
 #include <path-join/path-join.h>
-#include <str-flatten/str-flatten.h>
+#include <strdup/strdup.h>
 #include <trim/trim.h>
 
 #include "version.h"
@@ -46,6 +64,13 @@
 #define CLIB_PACKAGE_CACHE_TIME 30 * 24 * 60 * 60
 #define PROGRAM_NAME "clib-build"
 
+// where the stamps of the last build of each package are kept, in the
+// output directory
+#define BUILD_STAMPS_DIR ".clib-build"
+
+// how long --watch waits for the files to stop changing, in milliseconds
+#define WATCH_SETTLE_MS 200
+
 #define SX(s) #s
 #define S(s) SX(s)
 
@@ -75,22 +100,24 @@ struct options {
   int verbose;
   int dev;
   int skip_cache;
+  int build_cache;
+  int configure;
   int global;
+  int watch;
   char *clean;
   char *test;
+  const char *trace;
 #ifdef HAVE_PTHREADS
   unsigned int concurrency;
 #endif
 };
 
-const char *manifest_names[] = {"clib.json", "package.json", 0};
-
 clib_package_opts_t package_opts = {0};
 clib_package_t *root_package = 0;
 
 command_t program = {0};
 debug_t debugger = {0};
-hash_t *built = 0;
+concurrent_hash_t *built = 0;
 
 char **rest_argv = 0;
 int rest_offset = 0;
@@ -112,117 +139,606 @@ options_t opts = {.skip_cache = 0,
 
 };
 
-int build_package(const char *dir);
+/**
+ * Runs `argv` in the environment with the variables of `env`, and waits
+ * for it. When `quiet` is set its output goes to /dev/null, otherwise it
+ * is appended to `log` when there is one.
+ *
+ * @return The exit status of the command, or -1 if it didn't run
+ */
+
+static int run_command(char *const argv[], char *const env[], int quiet,
+                       strbuf_t *log) {
+  clib_spawn_opts_t spawn = {0};
+  char *output = NULL;
+  int rc = 0;
+
+  spawn.env = env;
+  spawn.quiet = quiet;
+  spawn.log = log && !quiet ? &output : NULL;
+  rc = clib_spawn(argv, &spawn);
+
+  if (output) {
+    strbuf_append(log, output);
+    free(output);
+  }
+
+  return rc;
+}
+
+/**
+ * Reads the make option `-j` at `rest_argv[i]` into `jobs`, 0 meaning
+ * no limit.
+ *
+ * @return How many arguments the option takes, 0 if it isn't one
+ */
+
+static int jobs_option(int i, int *jobs) {
+  char *arg = rest_argv[i];
+  char *next = i + 1 < rest_argc ? rest_argv[i + 1] : NULL;
+  char *value = NULL;
+  int size = 1;
+
+  if (0 == strcmp(arg, "-j") || 0 == strcmp(arg, "--jobs")) {
+    if (next && next[0] >= '0' && next[0] <= '9') {
+      value = next;
+      size = 2;
+    }
+  } else if (0 == strncmp(arg, "-j", 2) && arg[2] >= '0' && arg[2] <= '9') {
+    value = arg + 2;
+  } else if (0 == strncmp(arg, "--jobs=", 7)) {
+    value = arg + 7;
+  } else {
+    return 0;
+  }
+
+  *jobs = value ? atoi(value) : 0;
+  return size;
+}
+
+/**
+ * Looks for a rule for `target` in the text of `makefile`, to spare make
+ * a dry run just to learn whether the target exists.
+ *
+ * @return 1 if a rule was found, 0 otherwise, as the target may still
+ * come from an included makefile or a pattern rule
+ */
+
+static int makefile_has_target(const char *makefile, const char *target) {
+  size_t length = strlen(target);
+  char *contents = fs_read(makefile);
+  char *line = contents;
+  int found = 0;
+
+  while (line && *line && !found) {
+    char *end = strchr(line, '\n');
+    char *colon = NULL;
+
+    if (end) {
+      *end = 0;
+    }
+
+    // rules start in the first column, `a b: deps` names both a and b,
+    // and `a := b` is a variable
+    colon = strchr(line, ':');
+    if (colon && ' ' != *line && '\t' != *line && '=' != colon[1]) {
+      for (char *word = line; word < colon && !found; word++) {
+        if ((word == line || ' ' == word[-1] || '\t' == word[-1]) &&
+            0 == strncmp(word, target, length) &&
+            (word + length == colon || ' ' == word[length] ||
+             '\t' == word[length])) {
+          found = 1;
+        }
+      }
+    }
+
+    line = end ? end + 1 : NULL;
+  }
+
+  free(contents);
+  return found;
+}
 
 #ifdef HAVE_PTHREADS
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-typedef struct clib_package_thread clib_package_thread_t;
-struct clib_package_thread {
-  const char *dir;
-};
+clib_pool_t *pool = 0;
+#endif
+
+/**
+ * What the build of a package leaves for the packages depending on it
+ */
+
+typedef struct {
+  char digest[CLIB_HASH_HEX_SIZE];
+  // what its outputs are cached under, empty if they can't be
+  char key[CLIB_HASH_HEX_SIZE];
+  // whether it has to build again, and how its last build went
+  int dirty;
+  int rc;
+  // where its files really are, for --watch
+  char *realdir;
+} build_state_t;
+
+clib_tree_t *tree = 0;
+
+// digest of the compiler, when build outputs are cached
+char compiler[CLIB_HASH_HEX_SIZE] = {0};
+
+static build_state_t *state_of(clib_tree_node_t *node) { return node->data; }
+
+static void load_root_package(void) {
+  root_package = clib_tree_load_root(opts.verbose);
+
+  if (root_package && root_package->prefix) {
+    package_opts.prefix = root_package->prefix;
+    clib_package_set_opts(package_opts);
+  }
+}
+
+typedef struct {
+  const char *root;
+  uint64_t sum;
+  uint64_t count;
+  // the record of every file by path, when set
+  hash_t *files;
+} stamp_walk_t;
+
+/**
+ * Leaves out hidden directories, like .git or the stamps, and the
+ * output directory, as its packages have stamps of their own.
+ */
+
+static int stamp_enter(int dirfd, const char *name, const char *path,
+                       void *data) {
+  stamp_walk_t *walk = data;
+  char *full = NULL;
+  int skip = '.' == name[0];
+
+  (void)dirfd;
+
+  if (!skip && opts.dir && (full = path_join(walk->root, path))) {
+    skip = 0 == strcmp(full, opts.dir);
+    free(full);
+  }
+
+  return skip ? CLIB_WALK_SKIP : 0;
+}
+
+/**
+ * Adds the path, size, modification time and inode of a file to the
+ * sum, which doesn't depend on the order the files come in.
+ */
+
+static int stamp_file(int dirfd, const char *name, const char *path,
+                      void *data) {
+  stamp_walk_t *walk = data;
+  uint64_t hash = 14695981039346656037ULL;
+  char record[128];
+  struct stat st;
+
+  if (0 != fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW)) {
+    return -1;
+  }
+
+  snprintf(record, sizeof(record), "%lld %lld %llu %o",
+           (long long)st.st_size, (long long)st.st_mtime,
+           (unsigned long long)st.st_ino, (unsigned int)st.st_mode);
+
+  // FNV-1a, enough to notice a change
+  for (const char *p = path; *p; p++) {
+    hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+  }
+
+  for (const char *p = record; *p; p++) {
+    hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+  }
+
+  walk->sum += hash;
+  (void)walk->count++;
+
+  if (walk->files) {
+    hash_set(walk->files, strdup(path), strdup(record));
+  }
 
-void *build_package_with_manifest_name_thread(void *arg) {
-  clib_package_thread_t *wrap = arg;
-  const char *dir = wrap->dir;
-  build_package(dir);
   return 0;
 }
-#endif
 
-int build_package_with_manifest_name(const char *dir, const char *file) {
-  clib_package_t *package = 0;
-  char *json = 0;
-  int ok = 0;
+/**
+ * Digests what a build of `node` depends on: its files, the variables
+ * make gets, the arguments given to make, as -j doesn't change the
+ * outcome, and the digests of its dependencies.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+
+static int build_digest(clib_tree_node_t *node, const char *cflags_var,
+                        const char *prefix_var, char hex[CLIB_HASH_HEX_SIZE]) {
+  stamp_walk_t data = {node->dir, 0, 0, NULL};
+  clib_walk_t walk = {stamp_file, stamp_enter, NULL, &data};
+  char sums[64];
+  clib_hash_t hash;
+
+  if (0 != clib_walk(node->dir, 1, &walk)) {
+    return -1;
+  }
+
+  clib_hash_init(&hash);
+
+  snprintf(sums, sizeof(sums), "%llu %llu", (unsigned long long)data.sum,
+           (unsigned long long)data.count);
+  clib_hash_update(&hash, sums, strlen(sums) + 1);
+
+  if (cflags_var) {
+    clib_hash_update(&hash, cflags_var, strlen(cflags_var) + 1);
+  }
+
+  if (prefix_var) {
+    clib_hash_update(&hash, prefix_var, strlen(prefix_var) + 1);
+  }
+
+  for (int i = 0; i < rest_argc; i++) {
+    int jobs = 0;
+    int size = jobs_option(i, &jobs);
+
+    if (size > 0) {
+      i += size - 1;
+    } else {
+      clib_hash_update(&hash, rest_argv[i], strlen(rest_argv[i]) + 1);
+    }
+  }
+
+  for (int i = 0; i < node->deps_count; i++) {
+    clib_tree_node_t *dep = clib_tree_node(tree, node->deps[i]);
+    clib_hash_update(&hash, state_of(dep)->digest, CLIB_HASH_HEX_SIZE);
+  }
+
+  clib_hash_final(&hash, hex);
+  return 0;
+}
+
+/**
+ * @return The path of the stamp of the package in `dir`, or NULL on error
+ */
+
+static char *stamp_path(const char *dir) {
+  char name[CLIB_HASH_HEX_SIZE];
+  char *path = NULL;
+
+  clib_hash_buffer(dir, strlen(dir), name);
+  name[16] = 0;
+
+  asprintf(&path, "%s/" BUILD_STAMPS_DIR "/%s", opts.dir, name);
+  return path;
+}
+
+/**
+ * Stamps are only trusted for plain builds, --force, --clean and --test
+ * always run make.
+ */
+
+static int use_stamps(void) {
+  return opts.dir && !opts.force && !opts.clean && !opts.test;
+}
+
+/**
+ * Digests the package of `node` as it is now, for its dependents and to
+ * compare with `stamp`.
+ *
+ * @return 1 if the package didn't change since its last build
+ */
+
+static int is_stamped(clib_tree_node_t *node, const char *stamp,
+                      const char *cflags_var, const char *prefix_var) {
+  build_state_t *state = node->data;
+  char *stamped = NULL;
   int rc = 0;
 
-#ifdef PATH_MAX
-  long path_max = PATH_MAX;
-#elif defined(_PC_PATH_MAX)
-  long path_max = pathconf(dir, _PC_PATH_MAX);
-#else
-  long path_max = 4096;
-#endif
+  if (0 != build_digest(node, cflags_var, prefix_var, state->digest)) {
+    return 0;
+  }
 
-  char *path = path_join(dir, file);
+  if ((stamped = fs_read(stamp))) {
+    rc = 0 == strncmp(stamped, state->digest, CLIB_HASH_HEX_SIZE - 1);
+    free(stamped);
+  }
 
-  if (0 == path) {
-    return -ENOMEM;
+  return rc;
+}
+
+/**
+ * Stamps the package of `node` as it is after a build, so the next
+ * build can tell it didn't change.
+ */
+
+static void save_stamp(clib_tree_node_t *node, const char *stamp,
+                       const char *cflags_var, const char *prefix_var) {
+  build_state_t *state = node->data;
+  char *dir = path_join(opts.dir, BUILD_STAMPS_DIR);
+  char *contents = NULL;
+
+  if (dir && 0 == mkdirp(dir, 0777) &&
+      0 == build_digest(node, cflags_var, prefix_var, state->digest) &&
+      -1 != asprintf(&contents, "%s %s\n", state->digest, node->dir)) {
+    fs_write(stamp, contents);
+    free(contents);
+  } else {
+    unlink(stamp);
   }
 
-#ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&mutex);
-#endif
+  free(dir);
+}
 
-  if (!root_package) {
-    const char *name = NULL;
-    char *json = NULL;
-    unsigned int i = 0;
+/**
+ * Digests `$CC`, or `cc`, and what it says with `--version`, so outputs
+ * of another compiler aren't restored from the cache.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+
+static int compiler_digest(char hex[CLIB_HASH_HEX_SIZE]) {
+  clib_spawn_opts_t spawn = {0};
+  const char *cc = getenv("CC");
+  char *output = NULL;
+  char *copy = NULL;
+  char *argv[16];
+  clib_hash_t hash;
+  int argc = 0;
+  int rc = 0;
 
-    do {
-      name = manifest_names[i];
-      json = fs_read(name);
-    } while (NULL != manifest_names[++i] && !json);
+  if (!cc || !*cc) {
+    cc = "cc";
+  }
+
+  clib_hash_init(&hash);
+  clib_hash_update(&hash, cc, strlen(cc) + 1);
+
+  if (!(copy = strdup(cc))) {
+    return -1;
+  }
 
-    if (json) {
-      root_package = clib_package_new(json, opts.verbose);
+  // like make, `CC` may hold a command with options
+  for (char *word = strtok(copy, " \t"); word && argc < 14;
+       word = strtok(NULL, " \t")) {
+    argv[argc++] = word;
+  }
+
+  argv[argc++] = "--version";
+  argv[argc] = 0;
+
+  // only what it says on its standard output counts
+  spawn.output = &output;
+  spawn.quiet = 1;
+  rc = clib_spawn(argv, &spawn);
+  free(copy);
+
+  if (0 != rc || !output) {
+    free(output);
+    return -1;
+  }
+
+  clib_hash_update(&hash, output, strlen(output));
+  free(output);
+
+  clib_hash_final(&hash, hex);
+  return 0;
+}
+
+/**
+ * Keys the outputs of a build of `node` by its slug, the compiler, the
+ * variables and arguments make gets, and the keys of its dependencies.
+ * Only dependencies in the output directory with a version get a key,
+ * as the sources of anything else may change under the same version.
+ */
+
+static void build_key(clib_tree_node_t *node, const char *cflags_var,
+                      const char *prefix_var) {
+  build_state_t *state = node->data;
+  clib_package_t *package = node->package;
+  size_t length = strlen(opts.dir);
+  clib_hash_t hash;
+
+  state->key[0] = 0;
+
+  if (!compiler[0] || !package->author || !package->name ||
+      !package->version || !*package->version ||
+      0 != strncmp(node->dir, opts.dir, length) || '/' != node->dir[length]) {
+    return;
+  }
+
+  for (int i = 0; i < node->deps_count; i++) {
+    clib_tree_node_t *dep = clib_tree_node(tree, node->deps[i]);
+    if (!state_of(dep)->key[0]) {
+      return;
     }
+  }
 
-    if (root_package && root_package->prefix) {
-      char prefix[path_max];
-      memset(prefix, 0, path_max);
-      realpath(root_package->prefix, prefix);
-      unsigned long int size = strlen(prefix) + 1;
-      free(root_package->prefix);
-      root_package->prefix = malloc(size);
-      memset((void *)root_package->prefix, 0, size);
-      memcpy((void *)root_package->prefix, prefix, size);
+  clib_hash_init(&hash);
+  clib_hash_update(&hash, package->author, strlen(package->author) + 1);
+  clib_hash_update(&hash, package->name, strlen(package->name) + 1);
+  clib_hash_update(&hash, package->version, strlen(package->version) + 1);
+  clib_hash_update(&hash, compiler, sizeof(compiler));
+
+  if (cflags_var) {
+    clib_hash_update(&hash, cflags_var, strlen(cflags_var) + 1);
+  }
+
+  if (prefix_var) {
+    clib_hash_update(&hash, prefix_var, strlen(prefix_var) + 1);
+  }
+
+  for (int i = 0; i < rest_argc; i++) {
+    int jobs = 0;
+    int size = jobs_option(i, &jobs);
+
+    if (size > 0) {
+      i += size - 1;
+    } else {
+      clib_hash_update(&hash, rest_argv[i], strlen(rest_argv[i]) + 1);
     }
   }
 
-  if (hash_has(built, path)) {
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&mutex);
-#endif
-    goto cleanup;
+  for (int i = 0; i < node->deps_count; i++) {
+    clib_tree_node_t *dep = clib_tree_node(tree, node->deps[i]);
+    clib_hash_update(&hash, state_of(dep)->key, CLIB_HASH_HEX_SIZE);
   }
 
-#ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&mutex);
-#endif
+  clib_hash_final(&hash, state->key);
+}
+
+/**
+ * Build outputs are only cached for plain builds, like stamps
+ */
+
+static int use_build_cache(clib_tree_node_t *node) {
+  build_state_t *state = node->data;
+
+  return opts.build_cache && state->key[0] && !opts.force && !opts.clean &&
+         !opts.test;
+}
+
+static void free_snapshot(hash_t *files) {
+  if (files) {
+    hash_each(files, {
+      free((void *)key);
+      free(val);
+    });
+    hash_free(files);
+  }
+}
+
+/**
+ * @return The record of every file of the package in `dir` by path, or
+ * NULL on error
+ */
+
+static hash_t *snapshot_files(const char *dir) {
+  stamp_walk_t data = {dir, 0, 0, hash_new()};
+  clib_walk_t walk = {stamp_file, stamp_enter, NULL, &data};
+
+  if (data.files && 0 != clib_walk(dir, 1, &walk)) {
+    free_snapshot(data.files);
+    return NULL;
+  }
+
+  return data.files;
+}
+
+/**
+ * Caches the files the build of `node` added or changed since `before`.
+ * They are gathered in a directory of their own first, as the cache
+ * stores whole directories.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+
+static int save_build(clib_tree_node_t *node, hash_t *before) {
+  build_state_t *state = node->data;
+  clib_package_t *package = node->package;
+  hash_t *after = snapshot_files(node->dir);
+  char *staging = NULL;
+  int count = 0;
+  int rc = 0;
+
+  asprintf(&staging, "%s/" BUILD_STAMPS_DIR "/%.16s.tmp", opts.dir,
+           state->key);
+
+  if (!after || !staging) {
+    free_snapshot(after);
+    free(staging);
+    return -1;
+  }
 
-  if (0 == fs_exists(path)) {
-    debug(&debugger, "read %s", path);
-    json = fs_read(path);
+  clib_walk_remove(staging, 1);
+
+  hash_each(after, {
+    char *was = hash_get(before, (char *)key);
+
+    if (0 == rc && (!was || 0 != strcmp(was, val))) {
+      char *from = path_join(node->dir, key);
+      char *to = path_join(staging, key);
+      char *parent = to ? strdup(to) : NULL;
+
+      // the same file system, so a link spares the copy
+      if (!from || !to || !parent || 0 != mkdirp(dirname(parent), 0777) ||
+          (0 != link(from, to) && 0 != copy_file(from, to))) {
+        rc = -1;
+      }
+
+      (void)count++;
+      free(from);
+      free(to);
+      free(parent);
+    }
+  });
+
+  if (0 == rc && count > 0) {
+    rc = clib_cache_save_build(package->author, package->name,
+                               package->version, state->key, staging);
+    debug(&debugger, "cached %d files of %s", count, package->name);
   }
 
-  if (0 != json) {
-#ifdef DEBUG
-    package = clib_package_new(json, 1);
+  clib_walk_remove(staging, 1);
+  free_snapshot(after);
+  free(staging);
+  return rc;
+}
+
+/**
+ * @return Whether packages may build at the same time, in which case the
+ * output of each is printed whole once it is done
+ */
+
+static int capture_output(void) {
+#ifdef HAVE_PTHREADS
+  return NULL != pool && opts.concurrency > 1;
 #else
-    package = clib_package_new(json, 0);
+  return 0;
 #endif
-  } else {
-#ifdef DEBUG
-    package = clib_package_new_from_slug(dir, 1);
+}
+
+/**
+ * Runs the makefile of a package, once all its dependencies are built.
+ * Each make gets its own environment, as packages build concurrently.
+ */
+
+static int build_node(clib_tree_node_t *node, void *data) {
+  build_state_t *state = node->data;
+  clib_package_t *package = node->package;
+  const char *dir = node->dir;
+  int restored = 0;
+  int skip = 0;
+  int rc = 0;
+
+#ifdef PATH_MAX
+  long path_max = PATH_MAX;
+#elif defined(_PC_PATH_MAX)
+  long path_max = pathconf(dir, _PC_PATH_MAX);
 #else
-    package = clib_package_new_from_slug(dir, 0);
+  long path_max = 4096;
 #endif
-  }
 
-  if (0 == package) {
-    rc = -ENOMEM;
-    goto cleanup;
+  (void)data;
+
+  // with --watch, only packages that changed or depend on one build again
+  if (!state->dirty) {
+    return state->rc;
   }
 
+  state->dirty = 0;
+
   if (0 != package->makefile) {
     char *makefile = path_join(dir, package->makefile);
-    char *command = 0;
-    char *args = rest_argc > 0
-                     ? str_flatten((const char **)rest_argv, 0, rest_argc)
-                     : "";
-
-    char *clean = 0;
-    char *flags = 0;
+    char **argv = malloc((8 + rest_argc) * sizeof(char *));
+    char *envp[3] = {0};
+    char *cflags_var = 0;
+    char *prefix_var = 0;
+    clib_jobserver_token_t token = 0;
+    strbuf_t output = STRBUF_INIT;
+    // held until make is done when others may be printing meanwhile
+    strbuf_t *log = capture_output() ? &output : 0;
+    hash_t *before = 0;
+    char *stamp = 0;
+    uint64_t started = 0;
+    int argc = 0;
 
 #ifdef _GNU_SOURCE
     char *cflags = secure_getenv("CFLAGS");
@@ -231,261 +747,363 @@ int build_package_with_manifest_name(const char *dir, const char *file) {
 #endif
 
     if (cflags) {
-      asprintf(&flags, "%s -I %s", cflags, opts.dir);
+      asprintf(&cflags_var, "CFLAGS=%s -I %s", cflags, opts.dir);
     } else {
-      asprintf(&flags, "-I %s", opts.dir);
+      asprintf(&cflags_var, "CFLAGS=-I %s", opts.dir);
     }
 
     if (root_package && root_package->prefix) {
-      package_opts.prefix = root_package->prefix;
-      clib_package_set_opts(package_opts);
-      setenv("PREFIX", package_opts.prefix, 1);
+      asprintf(&prefix_var, "PREFIX=%s", root_package->prefix);
     } else if (opts.prefix) {
-      setenv("PREFIX", opts.prefix, 1);
+      asprintf(&prefix_var, "PREFIX=%s", opts.prefix);
     } else if (package->prefix) {
       char prefix[path_max];
       memset(prefix, 0, path_max);
       realpath(package->prefix, prefix);
-      unsigned long int size = strlen(prefix) + 1;
-      free(package->prefix);
-      package->prefix = malloc(size);
-      memset((void *)package->prefix, 0, size);
-      memcpy((void *)package->prefix, prefix, size);
-      setenv("PREFIX", package->prefix, 1);
+      asprintf(&prefix_var, "PREFIX=%s", prefix);
     }
 
-    setenv("CFLAGS", flags, 1);
+    if (0 == makefile || 0 == argv || 0 == cflags_var) {
+      free(makefile);
+      free(argv);
+      free(cflags_var);
+      free(prefix_var);
+      return -ENOMEM;
+    }
 
-    if (opts.clean) {
-      char *clean = 0;
-      asprintf(&clean, "make -C %s -f %s %s", dir, makefile, opts.clean);
+    envp[0] = cflags_var;
+    envp[1] = prefix_var;
+
+    if (use_stamps() && (stamp = stamp_path(dir))) {
+      skip = is_stamped(node, stamp, cflags_var, prefix_var);
     }
 
-    char *make = 0;
-    if (opts.test) {
-      asprintf(&make,
-               "make -n -C %s -f %s %s >/dev/null 2>&1 && make -C %s -f %s %s",
-               dir, makefile, opts.test, dir, makefile, opts.test);
-    } else {
-      asprintf(&make, "make -n -C %s -f %s >/dev/null 2>&1 && make -C %s -f %s",
-               dir, makefile, dir, makefile);
+    if (opts.build_cache) {
+      build_key(node, cflags_var, prefix_var);
     }
 
-    asprintf(&command, "%s && %s %s %s", clean ? clean : ":", make,
-             opts.force ? "-B" : "", args);
+    if (!skip && use_build_cache(node)) {
+      restored = 0 == clib_cache_load_build(package->author, package->name,
+                                            package->version, state->key,
+                                            (char *)dir);
 
-    if (0 != opts.verbose) {
-      logger_warn("build", "%s: %s", package->name, package->makefile);
+      // what was there before the build tells its outputs apart
+      if (!restored) {
+        before = snapshot_files(dir);
+      }
     }
 
-    debug(&debugger, "system: %s", command);
-    rc = system(command);
-    free(command);
+    if (skip) {
+      if (0 != opts.verbose) {
+        logger_info("build", "%s: up to date", package->name);
+      }
+    } else if (restored) {
+      if (0 != opts.verbose) {
+        logger_info("build", "%s: restored from cache", package->name);
+      }
 
-    if (clean) {
-      free(clean);
+      if (stamp) {
+        save_stamp(node, stamp, cflags_var, prefix_var);
+      }
+    } else {
+      argv[argc++] = "make";
+      argv[argc++] = "-C";
+      argv[argc++] = (char *)dir;
+      argv[argc++] = "-f";
+      argv[argc++] = makefile;
+
+      if (0 != opts.verbose) {
+        logger_warn("build", "%s: %s", package->name, package->makefile);
+      }
+
+      // every make runs on a job slot and takes any more it needs from
+      // the same jobserver
+      token = clib_jobserver_acquire();
+
+      if (opts.clean) {
+        argv[argc] = opts.clean;
+        argv[argc + 1] = 0;
+        debug(&debugger, "spawn: make -C %s -f %s %s", dir, makefile,
+              opts.clean);
+        rc = run_command(argv, envp, 0, log);
+      }
+
+      // only ask make whether the target exists when the makefile itself
+      // doesn't tell, as that evaluates the whole makefile once more
+      if (0 == rc && opts.test && !makefile_has_target(makefile, opts.test)) {
+        argv[argc] = "-n";
+        argv[argc + 1] = opts.test;
+        argv[argc + 2] = 0;
+        debug(&debugger, "spawn: make -C %s -f %s -n %s", dir, makefile,
+              opts.test);
+        rc = run_command(argv, envp, 1, 0);
+      }
+
+      if (0 == rc) {
+        if (opts.test) {
+          argv[argc++] = opts.test;
+        }
+
+        if (opts.force) {
+          argv[argc++] = "-B";
+        }
+
+        for (int i = 0; i < rest_argc; i++) {
+          int jobs = 0;
+          int size = 0;
+
+          // a -j of its own would make it leave the jobserver
+          if (clib_jobserver_enabled() && (size = jobs_option(i, &jobs))) {
+            i += size - 1;
+            continue;
+          }
+
+          argv[argc++] = rest_argv[i];
+        }
+
+        argv[argc] = 0;
+        debug(&debugger, "spawn: make -C %s -f %s", dir, makefile);
+        started = clib_trace_now();
+        rc = run_command(argv, envp, 0, log);
+        clib_trace_span("build", "make", package->name, started,
+                        "\"rc\":%d", rc);
+      }
+
+      clib_tree_print_log("build", package, output.data, rc);
+
+      clib_jobserver_release(token);
+
+      if (before && 0 == rc && 0 != save_build(node, before)) {
+        logger_warn("warning", "Failed to cache the build of %s",
+                    package->name);
+      }
+
+      if (stamp && 0 == rc) {
+        save_stamp(node, stamp, cflags_var, prefix_var);
+      } else if (stamp) {
+        unlink(stamp);
+      }
     }
 
     free(makefile);
-    free(make);
-    free(flags);
+    free(argv);
+    free(cflags_var);
+    free(prefix_var);
+    free(stamp);
+    free_snapshot(before);
+    strbuf_free(&output);
+  } else {
+    if (use_stamps()) {
+      build_digest(node, NULL, NULL, state->digest);
+    }
 
-    if (rest_argc > 0) {
-      free(args);
+    // so the packages that depend on it can be cached
+    if (opts.build_cache) {
+      build_key(node, NULL, NULL);
     }
+  }
 
-    command = 0;
-#ifdef HAVE_PTHREADS
-    rc = pthread_mutex_lock(&mutex);
-#endif
+  concurrent_hash_set(built, node->path,
+                      0 != package->makefile && !skip && 0 == rc ? "t" : "f");
 
-    hash_set(built, path, "t");
-    ok = 1;
-  } else {
-#ifdef HAVE_PTHREADS
-    rc = pthread_mutex_lock(&mutex);
-#endif
+  state->rc = rc;
+  return rc;
+}
 
-    hash_set(built, path, "f");
-    ok = 1;
-  }
+/**
+ * Builds every package of the tree, each as soon as its dependencies
+ * are built, and those that depend on a failed build not at all. With
+ * --configure they are all configured first, from the same manifests.
+ *
+ * @return Number of packages that failed or were skipped
+ */
 
-  if (0 != rc) {
-    goto cleanup;
-  }
+static int build_packages(void) {
+  clib_pool_t *threads = NULL;
+  int rc = 0;
 
 #ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&mutex);
+  threads = pool;
 #endif
 
-  if (0 != package->dependencies) {
-    list_iterator_t *iterator = 0;
-    list_node_t *node = 0;
+  for (int i = 0; i < clib_tree_size(tree); i++) {
+    clib_tree_node_t *node = clib_tree_node(tree, i);
 
-#ifdef HAVE_PTHREADS
-    clib_package_thread_t wraps[opts.concurrency];
-    pthread_t threads[opts.concurrency];
-    unsigned int i = 0;
-#endif
+    if (!(node->data = calloc(1, sizeof(build_state_t)))) {
+      return clib_tree_size(tree);
+    }
 
-    iterator = list_iterator_new(package->dependencies, LIST_HEAD);
+    state_of(node)->dirty = 1;
+  }
 
-    while ((node = list_iterator_next(iterator))) {
-      clib_package_dependency_t *dep = node->val;
-      char *slug = 0;
-      char *dep_dir = 0;
-      asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version);
+  if (opts.configure) {
+    clib_tree_configure_opts_t configure = {0};
 
-      clib_package_t *dependency = clib_package_new_from_slug(slug, 0);
-      if (opts.dir && dependency && dependency->name) {
-        dep_dir = path_join(opts.dir, dependency->name);
-      }
+    configure.prefix =
+        root_package && root_package->prefix ? root_package->prefix
+                                             : opts.prefix;
+    configure.verbose = opts.verbose;
+    configure.capture = capture_output();
 
-      free(slug);
-      clib_package_free(dependency);
+    if (0 != (rc = clib_tree_run(tree, threads, "configure",
+                                 clib_tree_configure, &configure))) {
+      return rc;
+    }
+  }
 
-      if (0 == dep_dir) {
-        rc = -ENOMEM;
-        goto cleanup;
-      }
+  return clib_tree_run(tree, threads, "build", build_node, NULL);
+}
 
-#ifdef HAVE_PTHREADS
-      clib_package_thread_t *wrap = &wraps[i];
-      pthread_t *thread = &threads[i];
-      wrap->dir = dep_dir;
-      rc = pthread_create(thread, 0, build_package_with_manifest_name_thread,
-                          wrap);
-
-      if (++i >= opts.concurrency) {
-        for (int j = 0; j < i; ++j) {
-          pthread_join(threads[j], 0);
-          free((void *)wraps[j].dir);
-        }
+/**
+ * Marks the package holding the changed file `path` to build again, the
+ * one whose directory is the longest start of it, as those of the
+ * dependencies are usually inside the directory of the root package.
+ */
 
-        i = 0;
-      }
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-      usleep(1024 * 10);
-#endif
-#else
-      rc = build_package(dep_dir);
+static void mark_changed(const char *path, void *data) {
+  build_state_t *owner = NULL;
+  size_t longest = 0;
 
-      free((void *)dep_dir);
+  (void)data;
 
-      if (0 != rc) {
-        goto cleanup;
-      }
-#endif
-    }
+  for (int i = 0; i < clib_tree_size(tree); i++) {
+    build_state_t *state = state_of(clib_tree_node(tree, i));
+    size_t length = state->realdir ? strlen(state->realdir) : 0;
 
-#ifdef HAVE_PTHREADS
-    for (int j = 0; j < i; ++j) {
-      pthread_join(threads[j], 0);
-      free((void *)wraps[j].dir);
+    if (length > longest && 0 == strncmp(path, state->realdir, length) &&
+        '/' == path[length]) {
+      owner = state;
+      longest = length;
     }
-#endif
+  }
 
-    if (0 != iterator) {
-      list_iterator_destroy(iterator);
-    }
+  if (owner && !owner->dirty) {
+    debug(&debugger, "changed: %s", path);
+    owner->dirty = 1;
   }
+}
 
-  if (opts.dev && 0 != package->development) {
-    list_iterator_t *iterator = 0;
-    list_node_t *node = 0;
+/**
+ * Marks the packages depending on one that builds again to build again
+ * too.
+ *
+ * @return Number of packages to build
+ */
 
-#ifdef HAVE_PTHREADS
-    clib_package_thread_t wraps[opts.concurrency];
-    pthread_t threads[opts.concurrency];
-    unsigned int i = 0;
-#endif
+static int mark_dependents(void) {
+  int changed = 1;
+  int count = 0;
 
-    iterator = list_iterator_new(package->development, LIST_HEAD);
+  while (changed) {
+    changed = 0;
 
-    while ((node = list_iterator_next(iterator))) {
-      clib_package_dependency_t *dep = node->val;
-      char *slug = 0;
-      asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version);
+    for (int i = 0; i < clib_tree_size(tree); i++) {
+      clib_tree_node_t *node = clib_tree_node(tree, i);
 
-      clib_package_t *dependency = clib_package_new_from_slug(slug, 0);
-      char *dep_dir = path_join(opts.dir, dependency->name);
+      for (int j = 0; !state_of(node)->dirty && j < node->deps_count; j++) {
+        if (state_of(clib_tree_node(tree, node->deps[j]))->dirty) {
+          state_of(node)->dirty = 1;
+          changed = 1;
+        }
+      }
+    }
+  }
 
-      free(slug);
-      clib_package_free(dependency);
+  for (int i = 0; i < clib_tree_size(tree); i++) {
+    count += state_of(clib_tree_node(tree, i))->dirty;
+  }
 
-#ifdef HAVE_PTHREADS
-      clib_package_thread_t *wrap = &wraps[i];
-      pthread_t *thread = &threads[i];
-      wrap->dir = dep_dir;
-      rc = pthread_create(thread, 0, build_package_with_manifest_name_thread,
-                          wrap);
-
-      if (++i >= opts.concurrency) {
-        for (int j = 0; j < i; ++j) {
-          pthread_join(threads[j], 0);
-          free((void *)wraps[j].dir);
-        }
+  return count;
+}
 
-        i = 0;
-      }
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-      usleep(1024 * 10);
-#endif
-#else
-      if (0 == dep_dir) {
-        rc = -ENOMEM;
-        goto cleanup;
-      }
+/**
+ * Writes the metrics of the builds so far to `CLIB_METRICS_FILE`, when
+ * it's set.
+ */
 
-      rc = build_package(dep_dir);
+static void write_metrics(void) {
+  const char *path = getenv(CLIB_METRICS_FILE_ENV);
 
-      free((void *)dep_dir);
+  if (!path || !*path) {
+    return;
+  }
 
-      if (0 != rc) {
-        goto cleanup;
-      }
+  clib_package_publish_metrics();
+
+  if (0 != clib_metrics_write(path)) {
+    logger_warn("warning", "Unable to write metrics to %s", path);
+  }
+}
+
+/**
+ * Watches the files of every package of the tree, built once already,
+ * and builds the packages that change and those depending on them again,
+ * until interrupted. The tree and its manifests are kept as they were.
+ *
+ * @return 1 when changes can't be watched, as it doesn't return otherwise
+ */
+
+static int watch_packages(void) {
+  clib_pool_t *threads = NULL;
+  clib_watch_t *watch = clib_watch_new();
+#ifdef PATH_MAX
+  char dir[PATH_MAX];
+#else
+  char dir[4096];
 #endif
-    }
 
 #ifdef HAVE_PTHREADS
-    for (int j = 0; j < i; ++j) {
-      pthread_join(threads[j], 0);
-      free((void *)wraps[j].dir);
-    }
+  threads = pool;
 #endif
 
-    if (0 != iterator) {
-      list_iterator_destroy(iterator);
-    }
+  if (!watch) {
+    logger_error("error", "Unable to watch for changes");
+    return 1;
   }
 
-cleanup:
-  if (0 != package) {
-    clib_package_free(package);
-  }
-  if (0 != json) {
-    free(json);
-  }
-  if (0 == ok) {
-    if (0 != path) {
-      free(path);
+  for (int i = 0; i < clib_tree_size(tree); i++) {
+    clib_tree_node_t *node = clib_tree_node(tree, i);
+    build_state_t *state = state_of(node);
+
+    if (!realpath(node->dir, dir) || !(state->realdir = strdup(dir)) ||
+        0 != clib_watch_add(watch, state->realdir)) {
+      logger_warn("warning", "Unable to watch %s", node->dir);
     }
   }
-  return rc;
-}
 
-int build_package(const char *dir) {
-  static const char *manifest_names[] = {"clib.json", "package.json", 0};
-  const char *name = NULL;
-  unsigned int i = 0;
-  int rc = 0;
+  logger_info("watch", "waiting for changes to %d packages",
+              clib_tree_size(tree));
+  write_metrics();
 
-  do {
-    name = manifest_names[i];
-    rc = build_package_with_manifest_name(dir, name);
-  } while (NULL != manifest_names[++i] && 0 != rc);
+  while (0 == clib_watch_wait(watch, WATCH_SETTLE_MS, mark_changed, NULL)) {
+    int count = mark_dependents();
+    int failed = 0;
 
-  return rc;
+    if (0 == count) {
+      continue;
+    }
+
+    logger_info("watch", "building %d changed package%s", count,
+                1 == count ? "" : "s");
+    failed = clib_tree_run(tree, threads, "build", build_node, NULL);
+
+    if (0 != failed) {
+      logger_error("error", "%d packages failed or were skipped", failed);
+    } else {
+      logger_info("watch", "done, waiting for changes");
+    }
+
+    write_metrics();
+
+    // without stamps nothing tells what make wrote from a new change
+    if (!use_stamps()) {
+      clib_watch_drain(watch);
+    }
+  }
+
+  logger_error("error", "Unable to watch for changes");
+  clib_watch_free(watch);
+  return 1;
 }
 
 static void setopt_skip_cache(command_t *self) {
@@ -493,6 +1111,16 @@ static void setopt_skip_cache(command_t *self) {
   debug(&debugger, "set skip cache flag");
 }
 
+static void setopt_build_cache(command_t *self) {
+  opts.build_cache = 1;
+  debug(&debugger, "set build cache flag");
+}
+
+static void setopt_configure(command_t *self) {
+  opts.configure = 1;
+  debug(&debugger, "set configure flag");
+}
+
 static void setopt_dev(command_t *self) {
   opts.dev = 1;
   debug(&debugger, "set dev flag");
@@ -546,6 +1174,16 @@ static void setopt_quiet(command_t *self) {
   debug(&debugger, "set quiet flag");
 }
 
+static void setopt_watch(command_t *self) {
+  opts.watch = 1;
+  debug(&debugger, "set watch flag");
+}
+
+static void setopt_trace(command_t *self) {
+  opts.trace = self->arg;
+  debug(&debugger, "set trace: %s", opts.trace);
+}
+
 #ifdef HAVE_PTHREADS
 static void setopt_concurrency(command_t *self) {
   if (self->arg) {
@@ -556,6 +1194,7 @@ static void setopt_concurrency(command_t *self) {
 #endif
 
 int main(int argc, char **argv) {
+  int jobs = 0;
   int rc = 0;
 
 #ifdef PATH_MAX
@@ -574,8 +1213,8 @@ int main(int argc, char **argv) {
     return -errno;
   }
 
-  built = hash_new();
-  hash_set(built, strdup("__" PROGRAM_NAME "__"), CLIB_VERSION);
+  built = concurrent_hash_new();
+  concurrent_hash_set(built, "__" PROGRAM_NAME "__", CLIB_VERSION);
 
   command_init(&program, PROGRAM_NAME, CLIB_VERSION);
   debug_init(&debugger, PROGRAM_NAME);
@@ -616,6 +1255,21 @@ int main(int argc, char **argv) {
   command_option(&program, "-c", "--skip-cache", "skip cache when configuring",
                  setopt_skip_cache);
 
+  command_option(&program, "-b", "--build-cache",
+                 "restore and save the builds of dependencies in the cache",
+                 setopt_build_cache);
+
+  command_option(&program, "-k", "--configure",
+                 "configure packages before building them", setopt_configure);
+
+  command_option(&program, "-w", "--watch",
+                 "build the packages that change again, until interrupted",
+                 setopt_watch);
+
+  command_option(&program, "-R", "--trace <file>",
+                 "write a Chrome trace of where the time goes to <file>",
+                 setopt_trace);
+
 #ifdef HAVE_PTHREADS
   command_option(&program, "-C", "--concurrency <number>",
                  "Set concurrency (default: " S(MAX_THREADS) ")",
@@ -671,13 +1325,46 @@ int main(int argc, char **argv) {
     } while (program.nargv[i]);
   }
 
+  // join the jobserver of an outer make, or bound the makes started
+  // here by the -j given to them, instead of letting each run that many
+  for (int i = 0; i < rest_argc; i++) {
+    int size = jobs_option(i, &jobs);
+    i += size > 0 ? size - 1 : 0;
+  }
+
+  switch (clib_jobserver_init(jobs)) {
+  case 1:
+    debug(&debugger, "joined the jobserver of make");
+    break;
+  case 2:
+    debug(&debugger, "started a jobserver with %d slots", jobs);
+    break;
+  case -1:
+    logger_warn("warning", "Failed to start a jobserver");
+    break;
+  }
+
   if (0 != curl_global_init(CURL_GLOBAL_ALL)) {
     logger_error("error", "Failed to initialize cURL");
     return 1;
   }
 
+  clib_ratelimit_init();
+  clib_dns_prefetch();
+
   clib_cache_init(CLIB_PACKAGE_CACHE_TIME);
 
+  if (opts.trace && 0 != clib_trace_open(opts.trace)) {
+    logger_warn("warning", "Unable to write a trace to %s", opts.trace);
+  }
+
+  uint64_t started = clib_trace_now();
+
+  if (opts.build_cache && 0 != compiler_digest(compiler)) {
+    logger_warn("warning", "Failed to run the compiler, not caching builds");
+    compiler[0] = 0;
+  }
+
   package_opts.skip_cache = opts.skip_cache;
   package_opts.prefix = opts.prefix;
   package_opts.global = opts.global;
@@ -685,64 +1372,78 @@ int main(int argc, char **argv) {
 
   clib_package_set_opts(package_opts);
 
-  if (0 == program.argc || (argc == rest_offset + rest_argc)) {
-    rc = build_package(CWD);
-  } else {
-    for (int i = 1; i <= rest_offset; ++i) {
-      char *dep = program.nargv[i];
-
-      if ('.' == dep[0]) {
-        char dir[path_max];
-        memset(dir, 0, path_max);
-        dep = realpath(dep, dir);
-      } else {
-        fs_stats *stats = fs_stat(dep);
-        if (!stats) {
-          dep = path_join(opts.dir, dep);
-        } else {
-          free(stats);
-        }
-      }
-
-      fs_stats *stats = fs_stat(dep);
+  // kept from the first build on, for the builds that changes start
+  if (opts.watch && getenv(CLIB_METRICS_FILE_ENV) && 0 != clib_metrics_init()) {
+    logger_warn("warning", "Unable to keep metrics");
+  }
 
-      if (stats && (S_IFREG == (stats->st_mode & S_IFMT)
-#if defined(__unix__) || defined(__linux__) || defined(_POSIX_VERSION)
-                    || S_IFLNK == (stats->st_mode & S_IFMT)
+#ifdef HAVE_PTHREADS
+  // the main thread builds too while it waits on dependencies
+  pool = clib_pool_new((int)opts.concurrency - 1);
 #endif
-                        )) {
-        dep = basename(dep);
-        rc = build_package_with_manifest_name(dirname(dep), basename(dep));
-      } else {
-        rc = build_package(dep);
 
-        // try with slug
-        if (0 != rc) {
-          rc = build_package(program.nargv[i]);
-        }
-      }
+  clib_profile_phase("resolve");
+  load_root_package();
+
+  tree = clib_tree_new(opts.dir, opts.dev);
 
-      if (stats) {
-        free(stats);
-        stats = 0;
+  // the names come first, what follows `--` is counted in too
+  if (!tree) {
+    rc = -ENOMEM;
+  } else if (0 == program.argc - rest_argc) {
+    rc = -1 == clib_tree_add(tree, CWD) ? 1 : 0;
+  } else {
+    for (int i = 1; i <= program.argc - rest_argc; ++i) {
+      if (-1 == clib_tree_add_name(tree, program.nargv[i])) {
+        logger_error("error", "Unable to find package %s", program.nargv[i]);
+        rc = 1;
       }
     }
   }
 
+  clib_profile_phase("build");
+  if (tree && 0 != build_packages()) {
+    rc = 1;
+  }
+
+  if (tree && opts.watch) {
+    rc = watch_packages();
+  }
+
+  clib_profile_phase("cleanup");
+
+  clib_trace_span("command", "build", NULL, started, "\"rc\":%d", rc);
+  clib_trace_close();
+
   int total_built = 0;
-  hash_each(built, {
+  concurrent_hash_each_val(built, {
     if (0 == strncmp("t", val, 1)) {
       (void)total_built++;
     }
-    if (0 != key) {
-      free((void *)key);
-    }
   });
 
-  hash_free(built);
+  concurrent_hash_free(built);
+
+  for (int i = 0; i < clib_tree_size(tree); i++) {
+    build_state_t *state = clib_tree_node(tree, i)->data;
+
+    if (state) {
+      free(state->realdir);
+    }
+
+    free(state);
+  }
+
+  clib_tree_free(tree);
+  clib_package_free(root_package);
+
   command_free(&program);
   curl_global_cleanup();
+#ifdef HAVE_PTHREADS
+  clib_pool_free(pool);
+#endif
   clib_package_cleanup();
+  clib_jobserver_cleanup();
 
   if (opts.dir) {
     free((void *)opts.dir);
@@ -0,0 +1,219 @@
+//
+// clib-cache.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "commander/commander.h"
+#include "common/clib-cache.h"
+#include "common/clib-spawn.h"
+#include "debug/debug.h"
+#include "logger/logger.h"
+#include "version.h"
+#include <inttypes.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CLIB_PACKAGE_CACHE_TIME 30 * 24 * 60 * 60
+
+debug_t debugger;
+
+struct options {
+  uint64_t max_size;
+  int repair;
+  int dev;
+  int invalid;
+};
+
+static struct options opts = {0};
+
+static void setopt_max_size(command_t *self) {
+  if (0 != clib_cache_parse_size(self->arg, &opts.max_size)) {
+    logger_error("error", "Invalid size \"%s\"", self->arg);
+    opts.invalid = 1;
+  }
+  debug(&debugger, "set max size: %" PRIu64, opts.max_size);
+}
+
+static void setopt_repair(command_t *self) {
+  opts.repair = 1;
+  debug(&debugger, "set repair flag");
+}
+
+static void setopt_dev(command_t *self) {
+  opts.dev = 1;
+  debug(&debugger, "set development flag");
+}
+
+static void format_size(char *buffer, uint64_t size) {
+  const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+  double value = size;
+  int i = 0;
+
+  while (value >= 1024 && i < 4) {
+    value /= 1024;
+    i++;
+  }
+
+  sprintf(buffer, 0 == i ? "%.0f %s" : "%.1f %s", value, units[i]);
+}
+
+static int cache_stats(void) {
+  clib_cache_stats_t stats;
+  char size[32];
+  char max_size[32];
+
+  if (0 != clib_cache_stats(&stats)) {
+    logger_error("error", "Unable to read the cache");
+    return 1;
+  }
+
+  format_size(size, stats.size);
+  printf("  packages:  %zu\n", stats.packages);
+  printf("  manifests: %zu\n", stats.manifests);
+  printf("  files:     %zu\n", stats.objects);
+  printf("  size:      %s\n", size);
+
+  if (stats.max_size) {
+    format_size(max_size, stats.max_size);
+    printf("  max size:  %s\n", max_size);
+  }
+
+  return 0;
+}
+
+static int cache_prune(void) {
+  uint64_t freed = 0;
+  char size[32];
+
+  if (0 != clib_cache_prune(opts.max_size, &freed)) {
+    logger_error("error", "Unable to prune the cache");
+    return 1;
+  }
+
+  format_size(size, freed);
+  logger_info("prune", "freed %s", size);
+  return 0;
+}
+
+static int cache_verify(void) {
+  int broken = clib_cache_verify(opts.repair);
+
+  if (-1 == broken) {
+    logger_error("error", "Unable to read the cache");
+    return 1;
+  }
+
+  if (0 == broken) {
+    logger_info("verify", "all cached packages are intact");
+    return 0;
+  }
+
+  if (opts.repair) {
+    logger_warn("verify", "removed %d broken package(s)", broken);
+    return 0;
+  }
+
+  logger_error("verify",
+               "%d broken package(s), run with --repair to remove them",
+               broken);
+  return 1;
+}
+
+/**
+ * Resolve the dependencies of `manifest`, or of the manifest in the
+ * working directory, into the cache without installing them
+ */
+
+static int cache_warm(const char *manifest) {
+  clib_spawn_opts_t spawn = {0};
+  char *argv[5] = {"clib-install", "--prefetch-only", NULL, NULL, NULL};
+  char *path = NULL;
+  const char *dir = ".";
+  const char *file = "";
+  int argc = 2;
+  int rc = 1;
+
+  if (manifest) {
+    if (!(path = strdup(manifest))) {
+      return 1;
+    }
+
+    // its clib.lock sits next to it
+    dir = dirname(path);
+    file = strrchr(manifest, '/') ? strrchr(manifest, '/') + 1 : manifest;
+  }
+
+  if (opts.dev) {
+    argv[argc++] = "--dev";
+  }
+
+  if (*file) {
+    argv[argc++] = (char *)file;
+  }
+
+  debug(&debugger, "exec: clib-install --prefetch-only in %s", dir);
+  spawn.dir = dir;
+  rc = 0 == clib_spawn(argv, &spawn) ? 0 : 1;
+
+  free(path);
+  return rc;
+}
+
+int main(int argc, char **argv) {
+  int rc = 1;
+  command_t program;
+  const char *action = NULL;
+
+  debug_init(&debugger, "clib-cache");
+
+  command_init(&program, "clib-cache", CLIB_VERSION);
+
+  program.usage = "[options] <stats|prune|verify|warm [manifest]>";
+
+  command_option(&program, "-s", "--max-size <size>",
+                 "prune least recently used packages until the cache fits "
+                 "in size (e.g. 512M, 2G)",
+                 setopt_max_size);
+  command_option(&program, "-r", "--repair",
+                 "remove the broken packages found by verify",
+                 setopt_repair);
+  command_option(&program, "-d", "--dev",
+                 "warm development dependencies too", setopt_dev);
+
+  command_parse(&program, argc, argv);
+
+  if (0 == program.argc || opts.invalid ||
+      (program.argc > 1 && 0 != strcmp(program.argv[0], "warm")) ||
+      program.argc > 2) {
+    command_help(&program);
+    goto cleanup;
+  }
+
+  if (0 != clib_cache_init(CLIB_PACKAGE_CACHE_TIME)) {
+    logger_error("error", "Unable to initialize the cache");
+    goto cleanup;
+  }
+
+  action = program.argv[0];
+
+  if (0 == strcmp(action, "stats")) {
+    rc = cache_stats();
+  } else if (0 == strcmp(action, "prune")) {
+    rc = cache_prune();
+  } else if (0 == strcmp(action, "verify")) {
+    rc = cache_verify();
+  } else if (0 == strcmp(action, "warm")) {
+    rc = cache_warm(2 == program.argc ? program.argv[1] : NULL);
+  } else {
+    logger_error("error", "Unknown cache command \"%s\"", action);
+  }
+
+cleanup:
+  command_free(&program);
+  return rc;
+}
@@ -7,19 +7,16 @@
 
 #include <curl/curl.h>
 #include <errno.h>
-#include <libgen.h>
 #include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
 #include <unistd.h>
 #endif
 
-#ifdef HAVE_PTHREADS
-#include <pthread.h>
-#endif
-
 #ifdef _WIN32
 #include <direct.h>
 #define getcwd _getcwd
@@ -28,24 +25,31 @@
 #endif
 
 #include "common/clib-cache.h"
+#include "common/clib-dns.h"
+#include "common/clib-hash.h"
 #include "common/clib-package.h"
+#include "common/clib-pool.h"
+#include "common/clib-ratelimit.h"
+#include "common/clib-trace.h"
+#include "common/clib-tree.h"
 
 #include <asprintf/asprintf.h>
 #include <commander/commander.h>
 #include <debug/debug.h>
 #include <fs/fs.h>
-#include <hash/hash.h>
-#include <list/list.h>
 #include <logger/logger.h>
 #include <path-join/path-join.h>
 #include <str-flatten/str-flatten.h>
-#include <trim/trim.h>
+#include <strbuf/strbuf.h>
 
 #include "version.h"
 
 #define CLIB_PACKAGE_CACHE_TIME 30 * 24 * 60 * 60
 #define PROGRAM_NAME "clib-configure"
 
+// where the output of --flags is kept, in the output directory
+#define FLAGS_STAMP ".clib-flags"
+
 #define SX(s) #s
 #define S(s) SX(s)
 
@@ -69,17 +73,15 @@ struct options {
   int skip_cache;
   int flags;
   int global;
+  const char *trace;
 #ifdef HAVE_PTHREADS
   unsigned int concurrency;
 #endif
 };
 
-const char *manifest_names[] = {"clib.json", "package.json", 0};
-
 clib_package_opts_t package_opts = {0};
 clib_package_t *root_package = 0;
 
-hash_t *configured = 0;
 command_t program = {0};
 debug_t debugger = {0};
 
@@ -103,350 +105,10 @@ options_t opts = {.skip_cache = 0,
 
 };
 
-int configure_package(const char *dir);
-
-#ifdef HAVE_PTHREADS
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-typedef struct clib_package_thread clib_package_thread_t;
-struct clib_package_thread {
-  const char *dir;
-};
-
-void *configure_package_with_manifest_name_thread(void *arg) {
-  clib_package_thread_t *wrap = arg;
-  const char *dir = wrap->dir;
-  configure_package(dir);
-  return 0;
-}
-#endif
-
-int configure_package_with_manifest_name(const char *dir, const char *file) {
-  clib_package_t *package = 0;
-  char *json = NULL;
-  int ok = 0;
-  int rc = 0;
-
-#ifdef PATH_MAX
-  long path_max = PATH_MAX;
-#elif defined(_PC_PATH_MAX)
-  long path_max = pathconf(dir, _PC_PATH_MAX);
-#else
-  long path_max = 4096;
-#endif
-
-  char *path = path_join(dir, file);
-
-  if (0 == path) {
-    return -ENOMEM;
-  }
-
-#ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&mutex);
-#endif
-
-  if (!root_package) {
-    const char *name = NULL;
-    unsigned int i = 0;
-
-    do {
-      name = manifest_names[i];
-      json = fs_read(name);
-    } while (NULL != manifest_names[++i] && !json);
-
-    if (json) {
-      root_package = clib_package_new(json, opts.verbose);
-    }
-
-    if (root_package && root_package->prefix) {
-      char prefix[path_max];
-      memset(prefix, 0, path_max);
-      realpath(root_package->prefix, prefix);
-      unsigned long int size = strlen(prefix) + 1;
-      free(root_package->prefix);
-      root_package->prefix = malloc(size);
-      memset((void *)root_package->prefix, 0, size);
-      memcpy((void *)root_package->prefix, prefix, size);
-    }
-  }
-
-  if (hash_has(configured, path)) {
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&mutex);
-#endif
-    goto cleanup;
-  }
-
-#ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&mutex);
-#endif
-
-  // Free the json if it was allocated before attempting to modify it
-  free(json);
-
-  if (0 == fs_exists(path)) {
-    debug(&debugger, "read %s", path);
-    json = fs_read(path);
-  }
-
-  if (0 != json) {
-#ifdef DEBUG
-    package = clib_package_new(json, 1);
-#else
-    package = clib_package_new(json, 0);
-#endif
-  } else {
-#ifdef DEBUG
-    package = clib_package_new_from_slug(dir, 1);
-#else
-    package = clib_package_new_from_slug(dir, 0);
-#endif
-  }
-
-  if (0 == package) {
-    rc = -ENOMEM;
-    goto cleanup;
-  }
-
-  if (0 != package->flags && opts.flags) {
-#ifdef HAVE_PTHREADS
-    rc = pthread_mutex_lock(&mutex);
-#endif
-
-    hash_set(configured, path, "t");
-    ok = 1;
-    fprintf(stdout, "%s ", trim(package->flags));
-    fflush(stdout);
-  } else if (0 != package->configure) {
-    char *command = 0;
-    char *args = rest_argc > 0
-                     ? str_flatten((const char **)rest_argv, 0, rest_argc)
-                     : "";
-
-    asprintf(&command, "cd %s && %s %s", dir, package->configure, args);
-
-    if (root_package && root_package->prefix) {
-      package_opts.prefix = root_package->prefix;
-      clib_package_set_opts(package_opts);
-      setenv("PREFIX", package_opts.prefix, 1);
-    } else if (opts.prefix) {
-      setenv("PREFIX", opts.prefix, 1);
-    } else if (package->prefix) {
-      char prefix[path_max];
-      memset(prefix, 0, path_max);
-      realpath(package->prefix, prefix);
-      unsigned long int size = strlen(prefix) + 1;
-      free(package->prefix);
-      package->prefix = malloc(size);
-      memset((void *)package->prefix, 0, size);
-      memcpy((void *)package->prefix, prefix, size);
-      setenv("PREFIX", package->prefix, 1);
-    }
-
-    if (rest_argc > 0) {
-      free(args);
-    }
-
-    if (0 != opts.verbose) {
-      logger_warn("configure", "%s: %s", package->name, package->configure);
-    }
-
-    debug(&debugger, "system: %s", command);
-    rc = system(command);
-    free(command);
-    command = 0;
-#ifdef HAVE_PTHREADS
-    rc = pthread_mutex_lock(&mutex);
-#endif
-
-    hash_set(configured, path, "t");
-    ok = 1;
-  } else {
-#ifdef HAVE_PTHREADS
-    rc = pthread_mutex_lock(&mutex);
-#endif
-
-    hash_set(configured, path, "f");
-    ok = 1;
-  }
-
-  if (0 != rc) {
-    goto cleanup;
-  }
-
 #ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&mutex);
+clib_pool_t *pool = 0;
 #endif
 
-  if (0 != package->dependencies) {
-    list_iterator_t *iterator = 0;
-    list_node_t *node = 0;
-
-#ifdef HAVE_PTHREADS
-    clib_package_thread_t wraps[opts.concurrency];
-    pthread_t threads[opts.concurrency];
-    unsigned int i = 0;
-#endif
-
-    iterator = list_iterator_new(package->dependencies, LIST_HEAD);
-
-    while ((node = list_iterator_next(iterator))) {
-      clib_package_dependency_t *dep = node->val;
-      char *slug = 0;
-      asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version);
-
-      clib_package_t *dependency = clib_package_new_from_slug(slug, 0);
-      char *dep_dir = path_join(opts.dir, dependency->name);
-
-      free(slug);
-      clib_package_free(dependency);
-
-#ifdef HAVE_PTHREADS
-      clib_package_thread_t *wrap = &wraps[i];
-      pthread_t *thread = &threads[i];
-      wrap->dir = dep_dir;
-      rc = pthread_create(thread, 0,
-                          configure_package_with_manifest_name_thread, wrap);
-
-      if (++i >= opts.concurrency) {
-        for (int j = 0; j < i; ++j) {
-          pthread_join(threads[j], 0);
-          free((void *)wraps[j].dir);
-        }
-
-        i = 0;
-      }
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-      if (!opts.flags) {
-        usleep(1024 * 10);
-      }
-#endif
-#else
-      if (0 == dep_dir) {
-        rc = -ENOMEM;
-        goto cleanup;
-      }
-
-      rc = configure_package(dep_dir);
-
-      free((void *)dep_dir);
-
-      if (0 != rc) {
-        goto cleanup;
-      }
-#endif
-    }
-
-#ifdef HAVE_PTHREADS
-    for (int j = 0; j < i; ++j) {
-      pthread_join(threads[j], 0);
-      free((void *)wraps[j].dir);
-    }
-#endif
-
-    if (0 != iterator) {
-      list_iterator_destroy(iterator);
-    }
-  }
-
-  if (opts.dev && 0 != package->development) {
-    list_iterator_t *iterator = 0;
-    list_node_t *node = 0;
-
-#ifdef HAVE_PTHREADS
-    clib_package_thread_t wraps[opts.concurrency];
-    pthread_t threads[opts.concurrency];
-    unsigned int i = 0;
-#endif
-
-    iterator = list_iterator_new(package->development, LIST_HEAD);
-
-    while ((node = list_iterator_next(iterator))) {
-      clib_package_dependency_t *dep = node->val;
-      char *slug = 0;
-      asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version);
-
-      clib_package_t *dependency = clib_package_new_from_slug(slug, 0);
-      char *dep_dir = path_join(opts.dir, dependency->name);
-
-      free(slug);
-      clib_package_free(dependency);
-
-#ifdef HAVE_PTHREADS
-      clib_package_thread_t *wrap = &wraps[i];
-      pthread_t *thread = &threads[i];
-      wrap->dir = dep_dir;
-      rc = pthread_create(thread, 0,
-                          configure_package_with_manifest_name_thread, wrap);
-
-      if (++i >= opts.concurrency) {
-        for (int j = 0; j < i; ++j) {
-          pthread_join(threads[j], 0);
-          free((void *)wraps[j].dir);
-        }
-
-        i = 0;
-      }
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-      if (!opts.flags) {
-        usleep(1024 * 10);
-      }
-#endif
-#else
-      if (0 == dep_dir) {
-        rc = -ENOMEM;
-        goto cleanup;
-      }
-
-      rc = configure_package(dep_dir);
-
-      free((void *)dep_dir);
-
-      if (0 != rc) {
-        goto cleanup;
-      }
-#endif
-    }
-
-#ifdef HAVE_PTHREADS
-    for (int j = 0; j < i; ++j) {
-      pthread_join(threads[j], 0);
-      free((void *)wraps[j].dir);
-    }
-#endif
-
-    if (0 != iterator) {
-      list_iterator_destroy(iterator);
-    }
-  }
-
-cleanup:
-  if (0 != package) {
-    clib_package_free(package);
-  }
-  if (0 != json) {
-    free(json);
-  }
-  if (0 == ok) {
-    if (0 != path) {
-      free(path);
-    }
-  }
-  return rc;
-}
-
-int configure_package(const char *dir) {
-  const char *name = NULL;
-  unsigned int i = 0;
-  int rc = 0;
-
-  do {
-    name = manifest_names[i];
-    rc = configure_package_with_manifest_name(dir, name);
-  } while (NULL != manifest_names[++i] && 0 != rc);
-
-  return rc;
-}
-
 static void setopt_skip_cache(command_t *self) {
   opts.skip_cache = 1;
   debug(&debugger, "set skip cache flag");
@@ -488,6 +150,11 @@ static void setopt_quiet(command_t *self) {
   debug(&debugger, "set quiet flag");
 }
 
+static void setopt_trace(command_t *self) {
+  opts.trace = self->arg;
+  debug(&debugger, "set trace: %s", opts.trace);
+}
+
 #ifdef HAVE_PTHREADS
 static void setopt_concurrency(command_t *self) {
   if (self->arg) {
@@ -497,7 +164,164 @@ static void setopt_concurrency(command_t *self) {
 }
 #endif
 
+/**
+ * Digests what the output of --flags depends on besides the manifests:
+ * the version of clib, the directory it runs in and the packages asked
+ * for.
+ */
+
+static void flags_key(const char *cwd, char hex[CLIB_HASH_HEX_SIZE]) {
+  clib_hash_t hash;
+
+  clib_hash_init(&hash);
+  clib_hash_update(&hash, CLIB_VERSION, strlen(CLIB_VERSION) + 1);
+  clib_hash_update(&hash, cwd, strlen(cwd) + 1);
+  clib_hash_update(&hash, &opts.dev, sizeof(opts.dev));
+
+  for (int i = 1; i <= program.argc - rest_argc; i++) {
+    clib_hash_update(&hash, program.nargv[i], strlen(program.nargv[i]) + 1);
+  }
+
+  clib_hash_final(&hash, hex);
+}
+
+/**
+ * Writes the size, modification time and inode of `path` to `record`,
+ * which tells when a manifest or directory changed without reading it.
+ *
+ * @return The modification time, or -1 if there is no such file
+ */
+
+static time_t stat_record(const char *path, char *record, size_t size) {
+  struct stat st;
+
+  if (0 != stat(path, &st)) {
+    return -1;
+  }
+
+  snprintf(record, size, "%lld %lld %llu", (long long)st.st_size,
+           (long long)st.st_mtime, (unsigned long long)st.st_ino);
+  return st.st_mtime;
+}
+
+/**
+ * Reads the output of a previous --flags from the stamp in `opts.dir`,
+ * which is only good as long as none of the files it lists has changed.
+ * Its first line is the key, then come the files, each as a record, a
+ * tab and its path, and last the flags after a tab.
+ *
+ * @return The flags, or NULL when they have to be collected again
+ */
+
+static char *read_flags_stamp(const char *key) {
+  char *path = path_join(opts.dir, FLAGS_STAMP);
+  char *stamp = path ? fs_read(path) : NULL;
+  char *flags = NULL;
+  char *line = stamp;
+  char *end = NULL;
+  char record[128];
+
+  if (!stamp || !(end = strchr(line, '\n'))) {
+    goto cleanup;
+  }
+
+  *end = 0;
+  if (0 != strcmp(line, key)) {
+    goto cleanup;
+  }
+
+  for (line = end + 1; (end = strchr(line, '\n')); line = end + 1) {
+    char *tab = strchr(line, '\t');
+
+    *end = 0;
+
+    if (!tab) {
+      goto cleanup;
+    }
+
+    *tab = 0;
+
+    if (tab == line) {
+      flags = strdup(tab + 1);
+      break;
+    }
+
+    if (-1 == stat_record(tab + 1, record, sizeof(record)) ||
+        0 != strcmp(line, record)) {
+      debug(&debugger, "changed: %s", tab + 1);
+      goto cleanup;
+    }
+  }
+
+cleanup:
+  free(stamp);
+  free(path);
+  return flags;
+}
+
+/**
+ * Keeps `flags`, collected from the packages of `tree`, in the stamp in
+ * `opts.dir` with what they were read from: the manifests, the output
+ * directory, where packages come and go, and the working directory. A
+ * file changed in the second the stamp is written in could change again
+ * unnoticed, so then there is no stamp.
+ *
+ * The stamp is rewritten in place, as making it would change the output
+ * directory. A reader that sees half of it finds no flags line in it.
+ */
+
+static void write_flags_stamp(const char *key, const char *cwd,
+                              clib_tree_t *tree, const char *flags) {
+  strbuf_t stamp = STRBUF_INIT;
+  time_t now = time(NULL);
+  char *path = path_join(opts.dir, FLAGS_STAMP);
+  char record[128];
+  struct stat st;
+  int count = clib_tree_size(tree);
+  int rc = 0;
+
+  if (!path || (0 != stat(path, &st) && -1 == fs_write(path, ""))) {
+    goto cleanup;
+  }
+
+  strbuf_append(&stamp, key);
+  strbuf_append_char(&stamp, '\n');
+
+  for (int i = -2; i < count && 0 == rc; i++) {
+    const char *file = -2 == i ? opts.dir
+                       : -1 == i ? cwd
+                                 : clib_tree_node(tree, i)->path;
+    time_t modified = stat_record(file, record, sizeof(record));
+
+    if (-1 == modified || modified >= now) {
+      rc = -1;
+    } else if (0 != strbuf_append(&stamp, record) ||
+               0 != strbuf_append_char(&stamp, '\t') ||
+               0 != strbuf_append(&stamp, file) ||
+               0 != strbuf_append_char(&stamp, '\n')) {
+      rc = -1;
+    }
+  }
+
+  if (0 == rc && 0 == strbuf_append_char(&stamp, '\t') &&
+      0 == strbuf_append(&stamp, flags) &&
+      0 == strbuf_append_char(&stamp, '\n') &&
+      -1 != fs_write(path, stamp.data)) {
+    debug(&debugger, "wrote %s", path);
+  }
+
+cleanup:
+  strbuf_free(&stamp);
+  free(path);
+}
+
 int main(int argc, char **argv) {
+  clib_tree_configure_opts_t configure = {0};
+  strbuf_t flags = STRBUF_INIT;
+  char key[CLIB_HASH_HEX_SIZE];
+  clib_pool_t *threads = NULL;
+  clib_tree_t *tree = NULL;
+  int stamped = 0;
   int rc = 0;
 
 #ifdef PATH_MAX
@@ -516,9 +340,6 @@ int main(int argc, char **argv) {
     return -errno;
   }
 
-  configured = hash_new();
-  hash_set(configured, strdup("__" PROGRAM_NAME "__"), CLIB_VERSION);
-
   command_init(&program, PROGRAM_NAME, CLIB_VERSION);
   debug_init(&debugger, PROGRAM_NAME);
 
@@ -547,6 +368,10 @@ int main(int argc, char **argv) {
   command_option(&program, "-c", "--skip-cache", "skip cache when configuring",
                  setopt_skip_cache);
 
+  command_option(&program, "-R", "--trace <file>",
+                 "write a Chrome trace of where the time goes to <file>",
+                 setopt_trace);
+
 #ifdef HAVE_PTHREADS
   command_option(&program, "-C", "--concurrency <number>",
                  "Set concurrency (default: " S(MAX_THREADS) ")",
@@ -602,13 +427,44 @@ int main(int argc, char **argv) {
     } while (program.nargv[i]);
   }
 
+  // compiler wrappers ask for the flags of every file they compile, which
+  // are the same until a manifest changes
+  stamped = opts.flags && !opts.force && !opts.skip_cache && opts.dir &&
+            0 != opts.dir[0];
+
+  if (stamped) {
+    char *cached = NULL;
+
+    flags_key(CWD, key);
+
+    if ((cached = read_flags_stamp(key))) {
+      debug(&debugger, "flags from %s", FLAGS_STAMP);
+      printf("%s%s", cached, cached[0] ? "\n" : "");
+      free(cached);
+      command_free(&program);
+      free((void *)opts.dir);
+      free(opts.prefix);
+      free(rest_argv);
+      return 0;
+    }
+  }
+
   if (0 != curl_global_init(CURL_GLOBAL_ALL)) {
     logger_error("error", "Failed to initialize cURL");
     return 1;
   }
 
+  clib_ratelimit_init();
+  clib_dns_prefetch();
+
   clib_cache_init(CLIB_PACKAGE_CACHE_TIME);
 
+  if (opts.trace && 0 != clib_trace_open(opts.trace)) {
+    logger_warn("warning", "Unable to write a trace to %s", opts.trace);
+  }
+
+  uint64_t started = clib_trace_now();
+
   package_opts.skip_cache = opts.skip_cache;
   package_opts.prefix = opts.prefix;
   package_opts.global = opts.global;
@@ -616,63 +472,79 @@ int main(int argc, char **argv) {
 
   clib_package_set_opts(package_opts);
 
-  if (0 == program.argc || (argc == rest_offset + rest_argc)) {
-    rc = configure_package(CWD);
-  } else {
-    for (int i = 1; i <= rest_offset; ++i) {
-      char *dep = program.nargv[i];
-
-      if ('.' == dep[0]) {
-        char dir[path_max];
-        memset(dir, 0, path_max);
-        dep = realpath(dep, dir);
-      } else {
-        fs_stats *stats = fs_stat(dep);
-        if (!stats) {
-          dep = path_join(opts.dir, dep);
-        } else {
-          free(stats);
-        }
-      }
+#ifdef HAVE_PTHREADS
+  // the main thread configures too while it waits on dependencies, and
+  // printing flags is no work for threads
+  pool = clib_pool_new((int)opts.concurrency - 1);
+  threads = opts.flags ? NULL : pool;
+#endif
 
-      fs_stats *stats = fs_stat(dep);
+  root_package = clib_tree_load_root(opts.verbose);
 
-      if (stats && (S_IFREG == (stats->st_mode & S_IFMT)
-#if defined(__unix__) || defined(__linux__) || defined(_POSIX_VERSION)
-                    || S_IFLNK == (stats->st_mode & S_IFMT)
-#endif
-                        )) {
-        dep = basename(dep);
-        rc = configure_package_with_manifest_name(dirname(dep), basename(dep));
-      } else {
-        rc = configure_package(dep);
+  if (root_package && root_package->prefix) {
+    package_opts.prefix = root_package->prefix;
+    clib_package_set_opts(package_opts);
+  }
 
-        // try with slug
-        if (0 != rc) {
-          rc = configure_package(program.nargv[i]);
-        }
-      }
+  tree = clib_tree_new(opts.dir, opts.dev);
 
-      if (stats) {
-        free(stats);
-        stats = 0;
+  // the names come first, what follows `--` is counted in too
+  if (!tree) {
+    rc = -ENOMEM;
+  } else if (0 == program.argc - rest_argc) {
+    rc = -1 == clib_tree_add(tree, CWD) ? 1 : 0;
+  } else {
+    for (int i = 1; i <= program.argc - rest_argc; ++i) {
+      if (-1 == clib_tree_add_name(tree, program.nargv[i])) {
+        logger_error("error", "Unable to find package %s", program.nargv[i]);
+        rc = 1;
       }
     }
   }
 
-  int total_configured = 0;
-  hash_each(configured, {
-    if (0 == strncmp("t", val, 1)) {
-      (void)total_configured++;
-    }
-    if (0 != key) {
-      free((void *)key);
+  configure.prefix = package_opts.prefix;
+  // joined once, rather than for each package
+  if (rest_argc > 0) {
+    configure.args = str_flatten((const char **)rest_argv, 0, rest_argc);
+  }
+  configure.flags = opts.flags;
+  configure.output = opts.flags ? &flags : NULL;
+  configure.verbose = opts.verbose;
+#ifdef HAVE_PTHREADS
+  // packages configuring at the same time print their output when done
+  configure.capture = NULL != threads && opts.concurrency > 1;
+#endif
+
+  // dependencies are configured first, printing flags takes no time
+  if (tree && 0 != clib_tree_run(tree, threads,
+                                 opts.flags ? NULL : "configure",
+                                 clib_tree_configure, &configure)) {
+    rc = 1;
+  }
+
+  int total_configured = configure.configured;
+
+  if (opts.flags) {
+    fputs(flags.data ? flags.data : "", stdout);
+
+    if (0 == rc && stamped) {
+      write_flags_stamp(key, CWD, tree, flags.data ? flags.data : "");
     }
-  });
 
-  hash_free(configured);
+    strbuf_free(&flags);
+  }
+
+  clib_trace_span("command", "configure", NULL, started, "\"rc\":%d", rc);
+  clib_trace_close();
+
+  clib_tree_free(tree);
+  clib_package_free(root_package);
+
   command_free(&program);
   curl_global_cleanup();
+#ifdef HAVE_PTHREADS
+  clib_pool_free(pool);
+#endif
   clib_package_cleanup();
 
   if (opts.dir) {
@@ -684,6 +556,7 @@ int main(int argc, char **argv) {
   }
 
   if (rest_argc > 0) {
+    free((void *)configure.args);
     free(rest_argv);
     rest_offset = 0;
     rest_argc = 0;
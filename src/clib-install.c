@@ -5,26 +5,51 @@
 // MIT licensed
 //
 
+#include "asprintf/asprintf.h"
 #include "commander/commander.h"
 #include "common/clib-cache.h"
+#include "common/clib-dns.h"
+#include "common/clib-hash.h"
+#include "common/clib-json.h"
+#include "common/clib-link.h"
+#include "common/clib-lockfile.h"
+#include "common/clib-mkdir.h"
 #include "common/clib-package.h"
+#include "common/clib-pool.h"
+#include "common/clib-profile.h"
+#include "common/clib-ratelimit.h"
+#include "common/clib-trace.h"
 #include "common/clib-validate.h"
+#include "common/clib-walk.h"
 #include "debug/debug.h"
 #include "fs/fs.h"
+#include "hash/hash.h"
 #include "http-get/http-get.h"
 #include "logger/logger.h"
 #include "parson/parson.h"
+#include "path-join/path-join.h"
 #include "str-replace/str-replace.h"
 #include "version.h"
 #include <curl/curl.h>
 #include <libgen.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 #define CLIB_PACKAGE_CACHE_TIME 30 * 24 * 60 * 60
 
+// in the output directory, the state it was left in by the last install
+// of the project's manifest
+#define CLIB_INSTALL_STAMP ".clib-install"
+
 #define SX(s) #s
 #define S(s) SX(s)
 
@@ -53,6 +78,26 @@ struct options {
   int force;
   int global;
   int skip_cache;
+  int no_compression;
+  int http3;
+  int git;
+  int retries;
+  int connect_timeout;
+  int timeout;
+  int low_speed_time;
+  int min_downloads;
+  int max_downloads;
+  int memory_budget;
+  int progress;
+  int no_lockfile;
+  int frozen_lockfile;
+  int prefetch_only;
+  int build;
+  int workspace;
+  int link;
+  const char *trace;
+  const char *summary;
+  const char *plan;
 #ifdef HAVE_PTHREADS
   unsigned int concurrency;
 #endif
@@ -65,6 +110,15 @@ static const char *manifest_names[] = {"clib.json", "package.json", NULL};
 static clib_package_opts_t package_opts = {0};
 static clib_package_t *root_package = NULL;
 
+// the manifest as `--save` and `--save-dev` leave it, written at the end
+static JSON_Value *saved_manifest = NULL;
+static const char *saved_manifest_name = NULL;
+
+#ifdef HAVE_PTHREADS
+// packages given on the command line are installed concurrently
+static pthread_mutex_t save_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 /**
  * Option setters.
  */
@@ -114,6 +168,27 @@ static void setopt_global(command_t *self) {
   debug(&debugger, "set global flag");
 }
 
+static void setopt_trace(command_t *self) {
+  opts.trace = self->arg;
+  debug(&debugger, "set trace: %s", opts.trace);
+}
+
+static void setopt_summary(command_t *self) {
+  // without a file, to stderr
+  opts.summary = self->arg ? self->arg : "-";
+  debug(&debugger, "set summary: %s", opts.summary);
+}
+
+static void setopt_plan(command_t *self) {
+  opts.plan = "text";
+  debug(&debugger, "set plan: %s", opts.plan);
+}
+
+static void setopt_plan_json(command_t *self) {
+  opts.plan = "json";
+  debug(&debugger, "set plan: %s", opts.plan);
+}
+
 #ifdef HAVE_PTHREADS
 static void setopt_concurrency(command_t *self) {
   if (self->arg) {
@@ -123,24 +198,133 @@ static void setopt_concurrency(command_t *self) {
 }
 #endif
 
+static void setopt_no_compression(command_t *self) {
+  opts.no_compression = 1;
+  debug(&debugger, "set no compression flag");
+}
+
+static void setopt_http3(command_t *self) {
+  opts.http3 = 1;
+  debug(&debugger, "set http3 flag");
+}
+
+static void setopt_git(command_t *self) {
+  opts.git = 1;
+  debug(&debugger, "set git flag");
+}
+
+static void setopt_retries(command_t *self) {
+  if (self->arg) {
+    opts.retries = atoi(self->arg);
+    // zero means "no retries", which the package options spell as -1
+    if (0 == opts.retries) {
+      opts.retries = -1;
+    }
+    debug(&debugger, "set retries: %d", opts.retries);
+  }
+}
+
+/**
+ * Reads the seconds of a limit, where zero means "no limit", which the
+ * package options spell as -1
+ */
+
+static int seconds_option(const char *arg) {
+  int seconds = atoi(arg);
+  return 0 == seconds ? -1 : seconds;
+}
+
+static void setopt_connect_timeout(command_t *self) {
+  if (self->arg) {
+    opts.connect_timeout = seconds_option(self->arg);
+    debug(&debugger, "set connect timeout: %d", opts.connect_timeout);
+  }
+}
+
+static void setopt_max_time(command_t *self) {
+  if (self->arg) {
+    opts.timeout = seconds_option(self->arg);
+    debug(&debugger, "set max time: %d", opts.timeout);
+  }
+}
+
+static void setopt_stall_timeout(command_t *self) {
+  if (self->arg) {
+    opts.low_speed_time = seconds_option(self->arg);
+    debug(&debugger, "set stall timeout: %d", opts.low_speed_time);
+  }
+}
+
+static void setopt_downloads(command_t *self) {
+  const char *dash = NULL;
+
+  if (self->arg) {
+    // "8" keeps to 8, "2-16" adapts in between
+    dash = strchr(self->arg, '-');
+    opts.min_downloads = atoi(self->arg);
+    opts.max_downloads = dash ? atoi(dash + 1) : opts.min_downloads;
+    debug(&debugger, "set downloads: %d-%d", opts.min_downloads,
+          opts.max_downloads);
+  }
+}
+
+static void setopt_memory(command_t *self) {
+  if (self->arg) {
+    // zero means "no budget", which the package options spell as -1
+    opts.memory_budget = atoi(self->arg);
+    if (0 == opts.memory_budget) {
+      opts.memory_budget = -1;
+    }
+    debug(&debugger, "set memory budget: %d", opts.memory_budget);
+  }
+}
+
+static void setopt_progress(command_t *self) {
+  opts.progress = CLIB_PACKAGE_PROGRESS_INTERVAL;
+  debug(&debugger, "set progress flag");
+}
+
+static void setopt_no_lockfile(command_t *self) {
+  opts.no_lockfile = 1;
+  debug(&debugger, "set no lockfile flag");
+}
+
+static void setopt_frozen_lockfile(command_t *self) {
+  opts.frozen_lockfile = 1;
+  debug(&debugger, "set frozen lockfile flag");
+}
+
+static void setopt_prefetch_only(command_t *self) {
+  opts.prefetch_only = 1;
+  debug(&debugger, "set prefetch only flag");
+}
+
+static void setopt_build(command_t *self) {
+  opts.build = 1;
+  debug(&debugger, "set build flag");
+}
+
+static void setopt_workspace(command_t *self) {
+  opts.workspace = 1;
+  debug(&debugger, "set workspace flag");
+}
+
+static void setopt_link(command_t *self) {
+  opts.link = 1;
+  debug(&debugger, "set link flag");
+}
+
 static void setopt_skip_cache(command_t *self) {
   opts.skip_cache = 1;
   debug(&debugger, "set skip cache flag");
 }
 
 static int install_local_packages_with_package_name(const char *file) {
-  if (0 != clib_validate(file)) {
-    return 1;
-  }
-
   debug(&debugger, "reading local clib.json or package.json");
-  char *json = fs_read(file);
-  if (NULL == json)
-    return 1;
-
-  clib_package_t *pkg = clib_package_new(json, opts.verbose);
-  if (NULL == pkg)
-    goto e1;
+  // validated as read, rather than parsed once more
+  clib_package_t *pkg = clib_validate_load(file);
+  if (0 != clib_validate_package(pkg, file))
+    goto e2;
 
   if (pkg->prefix) {
     setenv("PREFIX", pkg->prefix, 1);
@@ -156,14 +340,11 @@ static int install_local_packages_with_package_name(const char *file) {
       goto e2;
   }
 
-  free(json);
   clib_package_free(pkg);
   return 0;
 
 e2:
   clib_package_free(pkg);
-e1:
-  free(json);
   return 1;
 }
 
@@ -183,196 +364,1147 @@ static int install_local_packages() {
   return rc;
 }
 
-static int write_dependency_with_package_name(clib_package_t *pkg, char *prefix,
-                                              const char *file) {
-  JSON_Value *packageJson = json_parse_file(file);
-  JSON_Object *packageJsonObject = json_object(packageJson);
-  JSON_Value *newDepSectionValue = NULL;
+/**
+ * Links the package at `path`, a directory with a manifest or the manifest
+ * itself, into the output dir instead of copying its sources, so edits to
+ * it are seen without installing again, then installs its dependencies.
+ *
+ * @return 0 on success, 1 otherwise
+ */
 
-  if (NULL == packageJson || NULL == packageJsonObject)
-    return 1;
+static int link_local_package(const char *path) {
+  clib_package_t *pkg = NULL;
+  fs_stats *stats = NULL;
+  char *manifest = NULL;
+  char *parent = NULL;
+  char *link = NULL;
+  int rc = 1;
 
-  // If the dependency section doesn't exist then create it
-  JSON_Object *depSection =
-      json_object_dotget_object(packageJsonObject, prefix);
-  if (NULL == depSection) {
-    newDepSectionValue = json_value_init_object();
-    depSection = json_value_get_object(newDepSectionValue);
-    json_object_set_value(packageJsonObject, prefix, newDepSectionValue);
+#ifdef PATH_MAX
+  long path_max = PATH_MAX;
+#elif defined(_PC_PATH_MAX)
+  long path_max = pathconf(path, _PC_PATH_MAX);
+#else
+  long path_max = 4096;
+#endif
+
+  char target[path_max];
+
+  if (!(stats = fs_stat(path))) {
+    goto cleanup;
+  }
+
+  if (S_IFDIR == (stats->st_mode & S_IFMT)) {
+    for (int i = 0; !manifest && manifest_names[i]; i++) {
+      if ((manifest = path_join(path, manifest_names[i])) &&
+          0 != fs_exists(manifest)) {
+        free(manifest);
+        manifest = NULL;
+      }
+    }
+  } else {
+    manifest = strdup(path);
   }
 
-  // Add the dependency to the dependency section
-  json_object_set_string(depSection, pkg->repo, pkg->version);
+  if (!manifest) {
+    logger_error("error", "No clib.json or package.json in %s", path);
+    goto cleanup;
+  }
+
+  pkg = clib_validate_load(manifest);
+  if (0 != clib_validate_package(pkg, manifest)) {
+    goto cleanup;
+  }
+
+  if (!pkg->name) {
+    logger_error("error", "%s has no name to link it by", manifest);
+    goto cleanup;
+  }
+
+  // the link is followed from the output dir
+  if (!(parent = strdup(manifest)) || !realpath(dirname(parent), target) ||
+      !(link = path_join(opts.dir, pkg->name))) {
+    goto cleanup;
+  }
+
+  if (!opts.plan && !opts.prefetch_only) {
+    if (0 == fs_exists(link) && !clib_link_is_link(link)) {
+      logger_error("error", "%s is installed already, remove it to link %s",
+                   link, target);
+      goto cleanup;
+    }
+
+    if (-1 == clib_mkdirp(opts.dir, 0777) ||
+        0 != clib_link_dir(target, link)) {
+      logger_error("error", "Unable to link %s to %s", link, target);
+      goto cleanup;
+    }
+
+    if (opts.verbose) {
+      logger_info("link", "%s -> %s", link, target);
+    }
+  }
+
+  if (pkg->prefix) {
+    setenv("PREFIX", pkg->prefix, 1);
+  }
 
-  // Flush package.json
-  int rc = json_serialize_to_file_pretty(packageJson, file);
-  json_value_free(packageJson);
+  if (-1 == clib_package_install_dependencies(pkg, opts.dir, opts.verbose) ||
+      (opts.dev &&
+       -1 == clib_package_install_development(pkg, opts.dir, opts.verbose))) {
+    goto cleanup;
+  }
+
+  rc = 0;
+
+cleanup:
+  clib_package_free(pkg);
+  free(stats);
+  free(manifest);
+  free(parent);
+  free(link);
   return rc;
 }
 
-/**
- * Writes out a dependency to clib.json or package.json
- */
-static int write_dependency(clib_package_t *pkg, char *prefix) {
-  const char *name = NULL;
-  unsigned int i = 0;
-  int rc = 0;
+typedef struct {
+  list_t *manifests; // of the components, relative to the workspace
+  const char *deps;  // the name of the directories packages go to
+} workspace_walk_t;
 
-  do {
-    name = manifest_names[i];
-    rc = write_dependency_with_package_name(pkg, prefix, name);
-  } while (NULL != manifest_names[++i] && 0 != rc);
+static int find_component(int dirfd, const char *name, const char *path,
+                          void *data) {
+  workspace_walk_t *walk = data;
+  char *manifest = NULL;
 
-  return rc;
+  (void)dirfd;
+
+  if (0 != strcmp(name, manifest_names[0])) {
+    return 0;
+  }
+
+  if (!(manifest = strdup(path)) ||
+      !list_rpush(walk->manifests, list_node_new(manifest))) {
+    free(manifest);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int enter_component(int dirfd, const char *name, const char *path,
+                           void *data) {
+  workspace_walk_t *walk = data;
+
+  (void)dirfd;
+  (void)path;
+
+  // installed packages and the trees of other tools hold no components
+  return '.' == name[0] || 0 == strcmp(name, walk->deps) ||
+                 0 == strcmp(name, "node_modules")
+             ? CLIB_WALK_SKIP
+             : 0;
 }
 
 /**
- * Save a dependency to clib.json or package.json.
+ * @return The `author/name@version` of `dep`, or NULL on error
  */
-static int save_dependency(clib_package_t *pkg) {
-  debug(&debugger, "saving dependency %s at %s", pkg->name, pkg->version);
-  return write_dependency(pkg, "dependencies");
+
+static char *version_slug(clib_package_dependency_t *dep) {
+  char *slug = NULL;
+
+  if (-1 == asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version)) {
+    return NULL;
+  }
+
+  return slug;
 }
 
 /**
- * Save a development dependency to clib.json or package.json.
+ * @return How many components depend on `dep` at its version, as counted
+ * in `counts`
  */
-static int save_dev_dependency(clib_package_t *pkg) {
-  debug(&debugger, "saving dev dependency %s at %s", pkg->name, pkg->version);
-  return write_dependency(pkg, "development");
+
+static intptr_t version_count(hash_t *counts, clib_package_dependency_t *dep) {
+  char *slug = version_slug(dep);
+  intptr_t count = slug ? (intptr_t)hash_get(counts, slug) : 0;
+
+  free(slug);
+  return count;
 }
 
 /**
- * Create and install a package from `slug`.
+ * Counts one more component depending on each of `deps` at its version in
+ * `counts`, which owns its keys.
+ *
+ * @return 0 on success, -1 on error
  */
 
-static int install_package(const char *slug) {
-  clib_package_t *pkg = NULL;
-  int rc;
+static int count_versions(hash_t *counts, list_t *deps) {
+  list_node_t *node = NULL;
 
-#ifdef PATH_MAX
-  long path_max = PATH_MAX;
-#elif defined(_PC_PATH_MAX)
-  long path_max = pathconf(slug, _PC_PATH_MAX);
-#else
-  long path_max = 4096;
-#endif
+  if (!deps) {
+    return 0;
+  }
 
-  if (!root_package) {
-    const char *name = NULL;
-    char *json = NULL;
-    unsigned int i = 0;
+  list_each(deps, node) {
+    char *slug = version_slug(node->val);
+    intptr_t count = 0;
 
-    do {
-      name = manifest_names[i];
-      json = fs_read(name);
-    } while (NULL != manifest_names[++i] && !json);
+    if (!slug) {
+      return -1;
+    }
 
-    if (json) {
-      root_package = clib_package_new(json, opts.verbose);
+    count = (intptr_t)hash_get(counts, slug);
+    hash_set(counts, slug, (void *)(count + 1));
+
+    // the hash keeps the key it had
+    if (count > 0) {
+      free(slug);
     }
   }
 
-  if ('.' == slug[0]) {
-    if (1 == strlen(slug) || ('/' == slug[1] && 2 == strlen(slug))) {
-      char dir[path_max];
-      realpath(slug, dir);
-      slug = dir;
-      return install_local_packages();
-    }
+  return 0;
+}
+
+/**
+ * Chooses, into `chosen`, the version of each of `deps` that the most
+ * components depend on, the first one seen on a tie, or each of them
+ * whatever the others depend on when `pin` is set.
+ */
+
+static void choose_versions(hash_t *chosen, hash_t *counts, list_t *deps,
+                            int pin) {
+  list_node_t *node = NULL;
+
+  if (!deps) {
+    return;
   }
 
-  if (0 == fs_exists(slug)) {
-    fs_stats *stats = fs_stat(slug);
-    if (NULL != stats && (S_IFREG == (stats->st_mode & S_IFMT)
-#if defined(__unix__) || defined(__linux__) || defined(_POSIX_VERSION)
-                          || S_IFLNK == (stats->st_mode & S_IFMT)
-#endif
-                              )) {
-      free(stats);
-      return install_local_packages_with_package_name(slug);
-    }
+  list_each(deps, node) {
+    clib_package_dependency_t *dep = node->val;
+    clib_package_dependency_t *current = hash_get(chosen, dep->name);
 
-    if (stats) {
-      free(stats);
+    if (pin || !current ||
+        version_count(counts, dep) > version_count(counts, current)) {
+      hash_set(chosen, dep->name, dep);
     }
   }
+}
 
-  if (!pkg) {
-    pkg = clib_package_new_from_slug(slug, opts.verbose);
-  }
+/**
+ * Adds the dependencies in `deps` to `object`, only those at the version
+ * in `chosen` when `shared` is set, or only the others otherwise.
+ *
+ * @return The number added
+ */
 
-  if (NULL == pkg)
-    return -1;
+static int add_workspace_dependencies(JSON_Object *object, list_t *deps,
+                                      hash_t *chosen, int shared) {
+  list_node_t *node = NULL;
+  int count = 0;
 
-  if (root_package && root_package->prefix) {
-    package_opts.prefix = root_package->prefix;
-    clib_package_set_opts(package_opts);
+  if (!deps) {
+    return 0;
   }
 
-  rc = clib_package_install(pkg, opts.dir, opts.verbose);
-  if (0 != rc) {
-    goto cleanup;
-  }
+  list_each(deps, node) {
+    clib_package_dependency_t *dep = node->val;
+    clib_package_dependency_t *version = hash_get(chosen, dep->name);
+    int hoisted = version && 0 == strcmp(version->author, dep->author) &&
+                  0 == strcmp(version->version, dep->version);
+    char *repo = NULL;
 
-  if (0 == rc && opts.dev) {
-    rc = clib_package_install_development(pkg, opts.dir, opts.verbose);
-    if (0 != rc) {
-      goto cleanup;
+    if (hoisted != shared ||
+        -1 == asprintf(&repo, "%s/%s", dep->author, dep->name)) {
+      continue;
     }
+
+    if (JSONSuccess == json_object_set_string(object, repo, dep->version)) {
+      count++;
+    }
+
+    free(repo);
   }
 
-  if (0 == pkg->repo || 0 != strcmp(slug, pkg->repo)) {
-    pkg->repo = strdup(slug);
+  return count;
+}
+
+/**
+ * Installs the dependencies in `manifest`, a value made by
+ * `add_workspace_dependencies()`, into `dir`.
+ *
+ * @return 0 on success, 1 otherwise
+ */
+
+static int install_workspace_dependencies(JSON_Value *manifest,
+                                          const char *dir) {
+  clib_package_t *pkg = NULL;
+  char *json = NULL;
+  int rc = 1;
+
+  if (!(json = json_serialize_to_string(manifest)) ||
+      !(pkg = clib_package_new(json, opts.verbose))) {
+    goto cleanup;
   }
 
-  if (opts.save)
-    save_dependency(pkg);
-  if (opts.savedev)
-    save_dev_dependency(pkg);
+  rc = 0 == clib_package_install_dependencies(pkg, dir, opts.verbose) ? 0 : 1;
 
 cleanup:
   clib_package_free(pkg);
+  json_free_serialized_string(json);
   return rc;
 }
 
 /**
- * Install the given `pkgs`.
+ * Installs the dependencies of every component of the workspace in the
+ * working directory, a directory with a clib.json file. Each package is
+ * installed once into the output dir at the version that clib.json, or
+ * else most components, depend on, and at any other version into the
+ * directory of that name next to the clib.json of the components
+ * depending on it.
  */
 
-static int install_packages(int n, char *pkgs[]) {
-  for (int i = 0; i < n; i++) {
-    debug(&debugger, "install %s (%d)", pkgs[i], i);
-    if (-1 == install_package(pkgs[i])) {
-      logger_error("error", "Unable to install package %s", pkgs[i]);
-      return 1;
-    }
+static int install_workspace(void) {
+  workspace_walk_t walk = {NULL, NULL};
+  clib_walk_t callbacks = {find_component, enter_component, NULL, &walk};
+  list_t *components = NULL;
+  hash_t *counts = NULL;
+  hash_t *chosen = NULL;
+  JSON_Value *shared = NULL;
+  list_node_t *node = NULL;
+  char *deps_name = NULL;
+  int shared_count = 0;
+  int rc = 1;
+
+  if (!(walk.manifests = list_new()) || !(components = list_new()) ||
+      !(counts = hash_new()) || !(chosen = hash_new()) ||
+      !(deps_name = strdup(opts.dir))) {
+    goto cleanup;
   }
-  return 0;
-}
 
-/**
- * Entry point.
- */
+  walk.manifests->free = free;
+  walk.deps = basename(deps_name);
 
-int main(int argc, char *argv[]) {
-#ifdef _WIN32
-  opts.dir = ".\\deps";
-#else
-  opts.dir = "./deps";
-#endif
-  opts.verbose = 1;
-  opts.dev = 0;
+  if (0 != clib_walk(".", 1, &callbacks)) {
+    logger_error("error", "Unable to look for the components of the workspace");
+    goto cleanup;
+  }
 
-#ifdef PATH_MAX
-  long path_max = PATH_MAX;
-#elif defined(_PC_PATH_MAX)
-  long path_max = pathconf(opts.dir, _PC_PATH_MAX);
-#else
-  long path_max = 4096;
-#endif
+  // how many components depend on each version of each package
+  list_each(walk.manifests, node) {
+    char *json = fs_read(node->val);
+    clib_package_t *pkg = json ? clib_package_new(json, opts.verbose) : NULL;
 
-  debug_init(&debugger, "clib-install");
+    free(json);
+
+    if (!pkg) {
+      logger_error("error", "Unable to read %s", (char *)node->val);
+      goto cleanup;
+    }
+
+    pkg->data = node->val;
+    list_rpush(components, list_node_new(pkg));
+
+    if (0 != count_versions(counts, pkg->dependencies) ||
+        (opts.dev && 0 != count_versions(counts, pkg->development))) {
+      goto cleanup;
+    }
+  }
+
+  // the packages of the workspace's own clib.json go to the output dir
+  // whatever the components depend on, so they are chosen last
+  for (int pin = 0; pin < 2; pin++) {
+    list_each(components, node) {
+      clib_package_t *pkg = node->val;
+
+      if (pin != (0 == strcmp(pkg->data, manifest_names[0]))) {
+        continue;
+      }
+
+      choose_versions(chosen, counts, pkg->dependencies, pin);
+      if (opts.dev) {
+        choose_versions(chosen, counts, pkg->development, pin);
+      }
+    }
+  }
+
+  if (!(shared = json_value_init_object()) ||
+      JSONSuccess != json_object_set_value(json_object(shared), "dependencies",
+                                           json_value_init_object())) {
+    goto cleanup;
+  }
+
+  list_each(components, node) {
+    clib_package_t *pkg = node->val;
+    JSON_Object *object =
+        json_object_get_object(json_object(shared), "dependencies");
+
+    add_workspace_dependencies(object, pkg->dependencies, chosen, 1);
+    if (opts.dev) {
+      add_workspace_dependencies(object, pkg->development, chosen, 1);
+    }
+  }
+
+  shared_count = (int)json_object_get_count(
+      json_object_get_object(json_object(shared), "dependencies"));
+
+  if (opts.verbose) {
+    logger_info("workspace", "%d components share %d packages in %s",
+                (int)components->len, shared_count, opts.dir);
+  }
+
+  rc = 0;
+
+  if (shared_count > 0) {
+    rc = install_workspace_dependencies(shared, opts.dir);
+  }
+
+  // the other versions, next to each component depending on them
+  list_each(components, node) {
+    clib_package_t *pkg = node->val;
+    JSON_Value *own = json_value_init_object();
+    JSON_Value *deps = json_value_init_object();
+    char *manifest = NULL;
+    char *dir = NULL;
+    int count = 0;
+
+    if (!own || !deps ||
+        JSONSuccess !=
+            json_object_set_value(json_object(own), "dependencies", deps)) {
+      json_value_free(own);
+      json_value_free(deps);
+      rc = 1;
+      continue;
+    }
+
+    count = add_workspace_dependencies(json_object(deps), pkg->dependencies,
+                                       chosen, 0);
+    if (opts.dev) {
+      count += add_workspace_dependencies(json_object(deps), pkg->development,
+                                          chosen, 0);
+    }
+
+    if (count > 0 && (manifest = strdup(pkg->data)) &&
+        (dir = path_join(dirname(manifest), walk.deps))) {
+      if (opts.verbose) {
+        logger_info("workspace", "%d packages of their own in %s", count,
+                    dir);
+      }
+
+      if (0 != install_workspace_dependencies(own, dir)) {
+        rc = 1;
+      }
+    } else if (count > 0) {
+      rc = 1;
+    }
+
+    free(manifest);
+    free(dir);
+    json_value_free(own);
+  }
+
+cleanup:
+  if (components) {
+    list_each(components, node) {
+      clib_package_free(node->val);
+    }
+    list_destroy(components);
+  }
+
+  if (walk.manifests) {
+    list_destroy(walk.manifests);
+  }
+
+  if (counts) {
+    hash_each_key(counts, free((char *)key));
+    hash_free(counts);
+  }
+
+  // the keys and values are the components'
+  if (chosen) {
+    hash_free(chosen);
+  }
+
+  json_value_free(shared);
+  free(deps_name);
+  return rc;
+}
+
+/**
+ * Loads the manifest that `--save` and `--save-dev` add to, the first of
+ * `manifest_names` there is, once.
+ *
+ * @return Its root object, or NULL when there is none
+ */
+
+static JSON_Object *load_saved_manifest(void) {
+  unsigned int i = 0;
+
+  while (!saved_manifest && NULL != manifest_names[i]) {
+    if ((saved_manifest = json_parse_file(manifest_names[i]))) {
+      saved_manifest_name = manifest_names[i];
+    }
+    (void)i++;
+  }
+
+  return json_object(saved_manifest);
+}
+
+/**
+ * Adds the dependency on `repo` to the `prefix` section of the manifest in
+ * memory, which `write_saved_manifest()` writes once the install is over
+ */
+static int write_dependency(clib_package_t *pkg, const char *repo,
+                            char *prefix) {
+  JSON_Object *manifest = load_saved_manifest();
+  JSON_Value *newDepSectionValue = NULL;
+
+  if (NULL == manifest)
+    return 1;
+
+  // If the dependency section doesn't exist then create it
+  JSON_Object *depSection = json_object_dotget_object(manifest, prefix);
+  if (NULL == depSection) {
+    newDepSectionValue = json_value_init_object();
+    depSection = json_value_get_object(newDepSectionValue);
+    json_object_set_value(manifest, prefix, newDepSectionValue);
+  }
+
+  // Add the dependency to the dependency section, where it was if it was
+  return JSONSuccess == json_object_set_string(depSection, repo, pkg->version)
+             ? 0
+             : 1;
+}
+
+/**
+ * Writes the dependencies saved by the install to the manifest at once,
+ * through a copy renamed over it so that it is never left half written.
+ *
+ * @return 0 on success, or when nothing was saved, -1 otherwise
+ */
+static int write_saved_manifest(void) {
+  char *staged = NULL;
+  int rc = -1;
+
+  if (NULL == saved_manifest) {
+    return 0;
+  }
+
+  if (-1 != asprintf(&staged, "%s.%ld", saved_manifest_name,
+                     (long)getpid())) {
+    if (JSONSuccess == json_serialize_to_file_pretty(saved_manifest, staged) &&
+        0 == rename(staged, saved_manifest_name)) {
+      rc = 0;
+    } else {
+      unlink(staged);
+    }
+
+    free(staged);
+  }
+
+  json_value_free(saved_manifest);
+  saved_manifest = NULL;
+  return rc;
+}
+
+/**
+ * Save a dependency to clib.json or package.json.
+ */
+static int save_dependency(clib_package_t *pkg, const char *repo) {
+  debug(&debugger, "saving dependency %s at %s", pkg->name, pkg->version);
+  return write_dependency(pkg, repo, "dependencies");
+}
+
+/**
+ * Save a development dependency to clib.json or package.json.
+ */
+static int save_dev_dependency(clib_package_t *pkg, const char *repo) {
+  debug(&debugger, "saving dev dependency %s at %s", pkg->name, pkg->version);
+  return write_dependency(pkg, repo, "development");
+}
+
+/**
+ * Create and install a package from `slug`.
+ */
+
+static void load_root_package(void) {
+  const char *name = NULL;
+  char *json = NULL;
+  unsigned int i = 0;
+
+  if (root_package) {
+    return;
+  }
+
+  do {
+    name = manifest_names[i];
+    json = fs_read(name);
+  } while (NULL != manifest_names[++i] && !json);
+
+  if (json) {
+    root_package = clib_package_new(json, opts.verbose);
+  }
+
+  if (root_package && root_package->prefix) {
+    package_opts.prefix = root_package->prefix;
+    clib_package_set_opts(package_opts);
+  }
+}
+
+static int install_package(const char *slug) {
+  clib_package_t *pkg = NULL;
+  int rc;
+
+#ifdef PATH_MAX
+  long path_max = PATH_MAX;
+#elif defined(_PC_PATH_MAX)
+  long path_max = pathconf(slug, _PC_PATH_MAX);
+#else
+  long path_max = 4096;
+#endif
+
+  load_root_package();
+
+  if ('.' == slug[0]) {
+    if (1 == strlen(slug) || ('/' == slug[1] && 2 == strlen(slug))) {
+      char dir[path_max];
+      realpath(slug, dir);
+      slug = dir;
+      return install_local_packages();
+    }
+  }
+
+  if (opts.link && 0 == fs_exists(slug)) {
+    return link_local_package(slug);
+  }
+
+  if (0 == fs_exists(slug)) {
+    fs_stats *stats = fs_stat(slug);
+    if (NULL != stats && (S_IFREG == (stats->st_mode & S_IFMT)
+#if defined(__unix__) || defined(__linux__) || defined(_POSIX_VERSION)
+                          || S_IFLNK == (stats->st_mode & S_IFMT)
+#endif
+                              )) {
+      free(stats);
+      return install_local_packages_with_package_name(slug);
+    }
+
+    if (stats) {
+      free(stats);
+    }
+  }
+
+  if (!pkg) {
+    pkg = clib_package_new_from_slug(slug, opts.verbose);
+  }
+
+  if (NULL == pkg)
+    return -1;
+
+  rc = clib_package_install(pkg, opts.dir, opts.verbose);
+  if (0 != rc) {
+    goto cleanup;
+  }
+
+  if (0 == rc && opts.dev) {
+    rc = clib_package_install_development(pkg, opts.dir, opts.verbose);
+    if (0 != rc) {
+      goto cleanup;
+    }
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&save_mutex);
+#endif
+  // saved as it was asked for, the package may be shared and isn't changed
+  if (opts.save && !opts.prefetch_only && !opts.plan)
+    save_dependency(pkg, slug);
+  if (opts.savedev && !opts.prefetch_only && !opts.plan)
+    save_dev_dependency(pkg, slug);
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&save_mutex);
+#endif
+
+cleanup:
+  clib_package_free(pkg);
+  return rc;
+}
+
+typedef struct {
+  const char *slug;
+  int rc;
+} install_task_t;
+
+static int install_package_task(void *arg) {
+  install_task_t *task = arg;
+
+  debug(&debugger, "install %s", task->slug);
+  task->rc = install_package(task->slug);
+  return -1 == task->rc;
+}
+
+/**
+ * Install the given `pkgs` on the package pool, and report every one
+ * that failed once all are done.
+ */
+
+static int install_packages(int n, char *pkgs[]) {
+  install_task_t *tasks = calloc(n, sizeof(install_task_t));
+  clib_pool_group_t *group = NULL;
+  int failures = 0;
+
+  if (NULL == tasks) {
+    return 1;
+  }
+
+  // before any thread reads it
+  load_root_package();
+
+  group = clib_pool_group_new(clib_package_pool());
+
+  for (int i = 0; i < n; i++) {
+    tasks[i].slug = pkgs[i];
+    if (!group || 0 != clib_pool_submit(group, install_package_task,
+                                        &tasks[i])) {
+      install_package_task(&tasks[i]);
+    }
+  }
+
+  clib_pool_wait(group);
+  clib_pool_group_free(group);
+
+  for (int i = 0; i < n; i++) {
+    if (-1 == tasks[i].rc) {
+      logger_error("error", "Unable to install package %s", pkgs[i]);
+      (void)failures++;
+    }
+  }
+
+  if (failures > 1) {
+    logger_error("error", "%d of %d packages failed to install", failures, n);
+  }
+
+  free(tasks);
+  return 0 == failures ? 0 : 1;
+}
+
+/**
+ * Writes the totals of the install as JSON to `path`, or to stderr when
+ * it is "-", for CI to keep an eye on cache hits and slow mirrors.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+
+static int write_summary(const char *path, int code, uint64_t started) {
+  clib_package_stats_t package;
+  http_get_memory_t memory;
+  http_get_stats_t http;
+  FILE *file = stderr;
+  int peak = 0;
+  int downloads = clib_package_downloads(&peak);
+  int rc = 0;
+
+  if (0 != strcmp("-", path) && !(file = fopen(path, "w"))) {
+    return -1;
+  }
+
+  clib_package_stats(&package);
+  http_get_stats(&http);
+  http_get_memory(&memory);
+
+  fprintf(file,
+          "{\"rc\":%d,\n"
+          " \"manifests\":{\"cached\":%llu,\"revalidated\":%llu,"
+          "\"stale\":%llu,\"fetched\":%llu,\"locked\":%llu,"
+          "\"failed\":%llu},\n"
+          " \"packages\":{\"cached\":%llu,\"downloaded\":%llu},\n"
+          " \"http\":{\"requests\":%llu,\"retries\":%llu,"
+          "\"wire_bytes\":%llu,\"body_bytes\":%llu},\n"
+          " \"downloads\":{\"concurrency\":%d,\"peak\":%d,"
+          "\"held\":%llu},\n"
+          " \"memory\":{\"budget\":%llu,\"peak\":%llu,\"spilled\":%llu,"
+          "\"spilled_bytes\":%llu},\n"
+          " \"seconds\":{\"wall\":%.3f,\"manifests\":%.3f,\"fetch\":%.3f,"
+          "\"configure\":%.3f,\"build\":%.3f}}\n",
+          code, package.manifests_cached, package.manifests_revalidated,
+          package.manifests_stale, package.manifests_fetched, package.manifests_locked,
+          package.manifests_failed, package.packages_cached,
+          package.packages_downloaded, http.requests, package.retries,
+          http.wire_bytes, http.body_bytes, downloads, peak,
+          package.downloads_held, memory.budget, memory.peak, memory.spilled,
+          memory.spilled_bytes,
+          (clib_trace_clock() - started) / 1e6, package.manifest_us / 1e6,
+          package.fetch_us / 1e6, package.configure_us / 1e6,
+          package.build_us / 1e6);
+
+  if (ferror(file)) {
+    rc = -1;
+  }
+
+  if (stderr != file && 0 != fclose(file)) {
+    rc = -1;
+  }
+
+  return rc;
+}
+
+typedef struct {
+  uint64_t sum;
+  uint64_t count;
+} install_state_t;
+
+/**
+ * Adds the path, size, modification time, inode and mode of the file at
+ * `path`, or that it is missing, to the sum, which doesn't depend on the
+ * order the files come in.
+ */
+
+static void add_file_state(install_state_t *state, const char *path) {
+  uint64_t hash = 14695981039346656037ULL;
+  char record[128] = "missing";
+  struct stat st;
+
+  if (0 == stat(path, &st)) {
+    snprintf(record, sizeof(record), "%lld %lld %llu %o",
+             (long long)st.st_size, (long long)st.st_mtime,
+             (unsigned long long)st.st_ino, (unsigned int)st.st_mode);
+  }
+
+  // FNV-1a, enough to notice a change
+  for (const char *p = path; *p; p++) {
+    hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+  }
+
+  for (const char *p = record; *p; p++) {
+    hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+  }
+
+  state->sum += hash;
+  (void)state->count++;
+}
+
+/**
+ * Adds the files that installing the package in the directory `path` of
+ * the output directory wrote to the sum: its manifest and the sources and
+ * makefile it lists, and not what building it left there.
+ */
+
+static int enter_installed_package(int dirfd, const char *name,
+                                   const char *path, void *data) {
+  install_state_t *state = data;
+  JSON_Value *root = NULL;
+  JSON_Array *sources = NULL;
+  const char *makefile = NULL;
+  char *dir = NULL;
+  int rc = CLIB_WALK_SKIP;
+
+  (void)dirfd;
+
+  if ('.' == name[0]) {
+    return CLIB_WALK_SKIP;
+  }
+
+  if (!(dir = path_join(opts.dir, path))) {
+    return -1;
+  }
+
+  for (unsigned int i = 0; !root && NULL != manifest_names[i]; i++) {
+    char *file = path_join(dir, manifest_names[i]);
+
+    if (file && (root = json_parse_file(file))) {
+      add_file_state(state, file);
+    }
+
+    free(file);
+  }
+
+  sources = json_object_get_array(json_object(root), "src");
+  makefile = json_object_get_string(json_object(root), "makefile");
+
+  for (size_t i = 0; i <= json_array_get_count(sources); i++) {
+    const char *source = i < json_array_get_count(sources)
+                             ? json_array_get_string(sources, i)
+                             : makefile;
+    char *file = NULL;
+
+    if (!source) {
+      continue;
+    }
+
+    // the files of a package are installed by their base names
+    if (strrchr(source, '/')) {
+      source = strrchr(source, '/') + 1;
+    }
+
+    if (!(file = path_join(dir, source))) {
+      rc = -1;
+      break;
+    }
+
+    add_file_state(state, file);
+    free(file);
+  }
+
+  json_value_free(root);
+  free(dir);
+  return rc;
+}
+
+/**
+ * Digests the state of the project: what it depends on, as its manifest
+ * and lockfile have it, the options the install takes, and the files of
+ * every package in the output directory.
+ *
+ * @return The line of the stamp of the state, or NULL on error
+ */
+
+static char *install_state(void) {
+  install_state_t state = {0, 0};
+  clib_walk_t walk = {NULL, enter_installed_package, NULL, &state};
+  char digest[CLIB_HASH_HEX_SIZE];
+  char options[64];
+  const char *env[] = {"PREFIX", "CFLAGS", NULL};
+  char *line = NULL;
+  clib_hash_t hash;
+
+  if (0 != clib_walk(opts.dir, 1, &walk)) {
+    return NULL;
+  }
+
+  clib_hash_init(&hash);
+  clib_hash_update(&hash, CLIB_VERSION, strlen(CLIB_VERSION) + 1);
+
+  for (unsigned int i = 0; NULL != manifest_names[i]; i++) {
+    char *json = fs_read(manifest_names[i]);
+
+    clib_hash_update(&hash, json ? json : "", json ? strlen(json) + 1 : 0);
+    clib_hash_update(&hash, "", 1);
+    free(json);
+  }
+
+  if (!opts.no_lockfile) {
+    char *json = fs_read(CLIB_LOCKFILE_NAME);
+
+    clib_hash_update(&hash, json ? json : "", json ? strlen(json) + 1 : 0);
+    free(json);
+  }
+
+  snprintf(options, sizeof(options), "%d %d %d %d %d", opts.dev, opts.build,
+           opts.no_lockfile, opts.frozen_lockfile, opts.git);
+  clib_hash_update(&hash, options, strlen(options) + 1);
+  clib_hash_update(&hash, opts.prefix ? opts.prefix : "",
+                   opts.prefix ? strlen(opts.prefix) + 1 : 0);
+
+  for (unsigned int i = 0; NULL != env[i]; i++) {
+    char *value = getenv(env[i]);
+
+    clib_hash_update(&hash, value ? value : "", value ? strlen(value) + 1 : 0);
+    clib_hash_update(&hash, "", 1);
+  }
+
+  clib_hash_final(&hash, digest);
+
+  if (-1 == asprintf(&line, "%s %016llx %llu\n", digest,
+                     (unsigned long long)state.sum,
+                     (unsigned long long)state.count)) {
+    return NULL;
+  }
+
+  return line;
+}
+
+/**
+ * @return 1 if the output directory is as the last install of the project
+ * left it and nothing it was installed from changed since, 0 otherwise
+ */
+
+static int is_installed(void) {
+  char *stamp = path_join(opts.dir, CLIB_INSTALL_STAMP);
+  char *stamped = stamp ? fs_read(stamp) : NULL;
+  char *state = stamped ? install_state() : NULL;
+  int rc = state && 0 == strcmp(state, stamped);
+
+  free(state);
+  free(stamped);
+  free(stamp);
+  return rc;
+}
+
+/**
+ * Stamps the output directory with its state after an install of the
+ * project, or forgets the stamp when `installed` is 0, as the install
+ * changed the output directory.
+ */
+
+static void stamp_installed(int installed) {
+  char *stamp = path_join(opts.dir, CLIB_INSTALL_STAMP);
+  char *staged = NULL;
+  char *state = NULL;
+
+  if (!stamp) {
+    return;
+  }
+
+  // readers see the old stamp or the new one
+  if (installed && (state = install_state()) &&
+      -1 != asprintf(&staged, "%s.%ld", stamp, (long)getpid())) {
+    if (-1 == fs_write(staged, state) || 0 != rename(staged, stamp)) {
+      unlink(staged);
+      unlink(stamp);
+    }
+  } else {
+    unlink(stamp);
+  }
+
+  free(staged);
+  free(state);
+  free(stamp);
+}
+
+static void write_count(clib_json_t *json, const char *key,
+                        unsigned long long count) {
+  clib_json_key(json, key);
+  clib_json_uint(json, count);
+}
+
+static void write_flag(clib_json_t *json, const char *key, int flag) {
+  clib_json_key(json, key);
+  clib_json_bool(json, flag);
+}
+
+static void write_plan_json(clib_json_t *json,
+                            const clib_package_plan_t *plan) {
+  clib_json_begin_object(json);
+  clib_json_key(json, "slug");
+  clib_json_string(json, plan->slug);
+  write_flag(json, "cached", plan->cached);
+  write_count(json, "files", plan->files);
+  write_count(json, "requests", plan->requests);
+  write_count(json, "bytes", plan->size);
+  write_flag(json, "exact", plan->exact);
+  write_flag(json, "configure", plan->configure);
+  write_flag(json, "install", plan->install);
+  write_flag(json, "binary", plan->binary);
+  write_flag(json, "build", plan->build);
+  clib_json_end_object(json);
+}
+
+/**
+ * Prints what the install with `--plan` would have done to stdout, as
+ * JSON when `format` is "json" and as a line per package otherwise.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+
+static int write_plan(const char *format, int code) {
+  const clib_package_plan_t *plans = NULL;
+  size_t count = clib_package_plan(&plans);
+  clib_package_stats_t package;
+  unsigned long long requests = 0;
+  unsigned long long size = 0;
+  int json = 0 == strcmp("json", format);
+  clib_json_t writer;
+  int cached = 0;
+  int estimated = 0;
+
+  clib_package_stats(&package);
+
+  if (json) {
+    clib_json_init(&writer, stdout, 1);
+    clib_json_begin_object(&writer);
+    clib_json_key(&writer, "rc");
+    clib_json_int(&writer, code);
+    clib_json_key(&writer, "packages");
+    clib_json_begin_array(&writer);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const clib_package_plan_t *plan = &plans[i];
+
+    requests += plan->requests;
+    size += plan->size;
+    cached += plan->cached;
+    estimated += !plan->exact;
+
+    if (json) {
+      write_plan_json(&writer, plan);
+      continue;
+    }
+
+    printf("%-8s %s, %u files, %u requests, ", plan->cached ? "cache" : "fetch",
+           plan->slug, plan->files, plan->requests);
+
+    // no version of a package that was never cached has a size
+    if (plan->exact || plan->size) {
+      printf("%s%llu bytes", plan->exact ? "" : "~", plan->size);
+    } else {
+      printf("size unknown");
+    }
+
+    printf("%s%s%s\n", plan->configure ? ", configure" : "",
+           plan->binary    ? ", install binary"
+           : plan->install ? ", install"
+                           : "",
+           plan->build ? ", build" : "");
+  }
+
+  if (json) {
+    clib_json_end_array(&writer);
+    clib_json_key(&writer, "total");
+    clib_json_begin_object(&writer);
+    write_count(&writer, "packages", count);
+    write_count(&writer, "cached", cached);
+    write_count(&writer, "requests", requests);
+    write_count(&writer, "bytes", size);
+    write_count(&writer, "estimated", estimated);
+    clib_json_end_object(&writer);
+    clib_json_key(&writer, "manifests");
+    clib_json_begin_object(&writer);
+    write_count(&writer, "cached", package.manifests_cached);
+    write_count(&writer, "revalidated", package.manifests_revalidated);
+    write_count(&writer, "stale", package.manifests_stale);
+    write_count(&writer, "fetched", package.manifests_fetched);
+    write_count(&writer, "locked", package.manifests_locked);
+    write_count(&writer, "failed", package.manifests_failed);
+    clib_json_end_object(&writer);
+    clib_json_end_object(&writer);
+    return clib_json_finish(&writer);
+  }
+
+  printf("%zu packages, %d cached, %llu requests, %s%llu bytes\n", count,
+         cached, requests, estimated ? "~" : "", size);
+  printf("%llu manifests fetched, %llu from the cache, %llu locked\n",
+         package.manifests_fetched,
+         package.manifests_cached + package.manifests_revalidated +
+             package.manifests_stale,
+         package.manifests_locked);
+
+  fflush(stdout);
+  return ferror(stdout) ? -1 : 0;
+}
+
+/**
+ * Entry point.
+ */
+
+int main(int argc, char *argv[]) {
+#ifdef _WIN32
+  opts.dir = ".\\deps";
+#else
+  opts.dir = "./deps";
+#endif
+  opts.verbose = 1;
+  opts.dev = 0;
+
+#ifdef PATH_MAX
+  long path_max = PATH_MAX;
+#elif defined(_PC_PATH_MAX)
+  long path_max = pathconf(opts.dir, _PC_PATH_MAX);
+#else
+  long path_max = 4096;
+#endif
+
+  debug_init(&debugger, "clib-install");
 
   // 30 days expiration
   clib_cache_init(CLIB_PACKAGE_CACHE_TIME);
@@ -407,6 +1539,75 @@ int main(int argc, char *argv[]) {
                  setopt_global);
   command_option(&program, "-t", "--token <token>",
                  "Access token used to read private content", setopt_token);
+  command_option(&program, "-r", "--retries <number>",
+                 "Retry failed requests (default: 3)", setopt_retries);
+  command_option(&program, "-T", "--connect-timeout <seconds>",
+                 "Give up connecting after this long, 0 never (default: " S(
+                     CLIB_PACKAGE_CONNECT_TIMEOUT) ")",
+                 setopt_connect_timeout);
+  command_option(&program, "-M", "--max-time <seconds>",
+                 "Give up on any request after this long (default: never)",
+                 setopt_max_time);
+  command_option(&program, "-W", "--stall-timeout <seconds>",
+                 "Retry transfers stalled for this long, 0 never (default: " S(
+                     CLIB_PACKAGE_LOW_SPEED_TIME) ")",
+                 setopt_stall_timeout);
+  command_option(&program, "-x", "--downloads <n|min-max>",
+                 "Downloads in flight, adapted to the network in between "
+                 "(default: " S(CLIB_PACKAGE_MIN_DOWNLOADS) "-" S(
+                     CLIB_PACKAGE_MAX_DOWNLOADS) ")",
+                 setopt_downloads);
+  command_option(&program, "-B", "--memory <megabytes>",
+                 "Keep response bodies in memory up to this much, spilling "
+                 "to disk beyond it, 0 no limit (default: " S(
+                     CLIB_PACKAGE_MEMORY_BUDGET) ")",
+                 setopt_memory);
+  command_option(&program, "-i", "--progress",
+                 "report the progress of downloads every second instead of "
+                 "a line per file",
+                 setopt_progress);
+  command_option(&program, "-Z", "--no-compression",
+                 "don't request compressed HTTP responses",
+                 setopt_no_compression);
+  command_option(&program, "-3", "--http3",
+                 "move to HTTP/3 when the registry offers it, and back to "
+                 "TCP when it fails",
+                 setopt_http3);
+  command_option(&program, "-G", "--git",
+                 "fetch sources and executables with git into a repository "
+                 "cache shared by their versions",
+                 setopt_git);
+  command_option(&program, "-L", "--no-lockfile",
+                 "neither read nor write " CLIB_LOCKFILE_NAME,
+                 setopt_no_lockfile);
+  command_option(&program, "-l", "--frozen-lockfile",
+                 "only install what " CLIB_LOCKFILE_NAME
+                 " pins and leave it unchanged",
+                 setopt_frozen_lockfile);
+  command_option(&program, "-p", "--prefetch-only",
+                 "fill the package cache without writing the output dir",
+                 setopt_prefetch_only);
+  command_option(&program, "-b", "--build",
+                 "build each package once it and its dependencies are in",
+                 setopt_build);
+  command_option(&program, "-w", "--workspace",
+                 "install for every clib.json below, shared packages once",
+                 setopt_workspace);
+  command_option(&program, "-k", "--link",
+                 "link local packages given by path into the output dir "
+                 "instead of copying them",
+                 setopt_link);
+  command_option(&program, "-R", "--trace <file>",
+                 "write a Chrome trace of where the time goes to <file>",
+                 setopt_trace);
+  command_option(&program, "-m", "--summary [file]",
+                 "write totals of the install as JSON to [file] or stderr",
+                 setopt_summary);
+  command_option(&program, "-n", "--plan",
+                 "print what would be fetched and built, installing nothing",
+                 setopt_plan);
+  command_option(&program, "-N", "--plan-json",
+                 "print the plan of --plan as JSON", setopt_plan_json);
 #ifdef HAVE_PTHREADS
   command_option(&program, "-C", "--concurrency <number>",
                  "Set concurrency (default: " S(MAX_THREADS) ")",
@@ -416,8 +1617,16 @@ int main(int argc, char *argv[]) {
 
   debug(&debugger, "%d arguments", program.argc);
 
-  if (0 != curl_global_init(CURL_GLOBAL_ALL)) {
-    logger_error("error", "Failed to initialize cURL");
+  if (opts.workspace && program.argc > 0) {
+    logger_error("error", "A workspace installs what its components need, "
+                          "without packages to install");
+    command_free(&program);
+    return 1;
+  }
+
+  // the plan is the output, nothing is installed
+  if (opts.plan) {
+    opts.verbose = 0;
   }
 
   if (opts.prefix) {
@@ -430,13 +1639,67 @@ int main(int argc, char *argv[]) {
     memcpy((void *)opts.prefix, prefix, size);
   }
 
+  // reinstalling the project is left out when nothing changed since, as
+  // build scripts run it before every build
+  int stamped = 0 == program.argc && !opts.workspace && !opts.global &&
+                !opts.prefetch_only && !opts.plan && !opts.force &&
+                !opts.skip_cache && !opts.trace && !opts.summary;
+
+  if (stamped && is_installed()) {
+    if (opts.verbose) {
+      logger_info("install", "%s: up to date", opts.dir);
+    }
+    command_free(&program);
+    return 0;
+  }
+
+  if (0 != curl_global_init(CURL_GLOBAL_ALL)) {
+    logger_error("error", "Failed to initialize cURL");
+  }
+
+  clib_ratelimit_init();
+  clib_dns_prefetch();
+
+  if (opts.trace && 0 != clib_trace_open(opts.trace)) {
+    logger_warn("warning", "Unable to write a trace to %s", opts.trace);
+  }
+
+  uint64_t started = clib_trace_clock();
+
   clib_cache_init(CLIB_PACKAGE_CACHE_TIME);
 
+  // packages are fetched into a scratch dir that only feeds the cache
+  char prefetch_dir[] = "/tmp/clib-prefetch-XXXXXX";
+  if (opts.prefetch_only) {
+    if (NULL == mkdtemp(prefetch_dir)) {
+      logger_error("error", "Unable to create a prefetch directory");
+      curl_global_cleanup();
+      command_free(&program);
+      return 1;
+    }
+
+    opts.dir = prefetch_dir;
+    opts.global = 0;
+  }
+
   package_opts.skip_cache = opts.skip_cache;
   package_opts.prefix = opts.prefix;
   package_opts.global = opts.global;
   package_opts.force = opts.force;
   package_opts.token = opts.token;
+  package_opts.retries = opts.retries;
+  package_opts.connect_timeout = opts.connect_timeout;
+  package_opts.timeout = opts.timeout;
+  package_opts.low_speed_time = opts.low_speed_time;
+  package_opts.min_downloads = opts.min_downloads;
+  package_opts.max_downloads = opts.max_downloads;
+  package_opts.memory_budget = opts.memory_budget;
+  package_opts.progress = opts.progress;
+  package_opts.prefetch_only = opts.prefetch_only;
+  package_opts.build = opts.build;
+  package_opts.git = opts.git;
+  package_opts.http3 = opts.http3;
+  package_opts.plan = NULL != opts.plan;
 
 #ifdef HAVE_PTHREADS
   package_opts.concurrency = opts.concurrency;
@@ -444,10 +1707,105 @@ int main(int argc, char *argv[]) {
 
   clib_package_set_opts(package_opts);
 
-  int code = 0 == program.argc ? install_local_packages()
-                               : install_packages(program.argc, program.argv);
+  // like clib-build, every package finds the headers of its dependencies
+  // in the output directory, wherever make runs
+  if (opts.build && !opts.global && !opts.prefetch_only && !opts.plan) {
+    char dir[path_max];
+    char *flags = NULL;
+#ifdef _GNU_SOURCE
+    char *cflags = secure_getenv("CFLAGS");
+#else
+    char *cflags = getenv("CFLAGS");
+#endif
+
+    memset(dir, 0, path_max);
+    clib_mkdirp(opts.dir, 0777);
+    realpath(opts.dir, dir);
+
+    if (cflags) {
+      asprintf(&flags, "%s -I %s", cflags, dir);
+    } else {
+      asprintf(&flags, "-I %s", dir);
+    }
+
+    if (flags) {
+      setenv("CFLAGS", flags, 1);
+      free(flags);
+    }
+  }
+
+  if (opts.no_compression) {
+    http_get_set_compression(0);
+  }
+
+  // global installs aren't tied to the project in the working directory
+  clib_lockfile_t *lockfile = NULL;
+  if (!opts.no_lockfile && !opts.global) {
+    lockfile = clib_lockfile_load(CLIB_LOCKFILE_NAME);
+
+    if (!lockfile && opts.frozen_lockfile) {
+      logger_error("error", "Missing or invalid %s", CLIB_LOCKFILE_NAME);
+      curl_global_cleanup();
+      command_free(&program);
+      return 1;
+    }
+
+    if (!lockfile) {
+      lockfile = clib_lockfile_new();
+    }
+
+    clib_package_set_lockfile(lockfile, opts.frozen_lockfile);
+  }
+
+  // whatever is installed now, the stamp is out of date
+  if (!opts.prefetch_only && !opts.plan) {
+    stamp_installed(0);
+  }
+
+  clib_profile_phase("install");
+  int code = opts.workspace      ? install_workspace()
+             : 0 == program.argc ? install_local_packages()
+                                 : install_packages(program.argc, program.argv);
+
+  clib_profile_phase("cleanup");
+  if (opts.prefetch_only) {
+    clib_walk_remove(prefetch_dir, opts.concurrency);
+  }
+
+  if (0 != write_saved_manifest()) {
+    logger_warn("warning", "unable to write %s", saved_manifest_name);
+  }
+
+  // a prefetch or plan leaves the project as it is
+  if (0 == code && lockfile && !opts.frozen_lockfile &&
+      !opts.prefetch_only && !opts.plan &&
+      0 != clib_lockfile_save(lockfile, CLIB_LOCKFILE_NAME)) {
+    logger_warn("warning", "unable to write %s", CLIB_LOCKFILE_NAME);
+  }
+
+  if (0 == code && stamped) {
+    stamp_installed(1);
+  }
+
+  http_get_stats_t stats;
+  http_get_stats(&stats);
+  debug(&debugger, "%llu requests, %llu bytes received, %llu bytes decoded",
+        stats.requests, stats.wire_bytes, stats.body_bytes);
+
+  clib_trace_span("command", "install", NULL, started, "\"rc\":%d", code);
+  clib_trace_close();
+
+  if (opts.plan && 0 != write_plan(opts.plan, code)) {
+    code = 1;
+  }
+
+  if (opts.summary && 0 != write_summary(opts.summary, code, started)) {
+    logger_warn("warning", "Unable to write a summary to %s", opts.summary);
+  }
 
   curl_global_cleanup();
+  clib_package_set_lockfile(NULL, 0);
+  clib_lockfile_free(lockfile);
   clib_package_cleanup();
 
   command_free(&program);
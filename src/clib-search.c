@@ -9,24 +9,49 @@
 #include "case/case.h"
 #include "commander/commander.h"
 #include "common/clib-cache.h"
-#include "common/clib-package.h"
-#include "console-colors/console-colors.h"
+#include "common/clib-json.h"
+#include "common/clib-profile.h"
+#include "common/clib-registry.h"
+#include "common/clib-search-index.h"
+#include "common/clib-snapshot.h"
 #include "debug/debug.h"
 #include "fs/fs.h"
 #include "http-get/http-get.h"
 #include "logger/logger.h"
 #include "parson/parson.h"
+#include "strbuf/strbuf.h"
 #include "strdup/strdup.h"
 #include "tempdir/tempdir.h"
 #include "version.h"
 #include "wiki-registry/wiki-registry.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+#else
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #define CLIB_WIKI_URL "https://github.com/clibs/clib/wiki/Packages"
 #define CLIB_SEARCH_CACHE_TIME 1 * 24 * 60 * 60
+#define CLIB_SEARCH_RANK_LIMIT 20
+
+// the results are rendered and written in chunks of about this size
+#define CLIB_SEARCH_RENDER_CHUNK 64 * 1024
+
+// escape sequences for the dark cyan and dark gray of the results
+#define COLOR_HIGHLIGHT "\x1B[36m"
+#define COLOR_TEXT "\x1B[90m"
+#define COLOR_RESET "\x1B[39m"
 
 #if defined(_WIN32) || defined(WIN32) || defined(__MINGW32__) ||               \
     defined(__MINGW64__)
@@ -39,6 +64,9 @@ debug_t debugger;
 static int opt_color;
 static int opt_cache;
 static int opt_json;
+static int opt_rank;
+static int opt_limit;
+static char *opt_category;
 
 static void setopt_nocolor(command_t *self) { opt_color = 0; }
 
@@ -46,110 +74,301 @@ static void setopt_nocache(command_t *self) { opt_cache = 0; }
 
 static void setopt_json(command_t *self) { opt_json = 1; }
 
-#define COMPARE(v)                                                             \
-  {                                                                            \
-    if (NULL == v) {                                                           \
-      rc = 0;                                                                  \
-      goto cleanup;                                                            \
-    }                                                                          \
-    case_lower(v);                                                             \
-    for (int i = 0; i < count; i++) {                                          \
-      if (strstr(v, args[i])) {                                                \
-        rc = 1;                                                                \
-        break;                                                                 \
-      }                                                                        \
-    }                                                                          \
-  }
-
-static int matches(int count, char *args[], wiki_package_t *pkg) {
-  // Display all packages if there's no query
-  if (0 == count)
-    return 1;
+static void setopt_rank(command_t *self) { opt_rank = 1; }
 
-  char *description = NULL;
-  char *name = NULL;
-  char *repo = NULL;
-  char *href = NULL;
-  int rc = 0;
+static void setopt_category(command_t *self) {
+  if (self->arg) {
+    opt_category = (char *)self->arg;
+    debug(&debugger, "set category: %s", opt_category);
+  }
+}
+
+static void setopt_limit(command_t *self) {
+  if (self->arg) {
+    opt_limit = atoi(self->arg);
+    debug(&debugger, "set limit: %d", opt_limit);
+  }
+}
+
+/**
+ * Whether stdout takes colors, asked once a run: a terminal, unless
+ * `NO_COLOR` is set, and on Windows one that understands escape sequences.
+ */
 
-  name = clib_package_parse_name(pkg->repo);
-  COMPARE(name);
+static int stdout_has_colors(void) {
+  const char *no_color = getenv("NO_COLOR");
 
-  description = strdup(pkg->description);
-  COMPARE(description);
+  if (no_color && *no_color) {
+    return 0;
+  }
+
+#ifdef _WIN32
+  HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+  DWORD mode = 0;
 
-  repo = strdup(pkg->repo);
-  COMPARE(repo);
+  return INVALID_HANDLE_VALUE != console && GetConsoleMode(console, &mode) &&
+         SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#else
+  return isatty(STDOUT_FILENO);
+#endif
+}
 
-  href = strdup(pkg->href);
-  COMPARE(href);
+/**
+ * Writes what was rendered into `out` to stdout once there is at least
+ * `threshold` bytes of it.
+ *
+ * @return 0 on success, -1 if it couldn't be written
+ */
 
-cleanup:
-  free(description);
-  free(name);
-  free(repo);
-  free(href);
+static int flush_render(strbuf_t *out, size_t threshold) {
+  int rc = 0;
+
+  if (out->len < threshold || 0 == out->len) {
+    return 0;
+  }
+
+  if (out->len != fwrite(out->data, 1, out->len, stdout)) {
+    rc = -1;
+  }
+
+  strbuf_truncate(out, 0);
   return rc;
 }
 
-static char *wiki_html_cache() {
+static void render_colored(strbuf_t *out, const char *color,
+                           const char *text) {
+  if (color) {
+    strbuf_append(out, color);
+  }
 
-  if (clib_cache_has_search() && opt_cache) {
-    char *data = clib_cache_read_search();
+  strbuf_append(out, text ? text : "");
 
-    if (data) {
-      return data;
+  if (color) {
+    strbuf_append(out, COLOR_RESET);
+  }
+}
+
+/**
+ * Renders `pkg` into `out`, in colors unless `color` is 0.
+ */
+
+static void render_package(strbuf_t *out, const wiki_package_t *pkg,
+                           int color) {
+  strbuf_append(out, "  ");
+  render_colored(out, color ? COLOR_HIGHLIGHT : NULL, pkg->repo);
+  strbuf_append(out, "\n  url: ");
+  render_colored(out, color ? COLOR_TEXT : NULL, pkg->href);
+  strbuf_append(out, "\n  desc: ");
+  render_colored(out, color ? COLOR_TEXT : NULL, pkg->description);
+  strbuf_append(out, "\n\n");
+}
+
+static void write_package_json(const wiki_package_t *pkg, clib_json_t *json) {
+  clib_json_begin_object(json);
+  clib_json_key(json, "repo");
+  clib_json_string(json, pkg->repo);
+  clib_json_key(json, "href");
+  clib_json_string(json, pkg->href);
+  clib_json_key(json, "description");
+  clib_json_string(json, pkg->description);
+  clib_json_key(json, "category");
+  clib_json_string(json, pkg->category);
+  clib_json_end_object(json);
+}
+
+/**
+ * Reads the search cache, once it expired too when `expired` is set, as
+ * long as it may still be used while it is refreshed.
+ */
+
+static clib_search_index_t *read_search_cache(int expired) {
+  clib_search_index_t *index = NULL;
+  fs_mapping packages;
+  fs_mapping trigrams;
+
+  // both are mapped rather than copied, the index keeps the trigrams
+  if (0 == (expired ? clib_cache_map_expired_search(&packages)
+                    : clib_cache_map_search(&packages))) {
+    if (expired) {
+      clib_cache_map_expired_search_index(&trigrams);
+    } else {
+      clib_cache_map_search_index(&trigrams);
     }
+    index = clib_search_index_parse(packages.data, trigrams);
+    fs_unmap(&packages);
+  }
 
-    goto set_cache;
+  return index;
+}
+
+/**
+ * Fetches the packages from the JSON registry when there is one, which
+ * may tell the cache is still up to date, and scrapes the wiki otherwise.
+ */
+
+static list_t *fetch_packages(char **etag, int *unchanged) {
+  char *cached_etag = opt_cache ? clib_cache_read_search_etag() : NULL;
+  list_t *pkgs = NULL;
+  int rc = -1;
+
+  *etag = NULL;
+  *unchanged = 0;
+
+  if (clib_registry_url()) {
+    debug(&debugger, "fetching registry %s", clib_registry_url());
+    rc = clib_registry_fetch(cached_etag, &pkgs, etag);
+    *unchanged = 1 == rc;
   }
 
-set_cache:
+  free(cached_etag);
+
+  if (-1 != rc) {
+    return pkgs;
+  }
 
   debug(&debugger, "setting cache from %s", CLIB_WIKI_URL);
   http_get_response_t *res = http_get(CLIB_WIKI_URL);
-  if (!res->ok)
-    return NULL;
+  if (res->ok) {
+    pkgs = wiki_registry_parse(res->data);
+  }
 
-  char *html = strdup(res->data);
-  if (NULL == html)
-    return NULL;
   http_get_free(res);
+  return pkgs;
+}
+
+static clib_search_index_t *update_search_cache() {
+  clib_search_index_t *index = NULL;
+  list_node_t *node = NULL;
+  list_t *pkgs = NULL;
+  char *packages = NULL;
+  char *trigrams = NULL;
+  char *etag = NULL;
+  int unchanged = 0;
+
+  pkgs = fetch_packages(&etag, &unchanged);
+
+  if (unchanged) {
+    debug(&debugger, "registry unchanged, renewing cache");
+    if (0 == clib_cache_renew_search() && (index = read_search_cache(0))) {
+      return index;
+    }
+
+    // the cache is gone after all, so fetch all of it
+    clib_cache_save_search_etag(NULL);
+    pkgs = fetch_packages(&etag, &unchanged);
+  }
+
+  if (NULL == pkgs) {
+    free(etag);
+    return NULL;
+  }
 
-  if (NULL == html)
-    return html;
-  clib_cache_save_search(html);
-  debug(&debugger, "wrote cach");
-  return html;
+  // so the next searches don't parse the registry again
+  if (0 == clib_search_index_build(pkgs, &packages, &trigrams)) {
+    clib_cache_save_search_index(trigrams);
+    clib_cache_save_search(packages);
+    clib_cache_save_search_etag(etag);
+    debug(&debugger, "wrote cache");
+    index = clib_search_index_parse(
+        packages, (fs_mapping){trigrams, strlen(trigrams), 0});
+    json_free_serialized_string(packages);
+  }
+
+  list_each(pkgs, node) {
+    wiki_package_free(node->val);
+  }
+  list_destroy(pkgs);
+  free(etag);
+
+  return index;
 }
 
-static void display_package(const wiki_package_t *pkg,
-                            cc_color_t fg_color_highlight,
-                            cc_color_t fg_color_text) {
-  cc_fprintf(fg_color_highlight, stdout, "  %s\n", pkg->repo);
-  printf("  url: ");
-  cc_fprintf(fg_color_text, stdout, "%s\n", pkg->href);
-  printf("  desc: ");
-  cc_fprintf(fg_color_text, stdout, "%s\n", pkg->description);
-  printf("\n");
+#ifndef _WIN32
+/**
+ * Updates the search cache in a process of its own, which may outlive
+ * this one, unless another process is updating it already.
+ */
+
+static void refresh_search_cache(void) {
+  int lock = clib_cache_begin_refresh_search();
+  pid_t pid = 0;
+  int null = -1;
+
+  if (-1 == lock) {
+    debug(&debugger, "cache refreshed by another process");
+    return;
+  }
+
+  fflush(NULL);
+
+  if (-1 == (pid = fork())) {
+    clib_cache_end_refresh(lock);
+    return;
+  }
+
+  if (0 != pid) {
+    // the lock is the refreshing process' now
+    clib_cache_end_refresh(lock);
+
+    while (-1 == waitpid(pid, NULL, 0)) {
+      if (EINTR != errno) {
+        break;
+      }
+    }
+
+    return;
+  }
+
+  if (0 != fork()) {
+    _exit(0);
+  }
+
+  // nor does it hold on to the terminal or pipes of the command
+  setsid();
+
+  if (-1 != (null = open("/dev/null", O_RDWR))) {
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+  }
+
+  clib_search_index_free(update_search_cache());
+  _exit(0);
 }
+#endif
 
-static void add_package_to_json(const wiki_package_t *pkg,
-                                JSON_Array *json_list) {
-  JSON_Value *json_pkg_root = json_value_init_object();
-  JSON_Object *json_pkg = json_value_get_object(json_pkg_root);
+static clib_search_index_t *wiki_registry_cache() {
+  clib_search_index_t *index = NULL;
 
-  json_object_set_string(json_pkg, "repo", pkg->repo);
-  json_object_set_string(json_pkg, "href", pkg->href);
-  json_object_set_string(json_pkg, "description", pkg->description);
-  json_object_set_string(json_pkg, "category", pkg->category);
+  if (opt_cache && (index = read_search_cache(0))) {
+    return index;
+  }
 
-  json_array_append_value(json_list, json_pkg_root);
+#ifndef _WIN32
+  // rather than waiting for the registry, an expired cache is searched,
+  // and the next searches find it up to date
+  if (opt_cache && (index = read_search_cache(1))) {
+    debug(&debugger, "cache expired, refreshing it in the background");
+    refresh_search_cache();
+    return index;
+  }
+
+  // nor is a first search kept waiting, it finds the registry clib was
+  // built with while the cache is made
+  if (opt_cache && (index = clib_snapshot_search_index())) {
+    debug(&debugger, "no cache yet, searching the snapshot");
+    refresh_search_cache();
+    return index;
+  }
+#endif
+
+  return update_search_cache();
 }
 
 int main(int argc, char *argv[]) {
   opt_color = 1;
   opt_cache = 1;
+  opt_limit = -1;
 
   debug_init(&debugger, "clib-search");
 
@@ -168,65 +387,100 @@ int main(int argc, char *argv[]) {
   command_option(&program, "-j", "--json", "generate a serialized JSON output",
                  setopt_json);
 
+  command_option(&program, "-r", "--rank",
+                 "rank packages by how well they match, the best first",
+                 setopt_rank);
+
+  command_option(&program, "-l", "--limit <count>",
+                 "show at most that many packages, 20 when ranking",
+                 setopt_limit);
+
+  command_option(&program, "-g", "--category <name>",
+                 "only search the categories with <name> in theirs",
+                 setopt_category);
+
   command_parse(&program, argc, argv);
 
   for (int i = 0; i < program.argc; i++)
     case_lower(program.argv[i]);
 
-  // set color theme
-  cc_color_t fg_color_highlight = opt_color ? CC_FG_DARK_CYAN : CC_FG_NONE;
-  cc_color_t fg_color_text = opt_color ? CC_FG_DARK_GRAY : CC_FG_NONE;
+  if (opt_category) {
+    case_lower(opt_category);
+  }
+
+  int color = opt_color && !opt_json && stdout_has_colors();
 
-  char *html = wiki_html_cache();
-  if (NULL == html) {
+  clib_profile_phase("registry");
+  clib_search_index_t *index = wiki_registry_cache();
+  if (NULL == index) {
     command_free(&program);
     logger_error("error", "failed to fetch wiki HTML");
     return 1;
   }
 
-  list_t *pkgs = wiki_registry_parse(html);
-  free(html);
+  int found = 0;
+  int *results = NULL;
 
-  debug(&debugger, "found %zu packages", pkgs->len);
+  clib_profile_phase("search");
+  if (opt_category) {
+    int size = clib_search_index_filter_category(index, opt_category);
+    debug(&debugger, "%d packages in categories with %s", size,
+          opt_category);
+  }
 
-  list_node_t *node;
-  list_iterator_t *it = list_iterator_new(pkgs, LIST_HEAD);
+  if (opt_rank) {
+    int limit = opt_limit < 0 ? CLIB_SEARCH_RANK_LIMIT : opt_limit;
+    results = clib_search_index_rank(index, program.argc, program.argv, limit,
+                                     &found);
+  } else {
+    results =
+        clib_search_index_query(index, program.argc, program.argv, &found);
 
-  JSON_Array *json_list = NULL;
-  JSON_Value *json_list_root = NULL;
+    if (opt_limit > 0 && found > opt_limit) {
+      found = opt_limit;
+    }
+  }
 
+  debug(&debugger, "found %d of %d packages", found,
+        clib_search_index_size(index));
+
+  strbuf_t rendered = STRBUF_INIT;
+  clib_json_t json;
+
+  clib_profile_phase("output");
+  printf("\n");
+
+  // written as the packages are found, nothing is kept to serialize
   if (opt_json) {
-    json_list_root = json_value_init_array();
-    json_list = json_value_get_array(json_list_root);
+    clib_json_init(&json, stdout, 1);
+    clib_json_begin_array(&json);
   }
 
-  printf("\n");
+  for (int i = 0; results && i < found; i++) {
+    wiki_package_t pkg;
 
-  while ((node = list_iterator_next(it))) {
-    wiki_package_t *pkg = (wiki_package_t *)node->val;
-    if (matches(program.argc, program.argv, pkg)) {
-      if (opt_json) {
-        add_package_to_json(pkg, json_list);
-      } else {
-        display_package(pkg, fg_color_highlight, fg_color_text);
-      }
-    } else {
-      debug(&debugger, "skipped package %s", pkg->repo);
+    if (0 != clib_search_index_package(index, results[i], &pkg)) {
+      continue;
     }
 
-    wiki_package_free(pkg);
+    if (opt_json) {
+      write_package_json(&pkg, &json);
+    } else {
+      render_package(&rendered, &pkg, color);
+      flush_render(&rendered, CLIB_SEARCH_RENDER_CHUNK);
+    }
   }
 
-  if (opt_json) {
-    char *serialized = json_serialize_to_string_pretty(json_list_root);
-    puts(serialized);
+  flush_render(&rendered, 0);
+  strbuf_free(&rendered);
 
-    json_free_serialized_string(serialized);
-    json_value_free(json_list_root);
+  if (opt_json) {
+    clib_json_end_array(&json);
+    clib_json_finish(&json);
   }
 
-  list_iterator_destroy(it);
-  list_destroy(pkgs);
+  free(results);
+  clib_search_index_free(index);
   command_free(&program);
   return 0;
 }
@@ -9,18 +9,33 @@
 
 #include "asprintf/asprintf.h"
 #include "commander/commander.h"
+#include "common/clib-archive.h"
+#include "common/clib-cache.h"
+#include "common/clib-pool.h"
+#include "common/clib-spawn.h"
 #include "debug/debug.h"
 #include "fs/fs.h"
 #include "http-get/http-get.h"
 #include "logger/logger.h"
 #include "parse-repo/parse-repo.h"
 #include "parson/parson.h"
+#include "strdup/strdup.h"
+#include "substr/substr.h"
 #include "version.h"
 #include <stdlib.h>
 #include <string.h>
 
 #define CLIB_UNINSTALL_DEFAULT_TARGET "make uninstall"
 
+#define CLIB_PACKAGE_CACHE_TIME 30 * 24 * 60 * 60
+
+#define SX(s) #s
+#define S(s) SX(s)
+
+#ifdef HAVE_PTHREADS
+#define MAX_THREADS 12
+#endif
+
 #if defined(_WIN32) || defined(WIN32) || defined(__MINGW32__) ||               \
     defined(__MINGW64__)
 #define setenv(k, v, _) _putenv_s(k, v)
@@ -30,11 +45,22 @@ const char *manifest_names[] = {"clib.json", "package.json", NULL};
 
 debug_t debugger;
 
+static int concurrency = 0;
+
 static void setopt_prefix(command_t *self) {
   setenv("PREFIX", (char *)self->arg, 1);
   debug(&debugger, "set prefix: %s", (char *)self->arg);
 }
 
+#ifdef HAVE_PTHREADS
+static void setopt_concurrency(command_t *self) {
+  if (self->arg) {
+    concurrency = atoi(self->arg);
+    debug(&debugger, "set concurrency: %d", concurrency);
+  }
+}
+#endif
+
 static char *get_tarball_url(const char *owner, const char *name,
                              const char *version) {
   char *tarball = NULL;
@@ -64,13 +90,23 @@ static char *get_tmp_tarball(const char *file) {
   return tmp;
 }
 
-static char *get_untar_command(const char *file) {
-  char *cmd = NULL;
-  int size = 0;
-  size = asprintf(&cmd, "cd /tmp && tar -xf %s", file);
-  if (-1 == size)
-    return NULL;
-  return cmd;
+/**
+ * Materialize the tree cached by the install of the package where
+ * `get_uninstall_target()` expects the extracted tarball
+ */
+
+static int load_cached_tree(const char *owner, const char *name,
+                            const char *version) {
+  char *dir = NULL;
+  int rc = -1;
+
+  if (-1 == asprintf(&dir, "/tmp/%s-%s", name, version))
+    return -1;
+
+  rc = clib_cache_load_executable((char *)owner, (char *)name, (char *)version,
+                                  dir);
+  free(dir);
+  return rc;
 }
 
 static char *get_manifest_path(const char *dir) {
@@ -93,19 +129,13 @@ static char *get_manifest_path(const char *dir) {
   return NULL;
 }
 
-static char *get_uninstall_target(const char *name, const char *version) {
-  int size = 0;
+static char *get_uninstall_target(const char *dir) {
   char *target = NULL;
-  char *dir = NULL;
   char *manifest = NULL;
   const char *val = NULL;
   JSON_Value *root = NULL;
   JSON_Object *obj = NULL;
 
-  size = asprintf(&dir, "/tmp/%s-%s", name, version);
-  if (-1 == size)
-    return NULL;
-
   manifest = get_manifest_path(dir);
 
   if (NULL == manifest)
@@ -128,14 +158,11 @@ static char *get_uninstall_target(const char *name, const char *version) {
     val = CLIB_UNINSTALL_DEFAULT_TARGET;
   }
 
-  size = asprintf(&target, "cd %s && %s", dir, val);
-  if (-1 == size)
-    return NULL;
+  target = strdup(val);
 
 done:
   if (root)
     json_value_free(root);
-  free(dir);
   free(manifest);
   return target;
 }
@@ -145,14 +172,20 @@ static int clib_uninstall(const char *owner, const char *name,
   char *tarball = NULL;
   char *file = NULL;
   char *tarpath = NULL;
-  char *cmd = NULL;
+  char *dir = NULL;
   char *target = NULL;
+  clib_spawn_opts_t spawn = {0};
   int rc = -1;
 
   // sanity
   if (!owner || !name || !version)
     return -1;
 
+  if (0 == load_cached_tree(owner, name, version)) {
+    logger_info("cache", "%s/%s@%s", owner, name, version);
+    goto uninstall;
+  }
+
   if (!(tarball = get_tarball_url(owner, name, version)))
     goto done;
   if (!(file = get_tar_filepath(name, version)))
@@ -161,36 +194,74 @@ static int clib_uninstall(const char *owner, const char *name,
     goto done;
 
   logger_info("fetch", tarball);
-  if (-1 == http_get_file(tarball, tarpath)) {
+  if (-1 == http_get_file_resume_shared(tarball, tarpath, NULL)) {
     logger_error("error", "failed to fetch tarball");
     goto done;
   }
 
-  if (!(cmd = get_untar_command(file)))
-    goto done;
-
   logger_info("untar", tarpath);
-  if (0 != system(cmd)) {
+  if (0 != clib_archive_extract(tarpath, "/tmp")) {
     logger_error("error", "failed to untar");
     goto done;
   }
 
-  target = get_uninstall_target(name, version);
+uninstall:
+  if (-1 == asprintf(&dir, "/tmp/%s-%s", name, version))
+    goto done;
+
+  target = get_uninstall_target(dir);
   if (!target)
     goto done;
 
-  rc = system(target);
+  // the command of the manifest, run from its extracted tree
+  spawn.dir = dir;
+  rc = clib_spawn_shell(target, &spawn);
 
 done:
   free(tarball);
   free(file);
   free(tarpath);
-  free(cmd);
+  free(dir);
   free(target);
   return rc;
 }
 
+typedef struct {
+  const char *slug;
+  int rc;
+} uninstall_task_t;
+
+static int uninstall_task(void *arg) {
+  uninstall_task_t *task = arg;
+  const char *slug = task->slug;
+  char *owner = NULL;
+  char *name = NULL;
+  char *version = NULL;
+  parse_repo_t repo;
+
+  // the owner is needed, there is no default one
+  if (0 == parse_repo(slug, &repo) && repo.owner.length) {
+    owner = substr_n(slug, repo.owner.length, 0, -1);
+    name = substr_n(slug + repo.name.offset, repo.name.length, 0, -1);
+    version = repo.version.length && '*' != slug[repo.version.offset]
+                  ? strdup(slug + repo.version.offset)
+                  : strdup("master");
+  }
+
+  task->rc = owner && name && version ? clib_uninstall(owner, name, version)
+                                      : -1;
+
+  free(owner);
+  free(name);
+  free(version);
+  return -1 == task->rc;
+}
+
 int main(int argc, char **argv) {
+  uninstall_task_t *tasks = NULL;
+  clib_pool_group_t *group = NULL;
+  clib_pool_t *pool = NULL;
+  int failures = 0;
   int rc = 1;
   command_t program;
 
@@ -203,34 +274,53 @@ int main(int argc, char **argv) {
   command_option(&program, "-P", "--prefix <dir>",
                  "change the prefix directory (usually '/usr/local')",
                  setopt_prefix);
+#ifdef HAVE_PTHREADS
+  concurrency = MAX_THREADS;
+  command_option(&program, "-C", "--concurrency <number>",
+                 "Set concurrency (default: " S(MAX_THREADS) ")",
+                 setopt_concurrency);
+#endif
 
   command_parse(&program, argc, argv);
 
   if (0 == program.argc)
     command_help(&program);
 
+  clib_cache_init(CLIB_PACKAGE_CACHE_TIME);
+
+  if (!(tasks = calloc(program.argc, sizeof(uninstall_task_t))))
+    goto cleanup;
+
+  // the main thread uninstalls too while it waits
+  pool = clib_pool_new(concurrency - 1);
+  group = clib_pool_group_new(pool);
+
   for (int i = 0; i < program.argc; i++) {
-    char *owner = parse_repo_owner(program.argv[i], NULL);
-    if (!owner)
-      goto cleanup;
-    char *name = parse_repo_name(program.argv[i]);
-    if (!name) {
-      free(owner);
-      goto cleanup;
-    }
+    tasks[i].slug = program.argv[i];
+    if (!group || 0 != clib_pool_submit(group, uninstall_task, &tasks[i]))
+      uninstall_task(&tasks[i]);
+  }
+
+  clib_pool_wait(group);
 
-    int res = clib_uninstall(owner, name, "master");
-    free(owner);
-    free(name);
-    if (-1 == res) {
+  for (int i = 0; i < program.argc; i++) {
+    if (-1 == tasks[i].rc) {
       logger_error("error", "Failed to uninstall %s", program.argv[i]);
-      goto cleanup;
+      (void)failures++;
     }
   }
 
-  rc = 0;
+  if (failures > 1) {
+    logger_error("error", "%d of %d packages failed to uninstall", failures,
+                 program.argc);
+  }
+
+  rc = 0 == failures ? 0 : 1;
 
 cleanup:
+  clib_pool_group_free(group);
+  clib_pool_free(pool);
+  free(tasks);
   command_free(&program);
   return rc;
 }
@@ -7,7 +7,14 @@
 
 #include "commander/commander.h"
 #include "common/clib-cache.h"
+#include "common/clib-dns.h"
+#include "common/clib-github.h"
+#include "common/clib-lockfile.h"
+#include "common/clib-mirror.h"
 #include "common/clib-package.h"
+#include "common/clib-pool.h"
+#include "common/clib-ratelimit.h"
+#include "common/clib-refs.h"
 #include "common/clib-validate.h"
 #include "debug/debug.h"
 #include "fs/fs.h"
@@ -25,6 +32,9 @@
 
 #define CLIB_PACKAGE_CACHE_TIME 30 * 24 * 60 * 60
 
+// refs of repos looked up at once
+#define MAX_LOOKUPS 16
+
 #define SX(s) #s
 #define S(s) SX(s)
 
@@ -99,18 +109,11 @@ static void setopt_concurrency(command_t *self) {
 #endif
 
 static int install_local_packages_with_package_name(const char *file) {
-  if (0 != clib_validate(file)) {
-    return 1;
-  }
-
   debug(&debugger, "reading local clib.json or package.json");
-  char *json = fs_read(file);
-  if (NULL == json)
-    return 1;
-
-  clib_package_t *pkg = clib_package_new(json, opts.verbose);
-  if (NULL == pkg)
-    goto e1;
+  // validated as read, rather than parsed once more
+  clib_package_t *pkg = clib_validate_load(file);
+  if (0 != clib_validate_package(pkg, file))
+    goto e2;
 
   if (pkg->prefix) {
     setenv("PREFIX", pkg->prefix, 1);
@@ -126,14 +129,11 @@ static int install_local_packages_with_package_name(const char *file) {
       goto e2;
   }
 
-  free(json);
   clib_package_free(pkg);
   return 0;
 
 e2:
   clib_package_free(pkg);
-e1:
-  free(json);
   return 1;
 }
 
@@ -184,6 +184,30 @@ static int write_dependency_with_package_name(clib_package_t *pkg, char *prefix,
  * Create and install a package from `slug`.
  */
 
+static void load_root_package(void) {
+  const char *name = NULL;
+  char *json = NULL;
+  unsigned int i = 0;
+
+  if (root_package) {
+    return;
+  }
+
+  do {
+    name = manifest_names[i];
+    json = fs_read(name);
+  } while (NULL != manifest_names[++i] && !json);
+
+  if (json) {
+    root_package = clib_package_new(json, opts.verbose);
+  }
+
+  if (root_package && root_package->prefix) {
+    package_opts.prefix = root_package->prefix;
+    clib_package_set_opts(package_opts);
+  }
+}
+
 static int install_package(const char *slug) {
   clib_package_t *pkg = NULL;
   int rc;
@@ -196,20 +220,7 @@ static int install_package(const char *slug) {
   long path_max = 4096;
 #endif
 
-  if (!root_package) {
-    const char *name = NULL;
-    char *json = NULL;
-    unsigned int i = 0;
-
-    do {
-      name = manifest_names[i];
-      json = fs_read(name);
-    } while (NULL != manifest_names[++i] && !json);
-
-    if (json) {
-      root_package = clib_package_new(json, opts.verbose);
-    }
-  }
+  load_root_package();
 
   if ('.' == slug[0]) {
     if (1 == strlen(slug) || ('/' == slug[1] && 2 == strlen(slug))) {
@@ -243,11 +254,6 @@ static int install_package(const char *slug) {
   if (NULL == pkg)
     return -1;
 
-  if (root_package && root_package->prefix) {
-    package_opts.prefix = root_package->prefix;
-    clib_package_set_opts(package_opts);
-  }
-
   rc = clib_package_install(pkg, opts.dir, opts.verbose);
   if (0 != rc) {
     goto cleanup;
@@ -260,26 +266,183 @@ static int install_package(const char *slug) {
     }
   }
 
-  if (0 == pkg->repo || 0 != strcmp(slug, pkg->repo)) {
-    pkg->repo = strdup(slug);
-  }
-
 cleanup:
   clib_package_free(pkg);
   return rc;
 }
 
+typedef struct {
+  const char *slug;
+  int rc;
+} install_task_t;
+
+static int install_package_task(void *arg) {
+  install_task_t *task = arg;
+
+  debug(&debugger, "install %s", task->slug);
+  task->rc = install_package(task->slug);
+  return -1 == task->rc;
+}
+
 /**
- * Install the given `pkgs`.
+ * Install the given `pkgs` on the package pool, and report every one
+ * that failed once all are done.
  */
 
 static int install_packages(int n, char *pkgs[]) {
+  install_task_t *tasks = calloc(n, sizeof(install_task_t));
+  clib_pool_group_t *group = NULL;
+  int failures = 0;
+
+  if (NULL == tasks) {
+    return 1;
+  }
+
+  // before any thread reads it
+  load_root_package();
+
+  group = clib_pool_group_new(clib_package_pool());
+
   for (int i = 0; i < n; i++) {
-    debug(&debugger, "install %s (%d)", pkgs[i], i);
-    if (-1 == install_package(pkgs[i]))
-      return 1;
+    tasks[i].slug = pkgs[i];
+    if (!group || 0 != clib_pool_submit(group, install_package_task,
+                                        &tasks[i])) {
+      install_package_task(&tasks[i]);
+    }
+  }
+
+  clib_pool_wait(group);
+  clib_pool_group_free(group);
+
+  for (int i = 0; i < n; i++) {
+    if (-1 == tasks[i].rc) {
+      logger_error("error", "Unable to update package %s", pkgs[i]);
+      (void)failures++;
+    }
+  }
+
+  if (failures > 1) {
+    logger_error("error", "%d of %d packages failed to update", failures, n);
+  }
+
+  free(tasks);
+  return 0 == failures ? 0 : 1;
+}
+
+/**
+ * Looks up the commits of `slugs`, in batched GraphQL queries when there
+ * is a token, which private repositories need, or else from their refs.
+ */
+
+static hash_t *resolve_refs(list_t *slugs) {
+  if (opts.token && *opts.token) {
+    return clib_github_commits(slugs, opts.token, clib_package_curl_share);
+  }
+
+  return clib_refs_resolve(slugs, MAX_LOOKUPS, clib_package_curl_share);
+}
+
+/**
+ * Looks the commits of the locked packages up, all at once, keeping the
+ * ones that are still at the commit they were installed at and
+ * forgetting the others, so that those are resolved and fetched again.
+ * Without a commit to compare, a package is fetched again, as it always
+ * was.
+ *
+ * @return The commits that were found, by slug
+ */
+
+static hash_t *check_locked_packages(clib_lockfile_t *lockfile) {
+  list_t *slugs = clib_lockfile_slugs(lockfile);
+  list_iterator_t *iterator = NULL;
+  list_node_t *node = NULL;
+  hash_t *refs = NULL;
+  int kept = 0;
+
+  if (!slugs) {
+    return NULL;
+  }
+
+  // the refs are on GitHub, which a mirror only install doesn't ask
+  if (slugs->len > 0 && !clib_mirror_only()) {
+    refs = resolve_refs(slugs);
+  }
+
+  if ((iterator = list_iterator_new(slugs, LIST_HEAD))) {
+    while ((node = list_iterator_next(iterator))) {
+      char *locked = clib_lockfile_commit(lockfile, node->val);
+      char *commit = refs ? hash_get(refs, node->val) : NULL;
+
+      if (locked && commit && 0 == strcmp(locked, commit)) {
+        debug(&debugger, "unchanged %s at %s", (char *)node->val, commit);
+        clib_lockfile_keep(lockfile, node->val);
+        (void)kept++;
+      } else {
+        debug(&debugger, "changed %s", (char *)node->val);
+        clib_lockfile_remove(lockfile, node->val);
+      }
+
+      free(locked);
+    }
+    list_iterator_destroy(iterator);
+  }
+
+  debug(&debugger, "%d of %d locked packages unchanged", kept,
+        (int)slugs->len);
+
+  list_destroy(slugs);
+  return refs;
+}
+
+/**
+ * Records the commit of every locked package that has none yet, from
+ * `refs` when it was looked up before the update, or else now.
+ */
+
+static void record_commits(clib_lockfile_t *lockfile, hash_t *refs) {
+  list_t *slugs = clib_lockfile_slugs(lockfile);
+  list_t *missing = list_new();
+  list_iterator_t *iterator = NULL;
+  list_node_t *node = NULL;
+  hash_t *found = NULL;
+
+  if (!slugs || !missing) {
+    goto cleanup;
+  }
+
+  if ((iterator = list_iterator_new(slugs, LIST_HEAD))) {
+    while ((node = list_iterator_next(iterator))) {
+      char *locked = clib_lockfile_commit(lockfile, node->val);
+      char *commit = refs ? hash_get(refs, node->val) : NULL;
+
+      if (!locked) {
+        if (commit) {
+          clib_lockfile_set_commit(lockfile, node->val, commit);
+        } else {
+          list_rpush(missing, list_node_new(node->val));
+        }
+      }
+
+      free(locked);
+    }
+    list_iterator_destroy(iterator);
+  }
+
+  if (0 == missing->len || clib_mirror_only() ||
+      !(found = resolve_refs(missing))) {
+    goto cleanup;
+  }
+
+  hash_each(found, clib_lockfile_set_commit(lockfile, key, val));
+  clib_refs_free(found);
+
+cleanup:
+  if (missing) {
+    list_destroy(missing);
+  }
+  if (slugs) {
+    list_destroy(slugs);
   }
-  return 0;
 }
 
 /**
@@ -338,6 +501,9 @@ int main(int argc, char *argv[]) {
     logger_error("error", "Failed to initialize cURL");
   }
 
+  clib_ratelimit_init();
+  clib_dns_prefetch();
+
   if (opts.prefix) {
     char prefix[path_max];
     memset(prefix, 0, path_max);
@@ -362,9 +528,33 @@ int main(int argc, char *argv[]) {
 
   clib_package_set_opts(package_opts);
 
+  clib_lockfile_t *lockfile = clib_lockfile_load(CLIB_LOCKFILE_NAME);
+  hash_t *refs = NULL;
+
+  if (!lockfile) {
+    lockfile = clib_lockfile_new();
+  }
+
+  if (lockfile) {
+    refs = check_locked_packages(lockfile);
+    clib_package_set_lockfile(lockfile, 0);
+  }
+
   int code = 0 == program.argc ? install_local_packages()
                                : install_packages(program.argc, program.argv);
 
+  if (lockfile) {
+    record_commits(lockfile, refs);
+
+    if (0 == code && 0 != clib_lockfile_save(lockfile, CLIB_LOCKFILE_NAME)) {
+      logger_warn("warning", "Unable to write %s", CLIB_LOCKFILE_NAME);
+    }
+  }
+
+  clib_package_set_lockfile(NULL, 0);
+  clib_lockfile_free(lockfile);
+  clib_refs_free(refs);
+
   curl_global_cleanup();
   clib_package_cleanup();
 
@@ -6,16 +6,25 @@
 //
 
 #include "commander/commander.h"
+#include "common/clib-archive.h"
 #include "common/clib-cache.h"
+#include "common/clib-dns.h"
+#include "common/clib-hash.h"
 #include "common/clib-package.h"
+#include "common/clib-ratelimit.h"
 #include "common/clib-release-info.h"
+#include "copy/copy.h"
 #include "debug/debug.h"
 #include "fs/fs.h"
 #include "http-get/http-get.h"
 #include "logger/logger.h"
+#include "mkdirp/mkdirp.h"
 #include "parson/parson.h"
+#include "path-join/path-join.h"
+#include "rimraf/rimraf.h"
 #include "str-replace/str-replace.h"
 #include "tempdir/tempdir.h"
+#include "tinydir/tinydir.h"
 #include "version.h"
 #include <asprintf/asprintf.h>
 #include <curl/curl.h>
@@ -24,8 +33,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define CLIB_PACKAGE_CACHE_TIME 30 * 24 * 60 * 60
+#define RELEASE_TAG_EXPIRATION 24 * 60 * 60 // 1 day
+#define RELEASE_CHECK_TIMEOUT 10            // seconds
+
+#define RELEASE_DOWNLOAD_URL "https://github.com/%s/releases/download/%s/%s"
+
+// the name of the release archives built for this platform
+#if defined(__linux__)
+#define RELEASE_ARTIFACT "clib-linux"
+#elif defined(__APPLE__)
+#define RELEASE_ARTIFACT "clib-macos"
+#endif
 
 #define SX(s) #s
 #define S(s) SX(s)
@@ -107,6 +129,183 @@ static void setopt_concurrency(command_t *self) {
 }
 #endif
 
+/**
+ * @return The latest tag, as last looked up by `clib` or this command
+ * unless that was more than a day ago, which must be freed
+ */
+
+static const char *latest_tag(void) {
+  const char *path = path_join(clib_cache_meta_dir(), CLIB_RELEASE_TAG_FILE);
+  const char *tag = NULL;
+
+  tag = clib_release_get_latest_tag_cached(path, RELEASE_TAG_EXPIRATION,
+                                           RELEASE_CHECK_TIMEOUT);
+
+  free((void *)path);
+  return tag;
+}
+
+/**
+ * @return 1 when `tag` is the version of this clib, 0 otherwise
+ */
+
+static int is_current(const char *tag) {
+  if ('v' == tag[0]) {
+    tag++;
+  }
+
+  return 0 == strcmp(tag, CLIB_VERSION);
+}
+
+/**
+ * Copies the files of `dir` into `bin`, each through a file of its own,
+ * so that a running clib is replaced rather than written over.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+
+static int install_binaries(const char *dir, const char *bin) {
+  tinydir_dir files;
+  int count = 0;
+  int rc = 0;
+
+  if (-1 == tinydir_open_sorted(&files, dir)) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < files.n_files && 0 == rc; i++) {
+    tinydir_file file;
+    char *target = NULL;
+    char *tmp = NULL;
+
+    tinydir_readfile_n(&files, &file, i);
+
+    if (!file.is_reg) {
+      continue;
+    }
+
+    if (-1 == asprintf(&target, "%s/%s", bin, file.name) ||
+        -1 == asprintf(&tmp, "%s/.%s.tmp", bin, file.name)) {
+      rc = -1;
+    } else if (0 != copy_file(file.path, tmp) || 0 != chmod(tmp, 0755) ||
+               0 != rename(tmp, target)) {
+      logger_error("error", "Unable to install %s", target);
+      unlink(tmp);
+      rc = -1;
+    } else {
+      logger_info("install", "%s", target);
+      count++;
+    }
+
+    free(target);
+    free(tmp);
+  }
+
+  tinydir_close(&files);
+  return 0 == rc && 0 < count ? 0 : -1;
+}
+
+/**
+ * Installs the binaries released for this platform as `tag`, when there
+ * are, checking them against the checksum released along with them.
+ *
+ * @return 0 on success, 1 when there is no release for this platform, -1
+ * on error
+ */
+
+static int install_prebuilt(const char *slug, const char *tag) {
+#ifdef RELEASE_ARTIFACT
+  http_get_response_t *sum = NULL;
+  http_get_response_t *res = NULL;
+  char hash[CLIB_HASH_HEX_SIZE];
+  char *name = NULL;
+  char *url = NULL;
+  char *sum_url = NULL;
+  char *dir = NULL;
+  char *src = NULL;
+  char *bin = NULL;
+  char *tmp = NULL;
+  const char *prefix = package_opts.prefix;
+  int rc = -1;
+
+  if (!prefix) {
+    prefix = getenv("PREFIX");
+  }
+
+  if (!prefix) {
+    prefix = "/usr/local";
+  }
+
+  if (-1 == asprintf(&name, "%s-%s.tar.gz", RELEASE_ARTIFACT, tag) ||
+      -1 == asprintf(&url, RELEASE_DOWNLOAD_URL, slug, tag, name) ||
+      -1 == asprintf(&sum_url, "%s.sha256", url)) {
+    goto cleanup;
+  }
+
+  // releases without binaries, older ones or forks, are built from source
+  if (!(sum = http_get(sum_url)) || !sum->ok) {
+    debug(&debugger, "no release binaries at %s", sum_url);
+    rc = 1;
+    goto cleanup;
+  }
+
+  if (sum->size < CLIB_HASH_HEX_SIZE - 1) {
+    logger_error("error", "Malformed checksum at %s", sum_url);
+    goto cleanup;
+  }
+
+  logger_info("fetch", "%s", url);
+
+  if (!(res = http_get(url)) || !res->ok) {
+    logger_error("error", "Unable to fetch %s", url);
+    goto cleanup;
+  }
+
+  clib_hash_buffer(res->data, res->size, hash);
+
+  if (0 != strncasecmp(hash, sum->data, CLIB_HASH_HEX_SIZE - 1)) {
+    logger_error("error", "Checksum mismatch of %s", name);
+    goto cleanup;
+  }
+
+  if (!(tmp = gettempdir()) ||
+      -1 == asprintf(&dir, "%s/clib-upgrade-%d", tmp, (int)getpid()) ||
+      -1 == asprintf(&src, "%s/bin", dir) ||
+      -1 == asprintf(&bin, "%s/bin", prefix)) {
+    goto cleanup;
+  }
+
+  if (0 != clib_archive_extract_buffer(res->data, res->size, dir)) {
+    logger_error("error", "Unable to extract %s", name);
+    goto cleanup;
+  }
+
+  if (0 != mkdirp(bin, 0777)) {
+    logger_error("error", "Unable to create %s", bin);
+    goto cleanup;
+  }
+
+  rc = install_binaries(src, bin);
+
+cleanup:
+  if (dir) {
+    rimraf(dir);
+  }
+  http_get_free(sum);
+  http_get_free(res);
+  free(name);
+  free(url);
+  free(sum_url);
+  free(dir);
+  free(src);
+  free(bin);
+  free(tmp);
+  return rc;
+#else
+  return 1;
+#endif
+}
+
 /**
  * Create and install a package from `slug`.
  */
@@ -131,18 +330,36 @@ static int install_package(const char *slug) {
   }
 
   char *extended_slug = 0;
+  const char *tag = opts.tag ? strdup(opts.tag) : latest_tag();
 
-  if (0 != opts.tag) {
-    asprintf(&extended_slug, "%s@%s", slug, opts.tag);
-  } else {
-    const char *latest_tag = clib_release_get_latest_tag();
+  if (!tag) {
+    logger_error("error", "Unable to look up the latest release of %s", slug);
+    return -1;
+  }
 
-    asprintf(&extended_slug, "%s@%s", slug, latest_tag);
-    free((void *)latest_tag);
+  if (0 == opts.force && is_current(tag)) {
+    logger_info("info", "Already using clib %s", CLIB_VERSION);
+    free((void *)tag);
+    return 0;
   }
 
+  if (root_package && root_package->prefix && !package_opts.prefix) {
+    package_opts.prefix = root_package->prefix;
+    clib_package_set_opts(package_opts);
+  }
+
+  asprintf(&extended_slug, "%s@%s", slug, tag);
+
   logger_info("info", "Upgrading to %s", extended_slug);
 
+  if (1 != (rc = install_prebuilt(slug, tag))) {
+    free((void *)tag);
+    free(extended_slug);
+    return rc;
+  }
+
+  free((void *)tag);
+
   pkg = clib_package_new_from_slug(extended_slug, opts.verbose);
 
   if (NULL == pkg) {
@@ -151,14 +368,10 @@ static int install_package(const char *slug) {
                  "sure it actually exists.",
                  extended_slug);
 
+    free(extended_slug);
     return -1;
   }
 
-  if (root_package && root_package->prefix) {
-    package_opts.prefix = root_package->prefix;
-    clib_package_set_opts(package_opts);
-  }
-
   char *tmp = gettempdir();
 
   if (0 != tmp) {
@@ -172,10 +385,6 @@ static int install_package(const char *slug) {
     goto cleanup;
   }
 
-  if (0 == pkg->repo || 0 != strcmp(slug, pkg->repo)) {
-    pkg->repo = strdup(slug);
-  }
-
 cleanup:
   if (0 != extended_slug) {
     free(extended_slug);
@@ -233,6 +442,9 @@ int main(int argc, char *argv[]) {
     logger_error("error", "Failed to initialize cURL");
   }
 
+  clib_ratelimit_init();
+  clib_dns_prefetch();
+
   if (opts.prefix) {
     char prefix[path_max];
     memset(prefix, 0, path_max);
@@ -244,6 +456,7 @@ int main(int argc, char *argv[]) {
   }
 
   clib_cache_init(CLIB_PACKAGE_CACHE_TIME);
+  clib_cache_meta_init();
 
   package_opts.skip_cache = 1;
   package_opts.prefix = opts.prefix;
@@ -0,0 +1,299 @@
+//
+// clib-validate.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "commander/commander.h"
+#include "common/clib-package.h"
+#include "common/clib-pool.h"
+#include "common/clib-validate.h"
+#include "debug/debug.h"
+#include "dir-iter/dir-iter.h"
+#include "fs/fs.h"
+#include "logger/logger.h"
+#include "path-join/path-join.h"
+#include "strdup/strdup.h"
+#include "version.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SX(s) #s
+#define S(s) SX(s)
+
+#ifdef HAVE_PTHREADS
+#define MAX_THREADS 8
+#endif
+
+debug_t debugger;
+
+static const char *manifest_names[] = {"clib.json", "package.json", NULL};
+
+struct options {
+  const char *dir;
+  int quiet;
+#ifdef HAVE_PTHREADS
+  unsigned int concurrency;
+#endif
+};
+
+static struct options opts = {0};
+
+// a manifest to validate, read by a task of the pool
+typedef struct {
+  char *path;
+  clib_package_t *pkg;
+} manifest_t;
+
+static void setopt_dir(command_t *self) {
+  opts.dir = self->arg;
+  debug(&debugger, "set dir: %s", opts.dir);
+}
+
+static void setopt_quiet(command_t *self) {
+  opts.quiet = 1;
+  debug(&debugger, "set quiet flag");
+}
+
+#ifdef HAVE_PTHREADS
+static void setopt_concurrency(command_t *self) {
+  if (self->arg) {
+    opts.concurrency = atol(self->arg);
+    debug(&debugger, "set concurrency: %u", opts.concurrency);
+  }
+}
+#endif
+
+/**
+ * @return A new path of the manifest in `dir`, or NULL if it has none
+ */
+
+static char *find_manifest(const char *dir) {
+  char *manifest = NULL;
+
+  for (int i = 0; manifest_names[i]; i++) {
+    if ((manifest = path_join(dir, manifest_names[i])) &&
+        0 == fs_exists(manifest)) {
+      return manifest;
+    }
+    free(manifest);
+  }
+
+  return NULL;
+}
+
+/**
+ * Adds the manifest `path`, or the one in the directory `path`, to
+ * `manifests`. The path is kept as it is when there is none, to be
+ * reported as missing.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int add_manifest(list_t *manifests, const char *path) {
+  fs_stats *stats = fs_stat(path);
+  manifest_t *manifest = NULL;
+  char *file = NULL;
+
+  if (stats && S_IFDIR == (stats->st_mode & S_IFMT)) {
+    file = find_manifest(path);
+  }
+
+  free(stats);
+
+  if ((!file && !(file = strdup(path))) ||
+      !(manifest = calloc(1, sizeof(manifest_t)))) {
+    free(file);
+    return -1;
+  }
+
+  manifest->path = file;
+  return list_rpush(manifests, list_node_new(manifest)) ? 0 : -1;
+}
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Adds the manifests of the packages installed in `dir`, in order of
+ * their names, so that the output is the same from one run to the next.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int add_installed(list_t *manifests, const char *dir) {
+  dir_iter_t iter;
+  char **names = NULL;
+  size_t count = 0;
+  size_t size = 0;
+  int rc = 0;
+
+  if (-1 == dir_iter_open(&iter, dir)) {
+    return 0;
+  }
+
+  while (0 == rc && dir_iter_next(&iter)) {
+    if (count == size) {
+      char **grown = realloc(names, (size = size ? 2 * size : 16) *
+                                        sizeof(char *));
+      if (!grown) {
+        rc = -1;
+        break;
+      }
+      names = grown;
+    }
+
+    if (!(names[count] = path_join(dir, iter.name))) {
+      rc = -1;
+    } else {
+      count++;
+    }
+  }
+
+  dir_iter_close(&iter);
+
+  if (count > 1) {
+    qsort(names, count, sizeof(char *), compare_names);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    char *manifest = NULL;
+
+    // files next to the packages aren't any of them
+    if (0 == rc && (manifest = find_manifest(names[i]))) {
+      rc = add_manifest(manifests, manifest);
+    }
+
+    free(manifest);
+    free(names[i]);
+  }
+
+  free(names);
+  return rc;
+}
+
+static int load_manifest(void *arg) {
+  manifest_t *manifest = arg;
+
+  manifest->pkg = clib_validate_load(manifest->path);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  command_t program;
+  list_t *manifests = NULL;
+  list_node_t *node = NULL;
+  clib_pool_group_t *group = NULL;
+  clib_pool_t *pool = NULL;
+  char *root = NULL;
+  int invalid = 0;
+  int rc = 1;
+
+  opts.dir = "./deps";
+#ifdef HAVE_PTHREADS
+  opts.concurrency = MAX_THREADS;
+#endif
+
+  debug_init(&debugger, "clib-validate");
+
+  command_init(&program, "clib-validate", CLIB_VERSION);
+
+  program.usage = "[options] [manifest|dir ...]";
+
+  command_option(&program, "-o", "--out <dir>",
+                 "validate the packages installed in <dir> (default: deps)",
+                 setopt_dir);
+  command_option(&program, "-q", "--quiet", "only report what is wrong",
+                 setopt_quiet);
+#ifdef HAVE_PTHREADS
+  command_option(&program, "-C", "--concurrency <number>",
+                 "Set concurrency (default: " S(MAX_THREADS) ")",
+                 setopt_concurrency);
+#endif
+
+  command_parse(&program, argc, argv);
+
+  if (!(manifests = list_new())) {
+    goto cleanup;
+  }
+
+  manifests->free = NULL;
+
+  // the project and the packages installed for it, unless told otherwise
+  if (0 == program.argc) {
+    if ((root = find_manifest(".")) && 0 != add_manifest(manifests, root)) {
+      goto cleanup;
+    }
+
+    if (0 != add_installed(manifests, opts.dir)) {
+      goto cleanup;
+    }
+  }
+
+  for (int i = 0; i < program.argc; i++) {
+    if (0 != add_manifest(manifests, program.argv[i])) {
+      goto cleanup;
+    }
+  }
+
+  if (0 == manifests->len) {
+    logger_error("error", "No clib.json or package.json to validate");
+    goto cleanup;
+  }
+
+#ifdef HAVE_PTHREADS
+  pool = clib_pool_new(opts.concurrency);
+#else
+  pool = clib_pool_new(0);
+#endif
+
+  if (!pool || !(group = clib_pool_group_new(pool))) {
+    goto cleanup;
+  }
+
+  // the manifests are read in parallel, and reported on in order
+  list_each(manifests, node) {
+    if (0 != clib_pool_submit(group, load_manifest, node->val)) {
+      load_manifest(node->val);
+    }
+  }
+
+  clib_pool_wait(group);
+
+  list_each(manifests, node) {
+    manifest_t *manifest = node->val;
+
+    if (0 != clib_validate_package(manifest->pkg, manifest->path)) {
+      invalid++;
+    } else if (!opts.quiet) {
+      logger_info("valid", manifest->path);
+    }
+  }
+
+  if (!opts.quiet || invalid) {
+    logger_info("validated", "%u manifests, %d invalid", manifests->len,
+                invalid);
+  }
+
+  rc = 0 == invalid ? 0 : 1;
+
+cleanup:
+  if (manifests) {
+    list_each(manifests, node) {
+      manifest_t *manifest = node->val;
+      clib_package_free(manifest->pkg);
+      free(manifest->path);
+      free(manifest);
+    }
+    list_destroy(manifests);
+  }
+  clib_pool_group_free(group);
+  clib_pool_free(pool);
+  free(root);
+  command_free(&program);
+  return rc;
+}
@@ -7,23 +7,31 @@
 
 #include "asprintf/asprintf.h"
 #include "common/clib-cache.h"
+#include "common/clib-daemon.h"
 #include "common/clib-release-info.h"
+#include "common/clib-spawn.h"
 #include "debug/debug.h"
 #include "fs/fs.h"
 #include "http-get/http-get.h"
 #include "logger/logger.h"
 #include "parson/parson.h"
 #include "path-join/path-join.h"
-#include "str-flatten/str-flatten.h"
 #include "strdup/strdup.h"
 #include "trim/trim.h"
 #include "version.h"
 #include "which/which.h"
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #if defined(_WIN32) || defined(WIN32) || defined(__MINGW32__) ||               \
     defined(__MINGW64__) || defined(__CYGWIN__)
 #define setenv(k, v, _) _putenv_s(k, v)
@@ -33,6 +41,7 @@
 #define LATEST_RELEASE_ENDPOINT                                                \
   "https://api.github.com/repos/clibs/clib/releases/latest"
 #define RELEASE_NOTIFICATION_EXPIRATION 3 * 24 * 60 * 60 // 3 days
+#define RELEASE_CHECK_TIMEOUT 10                          // seconds
 
 debug_t debugger;
 
@@ -55,6 +64,9 @@ static const char *usage =
     "    configure [name...]  Configure one or more packages\n"
     "    build [name...]      Build one or more packages\n"
     "    search [query]       Search for packages\n"
+    "    validate [path...]   Validate manifests, those installed by default\n"
+    "    cache <command>      Show, prune, verify or warm the package cache\n"
+    "    daemon [stop]        Run commands from a process kept in the background\n"
     "    help <cmd>           Display help for cmd\n"
     "";
 
@@ -81,43 +93,135 @@ static bool should_check_release(const char *path) {
   return now - modified >= RELEASE_NOTIFICATION_EXPIRATION;
 }
 
-static void compare_versions(const char *marker_file_path) {
-  const char *latest_version = clib_release_get_latest_tag();
+/**
+ * Tells about the release found by the last check, once.
+ */
+
+static void show_new_release(const char *latest_file_path) {
+  char *latest_version = NULL;
+
+  if (0 != fs_exists(latest_file_path)) {
+    return;
+  }
+
+  latest_version = fs_read(latest_file_path);
+  remove(latest_file_path);
 
-  if (0 != strcmp(CLIB_VERSION, latest_version)) {
+  if (latest_version && *trim(latest_version) &&
+      0 != strcmp(CLIB_VERSION, trim(latest_version))) {
     logger_info("info",
                 "You are using clib %s, a new version is avalable. You can "
                 "upgrade with the following command: clib upgrade --tag %s",
-                CLIB_VERSION, latest_version);
+                CLIB_VERSION, trim(latest_version));
+  }
+
+  free(latest_version);
+}
+
+/**
+ * Looks the latest release up and writes it to `latest_file_path`, for
+ * the next run to show, and to `tag_file_path`, for `clib upgrade`.
+ * That's done by a process of its own, so the command doesn't wait for
+ * the network, and it can outlive this one.
+ */
+
+static void check_release(const char *latest_file_path,
+                          const char *tag_file_path) {
+  const char *latest_version = NULL;
+  char *tmp_file_path = NULL;
+
+  if (-1 == asprintf(&tmp_file_path, "%s.tmp", latest_file_path)) {
+    return;
+  }
+
+#ifndef _WIN32
+  pid_t pid = 0;
+  int null = -1;
+
+  fflush(NULL);
+
+  if (-1 == (pid = fork())) {
+    free(tmp_file_path);
+    return;
+  }
+
+  if (0 != pid) {
+    // only the first child, the one doing the check is left to init
+    while (-1 == waitpid(pid, NULL, 0)) {
+      if (EINTR != errno) {
+        break;
+      }
+    }
+
+    free(tmp_file_path);
+    return;
+  }
+
+  if (0 != fork()) {
+    _exit(0);
+  }
+
+  // nor does it hold on to the terminal or pipes of the command
+  setsid();
+
+  if (-1 != (null = open("/dev/null", O_RDWR))) {
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+  }
+#endif
+
+  latest_version = clib_release_get_latest_tag_cached(tag_file_path, 0,
+                                                      RELEASE_CHECK_TIMEOUT);
+
+  // readers see all of it or nothing
+  if (latest_version && -1 != fs_write(tmp_file_path, latest_version)) {
+    rename(tmp_file_path, latest_file_path);
   }
+
   free((void *)latest_version);
+  free(tmp_file_path);
+
+#ifndef _WIN32
+  _exit(0);
+#endif
 }
 
 static void notify_new_release(void) {
   const char *marker_file_path =
       path_join(clib_cache_meta_dir(), "release-notification-checked");
+  const char *latest_file_path =
+      path_join(clib_cache_meta_dir(), "release-latest");
+  const char *tag_file_path =
+      path_join(clib_cache_meta_dir(), CLIB_RELEASE_TAG_FILE);
 
-  if (!marker_file_path) {
+  if (!marker_file_path || !latest_file_path || !tag_file_path) {
     debug(&debugger,
           "Unable to retrieve release notification marker file path");
-    return;
+    goto cleanup;
   }
 
+  show_new_release(latest_file_path);
+
   if (!should_check_release(marker_file_path)) {
     debug(&debugger, "No need to check for new release yet");
     goto cleanup;
   }
 
-  compare_versions(marker_file_path);
+  // before the check, so that commands run meanwhile don't check too
   fs_write(marker_file_path, " ");
+  check_release(latest_file_path, tag_file_path);
 
 cleanup:
   free((void *)marker_file_path);
+  free((void *)latest_file_path);
+  free((void *)tag_file_path);
 }
 
 static void warn_deprecated_sub_command(const char *cmd) {
-  const char *allowed[] = {"build",  "configure", "init",    "install",
-                           "search", "update",    "upgrade", "uninstall", NULL};
+  const char *allowed[] = {"build",   "cache",     "configure", "daemon",
+                           "init",    "install",   "search",    "update",
+                           "upgrade", "uninstall", "validate",  NULL};
 
   int i = 0;
 
@@ -131,15 +235,77 @@ static void warn_deprecated_sub_command(const char *cmd) {
                             "sub-commands will be removed in 3.0");
 }
 
+#ifdef CLIB_MULTICALL
+int clib_build_main(int argc, char **argv);
+int clib_cache_main(int argc, char **argv);
+int clib_configure_main(int argc, char **argv);
+int clib_init_main(int argc, char **argv);
+int clib_install_main(int argc, char **argv);
+int clib_search_main(int argc, char **argv);
+int clib_uninstall_main(int argc, char **argv);
+int clib_update_main(int argc, char **argv);
+int clib_upgrade_main(int argc, char **argv);
+int clib_validate_main(int argc, char **argv);
+
+typedef int (*command_main_t)(int argc, char **argv);
+
+static const struct {
+  const char *name;
+  command_main_t main;
+} commands[] = {
+    {"build", clib_build_main},         {"cache", clib_cache_main},
+    {"configure", clib_configure_main}, {"init", clib_init_main},
+    {"install", clib_install_main},     {"search", clib_search_main},
+    {"uninstall", clib_uninstall_main}, {"update", clib_update_main},
+    {"upgrade", clib_upgrade_main},     {"validate", clib_validate_main},
+    {NULL, NULL}};
+
+/**
+ * @return The entry point of command `name` linked into this binary, which
+ * may end with ".exe", or NULL if it isn't one of them
+ */
+
+static command_main_t find_command(const char *name) {
+  size_t length = strlen(name);
+
+  if (length > 4 && 0 == strcmp(name + length - 4, ".exe")) {
+    length -= 4;
+  }
+
+  for (int i = 0; commands[i].name; i++) {
+    if (length == strlen(commands[i].name) &&
+        0 == strncmp(commands[i].name, name, length)) {
+      return commands[i].main;
+    }
+  }
+
+  return NULL;
+}
+#endif
+
 int main(int argc, const char **argv) {
 
   char *cmd = NULL;
-  char *args = NULL;
+  char **args = NULL;
   char *command = NULL;
-  char *command_with_args = NULL;
   char *bin = NULL;
+  int count = 1;
   int rc = 1;
 
+#ifdef CLIB_MULTICALL
+  // run as one of the links named after the commands
+  {
+    const char *name = strrchr(argv[0], '/');
+    command_main_t entry = NULL;
+
+    name = name ? name + 1 : argv[0];
+
+    if (0 == strncmp(name, "clib-", 5) && (entry = find_command(name + 5))) {
+      return entry(argc, (char **)argv);
+    }
+  }
+#endif
+
   debug_init(&debugger, "clib");
 
   clib_cache_meta_init();
@@ -173,23 +339,26 @@ int main(int argc, const char **argv) {
   }
   cmd = trim(cmd);
 
+  // the arguments go to the command as they are, without a shell
+  if (!(args = calloc(argc + 1, sizeof(char *)))) {
+    fprintf(stderr, "Memory allocation failure\n");
+    goto cleanup;
+  }
+
   if (0 == strcmp(cmd, "help")) {
     if (argc >= 3) {
       free(cmd);
       cmd = strdup(argv[2]);
-      args = strdup("--help");
+      args[count++] = "--help";
     } else {
       fprintf(stderr, "Help command required.\n");
       goto cleanup;
     }
   } else {
-    if (argc >= 3) {
-      args = str_flatten(argv, 2, argc);
-      if (NULL == args)
-        goto cleanup;
+    for (int i = 2; i < argc; i++) {
+      args[count++] = (char *)argv[i];
     }
   }
-  debug(&debugger, "args: %s", args);
 
   // aliases
   cmd = strcmp(cmd, "i") == 0 ? strdup("install") : cmd;
@@ -204,6 +373,39 @@ int main(int argc, const char **argv) {
 #endif
   debug(&debugger, "command '%s'", cmd);
 
+  if (0 == strcmp(cmd, "daemon")) {
+    if (argc > 2 && 0 == strcmp(argv[2], "stop")) {
+      rc = clib_daemon_stop();
+    } else if (argc > 2) {
+      fprintf(stderr, "Unknown daemon command \"%s\"\n", argv[2]);
+    } else {
+#ifdef CLIB_MULTICALL
+      rc = clib_daemon_serve(CLIB_VERSION, find_command);
+#else
+      fprintf(stderr, "The daemon is part of the multicall build of clib\n");
+#endif
+    }
+    goto cleanup;
+  }
+
+  args[0] = command;
+  rc = 1;
+
+#ifdef CLIB_MULTICALL
+  // a running daemon starts the command sooner than this process can, and
+  // has the same commands linked in
+  if (find_command(cmd) &&
+      -1 != (rc = clib_daemon_forward(CLIB_VERSION, count, args))) {
+    goto cleanup;
+  }
+
+  // commands linked in run right here, others are still looked up
+  if (find_command(cmd)) {
+    rc = find_command(cmd)(count, args);
+    goto cleanup;
+  }
+#endif
+
   bin = which(command);
   if (NULL == bin) {
     fprintf(stderr, "Unsupported command \"%s\"\n", cmd);
@@ -216,24 +418,26 @@ int main(int argc, const char **argv) {
       *p = '\\';
 #endif
 
-  if (args) {
-    format(&command_with_args, "%s %s", bin, args);
-  } else {
-    format(&command_with_args, "%s", bin);
-  }
+  args[0] = bin;
+  debug(&debugger, "exec: %s", bin);
 
-  debug(&debugger, "exec: %s", command_with_args);
-
-  rc = system(command_with_args);
+#ifdef _WIN32
+  // exec doesn't keep the process there, the console would move on
+  rc = clib_spawn(args, NULL);
   debug(&debugger, "returned %d", rc);
-  if (rc > 255)
+  if (-1 == rc)
     rc = 1;
+#else
+  // the command takes the place of this process, which has no use left
+  fflush(NULL);
+  execv(bin, args);
+  fprintf(stderr, "Unable to run \"%s\": %s\n", bin, strerror(errno));
+#endif
 
 cleanup:
   free(cmd);
   free(args);
   free(command);
-  free(command_with_args);
   free(bin);
   return rc;
 }
@@ -0,0 +1,819 @@
+//
+// clib-archive.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "clib-archive.h"
+#include "asprintf/asprintf.h"
+#include "clib-batch.h"
+#include "clib-mkdir.h"
+#include "clib-spawn.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include "fs/fs.h"
+#include <zlib.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#define TAR_BLOCK_SIZE 512
+#define ARCHIVE_BUFFER_SIZE (64 * 1024)
+// GNU long names and pax headers larger than this are rejected
+#define ARCHIVE_META_MAX (1024 * 1024)
+// files up to this size are kept whole and written in batches
+#define ARCHIVE_BATCH_FILE_MAX (256 * 1024)
+
+typedef enum {
+  ENTRY_SKIP = 0,
+  ENTRY_FILE,
+  ENTRY_LONG_NAME,
+  ENTRY_LONG_LINK,
+  ENTRY_PAX,
+} entry_kind_t;
+
+typedef struct {
+  char *name;
+  char *path;
+  int extracted;
+} clib_archive_selection_t;
+
+struct clib_archive {
+  z_stream stream;
+  int stream_end;
+  char *dir;
+  char *buffer;
+  // the tar stream
+  char header[TAR_BLOCK_SIZE];
+  size_t header_size;
+  uint64_t remaining;
+  size_t padding;
+  int zero_blocks;
+  int done;
+  int failed;
+  // the entry being extracted
+  entry_kind_t kind;
+  FILE *file;
+  char *data;
+  size_t data_size;
+  char *path;
+  unsigned mode;
+  time_t mtime;
+  char *meta;
+  size_t meta_size;
+  // names carried over from GNU and pax headers to the next entry
+  char *long_name;
+  char *long_link;
+  // entries to extract, when not the whole archive
+  clib_archive_selection_t *selections;
+  size_t selections_count;
+  size_t extracted;
+  clib_archive_selection_t *selection;
+  // small files waiting to be written, when batches are enabled
+  clib_batch_t *batch;
+};
+
+static uint64_t parse_number(const char *field, size_t size) {
+  uint64_t value = 0;
+
+  // GNU base-256 for values that don't fit in octal
+  if (0x80 & (unsigned char)field[0]) {
+    value = 0x7f & (unsigned char)field[0];
+    for (size_t i = 1; i < size; i++) {
+      value = (value << 8) | (unsigned char)field[i];
+    }
+    return value;
+  }
+
+  while (size > 0 && ' ' == *field) {
+    field++;
+    size--;
+  }
+
+  for (size_t i = 0; i < size && field[i] >= '0' && field[i] <= '7'; i++) {
+    value = value * 8 + (field[i] - '0');
+  }
+
+  return value;
+}
+
+static int valid_checksum(const char *header) {
+  uint64_t expected = parse_number(header + 148, 8);
+  uint64_t sum = 0;
+
+  for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
+    sum += i >= 148 && i < 156 ? ' ' : (unsigned char)header[i];
+  }
+
+  return sum == expected;
+}
+
+/**
+ * @return 1 if `name` stays inside the target directory
+ */
+
+static int is_safe_path(const char *name) {
+  const char *part = name;
+
+  if ('/' == name[0] || '\\' == name[0] || 0 == name[0]) {
+    return 0;
+  }
+
+  while (part) {
+    const char *end = strpbrk(part, "/\\");
+    size_t size = end ? (size_t)(end - part) : strlen(part);
+
+    if (2 == size && 0 == strncmp(part, "..", 2)) {
+      return 0;
+    }
+
+    part = end ? end + 1 : NULL;
+  }
+
+  return 1;
+}
+
+static char *field_string(const char *field, size_t size) {
+  size_t length = 0;
+  char *value = NULL;
+
+  while (length < size && field[length]) {
+    length++;
+  }
+
+  if ((value = malloc(length + 1))) {
+    memcpy(value, field, length);
+    value[length] = 0;
+  }
+
+  return value;
+}
+
+static void mkdir_parent(char *path) {
+  char *slash = strrchr(path, '/');
+
+  if (slash && slash != path) {
+    *slash = 0;
+    clib_mkdirp(path, 0755);
+    *slash = '/';
+  }
+}
+
+/**
+ * Reads the `path` and `linkpath` records of a pax extended header
+ */
+
+static void parse_pax(clib_archive_t *self) {
+  size_t offset = 0;
+
+  while (offset < self->meta_size) {
+    char *record = self->meta + offset;
+    char *key = NULL;
+    char *value = NULL;
+    size_t length = strtoul(record, &key, 10);
+
+    if (0 == length || offset + length > self->meta_size || ' ' != *key ||
+        !(value = memchr(key, '=', record + length - key))) {
+      return;
+    }
+
+    key++;
+    value++;
+
+    if (0 == strncmp(key, "path=", 5) || 0 == strncmp(key, "linkpath=", 9)) {
+      char **target = 'p' == key[0] ? &self->long_name : &self->long_link;
+      free(*target);
+      *target = field_string(value, record + length - 1 - value);
+    }
+
+    offset += length;
+  }
+}
+
+static int flush_batch(clib_archive_t *self) {
+  return self->batch ? clib_batch_flush(self->batch) : 0;
+}
+
+static int finish_entry(clib_archive_t *self) {
+  int rc = 0;
+
+  switch (self->kind) {
+  case ENTRY_FILE:
+    if (self->data) {
+      rc = clib_batch_write(self->batch, self->path, self->data,
+                            self->data_size, self->mode, self->mtime, 1);
+      self->data = NULL;
+      self->data_size = 0;
+      break;
+    }
+    if (0 != fclose(self->file)) {
+      rc = -1;
+    }
+    self->file = NULL;
+#ifndef _WIN32
+    chmod(self->path, self->mode & 0777);
+#endif
+    if (self->mtime) {
+      struct utimbuf times = {self->mtime, self->mtime};
+      utime(self->path, &times);
+    }
+    if (self->selection && !self->selection->extracted) {
+      self->selection->extracted = 1;
+      // nothing else of the archive is needed
+      self->done = ++self->extracted == self->selections_count;
+    }
+    self->selection = NULL;
+    break;
+
+  case ENTRY_LONG_NAME:
+  case ENTRY_LONG_LINK:
+    free(ENTRY_LONG_NAME == self->kind ? self->long_name : self->long_link);
+    if (ENTRY_LONG_NAME == self->kind) {
+      self->long_name = field_string(self->meta, self->meta_size);
+    } else {
+      self->long_link = field_string(self->meta, self->meta_size);
+    }
+    break;
+
+  case ENTRY_PAX:
+    parse_pax(self);
+    break;
+
+  default:
+    break;
+  }
+
+  free(self->path);
+  self->path = NULL;
+  free(self->meta);
+  self->meta = NULL;
+  self->meta_size = 0;
+  self->kind = ENTRY_SKIP;
+
+  return rc;
+}
+
+/**
+ * Starts the entry described by the header that was just read
+ */
+
+static int start_entry(clib_archive_t *self) {
+  const char *header = self->header;
+  char type = header[156];
+  char *name = NULL;
+  char *link = NULL;
+  size_t length = 0;
+  int rc = 0;
+
+  self->remaining = parse_number(header + 124, 12);
+  self->padding = (TAR_BLOCK_SIZE - self->remaining % TAR_BLOCK_SIZE) %
+                  TAR_BLOCK_SIZE;
+  self->kind = ENTRY_SKIP;
+
+  if ('L' == type || 'K' == type || 'x' == type) {
+    if (self->remaining > ARCHIVE_META_MAX ||
+        !(self->meta = malloc(self->remaining + 1))) {
+      return -1;
+    }
+    self->kind = 'L' == type ? ENTRY_LONG_NAME
+                             : 'K' == type ? ENTRY_LONG_LINK : ENTRY_PAX;
+    return 0 == self->remaining ? finish_entry(self) : 0;
+  }
+
+  if ('g' == type) {
+    return 0 == self->remaining ? finish_entry(self) : 0;
+  }
+
+  if (self->long_name) {
+    name = self->long_name;
+    self->long_name = NULL;
+  } else if (0 == memcmp(header + 257, "ustar", 5) && header[345]) {
+    char *prefix = field_string(header + 345, 155);
+    char *base = field_string(header + 0, 100);
+    if (prefix && base) {
+      asprintf(&name, "%s/%s", prefix, base);
+    }
+    free(prefix);
+    free(base);
+  } else {
+    name = field_string(header + 0, 100);
+  }
+
+  if (self->long_link) {
+    link = self->long_link;
+    self->long_link = NULL;
+  } else {
+    link = field_string(header + 157, 100);
+  }
+
+  if (!name || !link) {
+    rc = -1;
+    goto cleanup;
+  }
+
+  while (0 == strncmp(name, "./", 2)) {
+    memmove(name, name + 2, strlen(name + 2) + 1);
+  }
+
+  length = strlen(name);
+  while (length > 0 && '/' == name[length - 1]) {
+    name[--length] = 0;
+  }
+
+  if (self->selections_count > 0) {
+    // the top level directory is named after the repository and version
+    char *relative = strchr(name, '/');
+
+    for (size_t i = 0; relative && i < self->selections_count; i++) {
+      if (0 == strcmp(relative + 1, self->selections[i].name)) {
+        self->selection = &self->selections[i];
+        break;
+      }
+    }
+
+    // only regular files are selected
+    if (!self->selection || ('0' != type && '\0' != type && '7' != type)) {
+      self->selection = NULL;
+      goto cleanup;
+    }
+
+    if (!(self->path = strdup(self->selection->path))) {
+      self->selection = NULL;
+      rc = -1;
+      goto cleanup;
+    }
+  } else if (!is_safe_path(name)) {
+    goto cleanup;
+  } else if (-1 == asprintf(&self->path, "%s/%s", self->dir, name)) {
+    self->path = NULL;
+    rc = -1;
+    goto cleanup;
+  }
+
+  switch (type) {
+  case '0':
+  case '\0':
+  case '7':
+    mkdir_parent(self->path);
+    self->mode = (unsigned)parse_number(header + 100, 8);
+    self->mtime = (time_t)parse_number(header + 136, 12);
+
+    if (self->batch && 0 == self->selections_count &&
+        self->remaining <= ARCHIVE_BATCH_FILE_MAX) {
+      if (!(self->data = malloc(self->remaining ? self->remaining : 1))) {
+        rc = -1;
+        goto cleanup;
+      }
+      self->kind = ENTRY_FILE;
+      break;
+    }
+
+    // the files before it are written first, in case one has its path
+    if (0 != flush_batch(self)) {
+      rc = -1;
+      goto cleanup;
+    }
+    // it may be a hard link to a file that must not change
+    unlink(self->path);
+    if (!(self->file = fopen(self->path, "wb"))) {
+      rc = -1;
+      goto cleanup;
+    }
+    self->kind = ENTRY_FILE;
+    break;
+
+  case '5':
+    clib_mkdirp(self->path, 0755);
+    break;
+
+#ifndef _WIN32
+  case '2':
+    // links out of the tree would let later entries escape it
+    if (is_safe_path(link) && 0 == flush_batch(self)) {
+      mkdir_parent(self->path);
+      unlink(self->path);
+      symlink(link, self->path);
+    }
+    break;
+#endif
+
+  default:
+    break;
+  }
+
+cleanup:
+  free(name);
+  free(link);
+
+  if (0 == rc && 0 == self->remaining) {
+    rc = finish_entry(self);
+  }
+
+  return rc;
+}
+
+static int read_header(clib_archive_t *self) {
+  int empty = 1;
+
+  for (int i = 0; i < TAR_BLOCK_SIZE && empty; i++) {
+    empty = 0 == self->header[i];
+  }
+
+  // two empty blocks end the archive
+  if (empty) {
+    self->done = 2 == ++self->zero_blocks;
+    return 0;
+  }
+
+  self->zero_blocks = 0;
+
+  if (!valid_checksum(self->header)) {
+    return -1;
+  }
+
+  return start_entry(self);
+}
+
+static int is_complete(clib_archive_t *self) {
+  return self->selections_count > 0 &&
+         self->extracted == self->selections_count;
+}
+
+static int write_tar(clib_archive_t *self, const char *data, size_t size) {
+  while (size > 0 && !self->done) {
+    size_t n = 0;
+
+    if (self->remaining > 0) {
+      n = self->remaining < size ? (size_t)self->remaining : size;
+
+      if (ENTRY_FILE == self->kind && self->data) {
+        memcpy(self->data + self->data_size, data, n);
+        self->data_size += n;
+      } else if (ENTRY_FILE == self->kind &&
+                 n != fwrite(data, 1, n, self->file)) {
+        return -1;
+      }
+
+      if (self->meta) {
+        memcpy(self->meta + self->meta_size, data, n);
+        self->meta_size += n;
+      }
+
+      self->remaining -= n;
+      if (0 == self->remaining && 0 != finish_entry(self)) {
+        return -1;
+      }
+    } else if (self->padding > 0) {
+      n = self->padding < size ? self->padding : size;
+      self->padding -= n;
+    } else {
+      n = TAR_BLOCK_SIZE - self->header_size;
+      n = n < size ? n : size;
+      memcpy(self->header + self->header_size, data, n);
+      self->header_size += n;
+
+      if (TAR_BLOCK_SIZE == self->header_size) {
+        self->header_size = 0;
+        if (0 != read_header(self)) {
+          return -1;
+        }
+      }
+    }
+
+    data += n;
+    size -= n;
+  }
+
+  return 0;
+}
+
+clib_archive_t *clib_archive_new(const char *dir) {
+  clib_archive_t *self = malloc(sizeof(clib_archive_t));
+
+  if (NULL == self) {
+    return NULL;
+  }
+
+  memset(self, 0, sizeof(clib_archive_t));
+
+  // 16 + MAX_WBITS only accepts a gzip wrapper
+  if (!(self->dir = strdup(dir)) ||
+      !(self->buffer = malloc(ARCHIVE_BUFFER_SIZE)) ||
+      Z_OK != inflateInit2(&self->stream, 16 + MAX_WBITS)) {
+    free(self->dir);
+    free(self->buffer);
+    free(self);
+    return NULL;
+  }
+
+  clib_mkdirp(self->dir, 0755);
+
+  // without a batch each file is streamed to disk as it is read
+  if (clib_batch_enabled()) {
+    self->batch = clib_batch_new();
+  }
+
+  return self;
+}
+
+int clib_archive_write(clib_archive_t *self, const char *buffer, size_t size) {
+  if (NULL == self || self->failed) {
+    return -1;
+  }
+
+  if (is_complete(self)) {
+    return 1;
+  }
+
+  self->stream.next_in = (Bytef *)buffer;
+  self->stream.avail_in = (uInt)size;
+
+  while (self->stream.avail_in > 0 && !is_complete(self)) {
+    int rc = Z_OK;
+
+    // concatenated gzip members form one stream
+    if (self->stream_end) {
+      if (Z_OK != inflateReset(&self->stream)) {
+        self->failed = 1;
+        return -1;
+      }
+      self->stream_end = 0;
+    }
+
+    do {
+      self->stream.next_out = (Bytef *)self->buffer;
+      self->stream.avail_out = ARCHIVE_BUFFER_SIZE;
+
+      rc = inflate(&self->stream, Z_NO_FLUSH);
+
+      if (Z_OK != rc && Z_STREAM_END != rc && Z_BUF_ERROR != rc) {
+        self->failed = 1;
+        return -1;
+      }
+
+      if (0 != write_tar(self, self->buffer,
+                         ARCHIVE_BUFFER_SIZE - self->stream.avail_out)) {
+        self->failed = 1;
+        return -1;
+      }
+    } while (0 == self->stream.avail_out && Z_STREAM_END != rc);
+
+    if (Z_STREAM_END == rc) {
+      self->stream_end = 1;
+    } else if (Z_BUF_ERROR == rc) {
+      break;
+    }
+  }
+
+  return is_complete(self) ? 1 : 0;
+}
+
+#ifdef HAVE_LIBDEFLATE
+
+/**
+ * Inflates every gzip member of `buffer` in one call each
+ *
+ * @return The tarball, `*tar_size` bytes long, or NULL on error
+ */
+
+static char *inflate_whole(const char *buffer, size_t size, size_t *tar_size) {
+  struct libdeflate_decompressor *decompressor = NULL;
+  const unsigned char *trailer = (const unsigned char *)buffer + size - 4;
+  char *tar = NULL;
+  size_t capacity = 0;
+  size_t used = 0;
+
+  if (size < 18 || !(decompressor = libdeflate_alloc_decompressor())) {
+    return NULL;
+  }
+
+  // the trailer holds the size of the last member, modulo 4GiB; deflate
+  // can't do better than about 1032 to 1
+  capacity = (size_t)trailer[0] | (size_t)trailer[1] << 8 |
+             (size_t)trailer[2] << 16 | (size_t)trailer[3] << 24;
+  if (capacity / 1032 > size) {
+    capacity = size * 4;
+  }
+  capacity = capacity < ARCHIVE_BUFFER_SIZE ? ARCHIVE_BUFFER_SIZE : capacity;
+
+  if (!(tar = malloc(capacity))) {
+    goto error;
+  }
+
+  // concatenated gzip members form one stream
+  while (size > 0) {
+    size_t in = 0;
+    size_t out = 0;
+    enum libdeflate_result rc = libdeflate_gzip_decompress_ex(
+        decompressor, buffer, size, tar + used, capacity - used, &in, &out);
+
+    if (LIBDEFLATE_INSUFFICIENT_SPACE == rc) {
+      char *grown = realloc(tar, capacity * 2);
+
+      if (!grown) {
+        goto error;
+      }
+
+      tar = grown;
+      capacity *= 2;
+      continue;
+    }
+
+    if (LIBDEFLATE_SUCCESS != rc) {
+      goto error;
+    }
+
+    buffer += in;
+    size -= in;
+    used += out;
+  }
+
+  libdeflate_free_decompressor(decompressor);
+  *tar_size = used;
+  return tar;
+
+error:
+  libdeflate_free_decompressor(decompressor);
+  free(tar);
+  return NULL;
+}
+
+#endif
+
+/**
+ * Extracts a tarball that is already whole in `buffer`
+ */
+
+static int write_whole(clib_archive_t *self, const char *buffer,
+                       size_t size) {
+#ifdef HAVE_LIBDEFLATE
+  size_t tar_size = 0;
+  char *tar = inflate_whole(buffer, size, &tar_size);
+  int rc = tar ? write_tar(self, tar, tar_size) : -1;
+
+  free(tar);
+
+  if (0 != rc) {
+    self->failed = 1;
+    return -1;
+  }
+
+  self->stream_end = 1;
+  return 0;
+#else
+  return clib_archive_write(self, buffer, size) < 0 ? -1 : 0;
+#endif
+}
+
+int clib_archive_finish(clib_archive_t *self) {
+  if (NULL == self || self->failed || 0 != flush_batch(self)) {
+    return -1;
+  }
+
+  if (self->selections_count > 0) {
+    return is_complete(self) ? 0 : -1;
+  }
+
+  if (!self->stream_end) {
+    return -1;
+  }
+
+  // some writers leave out the end of archive blocks
+  if (!self->done &&
+      (self->header_size > 0 || self->remaining > 0 || self->file ||
+       self->data)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int clib_archive_select(clib_archive_t *self, const char *name,
+                        const char *path) {
+  clib_archive_selection_t *selections = NULL;
+  clib_archive_selection_t *selection = NULL;
+
+  if (NULL == self || NULL == name || NULL == path) {
+    return -1;
+  }
+
+  selections = realloc(self->selections, (self->selections_count + 1) *
+                                             sizeof(clib_archive_selection_t));
+  if (NULL == selections) {
+    return -1;
+  }
+
+  self->selections = selections;
+  selection = &selections[self->selections_count];
+  selection->extracted = 0;
+
+  if (!(selection->name = strdup(name)) ||
+      !(selection->path = strdup(path))) {
+    free(selection->name);
+    return -1;
+  }
+
+  (void)self->selections_count++;
+  return 0;
+}
+
+void clib_archive_free(clib_archive_t *self) {
+  if (NULL == self) {
+    return;
+  }
+
+  for (size_t i = 0; i < self->selections_count; i++) {
+    free(self->selections[i].name);
+    free(self->selections[i].path);
+  }
+
+  if (self->file) {
+    fclose(self->file);
+  }
+
+  clib_batch_free(self->batch);
+  inflateEnd(&self->stream);
+  free(self->data);
+  free(self->dir);
+  free(self->buffer);
+  free(self->path);
+  free(self->meta);
+  free(self->long_name);
+  free(self->long_link);
+  free(self->selections);
+  free(self);
+}
+
+int clib_archive_extract_buffer(const char *buffer, size_t size,
+                                const char *dir) {
+  clib_archive_t *self = clib_archive_new(dir);
+  int rc = -1;
+
+  if (self && 0 == write_whole(self, buffer, size)) {
+    rc = clib_archive_finish(self);
+  }
+
+  clib_archive_free(self);
+  return rc;
+}
+
+int clib_archive_extract(const char *file, const char *dir) {
+  fs_mapping mapping;
+  int rc = -1;
+
+  if (0 != fs_map(file, &mapping)) {
+    return -1;
+  }
+
+  rc = clib_archive_extract_buffer(mapping.data, mapping.size, dir);
+  fs_unmap(&mapping);
+  return rc;
+}
+
+#else
+
+clib_archive_t *clib_archive_new(const char *dir) { return NULL; }
+
+int clib_archive_write(clib_archive_t *self, const char *buffer, size_t size) {
+  return -1;
+}
+
+int clib_archive_finish(clib_archive_t *self) { return -1; }
+
+int clib_archive_select(clib_archive_t *self, const char *name,
+                        const char *path) {
+  return -1;
+}
+
+void clib_archive_free(clib_archive_t *self) {}
+
+int clib_archive_extract_buffer(const char *buffer, size_t size,
+                                const char *dir) {
+  return -1;
+}
+
+int clib_archive_extract(const char *file, const char *dir) {
+  char *argv[] = {"tar", "-xzf", (char *)file, "-C", (char *)dir, NULL};
+
+  clib_mkdirp(dir, 0755);
+
+  return 0 == clib_spawn(argv, NULL) ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,74 @@
+//
+// clib-archive.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_ARCHIVE_H
+#define CLIB_ARCHIVE_H 1
+
+#include <stddef.h>
+
+typedef struct clib_archive clib_archive_t;
+
+/**
+ * Starts extracting a gzip compressed tarball into `dir`, which is
+ * created if needed. The tarball is handed over chunk by chunk with
+ * `clib_archive_write()`, so it can be extracted while it downloads.
+ * Entries with absolute paths or `..` components are skipped.
+ *
+ * @return A new extractor, or NULL on error or when clib was built
+ * without zlib
+ */
+clib_archive_t *clib_archive_new(const char *dir);
+
+/**
+ * Extracts the next `size` bytes of the tarball
+ *
+ * @return 0 on success, 1 once every selected entry was extracted, -1 if
+ * the archive is malformed or a file can't be written
+ */
+int clib_archive_write(clib_archive_t *self, const char *buffer, size_t size);
+
+/**
+ * Writes the files still held back to be written together.
+ *
+ * @return 0 if the whole archive, or every selected entry, was extracted,
+ * -1 if it was cut short or any write failed
+ */
+int clib_archive_finish(clib_archive_t *self);
+
+void clib_archive_free(clib_archive_t *self);
+
+/**
+ * Extracts the entry `name` to `path` instead, and once any entry is
+ * selected, nothing else. `name` is relative to the top level directory
+ * of the archive, like `src/foo.c` for `foo-1.0.0/src/foo.c`. When every
+ * selected entry was extracted `clib_archive_write()` returns 1, so the
+ * rest of the archive doesn't need to be downloaded.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_archive_select(clib_archive_t *self, const char *name,
+                        const char *path);
+
+/**
+ * Extracts the gzip compressed tarball of `size` bytes at `buffer` into
+ * `dir`. When clib is built with libdeflate it is inflated in one call
+ * rather than streamed through zlib.
+ *
+ * @return 0 on success, -1 otherwise, or when clib was built without zlib
+ */
+int clib_archive_extract_buffer(const char *buffer, size_t size,
+                                const char *dir);
+
+/**
+ * Extracts the gzip compressed tarball `file` into `dir`, with `gzip`
+ * and `tar` when clib was built without zlib
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_archive_extract(const char *file, const char *dir);
+
+#endif
@@ -0,0 +1,134 @@
+//
+// clib-arena.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CLIB_ARENA_ALIGN 16
+#define CLIB_ARENA_MIN_CHUNK 1024
+#define CLIB_ARENA_ROUND(size)                                                 \
+  (((size) + CLIB_ARENA_ALIGN - 1) & ~(size_t)(CLIB_ARENA_ALIGN - 1))
+
+typedef struct clib_arena_chunk {
+  struct clib_arena_chunk *next;
+  size_t size;
+  size_t used;
+} clib_arena_chunk_t;
+
+struct clib_arena {
+  clib_arena_chunk_t *chunks;
+};
+
+#define CLIB_ARENA_HEADER CLIB_ARENA_ROUND(sizeof(clib_arena_chunk_t))
+#define CLIB_ARENA_DATA(chunk) ((char *)(chunk) + CLIB_ARENA_HEADER)
+
+clib_arena_t *clib_arena_new(size_t size) {
+  size_t header = CLIB_ARENA_ROUND(sizeof(clib_arena_t));
+  clib_arena_t *self = malloc(header + CLIB_ARENA_HEADER + size);
+  clib_arena_chunk_t *chunk = NULL;
+
+  if (NULL == self) {
+    return NULL;
+  }
+
+  chunk = (clib_arena_chunk_t *)((char *)self + header);
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+  self->chunks = chunk;
+  return self;
+}
+
+/**
+ * @return `size` bytes from the current chunk, or a new one, starting
+ * `align` bytes into it
+ */
+
+static void *allocate(clib_arena_t *self, size_t size, size_t align) {
+  clib_arena_chunk_t *chunk = self->chunks;
+  size_t offset = (chunk->used + align - 1) & ~(align - 1);
+
+  if (offset > chunk->size || chunk->size - offset < size) {
+    size_t chunk_size = chunk->size * 2;
+
+    if (chunk_size < size) {
+      chunk_size = size;
+    }
+
+    if (chunk_size < CLIB_ARENA_MIN_CHUNK) {
+      chunk_size = CLIB_ARENA_MIN_CHUNK;
+    }
+
+    if (!(chunk = malloc(CLIB_ARENA_HEADER + chunk_size))) {
+      return NULL;
+    }
+
+    chunk->next = self->chunks;
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    self->chunks = chunk;
+    offset = 0;
+  }
+
+  chunk->used = offset + size;
+  return CLIB_ARENA_DATA(chunk) + offset;
+}
+
+void *clib_arena_alloc(clib_arena_t *self, size_t size) {
+  return self ? allocate(self, size, CLIB_ARENA_ALIGN) : NULL;
+}
+
+char *clib_arena_strdup(clib_arena_t *self, const char *str) {
+  return str ? clib_arena_strndup(self, str, strlen(str)) : NULL;
+}
+
+char *clib_arena_strndup(clib_arena_t *self, const char *str, size_t length) {
+  char *copy = NULL;
+
+  if (!self || !str) {
+    return NULL;
+  }
+
+  // strings don't need any alignment
+  if ((copy = allocate(self, length + 1, 1))) {
+    memcpy(copy, str, length);
+    copy[length] = 0;
+  }
+
+  return copy;
+}
+
+int clib_arena_owns(const clib_arena_t *self, const void *ptr) {
+  const clib_arena_chunk_t *chunk = self ? self->chunks : NULL;
+
+  for (; chunk && ptr; chunk = chunk->next) {
+    const char *data = CLIB_ARENA_DATA(chunk);
+
+    if ((const char *)ptr >= data && (const char *)ptr < data + chunk->size) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+void clib_arena_free(clib_arena_t *self) {
+  clib_arena_chunk_t *chunk = NULL;
+
+  if (NULL == self) {
+    return;
+  }
+
+  // the last chunk is the first, allocated with the arena
+  while ((chunk = self->chunks) && chunk->next) {
+    self->chunks = chunk->next;
+    free(chunk);
+  }
+
+  free(self);
+}
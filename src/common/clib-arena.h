@@ -0,0 +1,54 @@
+//
+// clib-arena.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_ARENA_H
+#define CLIB_ARENA_H 1
+
+#include <stddef.h>
+
+/**
+ * Memory given out in order from large chunks, all released at once. It
+ * is meant for the strings of one object, a manifest for instance, which
+ * then live as long as it does and don't need to be freed one by one.
+ */
+
+typedef struct clib_arena clib_arena_t;
+
+/**
+ * Creates an arena whose first chunk, allocated along with it, holds
+ * `size` bytes. Later chunks are allocated as it runs out.
+ *
+ * @return A new arena, or NULL on error
+ */
+clib_arena_t *clib_arena_new(size_t size);
+
+/**
+ * @return `size` bytes, aligned for any type, or NULL on error
+ */
+void *clib_arena_alloc(clib_arena_t *self, size_t size);
+
+/**
+ * @return A copy of `str` in the arena, or NULL on error or if `str` is
+ * NULL
+ */
+char *clib_arena_strdup(clib_arena_t *self, const char *str);
+
+/**
+ * @return A null-terminated copy of the `length` bytes at `str` in the
+ * arena, or NULL on error
+ */
+char *clib_arena_strndup(clib_arena_t *self, const char *str, size_t length);
+
+/**
+ * @return 1 if `ptr` was given out by the arena, so must not be freed on
+ * its own, 0 otherwise
+ */
+int clib_arena_owns(const clib_arena_t *self, const void *ptr);
+
+void clib_arena_free(clib_arena_t *self);
+
+#endif
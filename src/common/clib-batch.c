@@ -0,0 +1,603 @@
+//
+// clib-batch.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _GNU_SOURCE
+
+#include "clib-batch.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// writes on a file opened earlier in the same chain need 5.17
+#ifdef IORING_FEAT_LINKED_FILE
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// files written together, each taking a slot of the ring's file table
+#define BATCH_FILES 64
+// unlink, open, write and close
+#define BATCH_OPS 4
+// bytes held before the batch is written
+#define BATCH_BYTES (8 * 1024 * 1024)
+// fewer files than this aren't worth setting a ring up for
+#define BATCH_MIN_FILES 4
+
+typedef struct {
+  char *path;
+  char *data;
+  size_t size;
+  unsigned mode;
+  time_t mtime;
+  int take;
+  int failed;
+} batch_file_t;
+
+#ifdef HAVE_IO_URING
+typedef struct {
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+} batch_ring_t;
+#endif
+
+struct clib_batch {
+  batch_file_t files[BATCH_FILES];
+  int count;
+  size_t bytes;
+  int failed;
+#ifdef HAVE_IO_URING
+  batch_ring_t ring;
+  // 1 once set up, -1 when it can't be
+  int ring_state;
+#endif
+};
+
+/**
+ * @return The umask of the process, without changing it, or -1 if it
+ * can't be told
+ */
+
+static int current_umask(void) {
+  static int mask = -2;
+
+#ifdef __linux__
+  if (-2 == mask) {
+    FILE *status = fopen("/proc/self/status", "r");
+    char line[128];
+    int found = -1;
+
+    while (status && -1 == found && fgets(line, sizeof(line), status)) {
+      if (0 == strncmp(line, "Umask:", 6)) {
+        found = (int)strtol(line + 6, NULL, 8);
+      }
+    }
+
+    if (status) {
+      fclose(status);
+    }
+
+    mask = found;
+  }
+#else
+  mask = -1;
+#endif
+
+  return mask;
+}
+
+/**
+ * Gives `file` the permissions and modification time it was written
+ * with, once its contents are there.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+
+static int finish_file(batch_file_t *file) {
+  int mask = current_umask();
+  int rc = 0;
+
+  // it was opened with its mode and writable by its owner, and the umask
+  // may have taken some away
+  if (-1 == mask || (file->mode & (unsigned)mask) || !(file->mode & 0200)) {
+#ifndef _WIN32
+    rc = chmod(file->path, file->mode);
+#else
+    chmod(file->path, file->mode & (S_IREAD | S_IWRITE));
+#endif
+  }
+
+  if (0 == rc && file->mtime) {
+    struct utimbuf times = {file->mtime, file->mtime};
+    rc = utime(file->path, &times);
+  }
+
+  return rc;
+}
+
+/**
+ * Writes `file` with a system call for each step.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+
+static int write_file(batch_file_t *file) {
+  int fd = -1;
+  int rc = 0;
+
+  // it may be a hard link to a file that must not change
+  unlink(file->path);
+
+  if (-1 == (fd = open(file->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC |
+                                       O_BINARY,
+                       file->mode | 0200))) {
+    return -1;
+  }
+
+  for (size_t written = 0; 0 == rc && written < file->size;) {
+    ssize_t n = write(fd, file->data + written, file->size - written);
+
+    if (n < 0 && EINTR == errno) {
+      continue;
+    }
+
+    if (n <= 0) {
+      rc = -1;
+    } else {
+      written += (size_t)n;
+    }
+  }
+
+  if (0 != close(fd)) {
+    rc = -1;
+  }
+
+  return 0 == rc ? finish_file(file) : -1;
+}
+
+static void release_file(batch_file_t *file) {
+  free(file->path);
+
+  if (file->take) {
+    free(file->data);
+  }
+
+  memset(file, 0, sizeof(batch_file_t));
+}
+
+#ifdef HAVE_IO_URING
+
+static int uring_disabled(void) {
+  const char *env = getenv("CLIB_IO_URING");
+  return env && 0 == strcmp(env, "0");
+}
+
+static void ring_free(batch_ring_t *ring) {
+  if (ring->sqes) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+
+  if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+
+  if (ring->sq_ring) {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+
+  if (ring->fd > 0) {
+    close(ring->fd);
+  }
+
+  memset(ring, 0, sizeof(batch_ring_t));
+}
+
+/**
+ * Sets up a ring for a whole batch, with an empty slot in its file table
+ * for each of the files.
+ *
+ * @return 0 on success, -1 if the kernel can't do what batches need
+ */
+
+static int ring_init(batch_ring_t *ring) {
+  struct io_uring_params params;
+  int fds[BATCH_FILES];
+  char *sq = NULL;
+  char *cq = NULL;
+
+  memset(&params, 0, sizeof(params));
+  memset(ring, 0, sizeof(batch_ring_t));
+
+  ring->fd = (int)syscall(__NR_io_uring_setup, BATCH_FILES * BATCH_OPS,
+                          &params);
+
+  if (ring->fd < 0) {
+    ring->fd = 0;
+    return -1;
+  }
+
+  if (!(params.features & IORING_FEAT_LINKED_FILE)) {
+    ring_free(ring);
+    return -1;
+  }
+
+  ring->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+      ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->cq_ring_size = ring->sq_ring_size;
+  }
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+  if (MAP_FAILED == ring->sq_ring) {
+    ring->sq_ring = NULL;
+    ring_free(ring);
+    return -1;
+  }
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_ring = ring->sq_ring;
+  } else {
+    ring->cq_ring =
+        mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+    if (MAP_FAILED == ring->cq_ring) {
+      ring->cq_ring = NULL;
+      ring_free(ring);
+      return -1;
+    }
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+  if (MAP_FAILED == ring->sqes) {
+    ring->sqes = NULL;
+    ring_free(ring);
+    return -1;
+  }
+
+  sq = ring->sq_ring;
+  cq = ring->cq_ring;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  for (int i = 0; i < BATCH_FILES; i++) {
+    fds[i] = -1;
+  }
+
+  if (0 != syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES,
+                   fds, BATCH_FILES)) {
+    ring_free(ring);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @return The next free entry of the submission queue, cleared
+ */
+
+static struct io_uring_sqe *ring_sqe(batch_ring_t *ring, unsigned *tail) {
+  unsigned index = *tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  ring->sq_array[index] = index;
+  (void)(*tail)++;
+  return sqe;
+}
+
+/**
+ * Queues the chain writing the file in slot `slot`: unlinking whatever
+ * is there first, whether or not that works, then opening it into the
+ * slot, writing it, and closing the slot even when the write failed.
+ */
+
+static void queue_file(batch_ring_t *ring, unsigned *tail, int slot,
+                       batch_file_t *file) {
+  struct io_uring_sqe *sqe = NULL;
+  uint64_t data = (uint64_t)slot * BATCH_OPS;
+
+  sqe = ring_sqe(ring, tail);
+  sqe->opcode = IORING_OP_UNLINKAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uintptr_t)file->path;
+  sqe->flags = IOSQE_IO_HARDLINK;
+  sqe->user_data = data;
+
+  sqe = ring_sqe(ring, tail);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uintptr_t)file->path;
+  sqe->len = file->mode | 0200;
+  sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  sqe->file_index = slot + 1;
+  sqe->flags = IOSQE_IO_LINK;
+  sqe->user_data = data + 1;
+
+  if (file->size > 0) {
+    sqe = ring_sqe(ring, tail);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = slot;
+    sqe->addr = (uintptr_t)file->data;
+    sqe->len = (unsigned)file->size;
+    sqe->off = 0;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    sqe->user_data = data + 2;
+  }
+
+  sqe = ring_sqe(ring, tail);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->file_index = slot + 1;
+  sqe->user_data = data + 3;
+}
+
+/**
+ * Has the kernel write every file of `self`, marking those that failed
+ * at any step.
+ *
+ * @return 0 on success, -1 if the ring broke down
+ */
+
+static int ring_write(clib_batch_t *self) {
+  batch_ring_t *ring = &self->ring;
+  unsigned tail = *ring->sq_tail;
+  unsigned queued = 0;
+  unsigned completed = 0;
+
+  for (int i = 0; i < self->count; i++) {
+    queue_file(ring, &tail, i, &self->files[i]);
+  }
+
+  queued = tail - *ring->sq_tail;
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+  while (completed < queued) {
+    unsigned head = __atomic_load_n(ring->cq_head, __ATOMIC_ACQUIRE);
+    unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned unsubmitted =
+        tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    for (; head != cq_tail; head++) {
+      struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+      batch_file_t *file = &self->files[cqe->user_data / BATCH_OPS];
+      unsigned op = (unsigned)(cqe->user_data % BATCH_OPS);
+
+      // unlinking nothing is fine
+      if (0 != op && cqe->res < 0) {
+        file->failed = 1;
+      } else if (2 == op && (size_t)cqe->res != file->size) {
+        file->failed = 1;
+      }
+
+      (void)completed++;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    if (completed == queued) {
+      break;
+    }
+
+    if (syscall(__NR_io_uring_enter, ring->fd, unsubmitted, queued - completed,
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        EINTR != errno) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @return Whether `self` writes through a ring, setting it up when first
+ * asked
+ */
+
+static int use_ring(clib_batch_t *self) {
+  if (0 == self->ring_state) {
+    self->ring_state = 0 == ring_init(&self->ring) ? 1 : -1;
+  }
+
+  return 1 == self->ring_state;
+}
+
+#endif
+
+int clib_batch_enabled(void) {
+#ifdef HAVE_IO_URING
+  static int enabled = -1;
+
+  if (-1 == enabled) {
+    batch_ring_t ring;
+
+    // racing threads agree on the answer
+    enabled = !uring_disabled() && 0 == ring_init(&ring);
+
+    if (enabled) {
+      ring_free(&ring);
+    }
+  }
+
+  return enabled;
+#else
+  return 0;
+#endif
+}
+
+clib_batch_t *clib_batch_new(void) {
+  return calloc(1, sizeof(clib_batch_t));
+}
+
+int clib_batch_write(clib_batch_t *self, const char *path, char *data,
+                     size_t size, unsigned mode, time_t mtime, int take) {
+  batch_file_t file = {NULL, data, size, mode & 0777, mtime, take, 0};
+  int rc = 0;
+
+  if (!self || !path || (size > 0 && !data)) {
+    if (take) {
+      free(data);
+    }
+    return -1;
+  }
+
+  if (!(file.path = strdup(path))) {
+    release_file(&file);
+    return -1;
+  }
+
+  // larger files don't fit a single write of the ring
+  if (!clib_batch_enabled() || size > UINT32_MAX) {
+    rc = write_file(&file);
+    release_file(&file);
+    return rc;
+  }
+
+  // chains of the ring run in any order, so a path is only queued once
+  for (int i = 0; i < self->count; i++) {
+    if (0 == strcmp(self->files[i].path, file.path)) {
+      rc = clib_batch_flush(self);
+      break;
+    }
+  }
+
+  self->files[self->count++] = file;
+  self->bytes += size;
+
+  if (BATCH_FILES == self->count || self->bytes >= BATCH_BYTES) {
+    return clib_batch_flush(self);
+  }
+
+  return rc;
+}
+
+int clib_batch_flush(clib_batch_t *self) {
+  int rc = 0;
+
+  if (!self) {
+    return -1;
+  }
+
+#ifdef HAVE_IO_URING
+  if (self->count >= BATCH_MIN_FILES && use_ring(self)) {
+    if (0 != ring_write(self)) {
+      // which files it wrote can't be told, so they are all written again
+      for (int i = 0; i < self->count; i++) {
+        self->files[i].failed = 1;
+      }
+
+      ring_free(&self->ring);
+      self->ring_state = -1;
+    }
+
+    for (int i = 0; i < self->count; i++) {
+      batch_file_t *file = &self->files[i];
+
+      if (!file->failed && 0 == finish_file(file)) {
+        release_file(file);
+      }
+    }
+  }
+#endif
+
+  // what the ring didn't write, or all of it without one, with the
+  // system calls telling why it fails
+  for (int i = 0; i < self->count; i++) {
+    batch_file_t *file = &self->files[i];
+
+    if (file->path && 0 != write_file(file)) {
+      rc = -1;
+    }
+
+    release_file(file);
+  }
+
+  self->count = 0;
+  self->bytes = 0;
+
+  if (0 != rc) {
+    self->failed = 1;
+  }
+
+  return self->failed ? -1 : 0;
+}
+
+void clib_batch_free(clib_batch_t *self) {
+  if (!self) {
+    return;
+  }
+
+  for (int i = 0; i < self->count; i++) {
+    release_file(&self->files[i]);
+  }
+
+#ifdef HAVE_IO_URING
+  if (1 == self->ring_state) {
+    ring_free(&self->ring);
+  }
+#endif
+
+  free(self);
+}
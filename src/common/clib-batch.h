@@ -0,0 +1,56 @@
+//
+// clib-batch.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_BATCH_H
+#define CLIB_BATCH_H 1
+
+#include <stddef.h>
+#include <time.h>
+
+typedef struct clib_batch clib_batch_t;
+
+/**
+ * Starts a batch of whole files to write. On Linux with io_uring they are
+ * written a few dozen at a time, each unlinked, opened, written and closed
+ * by the kernel without a system call of their own. Elsewhere, or with
+ * `CLIB_IO_URING=0`, every file is written right away.
+ *
+ * @return A new batch, or NULL on error
+ */
+clib_batch_t *clib_batch_new(void);
+
+/**
+ * @return Whether the files of a batch are written together, rather than
+ * each right away
+ */
+int clib_batch_enabled(void);
+
+/**
+ * Writes `size` bytes of `data` to a new file at `path`, replacing any
+ * file or link there, with the permissions `mode` and the modification
+ * time `mtime` unless it is 0. The directory must exist. When `take` is
+ * set the batch frees `data` once written, otherwise it must be kept until
+ * the next `clib_batch_flush()`.
+ *
+ * @return 0 on success, -1 if the file can't be written
+ */
+int clib_batch_write(clib_batch_t *self, const char *path, char *data,
+                     size_t size, unsigned mode, time_t mtime, int take);
+
+/**
+ * Writes every file still queued.
+ *
+ * @return 0 if all of them were written, -1 otherwise
+ */
+int clib_batch_flush(clib_batch_t *self);
+
+/**
+ * Frees `self`, dropping the files that weren't flushed.
+ */
+void clib_batch_free(clib_batch_t *self);
+
+#endif
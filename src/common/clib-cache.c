@@ -5,16 +5,60 @@
 // MIT licensed
 //
 
+#define _POSIX_C_SOURCE 200809L
+// flock()
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+
 #include "clib-cache.h"
+#include "clib-batch.h"
+#include "clib-hash.h"
+#include "clib-mkdir.h"
+#include "clib-pool.h"
+#include "clib-remote.h"
+#include "clib-trace.h"
+#include "clib-walk.h"
 #include "copy/copy.h"
 #include "fs/fs.h"
-#include "rimraf/rimraf.h"
+#include "hash/hash.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
-#include <mkdirp/mkdirp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <utime.h>
+#endif
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+static pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define INDEX_LOCK() pthread_mutex_lock(&index_mutex)
+#define INDEX_UNLOCK() pthread_mutex_unlock(&index_mutex)
+#else
+#define INDEX_LOCK()
+#define INDEX_UNLOCK()
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
 #define GET_PKG_CACHE(a, n, v)                                                 \
   char pkg_cache[BUFSIZ];                                                      \
   package_cache_path(pkg_cache, a, n, v);
@@ -23,6 +67,18 @@
   char json_cache[BUFSIZ];                                                     \
   json_cache_path(json_cache, a, n, v);
 
+#define GET_PKG_INDEX(a, n, v)                                                 \
+  char pkg_index[BUFSIZ];                                                      \
+  package_index_path(pkg_index, a, n, v);
+
+#define GET_PKG_PACK(a, n, v)                                                  \
+  char pkg_pack[BUFSIZ];                                                       \
+  package_pack_path(pkg_pack, a, n, v);
+
+#define GET_VALIDATORS_CACHE(a, n, v)                                          \
+  char validators_cache[BUFSIZ];                                               \
+  validators_cache_path(validators_cache, a, n, v);
+
 #ifdef _WIN32
 #define BASE_DIR getenv("AppData")
 #else
@@ -30,167 +86,3280 @@
 #endif
 
 #define BASE_CACHE_PATTERN "%s/.cache/clib"
-#define PKG_CACHE_PATTERN "%s/%s_%s_%s"
-#define JSON_CACHE_PATTERN "%s/%s_%s_%s.json"
+// the entries of the packages, json and locks dirs are spread over this
+// many subdirectories, named after the hash of the entry like the store's
+#define SHARDS 256
+#define SHARD_PATTERN "%s/%02x"
+// in each of those dirs, once its entries were moved into their shards
+#define SHARDED_MARKER ".sharded"
+#define PKG_CACHE_PATTERN "%s/%02x/%s_%s_%s"
+#define PKG_INDEX_PATTERN "%s/%02x/%s_%s_%s.index"
+#define PKG_PACK_PATTERN "%s/%02x/%s_%s_%s.pack"
+#define OBJECT_PATTERN "%s/%.2s/%s"
+#define OBJECT_PATH_SIZE (BUFSIZ + CLIB_HASH_HEX_SIZE + 2)
+#define JSON_CACHE_PATTERN "%s/%02x/%s_%s_%s.json"
+#define VALIDATORS_CACHE_PATTERN "%s/%02x/%s_%s_%s.etag"
+#define MISSING_CACHE_PATTERN "%s/%02x/%s_%s_%s.%s.missing"
+#define ENTRY_PATTERN "%s_%s_%s"
+#define LOCK_PATTERN "%s/%02x/%s.lock"
+// executable trees are cached next to the sources, under their own name
+#define EXECUTABLE_NAME_PATTERN "%s.executable"
+// and so are build outputs, under the key of the build
+#define BUILD_NAME_PATTERN "%s.build-%s"
+#define REMOTE_INDEX_PATTERN "packages/%s_%s_%s.index"
+#define REMOTE_OBJECT_PATTERN "store/%.2s/%s"
+// taken shared by saves and exclusively while pruning the store
+#define STORE_LOCK "store"
+// taken while moving entries into their shards
+#define SHARDING_LOCK "sharding"
+// held by the process refreshing an expired entry
+#define SEARCH_REFRESH_LOCK "search.refresh"
+#define JSON_REFRESH_PATTERN ENTRY_PATTERN ".json.refresh"
+// held by the process fetching a package into the cache
+#define FETCH_LOCK_PATTERN ENTRY_PATTERN ".fetch"
+#define GIT_REPO_PATTERN "%s_%s.git"
+
+// staged files older than this are left over from killed processes
+#define STAGING_MAX_AGE (60 * 60)
+
+#define PACK_MAGIC "CLIBPAK1"
+#define INDEX_MAGIC "CLIBIDX1"
+#define INDEX_KEY_SIZE 192
+// rewrite the index once it holds this many superseded records
+#define INDEX_COMPACT_THRESHOLD 256
+
+typedef enum {
+  ENTRY_JSON = 0,
+  ENTRY_INDEX, // a package as an index of store objects
+  ENTRY_PACK,  // a package as a single pack file
+} entry_kind_t;
+
+/**
+ * The cache index is a header followed by fixed size records, appended
+ * to whenever an entry changes so the last record of a key wins.
+ */
+
+typedef struct {
+  char magic[8];
+  uint32_t record_size;
+  uint32_t reserved;
+} index_header_t;
+
+typedef struct {
+  char key[INDEX_KEY_SIZE]; // "author/name@version"
+  int64_t json_mtime;       // 0 when not cached
+  int64_t json_size;
+  int64_t package_mtime; // 0 when not cached
+  int64_t package_size;  // total size of the package files
+  int64_t package_atime; // last load, for LRU eviction
+  char package_hash[CLIB_HASH_HEX_SIZE]; // of the package file list
+  char package_packed;                   // stored as a pack, not an index
+  char reserved[6];
+} index_record_t;
+
+/**
+ * A pack holds a whole package version in one file: this header, then a
+ * payload that is zstd compressed when clib is built with it. Unpacked,
+ * the payload lists every file as a `pack_file_t`, its path and its
+ * content.
+ */
+
+typedef enum {
+  PACK_NONE = 0,
+  PACK_ZSTD,
+} pack_compression_t;
+
+typedef struct {
+  char magic[8];
+  uint32_t compression;
+  uint32_t count;
+  uint64_t size;        // of the unpacked payload
+  uint64_t packed_size; // of the payload as stored
+  char hash[CLIB_HASH_HEX_SIZE]; // of the unpacked payload
+  char reserved[7];
+} pack_header_t;
+
+typedef struct {
+  uint32_t mode;
+  uint32_t path_size; // including the terminating nul
+  uint64_t size;
+} pack_file_t;
 
 /** Portable PATH_MAX ? */
 static char package_cache_dir[BUFSIZ];
 static char search_cache[BUFSIZ];
+static char search_index_cache[BUFSIZ];
+static char search_etag_cache[BUFSIZ];
 static char json_cache_dir[BUFSIZ];
 static char meta_cache_dir[BUFSIZ];
+static char store_dir[BUFSIZ];
+static char staging_dir[BUFSIZ];
+static char locks_dir[BUFSIZ];
+static char git_dir[BUFSIZ];
+static unsigned long staging_counter = 0;
+static char index_path[BUFSIZ];
+static hash_t *index_records = NULL;
+static int index_fd = -1;
 static time_t expiration;
+static time_t missing_expiration = CLIB_CACHE_DEFAULT_MISSING_TIME;
+static time_t max_stale = CLIB_CACHE_DEFAULT_MAX_STALE;
+static clib_cache_link_t link_mode = CLIB_CACHE_LINK_AUTO;
+static int concurrency = CLIB_CACHE_DEFAULT_CONCURRENCY;
+static int packed_mode = 0;
+static int verify_mode = 0;
+static uint64_t max_size = 0;
+// bytes in the store, -1 until counted for the first eviction check
+static int64_t store_bytes = -1;
+static int pruning = 0;
+
+/**
+ * @return The shard of the entry or lock `name`, by its FNV-1a hash
+ */
+
+static unsigned shard_of(const char *name) {
+  uint32_t hash = 2166136261u;
+
+  for (; *name; name++) {
+    hash = (hash ^ (unsigned char)*name) * 16777619u;
+  }
+
+  return (hash ^ (hash >> 16)) % SHARDS;
+}
+
+static unsigned entry_shard(char *author, char *name, char *version) {
+  char entry[BUFSIZ];
+
+  snprintf(entry, sizeof(entry), ENTRY_PATTERN, author, name, version);
+  return shard_of(entry);
+}
 
 static void json_cache_path(char *pkg_cache, char *author, char *name,
                             char *version) {
-  sprintf(pkg_cache, JSON_CACHE_PATTERN, json_cache_dir, author, name, version);
+  sprintf(pkg_cache, JSON_CACHE_PATTERN, json_cache_dir,
+          entry_shard(author, name, version), author, name, version);
+}
+
+static void validators_cache_path(char *validators_cache, char *author,
+                                  char *name, char *version) {
+  sprintf(validators_cache, VALIDATORS_CACHE_PATTERN, json_cache_dir,
+          entry_shard(author, name, version), author, name, version);
 }
 
 static void package_cache_path(char *json_cache, char *author, char *name,
                                char *version) {
-  sprintf(json_cache, PKG_CACHE_PATTERN, package_cache_dir, author, name,
-          version);
+  sprintf(json_cache, PKG_CACHE_PATTERN, package_cache_dir,
+          entry_shard(author, name, version), author, name, version);
 }
 
-const char *clib_cache_dir(void) { return package_cache_dir; }
+static void package_index_path(char *pkg_index, char *author, char *name,
+                               char *version) {
+  sprintf(pkg_index, PKG_INDEX_PATTERN, package_cache_dir,
+          entry_shard(author, name, version), author, name, version);
+}
 
-static int check_dir(char *dir) {
-  if (0 != (fs_exists(dir))) {
-    return mkdirp(dir, 0700);
-  }
-  return 0;
+static void package_pack_path(char *pkg_pack, char *author, char *name,
+                              char *version) {
+  sprintf(pkg_pack, PKG_PACK_PATTERN, package_cache_dir,
+          entry_shard(author, name, version), author, name, version);
 }
 
-int clib_cache_meta_init(void) {
-  sprintf(meta_cache_dir, BASE_CACHE_PATTERN "/meta", BASE_DIR);
+static void object_path(char *object, const char *hash) {
+  sprintf(object, OBJECT_PATTERN, store_dir, hash, hash + 2);
+}
 
-  if (0 != check_dir(meta_cache_dir)) {
+/**
+ * Every write goes to a unique file in the staging directory first and is
+ * published with a single `rename()`, so readers in this or any other
+ * process see either the old or the new content. The staging directory is
+ * on the same file system as the cache, which keeps the rename atomic.
+ */
+
+static void staging_path(char *path, const char *target) {
+  const char *name = strrchr(target, '/');
+  unsigned long n = __sync_fetch_and_add(&staging_counter, 1);
+
+  sprintf(path, "%s/%ld.%lu.%s", staging_dir, (long)getpid(), n,
+          name ? name + 1 : target);
+}
+
+static int publish(const char *staged, const char *target) {
+  if (0 != rename(staged, target)) {
+    unlink(staged);
     return -1;
   }
 
   return 0;
 }
 
-const char *clib_cache_meta_dir(void) { return meta_cache_dir; }
+static int write_atomic(const char *target, const char *content) {
+  char staged[BUFSIZ * 2];
+  int rc = 0;
 
-int clib_cache_init(time_t exp) {
-  expiration = exp;
+  staging_path(staged, target);
 
-  sprintf(package_cache_dir, BASE_CACHE_PATTERN "/packages", BASE_DIR);
-  sprintf(json_cache_dir, BASE_CACHE_PATTERN "/json", BASE_DIR);
-  sprintf(search_cache, BASE_CACHE_PATTERN "/search.html", BASE_DIR);
+  if (-1 == (rc = fs_write(staged, content))) {
+    unlink(staged);
+    return -1;
+  }
 
-  if (0 != check_dir(package_cache_dir)) {
+  if (0 != publish(staged, target)) {
     return -1;
   }
-  if (0 != check_dir(json_cache_dir)) {
+
+  return rc;
+}
+
+/**
+ * Remove staged files abandoned by processes that were killed mid-write
+ */
+
+static void clean_staging(void) {
+#ifndef _WIN32
+  DIR *dir = opendir(staging_dir);
+  struct dirent *entry = NULL;
+  time_t now = time(NULL);
+
+  if (NULL == dir) {
+    return;
+  }
+
+  while ((entry = readdir(dir))) {
+    struct stat st;
+
+    if ('.' == entry->d_name[0]) {
+      continue;
+    }
+
+    if (0 == fstatat(dirfd(dir), entry->d_name, &st, 0) &&
+        now - st.st_mtime > STAGING_MAX_AGE) {
+      unlinkat(dirfd(dir), entry->d_name, 0);
+    }
+  }
+
+  closedir(dir);
+#endif
+}
+
+/**
+ * Take the lock `name`, shared for readers and exclusive for writers, so
+ * concurrent clib processes don't save or delete an entry while another
+ * one is loading it.
+ *
+ * @return The lock descriptor for `unlock_entry()`, or -1 if the entry
+ * can't be locked, in which case the caller goes ahead unlocked
+ */
+
+static int lock_path(const char *name, int exclusive) {
+#ifndef _WIN32
+  char path[BUFSIZ * 2];
+  int fd = -1;
+
+  sprintf(path, LOCK_PATTERN, locks_dir, shard_of(name), name);
+
+  if (-1 == (fd = open(path, O_RDWR | O_CREAT, 0600))) {
     return -1;
   }
 
-  return 0;
+  while (0 != flock(fd, exclusive ? LOCK_EX : LOCK_SH)) {
+    if (EINTR != errno) {
+      close(fd);
+      return -1;
+    }
+  }
+
+  return fd;
+#else
+  return -1;
+#endif
 }
 
-static int is_expired(char *cache) {
-  fs_stats *stat = fs_stat(cache);
+/**
+ * Take the lock `name` exclusively unless another process holds it.
+ *
+ * @return The lock descriptor for `unlock_entry()`, or -1 if it is taken
+ * or can't be locked
+ */
 
-  if (!stat) {
+static int try_lock_path(const char *name) {
+#ifndef _WIN32
+  char path[BUFSIZ * 2];
+  int fd = -1;
+
+  sprintf(path, LOCK_PATTERN, locks_dir, shard_of(name), name);
+
+  if (-1 == (fd = open(path, O_RDWR | O_CREAT, 0600))) {
     return -1;
   }
 
-  time_t modified = stat->st_mtime;
-  time_t now = time(NULL);
-  free(stat);
+  while (0 != flock(fd, LOCK_EX | LOCK_NB)) {
+    if (EINTR != errno) {
+      close(fd);
+      return -1;
+    }
+  }
 
-  return now - modified >= expiration;
+  return fd;
+#else
+  (void)name;
+  return -1;
+#endif
 }
 
-int clib_cache_has_json(char *author, char *name, char *version) {
-  GET_JSON_CACHE(author, name, version);
+static int lock_entry(char *author, char *name, char *version, int exclusive) {
+  char entry[BUFSIZ];
 
-  return 0 == fs_exists(json_cache) && !is_expired(json_cache);
+  sprintf(entry, ENTRY_PATTERN, author, name, version);
+  return lock_path(entry, exclusive);
 }
 
-char *clib_cache_read_json(char *author, char *name, char *version) {
-  GET_JSON_CACHE(author, name, version);
+static void unlock_entry(int fd) {
+  if (-1 != fd) {
+    // closing the descriptor releases the lock
+    close(fd);
+  }
+}
+
+static int index_key(char key[INDEX_KEY_SIZE], char *author, char *name,
+                     char *version) {
+  return INDEX_KEY_SIZE > snprintf(key, INDEX_KEY_SIZE, "%s/%s@%s", author,
+                                   name, version)
+             ? 0
+             : -1;
+}
+
+/**
+ * @return The record of `key`, created empty when `create` is set, or
+ * NULL. Called with the index locked.
+ */
 
-  if (is_expired(json_cache)) {
+static index_record_t *index_find(const char *key, int create) {
+  index_record_t *record = NULL;
+  char *copy = NULL;
+
+  if (NULL == index_records) {
     return NULL;
   }
 
-  return fs_read(json_cache);
+  if ((record = hash_get(index_records, (char *)key)) || !create) {
+    return record;
+  }
+
+  if (!(record = malloc(sizeof(index_record_t))) || !(copy = strdup(key))) {
+    free(record);
+    return NULL;
+  }
+
+  memset(record, 0, sizeof(index_record_t));
+  strcpy(record->key, key);
+  hash_set(index_records, copy, record);
+
+  return record;
 }
 
-int clib_cache_save_json(char *author, char *name, char *version,
-                         char *content) {
-  GET_JSON_CACHE(author, name, version);
+/**
+ * Persist `record`. Appends of one record are atomic, so processes
+ * sharing the cache don't need to coordinate on the index.
+ */
 
-  return fs_write(json_cache, content);
+static void index_append(index_record_t *record) {
+  if (-1 != index_fd) {
+    if (sizeof(index_record_t) !=
+        write(index_fd, record, sizeof(index_record_t))) {
+      // a torn record would shift every later one
+      close(index_fd);
+      index_fd = -1;
+    }
+  }
 }
 
-int clib_cache_delete_json(char *author, char *name, char *version) {
-  GET_JSON_CACHE(author, name, version);
+static int index_open(void) {
+  index_header_t header;
+  struct stat st;
 
-  return unlink(json_cache);
+  index_fd = open(index_path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+  if (-1 == index_fd) {
+    return -1;
+  }
+
+  if (0 == fstat(index_fd, &st) && 0 == st.st_size) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(index_record_t);
+
+    if (sizeof(header) != write(index_fd, &header, sizeof(header))) {
+      close(index_fd);
+      index_fd = -1;
+      return -1;
+    }
+  }
+
+  return 0;
 }
 
-int clib_cache_has_search(void) {
-  return 0 == fs_exists(search_cache) && !is_expired(search_cache);
+/**
+ * Rewrite the index with only the live record of every key
+ */
+
+static void index_compact(void) {
+  char staged[BUFSIZ * 2];
+  index_header_t header;
+  FILE *file = NULL;
+  int rc = 0;
+
+  staging_path(staged, index_path);
+
+  if (!(file = fopen(staged, "wb"))) {
+    return;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+  header.record_size = sizeof(index_record_t);
+
+  if (1 != fwrite(&header, sizeof(header), 1, file)) {
+    rc = -1;
+  }
+
+  hash_each_val(index_records, {
+    index_record_t *record = val;
+    if (0 == rc && (record->json_mtime || record->package_mtime) &&
+        1 != fwrite(record, sizeof(index_record_t), 1, file)) {
+      rc = -1;
+    }
+  });
+
+  if (0 != fclose(file)) {
+    rc = -1;
+  }
+
+  if (0 == rc) {
+    publish(staged, index_path);
+  } else {
+    unlink(staged);
+  }
 }
 
-char *clib_cache_read_search(void) {
-  if (!clib_cache_has_search()) {
-    return NULL;
+/**
+ * Map the index and load its records, so lookups are served from memory
+ */
+
+static void index_load(void) {
+  const index_header_t *header = NULL;
+  const char *map = NULL;
+  struct stat st;
+  size_t count = 0;
+  int fd = -1;
+
+  INDEX_LOCK();
+
+  if (index_records) {
+    INDEX_UNLOCK();
+    return;
   }
-  return fs_read(search_cache);
+
+  if (!(index_records = hash_new())) {
+    INDEX_UNLOCK();
+    return;
+  }
+
+#ifndef _WIN32
+  if (-1 != (fd = open(index_path, O_RDONLY)) && 0 == fstat(fd, &st) &&
+      (size_t)st.st_size >= sizeof(index_header_t)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (MAP_FAILED == map) {
+      map = NULL;
+    }
+  }
+
+  header = (const index_header_t *)map;
+
+  if (map && 0 == memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) &&
+      sizeof(index_record_t) == header->record_size) {
+    const index_record_t *records =
+        (const index_record_t *)(map + sizeof(index_header_t));
+    count = (st.st_size - sizeof(index_header_t)) / sizeof(index_record_t);
+
+    for (size_t i = 0; i < count; i++) {
+      index_record_t *record = NULL;
+      char key[INDEX_KEY_SIZE];
+
+      memcpy(key, records[i].key, INDEX_KEY_SIZE);
+      key[INDEX_KEY_SIZE - 1] = 0;
+
+      if ((record = index_find(key, 1))) {
+        memcpy(record, &records[i], sizeof(index_record_t));
+        record->key[INDEX_KEY_SIZE - 1] = 0;
+        record->package_hash[CLIB_HASH_HEX_SIZE - 1] = 0;
+      }
+    }
+  } else if (map) {
+    // unknown layout, start over
+    count = INDEX_COMPACT_THRESHOLD + 1;
+  }
+
+  if (map) {
+    munmap((void *)map, st.st_size);
+  }
+
+  if (-1 != fd) {
+    close(fd);
+  }
+
+  if (count > INDEX_COMPACT_THRESHOLD &&
+      count > 2 * (size_t)hash_size(index_records)) {
+    index_compact();
+  }
+
+  index_open();
+#endif
+
+  INDEX_UNLOCK();
 }
 
-int clib_cache_save_search(char *content) {
-  return fs_write(search_cache, content);
+/**
+ * Update the fields of the record of an entry and persist it
+ */
+
+static void index_update_key(const char *key, entry_kind_t kind, time_t mtime,
+                             int64_t size, const char *hash) {
+  index_record_t *record = NULL;
+
+  INDEX_LOCK();
+  if ((record = index_find(key, 1))) {
+    if (ENTRY_JSON != kind) {
+      record->package_packed = ENTRY_PACK == kind;
+      record->package_mtime = mtime;
+      record->package_atime = mtime;
+      record->package_size = size;
+      memset(record->package_hash, 0, CLIB_HASH_HEX_SIZE);
+      if (hash) {
+        strncpy(record->package_hash, hash, CLIB_HASH_HEX_SIZE - 1);
+      }
+    } else {
+      record->json_mtime = mtime;
+      record->json_size = size;
+    }
+    index_append(record);
+  }
+  INDEX_UNLOCK();
 }
 
-int clib_cache_delete_search(void) { return unlink(search_cache); }
+static void index_update(char *author, char *name, char *version,
+                         entry_kind_t kind, time_t mtime, int64_t size,
+                         const char *hash) {
+  char key[INDEX_KEY_SIZE];
 
-int clib_cache_has_package(char *author, char *name, char *version) {
-  GET_PKG_CACHE(author, name, version);
+  if (0 == index_key(key, author, name, version)) {
+    index_update_key(key, kind, mtime, size, hash);
+  }
+}
+
+/**
+ * Record that a package entry was just used, which keeps it from being
+ * evicted before the entries that weren't
+ */
+
+static void index_touch(char *author, char *name, char *version) {
+  char key[INDEX_KEY_SIZE];
+  index_record_t *record = NULL;
+
+  if (0 != index_key(key, author, name, version)) {
+    return;
+  }
 
-  return 0 == fs_exists(pkg_cache) && !is_expired(pkg_cache);
+  INDEX_LOCK();
+  if ((record = index_find(key, 0)) && record->package_mtime) {
+    record->package_atime = time(NULL);
+    index_append(record);
+  }
+  INDEX_UNLOCK();
 }
 
-int clib_cache_is_expired_package(char *author, char *name, char *version) {
-  GET_PKG_CACHE(author, name, version);
+static int is_expired_at(time_t mtime) {
+  return time(NULL) - mtime >= expiration;
+}
 
-  return is_expired(pkg_cache);
+/**
+ * @return 1 if an entry written at `mtime` expired, but may still be used
+ * while it is refreshed
+ */
+
+static int is_stale_at(time_t mtime) {
+  return is_expired_at(mtime) && time(NULL) - mtime < expiration + max_stale;
 }
 
-int clib_cache_save_package(char *author, char *name, char *version,
-                            char *pkg_dir) {
-  GET_PKG_CACHE(author, name, version);
+/**
+ * @return 1 if `version` names what never changes once published, a tag
+ * like "1.2.3" or "v1.2.3" or the hash of a commit, and 0 if it names a
+ * ref that moves, like a branch
+ */
 
-  if (0 == fs_exists(pkg_cache)) {
-    rimraf(pkg_cache);
+static int is_immutable(const char *version) {
+  const char *c = version;
+  size_t hex = 0;
+
+  if (!version || !*version) {
+    return 0;
+  }
+
+  for (; isxdigit((unsigned char)version[hex]); hex++) {
+  }
+
+  if (0 == version[hex] && hex >= 7 && hex <= 40) {
+    return 1;
   }
 
-  return copy_dir(pkg_dir, pkg_cache);
+  if ('v' == *c || 'V' == *c) {
+    c++;
+  }
+
+  if (!isdigit((unsigned char)*c)) {
+    return 0;
+  }
+
+  for (; *c; c++) {
+    if (!isalnum((unsigned char)*c) && !strchr(".+-_", *c)) {
+      return 0;
+    }
+  }
+
+  return 1;
 }
 
-int clib_cache_load_package(char *author, char *name, char *version,
-                            char *target_dir) {
-  GET_PKG_CACHE(author, name, version);
+/**
+ * Entries of an immutable version only go when the cache is pruned to
+ * its size, those of a ref that moves expire.
+ *
+ * @return 1 if the entry of `version` written at `mtime` expired
+ */
+
+static int is_entry_expired(const char *version, time_t mtime) {
+  return !is_immutable(version) && is_expired_at(mtime);
+}
+
+/**
+ * When an entry was last written, from the index when it knows a fresh
+ * entry and from the file system at `path` otherwise, since other
+ * processes may have added or refreshed it since the index was loaded.
+ * A package missing at `path` may be stored as a pack instead, which
+ * sets `packed` unless it is NULL.
+ *
+ * @return The modification time, or 0 if the entry isn't cached
+ */
+
+static time_t entry_mtime(char *author, char *name, char *version,
+                          int package, char *path, int *packed) {
+  char key[INDEX_KEY_SIZE];
+  index_record_t *record = NULL;
+  time_t mtime = 0;
+  int is_packed = 0;
+  struct stat st;
+
+  int indexed = 0 == index_key(key, author, name, version);
+
+  if (indexed) {
+    INDEX_LOCK();
+    if ((record = index_find(key, 0))) {
+      mtime = package ? record->package_mtime : record->json_mtime;
+      is_packed = record->package_packed;
+    }
+    INDEX_UNLOCK();
+
+    if (mtime && !is_entry_expired(version, mtime)) {
+      if (packed) {
+        *packed = is_packed;
+      }
+      return mtime;
+    }
+  }
+
+  is_packed = 0;
+
+  if (0 != stat(path, &st)) {
+    GET_PKG_PACK(author, name, version);
+
+    if (package && 0 == stat(pkg_pack, &st)) {
+      is_packed = 1;
+    } else {
+      st.st_mtime = 0;
+      st.st_size = 0;
+    }
+  }
+
+  // remembered for this process only, the owner of the entry appends it
+  if (indexed) {
+    INDEX_LOCK();
+    if ((record = index_find(key, 1))) {
+      if (package) {
+        record->package_mtime = st.st_mtime;
+        record->package_packed = is_packed;
+      } else {
+        record->json_mtime = st.st_mtime;
+        record->json_size = st.st_size;
+      }
+    }
+    INDEX_UNLOCK();
+  }
+
+  if (packed) {
+    *packed = is_packed;
+  }
+
+  return st.st_mtime;
+}
+
+const char *clib_cache_dir(void) { return package_cache_dir; }
+
+void clib_cache_set_concurrency(int n) {
+  concurrency = n > 0 ? n : 1;
+}
+
+static int check_dir(char *dir) { return clib_mkdirp(dir, 0700); }
 
-  if (-1 == fs_exists(pkg_cache)) {
+static int has_suffix(const char *name, const char *suffix) {
+  size_t len = strlen(name);
+  size_t suffix_len = strlen(suffix);
+
+  return len > suffix_len && 0 == strcmp(name + len - suffix_len, suffix);
+}
+
+/**
+ * Moves what the flat `root` of older versions holds into the shards of
+ * the entries, and removes what can be done without but can't be told
+ * the entry of by its name, like missing manifest markers.
+ *
+ * @return The number of files moved or removed, or -1 on error
+ */
+
+static int move_into_shards(const char *root) {
+#ifndef _WIN32
+  static const char *suffixes[] = {".index", ".pack", ".json", ".etag", NULL};
+  DIR *dir = opendir(root);
+  struct dirent *entry = NULL;
+  int moved = 0;
+
+  if (NULL == dir) {
     return -1;
   }
 
-  if (is_expired(pkg_cache)) {
-    rimraf(pkg_cache);
+  while ((entry = readdir(dir))) {
+    const char *name = entry->d_name;
+    size_t len = strlen(name);
+    char base[BUFSIZ];
+    char to[BUFSIZ * 2];
+
+    // dot files and the shards themselves
+    if ('.' == name[0] || len >= sizeof(base) ||
+        (2 == len && isxdigit((unsigned char)name[0]) &&
+         isxdigit((unsigned char)name[1]))) {
+      continue;
+    }
+
+    if (has_suffix(name, ".missing") || has_suffix(name, ".lock")) {
+      if (0 == unlinkat(dirfd(dir), name, 0)) {
+        moved++;
+      }
+      continue;
+    }
+
+    strcpy(base, name);
+    for (int i = 0; suffixes[i]; i++) {
+      if (has_suffix(base, suffixes[i])) {
+        base[len - strlen(suffixes[i])] = 0;
+        break;
+      }
+    }
 
-    return -2;
+    sprintf(to, SHARD_PATTERN "/%s", root, shard_of(base), name);
+    if (0 == renameat(dirfd(dir), name, AT_FDCWD, to)) {
+      moved++;
+    }
   }
 
-  return copy_dir(pkg_cache, target_dir);
+  closedir(dir);
+  return moved;
+#else
+  (void)root;
+  return 0;
+#endif
 }
 
-int clib_cache_delete_package(char *author, char *name, char *version) {
-  GET_PKG_CACHE(author, name, version);
+/**
+ * Creates the shards of `root`, and moves the entries of a cache from
+ * before they existed into them, once. The locks dir goes first, as the
+ * others are sharded holding a lock.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+
+static int shard_dir(char *root) {
+  char marker[BUFSIZ * 2];
+  char shard[BUFSIZ * 2];
+  int moved = 0;
+  int lock = -1;
+  int rc = 0;
+
+  sprintf(marker, "%s/" SHARDED_MARKER, root);
+
+  if (0 == fs_exists(marker)) {
+    return 0;
+  }
+
+  for (unsigned i = 0; i < SHARDS; i++) {
+    sprintf(shard, SHARD_PATTERN, root, i);
+    if (0 != check_dir(shard)) {
+      return -1;
+    }
+  }
+
+  lock = lock_path(SHARDING_LOCK, 1);
+
+  // another process may have done it meanwhile
+  if (0 != fs_exists(marker)) {
+    // a directory may not list what is moved out of it while it's read
+    while ((moved = move_into_shards(root)) > 0) {
+    }
+
+    if (-1 == moved || -1 == fs_write(marker, "")) {
+      rc = -1;
+    }
+  }
+
+  unlock_entry(lock);
+  return rc;
+}
+
+/**
+ * Traces the span `what` of a package entry, begun at `start`
+ */
+
+static void trace_entry(const char *what, char *author, char *name,
+                        char *version, uint64_t start, int rc) {
+  char slug[BUFSIZ];
+
+  if (0 != start) {
+    snprintf(slug, sizeof(slug), "%s/%s@%s", author, name, version);
+    clib_trace_span("cache", what, slug, start, "\"rc\":%d", rc);
+  }
+}
 
-  return rimraf(pkg_cache);
+int clib_cache_meta_init(void) {
+  sprintf(meta_cache_dir, BASE_CACHE_PATTERN "/meta", BASE_DIR);
+
+  if (0 != check_dir(meta_cache_dir)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+const char *clib_cache_meta_dir(void) { return meta_cache_dir; }
+
+int clib_cache_init(time_t exp) {
+  expiration = exp;
+
+  sprintf(package_cache_dir, BASE_CACHE_PATTERN "/packages", BASE_DIR);
+  sprintf(json_cache_dir, BASE_CACHE_PATTERN "/json", BASE_DIR);
+  sprintf(search_cache, BASE_CACHE_PATTERN "/search.json", BASE_DIR);
+  sprintf(search_index_cache, BASE_CACHE_PATTERN "/search.idx", BASE_DIR);
+  sprintf(search_etag_cache, BASE_CACHE_PATTERN "/search.etag", BASE_DIR);
+  sprintf(store_dir, BASE_CACHE_PATTERN "/store", BASE_DIR);
+  sprintf(staging_dir, BASE_CACHE_PATTERN "/staging", BASE_DIR);
+  sprintf(locks_dir, BASE_CACHE_PATTERN "/locks", BASE_DIR);
+  sprintf(git_dir, BASE_CACHE_PATTERN "/git", BASE_DIR);
+  sprintf(index_path, BASE_CACHE_PATTERN "/index", BASE_DIR);
+
+  if (0 != check_dir(package_cache_dir)) {
+    return -1;
+  }
+  if (0 != check_dir(json_cache_dir)) {
+    return -1;
+  }
+  if (0 != check_dir(store_dir)) {
+    return -1;
+  }
+  if (0 != check_dir(staging_dir)) {
+    return -1;
+  }
+  if (0 != check_dir(locks_dir)) {
+    return -1;
+  }
+  if (0 != shard_dir(locks_dir) || 0 != shard_dir(package_cache_dir) ||
+      0 != shard_dir(json_cache_dir)) {
+    return -1;
+  }
+
+  clean_staging();
+  index_load();
+
+  const char *pack = getenv("CLIB_CACHE_PACK");
+  if (pack) {
+    packed_mode = 0 == strcmp(pack, "1");
+  }
+
+  const char *verify = getenv("CLIB_CACHE_VERIFY");
+  if (verify) {
+    verify_mode = 0 == strcmp(verify, "1");
+  }
+
+  const char *missing = getenv("CLIB_CACHE_MISSING_TIME");
+  if (missing && *missing) {
+    missing_expiration = atol(missing) > 0 ? atol(missing) : 0;
+  }
+
+  const char *stale = getenv("CLIB_CACHE_MAX_STALE");
+  if (stale && *stale) {
+    max_stale = atol(stale) > 0 ? atol(stale) : 0;
+  }
+
+  const char *size = getenv("CLIB_CACHE_MAX_SIZE");
+  if (size && 0 != clib_cache_parse_size(size, &max_size)) {
+    max_size = 0;
+  }
+
+  const char *mode = getenv("CLIB_CACHE_LINK");
+  if (mode) {
+    if (0 == strcmp(mode, "reflink")) {
+      link_mode = CLIB_CACHE_LINK_REFLINK;
+    } else if (0 == strcmp(mode, "hardlink")) {
+      link_mode = CLIB_CACHE_LINK_HARDLINK;
+    } else if (0 == strcmp(mode, "symlink")) {
+      link_mode = CLIB_CACHE_LINK_SYMLINK;
+    } else if (0 == strcmp(mode, "copy")) {
+      link_mode = CLIB_CACHE_LINK_COPY;
+    }
+  }
+
+  return 0;
+}
+
+static int is_expired(char *cache) {
+  fs_stats *stat = fs_stat(cache);
+
+  if (!stat) {
+    return -1;
+  }
+
+  time_t modified = stat->st_mtime;
+  time_t now = time(NULL);
+  free(stat);
+
+  return now - modified >= expiration;
+}
+
+/**
+ * @return 1 if `cache` is fresh, or expired but may still be used while
+ * it is refreshed, 0 otherwise
+ */
+
+static int is_usable(char *cache) {
+  fs_stats *stat = fs_stat(cache);
+  time_t modified = 0;
+
+  if (!stat) {
+    return 0;
+  }
+
+  modified = stat->st_mtime;
+  free(stat);
+
+  return !is_expired_at(modified) || is_stale_at(modified);
+}
+
+int clib_cache_has_json(char *author, char *name, char *version) {
+  GET_JSON_CACHE(author, name, version);
+  time_t mtime = entry_mtime(author, name, version, 0, json_cache, NULL);
+
+  return 0 != mtime && !is_entry_expired(version, mtime);
+}
+
+char *clib_cache_read_json(char *author, char *name, char *version) {
+  GET_JSON_CACHE(author, name, version);
+  time_t mtime = entry_mtime(author, name, version, 0, json_cache, NULL);
+
+  if (0 == mtime || is_entry_expired(version, mtime)) {
+    return NULL;
+  }
+
+  return fs_read(json_cache);
+}
+
+int clib_cache_map_json(char *author, char *name, char *version,
+                        fs_mapping *mapping) {
+  uint64_t started = clib_trace_now();
+  GET_JSON_CACHE(author, name, version);
+  time_t mtime = entry_mtime(author, name, version, 0, json_cache, NULL);
+  int rc = -1;
+
+  memset(mapping, 0, sizeof(fs_mapping));
+  if (0 != mtime && !is_entry_expired(version, mtime)) {
+    rc = fs_map(json_cache, mapping);
+  }
+
+  trace_entry("load manifest", author, name, version, started, rc);
+  return rc;
+}
+
+int clib_cache_has_expired_json(char *author, char *name, char *version) {
+  GET_JSON_CACHE(author, name, version);
+  time_t mtime = entry_mtime(author, name, version, 0, json_cache, NULL);
+
+  return 0 != mtime && is_entry_expired(version, mtime) && is_stale_at(mtime);
+}
+
+int clib_cache_map_expired_json(char *author, char *name, char *version,
+                                fs_mapping *mapping) {
+  uint64_t started = clib_trace_now();
+  GET_JSON_CACHE(author, name, version);
+  time_t mtime = entry_mtime(author, name, version, 0, json_cache, NULL);
+  int rc = -1;
+
+  memset(mapping, 0, sizeof(fs_mapping));
+  if (0 != mtime &&
+      (!is_entry_expired(version, mtime) || is_stale_at(mtime))) {
+    rc = fs_map(json_cache, mapping);
+  }
+
+  trace_entry("load expired manifest", author, name, version, started, rc);
+  return rc;
+}
+
+int clib_cache_renew_json(char *author, char *name, char *version) {
+  GET_JSON_CACHE(author, name, version);
+  struct stat st;
+
+  if (0 != utime(json_cache, NULL) || 0 != stat(json_cache, &st)) {
+    return -1;
+  }
+
+  index_update(author, name, version, ENTRY_JSON, st.st_mtime, st.st_size,
+               NULL);
+  return 0;
+}
+
+int clib_cache_save_json(char *author, char *name, char *version,
+                         char *content) {
+  uint64_t started = clib_trace_now();
+  GET_JSON_CACHE(author, name, version);
+  int rc = write_atomic(json_cache, content);
+
+  if (-1 != rc) {
+    index_update(author, name, version, ENTRY_JSON, time(NULL), rc, NULL);
+  }
+
+  trace_entry("save manifest", author, name, version, started, rc);
+  return rc;
+}
+
+int clib_cache_delete_json(char *author, char *name, char *version) {
+  GET_JSON_CACHE(author, name, version);
+  GET_VALIDATORS_CACHE(author, name, version);
+
+  index_update(author, name, version, ENTRY_JSON, 0, 0, NULL);
+  unlink(validators_cache);
+  return unlink(json_cache);
+}
+
+/**
+ * The marker of a manifest `file` the package doesn't have, or -1 when
+ * its path doesn't fit
+ */
+
+static int missing_cache_path(char *path, char *author, char *name,
+                              char *version, const char *file) {
+  int n = snprintf(path, BUFSIZ, MISSING_CACHE_PATTERN, json_cache_dir,
+                   entry_shard(author, name, version), author, name, version,
+                   file);
+  return n < 0 || n >= BUFSIZ || strchr(file, '/') ? -1 : 0;
+}
+
+int clib_cache_save_missing_json(char *author, char *name, char *version,
+                                 const char *file) {
+  char missing_cache[BUFSIZ];
+
+  if (0 == missing_expiration ||
+      0 != missing_cache_path(missing_cache, author, name, version, file)) {
+    return -1;
+  }
+
+  return -1 == write_atomic(missing_cache, "") ? -1 : 0;
+}
+
+int clib_cache_has_missing_json(char *author, char *name, char *version,
+                                const char *file) {
+  char missing_cache[BUFSIZ];
+  struct stat st;
+
+  if (0 == missing_expiration ||
+      0 != missing_cache_path(missing_cache, author, name, version, file) ||
+      0 != stat(missing_cache, &st)) {
+    return 0;
+  }
+
+  // the repository may have grown the file since
+  if (time(NULL) - st.st_mtime >= missing_expiration) {
+    unlink(missing_cache);
+    return 0;
+  }
+
+  return 1;
+}
+
+char *clib_cache_read_stale_json(char *author, char *name, char *version) {
+  GET_JSON_CACHE(author, name, version);
+
+  return fs_read(json_cache);
+}
+
+int clib_cache_map_stale_json(char *author, char *name, char *version,
+                              fs_mapping *mapping) {
+  GET_JSON_CACHE(author, name, version);
+
+  return fs_map(json_cache, mapping);
+}
+
+/**
+ * Copy the `n`th line of `content`, or NULL if it is missing or empty
+ */
+
+static char *read_line(char *content, int n) {
+  char *end = NULL;
+  char *line = NULL;
+
+  while (n-- > 0 && content) {
+    if ((content = strchr(content, '\n'))) {
+      content++;
+    }
+  }
+
+  if (!content || '\n' == *content || 0 == *content) {
+    return NULL;
+  }
+
+  if (!(end = strchr(content, '\n'))) {
+    end = content + strlen(content);
+  }
+
+  if ((line = malloc(end - content + 1))) {
+    memcpy(line, content, end - content);
+    line[end - content] = 0;
+  }
+
+  return line;
+}
+
+int clib_cache_read_json_validators(char *author, char *name, char *version,
+                                    char **etag, char **last_modified) {
+  GET_JSON_CACHE(author, name, version);
+  GET_VALIDATORS_CACHE(author, name, version);
+  // never written bigger than this
+  char content[BUFSIZ];
+
+  *etag = NULL;
+  *last_modified = NULL;
+
+  if (0 == entry_mtime(author, name, version, 0, json_cache, NULL)) {
+    return -1;
+  }
+
+  if (-1 == fs_read_into(validators_cache, content, sizeof(content))) {
+    return -1;
+  }
+
+  *etag = read_line(content, 0);
+  *last_modified = read_line(content, 1);
+
+  return (*etag || *last_modified) ? 0 : -1;
+}
+
+int clib_cache_save_json_validators(char *author, char *name, char *version,
+                                    const char *etag,
+                                    const char *last_modified) {
+  GET_VALIDATORS_CACHE(author, name, version);
+  char content[BUFSIZ];
+
+  if (!etag && !last_modified) {
+    unlink(validators_cache);
+    return 0;
+  }
+
+  if ((etag && strchr(etag, '\n')) ||
+      (last_modified && strchr(last_modified, '\n'))) {
+    return -1;
+  }
+
+  if (BUFSIZ <= snprintf(content, BUFSIZ, "%s\n%s\n", etag ? etag : "",
+                         last_modified ? last_modified : "")) {
+    return -1;
+  }
+
+  return write_atomic(validators_cache, content);
+}
+
+int clib_cache_has_search(void) {
+  return 0 == fs_exists(search_cache) && !is_expired(search_cache);
+}
+
+char *clib_cache_read_search(void) {
+  if (!clib_cache_has_search()) {
+    return NULL;
+  }
+  return fs_read(search_cache);
+}
+
+int clib_cache_map_search(fs_mapping *mapping) {
+  memset(mapping, 0, sizeof(fs_mapping));
+  if (!clib_cache_has_search()) {
+    return -1;
+  }
+  return fs_map(search_cache, mapping);
+}
+
+int clib_cache_map_expired_search(fs_mapping *mapping) {
+  memset(mapping, 0, sizeof(fs_mapping));
+  if (!is_usable(search_cache)) {
+    return -1;
+  }
+  return fs_map(search_cache, mapping);
+}
+
+int clib_cache_map_expired_search_index(fs_mapping *mapping) {
+  memset(mapping, 0, sizeof(fs_mapping));
+  if (!is_usable(search_index_cache)) {
+    return -1;
+  }
+  return fs_map(search_index_cache, mapping);
+}
+
+int clib_cache_save_search(char *content) {
+  return write_atomic(search_cache, content);
+}
+
+int clib_cache_delete_search(void) {
+  unlink(search_index_cache);
+  unlink(search_etag_cache);
+  return unlink(search_cache);
+}
+
+char *clib_cache_read_search_index(void) {
+  if (0 != fs_exists(search_index_cache) || is_expired(search_index_cache)) {
+    return NULL;
+  }
+  return fs_read(search_index_cache);
+}
+
+int clib_cache_map_search_index(fs_mapping *mapping) {
+  memset(mapping, 0, sizeof(fs_mapping));
+  if (0 != fs_exists(search_index_cache) || is_expired(search_index_cache)) {
+    return -1;
+  }
+  return fs_map(search_index_cache, mapping);
+}
+
+int clib_cache_save_search_index(char *content) {
+  return write_atomic(search_index_cache, content);
+}
+
+char *clib_cache_read_search_etag(void) {
+  char content[BUFSIZ];
+
+  // an expired search cache can still be revalidated
+  if (0 != fs_exists(search_cache) || 0 != fs_exists(search_index_cache) ||
+      -1 == fs_read_into(search_etag_cache, content, sizeof(content))) {
+    return NULL;
+  }
+
+  return read_line(content, 0);
+}
+
+int clib_cache_save_search_etag(const char *etag) {
+  char content[BUFSIZ];
+
+  if (!etag) {
+    unlink(search_etag_cache);
+    return 0;
+  }
+
+  if (strchr(etag, '\n') ||
+      BUFSIZ <= snprintf(content, BUFSIZ, "%s\n", etag)) {
+    return -1;
+  }
+
+  return write_atomic(search_etag_cache, content);
+}
+
+int clib_cache_renew_search(void) {
+  if (0 != utime(search_cache, NULL) || 0 != utime(search_index_cache, NULL)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int clib_cache_begin_refresh_search(void) {
+  return try_lock_path(SEARCH_REFRESH_LOCK);
+}
+
+int clib_cache_begin_refresh_json(char *author, char *name, char *version) {
+  char lock[BUFSIZ];
+
+  if (BUFSIZ <= snprintf(lock, BUFSIZ, JSON_REFRESH_PATTERN, author, name,
+                         version)) {
+    return -1;
+  }
+
+  return try_lock_path(lock);
+}
+
+void clib_cache_end_refresh(int lock) { unlock_entry(lock); }
+
+char *clib_cache_git_repo(char *author, char *name) {
+  char *repo = NULL;
+
+  // made once a package is fetched with git
+  if (0 != check_dir(git_dir) ||
+      !(repo = malloc(strlen(git_dir) + strlen(author) + strlen(name) +
+                      sizeof("/_.git")))) {
+    return NULL;
+  }
+
+  sprintf(repo, "%s/" GIT_REPO_PATTERN, git_dir, author, name);
+  return repo;
+}
+
+int clib_cache_lock_git(char *author, char *name) {
+  char lock[BUFSIZ];
+
+  if (BUFSIZ <= snprintf(lock, BUFSIZ, GIT_REPO_PATTERN, author, name)) {
+    return -1;
+  }
+
+  return lock_path(lock, 1);
+}
+
+void clib_cache_unlock_git(int lock) { unlock_entry(lock); }
+
+int clib_cache_lock_fetch(char *author, char *name, char *version) {
+  char lock[BUFSIZ];
+
+  if (BUFSIZ <= snprintf(lock, BUFSIZ, FETCH_LOCK_PATTERN, author, name,
+                         version)) {
+    return -1;
+  }
+
+  return lock_path(lock, 1);
+}
+
+void clib_cache_unlock_fetch(int lock) { unlock_entry(lock); }
+
+/**
+ * Copy the content of `from` into `to` and give it `mode`
+ */
+
+static int copy_contents(const char *from, const char *to, mode_t mode) {
+  if (0 != copy_file((char *)from, (char *)to) || 0 != chmod(to, mode)) {
+    unlink(to);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Give `to` the content of `from` and `mode` without writing it again, as
+ * a clone or a hard link to it, the ways `link_mode` allows
+ */
+
+static int link_contents(const char *from, const char *to, mode_t mode) {
+#if defined(FICLONE)
+  if (CLIB_CACHE_LINK_AUTO == link_mode ||
+      CLIB_CACHE_LINK_REFLINK == link_mode) {
+    int in = open(from, O_RDONLY);
+    int out = -1;
+    int cloned = 0;
+
+    if (-1 != in &&
+        -1 != (out = open(to, O_WRONLY | O_CREAT | O_EXCL, mode))) {
+      cloned = 0 == ioctl(out, FICLONE, in);
+    }
+
+    if (-1 != in) {
+      close(in);
+    }
+    if (-1 != out) {
+      close(out);
+      if (cloned) {
+        return 0;
+      }
+      unlink(to);
+    }
+  }
+#endif
+
+#if !defined(_WIN32)
+  // the mode is that of `from` too from then on
+  if ((CLIB_CACHE_LINK_AUTO == link_mode ||
+       CLIB_CACHE_LINK_HARDLINK == link_mode) &&
+      0 == link(from, to)) {
+    if (0 != chmod(to, mode)) {
+      unlink(to);
+      return -1;
+    }
+
+    return 0;
+  }
+#endif
+
+  return -1;
+}
+
+/**
+ * Add the content of `path`, which hashes to `hash`, to the store unless
+ * it's there already, linked to it when `linked` is set and copied
+ * otherwise. Objects are read-only so hard links to them can't be edited
+ * in place
+ */
+
+static int store_object(const char *path, mode_t mode, off_t size,
+                        const char *hash, int linked) {
+  char object[OBJECT_PATH_SIZE];
+  char staged[BUFSIZ * 2];
+  char dir[OBJECT_PATH_SIZE];
+
+  object_path(object, hash);
+
+  if (0 == fs_exists(object)) {
+    return 0;
+  }
+
+  sprintf(dir, "%s/%.2s", store_dir, hash);
+  if (0 != check_dir(dir)) {
+    return -1;
+  }
+
+  // identical content may race in from another process, either copy wins
+  staging_path(staged, object);
+  if (0 != (linked ? link_contents(path, staged, (mode & 0555) | 0400)
+                   : copy_contents(path, staged, (mode & 0555) | 0400))) {
+    return -1;
+  }
+
+  if (0 != publish(staged, object)) {
+    return -1;
+  }
+
+  if (store_bytes >= 0) {
+    __sync_fetch_and_add(&store_bytes, (int64_t)size);
+  }
+
+  return 0;
+}
+
+static int store_file(const char *path, mode_t mode, off_t size,
+                      char hash[CLIB_HASH_HEX_SIZE]) {
+  if (0 != clib_hash_file(path, hash)) {
+    return -1;
+  }
+
+  return store_object(path, mode, size, hash, 0);
+}
+
+int clib_cache_store_file(const char *path, const char *hash) {
+  struct stat st;
+
+  // a pack holds a copy of its own of every file
+  if (0 == *store_dir || packed_mode || 0 != stat(path, &st) ||
+      !S_ISREG(st.st_mode)) {
+    return -1;
+  }
+
+  return store_object(path, st.st_mode, st.st_size, hash, 1);
+}
+
+typedef struct {
+  FILE *index;
+  const char *dir;
+  int64_t size;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t mutex;
+#endif
+} index_data_t;
+
+/**
+ * Store a regular file of the package being saved and add its index line
+ */
+
+static int index_file(int dirfd, const char *name, const char *path,
+                      void *data) {
+  index_data_t *index = data;
+  char file[BUFSIZ * 2];
+  char hash[CLIB_HASH_HEX_SIZE];
+  struct stat st;
+  int rc = 0;
+
+  if (0 != fstatat(dirfd, name, &st, 0) || !S_ISREG(st.st_mode)) {
+    return 0;
+  }
+
+  if (sizeof(file) <= (size_t)snprintf(file, sizeof(file), "%s/%s",
+                                       index->dir, path)) {
+    return -1;
+  }
+
+  if (0 != store_file(file, st.st_mode, st.st_size, hash)) {
+    return -1;
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&index->mutex);
+#endif
+  if (0 > fprintf(index->index, "%o %s %s\n", (unsigned)(st.st_mode & 0777),
+                  hash, path)) {
+    rc = -1;
+  }
+  index->size += st.st_size;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&index->mutex);
+#endif
+
+  return rc;
+}
+
+/**
+ * Create `target` from the store `object`, using the cheapest way the
+ * file system and `link_mode` allow
+ */
+
+static int materialize(const char *object, const char *target, mode_t mode) {
+  unlink(target);
+
+#if defined(FICLONE)
+  if (CLIB_CACHE_LINK_AUTO == link_mode ||
+      CLIB_CACHE_LINK_REFLINK == link_mode) {
+    int in = open(object, O_RDONLY);
+    int out = -1;
+    int cloned = 0;
+
+    if (-1 != in && -1 != (out = open(target, O_WRONLY | O_CREAT | O_TRUNC,
+                                      mode))) {
+      cloned = 0 == ioctl(out, FICLONE, in);
+    }
+
+    if (-1 != in) {
+      close(in);
+    }
+    if (-1 != out) {
+      close(out);
+      if (cloned) {
+        return 0;
+      }
+      unlink(target);
+    }
+  }
+#endif
+
+#if !defined(_WIN32)
+  if ((CLIB_CACHE_LINK_AUTO == link_mode ||
+       CLIB_CACHE_LINK_HARDLINK == link_mode) &&
+      0 == link(object, target)) {
+    return 0;
+  }
+
+  if (CLIB_CACHE_LINK_SYMLINK == link_mode && 0 == symlink(object, target)) {
+    return 0;
+  }
+#endif
+
+  return copy_contents(object, target, mode);
+}
+
+/**
+ * Split an index line "<mode> <hash> <path>" in place
+ */
+
+static int parse_index_line(char *line, unsigned *mode, char **hash,
+                            char **path) {
+  size_t len = strlen(line);
+
+  if (len > 0 && '\n' == line[len - 1]) {
+    line[--len] = 0;
+  }
+
+  if (!(*hash = strchr(line, ' ')) || !(*path = strchr(*hash + 1, ' '))) {
+    return -1;
+  }
+
+  *(*hash)++ = 0;
+  *(*path)++ = 0;
+  *mode = (unsigned)strtoul(line, NULL, 8);
+
+  if (CLIB_HASH_HEX_SIZE - 1 != strlen(*hash) ||
+      CLIB_HASH_HEX_SIZE - 1 != strspn(*hash, "0123456789abcdef") ||
+      strstr(*path, "..")) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * A store object, or a pack when `hash` is empty, to check
+ */
+
+typedef struct {
+  char hash[CLIB_HASH_HEX_SIZE];
+  const char *base; // of the entry, for a pack
+  int broken;
+} check_t;
+
+static char *read_pack(const char *path, pack_header_t *header);
+
+static int run_check(void *arg) {
+  check_t *check = arg;
+  char path[BUFSIZ * 3];
+
+  if (*check->hash) {
+    char actual[CLIB_HASH_HEX_SIZE];
+
+    object_path(path, check->hash);
+    check->broken = 0 != clib_hash_file(path, actual) ||
+                    0 != strcmp(actual, check->hash);
+  } else {
+    pack_header_t header;
+    char *payload = NULL;
+
+    sprintf(path, SHARD_PATTERN "/%s.pack", package_cache_dir,
+            shard_of(check->base), check->base);
+    payload = read_pack(path, &header);
+    check->broken = NULL == payload;
+    free(payload);
+  }
+
+  return check->broken;
+}
+
+/**
+ * Runs the `count` checks, as many at once as `concurrency` allows, and
+ * removes the store objects found broken when `repair` is set
+ *
+ * @return The number of broken ones
+ */
+
+static size_t run_checks(check_t *checks, size_t count, int repair) {
+  clib_pool_t *pool = count > 1 ? clib_pool_new(concurrency) : NULL;
+  clib_pool_group_t *group = pool ? clib_pool_group_new(pool) : NULL;
+  size_t broken = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (!group || 0 != clib_pool_submit(group, run_check, &checks[i])) {
+      run_check(&checks[i]);
+    }
+  }
+
+  if (group) {
+    clib_pool_wait(group);
+    clib_pool_group_free(group);
+  }
+
+  clib_pool_free(pool);
+
+  for (size_t i = 0; i < count; i++) {
+    if (checks[i].broken) {
+      broken++;
+
+      if (repair && *checks[i].hash) {
+        char path[OBJECT_PATH_SIZE];
+
+        object_path(path, checks[i].hash);
+        unlink(path);
+      }
+    }
+  }
+
+  return broken;
+}
+
+/**
+ * Checks every store object of the index `pkg_index`, removing the ones
+ * that don't match their hash
+ *
+ * @return 0 when they all do, 1 when some don't, -1 on error
+ */
+
+static int verify_index(const char *pkg_index) {
+  char line[BUFSIZ * 2];
+  check_t *checks = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  int rc = 0;
+  FILE *index = fopen(pkg_index, "r");
+
+  if (NULL == index) {
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), index)) {
+    char *hash = NULL;
+    char *path = NULL;
+    unsigned mode = 0;
+
+    if (0 != parse_index_line(line, &mode, &hash, &path)) {
+      rc = -1;
+      goto cleanup;
+    }
+
+    if (count == capacity) {
+      check_t *grown = NULL;
+
+      capacity = capacity ? capacity * 2 : 16;
+
+      if (!(grown = realloc(checks, capacity * sizeof(check_t)))) {
+        rc = -1;
+        goto cleanup;
+      }
+
+      checks = grown;
+    }
+
+    memset(&checks[count], 0, sizeof(check_t));
+    strcpy(checks[count++].hash, hash);
+  }
+
+  rc = run_checks(checks, count, 1) > 0 ? 1 : 0;
+
+cleanup:
+  fclose(index);
+  free(checks);
+  return rc;
+}
+
+/**
+ * Materializes the files of the index `pkg_index` in `target_dir`
+ *
+ * @return 0 on success, -2 when verifying found a broken file, -1 on
+ * other errors
+ */
+
+static int load_index(const char *pkg_index, const char *target_dir,
+                      int writable) {
+  char line[BUFSIZ * 2];
+  int rc = 0;
+  FILE *index = NULL;
+
+  // nothing of a broken package is materialized
+  if (verify_mode && 0 != (rc = verify_index(pkg_index))) {
+    return 1 == rc ? -2 : -1;
+  }
+
+  if (NULL == (index = fopen(pkg_index, "r"))) {
+    return -1;
+  }
+
+  while (0 == rc && fgets(line, sizeof(line), index)) {
+    char object[OBJECT_PATH_SIZE];
+    char target[BUFSIZ * 3];
+    char *hash = NULL;
+    char *path = NULL;
+    char *slash = NULL;
+    unsigned mode = 0;
+
+    if (0 != parse_index_line(line, &mode, &hash, &path)) {
+      rc = -1;
+      break;
+    }
+
+    object_path(object, hash);
+    sprintf(target, "%s/%s", target_dir, path);
+
+    if ((slash = strrchr(target, '/')) && slash != target) {
+      *slash = 0;
+      rc = clib_mkdirp(target, 0777);
+      *slash = '/';
+      if (0 != rc) {
+        break;
+      }
+    }
+
+    if (writable) {
+      unlink(target);
+      rc = copy_contents(object, target, mode);
+    } else {
+      rc = materialize(object, target, mode);
+    }
+  }
+
+  fclose(index);
+  return rc;
+}
+
+/**
+ * Add the store object `hash` from the remote cache unless it's here
+ */
+
+static int fetch_object(const char *hash, unsigned mode, int64_t *size) {
+  char object[OBJECT_PATH_SIZE];
+  char dir[OBJECT_PATH_SIZE];
+  char key[OBJECT_PATH_SIZE];
+  char actual[CLIB_HASH_HEX_SIZE];
+  char staged[BUFSIZ * 2];
+  struct stat st;
+
+  object_path(object, hash);
+
+  if (0 == stat(object, &st)) {
+    *size += st.st_size;
+    return 0;
+  }
+
+  sprintf(dir, "%s/%.2s", store_dir, hash);
+  sprintf(key, REMOTE_OBJECT_PATTERN, hash, hash + 2);
+
+  if (0 != check_dir(dir)) {
+    return -1;
+  }
+
+  staging_path(staged, object);
+
+  if (0 != clib_remote_get(key, staged)) {
+    return -1;
+  }
+
+  // the remote is shared, only trust what matches its hash
+  if (0 != clib_hash_file(staged, actual) || 0 != strcmp(actual, hash) ||
+      0 != chmod(staged, (mode & 0555) | 0400) || 0 != stat(staged, &st)) {
+    unlink(staged);
+    return -1;
+  }
+
+  if (0 != publish(staged, object)) {
+    return -1;
+  }
+
+  if (store_bytes >= 0) {
+    __sync_fetch_and_add(&store_bytes, (int64_t)st.st_size);
+  }
+
+  *size += st.st_size;
+  return 0;
+}
+
+/**
+ * Fill a local miss from the remote cache, with the objects first and
+ * then the index that references them
+ *
+ * @return 0 if the package is now cached, -1 otherwise
+ */
+
+static int remote_fetch(char *author, char *name, char *version) {
+  GET_PKG_INDEX(author, name, version);
+  char line[BUFSIZ * 2];
+  char key[BUFSIZ * 2];
+  char staged[BUFSIZ * 2];
+  char hash[CLIB_HASH_HEX_SIZE] = {0};
+  char *list = NULL;
+  FILE *index = NULL;
+  int64_t size = 0;
+  int store_lock = -1;
+  int lock = -1;
+  int rc = -1;
+
+  if (!clib_remote_init()) {
+    return -1;
+  }
+
+  sprintf(key, REMOTE_INDEX_PATTERN, author, name, version);
+
+  store_lock = lock_path(STORE_LOCK, 0);
+  lock = lock_entry(author, name, version, 1);
+  staging_path(staged, pkg_index);
+
+  if (0 != clib_remote_get(key, staged) || !(index = fopen(staged, "r"))) {
+    goto cleanup;
+  }
+
+  rc = 0;
+  while (0 == rc && fgets(line, sizeof(line), index)) {
+    char *object = NULL;
+    char *path = NULL;
+    unsigned mode = 0;
+
+    if (0 != parse_index_line(line, &mode, &object, &path) ||
+        0 != fetch_object(object, mode, &size)) {
+      rc = -1;
+    }
+  }
+
+  fclose(index);
+
+  if (0 == rc && (list = fs_read(staged))) {
+    clib_hash_buffer(list, strlen(list), hash);
+    free(list);
+  }
+
+  if (0 == rc && 0 == (rc = publish(staged, pkg_index))) {
+    index_update(author, name, version, ENTRY_INDEX, time(NULL), size, hash);
+  }
+
+cleanup:
+  if (0 != rc) {
+    unlink(staged);
+  }
+
+  unlock_entry(lock);
+  unlock_entry(store_lock);
+  return rc;
+}
+
+/**
+ * Upload a saved package to the remote cache, objects the remote doesn't
+ * have yet first so its index never references missing ones
+ */
+
+static void remote_push(char *author, char *name, char *version) {
+  GET_PKG_INDEX(author, name, version);
+  char line[BUFSIZ * 2];
+  char key[BUFSIZ * 2];
+  FILE *index = NULL;
+  int store_lock = -1;
+  int lock = -1;
+  int rc = 0;
+
+  if (!clib_remote_init() || !clib_remote_writable()) {
+    return;
+  }
+
+  store_lock = lock_path(STORE_LOCK, 0);
+  lock = lock_entry(author, name, version, 0);
+
+  if (!(index = fopen(pkg_index, "r"))) {
+    goto cleanup;
+  }
+
+  while (0 == rc && fgets(line, sizeof(line), index)) {
+    char object[OBJECT_PATH_SIZE];
+    char *hash = NULL;
+    char *path = NULL;
+    unsigned mode = 0;
+
+    if (0 != parse_index_line(line, &mode, &hash, &path)) {
+      rc = -1;
+      break;
+    }
+
+    sprintf(key, REMOTE_OBJECT_PATTERN, hash, hash + 2);
+    object_path(object, hash);
+
+    if (1 != clib_remote_has(key) && 0 != clib_remote_put(key, object)) {
+      rc = -1;
+    }
+  }
+
+  fclose(index);
+
+  if (0 == rc) {
+    sprintf(key, REMOTE_INDEX_PATTERN, author, name, version);
+    clib_remote_put(key, pkg_index);
+  }
+
+cleanup:
+  unlock_entry(lock);
+  unlock_entry(store_lock);
+}
+
+static int has_package(char *author, char *name, char *version) {
+  GET_PKG_INDEX(author, name, version);
+  GET_PKG_CACHE(author, name, version);
+  time_t mtime = entry_mtime(author, name, version, 1, pkg_index, NULL);
+
+  if (0 != mtime) {
+    return !is_entry_expired(version, mtime);
+  }
+
+  if (0 == fs_exists(pkg_cache)) {
+    return is_immutable(version) || !is_expired(pkg_cache);
+  }
+
+  return 0 == remote_fetch(author, name, version);
+}
+
+int clib_cache_has_package(char *author, char *name, char *version) {
+  uint64_t started = clib_trace_now();
+  int rc = has_package(author, name, version);
+
+  trace_entry("probe", author, name, version, started, rc);
+  return rc;
+}
+
+uint64_t clib_cache_package_size(char *author, char *name, char *version,
+                                 int *exact) {
+  char wanted[INDEX_KEY_SIZE];
+  char prefix[INDEX_KEY_SIZE];
+  index_record_t *record = NULL;
+  int64_t latest = 0;
+  uint64_t size = 0;
+
+  *exact = 0;
+
+  if (0 != index_key(wanted, author, name, version) ||
+      INDEX_KEY_SIZE <=
+          snprintf(prefix, INDEX_KEY_SIZE, "%s/%s@", author, name)) {
+    return 0;
+  }
+
+  INDEX_LOCK();
+
+  if ((record = index_find(wanted, 0)) && 0 != record->package_mtime) {
+    *exact = 1;
+    size = record->package_size;
+  } else if (index_records) {
+    size_t len = strlen(prefix);
+
+    hash_each(index_records, {
+      index_record_t *other = val;
+      (void)key;
+
+      if (other->package_mtime > latest &&
+          0 == strncmp(other->key, prefix, len)) {
+        latest = other->package_mtime;
+        size = other->package_size;
+      }
+    });
+  }
+
+  INDEX_UNLOCK();
+  return size;
+}
+
+int clib_cache_is_expired_package(char *author, char *name, char *version) {
+  GET_PKG_INDEX(author, name, version);
+  GET_PKG_CACHE(author, name, version);
+  time_t mtime = entry_mtime(author, name, version, 1, pkg_index, NULL);
+
+  if (0 != mtime) {
+    return is_entry_expired(version, mtime);
+  }
+
+  if (is_immutable(version) && 0 == fs_exists(pkg_cache)) {
+    return 0;
+  }
+
+  return is_expired(pkg_cache);
+}
+
+/**
+ * Cache maintenance. The store is pruned under an exclusive lock, which
+ * keeps saves from referencing objects while unreferenced ones are
+ * collected.
+ */
+
+typedef struct {
+  uint64_t size;
+  int refs;
+} object_t;
+
+typedef struct {
+  hash_t *objects; // hash -> object_t, NULL to only count
+  uint64_t size;
+  size_t count;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t mutex;
+#endif
+} store_data_t;
+
+typedef struct {
+  char base[BUFSIZ]; // "<author>_<name>_<version>"
+  char key[INDEX_KEY_SIZE];
+  time_t atime;
+  time_t mtime;
+  int packed;
+  uint64_t size; // of a pack, the files of an index are in the store
+  char (*hashes)[CLIB_HASH_HEX_SIZE];
+  size_t count;
+} entry_t;
+
+static int count_object(int dirfd, const char *name, const char *path,
+                        void *data) {
+  store_data_t *store = data;
+  object_t *object = NULL;
+  char *hash = NULL;
+  struct stat st;
+  int rc = 0;
+
+  // "<hh>/<rest>"
+  if (CLIB_HASH_HEX_SIZE != strlen(path) || '/' != path[2] ||
+      0 != fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW)) {
+    return 0;
+  }
+
+  if (store->objects) {
+    if (!(object = malloc(sizeof(object_t))) ||
+        !(hash = malloc(CLIB_HASH_HEX_SIZE))) {
+      free(object);
+      return -1;
+    }
+
+    sprintf(hash, "%.2s%s", path, path + 3);
+    object->size = st.st_size;
+    object->refs = 0;
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&store->mutex);
+#endif
+  store->size += st.st_size;
+  store->count++;
+  if (object) {
+    if (hash_get(store->objects, hash)) {
+      free(hash);
+      free(object);
+    } else {
+      hash_set(store->objects, hash, object);
+    }
+  }
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&store->mutex);
+#endif
+
+  return rc;
+}
+
+static int read_store(store_data_t *store) {
+  clib_walk_t walk = {count_object, NULL, NULL, store};
+  int rc = 0;
+
+  store->size = 0;
+  store->count = 0;
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_init(&store->mutex, NULL);
+#endif
+  rc = clib_walk(store_dir, concurrency, &walk);
+#ifdef HAVE_PTHREADS
+  pthread_mutex_destroy(&store->mutex);
+#endif
+
+  return rc;
+}
+
+typedef struct {
+  char *path;
+  uint32_t mode;
+  uint64_t size;
+} pack_entry_t;
+
+typedef struct {
+  pack_entry_t *files;
+  size_t count;
+  size_t capacity;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t mutex;
+#endif
+} pack_data_t;
+
+static int pack_collect(int dirfd, const char *name, const char *path,
+                        void *data) {
+  pack_data_t *pack = data;
+  struct stat st;
+  char *copy = NULL;
+  int rc = 0;
+
+  if (0 != fstatat(dirfd, name, &st, 0) || !S_ISREG(st.st_mode)) {
+    return 0;
+  }
+
+  if (!(copy = strdup(path))) {
+    return -1;
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&pack->mutex);
+#endif
+  if (pack->count == pack->capacity) {
+    size_t capacity = pack->capacity ? pack->capacity * 2 : 32;
+    void *files = realloc(pack->files, capacity * sizeof(pack_entry_t));
+
+    if (files) {
+      pack->files = files;
+      pack->capacity = capacity;
+    } else {
+      rc = -1;
+    }
+  }
+
+  if (0 == rc) {
+    pack_entry_t *file = &pack->files[pack->count++];
+    file->path = copy;
+    file->mode = st.st_mode & 0777;
+    file->size = st.st_size;
+  } else {
+    free(copy);
+  }
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&pack->mutex);
+#endif
+
+  return rc;
+}
+
+static int compare_pack_entry(const void *a, const void *b) {
+  return strcmp(((const pack_entry_t *)a)->path,
+                ((const pack_entry_t *)b)->path);
+}
+
+/**
+ * Lay the files of `pack` out in an unpacked payload
+ */
+
+static char *pack_payload(const char *pkg_dir, pack_data_t *pack,
+                          uint64_t *size, uint64_t *files_size) {
+  char path[BUFSIZ * 2];
+  char *payload = NULL;
+  size_t offset = 0;
+
+  *size = 0;
+  *files_size = 0;
+
+  for (size_t i = 0; i < pack->count; i++) {
+    *size += sizeof(pack_file_t) + strlen(pack->files[i].path) + 1 +
+             pack->files[i].size;
+    *files_size += pack->files[i].size;
+  }
+
+  if (!(payload = malloc(*size ? *size : 1))) {
+    return NULL;
+  }
+
+  for (size_t i = 0; i < pack->count; i++) {
+    pack_entry_t *entry = &pack->files[i];
+    pack_file_t file = {entry->mode, strlen(entry->path) + 1, entry->size};
+    FILE *fp = NULL;
+
+    memcpy(payload + offset, &file, sizeof(file));
+    offset += sizeof(file);
+    memcpy(payload + offset, entry->path, file.path_size);
+    offset += file.path_size;
+
+    sprintf(path, "%s/%s", pkg_dir, entry->path);
+
+    // the size is from before the read, a file that changed in between
+    // fails the pack
+    if (!(fp = fopen(path, "rb")) ||
+        entry->size != fread(payload + offset, 1, entry->size, fp) ||
+        EOF != fgetc(fp)) {
+      if (fp) {
+        fclose(fp);
+      }
+      free(payload);
+      return NULL;
+    }
+
+    fclose(fp);
+    offset += entry->size;
+  }
+
+  return payload;
+}
+
+/**
+ * Write the package in `pkg_dir` to the pack file `target`
+ */
+
+static int save_pack(const char *pkg_dir, const char *target,
+                     uint64_t *files_size, char hash[CLIB_HASH_HEX_SIZE]) {
+  pack_data_t pack = {NULL, 0, 0};
+  clib_walk_t walk = {pack_collect, NULL, NULL, &pack};
+  pack_header_t header;
+  char staged[BUFSIZ * 2];
+  char *payload = NULL;
+  char *packed = NULL;
+  FILE *file = NULL;
+  int rc = 0;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_init(&pack.mutex, NULL);
+#endif
+  rc = clib_walk(pkg_dir, concurrency, &walk);
+#ifdef HAVE_PTHREADS
+  pthread_mutex_destroy(&pack.mutex);
+#endif
+
+  if (0 != rc) {
+    goto cleanup;
+  }
+
+  // sorted so packing the same files gives the same pack
+  qsort(pack.files, pack.count, sizeof(pack_entry_t), compare_pack_entry);
+
+  if (!(payload = pack_payload(pkg_dir, &pack, &header.size, files_size))) {
+    rc = -1;
+    goto cleanup;
+  }
+
+  header.count = pack.count;
+  header.compression = PACK_NONE;
+  header.packed_size = header.size;
+  packed = payload;
+  clib_hash_buffer(payload, header.size, header.hash);
+  strcpy(hash, header.hash);
+
+#ifdef HAVE_ZSTD
+  size_t bound = ZSTD_compressBound(header.size);
+  char *compressed = malloc(bound ? bound : 1);
+
+  if (compressed) {
+    size_t n = ZSTD_compress(compressed, bound, payload, header.size,
+                             ZSTD_CLEVEL_DEFAULT);
+
+    if (!ZSTD_isError(n) && n < header.size) {
+      header.compression = PACK_ZSTD;
+      header.packed_size = n;
+      packed = compressed;
+    } else {
+      free(compressed);
+    }
+  }
+#endif
+
+  staging_path(staged, target);
+
+  if (!(file = fopen(staged, "wb"))) {
+    rc = -1;
+    goto cleanup;
+  }
+
+  if (1 != fwrite(&header, sizeof(header), 1, file) ||
+      (header.packed_size &&
+       1 != fwrite(packed, header.packed_size, 1, file))) {
+    rc = -1;
+  }
+
+  if (0 != fclose(file)) {
+    rc = -1;
+  }
+
+  if (0 == rc) {
+    rc = publish(staged, target);
+  } else {
+    unlink(staged);
+  }
+
+cleanup:
+  if (packed != payload) {
+    free(packed);
+  }
+  free(payload);
+  for (size_t i = 0; i < pack.count; i++) {
+    free(pack.files[i].path);
+  }
+  free(pack.files);
+  return rc;
+}
+
+/**
+ * Read the pack `path` with a single sequential read and check it
+ *
+ * @return The unpacked payload, or NULL if the pack is missing or broken
+ */
+
+static char *read_pack(const char *path, pack_header_t *header) {
+  char hash[CLIB_HASH_HEX_SIZE];
+  char *content = NULL;
+  char *payload = NULL;
+  struct stat st;
+  size_t offset = 0;
+  int fd = open(path, O_RDONLY);
+
+  if (-1 == fd) {
+    return NULL;
+  }
+
+  if (0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(pack_header_t) ||
+      !(content = malloc(st.st_size))) {
+    close(fd);
+    return NULL;
+  }
+
+  while (offset < (size_t)st.st_size) {
+    ssize_t n = read(fd, content + offset, st.st_size - offset);
+
+    if (n <= 0) {
+      if (n < 0 && EINTR == errno) {
+        continue;
+      }
+      break;
+    }
+
+    offset += n;
+  }
+
+  close(fd);
+  memcpy(header, content, sizeof(pack_header_t));
+  header->hash[CLIB_HASH_HEX_SIZE - 1] = 0;
+
+  if (offset != (size_t)st.st_size ||
+      0 != memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) ||
+      header->packed_size != st.st_size - sizeof(pack_header_t)) {
+    free(content);
+    return NULL;
+  }
+
+  if (PACK_NONE == header->compression &&
+      header->size == header->packed_size) {
+    memmove(content, content + sizeof(pack_header_t), header->size);
+    payload = content;
+    content = NULL;
+  }
+#ifdef HAVE_ZSTD
+  else if (PACK_ZSTD == header->compression &&
+           (payload = malloc(header->size ? header->size : 1))) {
+    size_t n = ZSTD_decompress(payload, header->size,
+                               content + sizeof(pack_header_t),
+                               header->packed_size);
+
+    if (ZSTD_isError(n) || n != header->size) {
+      free(payload);
+      payload = NULL;
+    }
+  }
+#endif
+
+  free(content);
+
+  if (payload) {
+    clib_hash_buffer(payload, header->size, hash);
+
+    if (0 != strcmp(hash, header->hash)) {
+      free(payload);
+      payload = NULL;
+    }
+  }
+
+  return payload;
+}
+
+static int load_pack(const char *pkg_pack, const char *target_dir) {
+  pack_header_t header;
+  char target[BUFSIZ * 3];
+  char *payload = read_pack(pkg_pack, &header);
+  clib_batch_t *batch = NULL;
+  size_t offset = 0;
+  int rc = 0;
+
+  if (!payload) {
+    return -1;
+  }
+
+  if (!(batch = clib_batch_new())) {
+    free(payload);
+    return -1;
+  }
+
+  for (uint32_t i = 0; 0 == rc && i < header.count; i++) {
+    pack_file_t file;
+    const char *path = NULL;
+    char *slash = NULL;
+
+    if (header.size - offset < sizeof(file)) {
+      rc = -1;
+      break;
+    }
+
+    memcpy(&file, payload + offset, sizeof(file));
+    offset += sizeof(file);
+    path = payload + offset;
+
+    if (0 == file.path_size || header.size - offset < file.path_size ||
+        0 != path[file.path_size - 1] ||
+        header.size - offset - file.path_size < file.size ||
+        strstr(path, "..") || '/' == *path ||
+        sizeof(target) <= (size_t)snprintf(target, sizeof(target), "%s/%s",
+                                           target_dir, path)) {
+      rc = -1;
+      break;
+    }
+
+    offset += file.path_size;
+
+    if ((slash = strrchr(target, '/')) && slash != target) {
+      *slash = 0;
+      rc = clib_mkdirp(target, 0777);
+      *slash = '/';
+      if (0 != rc) {
+        break;
+      }
+    }
+
+    // the payload is only freed after the last flush, so no copy is made
+    if (0 != clib_batch_write(batch, target, payload + offset, file.size,
+                              file.mode & 0777, 0, 0)) {
+      rc = -1;
+      break;
+    }
+
+    offset += file.size;
+  }
+
+  if (0 != clib_batch_flush(batch)) {
+    rc = -1;
+  }
+
+  clib_batch_free(batch);
+  free(payload);
+  return rc;
+}
+
+/**
+ * Prune least recently used entries once the store outgrows the budget
+ */
+
+static void evict(void) {
+  clib_cache_stats_t stats;
+
+  if (0 == max_size || !__sync_bool_compare_and_swap(&pruning, 0, 1)) {
+    return;
+  }
+
+  if (store_bytes < 0 && 0 == clib_cache_stats(&stats)) {
+    store_bytes = stats.size;
+  }
+
+  if (store_bytes > 0 && (uint64_t)store_bytes > max_size) {
+    clib_cache_prune(max_size, NULL);
+  }
+
+  pruning = 0;
+}
+
+int clib_cache_save_package(char *author, char *name, char *version,
+                            char *pkg_dir) {
+  uint64_t started = clib_trace_now();
+  GET_PKG_INDEX(author, name, version);
+  GET_PKG_CACHE(author, name, version);
+  GET_PKG_PACK(author, name, version);
+  char staged[BUFSIZ * 2];
+  FILE *index = NULL;
+  // objects are only referenced once the index is published
+  int store_lock = lock_path(STORE_LOCK, 0);
+  int lock = lock_entry(author, name, version, 1);
+  int rc = 0;
+
+  // entries from before the store are whole copies of the package
+  if (0 == fs_exists(pkg_cache)) {
+    clib_walk_remove(pkg_cache, concurrency);
+  }
+
+  if (packed_mode) {
+    char hash[CLIB_HASH_HEX_SIZE] = {0};
+    uint64_t size = 0;
+    struct stat st;
+
+    if (0 == (rc = save_pack(pkg_dir, pkg_pack, &size, hash))) {
+      unlink(pkg_index);
+      index_update(author, name, version, ENTRY_PACK, time(NULL), size, hash);
+
+      if (store_bytes >= 0 && 0 == stat(pkg_pack, &st)) {
+        __sync_fetch_and_add(&store_bytes, (int64_t)st.st_size);
+      }
+    }
+
+    unlock_entry(lock);
+    unlock_entry(store_lock);
+
+    if (0 == rc) {
+      evict();
+    }
+
+    return rc;
+  }
+
+  staging_path(staged, pkg_index);
+
+  if (!(index = fopen(staged, "w"))) {
+    unlock_entry(lock);
+    unlock_entry(store_lock);
+    return -1;
+  }
+
+  index_data_t data = {index, pkg_dir, 0};
+  clib_walk_t walk = {index_file, NULL, NULL, &data};
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_init(&data.mutex, NULL);
+#endif
+  rc = clib_walk(pkg_dir, concurrency, &walk);
+#ifdef HAVE_PTHREADS
+  pthread_mutex_destroy(&data.mutex);
+#endif
+
+  if (0 != fclose(index)) {
+    rc = -1;
+  }
+
+  if (0 == rc) {
+    char hash[CLIB_HASH_HEX_SIZE] = {0};
+    char *list = fs_read(staged);
+
+    if (list) {
+      clib_hash_buffer(list, strlen(list), hash);
+      free(list);
+    }
+
+    if (0 == (rc = publish(staged, pkg_index))) {
+      unlink(pkg_pack);
+      index_update(author, name, version, ENTRY_INDEX, time(NULL), data.size,
+                   hash);
+    }
+  } else {
+    unlink(staged);
+  }
+
+  unlock_entry(lock);
+  unlock_entry(store_lock);
+
+  if (0 == rc) {
+    remote_push(author, name, version);
+    evict();
+  }
+
+  trace_entry("save", author, name, version, started, rc);
+  return rc;
+}
+
+/**
+ * Materializes a cached tree in `target_dir`, as copies of its own when
+ * `writable` is set, for trees that are going to be written over
+ */
+
+static int load_entry(char *author, char *name, char *version,
+                      char *target_dir, int writable) {
+  uint64_t started = clib_trace_now();
+  GET_PKG_INDEX(author, name, version);
+  GET_PKG_CACHE(author, name, version);
+  GET_PKG_PACK(author, name, version);
+  int packed = 0;
+  int lock = -1;
+  int rc = -1;
+
+  time_t mtime = entry_mtime(author, name, version, 1, pkg_index, &packed);
+
+  // fetched before taking the entry lock, which it takes exclusively
+  if (0 == mtime && 0 != fs_exists(pkg_cache) &&
+      0 == remote_fetch(author, name, version)) {
+    mtime = entry_mtime(author, name, version, 1, pkg_index, &packed);
+  }
+
+  lock = lock_entry(author, name, version, 0);
+
+  if (0 != mtime) {
+    if (is_entry_expired(version, mtime)) {
+      index_update(author, name, version, ENTRY_INDEX, 0, 0, NULL);
+      unlink(packed ? pkg_pack : pkg_index);
+      rc = -2;
+    } else if (0 == check_dir(target_dir) &&
+               0 == (rc = packed
+                              ? load_pack(pkg_pack, target_dir)
+                              : load_index(pkg_index, target_dir, writable))) {
+      index_touch(author, name, version);
+    } else if (-2 == rc) {
+      index_update(author, name, version, ENTRY_INDEX, 0, 0, NULL);
+      unlink(pkg_index);
+    }
+  } else if (0 == fs_exists(pkg_cache)) {
+    if (!is_immutable(version) && is_expired(pkg_cache)) {
+      clib_walk_remove(pkg_cache, concurrency);
+      rc = -2;
+    } else {
+      rc = clib_walk_copy(pkg_cache, target_dir, concurrency);
+    }
+  }
+
+  unlock_entry(lock);
+  trace_entry("load", author, name, version, started, rc);
+  return rc;
+}
+
+int clib_cache_load_package(char *author, char *name, char *version,
+                            char *target_dir) {
+  return load_entry(author, name, version, target_dir, 0);
+}
+
+int clib_cache_delete_package(char *author, char *name, char *version) {
+  GET_PKG_INDEX(author, name, version);
+  GET_PKG_CACHE(author, name, version);
+  GET_PKG_PACK(author, name, version);
+  int lock = lock_entry(author, name, version, 1);
+  int rc = -1;
+
+  index_update(author, name, version, ENTRY_INDEX, 0, 0, NULL);
+
+  if (0 == unlink(pkg_index)) {
+    rc = 0;
+  }
+
+  if (0 == unlink(pkg_pack)) {
+    rc = 0;
+  }
+
+  if (0 == fs_exists(pkg_cache) &&
+      0 == clib_walk_remove(pkg_cache, concurrency)) {
+    rc = 0;
+  }
+
+  unlock_entry(lock);
+  return rc;
+}
+
+int clib_cache_save_executable(char *author, char *name, char *version,
+                               char *dir) {
+  char executable[BUFSIZ];
+
+  if (sizeof(executable) <= (size_t)snprintf(executable, sizeof(executable),
+                                             EXECUTABLE_NAME_PATTERN, name)) {
+    return -1;
+  }
+
+  return clib_cache_save_package(author, executable, version, dir);
+}
+
+int clib_cache_load_executable(char *author, char *name, char *version,
+                               char *target_dir) {
+  char executable[BUFSIZ];
+
+  if (sizeof(executable) <= (size_t)snprintf(executable, sizeof(executable),
+                                             EXECUTABLE_NAME_PATTERN, name)) {
+    return -1;
+  }
+
+  return clib_cache_load_package(author, executable, version, target_dir);
+}
+
+int clib_cache_save_build(char *author, char *name, char *version, char *key,
+                          char *dir) {
+  char build[BUFSIZ];
+
+  if (sizeof(build) <= (size_t)snprintf(build, sizeof(build),
+                                        BUILD_NAME_PATTERN, name, key)) {
+    return -1;
+  }
+
+  return clib_cache_save_package(author, build, version, dir);
+}
+
+int clib_cache_load_build(char *author, char *name, char *version, char *key,
+                          char *target_dir) {
+  char build[BUFSIZ];
+
+  if (sizeof(build) <= (size_t)snprintf(build, sizeof(build),
+                                        BUILD_NAME_PATTERN, name, key)) {
+    return -1;
+  }
+
+  return load_entry(author, build, version, target_dir, 1);
+}
+
+static void free_objects(hash_t *objects) {
+  if (objects) {
+    hash_each(objects, {
+      free((char *)key);
+      free(val);
+    });
+    hash_free(objects);
+  }
+}
+
+/**
+ * Read the hashes listed by the package index `path` into `entry`
+ */
+
+static int read_entry_hashes(const char *path, entry_t *entry) {
+  char line[BUFSIZ * 2];
+  FILE *index = fopen(path, "r");
+  size_t size = 0;
+  int rc = 0;
+
+  if (NULL == index) {
+    return -1;
+  }
+
+  while (0 == rc && fgets(line, sizeof(line), index)) {
+    char *hash = NULL;
+    char *file = NULL;
+    unsigned mode = 0;
+
+    if (0 != parse_index_line(line, &mode, &hash, &file)) {
+      rc = -1;
+      break;
+    }
+
+    if (entry->count == size) {
+      void *hashes = realloc(entry->hashes, (size ? size * 2 : 16) *
+                                                CLIB_HASH_HEX_SIZE);
+      if (!hashes) {
+        rc = -1;
+        break;
+      }
+      entry->hashes = hashes;
+      size = size ? size * 2 : 16;
+    }
+
+    strcpy(entry->hashes[entry->count++], hash);
+  }
+
+  fclose(index);
+  return rc;
+}
+
+/**
+ * List the package entries of the cache, with their access times taken
+ * from the index when it has them.
+ *
+ * @return The number of entries in `*entries`, or -1 on error
+ */
+
+static ssize_t read_entries(entry_t **entries) {
+#ifndef _WIN32
+  DIR *dir = NULL;
+  struct dirent *dirent = NULL;
+  hash_t *bases = hash_new();
+  ssize_t count = 0;
+  size_t size = 0;
+
+  *entries = NULL;
+
+  if (!bases) {
+    return -1;
+  }
+
+  // "<author>/<name>@<version>" is stored as "<author>_<name>_<version>"
+  INDEX_LOCK();
+  if (index_records) {
+    hash_each_val(index_records, {
+      index_record_t *record = val;
+      const char *slash = strchr(record->key, '/');
+      const char *at = strrchr(record->key, '@');
+      char base[BUFSIZ];
+      char *copy = NULL;
+
+      if (record->package_mtime && slash && at && at > slash) {
+        sprintf(base, "%.*s_%.*s_%s", (int)(slash - record->key), record->key,
+                (int)(at - slash - 1), slash + 1, at + 1);
+        if (!hash_get(bases, base) && (copy = strdup(base))) {
+          hash_set(bases, copy, record);
+        }
+      }
+    });
+  }
+
+  for (unsigned shard = 0; -1 != count && shard < SHARDS; shard++) {
+    char shard_dir[BUFSIZ * 2];
+
+    sprintf(shard_dir, SHARD_PATTERN, package_cache_dir, shard);
+
+    if (!(dir = opendir(shard_dir))) {
+      continue;
+    }
+
+    while ((dirent = readdir(dir))) {
+      const char *suffix = strrchr(dirent->d_name, '.');
+      index_record_t *record = NULL;
+      char path[BUFSIZ * 3];
+      entry_t *entry = NULL;
+      struct stat st;
+
+      if (!suffix ||
+          (0 != strcmp(suffix, ".index") && 0 != strcmp(suffix, ".pack")) ||
+          suffix - dirent->d_name >= BUFSIZ ||
+          0 != fstatat(dirfd(dir), dirent->d_name, &st, 0)) {
+        continue;
+      }
+
+      if ((size_t)count == size) {
+        void *more =
+            realloc(*entries, (size ? size * 2 : 64) * sizeof(entry_t));
+        if (!more) {
+          count = -1;
+          break;
+        }
+        *entries = more;
+        size = size ? size * 2 : 64;
+      }
+
+      entry = &(*entries)[count++];
+      memset(entry, 0, sizeof(entry_t));
+      sprintf(entry->base, "%.*s", (int)(suffix - dirent->d_name),
+              dirent->d_name);
+      entry->mtime = entry->atime = st.st_mtime;
+
+      if ((record = hash_get(bases, entry->base))) {
+        strcpy(entry->key, record->key);
+        entry->mtime = record->package_mtime;
+        entry->atime = record->package_atime > record->package_mtime
+                           ? record->package_atime
+                           : record->package_mtime;
+      }
+
+      sprintf(path, "%s/%s", shard_dir, dirent->d_name);
+
+      if (0 == strcmp(suffix, ".pack")) {
+        entry->packed = 1;
+        entry->size = st.st_size;
+      } else {
+        read_entry_hashes(path, entry);
+      }
+    }
+
+    closedir(dir);
+  }
+  INDEX_UNLOCK();
+
+  hash_each_key(bases, free((char *)key));
+  hash_free(bases);
+
+  if (-1 == count) {
+    free(*entries);
+    *entries = NULL;
+  }
+
+  return count;
+#else
+  *entries = NULL;
+  return 0;
+#endif
+}
+
+static void free_entries(entry_t *entries, ssize_t count) {
+  for (ssize_t i = 0; i < count; i++) {
+    free(entries[i].hashes);
+  }
+  free(entries);
+}
+
+static int compare_atime(const void *a, const void *b) {
+  const entry_t *x = a;
+  const entry_t *y = b;
+
+  return x->atime < y->atime ? -1 : x->atime > y->atime;
+}
+
+static int delete_entry(entry_t *entry) {
+  char path[BUFSIZ * 3];
+  int lock = lock_path(entry->base, 1);
+  int rc = 0;
+
+  if (*entry->key) {
+    index_update_key(entry->key, ENTRY_INDEX, 0, 0, NULL);
+  }
+
+  sprintf(path, SHARD_PATTERN "/%s%s", package_cache_dir,
+          shard_of(entry->base), entry->base,
+          entry->packed ? ".pack" : ".index");
+  rc = unlink(path);
+
+  unlock_entry(lock);
+  return rc;
+}
+
+/**
+ * Remove expired cache directories and files of the shards of `root` with
+ * `suffix`
+ */
+
+static void prune_expired_files(const char *root, const char *suffix,
+                                uint64_t *freed) {
+#ifndef _WIN32
+  for (unsigned shard = 0; shard < SHARDS; shard++) {
+    char dir_path[BUFSIZ * 2];
+    DIR *dir = NULL;
+    struct dirent *entry = NULL;
+
+    sprintf(dir_path, SHARD_PATTERN, root, shard);
+
+    if (NULL == (dir = opendir(dir_path))) {
+      continue;
+    }
+
+    while ((entry = readdir(dir))) {
+      const char *dot = strrchr(entry->d_name, '.');
+      char version[BUFSIZ];
+      char path[BUFSIZ * 3];
+      struct stat st;
+
+      // "<author>_<name>_<version>", and then the suffix for the files of
+      // a manifest, where only the manifest itself is immutable
+      snprintf(version, sizeof(version), "%s",
+               strrchr(entry->d_name, '_') ? strrchr(entry->d_name, '_') + 1
+                                           : "");
+      if (suffix && strrchr(version, '.')) {
+        *strrchr(version, '.') = 0;
+      }
+
+      if ('.' == entry->d_name[0] ||
+          0 != fstatat(dirfd(dir), entry->d_name, &st, 0) ||
+          !is_expired_at(st.st_mtime) ||
+          ((!suffix || 0 == strcmp(suffix, ".json")) &&
+           is_immutable(version))) {
+        continue;
+      }
+
+      sprintf(path, "%s/%s", dir_path, entry->d_name);
+
+      if (suffix ? dot && 0 == strcmp(dot, suffix) : S_ISDIR(st.st_mode)) {
+        if (S_ISDIR(st.st_mode) ? 0 == clib_walk_remove(path, concurrency)
+                                : 0 == unlink(path)) {
+          *freed += S_ISDIR(st.st_mode) ? 0 : st.st_size;
+        }
+      }
+    }
+
+    closedir(dir);
+  }
+#endif
+}
+
+int clib_cache_prune(uint64_t size, uint64_t *freed) {
+  store_data_t store = {NULL};
+  entry_t *entries = NULL;
+  ssize_t count = 0;
+  uint64_t removed = 0;
+  uint64_t packs = 0;
+  int lock = -1;
+  int rc = 0;
+
+  if (!(store.objects = hash_new())) {
+    return -1;
+  }
+
+  lock = lock_path(STORE_LOCK, 1);
+
+  // expired manifests, and entries from before the store
+  prune_expired_files(json_cache_dir, ".json", &removed);
+  prune_expired_files(json_cache_dir, ".etag", &removed);
+  prune_expired_files(json_cache_dir, ".missing", &removed);
+  prune_expired_files(package_cache_dir, NULL, &removed);
+
+  if (0 != read_store(&store) || -1 == (count = read_entries(&entries))) {
+    rc = -1;
+    goto cleanup;
+  }
+
+  for (ssize_t i = 0; i < count; i++) {
+    packs += entries[i].size;
+
+    for (size_t j = 0; j < entries[i].count; j++) {
+      object_t *object = hash_get(store.objects, entries[i].hashes[j]);
+      if (object) {
+        object->refs++;
+      }
+    }
+  }
+
+  // least recently used first, expired entries go regardless of size
+  qsort(entries, count, sizeof(entry_t), compare_atime);
+
+  for (ssize_t i = 0; i < count; i++) {
+    const char *at = strrchr(entries[i].key, '@');
+
+    if (!is_entry_expired(at ? at + 1 : NULL, entries[i].mtime) &&
+        (0 == size || store.size + packs <= size)) {
+      continue;
+    }
+
+    if (0 != delete_entry(&entries[i])) {
+      continue;
+    }
+
+    packs -= entries[i].size;
+    removed += entries[i].size;
+
+    for (size_t j = 0; j < entries[i].count; j++) {
+      object_t *object = hash_get(store.objects, entries[i].hashes[j]);
+      if (object && 0 == --object->refs) {
+        store.size -= object->size;
+      }
+    }
+  }
+
+  hash_each(store.objects, {
+    object_t *object = val;
+    char path[OBJECT_PATH_SIZE];
+
+    if (object->refs <= 0) {
+      object_path(path, key);
+      if (0 == unlink(path)) {
+        removed += object->size;
+      }
+    }
+  });
+
+  store_bytes = store.size + packs;
+
+cleanup:
+  unlock_entry(lock);
+  free_entries(entries, count);
+  free_objects(store.objects);
+
+  if (freed) {
+    *freed = removed;
+  }
+
+  return rc;
+}
+
+int clib_cache_verify(int repair) {
+  hash_t *checked = hash_new();
+  entry_t *entries = NULL;
+  check_t *checks = NULL;
+  ssize_t count = 0;
+  size_t total = 0;
+  size_t packs = 0;
+  int broken = 0;
+
+  if (!checked) {
+    return -1;
+  }
+
+  if (-1 == (count = read_entries(&entries))) {
+    hash_free(checked);
+    return -1;
+  }
+
+  for (ssize_t i = 0; i < count; i++) {
+    total += entries[i].count + (entries[i].packed ? 1 : 0);
+  }
+
+  if (total && !(checks = calloc(total, sizeof(check_t)))) {
+    broken = -1;
+    goto cleanup;
+  }
+
+  // the packs first, in the order of the entries, then each object once
+  for (ssize_t i = 0; i < count; i++) {
+    if (entries[i].packed) {
+      checks[packs++].base = entries[i].base;
+    }
+  }
+
+  total = packs;
+
+  for (ssize_t i = 0; i < count; i++) {
+    for (size_t j = 0; j < entries[i].count; j++) {
+      char *hash = entries[i].hashes[j];
+
+      if (!hash_get(checked, hash)) {
+        strcpy(checks[total].hash, hash);
+        hash_set(checked, hash, &checks[total++]);
+      }
+    }
+  }
+
+  run_checks(checks, total, repair);
+  packs = 0;
+
+  for (ssize_t i = 0; i < count; i++) {
+    int ok = !entries[i].packed || !checks[packs++].broken;
+
+    for (size_t j = 0; ok && j < entries[i].count; j++) {
+      check_t *check = hash_get(checked, entries[i].hashes[j]);
+      ok = !check->broken;
+    }
+
+    if (!ok) {
+      broken++;
+      if (repair) {
+        delete_entry(&entries[i]);
+      }
+    }
+  }
+
+cleanup:
+  free(checks);
+  free_entries(entries, count);
+  hash_free(checked);
+
+  return broken;
+}
+
+int clib_cache_stats(clib_cache_stats_t *stats) {
+  store_data_t store = {NULL};
+  entry_t *entries = NULL;
+  ssize_t count = 0;
+#ifndef _WIN32
+  DIR *dir = NULL;
+  struct dirent *entry = NULL;
+#endif
+
+  memset(stats, 0, sizeof(clib_cache_stats_t));
+  stats->max_size = max_size;
+
+  if (0 != read_store(&store) || -1 == (count = read_entries(&entries))) {
+    return -1;
+  }
+
+  stats->packages = count;
+  stats->objects = store.count;
+  stats->size = store.size;
+  for (ssize_t i = 0; i < count; i++) {
+    stats->size += entries[i].size;
+  }
+  free_entries(entries, count);
+
+#ifndef _WIN32
+  for (unsigned shard = 0; shard < SHARDS; shard++) {
+    char shard_dir[BUFSIZ * 2];
+
+    sprintf(shard_dir, SHARD_PATTERN, json_cache_dir, shard);
+
+    if ((dir = opendir(shard_dir))) {
+      while ((entry = readdir(dir))) {
+        const char *dot = strrchr(entry->d_name, '.');
+        if (dot && 0 == strcmp(dot, ".json")) {
+          stats->manifests++;
+        }
+      }
+      closedir(dir);
+    }
+  }
+#endif
+
+  return 0;
+}
+
+void clib_cache_set_max_size(uint64_t size) { max_size = size; }
+
+void clib_cache_set_packed(int packed) { packed_mode = packed; }
+
+void clib_cache_set_verify(int verify) { verify_mode = verify; }
+
+int clib_cache_parse_size(const char *str, uint64_t *size) {
+  char *end = NULL;
+  unsigned long long value = 0;
+
+  if (!str || !*str) {
+    return -1;
+  }
+
+  const char *units = "KMGT";
+  const char *unit = NULL;
+
+  value = strtoull(str, &end, 10);
+
+  if (end == str) {
+    return -1;
+  }
+
+  if (*end && (unit = strchr(units, toupper((unsigned char)*end)))) {
+    value <<= 10 * (unit - units + 1);
+    end++;
+  }
+
+  if (*end && 0 != strcmp(end, "B")) {
+    return -1;
+  }
+
+  *size = value;
+  return 0;
 }
@@ -8,14 +8,50 @@
 #ifndef CLIB_CACHE_H
 #define CLIB_CACHE_H
 
+#include "fs/fs.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
 
+/**
+ * How cached package files are materialized into a target directory.
+ * `CLIB_CACHE_LINK_AUTO` tries a reflink, then a hard link, then a copy.
+ * It can be set with the `CLIB_CACHE_LINK` environment variable to one
+ * of "reflink", "hardlink", "symlink" or "copy".
+ */
+typedef enum {
+  CLIB_CACHE_LINK_AUTO = 0,
+  CLIB_CACHE_LINK_REFLINK,
+  CLIB_CACHE_LINK_HARDLINK,
+  CLIB_CACHE_LINK_SYMLINK,
+  CLIB_CACHE_LINK_COPY,
+} clib_cache_link_t;
+
+#define CLIB_CACHE_DEFAULT_CONCURRENCY 4
+
+// how long a manifest name that wasn't found isn't asked for again, in
+// seconds, `CLIB_CACHE_MISSING_TIME`
+#define CLIB_CACHE_DEFAULT_MISSING_TIME (24 * 60 * 60)
+
+// how long past its expiration the search cache or a manifest is still
+// used while it is refreshed in the background, in seconds,
+// `CLIB_CACHE_MAX_STALE`, 0 to wait for the refresh instead
+#define CLIB_CACHE_DEFAULT_MAX_STALE (7 * 24 * 60 * 60)
+
+typedef struct {
+  size_t packages;   // cached package versions
+  size_t manifests;  // cached package.json files
+  size_t objects;    // distinct files in the store
+  uint64_t size;     // bytes used by cached packages
+  uint64_t max_size; // eviction budget, 0 when unbounded
+} clib_cache_stats_t;
+
 /**
  * Internal setup, creates the base cache dir if necessary
  *
- * @param expiration Cache expiration in seconds
+ * @param expiration Cache expiration in seconds, of the entries of refs
+ * that move, like "master". Those of tags, like "1.2.3" or "v1.2.3", and
+ * commit hashes never expire, they only go when the cache is pruned.
  *
  * @return 0 on success, -1 otherwise
  */
@@ -33,6 +69,45 @@ int clib_cache_meta_init(void);
  */
 const char *clib_cache_meta_dir(void);
 
+/**
+ * Sets how many threads walk package trees when saving, copying or
+ * removing them
+ */
+void clib_cache_set_concurrency(int concurrency);
+
+/**
+ * Store every package version saved from now on as a single pack file,
+ * zstd compressed when available, instead of an index of shared files.
+ * Packs load with one sequential read but share nothing between
+ * versions. It can be set with `CLIB_CACHE_PACK=1`.
+ */
+void clib_cache_set_packed(int packed);
+
+/**
+ * Checks the files of every package loaded from now on against their
+ * hashes, several at once, before any of them is used. A package with a
+ * broken file is deleted, and loads as expired would. It can be set with
+ * `CLIB_CACHE_VERIFY=1`.
+ */
+void clib_cache_set_verify(int verify);
+
+/**
+ * Bounds the size of the package store. Once a save grows it past `size`
+ * bytes, the least recently loaded packages are evicted. It can be set
+ * with the `CLIB_CACHE_MAX_SIZE` environment variable, e.g. "2G".
+ *
+ * @param size The budget in bytes, 0 for no bound
+ */
+void clib_cache_set_max_size(uint64_t size);
+
+/**
+ * Parses a size like "512M", "2G" or "1024" with an optional K, M, G or T
+ * suffix, in powers of 1024
+ *
+ * @return 0 on success, -1 if `str` is not a size
+ */
+int clib_cache_parse_size(const char *str, uint64_t *size);
+
 /**
  * @return The base base dir
  */
@@ -51,6 +126,15 @@ int clib_cache_has_json(char *author, char *name, char *version);
  */
 char *clib_cache_read_json(char *author, char *name, char *version);
 
+/**
+ * Maps the cached package.json into memory rather than copying it, when it
+ * is found and not expired. Release it with `fs_unmap()`.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_cache_map_json(char *author, char *name, char *version,
+                        fs_mapping *mapping);
+
 /**
  * @return Number of written bytes, or -1 on error
  */
@@ -63,6 +147,83 @@ int clib_cache_save_json(char *author, char *name, char *version,
 int clib_cache_delete_json(char *author, char *name, char *version);
 
 /**
+ * Remembers that the package has no manifest named `file`, so that it
+ * isn't asked for again for `CLIB_CACHE_MISSING_TIME` seconds.
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_cache_save_missing_json(char *author, char *name, char *version,
+                                 const char *file);
+
+/**
+ * @return 1 if the package was found to have no manifest named `file`
+ * recently enough, 0 otherwise
+ */
+int clib_cache_has_missing_json(char *author, char *name, char *version,
+                                const char *file);
+
+/**
+ * Reads a cached package.json regardless of its age, so it can be
+ * revalidated against the server instead of being downloaded again
+ *
+ * @return The content of the cached package.json, or NULL if not found
+ */
+char *clib_cache_read_stale_json(char *author, char *name, char *version);
+
+/**
+ * Maps a cached package.json into memory regardless of its age, as
+ * `clib_cache_map_json()` does.
+ *
+ * @return 0 on success, -1 if not found
+ */
+int clib_cache_map_stale_json(char *author, char *name, char *version,
+                              fs_mapping *mapping);
+
+/**
+ * @return 1 if the cached package.json expired, but no more than
+ * `CLIB_CACHE_MAX_STALE` seconds ago, 0 otherwise
+ */
+int clib_cache_has_expired_json(char *author, char *name, char *version);
+
+/**
+ * Maps a cached package.json into memory as `clib_cache_map_json()` does,
+ * once it expired too, as long as `clib_cache_has_expired_json()`.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_cache_map_expired_json(char *author, char *name, char *version,
+                                fs_mapping *mapping);
+
+/**
+ * Makes an expired package.json fresh again, once the server told it is
+ * unchanged.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_cache_renew_json(char *author, char *name, char *version);
+
+/**
+ * Reads the ETag and Last-Modified validators stored with a cached
+ * package.json. Either value is set to NULL when it was not stored.
+ *
+ * @return 0 if any validator is cached, -1 otherwise
+ */
+int clib_cache_read_json_validators(char *author, char *name, char *version,
+                                    char **etag, char **last_modified);
+
+/**
+ * Stores the ETag and Last-Modified validators of a cached package.json.
+ * Passing NULL for both forgets previously stored validators.
+ *
+ * @return Number of written bytes, or -1 on error
+ */
+int clib_cache_save_json_validators(char *author, char *name, char *version,
+                                    const char *etag,
+                                    const char *last_modified);
+
+/**
+ * The search cache holds the index of the packages listed in the wiki.
+ *
  * @return 0/1 if the search cache exists
  */
 int clib_cache_has_search(void);
@@ -73,6 +234,24 @@ int clib_cache_has_search(void);
  */
 char *clib_cache_read_search(void);
 
+/**
+ * Maps the search cache into memory, unless it is missing or expired.
+ * Release it with `fs_unmap()`.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_cache_map_search(fs_mapping *mapping);
+
+/**
+ * Maps the search cache and its index into memory as
+ * `clib_cache_map_search()` and `clib_cache_map_search_index()` do, once
+ * they expired too, but no more than `CLIB_CACHE_MAX_STALE` seconds ago.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_cache_map_expired_search(fs_mapping *mapping);
+int clib_cache_map_expired_search_index(fs_mapping *mapping);
+
 /**
  * @return Number of written bytes, or -1 on error, or if there is no search
  * cahce
@@ -80,15 +259,115 @@ char *clib_cache_read_search(void);
 int clib_cache_save_search(char *content);
 
 /**
+ * Deletes the search cache along with its index.
+ *
  * @return 0 on success, -1 otherwise
  */
 int clib_cache_delete_search(void);
 
+/**
+ * @return The content of the index stored next to the search cache, NULL
+ * on error, if not found, or expired
+ */
+char *clib_cache_read_search_index(void);
+
+/**
+ * Maps the index stored next to the search cache into memory, unless it
+ * is missing or expired. Release it with `fs_unmap()`.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_cache_map_search_index(fs_mapping *mapping);
+
+/**
+ * @return Number of written bytes, or -1 on error
+ */
+int clib_cache_save_search_index(char *content);
+
+/**
+ * @return The ETag of the registry the search cache was made from, even
+ * once it expired, NULL if there is none
+ */
+char *clib_cache_read_search_etag(void);
+
+/**
+ * Stores the ETag of the registry the search cache was made from. Passing
+ * NULL forgets it.
+ *
+ * @return Number of written bytes, 0 when forgotten, or -1 on error
+ */
+int clib_cache_save_search_etag(const char *etag);
+
+/**
+ * Makes an expired search cache fresh again, once the registry it was
+ * made from is known to be unchanged.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_cache_renew_search(void);
+
+/**
+ * Takes the lock of refreshing the search cache, or a cached package.json,
+ * so that of all the clib processes using it expired only one refreshes
+ * it. The lock goes away with the process holding it, and its children.
+ *
+ * @return The lock for `clib_cache_end_refresh()`, or -1 when another
+ * process is refreshing it already
+ */
+int clib_cache_begin_refresh_search(void);
+int clib_cache_begin_refresh_json(char *author, char *name, char *version);
+
+/**
+ * Releases a lock taken by `clib_cache_begin_refresh_search()` or
+ * `clib_cache_begin_refresh_json()`.
+ */
+void clib_cache_end_refresh(int lock);
+
+/**
+ * @return The path of the bare git repository that every version of
+ * `author`/`name` is fetched into, in the git cache dir, which it makes,
+ * or NULL on error. It must be freed.
+ */
+char *clib_cache_git_repo(char *author, char *name);
+
+/**
+ * Takes the lock of the git repository of `author`/`name`, waiting for
+ * the other threads and clib processes using it.
+ *
+ * @return The lock for `clib_cache_unlock_git()`, or -1 if it can't be
+ * locked, in which case the caller goes ahead unlocked
+ */
+int clib_cache_lock_git(char *author, char *name);
+void clib_cache_unlock_git(int lock);
+
+/**
+ * Takes the lock of fetching `author`/`name`@`version` into the cache,
+ * waiting while another thread or clib process fetches it, so that it is
+ * downloaded once and then found in the cache by the others.
+ *
+ * @return The lock for `clib_cache_unlock_fetch()`, or -1 if it can't be
+ * locked, in which case the caller goes ahead unlocked
+ */
+int clib_cache_lock_fetch(char *author, char *name, char *version);
+void clib_cache_unlock_fetch(int lock);
+
 /**
  * @return 0/1 if the packe is cached
  */
 int clib_cache_has_package(char *author, char *name, char *version);
 
+/**
+ * Estimates how big `author`/`name`@`version` is, from the index of the
+ * cache: the size of its files when it is cached, and otherwise of the
+ * most recently cached version of the package.
+ *
+ * @param exact Set to 1 when the size is of `version` itself, 0 otherwise
+ *
+ * @return The size in bytes, 0 when no version of the package is cached
+ */
+uint64_t clib_cache_package_size(char *author, char *name, char *version,
+                                 int *exact);
+
 /**
  * @return 0/1 if the cached package modified date is more or less then the
  * given expiration. -1 if the package is not cached
@@ -96,10 +375,15 @@ int clib_cache_has_package(char *author, char *name, char *version);
 int clib_cache_is_expired_package(char *author, char *name, char *version);
 
 /**
- * @param target_dir Where the cached package should be copied
+ * Package files live once in a store keyed by their SHA-256, and each
+ * cached package version is an index of paths into it. Hard linked
+ * files are read-only so they can't be edited through `target_dir`.
+ *
+ * @param target_dir Where the cached package should be materialized
  *
  * @return 0 on success, -1 on error, if the package is not found in the cache.
- *         If the cached package is expired, it will be deleted, and -2 returned
+ *         If the cached package is expired, or broken while verifying, it
+ *         will be deleted, and -2 returned
  */
 int clib_cache_load_package(char *author, char *name, char *version,
                             char *target_dir);
@@ -114,9 +398,89 @@ int clib_cache_load_package(char *author, char *name, char *version,
 int clib_cache_save_package(char *author, char *name, char *version,
                             char *pkg_dir);
 
+/**
+ * Adds the file `path`, just downloaded and hashing to `hash`, to the
+ * store as a clone or a hard link, which is then read-only, so that
+ * saving its package writes none of it again. It is for files nothing
+ * writes to any more, not those of packages still to be configured.
+ *
+ * @return 0 on success, -1 if it can't be linked, when it is left to
+ *         `clib_cache_save_package()` to copy
+ */
+int clib_cache_store_file(const char *path, const char *hash);
+
 /**
  * @return 0 on success, -1 on error
  */
 int clib_cache_delete_package(char *author, char *name, char *version);
 
+/**
+ * Caches the extracted tarball of an executable package, kept apart from
+ * its sources, so it can be uninstalled without downloading it again
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_cache_save_executable(char *author, char *name, char *version,
+                               char *dir);
+
+/**
+ * Materializes the tree saved by `clib_cache_save_executable()` in
+ * `target_dir`, read-only like cached packages
+ *
+ * @return 0 on success, -1 on error or if it is not cached, -2 if it
+ * expired
+ */
+int clib_cache_load_executable(char *author, char *name, char *version,
+                               char *target_dir);
+
+/**
+ * Caches the files a build of a package produced in `dir`, under `key`,
+ * which tells apart builds of the same version, like the toolchain and
+ * flags they used
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_cache_save_build(char *author, char *name, char *version, char *key,
+                          char *dir);
+
+/**
+ * Copies the files saved by `clib_cache_save_build()` into `target_dir`,
+ * writable, as later builds may replace them
+ *
+ * @return 0 on success, -1 on error or if it is not cached, -2 if it
+ * expired
+ */
+int clib_cache_load_build(char *author, char *name, char *version, char *key,
+                          char *target_dir);
+
+/**
+ * Counts the cached packages and manifests and the size of the store
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_cache_stats(clib_cache_stats_t *stats);
+
+/**
+ * Removes expired entries, then the least recently loaded packages until
+ * the store fits in `size` bytes, and finally the files no package
+ * references anymore.
+ *
+ * @param size The budget in bytes, 0 to only remove expired entries
+ * @param freed Set to the number of bytes removed, unless NULL
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_cache_prune(uint64_t size, uint64_t *freed);
+
+/**
+ * Checks every file of every cached package against its hash, as many at
+ * once as the concurrency allows
+ *
+ * @param repair Whether to remove the broken files and the packages using
+ * them, so they are downloaded again
+ *
+ * @return The number of broken packages, or -1 on error
+ */
+int clib_cache_verify(int repair);
+
 #endif
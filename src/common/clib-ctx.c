@@ -0,0 +1,230 @@
+//
+// clib-ctx.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-ctx.h"
+#include "clib-cache.h"
+#include "clib-dns.h"
+#include "clib-lockfile.h"
+#include "clib-mkdir.h"
+#include "clib-ratelimit.h"
+#include "fs/fs.h"
+#include "strdup/strdup.h"
+#include <curl/curl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#define CLIB_PACKAGE_CACHE_TIME 30 * 24 * 60 * 60
+
+struct clib_ctx {
+  clib_package_opts_t opts; // with its own copies of the strings
+  clib_lockfile_t *lockfile;
+  char *lockfile_path;
+  int frozen;
+  clib_package_stats_t stats;
+};
+
+static int contexts = 0;
+
+#ifdef HAVE_PTHREADS
+// the packages module has one state for the process, which the installs
+// of each context take over in turn
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK() pthread_mutex_lock(&mutex)
+#define UNLOCK() pthread_mutex_unlock(&mutex)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+static void free_strings(clib_ctx_t *ctx) {
+  free(ctx->opts.prefix);
+  free(ctx->opts.token);
+  free(ctx->lockfile_path);
+}
+
+clib_ctx_t *clib_ctx_new(const clib_package_opts_t *opts) {
+  clib_ctx_t *ctx = calloc(1, sizeof(clib_ctx_t));
+
+  if (!ctx) {
+    return NULL;
+  }
+
+  if (opts) {
+    ctx->opts = *opts;
+    ctx->opts.prefix = opts->prefix ? strdup(opts->prefix) : NULL;
+    ctx->opts.token = opts->token ? strdup(opts->token) : NULL;
+
+    if ((opts->prefix && !ctx->opts.prefix) ||
+        (opts->token && !ctx->opts.token)) {
+      free_strings(ctx);
+      free(ctx);
+      return NULL;
+    }
+  }
+
+  LOCK();
+
+  // what each command sets up first, once for every context
+  if (0 == contexts++) {
+    curl_global_init(CURL_GLOBAL_ALL);
+    clib_cache_init(CLIB_PACKAGE_CACHE_TIME);
+    clib_ratelimit_init();
+    clib_dns_prefetch();
+  }
+
+  UNLOCK();
+
+  return ctx;
+}
+
+int clib_ctx_set_lockfile(clib_ctx_t *ctx, const char *file, int frozen) {
+  clib_lockfile_t *lockfile = NULL;
+  char *path = NULL;
+
+  if (file) {
+    if (!(path = strdup(file))) {
+      return -1;
+    }
+
+    lockfile = clib_lockfile_load(file);
+
+    if (!lockfile && frozen) {
+      free(path);
+      return -1;
+    }
+
+    if (!lockfile && !(lockfile = clib_lockfile_new())) {
+      free(path);
+      return -1;
+    }
+  }
+
+  clib_lockfile_free(ctx->lockfile);
+  free(ctx->lockfile_path);
+  ctx->lockfile = lockfile;
+  ctx->lockfile_path = path;
+  ctx->frozen = lockfile && frozen;
+  return 0;
+}
+
+/**
+ * Takes over the packages module for an install of `ctx`.
+ */
+
+static void begin(clib_ctx_t *ctx) {
+  LOCK();
+  clib_package_reset();
+  // the program may have removed some since the last install
+  clib_mkdirp_forget();
+  clib_package_set_opts(ctx->opts);
+  clib_package_set_lockfile(ctx->lockfile, ctx->frozen);
+}
+
+/**
+ * Adds up the totals of the install of `ctx` that ended with `rc`, saves
+ * its lockfile and hands the packages module over to the next one.
+ *
+ * @return `rc`, or -1 when the lockfile couldn't be saved
+ */
+
+static int end(clib_ctx_t *ctx, int rc) {
+  clib_package_stats_t stats;
+  unsigned long long *from = (unsigned long long *)&stats;
+  unsigned long long *to = (unsigned long long *)&ctx->stats;
+
+  clib_package_stats(&stats);
+
+  // every field is a counter
+  for (size_t i = 0; i < sizeof(stats) / sizeof(*from); i++) {
+    to[i] += from[i];
+  }
+
+  if (0 == rc && ctx->lockfile && !ctx->frozen && !ctx->opts.prefetch_only &&
+      !ctx->opts.plan &&
+      0 != clib_lockfile_save(ctx->lockfile, ctx->lockfile_path)) {
+    rc = -1;
+  }
+
+  clib_package_reset();
+  UNLOCK();
+  return rc;
+}
+
+int clib_ctx_install(clib_ctx_t *ctx, const char *slug, const char *dir,
+                     int verbose) {
+  clib_package_t *pkg = NULL;
+  int rc = -1;
+
+  if (!ctx || !slug) {
+    return -1;
+  }
+
+  begin(ctx);
+
+  if ((pkg = clib_package_new_from_slug(slug, verbose))) {
+    rc = 0 == clib_package_install(pkg, dir, verbose) ? 0 : -1;
+    clib_package_free(pkg);
+  }
+
+  return end(ctx, rc);
+}
+
+int clib_ctx_install_manifest(clib_ctx_t *ctx, const char *file,
+                              const char *dir, int dev, int verbose) {
+  clib_package_t *pkg = NULL;
+  char *json = NULL;
+  int rc = -1;
+
+  if (!ctx || !file || !(json = fs_read(file))) {
+    return -1;
+  }
+
+  begin(ctx);
+
+  if ((pkg = clib_package_new(json, verbose))) {
+    rc = clib_package_install_dependencies(pkg, dir, verbose);
+
+    if (0 == rc && dev) {
+      rc = clib_package_install_development(pkg, dir, verbose);
+    }
+
+    rc = 0 == rc ? 0 : -1;
+    clib_package_free(pkg);
+  }
+
+  free(json);
+  return end(ctx, rc);
+}
+
+void clib_ctx_stats(clib_ctx_t *ctx, clib_package_stats_t *stats) {
+  LOCK();
+  *stats = ctx->stats;
+  UNLOCK();
+}
+
+void clib_ctx_free(clib_ctx_t *ctx) {
+  if (NULL == ctx) {
+    return;
+  }
+
+  LOCK();
+
+  if (0 == --contexts) {
+    clib_package_cleanup();
+    curl_global_cleanup();
+  }
+
+  UNLOCK();
+
+  clib_lockfile_free(ctx->lockfile);
+  free_strings(ctx);
+  free(ctx);
+}
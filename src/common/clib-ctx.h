@@ -0,0 +1,65 @@
+//
+// clib-ctx.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_CTX_H
+#define CLIB_CTX_H 1
+
+#include "clib-package.h"
+
+/**
+ * What a program linked with libclib installs with, instead of running
+ * the commands: the options, lockfile and totals of one project. The
+ * installs of all the contexts of a process take turns, each starting
+ * over from its own options, and share the connections, the caches and
+ * the addresses of the registry hosts, which are kept warm in between.
+ */
+typedef struct clib_ctx clib_ctx_t;
+
+/**
+ * @return A new context installing with `opts`, copied, or the defaults
+ * of `clib install` when NULL, or NULL on error
+ */
+clib_ctx_t *clib_ctx_new(const clib_package_opts_t *opts);
+
+/**
+ * Has the installs of `ctx` follow and update `file`, the lockfile of the
+ * project, when set, and only install what it pins when `frozen`. It is
+ * saved after every successful install that isn't frozen, a prefetch or a
+ * plan.
+ *
+ * @return 0 on success, -1 on error or when a `frozen` lockfile is missing
+ */
+int clib_ctx_set_lockfile(clib_ctx_t *ctx, const char *file, int frozen);
+
+/**
+ * Installs the package `slug` and its dependencies into `dir`.
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_ctx_install(clib_ctx_t *ctx, const char *slug, const char *dir,
+                     int verbose);
+
+/**
+ * Installs the dependencies of the manifest `file`, and the development
+ * ones too with `dev`, into `dir`.
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_ctx_install_manifest(clib_ctx_t *ctx, const char *file,
+                              const char *dir, int dev, int verbose);
+
+/**
+ * Copies the totals of every install of `ctx` so far into `stats`.
+ */
+void clib_ctx_stats(clib_ctx_t *ctx, clib_package_stats_t *stats);
+
+/**
+ * Frees `ctx`, and what every context shares once it was the last one.
+ */
+void clib_ctx_free(clib_ctx_t *ctx);
+
+#endif
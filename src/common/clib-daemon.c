@@ -0,0 +1,672 @@
+//
+// clib-daemon.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "clib-daemon.h"
+#include "clib-cache.h"
+#include "clib-metrics.h"
+#include "clib-mkdir.h"
+#include "path-join/path-join.h"
+#include "strbuf/strbuf.h"
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// the largest request taken, arguments and environment together
+#define MAX_REQUEST (1024 * 1024)
+
+// how long a client has to send its request, in seconds
+#define REQUEST_TIMEOUT 5
+
+// the reply about a command that wasn't run, for the client to run it
+#define NOT_RUN -1
+
+// the reply to a client of another version, which runs the command itself
+#define OTHER_VERSION -2
+
+/**
+ * Sent along with the standard streams of the client, followed by its
+ * directory, the `argc` arguments and the `envc` entries of its
+ * environment, each NUL terminated.
+ */
+typedef struct {
+  char version[32]; // of the client, empty to stop the daemon
+  uint32_t size;    // of the strings that follow
+  uint32_t argc; // 0 stops the daemon
+  uint32_t envc;
+} request_t;
+
+static int socket_address(struct sockaddr_un *address) {
+  char *path = NULL;
+
+  if (0 != clib_cache_meta_init() ||
+      !(path = path_join(clib_cache_meta_dir(), CLIB_DAEMON_SOCKET))) {
+    return -1;
+  }
+
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof(address->sun_path)) {
+    free(path);
+    return -1;
+  }
+
+  strcpy(address->sun_path, path);
+  free(path);
+  return 0;
+}
+
+/**
+ * @return A socket connected to the daemon, or -1 when none is running
+ */
+
+static int connect_daemon(void) {
+  struct sockaddr_un address;
+  int fd = -1;
+
+  if (-1 == socket_address(&address) ||
+      -1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0))) {
+    return -1;
+  }
+
+  if (0 != connect(fd, (struct sockaddr *)&address, sizeof(address))) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int send_all(int fd, const void *data, size_t size) {
+  const char *p = data;
+
+  while (size > 0) {
+    ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+
+    if (-1 == sent && EINTR == errno) {
+      continue;
+    }
+
+    if (sent <= 0) {
+      return -1;
+    }
+
+    p += sent;
+    size -= sent;
+  }
+
+  return 0;
+}
+
+static int recv_all(int fd, void *data, size_t size) {
+  char *p = data;
+
+  while (size > 0) {
+    ssize_t received = recv(fd, p, size, 0);
+
+    if (-1 == received && EINTR == errno) {
+      continue;
+    }
+
+    if (received <= 0) {
+      return -1;
+    }
+
+    p += received;
+    size -= received;
+  }
+
+  return 0;
+}
+
+static int send_request(int fd, request_t *request, const int streams[3]) {
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(3 * sizeof(int))];
+  } control;
+  struct cmsghdr *cmsg = NULL;
+  struct msghdr message;
+  struct iovec iov;
+  ssize_t sent = 0;
+
+  memset(&message, 0, sizeof(message));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base = request;
+  iov.iov_len = sizeof(*request);
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+
+  cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), streams, 3 * sizeof(int));
+
+  do {
+    sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+  } while (-1 == sent && EINTR == errno);
+
+  return sizeof(*request) == sent ? 0 : -1;
+}
+
+/**
+ * Takes a request with the standard streams of the client into
+ * `streams`, which are -1 when it didn't send them.
+ */
+
+static int recv_request(int fd, request_t *request, int streams[3]) {
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(3 * sizeof(int))];
+  } control;
+  struct cmsghdr *cmsg = NULL;
+  struct msghdr message;
+  struct iovec iov;
+  ssize_t received = 0;
+
+  memset(&message, 0, sizeof(message));
+  iov.iov_base = request;
+  iov.iov_len = sizeof(*request);
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+
+  do {
+    received = recvmsg(fd, &message, 0);
+  } while (-1 == received && EINTR == errno);
+
+  for (cmsg = CMSG_FIRSTHDR(&message); received > 0 && cmsg;
+       cmsg = CMSG_NXTHDR(&message, cmsg)) {
+    if (SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type &&
+        CMSG_LEN(3 * sizeof(int)) == cmsg->cmsg_len) {
+      memcpy(streams, CMSG_DATA(cmsg), 3 * sizeof(int));
+    }
+  }
+
+  request->version[sizeof(request->version) - 1] = 0;
+  return sizeof(*request) == received ? 0 : -1;
+}
+
+/**
+ * Splits the `size` bytes of `body` into the directory, the arguments
+ * and the environment of `request`, into a new array holding the
+ * directory, then the arguments and the environment, each NULL
+ * terminated.
+ *
+ * @return The array, or NULL when `body` doesn't hold them
+ */
+
+static char **split_request(char *body, request_t *request) {
+  size_t count = 1 + (size_t)request->argc + request->envc;
+  char **strings = NULL;
+  char *end = body + request->size;
+  size_t n = 0;
+
+  if (count > request->size ||
+      !(strings = calloc(count + 2, sizeof(char *)))) {
+    return NULL;
+  }
+
+  for (char *p = body; p < end; p += strlen(p) + 1) {
+    if (n == count || !memchr(p, 0, end - p)) {
+      free(strings);
+      return NULL;
+    }
+
+    // after the arguments, for them to end with NULL
+    strings[n > request->argc ? n + 1 : n] = p;
+    n++;
+  }
+
+  if (n != count) {
+    free(strings);
+    return NULL;
+  }
+
+  return strings;
+}
+
+/**
+ * Runs `entry` with the arguments of `request` in a new process set up
+ * like the client, which goes away when the client does, and replies
+ * with its exit status.
+ */
+
+static void run(int fd, clib_daemon_main_t entry, request_t *request,
+                char **strings, int streams[3]) {
+  char **argv = strings + 1;
+  char **env = argv + request->argc + 1;
+  int32_t status = NOT_RUN;
+  int exited[2] = {-1, -1};
+  int wstatus = 0;
+  pid_t pid = 0;
+
+  signal(SIGCHLD, SIG_DFL);
+
+  // the write end is closed when the command is over, whichever way
+  if (0 != pipe(exited) || -1 == (pid = fork())) {
+    send_all(fd, &status, sizeof(status));
+    return;
+  }
+
+  if (0 == pid) {
+    close(fd);
+    close(exited[0]);
+    fcntl(exited[1], F_SETFD, FD_CLOEXEC);
+
+    for (int i = 0; i < 3; i++) {
+      if (i != streams[i]) {
+        dup2(streams[i], i);
+        close(streams[i]);
+      }
+    }
+
+    signal(SIGPIPE, SIG_DFL);
+
+    if (0 != chdir(strings[0])) {
+      fprintf(stderr, "Unable to change to \"%s\": %s\n", strings[0],
+              strerror(errno));
+      exit(1);
+    }
+
+    environ = env;
+
+    // the commands before this one may have removed directories
+    clib_mkdirp_forget();
+
+    exit(entry((int)request->argc, argv));
+  }
+
+  close(exited[1]);
+
+  for (;;) {
+    struct pollfd fds[2] = {{exited[0], POLLIN, 0}, {fd, POLLIN, 0}};
+
+    if (-1 == poll(fds, 2, -1)) {
+      if (EINTR == errno) {
+        continue;
+      }
+      break;
+    }
+
+    if (fds[0].revents) {
+      break;
+    }
+
+    // the client was interrupted, or sent more than it should have
+    if (fds[1].revents) {
+      kill(pid, SIGTERM);
+      break;
+    }
+  }
+
+  while (-1 == waitpid(pid, &wstatus, 0) && EINTR == errno) {
+  }
+
+  close(exited[0]);
+
+  if (WIFEXITED(wstatus)) {
+    status = WEXITSTATUS(wstatus);
+  } else if (WIFSIGNALED(wstatus)) {
+    status = 128 + WTERMSIG(wstatus);
+  } else {
+    status = 1;
+  }
+
+  send_all(fd, &status, sizeof(status));
+}
+
+/**
+ * Takes the request on `fd` and starts its command, in a process that
+ * keeps neither `listener` nor `scrapes` open.
+ *
+ * @return 1 when the daemon is to stop, 0 otherwise
+ */
+
+static int accept_request(int fd, int listener, int scrapes,
+                          const char *version, clib_daemon_find_t find) {
+  struct timeval timeout = {REQUEST_TIMEOUT, 0};
+  clib_daemon_main_t entry = NULL;
+  int streams[3] = {-1, -1, -1};
+  int32_t status = NOT_RUN;
+  request_t request;
+  char **strings = NULL;
+  char *body = NULL;
+  const char *name = NULL;
+  int stop = 0;
+  pid_t pid = 0;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (-1 == recv_request(fd, &request, streams)) {
+    goto cleanup;
+  }
+
+  if (0 == request.argc) {
+    status = 0;
+    stop = 1;
+    goto reply;
+  }
+
+  if (-1 == streams[0] || -1 == streams[1] || -1 == streams[2] ||
+      request.size > MAX_REQUEST || !(body = malloc(request.size + 1)) ||
+      -1 == recv_all(fd, body, request.size)) {
+    goto reply;
+  }
+
+  // after an upgrade, the daemon of the version before is still running
+  if (0 != strcmp(request.version, version)) {
+    status = OTHER_VERSION;
+    goto reply;
+  }
+
+  if (!(strings = split_request(body, &request))) {
+    goto reply;
+  }
+
+  name = strings[1];
+  name = 0 == strncmp(name, "clib-", 5) ? name + 5 : name;
+
+  if (!(entry = find(name))) {
+    goto reply;
+  }
+
+  fflush(NULL);
+
+  if (-1 == (pid = fork())) {
+    goto reply;
+  }
+
+  if (0 == pid) {
+    close(listener);
+    if (-1 != scrapes) {
+      close(scrapes);
+    }
+    run(fd, entry, &request, strings, streams);
+    _exit(0);
+  }
+
+  clib_metrics_count(CLIB_METRICS_COMMANDS, 1);
+  goto cleanup;
+
+reply:
+  send_all(fd, &status, sizeof(status));
+
+cleanup:
+  for (int i = 0; i < 3; i++) {
+    if (-1 != streams[i]) {
+      close(streams[i]);
+    }
+  }
+  free(strings);
+  free(body);
+  return stop;
+}
+#endif
+
+int clib_daemon_serve(const char *version, clib_daemon_find_t find) {
+#ifdef _WIN32
+  (void)version;
+  (void)find;
+  fprintf(stderr, "The clib daemon isn't supported on this platform\n");
+  return 1;
+#else
+  const char *env = getenv("CLIB_DAEMON_IDLE");
+  const char *scrape_address = getenv(CLIB_METRICS_ADDR_ENV);
+  long idle = CLIB_DAEMON_DEFAULT_IDLE;
+  struct sockaddr_un address;
+  time_t last = 0;
+  int listener = -1;
+  int scrapes = -1;
+  mode_t mask = 0;
+  int fd = -1;
+
+  if (env && *env) {
+    idle = atol(env) > 0 ? atol(env) : 0;
+  }
+
+  if (-1 == socket_address(&address)) {
+    fprintf(stderr, "Unable to find a place for the daemon socket\n");
+    return 1;
+  }
+
+  if (-1 != (fd = connect_daemon())) {
+    close(fd);
+    fprintf(stderr, "The clib daemon is running already\n");
+    return 1;
+  }
+
+  // nothing answers there, a daemon was killed before it could remove it
+  unlink(address.sun_path);
+
+  mask = umask(077);
+
+  if (-1 == (listener = socket(AF_UNIX, SOCK_STREAM, 0)) ||
+      0 != bind(listener, (struct sockaddr *)&address, sizeof(address)) ||
+      0 != listen(listener, SOMAXCONN)) {
+    fprintf(stderr, "Unable to listen on \"%s\": %s\n", address.sun_path,
+            strerror(errno));
+    umask(mask);
+    if (-1 != listener) {
+      close(listener);
+    }
+    return 1;
+  }
+
+  umask(mask);
+  fcntl(listener, F_SETFD, FD_CLOEXEC);
+
+  // what every command would do first, done once for all of them
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGCHLD, SIG_IGN);
+
+  // the commands count into the metrics too, being forked from here
+  if (scrape_address && *scrape_address) {
+    if (0 != clib_metrics_init() ||
+        -1 == (scrapes = clib_metrics_listen(scrape_address))) {
+      fprintf(stderr, "Unable to serve metrics on \"%s\"\n",
+              scrape_address);
+    } else {
+      fcntl(scrapes, F_SETFD, FD_CLOEXEC);
+    }
+  }
+
+  last = time(NULL);
+
+  for (;;) {
+    // poll() skips the scrapes when they are -1
+    struct pollfd fds[2] = {{listener, POLLIN, 0}, {scrapes, POLLIN, 0}};
+    long left = idle - (long)(time(NULL) - last);
+    int ready = 0;
+
+    // scrapes don't keep the daemon from being idle
+    if (idle > 0 && left <= 0) {
+      break;
+    }
+
+    ready = poll(fds, 2, idle > 0 ? (int)(left * 1000) : -1);
+
+    if (-1 == ready && EINTR == errno) {
+      continue;
+    }
+
+    if (ready < 0) {
+      break;
+    }
+
+    if (-1 != scrapes && fds[1].revents &&
+        -1 != (fd = accept(scrapes, NULL, NULL))) {
+      clib_metrics_answer(fd);
+    }
+
+    if (!fds[0].revents || -1 == (fd = accept(listener, NULL, NULL))) {
+      continue;
+    }
+
+    last = time(NULL);
+
+    if (1 == accept_request(fd, listener, scrapes, version, find)) {
+      close(fd);
+      break;
+    }
+
+    close(fd);
+  }
+
+  if (-1 != scrapes) {
+    close(scrapes);
+  }
+
+  close(listener);
+  unlink(address.sun_path);
+  curl_global_cleanup();
+  return 0;
+#endif
+}
+
+int clib_daemon_stop(void) {
+#ifndef _WIN32
+  const int streams[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  int32_t status = NOT_RUN;
+  int fd = connect_daemon();
+  request_t request;
+
+  memset(&request, 0, sizeof(request));
+
+  if (-1 != fd && 0 == send_request(fd, &request, streams) &&
+      0 == recv_all(fd, &status, sizeof(status)) && 0 == status) {
+    close(fd);
+    return 0;
+  }
+
+  if (-1 != fd) {
+    close(fd);
+  }
+#endif
+
+  fprintf(stderr, "No clib daemon is running\n");
+  return 1;
+}
+
+#ifndef _WIN32
+/**
+ * @return Non zero if `MAKEFLAGS` passes a jobserver as descriptors, which
+ * only this process has, rather than as a named pipe
+ */
+
+static int inherits_jobserver(void) {
+  const char *names[] = {"--jobserver-auth=", "--jobserver-fds=", 0};
+  const char *flags = getenv("MAKEFLAGS");
+
+  for (int i = 0; flags && names[i]; i++) {
+    for (const char *p = flags; (p = strstr(p, names[i])); p++) {
+      if (0 != strncmp(p + strlen(names[i]), "fifo:", 5)) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+#endif
+
+int clib_daemon_forward(const char *version, int argc, char **argv) {
+#ifdef _WIN32
+  (void)version;
+  (void)argc;
+  (void)argv;
+  return -1;
+#else
+  const int streams[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  const char *env = getenv("CLIB_NO_DAEMON");
+  strbuf_t body = STRBUF_INIT;
+  int32_t status = NOT_RUN;
+  request_t request;
+  char cwd[BUFSIZ];
+  int fd = -1;
+
+  if ((env && *env && 0 != strcmp(env, "0")) || argc < 1 ||
+      inherits_jobserver() || -1 == (fd = connect_daemon())) {
+    return NOT_RUN;
+  }
+
+  memset(&request, 0, sizeof(request));
+  snprintf(request.version, sizeof(request.version), "%s", version);
+
+  if (!getcwd(cwd, sizeof(cwd)) ||
+      -1 == strbuf_append_n(&body, cwd, strlen(cwd) + 1)) {
+    goto cleanup;
+  }
+
+  for (int i = 0; i < argc; i++) {
+    if (-1 == strbuf_append_n(&body, argv[i], strlen(argv[i]) + 1)) {
+      goto cleanup;
+    }
+  }
+
+  for (char **entry = environ; entry && *entry; entry++) {
+    if (-1 == strbuf_append_n(&body, *entry, strlen(*entry) + 1)) {
+      goto cleanup;
+    }
+    request.envc++;
+  }
+
+  request.size = (uint32_t)body.len;
+  request.argc = (uint32_t)argc;
+
+  // the command writes to the same streams
+  fflush(NULL);
+
+  if (0 != send_request(fd, &request, streams) ||
+      0 != send_all(fd, body.data, body.len)) {
+    goto cleanup;
+  }
+
+  // it may have run partly already, it can't be run once more here
+  if (0 != recv_all(fd, &status, sizeof(status))) {
+    fprintf(stderr, "Lost the clib daemon while running \"%s\"\n", argv[0]);
+    status = 1;
+  }
+
+  if (OTHER_VERSION == status) {
+    fprintf(stderr,
+            "The clib daemon running is not of clib %s, restart it with "
+            "\"clib daemon stop\" and \"clib daemon\"\n",
+            version);
+    status = NOT_RUN;
+  }
+
+cleanup:
+  close(fd);
+  strbuf_free(&body);
+  return status;
+#endif
+}
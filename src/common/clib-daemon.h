@@ -0,0 +1,64 @@
+//
+// clib-daemon.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_DAEMON_H
+#define CLIB_DAEMON_H 1
+
+// in the meta cache dir
+#define CLIB_DAEMON_SOCKET "daemon.sock"
+
+// how long the daemon waits for a command before it stops, in seconds,
+// `CLIB_DAEMON_IDLE`
+#define CLIB_DAEMON_DEFAULT_IDLE (10 * 60)
+
+typedef int (*clib_daemon_main_t)(int argc, char **argv);
+
+/**
+ * @return The entry point of the command `name`, or NULL if there is none
+ */
+typedef clib_daemon_main_t (*clib_daemon_find_t)(const char *name);
+
+/**
+ * Runs the daemon of clib `version` in the foreground until it's stopped
+ * or was idle for
+ * `CLIB_DAEMON_IDLE` seconds, 0 for good. It takes the commands that
+ * `clib_daemon_forward()` sends it on a socket in the meta cache dir that
+ * only its user may use, and runs each of them, as `find` finds it by the
+ * name of `argv[0]` without its "clib-" prefix, in a copy of itself with
+ * the arguments, directory, environment and standard streams of the
+ * caller. The copy starts out with the binary and libcurl loaded and set
+ * up, instead of a new process doing so for each command.
+ *
+ * Clients of another version of clib are turned away, as a daemon still
+ * running after an upgrade would run the commands of the version before.
+ *
+ * With `CLIB_METRICS_ADDR` set, it also answers scrapes of the metrics
+ * the commands kept, see clib-metrics.h.
+ *
+ * @return 0 once stopped, 1 if it couldn't start
+ */
+int clib_daemon_serve(const char *version, clib_daemon_find_t find);
+
+/**
+ * Stops the running daemon, of any version. The commands it started run
+ * until they are over still.
+ *
+ * @return 0 on success, 1 when there is no daemon
+ */
+int clib_daemon_stop(void);
+
+/**
+ * Has the running daemon of clib `version` run `argv`, the `argc`
+ * arguments of the command `argv[0]`, unless `CLIB_NO_DAEMON` is set or
+ * `MAKEFLAGS` passes a jobserver as descriptors of this process.
+ *
+ * @return The exit status of the command, or -1 when it wasn't run and is
+ * to be run by this process
+ */
+int clib_daemon_forward(const char *version, int argc, char **argv);
+
+#endif
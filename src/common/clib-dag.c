@@ -0,0 +1,445 @@
+//
+// clib-dag.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-dag.h"
+#include "clib-pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+enum {
+  CLIB_DAG_WAITING = 0,
+  CLIB_DAG_RUNNING,
+  CLIB_DAG_DONE,
+  CLIB_DAG_FAILED,
+};
+
+typedef struct {
+  void *item;
+  int *dependents;
+  int dependents_count;
+  int pending;
+  int blocked;
+  int state;
+  // 0 when unknown
+  uint64_t cost;
+  // own cost and the longest path of dependents after it
+  uint64_t priority;
+  // number of nodes waiting on it, directly or not
+  uint64_t downstream;
+  int visit;
+} clib_dag_node_t;
+
+struct clib_dag {
+  clib_dag_node_t *nodes;
+  int count;
+  int capacity;
+  // bookkeeping for `clib_dag_run()`
+  int finished;
+  int running;
+  int failures;
+  clib_dag_fn fn;
+  void *data;
+  clib_pool_group_t *group;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t mutex;
+#endif
+};
+
+typedef struct {
+  clib_dag_t *self;
+  int node;
+} clib_dag_task_t;
+
+#ifdef HAVE_PTHREADS
+#define LOCK(self) pthread_mutex_lock(&(self)->mutex)
+#define UNLOCK(self) pthread_mutex_unlock(&(self)->mutex)
+#else
+#define LOCK(self)
+#define UNLOCK(self)
+#endif
+
+clib_dag_t *clib_dag_new(void) {
+  clib_dag_t *self = malloc(sizeof(clib_dag_t));
+
+  if (NULL == self) {
+    return NULL;
+  }
+
+  memset(self, 0, sizeof(clib_dag_t));
+  return self;
+}
+
+int clib_dag_add(clib_dag_t *self, void *item) {
+  if (NULL == self) {
+    return -1;
+  }
+
+  if (self->count == self->capacity) {
+    int capacity = self->capacity ? self->capacity * 2 : 16;
+    clib_dag_node_t *nodes =
+        realloc(self->nodes, capacity * sizeof(clib_dag_node_t));
+
+    if (NULL == nodes) {
+      return -1;
+    }
+
+    self->nodes = nodes;
+    self->capacity = capacity;
+  }
+
+  memset(&self->nodes[self->count], 0, sizeof(clib_dag_node_t));
+  self->nodes[self->count].item = item;
+
+  return self->count++;
+}
+
+int clib_dag_depend(clib_dag_t *self, int node, int prerequisite) {
+  if (!self || node < 0 || node >= self->count || prerequisite < 0 ||
+      prerequisite >= self->count || node == prerequisite) {
+    return -1;
+  }
+
+  clib_dag_node_t *pre = &self->nodes[prerequisite];
+
+  for (int i = 0; i < pre->dependents_count; i++) {
+    if (node == pre->dependents[i]) {
+      return 0;
+    }
+  }
+
+  int *dependents =
+      realloc(pre->dependents, (pre->dependents_count + 1) * sizeof(int));
+
+  if (NULL == dependents) {
+    return -1;
+  }
+
+  pre->dependents = dependents;
+  pre->dependents[pre->dependents_count++] = node;
+  (void)self->nodes[node].pending++;
+
+  return 0;
+}
+
+void clib_dag_set_cost(clib_dag_t *self, int node, uint64_t cost) {
+  if (!self || node < 0 || node >= self->count) {
+    return;
+  }
+
+  self->nodes[node].cost = cost;
+}
+
+int clib_dag_size(clib_dag_t *self) { return self ? self->count : 0; }
+
+void *clib_dag_item(clib_dag_t *self, int node) {
+  if (!self || node < 0 || node >= self->count) {
+    return NULL;
+  }
+
+  return self->nodes[node].item;
+}
+
+enum { UNVISITED = 0, VISITING, VISITED };
+
+/**
+ * Works out the priority of `node` and the nodes after it, given
+ * `unknown` as the cost of those without one. An edge back to a node
+ * still being visited closes a cycle and adds nothing.
+ */
+
+static void prioritize(clib_dag_t *self, int node, uint64_t unknown) {
+  clib_dag_node_t *n = &self->nodes[node];
+  uint64_t longest = 0;
+  uint64_t downstream = 0;
+
+  n->visit = VISITING;
+
+  for (int i = 0; i < n->dependents_count; i++) {
+    clib_dag_node_t *dependent = &self->nodes[n->dependents[i]];
+
+    if (UNVISITED == dependent->visit) {
+      prioritize(self, n->dependents[i], unknown);
+    }
+
+    if (VISITED != dependent->visit) {
+      continue;
+    }
+
+    if (dependent->priority > longest) {
+      longest = dependent->priority;
+    }
+
+    // shared dependents count once for each path, it only breaks ties
+    downstream += 1 + dependent->downstream;
+    if (downstream < dependent->downstream) {
+      downstream = UINT64_MAX;
+    }
+  }
+
+  n->priority = (n->cost ? n->cost : unknown) + longest;
+  n->downstream = downstream;
+  n->visit = VISITED;
+}
+
+/**
+ * Ranks every node by the longest path of work from its start to the end
+ * of the graph, so that the nodes holding up the most start first. With
+ * no costs at all, that is the depth of the graph below each node.
+ */
+
+static void prioritize_all(clib_dag_t *self) {
+  uint64_t known = 0;
+  uint64_t total = 0;
+
+  for (int i = 0; i < self->count; i++) {
+    self->nodes[i].visit = UNVISITED;
+
+    if (self->nodes[i].cost) {
+      total += self->nodes[i].cost;
+      (void)known++;
+    }
+  }
+
+  for (int i = 0; i < self->count; i++) {
+    if (UNVISITED == self->nodes[i].visit) {
+      prioritize(self, i, known ? total / known : 1);
+    }
+  }
+}
+
+/**
+ * @return Whether node `a` should start before node `b`
+ */
+
+static int runs_before(clib_dag_t *self, int a, int b) {
+  clib_dag_node_t *x = &self->nodes[a];
+  clib_dag_node_t *y = &self->nodes[b];
+
+  if (x->priority != y->priority) {
+    return x->priority > y->priority;
+  }
+
+  return x->downstream > y->downstream;
+}
+
+/**
+ * Picks the next node to run, the ready one with the highest priority,
+ * or -1 if none is ready. When nothing is ready or running but nodes are
+ * left, they wait on each other, so the first one is released to break
+ * the cycle.
+ */
+
+static int next_ready(clib_dag_t *self) {
+  int waiting = -1;
+  int ready = -1;
+
+  for (int i = 0; i < self->count; i++) {
+    if (CLIB_DAG_WAITING != self->nodes[i].state) {
+      continue;
+    }
+
+    if (0 == self->nodes[i].pending) {
+      if (-1 == ready || runs_before(self, i, ready)) {
+        ready = i;
+      }
+      continue;
+    }
+
+    if (-1 == waiting) {
+      waiting = i;
+    }
+  }
+
+  if (-1 != ready) {
+    return ready;
+  }
+
+  if (-1 != waiting && 0 == self->running) {
+    self->nodes[waiting].pending = 0;
+    return waiting;
+  }
+
+  return -1;
+}
+
+/**
+ * Records the outcome of `node` and releases its dependents.
+ */
+
+static void complete(clib_dag_t *self, int node, int failed) {
+  clib_dag_node_t *n = &self->nodes[node];
+
+  n->state = failed ? CLIB_DAG_FAILED : CLIB_DAG_DONE;
+  (void)self->finished++;
+
+  if (failed) {
+    (void)self->failures++;
+  }
+
+  for (int i = 0; i < n->dependents_count; i++) {
+    clib_dag_node_t *dependent = &self->nodes[n->dependents[i]];
+
+    if (CLIB_DAG_WAITING != dependent->state) {
+      continue;
+    }
+
+    if (failed) {
+      dependent->blocked = 1;
+    }
+
+    if (dependent->pending > 0) {
+      (void)dependent->pending--;
+    }
+  }
+}
+
+static int run_node(void *arg);
+
+/**
+ * Submits every node that is ready to the pool. Nodes behind a failed
+ * prerequisite are completed as failed instead.
+ */
+
+static void dispatch(clib_dag_t *self) {
+  int node = -1;
+
+  while (-1 != (node = next_ready(self))) {
+    clib_dag_task_t *task = NULL;
+
+    if (self->nodes[node].blocked) {
+      complete(self, node, 1);
+      continue;
+    }
+
+    // marked first, tasks run right away when there are no threads
+    self->nodes[node].state = CLIB_DAG_RUNNING;
+    (void)self->running++;
+
+    if (!(task = malloc(sizeof(clib_dag_task_t)))) {
+      (void)self->running--;
+      complete(self, node, 1);
+      continue;
+    }
+
+    task->self = self;
+    task->node = node;
+
+    if (0 != clib_pool_submit(self->group, run_node, task)) {
+      free(task);
+      (void)self->running--;
+      complete(self, node, 1);
+    }
+  }
+}
+
+static int run_node(void *arg) {
+  clib_dag_task_t *task = arg;
+  clib_dag_t *self = task->self;
+  int node = task->node;
+  int rc = 0;
+
+  free(task);
+  rc = self->fn(self->nodes[node].item, self->data);
+
+  LOCK(self);
+  (void)self->running--;
+  complete(self, node, 0 != rc);
+  dispatch(self);
+  UNLOCK(self);
+
+  return rc;
+}
+
+int clib_dag_run(clib_dag_t *self, int concurrency, clib_dag_fn fn,
+                 void *data) {
+  clib_pool_t *pool = NULL;
+  int rc = -1;
+
+  if (!self || !fn) {
+    return -1;
+  }
+
+  if (concurrency > self->count) {
+    concurrency = self->count;
+  }
+
+  // the calling thread runs nodes too while it waits
+  if ((pool = clib_pool_new(concurrency - 1))) {
+    rc = clib_dag_run_pool(self, pool, fn, data);
+  }
+
+  clib_pool_free(pool);
+  return rc;
+}
+
+int clib_dag_run_pool(clib_dag_t *self, clib_pool_t *pool, clib_dag_fn fn,
+                      void *data) {
+  if (!self || !pool || !fn) {
+    return -1;
+  }
+
+  self->fn = fn;
+  self->data = data;
+  self->finished = 0;
+  self->running = 0;
+  self->failures = 0;
+
+  // every node starts over, so a graph can run phase after phase
+  for (int i = 0; i < self->count; i++) {
+    self->nodes[i].state = CLIB_DAG_WAITING;
+    self->nodes[i].blocked = 0;
+    self->nodes[i].pending = 0;
+  }
+
+  for (int i = 0; i < self->count; i++) {
+    for (int j = 0; j < self->nodes[i].dependents_count; j++) {
+      (void)self->nodes[self->nodes[i].dependents[j]].pending++;
+    }
+  }
+
+  prioritize_all(self);
+
+  if (!(self->group = clib_pool_group_new(pool))) {
+    return -1;
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_init(&self->mutex, NULL);
+#endif
+
+  LOCK(self);
+  dispatch(self);
+  UNLOCK(self);
+
+  clib_pool_wait(self->group);
+
+  clib_pool_group_free(self->group);
+  self->group = NULL;
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_destroy(&self->mutex);
+#endif
+
+  return self->failures;
+}
+
+void clib_dag_free(clib_dag_t *self) {
+  if (NULL == self) {
+    return;
+  }
+
+  for (int i = 0; i < self->count; i++) {
+    free(self->nodes[i].dependents);
+  }
+
+  free(self->nodes);
+  free(self);
+}
@@ -0,0 +1,83 @@
+//
+// clib-dag.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_DAG_H
+#define CLIB_DAG_H 1
+
+#include <stdint.h>
+
+struct clib_pool;
+
+typedef struct clib_dag clib_dag_t;
+
+/**
+ * Work done for a single node of the graph.
+ *
+ * @return 0 on success, anything else marks the node as failed
+ */
+typedef int (*clib_dag_fn)(void *item, void *data);
+
+/**
+ * @return A new empty graph, or NULL on error
+ */
+clib_dag_t *clib_dag_new(void);
+
+/**
+ * Adds a node holding `item`.
+ *
+ * @return Index of the new node, or -1 on error
+ */
+int clib_dag_add(clib_dag_t *self, void *item);
+
+/**
+ * Makes node `node` wait for node `prerequisite`.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_dag_depend(clib_dag_t *self, int node, int prerequisite);
+
+/**
+ * Sets how long node `node` is expected to take, in any unit as long as
+ * it is the same for all nodes. Ready nodes start longest remaining path
+ * first; nodes without a cost count as the average of those with one.
+ */
+void clib_dag_set_cost(clib_dag_t *self, int node, uint64_t cost);
+
+/**
+ * @return Number of nodes in the graph
+ */
+int clib_dag_size(clib_dag_t *self);
+
+/**
+ * @return The item of node `node`, or NULL if out of range
+ */
+void *clib_dag_item(clib_dag_t *self, int node);
+
+/**
+ * Runs `fn` for every node on up to `concurrency` threads, starting each
+ * node as soon as all its prerequisites succeeded, the one with the most
+ * work left behind it first. Nodes that depend on
+ * a failed node are skipped. Cycles are broken in insertion order. A
+ * graph may run again, with every node waiting again.
+ *
+ * @return Number of nodes that failed or were skipped
+ */
+int clib_dag_run(clib_dag_t *self, int concurrency, clib_dag_fn fn,
+                 void *data);
+
+/**
+ * Like `clib_dag_run()`, on the threads of `pool`, which may be running
+ * other work meanwhile
+ *
+ * @return Number of nodes that failed or were skipped
+ */
+int clib_dag_run_pool(clib_dag_t *self, struct clib_pool *pool,
+                      clib_dag_fn fn, void *data);
+
+void clib_dag_free(clib_dag_t *self);
+
+#endif
@@ -0,0 +1,389 @@
+//
+// clib-dns.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "clib-dns.h"
+#include "clib-cache.h"
+#include "clib-session.h"
+#include "fs/fs.h"
+#include "http-get/http-get.h"
+#include "path-join/path-join.h"
+#include "strbuf/strbuf.h"
+#include "strdup/strdup.h"
+#include <arpa/inet.h>
+#include <curl/curl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+// in the meta cache dir
+#define DNS_CACHE_FILE "dns"
+
+// every host of the registry is asked for over https
+#define DNS_PORT "443"
+
+typedef struct {
+  const char *name;
+  char *addresses; // for CURLOPT_RESOLVE, NULL when it didn't resolve
+  time_t resolved;
+  int done;
+  struct curl_slist *entry; // of this host alone
+} host_t;
+
+static host_t hosts[] = {
+    {"raw.githubusercontent.com"},
+    {"github.com"},
+    {"codeload.github.com"},
+    {"api.github.com"},
+};
+
+#define HOSTS_COUNT (int)(sizeof(hosts) / sizeof(hosts[0]))
+
+// of every host, once none is pending anymore
+static struct curl_slist *entries = NULL;
+static int complete = 0;
+static int started = 0;
+static long ttl = CLIB_DNS_DEFAULT_TTL;
+static long happy_eyeballs = CLIB_DNS_DEFAULT_HAPPY_EYEBALLS_TIMEOUT;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolved = PTHREAD_COND_INITIALIZER;
+#define LOCK() pthread_mutex_lock(&mutex)
+#define UNLOCK() pthread_mutex_unlock(&mutex)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+static host_t *find_host(const char *url) {
+  const char *start = strstr(url, "://");
+  size_t len = 0;
+
+  start = start ? start + 3 : url;
+  len = strcspn(start, ":/?#");
+
+  for (int i = 0; i < HOSTS_COUNT; i++) {
+    if (len == strlen(hosts[i].name) &&
+        0 == strncmp(hosts[i].name, start, len)) {
+      return &hosts[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Looks up `name`, IPv4 addresses first.
+ *
+ * @return The addresses as a comma separated list, or NULL on error
+ */
+
+static char *lookup(const char *name) {
+  static const int families[] = {AF_INET, AF_INET6};
+  struct addrinfo hints;
+  struct addrinfo *info = NULL;
+  strbuf_t addresses = STRBUF_INIT;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if (0 != getaddrinfo(name, DNS_PORT, &hints, &info)) {
+    return NULL;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    for (struct addrinfo *ai = info; ai; ai = ai->ai_next) {
+      char address[INET6_ADDRSTRLEN];
+      const void *in = NULL;
+
+      if (families[i] != ai->ai_family) {
+        continue;
+      }
+
+      in = AF_INET == ai->ai_family
+               ? (void *)&((struct sockaddr_in *)ai->ai_addr)->sin_addr
+               : (void *)&((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr;
+
+      if (!inet_ntop(ai->ai_family, in, address, sizeof(address)) ||
+          (addresses.len && -1 == strbuf_append_char(&addresses, ',')) ||
+          (AF_INET6 == ai->ai_family &&
+           -1 == strbuf_append_char(&addresses, '[')) ||
+          -1 == strbuf_append(&addresses, address) ||
+          (AF_INET6 == ai->ai_family &&
+           -1 == strbuf_append_char(&addresses, ']'))) {
+        freeaddrinfo(info);
+        strbuf_free(&addresses);
+        return NULL;
+      }
+    }
+  }
+
+  freeaddrinfo(info);
+  return addresses.data;
+}
+
+static struct curl_slist *append_entry(struct curl_slist *list,
+                                       host_t *host) {
+  struct curl_slist *appended = NULL;
+  char *entry = NULL;
+
+  if (!host->addresses ||
+      !(entry = malloc(strlen(host->name) + strlen(host->addresses) +
+                       sizeof(":" DNS_PORT ":")))) {
+    return list;
+  }
+
+  sprintf(entry, "%s:" DNS_PORT ":%s", host->name, host->addresses);
+  appended = curl_slist_append(list, entry);
+  free(entry);
+  return appended ? appended : list;
+}
+
+static char *cache_path(void) {
+  if (0 != clib_cache_meta_init()) {
+    return NULL;
+  }
+
+  return path_join(clib_cache_meta_dir(), DNS_CACHE_FILE);
+}
+
+/**
+ * Takes the addresses of the previous runs that are fresh still.
+ */
+
+static void load(void) {
+  char *path = cache_path();
+  char *content = NULL;
+  char *line = NULL;
+  char *next = NULL;
+  time_t now = time(NULL);
+
+  if (!path || 0 != fs_exists(path) || !(content = fs_read(path))) {
+    free(path);
+    return;
+  }
+
+  for (line = content; line; line = next) {
+    char name[256];
+    char addresses[1024];
+    long when = 0;
+    host_t *host = NULL;
+
+    if ((next = strchr(line, '\n'))) {
+      *next++ = 0;
+    }
+
+    if (3 != sscanf(line, "%255s %ld %1023s", name, &when, addresses) ||
+        !(host = find_host(name)) || host->done || now - when >= ttl ||
+        now < when) {
+      continue;
+    }
+
+    if ((host->addresses = strdup(addresses))) {
+      host->resolved = (time_t)when;
+      host->done = 1;
+    }
+  }
+
+  free(content);
+  free(path);
+}
+
+/**
+ * Keeps the addresses for the next runs.
+ */
+
+static void save(void) {
+  strbuf_t content = STRBUF_INIT;
+  char *path = cache_path();
+  char *staged = NULL;
+
+  if (!path || !(staged = malloc(strlen(path) + 32))) {
+    goto cleanup;
+  }
+
+  for (int i = 0; i < HOSTS_COUNT; i++) {
+    char line[64];
+
+    if (!hosts[i].addresses) {
+      continue;
+    }
+
+    snprintf(line, sizeof(line), " %ld ", (long)hosts[i].resolved);
+
+    if (-1 == strbuf_append(&content, hosts[i].name) ||
+        -1 == strbuf_append(&content, line) ||
+        -1 == strbuf_append(&content, hosts[i].addresses) ||
+        -1 == strbuf_append_char(&content, '\n')) {
+      goto cleanup;
+    }
+  }
+
+  // readers in other processes see the old or the new file
+  sprintf(staged, "%s.%ld", path, (long)getpid());
+
+  if (content.data && -1 != fs_write(staged, content.data) &&
+      0 != rename(staged, path)) {
+    unlink(staged);
+  }
+
+cleanup:
+  strbuf_free(&content);
+  free(staged);
+  free(path);
+}
+
+/**
+ * Records what `host` resolved to, holding the lock, and puts together
+ * the entries of every host once it was the last one.
+ */
+
+static void resolved_host(host_t *host, char *addresses, int fresh) {
+  if (fresh) {
+    host->addresses = addresses;
+    host->resolved = time(NULL);
+    host->done = 1;
+  }
+
+  host->entry = append_entry(NULL, host);
+
+  if (complete) {
+    return;
+  }
+
+  for (int i = 0; i < HOSTS_COUNT; i++) {
+    if (!hosts[i].done) {
+      return;
+    }
+  }
+
+  for (int i = 0; i < HOSTS_COUNT; i++) {
+    entries = append_entry(entries, &hosts[i]);
+  }
+
+  complete = 1;
+
+  // nothing new when every host came from the last runs
+  if (fresh && ttl > 0) {
+    save();
+  }
+}
+
+#ifdef HAVE_PTHREADS
+static void *lookup_thread(void *data) {
+  host_t *host = data;
+  char *addresses = lookup(host->name);
+
+  LOCK();
+  resolved_host(host, addresses, 1);
+  pthread_cond_broadcast(&resolved);
+  UNLOCK();
+  return NULL;
+}
+#endif
+
+void clib_dns_prefetch(void) {
+  const char *env = NULL;
+
+  LOCK();
+
+  if (started) {
+    UNLOCK();
+    return;
+  }
+
+  if ((env = getenv("CLIB_DNS_TTL")) && *env) {
+    ttl = atol(env) > 0 ? atol(env) : 0;
+  }
+
+  if ((env = getenv("CLIB_HAPPY_EYEBALLS_TIMEOUT")) && *env) {
+    happy_eyeballs = atol(env) > 0 ? atol(env) : 0;
+  }
+
+  if (ttl > 0) {
+    load();
+  }
+
+  started = 1;
+
+  for (int i = 0; i < HOSTS_COUNT; i++) {
+    if (hosts[i].done) {
+      resolved_host(&hosts[i], NULL, 0);
+      continue;
+    }
+
+#ifdef HAVE_PTHREADS
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (0 == pthread_create(&thread, &attr, lookup_thread, &hosts[i])) {
+      pthread_attr_destroy(&attr);
+      continue;
+    }
+
+    pthread_attr_destroy(&attr);
+#endif
+
+    // looked up in turn when there are no threads to do it
+    resolved_host(&hosts[i], lookup(hosts[i].name), 1);
+  }
+
+  UNLOCK();
+
+  http_get_set_prepare(clib_dns_prepare);
+}
+
+void clib_dns_prepare(void *req, const char *url) {
+#if LIBCURL_VERSION_NUM >= 0x073b00
+  struct curl_slist *list = NULL;
+  host_t *host = NULL;
+
+  clib_session_prepare(req);
+
+  if (!started || !url) {
+    return;
+  }
+
+  host = find_host(url);
+
+  LOCK();
+#ifdef HAVE_PTHREADS
+  // it's looked up already, asking again would only take longer
+  while (host && !host->done) {
+    pthread_cond_wait(&resolved, &mutex);
+  }
+#endif
+  list = entries ? entries : host ? host->entry : NULL;
+  UNLOCK();
+
+  if (list) {
+    curl_easy_setopt(req, CURLOPT_RESOLVE, list);
+  }
+
+  if (happy_eyeballs > 0) {
+    curl_easy_setopt(req, CURLOPT_HAPPY_EYEBALLS_TIMEOUT_MS, happy_eyeballs);
+  }
+#else
+  clib_session_prepare(req);
+  (void)url;
+#endif
+}
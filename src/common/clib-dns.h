@@ -0,0 +1,41 @@
+//
+// clib-dns.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_DNS_H
+#define CLIB_DNS_H 1
+
+// how long resolved addresses are kept across runs, in seconds,
+// `CLIB_DNS_TTL`
+#define CLIB_DNS_DEFAULT_TTL 300
+
+// how long a connection gets before the other address family is tried
+// too, in milliseconds, `CLIB_HAPPY_EYEBALLS_TIMEOUT`
+#define CLIB_DNS_DEFAULT_HAPPY_EYEBALLS_TIMEOUT 100
+
+/**
+ * Resolves the hosts of the registry all at once in the background, so
+ * that the first requests to them don't each wait for a lookup in turn,
+ * and has every request `http_get*()` prepares from now on use the
+ * addresses. Addresses resolved less than `CLIB_DNS_TTL` seconds ago, by
+ * this or an earlier run, are used without a lookup; 0 disables keeping
+ * them.
+ *
+ * IPv4 addresses are tried first and IPv6 ones after
+ * `CLIB_HAPPY_EYEBALLS_TIMEOUT` milliseconds, so that a network with a
+ * broken IPv6 route doesn't stall every connection.
+ */
+void clib_dns_prefetch(void);
+
+/**
+ * Sets the addresses and timings of `clib_dns_prefetch()` on the curl
+ * easy handle `req` of a request to `url`, waiting for the lookup of its
+ * host when it's still going on, and has it keep what it learns of HSTS
+ * and alt-svc across runs with `clib_session_prepare()`.
+ */
+void clib_dns_prepare(void *req, const char *url);
+
+#endif
@@ -0,0 +1,1246 @@
+//
+// clib-download.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+// usleep()
+#define _DEFAULT_SOURCE
+
+#include "clib-download.h"
+#include "asprintf/asprintf.h"
+#include "clib-metrics.h"
+#include "clib-ratelimit.h"
+#include "clib-retry.h"
+#include "clib-trace.h"
+#include "copy/copy.h"
+#include "hash/hash.h"
+#include "http-get/http-get.h"
+#include "strdup/strdup.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#define CLIB_DOWNLOAD_POLL_TIMEOUT 1000
+
+// times a throttled transfer is queued again before it counts as failed
+#define CLIB_DOWNLOAD_THROTTLE_RETRIES 3
+
+// how much slower than the fastest round the first bytes of a round may
+// come before the transfers in flight are taken to queue up somewhere
+#define CLIB_DOWNLOAD_LATENCY_FACTOR 2
+
+// microseconds between two cuts of the transfers in flight at least
+#define CLIB_DOWNLOAD_MIN_BACK_OFF 100000
+
+// how much faster a round has to be than the best one so far to count as
+// faster, in percent
+#define CLIB_DOWNLOAD_RATE_GAIN 5
+
+// where the duplicate of a hedged download lands until it wins
+#define CLIB_DOWNLOAD_HEDGE_SUFFIX ".hedge"
+
+typedef struct clib_download_job clib_download_job_t;
+struct clib_download_job {
+  char *url;
+  char *file; // NULL for in-memory requests
+  char *etag;
+  char *last_modified;
+  clib_download_cb cb;
+  clib_download_response_cb response_cb;
+  void *data;
+  http_get_file_transfer_t *transfer;
+  http_get_transfer_t *request;
+  // bytes received by the transfer in flight and its duplicate, kept up
+  // to date by curl while there are progress reports
+  curl_off_t received;
+  curl_off_t hedge_received;
+  int throttled;
+  int stalled;
+  int failed;
+  int held; // back, while the memory budget was exhausted
+  uint64_t not_before; // when it may be tried again
+  uint64_t started;    // when the transfer in flight started
+  // the duplicate raced against a slow transfer, there is one at most
+  http_get_file_transfer_t *hedge_transfer;
+  http_get_transfer_t *hedge_request;
+  int hedged;
+  // queued, or in flight in the list of `running`
+  clib_download_job_t *next;
+  // what is asked, requests for the same share the transfer of the first
+  char *key;
+  clib_download_job_t *followers;
+};
+
+// what the transfers of the current round, as many as were allowed in
+// flight when it started, have shown of the network so far
+typedef struct {
+  int size;
+  int done;
+  uint64_t started;
+  uint64_t bytes;
+  uint64_t latency; // microseconds to the first byte, summed
+} clib_download_round_t;
+
+struct clib_download {
+  CURLM *multi;
+  CURLSH *share;
+  int concurrency; // transfers allowed in flight now
+  int min;
+  int max;
+  int peak;
+  int slow_start; // doubling `concurrency` each round, until congested
+  uint64_t backed_off; // when `concurrency` was last cut
+  uint64_t best_latency;
+  double best_rate;
+  clib_download_round_t round;
+  int active;
+  unsigned long long held; // requests held back for the memory budget
+  unsigned long long transfers; // queued so far
+  unsigned long long done;
+  uint64_t received; // bytes of the transfers that ended
+  // reports on the progress of the transfers, by the driving thread
+  clib_download_progress_cb progress;
+  void *progress_data;
+  uint64_t progress_interval; // microseconds between two reports
+  uint64_t reported;          // when the last report was, 0 before any
+  uint64_t reported_bytes;    // received by then
+  clib_download_job_t *head;
+  clib_download_job_t *tail;
+  clib_download_job_t *running; // only touched by the driving thread
+  hash_t *leaders; // the jobs queued or in flight by key
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t mutex;
+  pthread_mutex_t driver;
+#endif
+};
+
+#ifdef HAVE_PTHREADS
+#define LOCK(m) pthread_mutex_lock(m)
+#define UNLOCK(m) pthread_mutex_unlock(m)
+#else
+#define LOCK(m)
+#define UNLOCK(m)
+#endif
+
+static void job_free(clib_download_job_t *job) {
+  if (NULL == job) {
+    return;
+  }
+
+  http_get_file_transfer_free(job->transfer);
+  http_get_transfer_free(job->request);
+  http_get_file_transfer_free(job->hedge_transfer);
+  http_get_transfer_free(job->hedge_request);
+  free(job->url);
+  free(job->file);
+  free(job->etag);
+  free(job->last_modified);
+  free(job->key);
+  free(job);
+}
+
+/**
+ * Ends the transfer of `job`, so that new requests for the same start
+ * their own.
+ *
+ * @return The requests that waited on it
+ */
+
+static clib_download_job_t *detach(clib_download_t *self,
+                                   clib_download_job_t *job) {
+  clib_download_job_t *followers = NULL;
+
+  LOCK(&self->mutex);
+  if (job == hash_get(self->leaders, job->key)) {
+    hash_del(self->leaders, job->key);
+  }
+  followers = job->followers;
+  job->followers = NULL;
+  UNLOCK(&self->mutex);
+
+  return followers;
+}
+
+static http_get_response_t *copy_response(const http_get_response_t *res) {
+  http_get_response_t *copy = NULL;
+
+  if (!res || !(copy = malloc(sizeof(http_get_response_t)))) {
+    return NULL;
+  }
+
+  *copy = *res;
+  copy->held = copy->mapped = 0;
+  copy->data = res->data ? malloc(res->size + 1) : NULL;
+  copy->etag = res->etag ? strdup(res->etag) : NULL;
+  copy->last_modified = res->last_modified ? strdup(res->last_modified) : NULL;
+
+  if ((res->data && !copy->data) || (res->etag && !copy->etag) ||
+      (res->last_modified && !copy->last_modified)) {
+    http_get_free(copy);
+    return NULL;
+  }
+
+  if (copy->data) {
+    memcpy(copy->data, res->data, res->size);
+    copy->data[res->size] = 0;
+  }
+
+  return copy;
+}
+
+static void job_done(clib_download_t *self, clib_download_job_t *job, int rc,
+                     int *failures) {
+  clib_download_job_t *follower = detach(self, job);
+  const char *etag = 0 == rc && job->transfer ? job->transfer->etag : NULL;
+
+  // before the first callback, which may move the file
+  while (follower) {
+    clib_download_job_t *next = follower->followers;
+    int copied = rc;
+
+    if (0 == rc && 0 != strcmp(job->file, follower->file)) {
+      copied = 0 == copy_file(job->file, follower->file) ? 0 : -1;
+    }
+
+    if (0 != copied) {
+      (void)(*failures)++;
+    }
+
+    if (follower->cb) {
+      follower->cb(copied, follower->url, follower->file, etag,
+                   follower->data);
+    }
+
+    job_free(follower);
+    (void)self->done++;
+    follower = next;
+  }
+
+  if (0 != rc) {
+    (void)(*failures)++;
+  }
+
+  (void)self->done++;
+
+  if (job->cb) {
+    job->cb(rc, job->url, job->file, etag, job->data);
+  }
+
+  job_free(job);
+}
+
+static void job_response(clib_download_t *self, clib_download_job_t *job,
+                         http_get_response_t *res, int *failures) {
+  clib_download_job_t *follower = detach(self, job);
+
+  // each callback owns its response
+  while (follower) {
+    clib_download_job_t *next = follower->followers;
+    http_get_response_t *copy = copy_response(res);
+
+    if (!copy || (!copy->ok && 304 != copy->status)) {
+      (void)(*failures)++;
+    }
+
+    if (follower->response_cb) {
+      follower->response_cb(copy, follower->url, follower->data);
+    } else {
+      http_get_free(copy);
+    }
+
+    job_free(follower);
+    (void)self->done++;
+    follower = next;
+  }
+
+  if (!res || (!res->ok && 304 != res->status)) {
+    (void)(*failures)++;
+  }
+
+  (void)self->done++;
+
+  if (job->response_cb) {
+    job->response_cb(res, job->url, job->data);
+  } else {
+    http_get_free(res);
+  }
+
+  job_free(job);
+}
+
+static void job_fail(clib_download_t *self, clib_download_job_t *job,
+                     int *failures) {
+  if (job->file) {
+    job_done(self, job, -1, failures);
+  } else {
+    job_response(self, job, NULL, failures);
+  }
+}
+
+static void enqueue(clib_download_t *self, clib_download_job_t *job) {
+  LOCK(&self->mutex);
+  if (self->tail) {
+    self->tail->next = job;
+  } else {
+    self->head = job;
+  }
+  self->tail = job;
+  UNLOCK(&self->mutex);
+}
+
+/**
+ * Queues `job`, unless the same is queued or in flight already, which it
+ * then waits on to share its outcome
+ */
+
+static void submit(clib_download_t *self, clib_download_job_t *job) {
+  clib_download_job_t *leader = NULL;
+
+  LOCK(&self->mutex);
+  (void)self->transfers++;
+  if ((leader = hash_get(self->leaders, job->key))) {
+    job->followers = leader->followers;
+    leader->followers = job;
+  } else {
+    hash_set(self->leaders, job->key, job);
+  }
+  UNLOCK(&self->mutex);
+
+  if (!leader) {
+    enqueue(self, job);
+  }
+}
+
+clib_download_t *clib_download_new(int concurrency, CURLSH *share) {
+  clib_download_t *self = malloc(sizeof(clib_download_t));
+
+  if (NULL == self) {
+    return NULL;
+  }
+
+  memset(self, 0, sizeof(clib_download_t));
+
+  if (!(self->multi = curl_multi_init())) {
+    free(self);
+    return NULL;
+  }
+
+  if (!(self->leaders = hash_new())) {
+    curl_multi_cleanup(self->multi);
+    free(self);
+    return NULL;
+  }
+
+  self->share = share;
+  self->concurrency = concurrency > 0 ? concurrency : 1;
+  self->min = self->concurrency;
+  self->max = self->concurrency;
+  self->peak = self->concurrency;
+
+  // multiplex transfers to the same host over one HTTP/2 connection and
+  // only open extra connections when the server refuses to multiplex
+#if LIBCURL_VERSION_NUM >= 0x072b00
+  curl_multi_setopt(self->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+  curl_multi_setopt(self->multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                    (long)self->concurrency);
+#endif
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_init(&self->mutex, NULL);
+  pthread_mutex_init(&self->driver, NULL);
+#endif
+
+  return self;
+}
+
+void clib_download_set_bounds(clib_download_t *self, int min, int max) {
+  if (!self) {
+    return;
+  }
+
+  LOCK(&self->driver);
+
+  self->min = min > 0 ? min : 1;
+  self->max = max > self->min ? max : self->min;
+
+  if (self->concurrency < self->min) {
+    self->concurrency = self->min;
+  } else if (self->concurrency > self->max) {
+    self->concurrency = self->max;
+  }
+
+  self->peak = self->concurrency;
+  self->slow_start = self->min < self->max;
+  memset(&self->round, 0, sizeof(self->round));
+
+#if LIBCURL_VERSION_NUM >= 0x071e00
+  curl_multi_setopt(self->multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                    (long)self->max);
+#endif
+
+  UNLOCK(&self->driver);
+}
+
+int clib_download_concurrency(clib_download_t *self, int *peak) {
+  int concurrency = 0;
+
+  if (!self) {
+    return 0;
+  }
+
+  LOCK(&self->mutex);
+  concurrency = self->concurrency;
+  if (peak) {
+    *peak = self->peak;
+  }
+  UNLOCK(&self->mutex);
+
+  return concurrency;
+}
+
+unsigned long long clib_download_held(clib_download_t *self) {
+  unsigned long long held = 0;
+
+  if (!self) {
+    return 0;
+  }
+
+  LOCK(&self->mutex);
+  held = self->held;
+  UNLOCK(&self->mutex);
+
+  return held;
+}
+
+void clib_download_set_progress(clib_download_t *self, long interval,
+                                clib_download_progress_cb cb, void *data) {
+  if (!self) {
+    return;
+  }
+
+  LOCK(&self->driver);
+  self->progress = cb;
+  self->progress_data = data;
+  self->progress_interval = 1000 * (uint64_t)(interval > 0 ? interval : 1);
+  self->reported = 0;
+  UNLOCK(&self->driver);
+}
+
+#if LIBCURL_VERSION_NUM >= 0x072000
+static int on_progress(void *data, curl_off_t dltotal, curl_off_t dlnow,
+                       curl_off_t ultotal, curl_off_t ulnow) {
+  *(curl_off_t *)data = dlnow;
+  return 0;
+}
+#endif
+
+/**
+ * Has curl count the bytes `req` receives in `received`, while there are
+ * progress reports.
+ */
+
+static void watch_progress(clib_download_t *self, CURL *req,
+                           curl_off_t *received) {
+  *received = 0;
+
+#if LIBCURL_VERSION_NUM >= 0x072000
+  if (self->progress) {
+    curl_easy_setopt(req, CURLOPT_XFERINFOFUNCTION, on_progress);
+    curl_easy_setopt(req, CURLOPT_XFERINFODATA, received);
+    curl_easy_setopt(req, CURLOPT_NOPROGRESS, 0L);
+  }
+#endif
+}
+
+/**
+ * Adds the bytes of a transfer that ended, counted in `received`, to
+ * those of `self`.
+ */
+
+static void count_received(clib_download_t *self, curl_off_t *received) {
+  self->received += (uint64_t)*received;
+  *received = 0;
+}
+
+/**
+ * Reports where the transfers are at when it is time to.
+ */
+
+static void report_progress(clib_download_t *self) {
+  clib_download_progress_t progress = {0};
+  uint64_t now = clib_trace_clock();
+  uint64_t bytes = self->received;
+
+  if (!self->progress ||
+      (0 != self->reported && now - self->reported < self->progress_interval)) {
+    return;
+  }
+
+  for (clib_download_job_t *job = self->running; job; job = job->next) {
+    bytes += (uint64_t)job->received + (uint64_t)job->hedge_received;
+  }
+
+  // the first time round only starts the clock
+  if (0 == self->reported) {
+    self->reported = now;
+    self->reported_bytes = bytes;
+    return;
+  }
+
+  LOCK(&self->mutex);
+  progress.transfers = self->transfers;
+  UNLOCK(&self->mutex);
+
+  progress.done = self->done;
+  progress.active = self->active;
+  progress.bytes = bytes;
+  progress.rate = (bytes - self->reported_bytes) * 1000000 /
+                  (now - self->reported);
+
+  self->reported = now;
+  self->reported_bytes = bytes;
+  self->progress(&progress, self->progress_data);
+}
+
+/**
+ * Has `concurrency` transfers in flight from now on, kept between the
+ * bounds, starting a new round.
+ */
+
+static void set_concurrency(clib_download_t *self, int concurrency) {
+  if (concurrency < self->min) {
+    concurrency = self->min;
+  } else if (concurrency > self->max) {
+    concurrency = self->max;
+  }
+
+  LOCK(&self->mutex);
+  self->concurrency = concurrency;
+  if (concurrency > self->peak) {
+    self->peak = concurrency;
+  }
+  UNLOCK(&self->mutex);
+
+  memset(&self->round, 0, sizeof(self->round));
+}
+
+/**
+ * Halves the transfers in flight when the server throttled one or a
+ * transfer failed on the way, once per round trip of the transfers that
+ * were in flight then, as they failed for the same reason.
+ */
+
+static void back_off(clib_download_t *self) {
+  uint64_t now = clib_trace_clock();
+  uint64_t round_trip = CLIB_DOWNLOAD_LATENCY_FACTOR * self->best_latency;
+
+  self->slow_start = 0;
+
+  if (round_trip < CLIB_DOWNLOAD_MIN_BACK_OFF) {
+    round_trip = CLIB_DOWNLOAD_MIN_BACK_OFF;
+  }
+
+  if (self->min == self->max ||
+      (self->backed_off && now - self->backed_off < round_trip)) {
+    return;
+  }
+
+  self->backed_off = now;
+  set_concurrency(self, self->concurrency / 2);
+}
+
+/**
+ * Learns from a transfer that went through, which took `latency`
+ * microseconds to its first byte and then brought `bytes`. Once the
+ * whole round is in, the transfers in flight double while slow starting,
+ * then grow by one while the rounds get faster and the first bytes don't
+ * take longer, and shrink by one when they do, as requests queue up.
+ */
+
+static void adapt(clib_download_t *self, uint64_t latency, uint64_t bytes) {
+  clib_download_round_t *round = &self->round;
+  uint64_t elapsed = 0;
+  uint64_t average = 0;
+  double rate = 0;
+  int congested = 0;
+
+  if (self->min == self->max) {
+    return;
+  }
+
+  if (0 == round->size) {
+    round->size = self->concurrency;
+    round->started = clib_trace_clock();
+  }
+
+  round->bytes += bytes;
+  round->latency += latency;
+
+  if (++round->done < round->size) {
+    return;
+  }
+
+  elapsed = clib_trace_clock() - round->started;
+  average = round->latency / round->done;
+  rate = elapsed ? (double)round->bytes / elapsed : 0;
+
+  if (0 == self->best_latency || average < self->best_latency) {
+    self->best_latency = average;
+  }
+
+  congested = average > CLIB_DOWNLOAD_LATENCY_FACTOR * self->best_latency;
+
+  if (congested) {
+    self->slow_start = 0;
+    set_concurrency(self, self->concurrency - 1);
+  } else if (self->slow_start) {
+    set_concurrency(self, 2 * self->concurrency);
+  } else if (rate * 100 >= self->best_rate * (100 + CLIB_DOWNLOAD_RATE_GAIN)) {
+    set_concurrency(self, self->concurrency + 1);
+  } else {
+    memset(round, 0, sizeof(*round));
+  }
+
+  if (rate > self->best_rate) {
+    self->best_rate = rate;
+  }
+}
+
+/**
+ * Feeds the outcome of a transfer of `url` that ended with `code` and
+ * `status` to the controller of the transfers in flight and the metrics,
+ * with the microseconds to its first byte and the bytes it brought.
+ */
+
+static void observe(clib_download_t *self, const char *url, int code,
+                    long status, long retry_after, curl_off_t latency,
+                    curl_off_t bytes) {
+  if (CURLE_OK == code && latency > 0) {
+    clib_metrics_observe_http(url, (uint64_t)latency);
+  }
+
+  if (CURLE_OK != code || clib_ratelimit_throttled(status, retry_after) ||
+      status >= 500) {
+    back_off(self);
+    return;
+  }
+
+  adapt(self, (uint64_t)latency, (uint64_t)bytes);
+}
+
+int clib_download_add(clib_download_t *self, const char *url, const char *file,
+                      clib_download_cb cb, void *data) {
+  clib_download_job_t *job = NULL;
+
+  if (!self || !url || !file) {
+    return -1;
+  }
+
+  if (!(job = malloc(sizeof(clib_download_job_t)))) {
+    return -1;
+  }
+
+  memset(job, 0, sizeof(clib_download_job_t));
+  job->url = strdup(url);
+  job->file = strdup(file);
+  job->cb = cb;
+  job->data = data;
+
+  if (!job->url || !job->file || -1 == asprintf(&job->key, "file %s", url)) {
+    job->key = NULL;
+    job_free(job);
+    return -1;
+  }
+
+  submit(self, job);
+  return 0;
+}
+
+int clib_download_get(clib_download_t *self, const char *url,
+                      const char *etag, const char *last_modified,
+                      clib_download_response_cb cb, void *data) {
+  clib_download_job_t *job = NULL;
+
+  if (!self || !url) {
+    return -1;
+  }
+
+  if (!(job = malloc(sizeof(clib_download_job_t)))) {
+    return -1;
+  }
+
+  memset(job, 0, sizeof(clib_download_job_t));
+  job->url = strdup(url);
+  job->etag = etag ? strdup(etag) : NULL;
+  job->last_modified = last_modified ? strdup(last_modified) : NULL;
+  job->response_cb = cb;
+  job->data = data;
+
+  if (!job->url || (etag && !job->etag) ||
+      (last_modified && !job->last_modified) ||
+      -1 == asprintf(&job->key, "get %s\n%s\n%s", url, etag ? etag : "",
+                     last_modified ? last_modified : "")) {
+    job->key = NULL;
+    job_free(job);
+    return -1;
+  }
+
+  submit(self, job);
+  return 0;
+}
+
+/**
+ * Takes the first queued job the rate limiter lets start.
+ *
+ * @return The job, or NULL with `wait` the milliseconds until one may
+ * start, 0 when the queue is empty
+ */
+
+static clib_download_job_t *next_job(clib_download_t *self, long *wait) {
+  clib_download_job_t *prev = NULL;
+  clib_download_job_t *job = NULL;
+
+  *wait = 0;
+
+  uint64_t now = clib_trace_clock();
+
+  // the bodies of requests in flight are freed before more are let in,
+  // while downloads into files go on
+  int exhausted = self->active > 0 && http_get_memory_exhausted();
+
+  LOCK(&self->mutex);
+  for (job = self->head; job; prev = job, job = job->next) {
+    if (exhausted && NULL == job->file) {
+      if (!job->held) {
+        job->held = 1;
+        (void)self->held++;
+      }
+      continue;
+    }
+
+    // a job backing off doesn't take a slot of the rate limiter yet
+    long delay = job->not_before > now
+                     ? (long)((job->not_before - now + 999) / 1000)
+                     : clib_ratelimit_try(job->url);
+
+    if (0 == delay) {
+      if (prev) {
+        prev->next = job->next;
+      } else {
+        self->head = job->next;
+      }
+      if (self->tail == job) {
+        self->tail = prev;
+      }
+      break;
+    }
+
+    if (0 == *wait || delay < *wait) {
+      *wait = delay;
+    }
+  }
+  UNLOCK(&self->mutex);
+
+  return job;
+}
+
+/**
+ * Moves queued jobs into the multi handle until all slots are taken or
+ * the rest have to wait for the rate limiter.
+ *
+ * @return The milliseconds until a waiting job may start, 0 if none waits
+ */
+
+static long start_pending(clib_download_t *self, int *failures) {
+  long wait = 0;
+
+  while (self->active < self->concurrency) {
+    clib_download_job_t *job = next_job(self, &wait);
+
+    if (NULL == job) {
+      return wait;
+    }
+
+    CURL *req = NULL;
+
+    job->next = NULL;
+
+    if (job->file) {
+      job->transfer =
+          http_get_file_transfer_new(job->url, job->file, self->share);
+      req = job->transfer ? job->transfer->req : NULL;
+    } else {
+      job->request = http_get_transfer_new(job->url, self->share, job->etag,
+                                           job->last_modified);
+      req = job->request ? job->request->req : NULL;
+    }
+
+    if (req) {
+      curl_easy_setopt(req, CURLOPT_PRIVATE, job);
+      watch_progress(self, req, &job->received);
+    }
+
+    // the connection that stalled may be stuck still
+    if (req && job->stalled) {
+      http_get_reconnect(req);
+    }
+
+    if (NULL == req || CURLM_OK != curl_multi_add_handle(self->multi, req)) {
+      clib_ratelimit_release(job->url, 0, 0);
+      job_fail(self, job, failures);
+      continue;
+    }
+
+    job->started = clib_trace_clock();
+    job->hedged = 0;
+    job->next = self->running;
+    self->running = job;
+    (void)self->active++;
+  }
+
+  return 0;
+}
+
+/**
+ * Takes `job` out of the transfers in flight
+ */
+
+static void stop_running(clib_download_t *self, clib_download_job_t *job) {
+  clib_download_job_t **link = &self->running;
+
+  while (*link && *link != job) {
+    link = &(*link)->next;
+  }
+
+  if (*link) {
+    *link = job->next;
+  }
+
+  job->next = NULL;
+}
+
+/**
+ * Starts a duplicate of `job` over a new connection, racing the slow
+ * transfer of a server that may be stuck.
+ *
+ * @return 0 when it started, -1 otherwise
+ */
+
+static int start_hedge(clib_download_t *self, clib_download_job_t *job) {
+  char *file = NULL;
+  CURL *req = NULL;
+
+  if (job->file) {
+    if (-1 == asprintf(&file, "%s" CLIB_DOWNLOAD_HEDGE_SUFFIX, job->file)) {
+      return -1;
+    }
+
+    job->hedge_transfer = http_get_file_transfer_new(job->url, file,
+                                                     self->share);
+    req = job->hedge_transfer ? job->hedge_transfer->req : NULL;
+    free(file);
+  } else {
+    job->hedge_request = http_get_transfer_new(job->url, self->share,
+                                               job->etag, job->last_modified);
+    req = job->hedge_request ? job->hedge_request->req : NULL;
+  }
+
+  if (req) {
+    curl_easy_setopt(req, CURLOPT_PRIVATE, job);
+    watch_progress(self, req, &job->hedge_received);
+    http_get_reconnect(req);
+  }
+
+  if (NULL == req || CURLM_OK != curl_multi_add_handle(self->multi, req)) {
+    http_get_file_transfer_free(job->hedge_transfer);
+    http_get_transfer_free(job->hedge_request);
+    job->hedge_transfer = NULL;
+    job->hedge_request = NULL;
+    return -1;
+  }
+
+  (void)self->active++;
+  return 0;
+}
+
+/**
+ * Hedges the transfers in flight that take longer than nearly all those
+ * that went through so far, once each, as long as slots are free and the
+ * rate limiter lets them start.
+ *
+ * @return The milliseconds until the next one is due, 0 if none is
+ */
+
+static long start_hedges(clib_download_t *self) {
+  uint64_t after = clib_retry_hedge_after();
+  uint64_t now = clib_trace_clock();
+  uint64_t due = 0;
+
+  if (0 == after) {
+    return 0;
+  }
+
+  for (clib_download_job_t *job = self->running; job; job = job->next) {
+    uint64_t elapsed = now - job->started;
+
+    if (job->hedged) {
+      continue;
+    }
+
+    if (elapsed < after) {
+      if (0 == due || after - elapsed < due) {
+        due = after - elapsed;
+      }
+      continue;
+    }
+
+    // hedges never hold back the transfers that are still queued
+    if (self->active >= self->concurrency) {
+      break;
+    }
+
+    if (0 != clib_ratelimit_try(job->url)) {
+      continue;
+    }
+
+    job->hedged = 1;
+    if (0 != start_hedge(self, job)) {
+      clib_ratelimit_release(job->url, 0, 0);
+    }
+  }
+
+  return due ? (long)((due + 999) / 1000) : 0;
+}
+
+/**
+ * Queues `job` again when the server throttled it, the rate limiter then
+ * holds it back for as long as the server asked.
+ *
+ * @return 1 when the job was queued again, 0 otherwise
+ */
+
+static int retry_throttled(clib_download_t *self, clib_download_job_t *job,
+                           long status, long retry_after) {
+  if (!clib_ratelimit_throttled(status, retry_after) ||
+      job->throttled >= CLIB_DOWNLOAD_THROTTLE_RETRIES) {
+    return 0;
+  }
+
+  (void)job->throttled++;
+  http_get_file_transfer_free(job->transfer);
+  job->transfer = NULL;
+  enqueue(self, job);
+  return 1;
+}
+
+/**
+ * Queues `job` again over a new connection when it ended with `code`
+ * because it stalled.
+ *
+ * @return 1 when the job was queued again, 0 otherwise
+ */
+
+static int retry_stalled(clib_download_t *self, clib_download_job_t *job,
+                         int code) {
+  if (!http_get_stalled(code) || job->stalled >= HTTP_GET_STALL_RETRIES) {
+    return 0;
+  }
+
+  (void)job->stalled++;
+  http_get_file_transfer_free(job->transfer);
+  job->transfer = NULL;
+  enqueue(self, job);
+  return 1;
+}
+
+/**
+ * Queues `job` again after a backoff when it failed with `code` and
+ * `status` in a way that may go away, like a connection that broke or a
+ * server error, rather than a missing file.
+ *
+ * @return 1 when the job was queued again, 0 otherwise
+ */
+
+static int retry_failed(clib_download_t *self, clib_download_job_t *job,
+                        int code, long status) {
+  if (!clib_retry_again(clib_retry_classify(code, status), job->failed + 1)) {
+    return 0;
+  }
+
+  (void)job->failed++;
+  job->not_before =
+      clib_trace_clock() + 1000 * (uint64_t)clib_retry_backoff(job->failed);
+  http_get_file_transfer_free(job->transfer);
+  job->transfer = NULL;
+  enqueue(self, job);
+  return 1;
+}
+
+/**
+ * Settles the race of a hedged `job` now that one of its transfers, the
+ * duplicate when `hedge` is set, ended `ok` or not, and was taken out of
+ * the job. The first to go through wins and the other is cancelled, one
+ * that failed is dropped while the other may still go through.
+ *
+ * @return 1 when what ended is to be ignored, 0 when it is the outcome
+ * of the job, which has no other transfer left
+ */
+
+static int settle(clib_download_t *self, clib_download_job_t *job, int hedge,
+                  int ok) {
+  CURL *twin = NULL;
+
+  if (hedge) {
+    twin = job->transfer ? job->transfer->req
+                         : (job->request ? job->request->req : NULL);
+  } else {
+    twin = job->hedge_transfer
+               ? job->hedge_transfer->req
+               : (job->hedge_request ? job->hedge_request->req : NULL);
+  }
+
+  if (NULL == twin) {
+    return 0;
+  }
+
+  if (!ok) {
+    if (!hedge) {
+      job->transfer = job->hedge_transfer;
+      job->request = job->hedge_request;
+      job->hedge_transfer = NULL;
+      job->hedge_request = NULL;
+    }
+    return 1;
+  }
+
+  curl_multi_remove_handle(self->multi, twin);
+  (void)self->active--;
+  clib_ratelimit_release(job->url, 0, 0);
+  count_received(self, hedge ? &job->received : &job->hedge_received);
+
+  if (hedge) {
+    http_get_file_transfer_free(job->transfer);
+    http_get_transfer_free(job->request);
+    job->transfer = NULL;
+    job->request = NULL;
+  } else {
+    http_get_file_transfer_free(job->hedge_transfer);
+    http_get_transfer_free(job->hedge_request);
+    job->hedge_transfer = NULL;
+    job->hedge_request = NULL;
+  }
+
+  return 0;
+}
+
+/**
+ * Completes every transfer curl reports as done.
+ */
+
+static void collect_done(clib_download_t *self, int *failures) {
+  CURLMsg *msg = NULL;
+  int left = 0;
+
+  while ((msg = curl_multi_info_read(self->multi, &left))) {
+    clib_download_job_t *job = NULL;
+    curl_off_t latency = 0;
+    curl_off_t bytes = 0;
+    int hedge = 0;
+    int code = 0;
+
+    if (CURLMSG_DONE != msg->msg) {
+      continue;
+    }
+
+    // `msg` doesn't outlive the removal of its handle
+    code = msg->data.result;
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&job);
+#if LIBCURL_VERSION_NUM >= 0x073d00
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_STARTTRANSFER_TIME_T,
+                      &latency);
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+#endif
+    curl_multi_remove_handle(self->multi, msg->easy_handle);
+    (void)self->active--;
+
+    if (NULL == job) {
+      continue;
+    }
+
+    hedge = (job->hedge_transfer &&
+             msg->easy_handle == job->hedge_transfer->req) ||
+            (job->hedge_request && msg->easy_handle == job->hedge_request->req);
+    count_received(self, hedge ? &job->hedge_received : &job->received);
+
+    if (job->file) {
+      http_get_file_transfer_t *transfer =
+          hedge ? job->hedge_transfer : job->transfer;
+      int rc = http_get_file_transfer_finish(transfer, code);
+      clib_ratelimit_release(job->url, transfer->status, transfer->retry_after);
+      observe(self, job->url, code, transfer->status, transfer->retry_after,
+              latency, bytes);
+
+      // the duplicate came in under its own name
+      if (0 == rc && hedge && 0 != rename(transfer->file, job->file)) {
+        remove(transfer->file);
+        rc = -1;
+      }
+
+      if (hedge) {
+        job->hedge_transfer = NULL;
+      } else {
+        job->transfer = NULL;
+      }
+
+      if (settle(self, job, hedge, 0 == rc)) {
+        http_get_file_transfer_free(transfer);
+        continue;
+      }
+
+      job->transfer = transfer;
+      stop_running(self, job);
+
+      if (0 == rc) {
+        clib_retry_observe(clib_trace_clock() - job->started);
+      } else if (retry_throttled(self, job, transfer->status,
+                                 transfer->retry_after) ||
+                 retry_stalled(self, job, code) ||
+                 retry_failed(self, job, code, transfer->status)) {
+        continue;
+      }
+
+      job_done(self, job, rc, failures);
+    } else {
+      http_get_response_t *res = http_get_transfer_finish(
+          hedge ? job->hedge_request : job->request, code);
+      int ok = res && (res->ok || 304 == res->status);
+
+      if (hedge) {
+        job->hedge_request = NULL;
+      } else {
+        job->request = NULL;
+      }
+
+      clib_ratelimit_release(job->url, res ? res->status : 0,
+                             res ? res->retry_after : 0);
+      observe(self, job->url, code, res ? res->status : 0,
+              res ? res->retry_after : 0, latency, bytes);
+
+      if (settle(self, job, hedge, ok)) {
+        http_get_free(res);
+        continue;
+      }
+
+      stop_running(self, job);
+
+      if (ok) {
+        clib_retry_observe(clib_trace_clock() - job->started);
+      } else if (res &&
+                 (retry_throttled(self, job, res->status, res->retry_after) ||
+                  retry_stalled(self, job, code) ||
+                  retry_failed(self, job, code, res->status))) {
+        http_get_free(res);
+        continue;
+      }
+
+      job_response(self, job, res, failures);
+    }
+  }
+}
+
+int clib_download_wait(clib_download_t *self) {
+  int failures = 0;
+  int running = 0;
+  long hedge = 0;
+
+  if (NULL == self) {
+    return -1;
+  }
+
+  LOCK(&self->driver);
+
+  for (;;) {
+    long wait = start_pending(self, &failures);
+
+    if (0 == self->active) {
+      if (0 == wait) {
+        break;
+      }
+
+      usleep(wait * 1000);
+      continue;
+    }
+
+    if (CURLM_OK != curl_multi_perform(self->multi, &running)) {
+      break;
+    }
+
+    collect_done(self, &failures);
+    hedge = start_hedges(self);
+    report_progress(self);
+
+    if (hedge > 0 && (0 == wait || hedge < wait)) {
+      wait = hedge;
+    }
+
+    // nor are the reports late while the transfers are quiet
+    if (self->progress &&
+        (0 == wait || self->progress_interval / 1000 < (uint64_t)wait)) {
+      wait = (long)(self->progress_interval / 1000);
+    }
+
+    if (running > 0) {
+      int timeout = wait > 0 && wait < CLIB_DOWNLOAD_POLL_TIMEOUT
+                        ? (int)wait
+                        : CLIB_DOWNLOAD_POLL_TIMEOUT;
+#if LIBCURL_VERSION_NUM >= 0x074200
+      curl_multi_poll(self->multi, NULL, 0, timeout, NULL);
+#else
+      curl_multi_wait(self->multi, NULL, 0, timeout, NULL);
+#endif
+    }
+  }
+
+  UNLOCK(&self->driver);
+
+  return failures;
+}
+
+void clib_download_free(clib_download_t *self) {
+  clib_download_job_t *job = NULL;
+
+  if (NULL == self) {
+    return;
+  }
+
+  while ((job = self->head)) {
+    self->head = job->next;
+
+    while (job->followers) {
+      clib_download_job_t *follower = job->followers;
+      job->followers = follower->followers;
+      job_free(follower);
+    }
+
+    job_free(job);
+  }
+
+  // its keys were freed with the jobs
+  hash_free(self->leaders);
+  curl_multi_cleanup(self->multi);
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_destroy(&self->mutex);
+  pthread_mutex_destroy(&self->driver);
+#endif
+
+  free(self);
+}
@@ -0,0 +1,126 @@
+//
+// clib-download.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_DOWNLOAD_H
+#define CLIB_DOWNLOAD_H 1
+
+#include "http-get/http-get.h"
+#include <curl/curl.h>
+
+typedef struct clib_download clib_download_t;
+
+/**
+ * Invoked on the driving thread when a queued download completes.
+ *
+ * @param rc 0 when the file was saved, -1 otherwise
+ * @param etag The ETag the file was served with, or NULL
+ */
+typedef void (*clib_download_cb)(int rc, const char *url, const char *file,
+                                 const char *etag, void *data);
+
+/**
+ * Invoked on the driving thread when a queued in-memory request
+ * completes. The callback owns `res`, which is NULL if the request could
+ * not be started.
+ */
+typedef void (*clib_download_response_cb)(http_get_response_t *res,
+                                          const char *url, void *data);
+
+/**
+ * Where the transfers of an engine are at, see
+ * `clib_download_set_progress()`.
+ */
+typedef struct {
+  unsigned long long transfers; // queued so far, done or not
+  unsigned long long done;
+  int active;               // in flight now, hedges included
+  unsigned long long bytes; // received so far
+  unsigned long long rate;  // bytes per second since the last report
+} clib_download_progress_t;
+
+/**
+ * Invoked on the driving thread with where the transfers are at.
+ */
+typedef void (*clib_download_progress_cb)(
+    const clib_download_progress_t *progress, void *data);
+
+/**
+ * Creates a download engine backed by a single `curl_multi` handle that
+ * keeps at most `concurrency` transfers in flight.
+ *
+ * @return NULL on error
+ */
+clib_download_t *clib_download_new(int concurrency, CURLSH *share);
+
+/**
+ * Has `self` adapt how many transfers it keeps in flight, starting from
+ * the concurrency it was made with, between `min` and `max`: doubling
+ * them each round of transfers until the server throttles one, a
+ * transfer fails or the first bytes take twice as long as they did, then
+ * adding one while that makes the rounds faster, taking one away when
+ * the first bytes take longer, and halving them on throttling or errors.
+ * With equal bounds it keeps to them, as it does until this is called.
+ */
+void clib_download_set_bounds(clib_download_t *self, int min, int max);
+
+/**
+ * @return How many transfers `self` allows in flight now, and sets `peak`
+ * to the most it allowed so far, unless NULL
+ */
+int clib_download_concurrency(clib_download_t *self, int *peak);
+
+/**
+ * @return How many in-memory requests `self` held back so far, because
+ * the bodies in memory took the whole budget, see
+ * `http_get_set_memory_budget()`. A request is held back only while
+ * others are in flight, which free memory once they are done.
+ */
+unsigned long long clib_download_held(clib_download_t *self);
+
+/**
+ * Has `cb` told where the transfers of `self` are at every `interval`
+ * milliseconds while it is driven, by the thread driving it. The bytes
+ * are counted as they come in, by a progress function of curl on each
+ * transfer, rather than read from every transfer for each report. A NULL
+ * `cb` stops the reports.
+ */
+void clib_download_set_progress(clib_download_t *self, long interval,
+                                clib_download_progress_cb cb, void *data);
+
+/**
+ * Queues a download of `url` into `file`. Safe to call from any thread.
+ * When `url` is queued or in flight already it isn't fetched again, the
+ * file of the first download is copied to `file` once it is in.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_download_add(clib_download_t *self, const char *url, const char *file,
+                      clib_download_cb cb, void *data);
+
+/**
+ * Queues an in-memory GET of `url`, conditional when `etag` or
+ * `last_modified` is given. Safe to call from any thread. The same GET
+ * queued or in flight already is shared, each callback gets its own copy
+ * of the response.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_download_get(clib_download_t *self, const char *url,
+                      const char *etag, const char *last_modified,
+                      clib_download_response_cb cb, void *data);
+
+/**
+ * Drives all queued transfers until the queue is empty. Only one thread
+ * drives the engine at a time, other callers block until it is idle.
+ *
+ * @return Number of failed transfers
+ */
+int clib_download_wait(clib_download_t *self);
+
+void clib_download_free(clib_download_t *self);
+
+#endif
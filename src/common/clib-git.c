@@ -0,0 +1,243 @@
+//
+// clib-git.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "clib-git.h"
+#include "asprintf/asprintf.h"
+#include "clib-mkdir.h"
+#include "clib-spawn.h"
+#include "clib-walk.h"
+#include "fs/fs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK() pthread_mutex_lock(&mutex)
+#define UNLOCK() pthread_mutex_unlock(&mutex)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+// refs of the fetched versions, which keep their objects around
+#define GIT_REF_PATTERN "refs/clib/%s"
+
+// where the files of a checkout are staged before they are moved
+#define GIT_STAGE_PATTERN "%s/.git-checkout-XXXXXX"
+
+// -1 until git was looked for
+static int available = -1;
+
+// git never asks for credentials, a private repository just fails
+static char *const env[] = {"GIT_TERMINAL_PROMPT=0", NULL};
+
+static int git(char *const argv[]) {
+  clib_spawn_opts_t spawn = {0};
+
+  spawn.env = env;
+  spawn.quiet = 1;
+  return clib_spawn(argv, &spawn);
+}
+
+int clib_git_available(void) {
+  char *argv[] = {"git", "--version", NULL};
+
+  LOCK();
+  if (-1 == available) {
+    available = 0 == git(argv);
+  }
+  UNLOCK();
+
+  return available;
+}
+
+/**
+ * Fetches the commit of `ref` and its trees, without their files, into
+ * `repo` as `local`, making the repository when it isn't there yet
+ */
+
+static int fetch(const char *repo, char *git_dir, const char *url,
+                 const char *ref, const char *local) {
+  char *refspec = NULL;
+  int rc = -1;
+
+  if (0 != fs_exists(repo)) {
+    char *init[] = {"git", "init", "-q", "--bare", (char *)repo, NULL};
+    char *origin[] = {"git",    git_dir,  "remote", "add",
+                      "origin", (char *)url, NULL};
+
+    if (0 != git(init) || 0 != git(origin)) {
+      clib_walk_remove(repo, 1);
+      return -1;
+    }
+  } else {
+    char *origin[] = {"git",    git_dir,  "remote", "set-url",
+                      "origin", (char *)url, NULL};
+
+    if (0 != git(origin)) {
+      return -1;
+    }
+  }
+
+  if (-1 == asprintf(&refspec, "+%s:%s", ref, local)) {
+    return -1;
+  }
+
+  // fetching with a filter makes origin the promisor of the files left out
+  char *argv[] = {"git",          git_dir,   "fetch",   "-q",
+                  "--no-tags",    "--depth", "1",       "--filter=blob:none",
+                  "origin",       refspec,   NULL};
+
+  rc = 0 == git(argv) ? 0 : -1;
+  free(refspec);
+  return rc;
+}
+
+/**
+ * Checks `paths` of `local`, or every file with a NULL `paths`, out into
+ * `work_tree`, fetching the files it doesn't have yet in one go
+ */
+
+static int checkout(char *git_dir, const char *local, list_t *paths,
+                    const char *work_tree) {
+  list_iterator_t *iterator = NULL;
+  list_node_t *node = NULL;
+  char *tree_arg = NULL;
+  char **argv = NULL;
+  int argc = 0;
+  int rc = -1;
+
+  if (-1 == asprintf(&tree_arg, "--work-tree=%s", work_tree)) {
+    return -1;
+  }
+
+  if (!(argv = calloc(8 + (paths ? paths->len : 1), sizeof(char *)))) {
+    goto cleanup;
+  }
+
+  argv[argc++] = "git";
+  argv[argc++] = git_dir;
+  argv[argc++] = tree_arg;
+  argv[argc++] = "checkout";
+  argv[argc++] = "-q";
+  argv[argc++] = (char *)local;
+  argv[argc++] = "--";
+
+  if (!paths) {
+    argv[argc++] = ".";
+  } else if ((iterator = list_iterator_new(paths, LIST_HEAD))) {
+    while ((node = list_iterator_next(iterator))) {
+      argv[argc++] = node->val;
+    }
+    list_iterator_destroy(iterator);
+  } else {
+    goto cleanup;
+  }
+
+  rc = 0 == git(argv) ? 0 : -1;
+
+cleanup:
+  free(argv);
+  free(tree_arg);
+  return rc;
+}
+
+/**
+ * Moves each of `paths` checked out in `stage` into `dir` by its base name
+ */
+
+static int flatten(const char *stage, list_t *paths, const char *dir) {
+  list_iterator_t *iterator = list_iterator_new(paths, LIST_HEAD);
+  list_node_t *node = NULL;
+  int rc = 0;
+
+  if (!iterator) {
+    return -1;
+  }
+
+  while (0 == rc && (node = list_iterator_next(iterator))) {
+    const char *path = node->val;
+    const char *base = strrchr(path, '/');
+    char *from = NULL;
+    char *to = NULL;
+
+    base = base ? base + 1 : path;
+
+    if (-1 == asprintf(&from, "%s/%s", stage, path)) {
+      from = NULL;
+    } else if (-1 == asprintf(&to, "%s/%s", dir, base)) {
+      to = NULL;
+    }
+
+    rc = from && to && 0 == rename(from, to) ? 0 : -1;
+
+    free(from);
+    free(to);
+  }
+
+  list_iterator_destroy(iterator);
+  return rc;
+}
+
+int clib_git_checkout(const char *repo, const char *url, const char *ref,
+                      list_t *paths, const char *dir) {
+  char *git_dir = NULL;
+  char *local = NULL;
+  char *stage = NULL;
+  int rc = -1;
+
+  // neither an option nor outside of the refs
+  if (!repo || !url || !ref || '-' == *ref || strstr(ref, "..") ||
+      !clib_git_available()) {
+    return -1;
+  }
+
+  if (-1 == asprintf(&git_dir, "--git-dir=%s", repo)) {
+    return -1;
+  }
+
+  if (-1 == asprintf(&local, GIT_REF_PATTERN, ref)) {
+    local = NULL;
+    goto cleanup;
+  }
+
+  if (0 != clib_mkdirp(dir, 0777) ||
+      0 != fetch(repo, git_dir, url, ref, local)) {
+    goto cleanup;
+  }
+
+  if (!paths) {
+    rc = checkout(git_dir, local, NULL, dir);
+    goto cleanup;
+  }
+
+  if (-1 == asprintf(&stage, GIT_STAGE_PATTERN, dir)) {
+    stage = NULL;
+    goto cleanup;
+  }
+
+  if (!mkdtemp(stage)) {
+    goto cleanup;
+  }
+
+  if (0 == checkout(git_dir, local, paths, stage)) {
+    rc = flatten(stage, paths, dir);
+  }
+
+  clib_walk_remove(stage, 1);
+
+cleanup:
+  free(git_dir);
+  free(local);
+  free(stage);
+  return rc;
+}
@@ -0,0 +1,34 @@
+//
+// clib-git.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_GIT_H
+#define CLIB_GIT_H 1
+
+#include "list/list.h"
+
+/**
+ * @return 1 if git can be run, 0 otherwise
+ */
+int clib_git_available(void);
+
+/**
+ * Checks the files `paths` of `ref` of the repository at `url` out into
+ * `dir`, each by its base name, or the whole tree as it is when `paths`
+ * is NULL. The commit of `ref` and its trees are fetched shallowly, with
+ * `--depth 1 --filter=blob:none`, into the bare repository `repo`, made on
+ * first use, and only the files checked out are then fetched into it. As
+ * every version of a package shares its repository, a new one only
+ * transfers the objects that changed.
+ *
+ * The caller holds the lock of `repo`.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_git_checkout(const char *repo, const char *url, const char *ref,
+                      list_t *paths, const char *dir);
+
+#endif
@@ -0,0 +1,426 @@
+//
+// clib-github.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-github.h"
+#include "clib-dns.h"
+#include "clib-ratelimit.h"
+#include "parse-repo/parse-repo.h"
+#include "parson/parson.h"
+#include "strbuf/strbuf.h"
+#include "strdup/strdup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef DEFAULT_REPO_VERSION
+#define DEFAULT_REPO_VERSION "master"
+#endif
+
+#ifndef DEFAULT_REPO_OWNER
+#define DEFAULT_REPO_OWNER "clibs"
+#endif
+
+#define GRAPHQL_URL "https://api.github.com/graphql"
+
+#define CLIB_GITHUB_TIMEOUT 30L
+
+static const char *graphql_url(void) {
+  const char *url = getenv("CLIB_GITHUB_GRAPHQL_URL");
+  return url && *url ? url : GRAPHQL_URL;
+}
+
+/**
+ * Appends `str` to `query` as a GraphQL string.
+ *
+ * @return 0 on success, -1 on error or when `str` can't be one
+ */
+
+static int append_string(strbuf_t *query, const char *str) {
+  if (-1 == strbuf_append_char(query, '"')) {
+    return -1;
+  }
+
+  for (; *str; str++) {
+    if ((unsigned char)*str < 0x20) {
+      return -1;
+    }
+
+    if (('"' == *str || '\\' == *str) &&
+        -1 == strbuf_append_char(query, '\\')) {
+      return -1;
+    }
+
+    if (-1 == strbuf_append_char(query, *str)) {
+      return -1;
+    }
+  }
+
+  return strbuf_append_char(query, '"');
+}
+
+/**
+ * Appends the selection of `slug` as the field `r<index>` of a query,
+ * its version as `v` and each of `names` at it as `f<n>`.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int append_version(strbuf_t *query, int index, const char *slug,
+                          const char **names) {
+  char *author = parse_repo_owner(slug, DEFAULT_REPO_OWNER);
+  char *name = parse_repo_name(slug);
+  char *version = parse_repo_version(slug, DEFAULT_REPO_VERSION);
+  char alias[32];
+  int rc = -1;
+
+  if (!author || !name || !version) {
+    goto cleanup;
+  }
+
+  snprintf(alias, sizeof(alias), "r%d:repository(owner:", index);
+
+  if (-1 == strbuf_append(query, alias) || -1 == append_string(query, author) ||
+      -1 == strbuf_append(query, ",name:") ||
+      -1 == append_string(query, name) ||
+      -1 == strbuf_append(query, "){v:object(expression:") ||
+      -1 == append_string(query, version) ||
+      -1 == strbuf_append(query, "){oid ...on Tag{target{oid}}}")) {
+    goto cleanup;
+  }
+
+  for (int i = 0; names && names[i]; i++) {
+    char *expression = malloc(strlen(version) + strlen(names[i]) + 2);
+
+    if (!expression) {
+      goto cleanup;
+    }
+
+    sprintf(expression, "%s:%s", version, names[i]);
+    snprintf(alias, sizeof(alias), " f%d:object(expression:", i);
+
+    rc = -1 == strbuf_append(query, alias) ||
+                 -1 == append_string(query, expression) ||
+                 -1 == strbuf_append(query, "){...on Blob{text isTruncated}}")
+             ? -1
+             : 0;
+
+    free(expression);
+
+    if (-1 == rc) {
+      goto cleanup;
+    }
+  }
+
+  rc = strbuf_append_char(query, '}');
+
+cleanup:
+  free(author);
+  free(name);
+  free(version);
+  return rc;
+}
+
+static size_t write_cb(void *contents, size_t size, size_t nmemb, void *data) {
+  size_t length = size * nmemb;
+  return 0 == strbuf_append_n(data, contents, length) ? length : 0;
+}
+
+/**
+ * Posts the GraphQL `query` authenticated with `token`.
+ *
+ * @return The parsed response, or NULL on error
+ */
+
+static JSON_Value *post(const char *query, const char *token, CURLSH *share) {
+  struct curl_slist *headers = NULL;
+  JSON_Value *request = NULL;
+  JSON_Value *response = NULL;
+  strbuf_t authorization = STRBUF_INIT;
+  strbuf_t body = STRBUF_INIT;
+  const char *url = graphql_url();
+  char *payload = NULL;
+  long status = 0;
+  long retry_after = 0;
+  CURL *req = NULL;
+  int code = 0;
+
+  if (!(request = json_value_init_object()) ||
+      JSONSuccess !=
+          json_object_set_string(json_object(request), "query", query) ||
+      !(payload = json_serialize_to_string(request))) {
+    goto cleanup;
+  }
+
+  if (-1 == strbuf_append(&authorization, "Authorization: bearer ") ||
+      -1 == strbuf_append(&authorization, token)) {
+    goto cleanup;
+  }
+
+  headers = curl_slist_append(headers, authorization.data);
+  headers = curl_slist_append(headers, "Content-Type: application/json");
+
+  if (!headers || !(req = curl_easy_init())) {
+    goto cleanup;
+  }
+
+  if (share) {
+    curl_easy_setopt(req, CURLOPT_SHARE, share);
+  }
+
+  curl_easy_setopt(req, CURLOPT_URL, url);
+  curl_easy_setopt(req, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(req, CURLOPT_POSTFIELDS, payload);
+  curl_easy_setopt(req, CURLOPT_ACCEPT_ENCODING, "");
+  curl_easy_setopt(req, CURLOPT_USERAGENT, "clib");
+  curl_easy_setopt(req, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(req, CURLOPT_TIMEOUT, CLIB_GITHUB_TIMEOUT);
+  curl_easy_setopt(req, CURLOPT_WRITEFUNCTION, write_cb);
+  curl_easy_setopt(req, CURLOPT_WRITEDATA, &body);
+  clib_dns_prepare(req, url);
+
+  clib_ratelimit_acquire(url);
+  code = curl_easy_perform(req);
+  curl_easy_getinfo(req, CURLINFO_RESPONSE_CODE, &status);
+#if LIBCURL_VERSION_NUM >= 0x074200
+  {
+    curl_off_t seconds = 0;
+    if (CURLE_OK == curl_easy_getinfo(req, CURLINFO_RETRY_AFTER, &seconds)) {
+      retry_after = (long)seconds;
+    }
+  }
+#endif
+  clib_ratelimit_release(url, status, retry_after);
+
+  if (CURLE_OK == code && 200 == status && body.data) {
+    response = json_parse_string(body.data);
+  }
+
+cleanup:
+  if (req) {
+    curl_easy_cleanup(req);
+  }
+  curl_slist_free_all(headers);
+  json_free_serialized_string(payload);
+  json_value_free(request);
+  strbuf_free(&authorization);
+  strbuf_free(&body);
+  return response;
+}
+
+static void version_free(clib_github_version_t *version) {
+  if (NULL == version) {
+    return;
+  }
+
+  for (int i = 0; i < version->count; i++) {
+    free(version->files[i]);
+  }
+
+  free(version->commit);
+  free(version->files);
+  free(version->missing);
+  free(version);
+}
+
+/**
+ * Reads what `data` says about `slug`, asked about as `r<index>`.
+ *
+ * @return A new version, or NULL if GitHub didn't answer for it
+ */
+
+static clib_github_version_t *read_version(JSON_Object *data, int index,
+                                           int count) {
+  clib_github_version_t *version = NULL;
+  JSON_Object *repository = NULL;
+  const char *commit = NULL;
+  char alias[16];
+
+  snprintf(alias, sizeof(alias), "r%d", index);
+
+  // an unknown or inaccessible repository is left to the regular fetch
+  if (!(repository = json_object_get_object(data, alias))) {
+    return NULL;
+  }
+
+  if (!(version = calloc(1, sizeof(clib_github_version_t))) ||
+      !(version->files = calloc(count + 1, sizeof(char *))) ||
+      !(version->missing = calloc(count + 1, sizeof(int)))) {
+    version_free(version);
+    return NULL;
+  }
+
+  version->count = count;
+
+  // an annotated tag points at the commit
+  if (!(commit = json_object_dotget_string(repository, "v.target.oid"))) {
+    commit = json_object_dotget_string(repository, "v.oid");
+  }
+
+  if (commit && !(version->commit = strdup(commit))) {
+    version_free(version);
+    return NULL;
+  }
+
+  for (int i = 0; i < count; i++) {
+    JSON_Object *file = NULL;
+    const char *text = NULL;
+
+    snprintf(alias, sizeof(alias), "f%d", i);
+
+    if (!(file = json_object_get_object(repository, alias))) {
+      version->missing[i] = 1;
+    } else if (1 != json_object_get_boolean(file, "isTruncated") &&
+               (text = json_object_get_string(file, "text")) &&
+               !(version->files[i] = strdup(text))) {
+      version_free(version);
+      return NULL;
+    }
+  }
+
+  return version;
+}
+
+/**
+ * Asks about the `count` slugs of `batch` in one query and adds the
+ * answers to `versions`.
+ */
+
+static void resolve_batch(hash_t *versions, char **batch, int count,
+                          const char **names, const char *token,
+                          CURLSH *share) {
+  strbuf_t query = STRBUF_INIT;
+  JSON_Value *response = NULL;
+  JSON_Object *data = NULL;
+  int names_count = 0;
+
+  while (names && names[names_count]) {
+    names_count++;
+  }
+
+  if (-1 == strbuf_append(&query, "query{")) {
+    goto cleanup;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if ((i && -1 == strbuf_append_char(&query, ' ')) ||
+        -1 == append_version(&query, i, batch[i], names)) {
+      goto cleanup;
+    }
+  }
+
+  if (-1 == strbuf_append_char(&query, '}')) {
+    goto cleanup;
+  }
+
+  // missing repositories come as errors next to the data of the rest
+  if (!(response = post(query.data, token, share)) ||
+      !(data = json_object_get_object(json_object(response), "data"))) {
+    goto cleanup;
+  }
+
+  for (int i = 0; i < count; i++) {
+    clib_github_version_t *version = read_version(data, i, names_count);
+    char *key = NULL;
+
+    if (version && !(key = strdup(batch[i]))) {
+      version_free(version);
+      version = NULL;
+    }
+
+    if (version) {
+      hash_set(versions, key, version);
+    }
+  }
+
+cleanup:
+  json_value_free(response);
+  strbuf_free(&query);
+}
+
+hash_t *clib_github_resolve(list_t *slugs, const char **names,
+                            const char *token, CURLSH *share) {
+  list_iterator_t *iterator = NULL;
+  list_node_t *node = NULL;
+  hash_t *versions = NULL;
+  hash_t *seen = NULL;
+  char *batch[CLIB_GITHUB_BATCH];
+  int count = 0;
+
+  if (!slugs || !token || !*token || !(versions = hash_new()) ||
+      !(seen = hash_new()) ||
+      !(iterator = list_iterator_new(slugs, LIST_HEAD))) {
+    goto error;
+  }
+
+  while ((node = list_iterator_next(iterator))) {
+    char *slug = node->val;
+
+    if (!slug || hash_get(seen, slug)) {
+      continue;
+    }
+
+    hash_set(seen, slug, slug);
+    batch[count++] = slug;
+
+    if (CLIB_GITHUB_BATCH == count) {
+      resolve_batch(versions, batch, count, names, token, share);
+      count = 0;
+    }
+  }
+
+  if (count > 0) {
+    resolve_batch(versions, batch, count, names, token, share);
+  }
+
+  list_iterator_destroy(iterator);
+  hash_free(seen);
+  return versions;
+
+error:
+  if (seen) {
+    hash_free(seen);
+  }
+  clib_github_free(versions);
+  return NULL;
+}
+
+void clib_github_free(hash_t *versions) {
+  if (NULL == versions) {
+    return;
+  }
+
+  hash_each(versions, {
+    free((char *)key);
+    version_free(val);
+  });
+
+  hash_free(versions);
+}
+
+hash_t *clib_github_commits(list_t *slugs, const char *token, CURLSH *share) {
+  hash_t *versions = clib_github_resolve(slugs, NULL, token, share);
+  hash_t *commits = NULL;
+
+  if (!versions || !(commits = hash_new())) {
+    clib_github_free(versions);
+    return NULL;
+  }
+
+  hash_each(versions, {
+    clib_github_version_t *version = val;
+    if (version->commit) {
+      hash_set(commits, (char *)key, version->commit);
+      version->commit = NULL;
+    } else {
+      free((char *)key);
+    }
+    version_free(version);
+  });
+
+  hash_free(versions);
+  return commits;
+}
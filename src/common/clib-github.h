@@ -0,0 +1,57 @@
+//
+// clib-github.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_GITHUB_H
+#define CLIB_GITHUB_H 1
+
+#include "hash/hash.h"
+#include "list/list.h"
+#include <curl/curl.h>
+
+// versions asked about in one query
+#define CLIB_GITHUB_BATCH 50
+
+/**
+ * What GitHub has at one `author/name@version`.
+ */
+typedef struct {
+  char *commit;  // the version is at, NULL when there is no such version
+  char **files;  // the text of each of the names asked for, or NULL
+  int *missing;  // 1 for each of the names that isn't there
+  int count;     // of `files` and `missing`
+} clib_github_version_t;
+
+/**
+ * Looks up the commit of the versions of `slugs`, each one
+ * `author/name@version`, along with the files `names` (NULL terminated,
+ * may be NULL) at each of them. The versions are asked about in GraphQL
+ * queries of `CLIB_GITHUB_BATCH` each, authenticated with `token`, so
+ * that a tree of packages takes a handful of requests and private
+ * repositories are found too. `CLIB_GITHUB_GRAPHQL_URL` overrides the
+ * endpoint, for GitHub Enterprise.
+ *
+ * A file that is too large for the API to return is neither in `files`
+ * nor `missing`, and has to be fetched by itself.
+ *
+ * @return A new hash of the slugs GitHub answered for to their
+ * `clib_github_version_t`, to be freed with `clib_github_free()`, or NULL
+ * on error
+ */
+hash_t *clib_github_resolve(list_t *slugs, const char **names,
+                            const char *token, CURLSH *share);
+
+void clib_github_free(hash_t *versions);
+
+/**
+ * Like `clib_refs_resolve()`, but with `clib_github_resolve()`.
+ *
+ * @return A new hash of the slugs that were found to their commits, to
+ * be freed with `clib_refs_free()`, or NULL on error
+ */
+hash_t *clib_github_commits(list_t *slugs, const char *token, CURLSH *share);
+
+#endif
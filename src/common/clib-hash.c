@@ -0,0 +1,167 @@
+//
+// clib-hash.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-hash.h"
+#include <stdio.h>
+#include <string.h>
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void transform(clib_hash_t *self, const unsigned char *block) {
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h;
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+           (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+  }
+
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  a = self->state[0];
+  b = self->state[1];
+  c = self->state[2];
+  d = self->state[3];
+  e = self->state[4];
+  f = self->state[5];
+  g = self->state[6];
+  h = self->state[7];
+
+  for (int i = 0; i < 64; i++) {
+    uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + k[i] + w[i];
+    uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  self->state[0] += a;
+  self->state[1] += b;
+  self->state[2] += c;
+  self->state[3] += d;
+  self->state[4] += e;
+  self->state[5] += f;
+  self->state[6] += g;
+  self->state[7] += h;
+}
+
+void clib_hash_init(clib_hash_t *self) {
+  static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                      0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                      0x1f83d9ab, 0x5be0cd19};
+
+  memcpy(self->state, initial, sizeof(initial));
+  self->length = 0;
+  self->used = 0;
+}
+
+void clib_hash_update(clib_hash_t *self, const void *data, size_t size) {
+  const unsigned char *p = data;
+
+  self->length += size;
+
+  while (size > 0) {
+    size_t n = sizeof(self->block) - self->used;
+
+    if (n > size) {
+      n = size;
+    }
+
+    memcpy(self->block + self->used, p, n);
+    self->used += n;
+    p += n;
+    size -= n;
+
+    if (sizeof(self->block) == self->used) {
+      transform(self, self->block);
+      self->used = 0;
+    }
+  }
+}
+
+void clib_hash_final(clib_hash_t *self, char hex[CLIB_HASH_HEX_SIZE]) {
+  uint64_t bits = self->length * 8;
+  unsigned char pad = 0x80;
+  unsigned char zero = 0;
+  unsigned char length[8];
+
+  clib_hash_update(self, &pad, 1);
+  while (56 != self->used) {
+    clib_hash_update(self, &zero, 1);
+  }
+
+  for (int i = 0; i < 8; i++) {
+    length[i] = (unsigned char)(bits >> (56 - 8 * i));
+  }
+
+  clib_hash_update(self, length, sizeof(length));
+
+  for (int i = 0; i < 8; i++) {
+    sprintf(hex + i * 8, "%08x", self->state[i]);
+  }
+}
+
+void clib_hash_buffer(const void *data, size_t size,
+                      char hex[CLIB_HASH_HEX_SIZE]) {
+  clib_hash_t hash;
+  clib_hash_init(&hash);
+  clib_hash_update(&hash, data, size);
+  clib_hash_final(&hash, hex);
+}
+
+int clib_hash_file(const char *path, char hex[CLIB_HASH_HEX_SIZE]) {
+  char buffer[BUFSIZ * 8];
+  clib_hash_t hash;
+  size_t n = 0;
+  FILE *file = fopen(path, "rb");
+
+  if (NULL == file) {
+    return -1;
+  }
+
+  clib_hash_init(&hash);
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    clib_hash_update(&hash, buffer, n);
+  }
+
+  if (ferror(file)) {
+    fclose(file);
+    return -1;
+  }
+
+  fclose(file);
+  clib_hash_final(&hash, hex);
+  return 0;
+}
@@ -0,0 +1,51 @@
+//
+// clib-hash.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_HASH_H
+#define CLIB_HASH_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CLIB_HASH_SIZE 32
+// hex digest plus the terminating NUL
+#define CLIB_HASH_HEX_SIZE (2 * CLIB_HASH_SIZE + 1)
+
+/**
+ * Incremental SHA-256 state.
+ */
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t length;
+  unsigned char block[64];
+  size_t used;
+} clib_hash_t;
+
+void clib_hash_init(clib_hash_t *self);
+
+void clib_hash_update(clib_hash_t *self, const void *data, size_t size);
+
+/**
+ * Writes the lowercase hex digest of everything hashed so far to `hex`.
+ */
+void clib_hash_final(clib_hash_t *self, char hex[CLIB_HASH_HEX_SIZE]);
+
+/**
+ * Hashes `size` bytes of `data` in one go.
+ */
+void clib_hash_buffer(const void *data, size_t size,
+                      char hex[CLIB_HASH_HEX_SIZE]);
+
+/**
+ * Hashes the content of the file at `path`.
+ *
+ * @return 0 on success, -1 if it can't be read
+ */
+int clib_hash_file(const char *path, char hex[CLIB_HASH_HEX_SIZE]);
+
+#endif
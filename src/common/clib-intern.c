@@ -0,0 +1,170 @@
+//
+// clib-intern.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-intern.h"
+#include "clib-arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+// strings are spread over this many tables, so threads rarely wait
+#define CLIB_INTERN_STRIPES 16
+#define CLIB_INTERN_MIN_CAPACITY 64
+#define CLIB_INTERN_ARENA_SIZE 4096
+
+typedef struct {
+  const char *str;
+  size_t length;
+  uint32_t hash;
+} entry_t;
+
+typedef struct {
+  entry_t *entries; // open addressing, a power of two of them
+  size_t capacity;
+  size_t count;
+  clib_arena_t *strings;
+} table_t;
+
+static table_t tables[CLIB_INTERN_STRIPES];
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t locks[CLIB_INTERN_STRIPES];
+static pthread_once_t locks_once = PTHREAD_ONCE_INIT;
+
+static void init_locks(void) {
+  for (int i = 0; i < CLIB_INTERN_STRIPES; i++) {
+    pthread_mutex_init(&locks[i], NULL);
+  }
+}
+#endif
+
+static uint32_t hash_string(const char *str, size_t length) {
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+  }
+
+  return hash;
+}
+
+/**
+ * @return The entry of the string, or the empty one it belongs in
+ */
+
+static entry_t *find(table_t *table, const char *str, size_t length,
+                     uint32_t hash) {
+  size_t mask = table->capacity - 1;
+  // the low bits picked the table
+  size_t i = (hash / CLIB_INTERN_STRIPES) & mask;
+
+  for (;; i = (i + 1) & mask) {
+    entry_t *entry = &table->entries[i];
+
+    if (!entry->str || (entry->hash == hash && entry->length == length &&
+                        0 == memcmp(entry->str, str, length))) {
+      return entry;
+    }
+  }
+}
+
+/**
+ * Doubles the entries of `table`, keeping them under three quarters full.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int grow(table_t *table) {
+  table_t grown = *table;
+
+  grown.capacity = table->capacity ? table->capacity * 2
+                                   : CLIB_INTERN_MIN_CAPACITY;
+  if (!(grown.entries = calloc(grown.capacity, sizeof(entry_t)))) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < table->capacity; i++) {
+    entry_t *entry = &table->entries[i];
+
+    if (entry->str) {
+      *find(&grown, entry->str, entry->length, entry->hash) = *entry;
+    }
+  }
+
+  free(table->entries);
+  *table = grown;
+  return 0;
+}
+
+const char *clib_intern_n(const char *str, size_t length) {
+  uint32_t hash = 0;
+  table_t *table = NULL;
+  entry_t *entry = NULL;
+  const char *interned = NULL;
+
+  if (!str) {
+    return NULL;
+  }
+
+  hash = hash_string(str, length);
+  table = &tables[hash % CLIB_INTERN_STRIPES];
+
+#ifdef HAVE_PTHREADS
+  pthread_once(&locks_once, init_locks);
+  pthread_mutex_lock(&locks[hash % CLIB_INTERN_STRIPES]);
+#endif
+
+  if (4 * (table->count + 1) > 3 * table->capacity && -1 == grow(table)) {
+    goto cleanup;
+  }
+
+  if ((entry = find(table, str, length, hash))->str) {
+    interned = entry->str;
+    goto cleanup;
+  }
+
+  if (!table->strings &&
+      !(table->strings = clib_arena_new(CLIB_INTERN_ARENA_SIZE))) {
+    goto cleanup;
+  }
+
+  if ((interned = clib_arena_strndup(table->strings, str, length))) {
+    entry->str = interned;
+    entry->length = length;
+    entry->hash = hash;
+    table->count++;
+  }
+
+cleanup:
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&locks[hash % CLIB_INTERN_STRIPES]);
+#endif
+  return interned;
+}
+
+const char *clib_intern(const char *str) {
+  return str ? clib_intern_n(str, strlen(str)) : NULL;
+}
+
+void clib_intern_cleanup(void) {
+  for (int i = 0; i < CLIB_INTERN_STRIPES; i++) {
+#ifdef HAVE_PTHREADS
+    pthread_once(&locks_once, init_locks);
+    pthread_mutex_lock(&locks[i]);
+#endif
+    free(tables[i].entries);
+    clib_arena_free(tables[i].strings);
+    memset(&tables[i], 0, sizeof(table_t));
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&locks[i]);
+#endif
+  }
+}
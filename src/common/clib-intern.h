@@ -0,0 +1,37 @@
+//
+// clib-intern.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_INTERN_H
+#define CLIB_INTERN_H 1
+
+#include <stddef.h>
+
+/**
+ * One copy of each distinct string for the whole process, so that equal
+ * strings are the same pointer. It is meant for identifiers, package
+ * authors, names and versions, which are few but repeated across every
+ * manifest of a dependency tree. Safe to use from several threads.
+ */
+
+/**
+ * @return The interned copy of the `length` bytes at `str`, or NULL on
+ * error
+ */
+const char *clib_intern_n(const char *str, size_t length);
+
+/**
+ * @return The interned copy of `str`, or NULL on error or if `str` is
+ * NULL
+ */
+const char *clib_intern(const char *str);
+
+/**
+ * Releases every interned string, which mustn't be used anymore.
+ */
+void clib_intern_cleanup(void);
+
+#endif
@@ -0,0 +1,287 @@
+//
+// clib-jobserver.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-jobserver.h"
+#include "asprintf/asprintf.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// no slot was taken, or the one every process gets without a token
+#define TOKEN_NONE -1
+#define TOKEN_IMPLICIT 256
+
+static struct {
+  int read_fd;
+  int write_fd;
+  // wakes up threads waiting on a token when the implicit slot is free
+  int wake[2];
+  // the jobserver was started here and not inherited
+  int owned;
+  int implicit_taken;
+  int enabled;
+} jobserver = {-1, -1, {-1, -1}, 0, 0, 0};
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+#define lock() pthread_mutex_lock(&mutex)
+#define unlock() pthread_mutex_unlock(&mutex)
+#else
+#define lock()
+#define unlock()
+#endif
+
+#ifndef _WIN32
+/**
+ * Finds the jobserver in `flags`, which GNU make passes either as a pair
+ * of inherited descriptors, `--jobserver-auth=3,4` (`--jobserver-fds` for
+ * make before 4.2), or as a named pipe with `--jobserver-auth=fifo:path`.
+ */
+
+static int parse_makeflags(const char *flags) {
+  const char *names[] = {"--jobserver-auth=", "--jobserver-fds=", 0};
+  const char *auth = NULL;
+  int read_fd = -1;
+  int write_fd = -1;
+
+  if (NULL == flags) {
+    return -1;
+  }
+
+  // like make, the last one wins
+  for (int i = 0; names[i]; i++) {
+    for (const char *p = flags; (p = strstr(p, names[i])); p++) {
+      if (!auth || p > auth) {
+        auth = p + strlen(names[i]);
+      }
+    }
+  }
+
+  if (NULL == auth) {
+    return -1;
+  }
+
+  if (0 == strncmp(auth, "fifo:", 5)) {
+    char path[PATH_MAX];
+    size_t size = strcspn(auth + 5, " ");
+
+    if (size >= sizeof(path)) {
+      return -1;
+    }
+
+    memcpy(path, auth + 5, size);
+    path[size] = 0;
+
+    if (-1 == (read_fd = open(path, O_RDWR))) {
+      return -1;
+    }
+
+    fcntl(read_fd, F_SETFD, FD_CLOEXEC);
+    write_fd = read_fd;
+  } else if (2 != sscanf(auth, "%d,%d", &read_fd, &write_fd) ||
+             -1 == fcntl(read_fd, F_GETFD) ||
+             -1 == fcntl(write_fd, F_GETFD)) {
+    // make didn't think we are a make and closed them
+    return -1;
+  }
+
+  jobserver.read_fd = read_fd;
+  jobserver.write_fd = write_fd;
+  jobserver.owned = 0;
+  return 0;
+}
+
+static int start_jobserver(int jobs) {
+  const char *makeflags = getenv("MAKEFLAGS");
+  char *flags = NULL;
+  int fds[2];
+
+  if (0 != pipe(fds)) {
+    return -1;
+  }
+
+  // this process holds the first slot, the pipe holds the others
+  for (int i = 1; i < jobs; i++) {
+    if (1 != write(fds[1], "+", 1)) {
+      break;
+    }
+  }
+
+  // make reads both names, so the old spelling works everywhere
+  if (-1 == asprintf(&flags, "%s -j --jobserver-fds=%d,%d",
+                     makeflags ? makeflags : "", fds[0], fds[1])) {
+    flags = NULL;
+  }
+
+  if (NULL == flags || 0 != setenv("MAKEFLAGS", flags, 1)) {
+    close(fds[0]);
+    close(fds[1]);
+    free(flags);
+    return -1;
+  }
+
+  free(flags);
+  jobserver.read_fd = fds[0];
+  jobserver.write_fd = fds[1];
+  jobserver.owned = 1;
+  return 0;
+}
+#endif
+
+int clib_jobserver_init(int jobs) {
+#ifdef _WIN32
+  (void)jobs;
+  return 0;
+#else
+  int rc = 0;
+
+  if (jobserver.enabled) {
+    return jobserver.owned ? 2 : 1;
+  }
+
+  if (0 == parse_makeflags(getenv("MAKEFLAGS"))) {
+    rc = 1;
+  } else if (jobs > 1 && 0 == start_jobserver(jobs)) {
+    rc = 2;
+  } else {
+    return jobs > 1 ? -1 : 0;
+  }
+
+  if (0 == pipe(jobserver.wake)) {
+    for (int i = 0; i < 2; i++) {
+      fcntl(jobserver.wake[i], F_SETFD, FD_CLOEXEC);
+      fcntl(jobserver.wake[i], F_SETFL, O_NONBLOCK);
+    }
+  } else {
+    jobserver.wake[0] = jobserver.wake[1] = -1;
+  }
+
+  jobserver.enabled = 1;
+  return rc;
+#endif
+}
+
+int clib_jobserver_enabled(void) { return jobserver.enabled; }
+
+clib_jobserver_token_t clib_jobserver_acquire(void) {
+#ifdef _WIN32
+  return TOKEN_NONE;
+#else
+  if (!jobserver.enabled) {
+    return TOKEN_NONE;
+  }
+
+  for (;;) {
+    struct pollfd fds[2] = {{jobserver.read_fd, POLLIN, 0},
+                            {jobserver.wake[0], POLLIN, 0}};
+    unsigned char token = 0;
+    ssize_t size = 0;
+
+    lock();
+    if (!jobserver.implicit_taken) {
+      jobserver.implicit_taken = 1;
+      unlock();
+      return TOKEN_IMPLICIT;
+    }
+    unlock();
+
+    if (-1 == poll(fds, -1 == jobserver.wake[0] ? 1 : 2, -1)) {
+      if (EINTR == errno) {
+        continue;
+      }
+      return TOKEN_NONE;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      while (1 == read(jobserver.wake[0], &token, 1)) {
+      }
+      continue;
+    }
+
+    // another make may take the token first, then this blocks until
+    // the next one comes back
+    size = read(jobserver.read_fd, &token, 1);
+
+    if (1 == size) {
+      return token;
+    }
+
+    if (-1 == size && (EINTR == errno || EAGAIN == errno)) {
+      continue;
+    }
+
+    // the jobserver is gone, run without it
+    return TOKEN_NONE;
+  }
+#endif
+}
+
+void clib_jobserver_release(clib_jobserver_token_t token) {
+#ifndef _WIN32
+  unsigned char byte = (unsigned char)token;
+
+  if (TOKEN_NONE == token) {
+    return;
+  }
+
+  if (TOKEN_IMPLICIT == token) {
+    lock();
+    jobserver.implicit_taken = 0;
+    unlock();
+
+    if (-1 != jobserver.wake[1] && 1 != write(jobserver.wake[1], "+", 1)) {
+      // the pipe is full, so the waiting threads wake up anyway
+    }
+    return;
+  }
+
+  while (-1 == write(jobserver.write_fd, &byte, 1) && EINTR == errno) {
+  }
+#endif
+}
+
+void clib_jobserver_cleanup(void) {
+#ifndef _WIN32
+  if (!jobserver.enabled) {
+    return;
+  }
+
+  if (jobserver.owned) {
+    close(jobserver.read_fd);
+    close(jobserver.write_fd);
+  } else if (jobserver.read_fd == jobserver.write_fd) {
+    // the named pipe was opened here
+    close(jobserver.read_fd);
+  }
+
+  for (int i = 0; i < 2; i++) {
+    if (-1 != jobserver.wake[i]) {
+      close(jobserver.wake[i]);
+    }
+  }
+
+  memset(&jobserver, 0, sizeof(jobserver));
+  jobserver.read_fd = jobserver.write_fd = -1;
+  jobserver.wake[0] = jobserver.wake[1] = -1;
+#endif
+}
@@ -0,0 +1,52 @@
+//
+// clib-jobserver.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_JOBSERVER_H
+#define CLIB_JOBSERVER_H 1
+
+/**
+ * A job slot taken with `clib_jobserver_acquire()`
+ */
+
+typedef int clib_jobserver_token_t;
+
+/**
+ * Joins the GNU make jobserver advertised in `MAKEFLAGS` by an outer
+ * make. Without one, and with `jobs` above 1, starts a jobserver with
+ * `jobs` slots and advertises it in `MAKEFLAGS`, so the makes started
+ * afterwards share the slots instead of each running `jobs` jobs.
+ *
+ * @return 1 when a jobserver was joined, 2 when one was started, 0 when
+ * there is none, -1 on error
+ */
+int clib_jobserver_init(int jobs);
+
+/**
+ * @return Non zero if a jobserver is in use
+ */
+int clib_jobserver_enabled(void);
+
+/**
+ * Takes a job slot for a command, blocking until one is free. The first
+ * slot is the one this process runs on, every other one is a token of
+ * the jobserver. Returns right away without a jobserver.
+ *
+ * @return The slot to give back with `clib_jobserver_release()`
+ */
+clib_jobserver_token_t clib_jobserver_acquire(void);
+
+/**
+ * Gives back a slot taken with `clib_jobserver_acquire()`
+ */
+void clib_jobserver_release(clib_jobserver_token_t token);
+
+/**
+ * Closes a jobserver started by this process, or leaves a joined one
+ */
+void clib_jobserver_cleanup(void);
+
+#endif
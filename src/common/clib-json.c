@@ -0,0 +1,202 @@
+//
+// clib-json.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-json.h"
+#include <string.h>
+
+void clib_json_init(clib_json_t *json, FILE *out, int pretty) {
+  memset(json, 0, sizeof(*json));
+  json->out = out;
+  json->pretty = pretty;
+}
+
+static void indent(clib_json_t *json, int level) {
+  fputc('\n', json->out);
+
+  for (int i = 0; i < level; i++) {
+    fputs("  ", json->out);
+  }
+}
+
+/**
+ * Separates what comes next from the value before it in its container.
+ *
+ * @return 0 if it may be written, -1 once the writer failed
+ */
+
+static int next_value(clib_json_t *json) {
+  if (json->failed) {
+    return -1;
+  }
+
+  if (json->after_key) {
+    json->after_key = 0;
+    return 0;
+  }
+
+  if (0 == json->depth) {
+    return 0;
+  }
+
+  if (json->count[json->depth - 1]++ > 0) {
+    fputc(',', json->out);
+  }
+
+  if (json->pretty) {
+    indent(json, json->depth);
+  }
+
+  return 0;
+}
+
+static void begin(clib_json_t *json, char bracket) {
+  if (0 != next_value(json)) {
+    return;
+  }
+
+  // what it would hold is left out, along with the rest of the document
+  if (json->depth == CLIB_JSON_MAX_DEPTH) {
+    json->failed = 1;
+    return;
+  }
+
+  fputc(bracket, json->out);
+  json->count[json->depth++] = 0;
+}
+
+static void end(clib_json_t *json, char bracket) {
+  if (json->failed) {
+    return;
+  }
+
+  if (0 == json->depth) {
+    json->failed = 1;
+    return;
+  }
+
+  // an empty one stays on its line
+  if (json->count[--json->depth] > 0 && json->pretty) {
+    indent(json, json->depth);
+  }
+
+  fputc(bracket, json->out);
+}
+
+void clib_json_begin_object(clib_json_t *json) { begin(json, '{'); }
+
+void clib_json_end_object(clib_json_t *json) { end(json, '}'); }
+
+void clib_json_begin_array(clib_json_t *json) { begin(json, '['); }
+
+void clib_json_end_array(clib_json_t *json) { end(json, ']'); }
+
+/**
+ * Writes `value` between quotes, escaping what JSON doesn't allow in a
+ * string, and each run of characters that need no escaping at once.
+ */
+
+static void write_string(clib_json_t *json, const char *value) {
+  static const char hex[] = "0123456789abcdef";
+  const char *run = value;
+  const char *p = value;
+
+  fputc('"', json->out);
+
+  for (; *p; p++) {
+    unsigned char c = (unsigned char)*p;
+    char escape[7] = {'\\', 0, 0, 0, 0, 0, 0};
+
+    if ('"' != c && '\\' != c && c >= 0x20) {
+      continue;
+    }
+
+    fwrite(run, 1, p - run, json->out);
+    run = p + 1;
+
+    switch (c) {
+    case '"':
+    case '\\':
+      escape[1] = c;
+      break;
+    case '\b':
+      escape[1] = 'b';
+      break;
+    case '\f':
+      escape[1] = 'f';
+      break;
+    case '\n':
+      escape[1] = 'n';
+      break;
+    case '\r':
+      escape[1] = 'r';
+      break;
+    case '\t':
+      escape[1] = 't';
+      break;
+    default:
+      memcpy(escape + 1, "u00", 3);
+      escape[4] = hex[c >> 4];
+      escape[5] = hex[c & 0xf];
+      break;
+    }
+
+    fputs(escape, json->out);
+  }
+
+  fwrite(run, 1, p - run, json->out);
+  fputc('"', json->out);
+}
+
+void clib_json_key(clib_json_t *json, const char *key) {
+  if (0 != next_value(json)) {
+    return;
+  }
+
+  write_string(json, key ? key : "");
+  fputs(json->pretty ? ": " : ":", json->out);
+  json->after_key = 1;
+}
+
+void clib_json_string(clib_json_t *json, const char *value) {
+  if (0 != next_value(json)) {
+    return;
+  }
+
+  if (value) {
+    write_string(json, value);
+  } else {
+    fputs("null", json->out);
+  }
+}
+
+void clib_json_uint(clib_json_t *json, unsigned long long value) {
+  if (0 == next_value(json)) {
+    fprintf(json->out, "%llu", value);
+  }
+}
+
+void clib_json_int(clib_json_t *json, long long value) {
+  if (0 == next_value(json)) {
+    fprintf(json->out, "%lld", value);
+  }
+}
+
+void clib_json_bool(clib_json_t *json, int value) {
+  if (0 == next_value(json)) {
+    fputs(value ? "true" : "false", json->out);
+  }
+}
+
+int clib_json_finish(clib_json_t *json) {
+  fputc('\n', json->out);
+
+  if (0 != fflush(json->out) || ferror(json->out)) {
+    json->failed = 1;
+  }
+
+  return json->failed || 0 != json->depth ? -1 : 0;
+}
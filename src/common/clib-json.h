@@ -0,0 +1,68 @@
+//
+// clib-json.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_JSON_H
+#define CLIB_JSON_H 1
+
+#include <stdio.h>
+
+// arrays and objects nested deeper are left out
+#define CLIB_JSON_MAX_DEPTH 32
+
+/**
+ * Writes JSON to a stream as it goes, rather than building values to
+ * serialize: a command printing thousands of packages allocates nothing.
+ * Keys and values follow each other in calls, the writer puts in the
+ * commas and, when `pretty`, the same line breaks and indentation as
+ * parson.
+ */
+typedef struct {
+  FILE *out;
+  int pretty;
+  int depth;
+  int after_key; // the value of a key comes next
+  int count[CLIB_JSON_MAX_DEPTH]; // of the values in each open container
+  int failed;
+} clib_json_t;
+
+/**
+ * Starts writing a JSON document to `out`.
+ */
+void clib_json_init(clib_json_t *json, FILE *out, int pretty);
+
+void clib_json_begin_object(clib_json_t *json);
+
+void clib_json_end_object(clib_json_t *json);
+
+void clib_json_begin_array(clib_json_t *json);
+
+void clib_json_end_array(clib_json_t *json);
+
+/**
+ * Writes the key of the next value of an object.
+ */
+void clib_json_key(clib_json_t *json, const char *key);
+
+/**
+ * Writes `value` escaped, or null when it is NULL.
+ */
+void clib_json_string(clib_json_t *json, const char *value);
+
+void clib_json_uint(clib_json_t *json, unsigned long long value);
+
+void clib_json_int(clib_json_t *json, long long value);
+
+void clib_json_bool(clib_json_t *json, int value);
+
+/**
+ * Ends the document with a line break and flushes it.
+ *
+ * @return 0 on success, -1 if anything couldn't be written
+ */
+int clib_json_finish(clib_json_t *json);
+
+#endif
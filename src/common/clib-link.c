@@ -0,0 +1,58 @@
+//
+// clib-link.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "clib-link.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#ifndef SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE
+#define SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE 0x2
+#endif
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+int clib_link_is_link(const char *path) {
+#ifdef _WIN32
+  DWORD attributes = GetFileAttributesA(path);
+
+  return INVALID_FILE_ATTRIBUTES != attributes &&
+         0 != (attributes & FILE_ATTRIBUTE_REPARSE_POINT);
+#else
+  struct stat stats;
+
+  return 0 == lstat(path, &stats) && S_ISLNK(stats.st_mode);
+#endif
+}
+
+int clib_link_dir(const char *target, const char *path) {
+  if (clib_link_is_link(path)) {
+#ifdef _WIN32
+    // a link to a directory is removed like one
+    if (!RemoveDirectoryA(path)) {
+      return -1;
+    }
+#else
+    if (0 != unlink(path)) {
+      return -1;
+    }
+#endif
+  }
+
+#ifdef _WIN32
+  return CreateSymbolicLinkA(path, target,
+                             SYMBOLIC_LINK_FLAG_DIRECTORY |
+                                 SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE)
+             ? 0
+             : -1;
+#else
+  return 0 == symlink(target, path) ? 0 : -1;
+#endif
+}
@@ -0,0 +1,25 @@
+//
+// clib-link.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_LINK_H
+#define CLIB_LINK_H 1
+
+/**
+ * Makes `path` a link to the directory `target`: a symbolic link, which
+ * Windows lets users make without privileges in developer mode. A link
+ * already at `path` is replaced, anything else is left as it is.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_link_dir(const char *target, const char *path);
+
+/**
+ * @return 1 if `path` is a link made by `clib_link_dir()`, 0 otherwise
+ */
+int clib_link_is_link(const char *path);
+
+#endif
@@ -0,0 +1,478 @@
+//
+// clib-lockfile.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-lockfile.h"
+#include "clib-hash.h"
+#include "fs/fs.h"
+#include "parson/parson.h"
+#include "strdup/strdup.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#define CLIB_LOCKFILE_VERSION 1
+
+struct clib_lockfile {
+  JSON_Value *root;
+  JSON_Object *packages;
+  JSON_Value *kept; // slugs marked unchanged, never saved
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t mutex;
+#endif
+};
+
+#ifdef HAVE_PTHREADS
+#define LOCK(self) pthread_mutex_lock(&(self)->mutex)
+#define UNLOCK(self) pthread_mutex_unlock(&(self)->mutex)
+#else
+#define LOCK(self)
+#define UNLOCK(self)
+#endif
+
+static clib_lockfile_t *lockfile_new(JSON_Value *root) {
+  clib_lockfile_t *self = NULL;
+  JSON_Object *object = json_value_get_object(root);
+
+  if (NULL == object) {
+    return NULL;
+  }
+
+  if (!json_object_get_object(object, "packages")) {
+    json_object_set_value(object, "packages", json_value_init_object());
+  }
+
+  if (!(self = malloc(sizeof(clib_lockfile_t)))) {
+    return NULL;
+  }
+
+  memset(self, 0, sizeof(clib_lockfile_t));
+
+  if (!(self->kept = json_value_init_object())) {
+    free(self);
+    return NULL;
+  }
+
+  self->root = root;
+  self->packages = json_object_get_object(object, "packages");
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_init(&self->mutex, NULL);
+#endif
+
+  return self;
+}
+
+clib_lockfile_t *clib_lockfile_new(void) {
+  JSON_Value *root = json_value_init_object();
+  clib_lockfile_t *self = NULL;
+
+  if (NULL == root) {
+    return NULL;
+  }
+
+  json_object_set_number(json_value_get_object(root), "lockfileVersion",
+                         CLIB_LOCKFILE_VERSION);
+
+  if (!(self = lockfile_new(root))) {
+    json_value_free(root);
+  }
+
+  return self;
+}
+
+clib_lockfile_t *clib_lockfile_load(const char *path) {
+  JSON_Value *root = NULL;
+  clib_lockfile_t *self = NULL;
+
+  if (!path || 0 != fs_exists(path)) {
+    return NULL;
+  }
+
+  if (!(root = json_parse_file(path))) {
+    return NULL;
+  }
+
+  if (CLIB_LOCKFILE_VERSION !=
+          (int)json_object_get_number(json_value_get_object(root),
+                                      "lockfileVersion") ||
+      !(self = lockfile_new(root))) {
+    json_value_free(root);
+    return NULL;
+  }
+
+  return self;
+}
+
+int clib_lockfile_save(clib_lockfile_t *self, const char *path) {
+  int rc = -1;
+
+  if (!self || !path) {
+    return -1;
+  }
+
+  LOCK(self);
+  if (JSONSuccess == json_serialize_to_file_pretty(self->root, path)) {
+    rc = 0;
+  }
+  UNLOCK(self);
+
+  return rc;
+}
+
+int clib_lockfile_has(clib_lockfile_t *self, const char *slug) {
+  int has = 0;
+
+  if (!self || !slug) {
+    return 0;
+  }
+
+  LOCK(self);
+  // an entry that is left with its files only is resolved again
+  has = NULL != json_object_get_string(
+                    json_object_get_object(self->packages, slug), "json");
+  UNLOCK(self);
+
+  return has;
+}
+
+char *clib_lockfile_manifest(clib_lockfile_t *self, const char *slug,
+                             char **file) {
+  JSON_Object *entry = NULL;
+  const char *json = NULL;
+  const char *hash = NULL;
+  const char *manifest = NULL;
+  char *res = NULL;
+  char digest[CLIB_HASH_HEX_SIZE];
+
+  if (!self || !slug) {
+    return NULL;
+  }
+
+  LOCK(self);
+
+  if (!(entry = json_object_get_object(self->packages, slug))) {
+    goto done;
+  }
+
+  json = json_object_get_string(entry, "json");
+  hash = json_object_get_string(entry, "hash");
+  manifest = json_object_get_string(entry, "manifest");
+
+  if (!json || !hash || !manifest) {
+    goto done;
+  }
+
+  // a hand edited entry is re-resolved rather than trusted
+  clib_hash_buffer(json, strlen(json), digest);
+  if (0 != strcmp(digest, hash)) {
+    goto done;
+  }
+
+  if (file && !(*file = strdup(manifest))) {
+    goto done;
+  }
+
+  if (!(res = strdup(json)) && file) {
+    free(*file);
+    *file = NULL;
+  }
+
+done:
+  UNLOCK(self);
+  return res;
+}
+
+static JSON_Value *string_array(list_t *list) {
+  JSON_Value *value = json_value_init_array();
+  list_iterator_t *iterator = NULL;
+  list_node_t *node = NULL;
+
+  if (NULL == value || NULL == list) {
+    return value;
+  }
+
+  if ((iterator = list_iterator_new(list, LIST_HEAD))) {
+    while ((node = list_iterator_next(iterator))) {
+      json_array_append_string(json_value_get_array(value), node->val);
+    }
+    list_iterator_destroy(iterator);
+  }
+
+  return value;
+}
+
+static JSON_Value *dependency_array(list_t *list) {
+  JSON_Value *value = json_value_init_array();
+  list_iterator_t *iterator = NULL;
+  list_node_t *node = NULL;
+
+  if (NULL == value || NULL == list) {
+    return value;
+  }
+
+  if ((iterator = list_iterator_new(list, LIST_HEAD))) {
+    while ((node = list_iterator_next(iterator))) {
+      clib_package_dependency_t *dep = node->val;
+      char *slug = malloc(strlen(dep->author) + strlen(dep->name) +
+                          strlen(dep->version) + 3);
+
+      if (slug) {
+        sprintf(slug, "%s/%s@%s", dep->author, dep->name, dep->version);
+        json_array_append_string(json_value_get_array(value), slug);
+        free(slug);
+      }
+    }
+    list_iterator_destroy(iterator);
+  }
+
+  return value;
+}
+
+int clib_lockfile_add(clib_lockfile_t *self, const char *slug,
+                      clib_package_t *pkg) {
+  JSON_Value *value = NULL;
+  JSON_Value *sources = NULL;
+  JSON_Object *entry = NULL;
+  JSON_Object *previous = NULL;
+  char digest[CLIB_HASH_HEX_SIZE];
+
+  if (!self || !slug || !pkg || !pkg->json || !pkg->filename) {
+    return -1;
+  }
+
+  if (!(value = json_value_init_object())) {
+    return -1;
+  }
+
+  entry = json_value_get_object(value);
+  clib_hash_buffer(pkg->json, strlen(pkg->json), digest);
+
+  if (pkg->author) {
+    json_object_set_string(entry, "author", pkg->author);
+  }
+  if (pkg->name) {
+    json_object_set_string(entry, "name", pkg->name);
+  }
+  if (pkg->version) {
+    json_object_set_string(entry, "version", pkg->version);
+  }
+  if (pkg->repo) {
+    json_object_set_string(entry, "repo", pkg->repo);
+  }
+
+  json_object_set_string(entry, "manifest", pkg->filename);
+  json_object_set_string(entry, "hash", digest);
+  json_object_set_value(entry, "files", string_array(pkg->src));
+  json_object_set_value(entry, "dependencies",
+                        dependency_array(pkg->dependencies));
+  json_object_set_value(entry, "development",
+                        dependency_array(pkg->development));
+  json_object_set_string(entry, "json", pkg->json);
+
+  LOCK(self);
+  // what is known of the files outlives a new resolution
+  if ((previous = json_object_get_object(self->packages, slug)) &&
+      (sources = json_object_get_value(previous, "sources"))) {
+    json_object_set_value(entry, "sources", json_value_deep_copy(sources));
+  }
+
+  if (JSONSuccess != json_object_set_value(self->packages, slug, value)) {
+    UNLOCK(self);
+    json_value_free(value);
+    return -1;
+  }
+  UNLOCK(self);
+
+  return 0;
+}
+
+list_t *clib_lockfile_slugs(clib_lockfile_t *self) {
+  list_t *slugs = NULL;
+  char *slug = NULL;
+
+  if (!self || !(slugs = list_new())) {
+    return NULL;
+  }
+
+  slugs->free = free;
+
+  LOCK(self);
+  for (size_t i = 0; i < json_object_get_count(self->packages); i++) {
+    const char *name = json_object_get_name(self->packages, i);
+    JSON_Object *entry = json_object_get_object(self->packages, name);
+
+    if (json_object_get_string(entry, "json") && (slug = strdup(name))) {
+      list_rpush(slugs, list_node_new(slug));
+    }
+  }
+  UNLOCK(self);
+
+  return slugs;
+}
+
+char *clib_lockfile_commit(clib_lockfile_t *self, const char *slug) {
+  JSON_Object *entry = NULL;
+  const char *commit = NULL;
+  char *res = NULL;
+
+  if (!self || !slug) {
+    return NULL;
+  }
+
+  LOCK(self);
+  if ((entry = json_object_get_object(self->packages, slug)) &&
+      (commit = json_object_get_string(entry, "commit"))) {
+    res = strdup(commit);
+  }
+  UNLOCK(self);
+
+  return res;
+}
+
+int clib_lockfile_set_commit(clib_lockfile_t *self, const char *slug,
+                             const char *commit) {
+  JSON_Object *entry = NULL;
+  int rc = -1;
+
+  if (!self || !slug || !commit) {
+    return -1;
+  }
+
+  LOCK(self);
+  if ((entry = json_object_get_object(self->packages, slug)) &&
+      JSONSuccess == json_object_set_string(entry, "commit", commit)) {
+    rc = 0;
+  }
+  UNLOCK(self);
+
+  return rc;
+}
+
+void clib_lockfile_remove(clib_lockfile_t *self, const char *slug) {
+  JSON_Object *entry = NULL;
+
+  if (!self || !slug) {
+    return;
+  }
+
+  LOCK(self);
+  if ((entry = json_object_get_object(self->packages, slug))) {
+    json_object_remove(entry, "json");
+    json_object_remove(entry, "hash");
+    json_object_remove(entry, "commit");
+  }
+  json_object_remove(json_value_get_object(self->kept), slug);
+  UNLOCK(self);
+}
+
+int clib_lockfile_source(clib_lockfile_t *self, const char *slug,
+                         const char *file, char **hash, char **etag) {
+  JSON_Object *entry = NULL;
+  JSON_Object *source = NULL;
+  const char *value = NULL;
+  int rc = -1;
+
+  *hash = NULL;
+  *etag = NULL;
+
+  if (!self || !slug || !file) {
+    return -1;
+  }
+
+  LOCK(self);
+  if ((entry = json_object_get_object(self->packages, slug)) &&
+      (source = json_object_get_object(
+           json_object_get_object(entry, "sources"), file)) &&
+      (value = json_object_get_string(source, "hash")) &&
+      (*hash = strdup(value))) {
+    if ((value = json_object_get_string(source, "etag"))) {
+      *etag = strdup(value);
+    }
+    rc = 0;
+  }
+  UNLOCK(self);
+
+  return rc;
+}
+
+int clib_lockfile_set_source(clib_lockfile_t *self, const char *slug,
+                             const char *file, const char *hash,
+                             const char *etag) {
+  JSON_Object *entry = NULL;
+  JSON_Object *sources = NULL;
+  JSON_Value *value = NULL;
+  int rc = -1;
+
+  if (!self || !slug || !file || !hash ||
+      !(value = json_value_init_object())) {
+    return -1;
+  }
+
+  json_object_set_string(json_value_get_object(value), "hash", hash);
+  if (etag) {
+    json_object_set_string(json_value_get_object(value), "etag", etag);
+  }
+
+  LOCK(self);
+  if ((entry = json_object_get_object(self->packages, slug))) {
+    if (!(sources = json_object_get_object(entry, "sources"))) {
+      json_object_set_value(entry, "sources", json_value_init_object());
+      sources = json_object_get_object(entry, "sources");
+    }
+
+    if (sources && JSONSuccess == json_object_set_value(sources, file, value)) {
+      value = NULL;
+      rc = 0;
+    }
+  }
+  UNLOCK(self);
+
+  json_value_free(value);
+  return rc;
+}
+
+void clib_lockfile_keep(clib_lockfile_t *self, const char *slug) {
+  if (!self || !slug) {
+    return;
+  }
+
+  LOCK(self);
+  json_object_set_boolean(json_value_get_object(self->kept), slug, 1);
+  UNLOCK(self);
+}
+
+int clib_lockfile_kept(clib_lockfile_t *self, const char *slug) {
+  int kept = 0;
+
+  if (!self || !slug) {
+    return 0;
+  }
+
+  LOCK(self);
+  kept = 1 == json_object_get_boolean(json_value_get_object(self->kept), slug);
+  UNLOCK(self);
+
+  return kept;
+}
+
+void clib_lockfile_free(clib_lockfile_t *self) {
+  if (NULL == self) {
+    return;
+  }
+
+  json_value_free(self->root);
+  json_value_free(self->kept);
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_destroy(&self->mutex);
+#endif
+
+  free(self);
+}
@@ -0,0 +1,123 @@
+//
+// clib-lockfile.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_LOCKFILE_H
+#define CLIB_LOCKFILE_H 1
+
+#include "clib-package.h"
+
+#define CLIB_LOCKFILE_NAME "clib.lock"
+
+/**
+ * A lockfile maps every requested `author/name@version` slug to the
+ * manifest it resolved to, so later installs can skip resolution.
+ */
+
+typedef struct clib_lockfile clib_lockfile_t;
+
+/**
+ * @return A new empty lockfile, or NULL on error
+ */
+clib_lockfile_t *clib_lockfile_new(void);
+
+/**
+ * Loads the lockfile at `path`.
+ *
+ * @return NULL if it doesn't exist or is invalid
+ */
+clib_lockfile_t *clib_lockfile_load(const char *path);
+
+/**
+ * Writes the lockfile to `path`.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_lockfile_save(clib_lockfile_t *self, const char *path);
+
+/**
+ * @return 1 if `slug` is locked, 0 otherwise
+ */
+int clib_lockfile_has(clib_lockfile_t *self, const char *slug);
+
+/**
+ * Looks up the locked manifest of `slug`, checking it against its
+ * recorded hash. `file` receives the manifest file name and must be
+ * freed by the caller.
+ *
+ * @return The manifest, or NULL if `slug` isn't locked or the entry
+ * doesn't match its hash
+ */
+char *clib_lockfile_manifest(clib_lockfile_t *self, const char *slug,
+                             char **file);
+
+/**
+ * Records that `slug` resolved to `pkg`, replacing any previous entry.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_lockfile_add(clib_lockfile_t *self, const char *slug,
+                      clib_package_t *pkg);
+
+/**
+ * @return A new list of the slugs that are resolved, or NULL on error
+ */
+list_t *clib_lockfile_slugs(clib_lockfile_t *self);
+
+/**
+ * @return The commit `slug` was at when it was installed, which must be
+ * freed, or NULL if none was recorded
+ */
+char *clib_lockfile_commit(clib_lockfile_t *self, const char *slug);
+
+/**
+ * Records that `slug` was installed at `commit`.
+ *
+ * @return 0 on success, -1 if `slug` isn't locked
+ */
+int clib_lockfile_set_commit(clib_lockfile_t *self, const char *slug,
+                             const char *commit);
+
+/**
+ * Forgets what `slug` resolved to, so that it is resolved again. What is
+ * recorded of its files is kept for the next install.
+ */
+void clib_lockfile_remove(clib_lockfile_t *self, const char *slug);
+
+/**
+ * Looks up what was installed of `file` of `slug`: the hash of its
+ * content, and the ETag it was served with, NULL when it isn't known.
+ * Both must be freed.
+ *
+ * @return 0 if `file` was recorded, -1 otherwise
+ */
+int clib_lockfile_source(clib_lockfile_t *self, const char *slug,
+                         const char *file, char **hash, char **etag);
+
+/**
+ * Records that `file` of `slug` was installed with the content hashed as
+ * `hash`, served with `etag` unless that is NULL.
+ *
+ * @return 0 on success, -1 if `slug` isn't locked
+ */
+int clib_lockfile_set_source(clib_lockfile_t *self, const char *slug,
+                             const char *file, const char *hash,
+                             const char *etag);
+
+/**
+ * Marks `slug` as unchanged since it was installed, so that installing it
+ * again leaves what is there as it is. Marks are not saved.
+ */
+void clib_lockfile_keep(clib_lockfile_t *self, const char *slug);
+
+/**
+ * @return 1 if `slug` was marked with `clib_lockfile_keep()`, 0 otherwise
+ */
+int clib_lockfile_kept(clib_lockfile_t *self, const char *slug);
+
+void clib_lockfile_free(clib_lockfile_t *self);
+
+#endif
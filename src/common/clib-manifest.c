@@ -0,0 +1,832 @@
+//
+// clib-manifest.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-manifest.h"
+#include "clib-arena.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// as deep as parson goes
+#define MANIFEST_MAX_NESTING 2048
+
+typedef struct {
+  const char *cursor;
+  clib_arena_t *arena;
+  size_t depth;
+} reader_t;
+
+enum {
+  KEY_NAME,
+  KEY_REPO,
+  KEY_VERSION,
+  KEY_LICENSE,
+  KEY_DESCRIPTION,
+  KEY_CONFIGURE,
+  KEY_INSTALL,
+  KEY_MAKEFILE,
+  KEY_PREFIX,
+  KEY_FLAGS,
+  KEY_CFLAGS,
+  KEY_SRC,
+  KEY_FILES,
+  KEY_DEPENDENCIES,
+  KEY_DEVELOPMENT,
+  KEY_BINARIES,
+  KEY_KEYWORDS,
+  KEY_COUNT
+};
+
+static const char *keys[KEY_COUNT] = {
+    "name",
+    "repo",
+    "version",
+    "license",
+    "description",
+    "configure",
+    "install",
+    "makefile",
+    "prefix",
+    "flags",
+    "cflags",
+    "src",
+    "files",
+    "dependencies",
+    "development",
+    "binaries",
+    "keywords",
+};
+
+static void skip_whitespace(reader_t *r) {
+  while (isspace((unsigned char)*r->cursor)) {
+    r->cursor++;
+  }
+}
+
+static int is_plain(char c) {
+  return '"' != c && '\\' != c && (unsigned char)c >= 0x20;
+}
+
+/**
+ * @return The code unit of the 4 hex digits at `p`, or -1 if they aren't
+ */
+
+static long read_hex(const char *p) {
+  long value = 0;
+
+  for (int i = 0; i < 4; i++) {
+    int c = (unsigned char)p[i];
+
+    if (!isxdigit(c)) {
+      return -1;
+    }
+
+    value = value * 16 + (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+  }
+
+  return value;
+}
+
+/**
+ * Writes `cp` as UTF-8 to `out`, unless it is NULL.
+ *
+ * @return The number of bytes it takes
+ */
+
+static size_t encode_utf8(unsigned long cp, char *out) {
+  unsigned char bytes[4];
+  size_t size = 0;
+
+  if (cp < 0x80) {
+    bytes[size++] = (unsigned char)cp;
+  } else if (cp < 0x800) {
+    bytes[size++] = 0xC0 | (cp >> 6);
+    bytes[size++] = 0x80 | (cp & 0x3F);
+  } else if (cp < 0x10000) {
+    bytes[size++] = 0xE0 | (cp >> 12);
+    bytes[size++] = 0x80 | ((cp >> 6) & 0x3F);
+    bytes[size++] = 0x80 | (cp & 0x3F);
+  } else {
+    bytes[size++] = 0xF0 | (cp >> 18);
+    bytes[size++] = 0x80 | ((cp >> 12) & 0x3F);
+    bytes[size++] = 0x80 | ((cp >> 6) & 0x3F);
+    bytes[size++] = 0x80 | (cp & 0x3F);
+  }
+
+  if (out) {
+    memcpy(out, bytes, size);
+  }
+
+  return size;
+}
+
+/**
+ * Decodes the string after the opening quote at `*cursor` into `out`,
+ * unless it is NULL, and moves `*cursor` past its closing quote. The
+ * decoded string is never longer than the quoted one.
+ *
+ * @return 0 with the decoded length in `length`, -1 if it is malformed
+ */
+
+static int decode_string(const char **cursor, char *out, size_t *length) {
+  const char *p = *cursor;
+  size_t n = 0;
+
+  while ('"' != *p) {
+    unsigned char c = (unsigned char)*p++;
+    long cp = 0;
+    long trail = 0;
+
+    // control characters, the end of the input among them, can't be in
+    // a string
+    if (c < 0x20) {
+      return -1;
+    }
+
+    if ('\\' == c) {
+      switch (*p++) {
+      case '"':
+        c = '"';
+        break;
+      case '\\':
+        c = '\\';
+        break;
+      case '/':
+        c = '/';
+        break;
+      case 'b':
+        c = '\b';
+        break;
+      case 'f':
+        c = '\f';
+        break;
+      case 'n':
+        c = '\n';
+        break;
+      case 'r':
+        c = '\r';
+        break;
+      case 't':
+        c = '\t';
+        break;
+      case 'u':
+        if (-1 == (cp = read_hex(p)) || (cp >= 0xDC00 && cp <= 0xDFFF)) {
+          return -1;
+        }
+
+        p += 4;
+
+        // a lead surrogate must be followed by a trail one
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+          trail = '\\' == p[0] && 'u' == p[1] ? read_hex(p + 2) : -1;
+
+          if (trail < 0xDC00 || trail > 0xDFFF) {
+            return -1;
+          }
+
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (trail - 0xDC00);
+          p += 6;
+        }
+
+        n += encode_utf8((unsigned long)cp, out ? out + n : NULL);
+        continue;
+      default:
+        return -1;
+      }
+    }
+
+    if (out) {
+      out[n] = (char)c;
+    }
+
+    n++;
+  }
+
+  *cursor = p + 1;
+  *length = n;
+  return 0;
+}
+
+/**
+ * Reads the string at the cursor, into a copy in the arena unless `out`
+ * is NULL.
+ *
+ * @return 0 on success, -1 on error or if there is no string
+ */
+
+static int read_string(reader_t *r, char **out) {
+  const char *start = r->cursor + 1;
+  const char *p = start;
+  size_t length = 0;
+
+  if ('"' != *r->cursor) {
+    return -1;
+  }
+
+  // most strings have no escapes, and are copied as they are
+  while (is_plain(*p)) {
+    p++;
+  }
+
+  if ('"' == *p) {
+    r->cursor = p + 1;
+    if (out && !(*out = clib_arena_strndup(r->arena, start, p - start))) {
+      return -1;
+    }
+    return 0;
+  }
+
+  r->cursor = start;
+  if (-1 == decode_string(&r->cursor, NULL, &length)) {
+    return -1;
+  }
+
+  if (out) {
+    if (!(*out = clib_arena_alloc(r->arena, length + 1))) {
+      return -1;
+    }
+
+    p = start;
+    decode_string(&p, *out, &length);
+    (*out)[length] = 0;
+  }
+
+  return 0;
+}
+
+/**
+ * Reads the key at the cursor, comparing it in place where it has no
+ * escapes.
+ *
+ * @return The `KEY_*` of the key, KEY_COUNT if clib doesn't use it, or -1
+ * on error
+ */
+
+static int read_key(reader_t *r) {
+  char decoded[sizeof("dependencies")];
+  const char *start = r->cursor + 1;
+  const char *key = start;
+  const char *p = start;
+  size_t length = 0;
+
+  if ('"' != *r->cursor) {
+    return -1;
+  }
+
+  while (is_plain(*p)) {
+    p++;
+  }
+
+  if ('"' == *p) {
+    r->cursor = p + 1;
+    length = p - start;
+  } else {
+    r->cursor = start;
+    if (-1 == decode_string(&r->cursor, NULL, &length)) {
+      return -1;
+    }
+
+    if (length >= sizeof(decoded)) {
+      return KEY_COUNT;
+    }
+
+    p = start;
+    decode_string(&p, decoded, &length);
+    key = decoded;
+  }
+
+  for (int i = 0; i < KEY_COUNT; i++) {
+    if (length == strlen(keys[i]) && 0 == memcmp(keys[i], key, length)) {
+      return i;
+    }
+  }
+
+  return KEY_COUNT;
+}
+
+/**
+ * Moves the cursor past `c` and the whitespace around it.
+ *
+ * @return 0 on success, -1 if `c` isn't next
+ */
+
+static int expect(reader_t *r, char c) {
+  skip_whitespace(r);
+  if (c != *r->cursor) {
+    return -1;
+  }
+
+  r->cursor++;
+  skip_whitespace(r);
+  return 0;
+}
+
+/**
+ * Moves the cursor into the object or array opened by `open` at it.
+ *
+ * @return 1 at its first member, 0 past its end if it is empty, -1 on
+ * error
+ */
+
+static int enter(reader_t *r, char open, char close) {
+  if (open != *r->cursor || ++r->depth > MANIFEST_MAX_NESTING) {
+    return -1;
+  }
+
+  r->cursor++;
+  skip_whitespace(r);
+
+  if (close == *r->cursor) {
+    r->cursor++;
+    r->depth--;
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * Moves the cursor from the end of a member of the object or array
+ * closed by `close` to the next one.
+ *
+ * @return 1 at the next member, 0 past the end of the object or array, -1
+ * on error
+ */
+
+static int next(reader_t *r, char close) {
+  skip_whitespace(r);
+
+  if (',' == *r->cursor) {
+    r->cursor++;
+    skip_whitespace(r);
+    return 1;
+  }
+
+  if (close == *r->cursor) {
+    r->cursor++;
+    r->depth--;
+    return 0;
+  }
+
+  return -1;
+}
+
+static int skip_literal(reader_t *r, const char *literal) {
+  size_t length = strlen(literal);
+
+  if (0 != strncmp(r->cursor, literal, length)) {
+    return -1;
+  }
+
+  r->cursor += length;
+  return 0;
+}
+
+static int skip_number(reader_t *r) {
+  const char *p = r->cursor;
+
+  if ('-' == *p) {
+    p++;
+  }
+
+  if ('0' == *p) {
+    p++;
+  } else if (isdigit((unsigned char)*p)) {
+    while (isdigit((unsigned char)*p)) {
+      p++;
+    }
+  } else {
+    return -1;
+  }
+
+  if ('.' == *p) {
+    if (!isdigit((unsigned char)*++p)) {
+      return -1;
+    }
+    while (isdigit((unsigned char)*p)) {
+      p++;
+    }
+  }
+
+  if ('e' == *p || 'E' == *p) {
+    if ('+' == *++p || '-' == *p) {
+      p++;
+    }
+    if (!isdigit((unsigned char)*p)) {
+      return -1;
+    }
+    while (isdigit((unsigned char)*p)) {
+      p++;
+    }
+  }
+
+  r->cursor = p;
+  return 0;
+}
+
+/**
+ * Checks the value at the cursor and moves past it, allocating nothing.
+ *
+ * @return 0 on success, -1 if it is malformed
+ */
+
+static int skip_value(reader_t *r) {
+  int rc = 0;
+
+  switch (*r->cursor) {
+  case '{':
+    for (rc = enter(r, '{', '}'); 1 == rc; rc = next(r, '}')) {
+      if (-1 == read_string(r, NULL) || -1 == expect(r, ':') ||
+          -1 == skip_value(r)) {
+        return -1;
+      }
+    }
+    return rc;
+  case '[':
+    for (rc = enter(r, '[', ']'); 1 == rc; rc = next(r, ']')) {
+      if (-1 == skip_value(r)) {
+        return -1;
+      }
+    }
+    return rc;
+  case '"':
+    return read_string(r, NULL);
+  case 't':
+    return skip_literal(r, "true");
+  case 'f':
+    return skip_literal(r, "false");
+  case 'n':
+    return skip_literal(r, "null");
+  default:
+    return skip_number(r);
+  }
+}
+
+/**
+ * Reads the value at the cursor into `out` if it is a string, and skips
+ * it otherwise.
+ */
+
+static int read_string_value(reader_t *r, char **out) {
+  return '"' == *r->cursor ? read_string(r, out) : skip_value(r);
+}
+
+/**
+ * Walks the array at the cursor, writing its strings to `out`, unless it
+ * is NULL, each after a space. Other values are skipped.
+ *
+ * @return 0 with the length of the joined strings in `length`, -1 on
+ * error
+ */
+
+static int join_strings(reader_t *r, char *out, size_t *length) {
+  size_t n = 0;
+  int rc = 0;
+
+  for (rc = enter(r, '[', ']'); 1 == rc; rc = next(r, ']')) {
+    size_t string_length = 0;
+
+    if ('"' != *r->cursor) {
+      if (-1 == skip_value(r)) {
+        return -1;
+      }
+      continue;
+    }
+
+    r->cursor++;
+    if (-1 == decode_string(&r->cursor, out ? out + n + 1 : NULL,
+                            &string_length)) {
+      return -1;
+    }
+
+    if (out) {
+      out[n] = ' ';
+    }
+
+    n += 1 + string_length;
+  }
+
+  *length = n;
+  return rc;
+}
+
+/**
+ * Reads the `flags` at the cursor into `string` if they are a string, or
+ * joined into `array` if they are an array of strings.
+ */
+
+static int read_flags(reader_t *r, char **string, char **array) {
+  const char *start = r->cursor;
+  size_t length = 0;
+
+  if ('[' != *r->cursor) {
+    return read_string_value(r, string);
+  }
+
+  if (-1 == join_strings(r, NULL, &length)) {
+    return -1;
+  }
+
+  if (0 == length) {
+    return 0;
+  }
+
+  if (!(*array = clib_arena_alloc(r->arena, length + 1))) {
+    return -1;
+  }
+
+  // walk the array again now that there is room for its strings
+  r->cursor = start;
+  join_strings(r, *array, &length);
+  (*array)[length] = 0;
+  return 0;
+}
+
+/**
+ * @return A new empty list in the arena, or NULL on error
+ */
+
+static list_t *new_list(reader_t *r) {
+  list_t *list = clib_arena_alloc(r->arena, sizeof(list_t));
+
+  if (list) {
+    memset(list, 0, sizeof(list_t));
+  }
+
+  return list;
+}
+
+/**
+ * Appends `val` to `list` in a node from the arena.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int push(reader_t *r, list_t *list, void *val) {
+  list_node_t *node = clib_arena_alloc(r->arena, sizeof(list_node_t));
+
+  if (!node) {
+    return -1;
+  }
+
+  node->val = val;
+  list_rpush(list, node);
+  return 0;
+}
+
+/**
+ * Reads the array of files at the cursor into `files`. Other values are
+ * skipped.
+ *
+ * @return 0 on success, -1 on error or if a file isn't a string
+ */
+
+static int read_files(reader_t *r, list_t **files) {
+  int rc = 0;
+
+  if ('[' != *r->cursor) {
+    return skip_value(r);
+  }
+
+  if (!(*files = new_list(r))) {
+    return -1;
+  }
+
+  for (rc = enter(r, '[', ']'); 1 == rc; rc = next(r, ']')) {
+    char *file = NULL;
+
+    if (-1 == read_string(r, &file) || -1 == push(r, *files, file)) {
+      return -1;
+    }
+  }
+
+  return rc;
+}
+
+/**
+ * Reads the object of dependencies at the cursor into `deps`. Other
+ * values are skipped.
+ *
+ * @return 0 on success, -1 on error or if a version isn't a string
+ */
+
+static int read_dependencies(reader_t *r, list_t **deps) {
+  int rc = 0;
+
+  if ('{' != *r->cursor) {
+    return skip_value(r);
+  }
+
+  if (!(*deps = new_list(r))) {
+    return -1;
+  }
+
+  for (rc = enter(r, '{', '}'); 1 == rc; rc = next(r, '}')) {
+    clib_package_dependency_t *dep = NULL;
+    char *name = NULL;
+    char *version = NULL;
+
+    if (-1 == read_string(r, &name) || -1 == expect(r, ':') ||
+        -1 == read_string(r, &version)) {
+      return -1;
+    }
+
+    if (!(dep = clib_package_dependency_new_in(r->arena, name, version)) ||
+        -1 == push(r, *deps, dep)) {
+      return -1;
+    }
+  }
+
+  return rc;
+}
+
+/**
+ * Reads the `url` and `sha256` of the prebuilt binary at the cursor into
+ * `pkg`. Other values are skipped.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int read_binary(reader_t *r, clib_package_t *pkg) {
+  int rc = 0;
+
+  if ('{' != *r->cursor) {
+    return skip_value(r);
+  }
+
+  for (rc = enter(r, '{', '}'); 1 == rc; rc = next(r, '}')) {
+    char *key = NULL;
+
+    if (-1 == read_string(r, &key) || -1 == expect(r, ':')) {
+      return -1;
+    }
+
+    if (0 == strcmp(key, "url")) {
+      rc = read_string_value(r, &pkg->binary);
+    } else if (0 == strcmp(key, "sha256")) {
+      rc = read_string_value(r, &pkg->binary_sha256);
+    } else {
+      rc = skip_value(r);
+    }
+
+    if (-1 == rc) {
+      return -1;
+    }
+  }
+
+  return rc;
+}
+
+/**
+ * Reads the prebuilt binary of this platform from the object of binaries
+ * at the cursor into `pkg`, skipping the ones of the other platforms.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int read_binaries(reader_t *r, clib_package_t *pkg) {
+  const char *platform = clib_manifest_platform();
+  int rc = 0;
+
+  if ('{' != *r->cursor) {
+    return skip_value(r);
+  }
+
+  for (rc = enter(r, '{', '}'); 1 == rc; rc = next(r, '}')) {
+    char *name = NULL;
+
+    if (-1 == read_string(r, &name) || -1 == expect(r, ':')) {
+      return -1;
+    }
+
+    if (-1 == (0 == strcmp(name, platform) ? read_binary(r, pkg)
+                                           : skip_value(r))) {
+      return -1;
+    }
+  }
+
+  return rc;
+}
+
+const char *clib_manifest_platform(void) {
+  const char *platform = getenv("CLIB_PLATFORM");
+
+  return platform && *platform ? platform : CLIB_MANIFEST_PLATFORM;
+}
+
+int clib_manifest_read(clib_package_t *pkg, const char *json) {
+  reader_t reader = {json, pkg->arena, 0};
+  reader_t *r = &reader;
+  // `flags` and `cflags` strings, then arrays, in order of precedence
+  char *flags[4] = {NULL};
+  // `src` and `files`
+  list_t *files[2] = {NULL};
+  unsigned long seen = 0;
+  int rc = -1;
+
+  skip_whitespace(r);
+
+  // parson takes arrays too, which are valid JSON but not manifests
+  if ('{' != *r->cursor) {
+    return '[' == *r->cursor && 0 == skip_value(r) ? 1 : -1;
+  }
+
+  for (rc = enter(r, '{', '}'); 1 == rc; rc = next(r, '}')) {
+    int key = read_key(r);
+
+    if (-1 == key || -1 == expect(r, ':')) {
+      rc = -1;
+      break;
+    }
+
+    // parson rejects duplicate keys, which would be ambiguous here
+    if (KEY_COUNT != key) {
+      if (seen & (1UL << key)) {
+        rc = -1;
+        break;
+      }
+      seen |= 1UL << key;
+    }
+
+    switch (key) {
+    case KEY_NAME:
+      rc = read_string_value(r, &pkg->name);
+      break;
+    case KEY_REPO:
+      rc = read_string_value(r, &pkg->repo);
+      break;
+    case KEY_VERSION:
+      rc = read_string_value(r, &pkg->version);
+      break;
+    case KEY_LICENSE:
+      rc = read_string_value(r, &pkg->license);
+      break;
+    case KEY_DESCRIPTION:
+      rc = read_string_value(r, &pkg->description);
+      break;
+    case KEY_CONFIGURE:
+      rc = read_string_value(r, &pkg->configure);
+      break;
+    case KEY_INSTALL:
+      rc = read_string_value(r, &pkg->install);
+      break;
+    case KEY_MAKEFILE:
+      rc = read_string_value(r, &pkg->makefile);
+      break;
+    case KEY_PREFIX:
+      rc = read_string_value(r, &pkg->prefix);
+      break;
+    case KEY_FLAGS:
+      rc = read_flags(r, &flags[0], &flags[2]);
+      break;
+    case KEY_CFLAGS:
+      rc = read_flags(r, &flags[1], &flags[3]);
+      break;
+    case KEY_SRC:
+      pkg->lint |= '[' == *r->cursor ? CLIB_MANIFEST_SRC_ARRAY
+                                     : CLIB_MANIFEST_SRC_OTHER;
+      rc = read_files(r, &files[0]);
+      break;
+    case KEY_FILES:
+      rc = read_files(r, &files[1]);
+      break;
+    case KEY_DEPENDENCIES:
+      rc = read_dependencies(r, &pkg->dependencies);
+      break;
+    case KEY_DEVELOPMENT:
+      rc = read_dependencies(r, &pkg->development);
+      break;
+    case KEY_BINARIES:
+      rc = read_binaries(r, pkg);
+      break;
+    case KEY_KEYWORDS:
+      if ('[' == *r->cursor) {
+        pkg->lint |= CLIB_MANIFEST_KEYWORDS;
+      }
+      rc = skip_value(r);
+      break;
+    default:
+      rc = skip_value(r);
+    }
+
+    if (-1 == rc) {
+      break;
+    }
+  }
+
+  if (-1 == rc) {
+    return -1;
+  }
+
+  for (int i = 0; i < 4 && !pkg->flags; i++) {
+    pkg->flags = flags[i];
+  }
+
+  // the list left out stays in the arena until the package is freed
+  pkg->src = files[0] ? files[0] : files[1];
+  return 0;
+}
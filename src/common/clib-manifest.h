@@ -0,0 +1,70 @@
+//
+// clib-manifest.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_MANIFEST_H
+#define CLIB_MANIFEST_H 1
+
+#include "clib-package.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CLIB_MANIFEST_ARCH "x86_64"
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CLIB_MANIFEST_ARCH "aarch64"
+#elif defined(__i386__) || defined(_M_IX86)
+#define CLIB_MANIFEST_ARCH "i686"
+#elif defined(__arm__)
+#define CLIB_MANIFEST_ARCH "arm"
+#elif defined(__riscv) && 64 == __riscv_xlen
+#define CLIB_MANIFEST_ARCH "riscv64"
+#else
+#define CLIB_MANIFEST_ARCH "unknown"
+#endif
+
+#if defined(__linux__)
+#define CLIB_MANIFEST_OS "linux"
+#elif defined(__APPLE__)
+#define CLIB_MANIFEST_OS "darwin"
+#elif defined(__FreeBSD__)
+#define CLIB_MANIFEST_OS "freebsd"
+#elif defined(_WIN32)
+#define CLIB_MANIFEST_OS "windows"
+#else
+#define CLIB_MANIFEST_OS "unknown"
+#endif
+
+// what `binaries` of manifests are looked up by, like "x86_64-linux"
+#define CLIB_MANIFEST_PLATFORM CLIB_MANIFEST_ARCH "-" CLIB_MANIFEST_OS
+
+// what `clib_manifest_read()` notes in `lint` of a package about the keys
+// clib doesn't read into it, for `clib_validate_package()`
+#define CLIB_MANIFEST_KEYWORDS 1  // "keywords" is an array
+#define CLIB_MANIFEST_SRC_ARRAY 2 // "src" is an array
+#define CLIB_MANIFEST_SRC_OTHER 4 // "src" is something else
+
+/**
+ * Reads the clib.json or package.json `json` into `pkg` in a single pass
+ * over it, without building a JSON tree. Only the keys clib uses are
+ * read, into strings in the arena of `pkg`; the values of other keys are
+ * checked and skipped without allocating.
+ *
+ * `flags` and `cflags` may be strings or arrays of strings, and `src`
+ * is read before `files`, as they always were. Of the `binaries`, an
+ * object of `{"url": ..., "sha256": ...}` by platform, only the one of
+ * `clib_manifest_platform()` is read.
+ *
+ * @return 0 on success, 1 if `json` is an array rather than an object,
+ * -1 on error or if `json` isn't valid JSON
+ */
+int clib_manifest_read(clib_package_t *pkg, const char *json);
+
+/**
+ * @return The platform of the prebuilt binaries installed, from the
+ * `CLIB_PLATFORM` environment variable, or else `CLIB_MANIFEST_PLATFORM`
+ */
+const char *clib_manifest_platform(void);
+
+#endif
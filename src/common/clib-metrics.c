@@ -0,0 +1,712 @@
+//
+// clib-metrics.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "clib-metrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// the hosts and the packages with a phase kept, the first ones seen
+#define HOSTS 32
+#define PHASES 256
+#define NAME_SIZE 64
+#define PHASE_SIZE 16
+
+// processes counting the tasks of their pools at once
+#define QUEUES 64
+
+// how long a scrape has to send its request, in seconds
+#define SCRAPE_TIMEOUT 1
+
+// the largest request of a scrape that is read
+#define MAX_SCRAPE 4096
+
+// a slot of a host or a phase is claimed by a process, and only read by
+// the others once its name is in
+#define FREE 0
+#define CLAIMED 1
+#define READY 2
+
+// the upper bounds of the latency buckets in microseconds, the last one
+// being infinite
+static const uint64_t bounds[] = {5000,    10000,   25000,   50000,
+                                  100000,  250000,  500000,  1000000,
+                                  2500000, 5000000, 10000000};
+
+#define BUCKETS (sizeof(bounds) / sizeof(bounds[0]) + 1)
+
+typedef struct {
+  int state;
+  char name[NAME_SIZE];
+  uint64_t buckets[BUCKETS]; // not cumulative
+  uint64_t sum;
+} host_t;
+
+typedef struct {
+  int state;
+  char phase[PHASE_SIZE];
+  char name[NAME_SIZE];
+  uint64_t count;
+  uint64_t sum;
+} phase_t;
+
+typedef struct {
+  int pid; // 0 when free
+  int queued;
+} queue_t;
+
+/**
+ * Mapped shared, so that forked processes count into it too. Hosts and
+ * phases claimed by two processes at once may be in it twice, and are
+ * summed when rendered.
+ */
+typedef struct {
+  uint64_t counters[CLIB_METRICS_COUNTERS];
+  host_t hosts[HOSTS];
+  phase_t phases[PHASES];
+  queue_t queues[QUEUES];
+} metrics_t;
+
+static const struct {
+  const char *name;
+  const char *type;
+  const char *labels;
+  const char *help;
+} counters[CLIB_METRICS_COUNTERS] = {
+    {"clib_cache_hits_total", "counter", "kind=\"manifest\"",
+     "Manifests and packages found in the cache"},
+    {"clib_cache_hits_total", "counter", "kind=\"package\"", NULL},
+    {"clib_cache_misses_total", "counter", "kind=\"manifest\"",
+     "Manifests and packages fetched for want of a cached copy"},
+    {"clib_cache_misses_total", "counter", "kind=\"package\"", NULL},
+    {"clib_manifest_failures_total", "counter", NULL,
+     "Manifests that couldn't be had"},
+    {"clib_http_requests_total", "counter", NULL, "HTTP requests made"},
+    {"clib_http_retries_total", "counter", NULL,
+     "Manifests, tarballs and files asked for again"},
+    {"clib_http_bytes_total", "counter", "encoding=\"wire\"",
+     "Bytes received, as sent and once decoded"},
+    {"clib_http_bytes_total", "counter", "encoding=\"body\"", NULL},
+    {"clib_daemon_commands_total", "counter", NULL,
+     "Commands the daemon started"},
+};
+
+static metrics_t *metrics = NULL;
+
+#ifndef _WIN32
+// the slot of this process, told apart from that of its parent by pid
+static int queue_pid = 0;
+static queue_t *queue = NULL;
+#endif
+
+int clib_metrics_init(void) {
+#ifdef _WIN32
+  return -1;
+#else
+  void *shared = NULL;
+
+  if (metrics) {
+    return 0;
+  }
+
+  shared = mmap(NULL, sizeof(metrics_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (MAP_FAILED == shared) {
+    return -1;
+  }
+
+  // zeroed, every slot free
+  metrics = shared;
+  return 0;
+#endif
+}
+
+void clib_metrics_count(clib_metrics_counter_t counter, uint64_t n) {
+  if (metrics && n > 0 && counter < CLIB_METRICS_COUNTERS) {
+    __sync_fetch_and_add(&metrics->counters[counter], n);
+  }
+}
+
+/**
+ * Claims `*state` when it's free, for its name to be set.
+ *
+ * @return 1 when it was claimed
+ */
+
+static int claim(int *state) {
+  return FREE == *state && __sync_bool_compare_and_swap(state, FREE, CLAIMED);
+}
+
+/**
+ * Sets `*state` ready once the name claimed with it is in.
+ */
+
+static void publish(int *state) {
+  __sync_synchronize();
+  *state = READY;
+}
+
+static int is_ready(int *state) {
+  int ready = READY == *state;
+  __sync_synchronize();
+  return ready;
+}
+
+/**
+ * Copies the `len` bytes of `name` into `dest`, cut to fit.
+ */
+
+static void set_name(char *dest, size_t size, const char *name, size_t len) {
+  len = len < size ? len : size - 1;
+  memcpy(dest, name, len);
+  dest[len] = '\0';
+}
+
+static int name_is(const char *name, size_t size, const char *other,
+                   size_t len) {
+  len = len < size ? len : size - 1;
+  return 0 == strncmp(name, other, len) && '\0' == name[len];
+}
+
+/**
+ * @return The slot of the host of `url`, claimed if it's new, or NULL
+ * when there is no room for it
+ */
+
+static host_t *find_host(const char *url) {
+  const char *start = strstr(url, "://");
+  size_t len = 0;
+
+  start = start ? start + 3 : url;
+  len = strcspn(start, "/?#");
+
+  for (int i = 0; i < HOSTS; i++) {
+    host_t *host = &metrics->hosts[i];
+
+    if (claim(&host->state)) {
+      set_name(host->name, NAME_SIZE, start, len);
+      publish(&host->state);
+      return host;
+    }
+
+    if (is_ready(&host->state) && name_is(host->name, NAME_SIZE, start, len)) {
+      return host;
+    }
+  }
+
+  return NULL;
+}
+
+void clib_metrics_observe_http(const char *url, uint64_t us) {
+  host_t *host = NULL;
+  size_t bucket = 0;
+
+  if (!metrics || !url || !(host = find_host(url))) {
+    return;
+  }
+
+  while (bucket < BUCKETS - 1 && us > bounds[bucket]) {
+    bucket++;
+  }
+
+  __sync_fetch_and_add(&host->buckets[bucket], 1);
+  __sync_fetch_and_add(&host->sum, us);
+}
+
+void clib_metrics_observe_phase(const char *phase, const char *name,
+                                uint64_t us) {
+  size_t phase_len = 0;
+  size_t name_len = 0;
+
+  if (!metrics || !phase || !name) {
+    return;
+  }
+
+  phase_len = strlen(phase);
+  name_len = strlen(name);
+
+  for (int i = 0; i < PHASES; i++) {
+    phase_t *slot = &metrics->phases[i];
+
+    if (claim(&slot->state)) {
+      set_name(slot->phase, PHASE_SIZE, phase, phase_len);
+      set_name(slot->name, NAME_SIZE, name, name_len);
+      publish(&slot->state);
+    } else if (!is_ready(&slot->state) ||
+               !name_is(slot->phase, PHASE_SIZE, phase, phase_len) ||
+               !name_is(slot->name, NAME_SIZE, name, name_len)) {
+      continue;
+    }
+
+    __sync_fetch_and_add(&slot->count, 1);
+    __sync_fetch_and_add(&slot->sum, us);
+    return;
+  }
+}
+
+#ifndef _WIN32
+static int is_gone(int pid) {
+  return 0 != pid && -1 == kill(pid, 0) && ESRCH == errno;
+}
+
+/**
+ * @return The slot counting the tasks queued by this process, taking a
+ * free one or that of a process that went away, or NULL when there is
+ * none
+ */
+
+static queue_t *own_queue(void) {
+  int pid = (int)getpid();
+
+  if (pid == queue_pid) {
+    return queue;
+  }
+
+  for (int i = 0; i < QUEUES; i++) {
+    queue_t *slot = &metrics->queues[i];
+    int owner = slot->pid;
+
+    if ((0 == owner || is_gone(owner)) &&
+        __sync_bool_compare_and_swap(&slot->pid, owner, pid)) {
+      slot->queued = 0;
+      queue = slot;
+      __sync_synchronize();
+      queue_pid = pid;
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+#endif
+
+void clib_metrics_queue(int delta) {
+#ifndef _WIN32
+  queue_t *slot = NULL;
+
+  if (metrics && (slot = own_queue())) {
+    __sync_fetch_and_add(&slot->queued, delta);
+  }
+#else
+  (void)delta;
+#endif
+}
+
+static int append(strbuf_t *out, const char *format, ...) {
+  char line[512];
+  va_list args;
+  int len = 0;
+
+  va_start(args, format);
+  len = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+
+  if (len < 0 || (size_t)len >= sizeof(line)) {
+    return -1;
+  }
+
+  return strbuf_append_n(out, line, (size_t)len);
+}
+
+/**
+ * Copies `value` into `dest` as a label value, escaped.
+ */
+
+static void escape(char *dest, size_t size, const char *value) {
+  size_t n = 0;
+
+  for (; *value && n + 2 < size; value++) {
+    if ('"' == *value || '\\' == *value) {
+      dest[n++] = '\\';
+      dest[n++] = *value;
+    } else if ('\n' == *value) {
+      dest[n++] = '\\';
+      dest[n++] = 'n';
+    } else {
+      dest[n++] = *value;
+    }
+  }
+
+  dest[n] = '\0';
+}
+
+static int render_counters(strbuf_t *out) {
+  int rc = 0;
+
+  for (int i = 0; 0 == rc && i < CLIB_METRICS_COUNTERS; i++) {
+    uint64_t value = __sync_fetch_and_add(&metrics->counters[i], 0);
+
+    if (counters[i].help) {
+      rc = append(out, "# HELP %s %s\n# TYPE %s %s\n", counters[i].name,
+                  counters[i].help, counters[i].name, counters[i].type);
+    }
+
+    if (0 == rc) {
+      rc = append(out, "%s%s%s%s %llu\n", counters[i].name,
+                  counters[i].labels ? "{" : "",
+                  counters[i].labels ? counters[i].labels : "",
+                  counters[i].labels ? "}" : "", (unsigned long long)value);
+    }
+  }
+
+  return rc;
+}
+
+static int render_hosts(strbuf_t *out) {
+  int rc = append(out, "# HELP clib_http_latency_seconds Time until a "
+                       "response started to arrive, by host\n"
+                       "# TYPE clib_http_latency_seconds histogram\n");
+
+  for (int i = 0; 0 == rc && i < HOSTS; i++) {
+    host_t *host = &metrics->hosts[i];
+    uint64_t buckets[BUCKETS] = {0};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    char name[2 * NAME_SIZE];
+    int seen = 0;
+
+    if (!is_ready(&host->state)) {
+      continue;
+    }
+
+    for (int j = 0; !seen && j < i; j++) {
+      seen = is_ready(&metrics->hosts[j].state) &&
+             0 == strcmp(metrics->hosts[j].name, host->name);
+    }
+
+    if (seen) {
+      continue;
+    }
+
+    for (int j = i; j < HOSTS; j++) {
+      host_t *same = &metrics->hosts[j];
+
+      if (!is_ready(&same->state) || 0 != strcmp(same->name, host->name)) {
+        continue;
+      }
+
+      for (size_t b = 0; b < BUCKETS; b++) {
+        buckets[b] += __sync_fetch_and_add(&same->buckets[b], 0);
+      }
+
+      sum += __sync_fetch_and_add(&same->sum, 0);
+    }
+
+    escape(name, sizeof(name), host->name);
+
+    for (size_t b = 0; 0 == rc && b < BUCKETS; b++) {
+      count += buckets[b];
+
+      if (b < BUCKETS - 1) {
+        rc = append(out,
+                    "clib_http_latency_seconds_bucket{host=\"%s\",le=\"%g\"} "
+                    "%llu\n",
+                    name, bounds[b] / 1e6, (unsigned long long)count);
+      } else {
+        rc = append(out,
+                    "clib_http_latency_seconds_bucket{host=\"%s\",le=\"+Inf\"}"
+                    " %llu\n",
+                    name, (unsigned long long)count);
+      }
+    }
+
+    if (0 == rc) {
+      rc = append(out,
+                  "clib_http_latency_seconds_sum{host=\"%s\"} %.6f\n"
+                  "clib_http_latency_seconds_count{host=\"%s\"} %llu\n",
+                  name, sum / 1e6, name, (unsigned long long)count);
+    }
+  }
+
+  return rc;
+}
+
+static int render_phases(strbuf_t *out) {
+  int rc = append(out, "# HELP clib_phase_seconds Time packages took to "
+                       "fetch, configure and build\n"
+                       "# TYPE clib_phase_seconds summary\n");
+
+  for (int i = 0; 0 == rc && i < PHASES; i++) {
+    phase_t *slot = &metrics->phases[i];
+    char phase[2 * PHASE_SIZE];
+    char name[2 * NAME_SIZE];
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    int seen = 0;
+
+    if (!is_ready(&slot->state)) {
+      continue;
+    }
+
+    for (int j = 0; !seen && j < i; j++) {
+      phase_t *other = &metrics->phases[j];
+      seen = is_ready(&other->state) && 0 == strcmp(other->name, slot->name) &&
+             0 == strcmp(other->phase, slot->phase);
+    }
+
+    if (seen) {
+      continue;
+    }
+
+    for (int j = i; j < PHASES; j++) {
+      phase_t *same = &metrics->phases[j];
+
+      if (is_ready(&same->state) && 0 == strcmp(same->name, slot->name) &&
+          0 == strcmp(same->phase, slot->phase)) {
+        count += __sync_fetch_and_add(&same->count, 0);
+        sum += __sync_fetch_and_add(&same->sum, 0);
+      }
+    }
+
+    escape(phase, sizeof(phase), slot->phase);
+    escape(name, sizeof(name), slot->name);
+    rc = append(out,
+                "clib_phase_seconds_sum{phase=\"%s\",package=\"%s\"} %.6f\n"
+                "clib_phase_seconds_count{phase=\"%s\",package=\"%s\"} "
+                "%llu\n",
+                phase, name, sum / 1e6, phase, name,
+                (unsigned long long)count);
+  }
+
+  return rc;
+}
+
+static int render_queues(strbuf_t *out) {
+  long long queued = 0;
+
+#ifndef _WIN32
+  for (int i = 0; i < QUEUES; i++) {
+    queue_t *slot = &metrics->queues[i];
+    int pid = slot->pid;
+
+    if (0 != pid && !is_gone(pid)) {
+      queued += __sync_fetch_and_add(&slot->queued, 0);
+    }
+  }
+#endif
+
+  return append(out,
+                "# HELP clib_pool_queued_tasks Tasks waiting for a worker\n"
+                "# TYPE clib_pool_queued_tasks gauge\n"
+                "clib_pool_queued_tasks %lld\n",
+                queued > 0 ? queued : 0);
+}
+
+int clib_metrics_render(strbuf_t *out) {
+  if (!metrics || !out) {
+    return -1;
+  }
+
+  if (0 != render_counters(out) || 0 != render_hosts(out) ||
+      0 != render_phases(out) || 0 != render_queues(out)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int clib_metrics_write(const char *path) {
+  strbuf_t text = STRBUF_INIT;
+  char *tmp = NULL;
+  FILE *file = NULL;
+  int rc = -1;
+
+  if (!path || 0 != clib_metrics_render(&text) ||
+      !(tmp = malloc(strlen(path) + 5))) {
+    goto cleanup;
+  }
+
+  // the collector never reads half of it
+  sprintf(tmp, "%s.tmp", path);
+
+  if (!(file = fopen(tmp, "w"))) {
+    goto cleanup;
+  }
+
+  if (text.len != fwrite(text.data, 1, text.len, file) || 0 != fclose(file)) {
+    file = NULL;
+    remove(tmp);
+    goto cleanup;
+  }
+
+  file = NULL;
+
+  if (0 != rename(tmp, path)) {
+    remove(tmp);
+    goto cleanup;
+  }
+
+  rc = 0;
+
+cleanup:
+  if (file) {
+    fclose(file);
+    remove(tmp);
+  }
+  free(tmp);
+  strbuf_free(&text);
+  return rc;
+}
+
+int clib_metrics_listen(const char *address) {
+#ifdef _WIN32
+  (void)address;
+  return -1;
+#else
+  struct addrinfo hints;
+  struct addrinfo *found = NULL;
+  const char *colon = address ? strrchr(address, ':') : NULL;
+  const char *port = colon ? colon + 1 : address;
+  char host[256] = "127.0.0.1";
+  int one = 1;
+  int fd = -1;
+
+  if (!address || !*port) {
+    return -1;
+  }
+
+  if (colon) {
+    size_t len = colon - address;
+
+    // "[::1]:9100"
+    if (len >= 2 && '[' == address[0] && ']' == address[len - 1]) {
+      address++;
+      len -= 2;
+    }
+
+    if (len >= sizeof(host)) {
+      return -1;
+    }
+
+    memcpy(host, address, len);
+    host[len] = '\0';
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  // an empty host, as in ":9100", is every interface
+  if (0 != getaddrinfo(*host ? host : NULL, port, &hints, &found)) {
+    return -1;
+  }
+
+  if (-1 == (fd = socket(found->ai_family, found->ai_socktype,
+                         found->ai_protocol)) ||
+      0 != setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+      0 != bind(fd, found->ai_addr, found->ai_addrlen) ||
+      0 != listen(fd, SOMAXCONN)) {
+    if (-1 != fd) {
+      close(fd);
+    }
+    fd = -1;
+  }
+
+  freeaddrinfo(found);
+  return fd;
+#endif
+}
+
+void clib_metrics_answer(int fd) {
+#ifndef _WIN32
+  static const char *not_found = "HTTP/1.0 404 Not Found\r\n"
+                                 "Content-Length: 0\r\n"
+                                 "Connection: close\r\n\r\n";
+  struct timeval timeout = {SCRAPE_TIMEOUT, 0};
+  strbuf_t reply = STRBUF_INIT;
+  strbuf_t text = STRBUF_INIT;
+  char request[MAX_SCRAPE];
+  size_t received = 0;
+  const char *p = NULL;
+  size_t left = 0;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  // only the request line matters, the headers are read to be polite
+  while (received < sizeof(request) - 1) {
+    ssize_t n = recv(fd, request + received, sizeof(request) - 1 - received,
+                     0);
+
+    if (-1 == n && EINTR == errno) {
+      continue;
+    }
+
+    if (n <= 0) {
+      break;
+    }
+
+    received += n;
+    request[received] = '\0';
+
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+      break;
+    }
+  }
+
+  request[received] = '\0';
+
+  if ((0 == strncmp(request, "GET /metrics ", 13) ||
+       0 == strncmp(request, "GET /metrics?", 13)) &&
+      0 == clib_metrics_render(&text) &&
+      0 == append(&reply,
+                  "HTTP/1.0 200 OK\r\n"
+                  "Content-Type: text/plain; version=0.0.4\r\n"
+                  "Content-Length: %zu\r\n"
+                  "Connection: close\r\n\r\n",
+                  text.len) &&
+      0 == strbuf_append_n(&reply, text.data, text.len)) {
+    p = reply.data;
+    left = reply.len;
+  } else {
+    p = not_found;
+    left = strlen(not_found);
+  }
+
+  while (left > 0) {
+    ssize_t sent = send(fd, p, left, MSG_NOSIGNAL);
+
+    if (-1 == sent && EINTR == errno) {
+      continue;
+    }
+
+    if (sent <= 0) {
+      break;
+    }
+
+    p += sent;
+    left -= sent;
+  }
+
+  strbuf_free(&text);
+  strbuf_free(&reply);
+  close(fd);
+#else
+  (void)fd;
+#endif
+}
@@ -0,0 +1,101 @@
+//
+// clib-metrics.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_METRICS_H
+#define CLIB_METRICS_H 1
+
+#include "strbuf/strbuf.h"
+#include <stdint.h>
+
+// where the daemon answers scrapes of its metrics, "[host:]port", on
+// loopback when there's no host
+#define CLIB_METRICS_ADDR_ENV "CLIB_METRICS_ADDR"
+
+// the file `clib build --watch` writes its metrics to after each build,
+// for the textfile collector of the node exporter to pick up
+#define CLIB_METRICS_FILE_ENV "CLIB_METRICS_FILE"
+
+/**
+ * Counters, in the order they are exported, those of a metric together
+ */
+typedef enum {
+  CLIB_METRICS_MANIFEST_HITS,
+  CLIB_METRICS_PACKAGE_HITS,
+  CLIB_METRICS_MANIFEST_MISSES,
+  CLIB_METRICS_PACKAGE_MISSES,
+  CLIB_METRICS_MANIFEST_FAILURES,
+  CLIB_METRICS_HTTP_REQUESTS,
+  CLIB_METRICS_HTTP_RETRIES,
+  CLIB_METRICS_WIRE_BYTES,
+  CLIB_METRICS_BODY_BYTES,
+  CLIB_METRICS_COMMANDS,
+  CLIB_METRICS_COUNTERS
+} clib_metrics_counter_t;
+
+/**
+ * Starts keeping metrics, in memory shared with the processes forked
+ * from then on, such as the commands the daemon runs. Until then, and in
+ * processes that don't, counting costs a branch.
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_metrics_init(void);
+
+/**
+ * Adds `n` to `counter`.
+ */
+void clib_metrics_count(clib_metrics_counter_t counter, uint64_t n);
+
+/**
+ * Counts a response from the host of `url` that started to arrive `us`
+ * microseconds after it was asked for, in a histogram of that host. The
+ * first hosts seen are kept, those beyond them aren't.
+ */
+void clib_metrics_observe_http(const char *url, uint64_t us);
+
+/**
+ * Counts that `phase` ("fetch", "configure", "build") took `us`
+ * microseconds for the package `name`, the first packages seen being
+ * kept as for hosts.
+ */
+void clib_metrics_observe_phase(const char *phase, const char *name,
+                                uint64_t us);
+
+/**
+ * Adds `delta` to the tasks the worker pools of this process have queued.
+ * Those of processes that went away don't count.
+ */
+void clib_metrics_queue(int delta);
+
+/**
+ * Appends the metrics in the Prometheus text format to `out`.
+ *
+ * @return 0 on success, -1 when there are none or on error
+ */
+int clib_metrics_render(strbuf_t *out);
+
+/**
+ * Replaces the file `path` with the metrics, all at once.
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_metrics_write(const char *path);
+
+/**
+ * Listens for scrapes on `address`, "[host:]port".
+ *
+ * @return The socket, or -1 on error
+ */
+int clib_metrics_listen(const char *address);
+
+/**
+ * Answers the HTTP request on the connection `fd` with the metrics when
+ * it's a GET of /metrics, closing it after.
+ */
+void clib_metrics_answer(int fd);
+
+#endif
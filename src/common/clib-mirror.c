@@ -0,0 +1,391 @@
+//
+// clib-mirror.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-mirror.h"
+#include "clib-cache.h"
+#include "clib-ratelimit.h"
+#include "fs/fs.h"
+#include "path-join/path-join.h"
+#include "strdup/strdup.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#define GITHUB_CONTENT_HOST "raw.githubusercontent.com/"
+
+// consecutive failures before a mirror is skipped, and for how long
+#define CLIB_MIRROR_MAX_FAILURES 3
+#define CLIB_MIRROR_COOLDOWN 60
+
+#define CLIB_MIRROR_POLL_INTERVAL 100
+
+typedef struct {
+  char *url;
+  int failures;
+  time_t down_until;
+} clib_mirror_t;
+
+static clib_mirror_t *mirrors = NULL;
+static int mirrors_count = 0;
+static int initialized = 0;
+static int only = 0;
+static long budget = CLIB_MIRROR_DEFAULT_BUDGET;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK() pthread_mutex_lock(&mutex)
+#define UNLOCK() pthread_mutex_unlock(&mutex)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+static void add_mirror(const char *start, size_t len) {
+  clib_mirror_t *list = NULL;
+  char *url = NULL;
+
+  // `url` is joined with a path that starts after a '/'
+  while (len > 0 && '/' == start[len - 1]) {
+    len--;
+  }
+
+  if (0 == len || !(url = malloc(len + 1))) {
+    return;
+  }
+
+  memcpy(url, start, len);
+  url[len] = 0;
+
+  if (!(list = realloc(mirrors, (mirrors_count + 1) * sizeof(clib_mirror_t)))) {
+    free(url);
+    return;
+  }
+
+  mirrors = list;
+  memset(&mirrors[mirrors_count], 0, sizeof(clib_mirror_t));
+  mirrors[mirrors_count++].url = url;
+}
+
+/**
+ * Adds every mirror in `list`, skipping `#` comments to the end of line.
+ */
+
+static void parse_mirrors(const char *list) {
+  const char *p = list;
+
+  while (*p) {
+    if ('#' == *p) {
+      while (*p && '\n' != *p) {
+        p++;
+      }
+      continue;
+    }
+
+    if (strchr(", \t\r\n", *p)) {
+      p++;
+      continue;
+    }
+
+    const char *start = p;
+    while (*p && !strchr(", \t\r\n#", *p)) {
+      p++;
+    }
+
+    add_mirror(start, p - start);
+  }
+}
+
+int clib_mirror_init(void) {
+  char *config = NULL;
+  char *content = NULL;
+  const char *env = NULL;
+
+  LOCK();
+  if (initialized) {
+    UNLOCK();
+    return mirrors_count;
+  }
+
+  initialized = 1;
+
+  if ((env = getenv("CLIB_MIRROR_BUDGET")) && atol(env) > 0) {
+    budget = atol(env);
+  }
+
+  if ((env = getenv("CLIB_MIRRORS_ONLY")) && *env && 0 != strcmp(env, "0")) {
+    only = 1;
+  }
+
+  if ((env = getenv("CLIB_MIRRORS"))) {
+    parse_mirrors(env);
+  } else if (0 == clib_cache_meta_init() &&
+             (config = path_join(clib_cache_meta_dir(), "mirrors"))) {
+    if (0 == fs_exists(config) && (content = fs_read(config))) {
+      parse_mirrors(content);
+      free(content);
+    }
+    free(config);
+  }
+
+  UNLOCK();
+  return mirrors_count;
+}
+
+int clib_mirror_count(void) { return clib_mirror_init(); }
+
+int clib_mirror_only(void) { return clib_mirror_init() > 0 && only; }
+
+char *clib_mirror_url(const char *url, int index) {
+  const char *path = NULL;
+  char *res = NULL;
+
+  if (!url || index < 0 || index >= clib_mirror_count()) {
+    return NULL;
+  }
+
+  // the host may be preceded by an access token, which mirrors don't get
+  if (0 != strncmp(url, "https://", 8) ||
+      !(path = strstr(url, GITHUB_CONTENT_HOST))) {
+    return NULL;
+  }
+
+  if ((path - url) > 8 && '@' != path[-1]) {
+    return NULL;
+  }
+
+  path += strlen(GITHUB_CONTENT_HOST);
+
+  if ((res = malloc(strlen(mirrors[index].url) + strlen(path) + 2))) {
+    sprintf(res, "%s/%s", mirrors[index].url, path);
+  }
+
+  return res;
+}
+
+int clib_mirror_next(int index) {
+  time_t now = time(NULL);
+  int count = clib_mirror_count();
+  int next = -1;
+
+  LOCK();
+  for (int i = index < 0 ? 0 : index + 1; i < count; i++) {
+    if (mirrors[i].down_until <= now) {
+      next = i;
+      break;
+    }
+  }
+  UNLOCK();
+
+  return next;
+}
+
+void clib_mirror_report(int index, int ok) {
+  if (index < 0 || index >= clib_mirror_count()) {
+    return;
+  }
+
+  LOCK();
+  if (ok) {
+    mirrors[index].failures = 0;
+    mirrors[index].down_until = 0;
+  } else if (++mirrors[index].failures >= CLIB_MIRROR_MAX_FAILURES) {
+    mirrors[index].failures = 0;
+    mirrors[index].down_until = time(NULL) + CLIB_MIRROR_COOLDOWN;
+  }
+  UNLOCK();
+}
+
+static long now_ms(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000L + tv.tv_usec / 1000L;
+}
+
+http_get_response_t *clib_mirror_get(const char *url, CURLSH *share,
+                                     const char *etag,
+                                     const char *last_modified) {
+  http_get_response_t *winner = NULL;
+  http_get_transfer_t **transfers = NULL;
+  char **urls = NULL;
+  int *indexes = NULL;
+  CURLM *multi = NULL;
+  int count = 0;
+  int started = 0;
+  int active = 0;
+  long deadline = 0;
+
+  if (0 == clib_mirror_count() ||
+      !(urls = calloc(mirrors_count + 1, sizeof(char *)))) {
+    return http_get_conditional_shared(url, share, etag, last_modified);
+  }
+
+  indexes = calloc(mirrors_count + 1, sizeof(int));
+  transfers = calloc(mirrors_count + 1, sizeof(http_get_transfer_t *));
+
+  if (!indexes || !transfers || !(multi = curl_multi_init())) {
+    goto fallback;
+  }
+
+  for (int i = clib_mirror_next(-1); -1 != i; i = clib_mirror_next(i)) {
+    if ((urls[count] = clib_mirror_url(url, i))) {
+      indexes[count++] = i;
+    }
+  }
+
+  if (0 == count) {
+    if (only) {
+      goto cleanup;
+    }
+    goto fallback;
+  }
+
+  // the origin is the last resort
+  if (!only) {
+    urls[count] = strdup(url);
+    indexes[count++] = -1;
+  }
+
+  while (!winner) {
+    // start the next candidate when nothing is running or the running
+    // ones are over budget
+    if (started < count && (0 == active || now_ms() >= deadline)) {
+      http_get_transfer_t *transfer =
+          http_get_transfer_new(urls[started], share, etag, last_modified);
+
+      if (transfer) {
+        clib_ratelimit_acquire(urls[started]);
+      }
+
+      if (transfer && CURLM_OK == curl_multi_add_handle(multi, transfer->req)) {
+        transfers[started] = transfer;
+        (void)active++;
+      } else {
+        if (transfer) {
+          clib_ratelimit_release(urls[started], 0, 0);
+        }
+        http_get_transfer_free(transfer);
+        clib_mirror_report(indexes[started], 0);
+      }
+
+      (void)started++;
+      deadline = now_ms() + budget;
+      continue;
+    }
+
+    if (0 == active) {
+      break;
+    }
+
+    int running = 0;
+    CURLMsg *msg = NULL;
+    int left = 0;
+
+    if (CURLM_OK != curl_multi_perform(multi, &running)) {
+      break;
+    }
+
+    while (!winner && (msg = curl_multi_info_read(multi, &left))) {
+      http_get_response_t *res = NULL;
+      int i = 0;
+
+      if (CURLMSG_DONE != msg->msg) {
+        continue;
+      }
+
+      for (i = 0; i < started; i++) {
+        if (transfers[i] && transfers[i]->req == msg->easy_handle) {
+          break;
+        }
+      }
+
+      if (i == started) {
+        continue;
+      }
+
+      curl_multi_remove_handle(multi, msg->easy_handle);
+      res = http_get_transfer_finish(transfers[i], msg->data.result);
+      transfers[i] = NULL;
+      (void)active--;
+      clib_ratelimit_release(urls[i], res ? res->status : 0,
+                             res ? res->retry_after : 0);
+
+      if (res && (res->ok || 304 == res->status)) {
+        clib_mirror_report(indexes[i], 1);
+        winner = res;
+      } else {
+        clib_mirror_report(indexes[i], 0);
+        http_get_free(res);
+      }
+    }
+
+    if (!winner && running > 0) {
+      long timeout = deadline - now_ms();
+      if (started >= count || timeout > CLIB_MIRROR_POLL_INTERVAL) {
+        timeout = CLIB_MIRROR_POLL_INTERVAL;
+      }
+      if (timeout > 0) {
+#if LIBCURL_VERSION_NUM >= 0x074200
+        curl_multi_poll(multi, NULL, 0, (int)timeout, NULL);
+#else
+        curl_multi_wait(multi, NULL, 0, (int)timeout, NULL);
+#endif
+      }
+    }
+  }
+
+  goto cleanup;
+
+fallback:
+  winner = http_get_conditional_shared(url, share, etag, last_modified);
+
+cleanup:
+  for (int i = 0; i < count; i++) {
+    if (transfers && transfers[i]) {
+      curl_multi_remove_handle(multi, transfers[i]->req);
+      http_get_transfer_free(transfers[i]);
+      clib_ratelimit_release(urls[i], 0, 0);
+    }
+    free(urls[i]);
+  }
+
+  if (multi) {
+    curl_multi_cleanup(multi);
+  }
+
+  free(urls);
+  free(indexes);
+  free(transfers);
+
+  if (!winner) {
+    // callers expect a response object to inspect
+    if ((winner = malloc(sizeof(http_get_response_t)))) {
+      memset(winner, 0, sizeof(http_get_response_t));
+      // of all the candidates that failed, none says why
+      winner->code = -1;
+    }
+  }
+
+  return winner;
+}
+
+void clib_mirror_cleanup(void) {
+  LOCK();
+  for (int i = 0; i < mirrors_count; i++) {
+    free(mirrors[i].url);
+  }
+  free(mirrors);
+  mirrors = NULL;
+  mirrors_count = 0;
+  initialized = 0;
+  only = 0;
+  UNLOCK();
+}
@@ -0,0 +1,80 @@
+//
+// clib-mirror.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_MIRROR_H
+#define CLIB_MIRROR_H 1
+
+#include "http-get/http-get.h"
+#include <curl/curl.h>
+
+/**
+ * Mirrors serve the same tree as raw.githubusercontent.com, so
+ * `https://raw.githubusercontent.com/<author>/<name>/<version>/<file>`
+ * is fetched as `<mirror>/<author>/<name>/<version>/<file>`.
+ *
+ * They are read, in order, from the comma or whitespace separated
+ * `CLIB_MIRRORS` environment variable, or else from one URL per line in
+ * `~/.cache/clib/meta/mirrors`. `CLIB_MIRROR_BUDGET` sets how many
+ * milliseconds a request may take before the next candidate is raced
+ * against it. With `CLIB_MIRRORS_ONLY` set, the origin is never asked,
+ * for machines without access to it and for replaying recorded fixtures.
+ */
+
+#define CLIB_MIRROR_DEFAULT_BUDGET 2000
+
+/**
+ * Loads the mirror configuration, later calls are no-ops.
+ *
+ * @return Number of configured mirrors
+ */
+int clib_mirror_init(void);
+
+/**
+ * @return Number of configured mirrors
+ */
+int clib_mirror_count(void);
+
+/**
+ * @return 1 when there are mirrors and the origin is not to be asked
+ */
+int clib_mirror_only(void);
+
+/**
+ * Rewrites a raw GitHub content `url` for the mirror at `index`.
+ *
+ * @return The mirror URL, or NULL if `url` can't be served by mirrors or
+ * `index` is out of range
+ */
+char *clib_mirror_url(const char *url, int index);
+
+/**
+ * @return Index of the first healthy mirror after `index` (pass -1 to
+ * start), or -1 when only the origin is left
+ */
+int clib_mirror_next(int index);
+
+/**
+ * Records the outcome of a request to the mirror at `index`. Mirrors
+ * that keep failing are skipped for a while.
+ */
+void clib_mirror_report(int index, int ok);
+
+/**
+ * Fetches `url` from the healthy mirrors in order with the origin as the
+ * last resort, unless `clib_mirror_only()`. A candidate that exceeds the latency budget is raced
+ * against the next one and the first usable answer wins. `etag` and
+ * `last_modified` make the request conditional and may be NULL.
+ *
+ * @return The response, with `ok` set or a 304 status on success
+ */
+http_get_response_t *clib_mirror_get(const char *url, CURLSH *share,
+                                     const char *etag,
+                                     const char *last_modified);
+
+void clib_mirror_cleanup(void);
+
+#endif
@@ -0,0 +1,81 @@
+//
+// clib-mkdir.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-mkdir.h"
+#include "hash/concurrent-hash.h"
+#include "mkdirp/mkdirp.h"
+#include <stdlib.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+static concurrent_hash_t *known = NULL;
+static int cleaned_up = 0;
+
+#ifdef HAVE_PTHREADS
+static pthread_once_t known_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void init_known(void) { known = concurrent_hash_new(); }
+
+/**
+ * @return The directories made so far, or NULL if they aren't remembered
+ */
+
+static concurrent_hash_t *known_dirs(void) {
+  if (cleaned_up) {
+    return NULL;
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_once(&known_once, init_known);
+#else
+  if (!known) {
+    init_known();
+  }
+#endif
+
+  return known;
+}
+
+int clib_mkdirp(const char *path, mode_t mode) {
+  concurrent_hash_t *dirs = known_dirs();
+
+  if (!path) {
+    return -1;
+  }
+
+  if (dirs && concurrent_hash_get(dirs, path)) {
+    return 0;
+  }
+
+  if (0 != mkdirp(path, mode)) {
+    return -1;
+  }
+
+  // failing to remember it only costs another mkdir()
+  if (dirs) {
+    concurrent_hash_set(dirs, path, (void *)1);
+  }
+
+  return 0;
+}
+
+void clib_mkdirp_forget(void) {
+  concurrent_hash_t *dirs = known_dirs();
+
+  if (dirs) {
+    concurrent_hash_clear(dirs);
+  }
+}
+
+void clib_mkdirp_cleanup(void) {
+  cleaned_up = 1;
+  concurrent_hash_free(known);
+  known = NULL;
+}
@@ -0,0 +1,38 @@
+//
+// clib-mkdir.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_MKDIR_H
+#define CLIB_MKDIR_H 1
+
+#include <sys/types.h>
+
+/**
+ * Directories made or found by `clib_mkdirp()` are remembered for the
+ * whole process, so installing many packages into the same places costs
+ * a lookup rather than a `mkdir()` for each. Safe to use from several
+ * threads.
+ */
+
+/**
+ * Like `mkdirp()`, but does nothing for a `path` it made before.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_mkdirp(const char *path, mode_t mode);
+
+/**
+ * Forgets every directory made so far. Anything that removes or moves
+ * directories must call it, lest `clib_mkdirp()` skip making them again.
+ */
+void clib_mkdirp_forget(void);
+
+/**
+ * Releases what `clib_mkdirp()` remembers, which is then not used anymore.
+ */
+void clib_mkdirp_cleanup(void);
+
+#endif
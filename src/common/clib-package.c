@@ -10,16 +10,36 @@
 #endif
 
 #include "asprintf/asprintf.h"
+#include "clib-archive.h"
+#include "clib-arena.h"
 #include "clib-cache.h"
+#include "clib-dag.h"
+#include "clib-download.h"
+#include "clib-git.h"
+#include "clib-github.h"
+#include "clib-hash.h"
+#include "clib-intern.h"
+#include "clib-link.h"
+#include "clib-lockfile.h"
+#include "clib-manifest.h"
+#include "clib-metrics.h"
+#include "clib-mirror.h"
+#include "clib-mkdir.h"
 #include "clib-package.h"
+#include "clib-pool.h"
+#include "clib-retry.h"
+#include "clib-session.h"
+#include "clib-spawn.h"
+#include "clib-timings.h"
+#include "clib-trace.h"
+#include "copy/copy.h"
 #include "debug/debug.h"
 #include "fs/fs.h"
+#include "hash/concurrent-hash.h"
 #include "hash/hash.h"
 #include "http-get/http-get.h"
 #include "logger/logger.h"
-#include "mkdirp/mkdirp.h"
 #include "parse-repo/parse-repo.h"
-#include "parson/parson.h"
 #include "path-join/path-join.h"
 #include "strdup/strdup.h"
 #include "substr/substr.h"
@@ -27,10 +47,13 @@
 #include <curl/curl.h>
 #include <libgen.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 
 #ifdef HAVE_PTHREADS
 #include <pthread.h>
@@ -46,45 +69,169 @@
 
 #define GITHUB_CONTENT_URL "https://raw.githubusercontent.com/"
 #define GITHUB_CONTENT_URL_WITH_TOKEN "https://%s@raw.githubusercontent.com/"
+#define GITHUB_ARCHIVE_URL "https://github.com/%s/%s/archive/%s.tar.gz"
+#define GITHUB_GIT_URL "https://github.com/%s/%s.git"
+
+// where prebuilt binaries go without a prefix, as `make install` would
+#define CLIB_PACKAGE_BINARY_PREFIX "/usr/local"
+
+// packages with this many sources are fetched from the repository tarball
+#define CLIB_PACKAGE_ARCHIVE_MIN_FILES 8
+
+// tarball bytes a saved request is worth, larger tarballs are given up on
+#define CLIB_PACKAGE_ARCHIVE_REQUEST_COST (64 * 1024)
 
 #if defined(_WIN32) || defined(WIN32) || defined(__MINGW32__) ||               \
     defined(__MINGW64__)
-#define setenv(k, v, _) _putenv_s(k, v)
 #define realpath(a, b) _fullpath(a, b, strlen(a))
 #endif
 
-static hash_t *visited_packages = 0;
+static hash_t *prefetched_manifests = 0;
+static clib_download_t *downloads = 0;
+static clib_pool_t *pool = 0;
+// downloaded packages being saved to the cache behind the installs
+static clib_pool_t *save_pool = 0;
+static clib_pool_group_t *saves = 0;
+static clib_lockfile_t *lockfile = 0;
+static int lockfile_frozen = 0;
+
+typedef struct prefetched_manifest prefetched_manifest_t;
+struct prefetched_manifest {
+  char *url;
+  http_get_response_t *res;
+};
 
 #ifdef HAVE_PTHREADS
-typedef struct fetch_package_file_thread_data fetch_package_file_thread_data_t;
-struct fetch_package_file_thread_data {
+// an expired manifest revalidated in the background while it is used
+typedef struct manifest_refresh manifest_refresh_t;
+struct manifest_refresh {
+  pthread_t thread;
+  char *author;
+  char *name;
+  char *version;
+  char *url;
+  int lock; // of the cache entry, for clib_cache_end_refresh()
+  manifest_refresh_t *next;
+};
+
+// joined by clib_package_cleanup()
+static manifest_refresh_t *manifest_refreshes = 0;
+#endif
+
+typedef struct fetch_package_file_data fetch_package_file_data_t;
+struct fetch_package_file_data {
   clib_package_t *pkg;
-  const char *dir;
   char *file;
+  char *origin; // URL on GitHub, used when no mirror can serve the file
+  int mirror;   // index of the mirror in use, -1 for the origin
   int verbose;
-  pthread_t thread;
-  pthread_attr_t attr;
-  void *data;
+  int *failures;
+  char *path; // of a synced file, see sync_package_file()
+  char *hash; // of its content before the sync, NULL if there was none
+  char *etag; // it was served with when the content was installed
 };
 
+// package versions are spread over this many cache locks, so threads
+// working on different packages rarely wait for each other
+#define CLIB_PACKAGE_LOCK_STRIPES 16
+
+static concurrent_hash_t *visited_packages = 0;
+
+// the packages resolved so far by canonical slug, each holding a reference
+static concurrent_hash_t *resolved_packages = 0;
+
+static clib_package_stats_t totals;
+
+// the totals and HTTP counters as last added to the metrics
+static clib_package_stats_t published;
+static http_get_stats_t published_http;
+
+// the packages the progress reports count, see report_progress()
+static struct {
+  unsigned long long packages;
+  unsigned long long done;
+} progress;
+
+// what the installs with the `plan` option would have done
+static clib_package_plan_t *plans = 0;
+static size_t plans_count = 0;
+static size_t plans_size = 0;
+
+#ifdef __GNUC__
+#define COUNT(counter, n) __sync_fetch_and_add(&(counter), (n))
+#else
+#define COUNT(counter, n) ((counter) += (n))
+#endif
+
+#define COUNT_SINCE(counter, start) COUNT(counter, clib_trace_clock() - (start))
+
+#ifdef HAVE_PTHREADS
 typedef struct clib_package_lock clib_package_lock_t;
 struct clib_package_lock {
-  pthread_mutex_t mutex;
+  pthread_mutex_t init;       // lazily created shared state and options
+  pthread_mutex_t output;     // keeps log lines whole
+  pthread_mutex_t prefetched; // prefetched_manifests
+  pthread_mutex_t refreshes;  // manifest_refreshes
+  pthread_mutex_t plans;      // plans
+  pthread_mutex_t cache[CLIB_PACKAGE_LOCK_STRIPES];
 };
 
-static clib_package_lock_t lock = {PTHREAD_MUTEX_INITIALIZER};
+static clib_package_lock_t lock = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER};
+static pthread_once_t lock_stripes_once = PTHREAD_ONCE_INIT;
 
+static void init_lock_stripes(void) {
+  for (int i = 0; i < CLIB_PACKAGE_LOCK_STRIPES; i++) {
+    pthread_mutex_init(&lock.cache[i], NULL);
+  }
+}
 #endif
 
 CURLSH *clib_package_curl_share;
-debug_t _debugger;
 
-#define _debug(...)                                                            \
-  ({                                                                           \
-    if (!(_debugger.name))                                                     \
-      debug_init(&_debugger, "clib-package");                                  \
-    debug(&_debugger, __VA_ARGS__);                                            \
-  })
+// traces above this level are compiled out: the ones for every file only
+// make it into `make DEBUG=...` builds
+#ifndef CLIB_PACKAGE_DEBUG_LEVEL
+#ifdef CLIB_DEBUG
+#define CLIB_PACKAGE_DEBUG_LEVEL 2
+#else
+#define CLIB_PACKAGE_DEBUG_LEVEL 1
+#endif
+#endif
+
+static debug_t _debugger;
+#ifdef HAVE_PTHREADS
+static pthread_once_t debugger_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void init_debugger(void) { debug_init(&_debugger, "clib-package"); }
+
+/**
+ * Whether `DEBUG` names clib-package, matched once for all threads.
+ */
+
+static int debugger_enabled(void) {
+#ifdef HAVE_PTHREADS
+  pthread_once(&debugger_once, init_debugger);
+#else
+  if (!_debugger.name) {
+    init_debugger();
+  }
+#endif
+  return _debugger.enabled;
+}
+
+// the arguments are only evaluated when the trace is printed
+#define _debug_at(level, ...)                                                  \
+  do {                                                                         \
+    if ((level) <= CLIB_PACKAGE_DEBUG_LEVEL && debugger_enabled())             \
+      debug(&_debugger, __VA_ARGS__);                                          \
+  } while (0)
+
+#define _debug(...) _debug_at(1, __VA_ARGS__)
+#define _debug_file(...) _debug_at(2, __VA_ARGS__)
 
 static const char *manifest_names[] = {"clib.json", "package.json", NULL};
 
@@ -95,35 +242,50 @@ static const char *manifest_names[] = {"clib.json", "package.json", NULL};
       goto cleanup;                                                            \
   });
 
-static clib_package_opts_t opts = {
 #ifdef HAVE_PTHREADS
-    .concurrency = 4,
+#define DEFAULT_CONCURRENCY 4
+#else
+#define DEFAULT_CONCURRENCY 0
 #endif
-    .skip_cache = 1,
-    .prefix = 0,
-    .global = 0,
-    .force = 0,
-    .token = 0,
-};
+
+// what a process starts out with, and `clib_package_reset()` goes back to
+#define DEFAULT_OPTS                                                           \
+  {                                                                            \
+    .concurrency = DEFAULT_CONCURRENCY, .skip_cache = 1, .prefix = 0,          \
+    .global = 0, .force = 0, .token = 0, .retries = 3, .retry_delay = 500,     \
+    .connect_timeout = CLIB_PACKAGE_CONNECT_TIMEOUT, .timeout = 0,             \
+    .low_speed_limit = CLIB_PACKAGE_LOW_SPEED_LIMIT,                           \
+    .low_speed_time = CLIB_PACKAGE_LOW_SPEED_TIME,                             \
+    .min_downloads = CLIB_PACKAGE_MIN_DOWNLOADS,                               \
+    .max_downloads = CLIB_PACKAGE_MAX_DOWNLOADS,                               \
+    .memory_budget = CLIB_PACKAGE_MEMORY_BUDGET,                               \
+  }
+
+static clib_package_opts_t opts = DEFAULT_OPTS;
 
 /**
  * Pre-declare prototypes.
  */
 
-static inline char *json_object_get_string_safe(JSON_Object *, const char *);
-
-static inline char *json_array_get_string_safe(JSON_Array *, int);
-
 static inline char *clib_package_file_url(const char *, const char *);
 
 static inline char *clib_package_slug(const char *, const char *, const char *);
 
 static inline char *clib_package_repo(const char *, const char *);
 
-static inline list_t *parse_package_deps(JSON_Object *);
-
 static inline int install_packages(list_t *, const char *, int);
 
+static int install_package(clib_package_t *, const char *, int, int);
+
+static list_t *prefetch_manifests(list_t *);
+
+static prefetched_manifest_t *take_prefetched_manifest(const char *);
+
+static void forget_prefetched_manifests(list_t *);
+
+static int sync_package_file(clib_package_t *, const char *, char *, int,
+                             int *);
+
 void clib_package_set_opts(clib_package_opts_t o) {
   if (1 == opts.skip_cache && 0 == o.skip_cache) {
     opts.skip_cache = 0;
@@ -168,33 +330,73 @@ void clib_package_set_opts(clib_package_opts_t o) {
   if (opts.concurrency < 0) {
     opts.concurrency = 0;
   }
-}
 
-/**
- * Create a copy of the result of a `json_object_get_string`
- * invocation.  This allows us to `json_value_free()` the
- * parent `JSON_Value` without destroying the string.
- */
+  clib_cache_set_concurrency(opts.concurrency);
 
-static inline char *json_object_get_string_safe(JSON_Object *obj,
-                                                const char *key) {
-  const char *val = json_object_get_string(obj, key);
-  if (!val)
-    return NULL;
-  return strdup(val);
-}
+  if (o.retries > 0) {
+    opts.retries = o.retries;
+  } else if (o.retries < 0) {
+    opts.retries = 0;
+  }
 
-/**
- * Create a copy of the result of a `json_array_get_string`
- * invocation.  This allows us to `json_value_free()` the
- * parent `JSON_Value` without destroying the string.
- */
+  if (o.retry_delay > 0) {
+    opts.retry_delay = o.retry_delay;
+  }
 
-static inline char *json_array_get_string_safe(JSON_Array *array, int index) {
-  const char *val = json_array_get_string(array, index);
-  if (!val)
-    return NULL;
-  return strdup(val);
+  clib_retry_set_policy(opts.retries, opts.retry_delay);
+
+  if (o.connect_timeout > 0) {
+    opts.connect_timeout = o.connect_timeout;
+  } else if (o.connect_timeout < 0) {
+    opts.connect_timeout = 0;
+  }
+
+  if (o.timeout > 0) {
+    opts.timeout = o.timeout;
+  } else if (o.timeout < 0) {
+    opts.timeout = 0;
+  }
+
+  if (o.low_speed_limit > 0) {
+    opts.low_speed_limit = o.low_speed_limit;
+  }
+
+  if (o.low_speed_time > 0) {
+    opts.low_speed_time = o.low_speed_time;
+  } else if (o.low_speed_time < 0) {
+    opts.low_speed_time = 0;
+  }
+
+  // a stalled connection can't hold up a worker for good
+  http_get_set_timeouts(opts.connect_timeout, opts.timeout,
+                        opts.low_speed_limit, opts.low_speed_time);
+
+  opts.prefetch_only = o.prefetch_only;
+  opts.build = o.build;
+  opts.git = o.git;
+  opts.plan = o.plan;
+  opts.http3 = o.http3;
+  http_get_set_http3(opts.http3);
+
+  if (o.memory_budget > 0) {
+    opts.memory_budget = o.memory_budget;
+  } else if (o.memory_budget < 0) {
+    opts.memory_budget = 0;
+  }
+
+  // many bodies in flight at once spill to disk rather than run out of
+  // memory
+  http_get_set_memory_budget((size_t)opts.memory_budget * 1024 * 1024);
+
+  opts.progress = o.progress > 0 ? o.progress : 0;
+
+  if (o.min_downloads > 0) {
+    opts.min_downloads = o.min_downloads;
+  }
+
+  if (o.max_downloads > 0) {
+    opts.max_downloads = o.max_downloads;
+  }
 }
 
 /**
@@ -236,6 +438,76 @@ static inline char *clib_package_slug(const char *author, const char *name,
   return slug;
 }
 
+/**
+ * Splits `slug` in a single pass into new strings, with the default
+ * author and version when it has none.
+ *
+ * @return 0 on success, -1 if the slug is malformed or on error
+ */
+
+static int split_slug(const char *slug, char **author, char **name,
+                      char **version) {
+  parse_repo_t repo;
+
+  *author = *name = *version = NULL;
+  if (-1 == parse_repo(slug, &repo)) {
+    return -1;
+  }
+
+  *author = repo.owner.length ? substr_n(slug, repo.owner.length, 0, -1)
+                              : strdup(DEFAULT_REPO_OWNER);
+  *name = substr_n(slug + repo.name.offset, repo.name.length, 0, -1);
+  // * <-> master
+  *version = repo.version.length && '*' != slug[repo.version.offset]
+                 ? strdup(slug + repo.version.offset)
+                 : strdup(DEFAULT_REPO_VERSION);
+
+  if (!*author || !*name || !*version) {
+    free(*author);
+    free(*name);
+    free(*version);
+    *author = *name = *version = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Build the `author/name@version` slug `slug` resolves to
+ */
+
+static char *canonical_slug(const char *slug) {
+  parse_repo_t repo;
+  const char *author = DEFAULT_REPO_OWNER;
+  const char *version = DEFAULT_REPO_VERSION;
+  int author_length = (int)strlen(author);
+  int version_length = (int)strlen(version);
+  char *res = NULL;
+
+  if (-1 == parse_repo(slug, &repo)) {
+    return NULL;
+  }
+
+  if (repo.owner.length) {
+    author = slug;
+    author_length = (int)repo.owner.length;
+  }
+
+  if (repo.version.length && '*' != slug[repo.version.offset]) {
+    version = slug + repo.version.offset;
+    version_length = (int)repo.version.length;
+  }
+
+  if (-1 == asprintf(&res, "%.*s/%.*s@%.*s", author_length, author,
+                     (int)repo.name.length, slug + repo.name.offset,
+                     version_length, version)) {
+    return NULL;
+  }
+
+  return res;
+}
+
 /**
  * Load a local package with a manifest.
  */
@@ -251,14 +523,14 @@ clib_package_t *clib_package_load_from_manifest(const char *manifest,
 
   logger_info("info", "reading local %s", manifest);
 
-  char *json = fs_read(manifest);
-  if (NULL == json)
+  fs_mapping json;
+  if (-1 == fs_map(manifest, &json))
     goto e1;
 
-  pkg = clib_package_new(json, verbose);
+  pkg = clib_package_new(json.data, verbose);
 
 e1:
-  free(json);
+  fs_unmap(&json);
 
   return pkg;
 }
@@ -297,155 +569,346 @@ static inline char *clib_package_repo(const char *author, const char *name) {
   return repo;
 }
 
+typedef struct {
+  clib_package_dependency_t *dep;
+  int dependent; // graph node waiting for `dep`, or -1
+} pending_dependency_t;
+
+typedef struct {
+  const char *dir;
+  int verbose;
+} install_context_t;
+
+static int queue_dependencies(list_t *queue, list_t *deps, int dependent) {
+  list_node_t *node = NULL;
+
+  if (NULL == deps) {
+    return 0;
+  }
+
+  list_each(deps, node) {
+    pending_dependency_t *pending = malloc(sizeof(pending_dependency_t));
+
+    if (NULL == pending) {
+      return -1;
+    }
+
+    pending->dep = node->val;
+    pending->dependent = dependent;
+    list_rpush(queue, list_node_new(pending));
+  }
+
+  return 0;
+}
+
 /**
- * Parse the dependencies in the given `obj` into a `list_t`
+ * Pick the stripe of the package made of the given NULL terminated parts
  */
 
-static inline list_t *parse_package_deps(JSON_Object *obj) {
-  list_t *list = NULL;
+static unsigned int lock_stripe(const char *part, ...) {
+  unsigned int hash = 5381;
+  va_list parts;
 
-  if (!obj)
-    goto done;
-  if (!(list = list_new()))
-    goto done;
-  list->free = clib_package_dependency_free;
+  va_start(parts, part);
+  for (; NULL != part; part = va_arg(parts, const char *)) {
+    for (const char *c = part; *c; c++) {
+      hash = hash * 33 + (unsigned char)*c;
+    }
+    hash = hash * 33 + '/';
+  }
+  va_end(parts);
 
-  for (unsigned int i = 0; i < json_object_get_count(obj); i++) {
-    const char *name = NULL;
-    char *version = NULL;
-    clib_package_dependency_t *dep = NULL;
-    int error = 1;
+  return hash % CLIB_PACKAGE_LOCK_STRIPES;
+}
 
-    if (!(name = json_object_get_name(obj, i)))
-      goto loop_cleanup;
-    if (!(version = json_object_get_string_safe(obj, name)))
-      goto loop_cleanup;
-    if (!(dep = clib_package_dependency_new(name, version)))
-      goto loop_cleanup;
-    if (!(list_rpush(list, list_node_new(dep))))
-      goto loop_cleanup;
+#ifdef HAVE_PTHREADS
+/**
+ * The lock serializing cache operations on one package version
+ */
+
+static pthread_mutex_t *cache_lock(const char *author, const char *name,
+                                   const char *version) {
+  pthread_once(&lock_stripes_once, init_lock_stripes);
+  return &lock.cache[lock_stripe(author ? author : "", name ? name : "",
+                                 version ? version : "", NULL)];
+}
+#endif
+
+/**
+ * Packages are visited once per directory they're installed into, so
+ * that the same name can go to a shared directory and to a project's own.
+ *
+ * @return A new key for `name` in `dir`, or NULL on error
+ */
 
-    error = 0;
+static char *visited_key(const char *dir, const char *name) {
+  return path_join(dir ? dir : "", name);
+}
 
-  loop_cleanup:
-    if (version)
-      free(version);
-    if (error) {
-      list_destroy(list);
-      list = NULL;
-      break;
+static int is_visited(const char *dir, const char *name) {
+  char *key = NULL;
+  int visited = 0;
+
+  if (opts.force || NULL == name || 0 == visited_packages ||
+      !(key = visited_key(dir, name))) {
+    return 0;
+  }
+
+  visited = NULL != concurrent_hash_get(visited_packages, key);
+  free(key);
+  return visited;
+}
+
+/**
+ * Mark `name` visited in `dir`, checking and marking at once so
+ * concurrent installs of the same package don't both go ahead
+ *
+ * @return 1 if it was visited already, 0 otherwise
+ */
+
+static int mark_visited(const char *dir, const char *name) {
+  char *key = NULL;
+  int visited = 0;
+
+  if (0 == visited_packages) {
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&lock.init);
+    // another thread may have created it meanwhile
+    if (0 == visited_packages) {
+      concurrent_hash_t *visited = concurrent_hash_new();
+      // threads use it without the lock, so only once it is whole
+      __sync_synchronize();
+      visited_packages = visited;
     }
+    pthread_mutex_unlock(&lock.init);
+#else
+    visited_packages = concurrent_hash_new();
+#endif
+  }
+
+  if (!(key = visited_key(dir, name))) {
+    return 0;
+  }
+
+  visited = 0 == concurrent_hash_insert(visited_packages, key, "t");
+  free(key);
+  return visited;
+}
+
+static int install_graph_node(void *item, void *data) {
+  install_context_t *context = data;
+  return install_package(item, context->dir, context->verbose, 0);
+}
+
+/**
+ * How long installing `pkg` took on earlier runs, in microseconds, or 0
+ * when it never was.
+ */
+
+static uint64_t install_cost(clib_package_t *pkg) {
+  uint64_t cost = clib_timings_get("fetch", pkg->name);
+
+  if (pkg->configure) {
+    cost += clib_timings_get("configure", pkg->name);
+  }
+
+  if (opts.build && !opts.prefetch_only) {
+    cost += clib_timings_get("build", pkg->name);
   }
 
-done:
-  return list;
+  return cost;
 }
 
+/**
+ * Resolves the whole dependency graph of `list` one level at a time,
+ * prefetching the manifests of each level, then installs it with every
+ * package starting as soon as its own dependencies are in place.
+ */
+
 static inline int install_packages(list_t *list, const char *dir, int verbose) {
   list_node_t *node = NULL;
-  list_iterator_t *iterator = NULL;
   int rc = -1;
-  list_t *freelist = NULL;
+  list_t *level = NULL;
+  list_t *next = NULL;
+  list_t *deps = NULL;
+  list_t *prefetched = NULL;
+  hash_t *indexes = NULL;
+  clib_dag_t *graph = NULL;
+  install_context_t context = {dir, verbose};
 
   if (!list || !dir)
     goto cleanup;
 
-  iterator = list_iterator_new(list, LIST_HEAD);
-  if (NULL == iterator)
+  if (!(graph = clib_dag_new()) || !(indexes = hash_new()) ||
+      !(level = list_new()))
     goto cleanup;
 
-  freelist = list_new();
+  level->free = free;
 
-  while ((node = list_iterator_next(iterator))) {
-    clib_package_dependency_t *dep = NULL;
-    char *slug = NULL;
-    clib_package_t *pkg = NULL;
-    int error = 1;
+  if (-1 == queue_dependencies(level, list, -1))
+    goto cleanup;
 
-    dep = (clib_package_dependency_t *)node->val;
-    slug = clib_package_slug(dep->author, dep->name, dep->version);
-    if (NULL == slug)
-      goto loop_cleanup;
+  while (level->len > 0) {
+    if (!(next = list_new()) || !(deps = list_new()))
+      goto cleanup;
 
-    pkg = clib_package_new_from_slug(slug, verbose);
-    if (NULL == pkg)
-      goto loop_cleanup;
+    next->free = free;
 
-    if (-1 == clib_package_install(pkg, dir, verbose))
-      goto loop_cleanup;
+    list_each(level, node) {
+      pending_dependency_t *pending = node->val;
+      list_rpush(deps, list_node_new(pending->dep));
+    }
 
-    list_rpush(freelist, list_node_new(pkg));
-    error = 0;
+    // request the manifests of this whole level at once
+    prefetched = prefetch_manifests(deps);
 
-  loop_cleanup:
-    if (slug)
+    list_each(level, node) {
+      pending_dependency_t *pending = node->val;
+      clib_package_t *pkg = NULL;
+      char *slug = NULL;
+      int index = -1;
+
+      slug = clib_package_slug(pending->dep->author, pending->dep->name,
+                               pending->dep->version);
+      if (NULL == slug)
+        goto cleanup;
+
+      pkg = clib_package_new_from_slug(slug, verbose);
       free(slug);
-    if (error) {
-      list_iterator_destroy(iterator);
-      iterator = NULL;
-      rc = -1;
-      goto cleanup;
+
+      if (NULL == pkg)
+        goto cleanup;
+
+      if (pkg->name && hash_get(indexes, pkg->name)) {
+        index = (int)(intptr_t)hash_get(indexes, pkg->name) - 1;
+        clib_package_free(pkg);
+      } else if (is_visited(dir, pkg->name)) {
+        clib_package_free(pkg);
+      } else {
+        index = clib_dag_add(graph, pkg);
+
+        if (-1 == index) {
+          clib_package_free(pkg);
+          goto cleanup;
+        }
+
+        if (pkg->name) {
+          hash_set(indexes, (char *)clib_intern(pkg->name),
+                   (void *)(intptr_t)(index + 1));
+        }
+
+        clib_dag_set_cost(graph, index, install_cost(pkg));
+
+        if (-1 == queue_dependencies(next, pkg->dependencies, index))
+          goto cleanup;
+      }
+
+      if (-1 != index && -1 != pending->dependent) {
+        clib_dag_depend(graph, pending->dependent, index);
+      }
     }
+
+    forget_prefetched_manifests(prefetched);
+    prefetched = NULL;
+    list_destroy(deps);
+    deps = NULL;
+    list_destroy(level);
+    level = next;
+    next = NULL;
   }
 
-  rc = 0;
+  if (opts.plan) {
+    // nothing runs, so the plan lists the packages in the order resolved
+    rc = 0;
+    for (int i = 0; 0 == rc && i < clib_dag_size(graph); i++) {
+      rc = install_graph_node(clib_dag_item(graph, i), &context);
+    }
+    rc = 0 == rc ? 0 : -1;
+  } else {
+    rc = 0 == clib_dag_run_pool(graph, clib_package_pool(),
+                                install_graph_node, &context)
+             ? 0
+             : -1;
+  }
 
 cleanup:
-  if (iterator)
-    list_iterator_destroy(iterator);
-
-  if (freelist) {
-    iterator = list_iterator_new(freelist, LIST_HEAD);
-    while ((node = list_iterator_next(iterator))) {
-      clib_package_t *pkg = node->val;
-      if (pkg)
-        clib_package_free(pkg);
-    }
-    list_iterator_destroy(iterator);
-    list_destroy(freelist);
+  forget_prefetched_manifests(prefetched);
+
+  if (deps)
+    list_destroy(deps);
+  if (next)
+    list_destroy(next);
+  if (level)
+    list_destroy(level);
+
+  // the names are interned
+  if (indexes) {
+    hash_free(indexes);
+  }
+
+  for (int i = 0; i < clib_dag_size(graph); i++) {
+    clib_package_free(clib_dag_item(graph, i));
   }
+
+  clib_dag_free(graph);
   return rc;
 }
 
 #ifdef HAVE_PTHREADS
+// libcurl may take several share locks at once, so each kind of shared
+// data needs its own mutex
+static pthread_mutex_t curl_share_locks[CURL_LOCK_DATA_LAST];
+static pthread_once_t curl_share_locks_once = PTHREAD_ONCE_INIT;
+
+static void init_curl_share_locks(void) {
+  for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+    pthread_mutex_init(&curl_share_locks[i], NULL);
+  }
+}
+
 static void curl_lock_callback(CURL *handle, curl_lock_data data,
                                curl_lock_access access, void *userptr) {
-  pthread_mutex_lock(&lock.mutex);
+  pthread_mutex_lock(&curl_share_locks[data]);
 }
 
 static void curl_unlock_callback(CURL *handle, curl_lock_data data,
                                  curl_lock_access access, void *userptr) {
-  pthread_mutex_unlock(&lock.mutex);
+  pthread_mutex_unlock(&curl_share_locks[data]);
 }
 
 static void init_curl_share() {
+  if (0 != clib_package_curl_share) {
+    return;
+  }
+
+  pthread_once(&curl_share_locks_once, init_curl_share_locks);
+  pthread_mutex_lock(&lock.init);
+  // another thread may have created it meanwhile
   if (0 == clib_package_curl_share) {
-    pthread_mutex_lock(&lock.mutex);
-    clib_package_curl_share = curl_share_init();
-    curl_share_setopt(clib_package_curl_share, CURLSHOPT_SHARE,
-                      CURL_LOCK_DATA_CONNECT);
-    curl_share_setopt(clib_package_curl_share, CURLSHOPT_LOCKFUNC,
-                      curl_lock_callback);
-    curl_share_setopt(clib_package_curl_share, CURLSHOPT_UNLOCKFUNC,
-                      curl_unlock_callback);
-    curl_share_setopt(clib_package_curl_share, CURLOPT_NETRC,
-                      CURL_NETRC_OPTIONAL);
-    pthread_mutex_unlock(&lock.mutex);
+    CURLSH *share = curl_share_init();
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, curl_lock_callback);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, curl_unlock_callback);
+    curl_share_setopt(share, CURLOPT_NETRC, CURL_NETRC_OPTIONAL);
+    clib_session_load(share);
+    // threads use it without the lock, so only once it has its callbacks
+    __sync_synchronize();
+    clib_package_curl_share = share;
   }
+
+  pthread_mutex_unlock(&lock.init);
 }
 #endif
 
 /**
- * Create a new clib package from the given `json`
+ * Builds a package from the manifest `json`, without keeping it.
  */
 
-clib_package_t *clib_package_new(const char *json, int verbose) {
+static clib_package_t *parse_package(const char *json, int verbose) {
   clib_package_t *pkg = NULL;
-  JSON_Value *root = NULL;
-  JSON_Object *json_object = NULL;
-  JSON_Array *src = NULL;
-  JSON_Object *deps = NULL;
-  JSON_Object *devs = NULL;
+  int rc = 0;
   int error = 1;
 
   if (!json) {
@@ -455,66 +918,24 @@ clib_package_t *clib_package_new(const char *json, int verbose) {
     goto cleanup;
   }
 
-  if (!(root = json_parse_string(json))) {
-    if (verbose) {
-      logger_error("error", "unable to parse JSON");
-    }
-    goto cleanup;
-  }
-
-  if (!(json_object = json_value_get_object(root))) {
-    if (verbose) {
-      logger_error("error", "invalid clib.json or package.json file");
-    }
-    goto cleanup;
-  }
-
   if (!(pkg = malloc(sizeof(clib_package_t)))) {
     goto cleanup;
   }
 
   memset(pkg, 0, sizeof(clib_package_t));
 
-  pkg->json = strdup(json);
-  pkg->name = json_object_get_string_safe(json_object, "name");
-  pkg->repo = json_object_get_string_safe(json_object, "repo");
-  pkg->version = json_object_get_string_safe(json_object, "version");
-  pkg->license = json_object_get_string_safe(json_object, "license");
-  pkg->description = json_object_get_string_safe(json_object, "description");
-  pkg->configure = json_object_get_string_safe(json_object, "configure");
-  pkg->install = json_object_get_string_safe(json_object, "install");
-  pkg->makefile = json_object_get_string_safe(json_object, "makefile");
-  pkg->prefix = json_object_get_string_safe(json_object, "prefix");
-  pkg->flags = json_object_get_string_safe(json_object, "flags");
-
-  if (!pkg->flags) {
-    pkg->flags = json_object_get_string_safe(json_object, "cflags");
+  // what is read from a manifest, strings, lists and dependencies, hardly
+  // ever outgrows twice its size
+  if (!(pkg->arena = clib_arena_new(2 * strlen(json) + 64))) {
+    goto cleanup;
   }
 
-  // try as array
-  if (!pkg->flags) {
-    JSON_Array *flags = json_object_get_array(json_object, "flags");
-
-    if (!flags) {
-      flags = json_object_get_array(json_object, "cflags");
-    }
-
-    if (flags) {
-      for (unsigned int i = 0; i < json_array_get_count(flags); i++) {
-        char *flag = json_array_get_string_safe(flags, i);
-        if (flag) {
-          if (!pkg->flags) {
-            pkg->flags = "";
-          }
-
-          if (-1 == asprintf(&pkg->flags, "%s %s", pkg->flags, flag)) {
-            goto cleanup;
-          }
-
-          free(flag);
-        }
-      }
+  if (0 != (rc = clib_manifest_read(pkg, json))) {
+    if (verbose) {
+      logger_error("error", -1 == rc ? "unable to parse JSON"
+                                     : "invalid clib.json or package.json file");
     }
+    goto cleanup;
   }
 
   if (!pkg->repo && pkg->author && pkg->name) {
@@ -528,9 +949,10 @@ clib_package_t *clib_package_new(const char *json, int verbose) {
 
   // TODO npm-style "repository" (thlorenz/gumbo-parser.c#1)
   if (pkg->repo) {
-    pkg->author = parse_repo_owner(pkg->repo, DEFAULT_REPO_OWNER);
+    char *version = NULL;
     // repo name may not be package name (thing.c -> thing)
-    pkg->repo_name = parse_repo_name(pkg->repo);
+    split_slug(pkg->repo, &pkg->author, &pkg->repo_name, &version);
+    free(version);
   } else {
     if (verbose) {
       logger_warn("warning",
@@ -541,53 +963,22 @@ clib_package_t *clib_package_new(const char *json, int verbose) {
     pkg->repo_name = NULL;
   }
 
-  src = json_object_get_array(json_object, "src");
-
-  if (!src) {
-    src = json_object_get_array(json_object, "files");
-  }
-
-  if (src) {
-    if (!(pkg->src = list_new()))
-      goto cleanup;
-    pkg->src->free = free;
-    for (unsigned int i = 0; i < json_array_get_count(src); i++) {
-      char *file = json_array_get_string_safe(src, i);
-      _debug("file: %s", file);
-      if (!file)
-        goto cleanup;
-      if (!(list_rpush(pkg->src, list_node_new(file))))
-        goto cleanup;
-    }
-  } else {
+  if (!pkg->src) {
     _debug("no src files listed in clib.json or package.json file");
-    pkg->src = NULL;
   }
 
-  if ((deps = json_object_get_object(json_object, "dependencies"))) {
-    if (!(pkg->dependencies = parse_package_deps(deps))) {
-      goto cleanup;
-    }
-  } else {
+  if (!pkg->dependencies) {
     _debug("no dependencies listed in clib.json or package.json file");
-    pkg->dependencies = NULL;
   }
 
-  if ((devs = json_object_get_object(json_object, "development"))) {
-    if (!(pkg->development = parse_package_deps(devs))) {
-      goto cleanup;
-    }
-  } else {
+  if (!pkg->development) {
     _debug(
         "no development dependencies listed in clib.json or package.json file");
-    pkg->development = NULL;
   }
 
   error = 0;
 
 cleanup:
-  if (root)
-    json_value_free(root);
   if (error && pkg) {
     clib_package_free(pkg);
     pkg = NULL;
@@ -595,9 +986,209 @@ cleanup:
   return pkg;
 }
 
+/**
+ * Create a new clib package from the given `json`
+ */
+
+clib_package_t *clib_package_new(const char *json, int verbose) {
+  clib_package_t *pkg = parse_package(json, verbose);
+
+  if (pkg && !(pkg->json = strdup(json))) {
+    clib_package_free(pkg);
+    return NULL;
+  }
+
+  // installs only read it, as they may share the package
+  if (pkg) {
+    pkg->url = clib_package_url(pkg->author, pkg->repo_name, pkg->version);
+  }
+
+  return pkg;
+}
+
+char *clib_package_read_json(clib_package_t *pkg) {
+  char *json = NULL;
+
+  if (!pkg) {
+    return NULL;
+  }
+
+  if (pkg->json) {
+    return strdup(pkg->json);
+  }
+
+  if (!pkg->author || !pkg->name || !pkg->version) {
+    return NULL;
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(cache_lock(pkg->author, pkg->name, pkg->version));
+#endif
+  json = clib_cache_read_stale_json(pkg->author, pkg->name, pkg->version);
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(cache_lock(pkg->author, pkg->name, pkg->version));
+#endif
+
+  return json;
+}
+
+void clib_package_set_string(clib_package_t *pkg, char **field, char *value) {
+  if (*field && !clib_arena_owns(pkg->arena, *field)) {
+    free(*field);
+  }
+
+  *field = value;
+}
+
+/**
+ * @return 1 if the manifest of the package version can be read from the
+ * cache without waiting for the network, 0 otherwise
+ */
+
+static int has_cached_json(char *author, char *name, char *version) {
+  if (opts.skip_cache) {
+    return 0;
+  }
+
+#ifdef HAVE_PTHREADS
+  // it would be revalidated in the background
+  if (clib_cache_has_expired_json(author, name, version)) {
+    return 1;
+  }
+#endif
+
+  return clib_cache_has_json(author, name, version);
+}
+
+#ifdef HAVE_PTHREADS
+static void free_manifest_refresh(manifest_refresh_t *refresh) {
+  free(refresh->author);
+  free(refresh->name);
+  free(refresh->version);
+  free(refresh->url);
+  free(refresh);
+}
+
+static void *refresh_manifest_thread(void *data) {
+  manifest_refresh_t *refresh = data;
+  http_get_response_t *res = NULL;
+  clib_package_t *pkg = NULL;
+  char *etag = NULL;
+  char *last_modified = NULL;
+
+  pthread_mutex_lock(
+      cache_lock(refresh->author, refresh->name, refresh->version));
+  clib_cache_read_json_validators(refresh->author, refresh->name,
+                                  refresh->version, &etag, &last_modified);
+  pthread_mutex_unlock(
+      cache_lock(refresh->author, refresh->name, refresh->version));
+
+  _debug("revalidating %s", refresh->url);
+  res = clib_mirror_get(refresh->url, clib_package_curl_share, etag,
+                        last_modified);
+
+  // what isn't a manifest is left to expire for good
+  if (res && res->ok && 304 != res->status && res->data) {
+    pkg = parse_package(res->data, 0);
+  }
+
+  pthread_mutex_lock(
+      cache_lock(refresh->author, refresh->name, refresh->version));
+  if (res && 304 == res->status) {
+    clib_cache_renew_json(refresh->author, refresh->name, refresh->version);
+  } else if (pkg && -1 != clib_cache_save_json(refresh->author, refresh->name,
+                                               refresh->version, res->data)) {
+    clib_cache_save_json_validators(refresh->author, refresh->name,
+                                    refresh->version, res->etag,
+                                    res->last_modified);
+  }
+  pthread_mutex_unlock(
+      cache_lock(refresh->author, refresh->name, refresh->version));
+
+  clib_cache_end_refresh(refresh->lock);
+  refresh->lock = -1;
+
+  if (pkg) {
+    clib_package_free(pkg);
+  }
+
+  http_get_free(res);
+  free(etag);
+  free(last_modified);
+  return NULL;
+}
+
+/**
+ * Revalidates the expired manifest of the package version at `url` in a
+ * thread of its own, unless another process is doing so already.
+ */
+
+static void refresh_manifest(const char *author, const char *name,
+                             const char *version, const char *url) {
+  manifest_refresh_t *refresh = NULL;
+  int entry_lock = -1;
+
+  if (-1 == (entry_lock = clib_cache_begin_refresh_json(
+                 (char *)author, (char *)name, (char *)version))) {
+    return;
+  }
+
+  if (!(refresh = calloc(1, sizeof(manifest_refresh_t)))) {
+    clib_cache_end_refresh(entry_lock);
+    return;
+  }
+
+  refresh->lock = entry_lock;
+  refresh->author = strdup(author);
+  refresh->name = strdup(name);
+  refresh->version = strdup(version);
+  refresh->url = strdup(url);
+
+  init_curl_share();
+
+  if (!refresh->author || !refresh->name || !refresh->version ||
+      !refresh->url ||
+      0 != pthread_create(&refresh->thread, NULL, refresh_manifest_thread,
+                          refresh)) {
+    clib_cache_end_refresh(entry_lock);
+    free_manifest_refresh(refresh);
+    return;
+  }
+
+  pthread_mutex_lock(&lock.refreshes);
+  refresh->next = manifest_refreshes;
+  manifest_refreshes = refresh;
+  pthread_mutex_unlock(&lock.refreshes);
+}
+
+/**
+ * Waits for the manifests revalidated in the background.
+ */
+
+static void join_manifest_refreshes(void) {
+  manifest_refresh_t *refresh = NULL;
+
+  pthread_mutex_lock(&lock.refreshes);
+  refresh = manifest_refreshes;
+  manifest_refreshes = 0;
+  pthread_mutex_unlock(&lock.refreshes);
+
+  while (refresh) {
+    manifest_refresh_t *next = refresh->next;
+
+    pthread_join(refresh->thread, NULL);
+    free_manifest_refresh(refresh);
+    refresh = next;
+  }
+}
+#endif
+
 static clib_package_t *
 clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
-                                             const char *file) {
+                                             const char *file,
+                                             const char *locked,
+                                             const char *locked_slug) {
+  uint64_t started = clib_trace_clock();
   char *author = NULL;
   char *name = NULL;
   char *version = NULL;
@@ -605,20 +1196,25 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
   char *json_url = NULL;
   char *repo = NULL;
   char *json = NULL;
+  char *etag = NULL;
+  char *last_modified = NULL;
   char *log = NULL;
+  unsigned long long *source = NULL;
+  fs_mapping cached_json = {0};
+  prefetched_manifest_t *prefetched = NULL;
   http_get_response_t *res = NULL;
   clib_package_t *pkg = NULL;
-  int retries = 3;
+  int cached = 0;
+  int stale = 0;
+  int missing = 0;
+  int exhausted = 0;
+  int attempts = 0;
 
   // parse chunks
   if (!slug)
     goto error;
   _debug("creating package: %s", slug);
-  if (!(author = parse_repo_owner(slug, DEFAULT_REPO_OWNER)))
-    goto error;
-  if (!(name = parse_repo_name(slug)))
-    goto error;
-  if (!(version = parse_repo_version(slug, DEFAULT_REPO_VERSION)))
+  if (-1 == split_slug(slug, &author, &name, &version))
     goto error;
   if (!(url = clib_package_url(author, name, version)))
     goto error;
@@ -629,52 +1225,153 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
   _debug("name: %s", name);
   _debug("version: %s", version);
 
+  // a locked manifest is used as is
+  if (locked) {
+    json = strdup(locked);
+    log = "lock";
+    source = &totals.manifests_locked;
+    goto build;
+  }
+
 #ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&lock.mutex);
+  pthread_mutex_lock(cache_lock(author, name, version));
 #endif
-  // fetch json
-  if (clib_cache_has_json(author, name, version)) {
-    if (opts.skip_cache) {
-      clib_cache_delete_json(author, name, version);
-      goto download;
-    }
+  // fetch json, mapped from the cache rather than copied
+  if (!opts.skip_cache &&
+      0 == clib_cache_map_json(author, name, version, &cached_json)) {
+    json = cached_json.data;
+  }
 
-    json = clib_cache_read_json(author, name, version);
+#ifdef HAVE_PTHREADS
+  // an expired copy is used right away and revalidated in the background,
+  // unless it expired too long ago
+  if (!json && !opts.skip_cache &&
+      0 == clib_cache_map_expired_json(author, name, version, &cached_json)) {
+    json = cached_json.data;
+    stale = 1;
+  }
+#endif
 
-    if (!json) {
-      goto download;
-    }
+  // a name the package was found not to have isn't asked for again
+  if (!json && !opts.skip_cache &&
+      clib_cache_has_missing_json(author, name, version, file)) {
+    missing = 1;
+  }
+
+  // an expired or skipped copy is revalidated instead of redownloaded
+  if (!json && !missing) {
+    clib_cache_read_json_validators(author, name, version, &etag,
+                                    &last_modified);
+  }
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(cache_lock(author, name, version));
+#endif
+
+  if (missing) {
+    _debug("missing %s", json_url);
+    goto error;
+  }
 
+  if (json) {
     log = "cache";
+    source = stale ? &totals.manifests_stale : &totals.manifests_cached;
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
+    if (stale) {
+      refresh_manifest(author, name, version, json_url);
+    }
 #endif
   } else {
   download:
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
-#endif
-    if (retries-- <= 0) {
-      goto error;
+    if (attempts > 0) {
+      clib_retry_class_t kind = clib_retry_classify(
+          res ? res->code : -1, res ? res->status : 0);
+
+      if (!clib_retry_again(kind, attempts)) {
+        exhausted = 1;
+        goto error;
+      }
+
+      COUNT(totals.retries, 1);
+      usleep(1000 * clib_retry_backoff(attempts));
+    }
+
+    (void)attempts++;
+
+    // clean up when retrying
+    http_get_free(res);
+    res = NULL;
+
+    if ((prefetched = take_prefetched_manifest(json_url))) {
+      _debug("prefetched %s", json_url);
+      res = prefetched->res;
+      free(prefetched->url);
+      free(prefetched);
+      prefetched = NULL;
     } else {
+      _debug("GET %s", json_url);
 #ifdef HAVE_PTHREADS
       init_curl_share();
-      _debug("GET %s", json_url);
-      // clean up when retrying
+#endif
+      res = clib_mirror_get(json_url, clib_package_curl_share, etag,
+                            last_modified);
+    }
+
+    if (!res) {
+      goto download;
+    }
+
+    _debug("status: %d", res->status);
+
+    // a definite answer, remembered rather than retried unless it may
+    // have come from a mirror that lags behind
+    if (404 == res->status) {
+      if (0 == clib_mirror_count()) {
+#ifdef HAVE_PTHREADS
+        pthread_mutex_lock(cache_lock(author, name, version));
+#endif
+        clib_cache_save_missing_json(author, name, version, file);
+#ifdef HAVE_PTHREADS
+        pthread_mutex_unlock(cache_lock(author, name, version));
+#endif
+      }
+      missing = 1;
+      goto error;
+    }
+
+    if (304 == res->status) {
       http_get_free(res);
-      res = http_get_shared(json_url, clib_package_curl_share);
-#else
-      res = http_get(json_url);
+      res = NULL;
+#ifdef HAVE_PTHREADS
+      pthread_mutex_lock(cache_lock(author, name, version));
 #endif
-      json = res->data;
-      _debug("status: %d", res->status);
-      if (!res || !res->ok) {
+      if (0 == clib_cache_map_stale_json(author, name, version, &cached_json)) {
+        json = cached_json.data;
+      }
+#ifdef HAVE_PTHREADS
+      pthread_mutex_unlock(cache_lock(author, name, version));
+#endif
+      if (!json) {
+        // the cached copy vanished, fetch it unconditionally
+        free(etag);
+        free(last_modified);
+        etag = last_modified = NULL;
+        // not a failure, the next request is the first of its kind
+        attempts = 0;
+        goto download;
+      }
+      log = "cache";
+      source = &totals.manifests_revalidated;
+    } else {
+      if (!res->ok) {
         goto download;
       }
+      json = res->data;
       log = "fetch";
+      source = &totals.manifests_fetched;
     }
   }
 
+build:
   if (verbose) {
     logger_info(log, "%s/%s:%s", author, name, file);
   }
@@ -686,7 +1383,7 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
 
   if (json) {
     // build package
-    pkg = clib_package_new(json, verbose);
+    pkg = parse_package(json, verbose);
   }
 
   if (!pkg)
@@ -697,8 +1394,7 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
     if (version) {
       if (0 != strcmp(version, DEFAULT_REPO_VERSION)) {
         _debug("forcing version number: %s (%s)", version, pkg->version);
-        free(pkg->version);
-        pkg->version = version;
+        clib_package_set_string(pkg, &pkg->version, version);
       } else {
         free(version);
       }
@@ -710,8 +1406,7 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
   // force package author (don't know how this could fail)
   if (author && pkg->author) {
     if (0 != strcmp(author, pkg->author)) {
-      free(pkg->author);
-      pkg->author = author;
+      clib_package_set_string(pkg, &pkg->author, author);
     } else {
       free(author);
     }
@@ -738,35 +1433,68 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
   pkg->url = url;
 
 #ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&lock.mutex);
+  pthread_mutex_lock(cache_lock(pkg->author, pkg->name, pkg->version));
 #endif
-  // cache json
-  if (pkg && pkg->author && pkg->name && pkg->version) {
+  // cache json, an expired one is left to its revalidation
+  if (!locked && !stale && pkg->author && pkg->name && pkg->version) {
     if (-1 ==
         clib_cache_save_json(pkg->author, pkg->name, pkg->version, json)) {
       _debug("failed to cache JSON for: %s/%s@%s", pkg->author, pkg->name,
              pkg->version);
     } else {
       _debug("cached: %s/%s@%s", pkg->author, pkg->name, pkg->version);
+      cached = 1;
+      if (res) {
+        clib_cache_save_json_validators(pkg->author, pkg->name, pkg->version,
+                                        res->etag, res->last_modified);
+      }
     }
   }
 #ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&lock.mutex);
+  pthread_mutex_unlock(cache_lock(pkg->author, pkg->name, pkg->version));
 #endif
 
-  if (res) {
-    http_get_free(res);
-    json = NULL;
-    res = NULL;
-  } else {
+  pkg->filename = (char *)file;
+
+  // record new resolutions while the manifest is at hand
+  if (locked_slug) {
+    pkg->json = json;
+    clib_lockfile_add(lockfile, locked_slug, pkg);
+    pkg->json = NULL;
+  }
+
+  // a cached manifest is read back from the cache when it is installed,
+  // so that resolving a large tree doesn't hold on to all of them
+  if (!cached) {
+    if (cached_json.data || (res && res->mapped)) {
+      pkg->json = strdup(json);
+    } else {
+      if (res) {
+        res->data = NULL;
+      }
+      pkg->json = json;
+    }
+  } else if (!res && !cached_json.data) {
     free(json);
-    json = NULL;
   }
 
+  fs_unmap(&cached_json);
+
+  json = NULL;
+  http_get_free(res);
+  res = NULL;
+
+  free(etag);
+  free(last_modified);
+
+  COUNT(*source, 1);
+  COUNT_SINCE(totals.manifest_us, started);
+  clib_trace_span("package", "manifest", slug, started, "\"source\":\"%s\"",
+                  log);
   return pkg;
 
 error:
-  if (0 == retries) {
+  if (exhausted) {
     if (verbose && author && name && file) {
       logger_warn("warning", "unable to fetch %s/%s:%s", author, name, file);
     }
@@ -778,35 +1506,161 @@ error:
   free(url);
   free(json_url);
   free(repo);
-  if (!res && json)
+  free(etag);
+  free(last_modified);
+  if (!res && json && !cached_json.data)
     free(json);
+  fs_unmap(&cached_json);
   if (res)
     http_get_free(res);
   if (pkg)
     clib_package_free(pkg);
+  COUNT(totals.manifests_failed, 1);
+  COUNT_SINCE(totals.manifest_us, started);
+  clib_trace_span("package", "manifest", slug, started, "\"failed\":true");
   return NULL;
 }
 
 /**
- * Create a package from the given repo `slug`
+ * Takes another reference to `pkg`, dropped by `clib_package_free()`
+ */
+
+static clib_package_t *retain_package(clib_package_t *pkg) {
+  __sync_fetch_and_add(&pkg->refs, 1);
+  return pkg;
+}
+
+/**
+ * Drops a reference to `pkg`, unless it is the last one
+ *
+ * @return 1 if one was dropped, 0 if the caller holds the last one
+ */
+
+static int release_package(clib_package_t *pkg) {
+  unsigned int refs = 0;
+
+  do {
+    if (0 == (refs = pkg->refs)) {
+      return 0;
+    }
+  } while (!__sync_bool_compare_and_swap(&pkg->refs, refs, refs - 1));
+
+  return 1;
+}
+
+/**
+ * Keeps `pkg` for the next resolutions of the canonical slug `key`. When
+ * another thread resolved it meanwhile, theirs is kept instead.
+ */
+
+static void remember_package(const char *key, clib_package_t *pkg) {
+  if (0 == resolved_packages) {
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&lock.init);
+    if (0 == resolved_packages) {
+      concurrent_hash_t *resolved = concurrent_hash_new();
+      // threads use it without the lock, so only once it is whole
+      __sync_synchronize();
+      resolved_packages = resolved;
+    }
+    pthread_mutex_unlock(&lock.init);
+#else
+    resolved_packages = concurrent_hash_new();
+#endif
+  }
+
+  retain_package(pkg);
+
+  if (!resolved_packages ||
+      1 != concurrent_hash_insert(resolved_packages, key, pkg)) {
+    release_package(pkg);
+  }
+}
+
+static void forget_resolved_packages(void) {
+  if (0 == resolved_packages) {
+    return;
+  }
+
+  concurrent_hash_each_val(resolved_packages, {
+    clib_package_free(val);
+  });
+
+  concurrent_hash_free(resolved_packages);
+  resolved_packages = 0;
+}
+
+/**
+ * Create a package from the given repo `slug`. A slug is only resolved
+ * once per run, later calls share the package, which each of them frees.
  */
 
 clib_package_t *clib_package_new_from_slug(const char *slug, int verbose) {
   clib_package_t *package = NULL;
   const char *name = NULL;
+  char *canonical = slug ? canonical_slug(slug) : NULL;
+  char *locked_slug = NULL;
+  char *locked = NULL;
+  char *file = NULL;
   unsigned int i = 0;
 
+  if (canonical && resolved_packages &&
+      (package = concurrent_hash_get(resolved_packages, canonical))) {
+    free(canonical);
+    return retain_package(package);
+  }
+
+  if (lockfile && slug) {
+    locked_slug = canonical;
+    locked = clib_lockfile_manifest(lockfile, locked_slug, &file);
+  }
+
+  if (lockfile_frozen && !locked) {
+    if (verbose) {
+      logger_error("error", "%s is not in %s", slug, CLIB_LOCKFILE_NAME);
+    }
+    goto cleanup;
+  }
+
   do {
     name = manifest_names[i];
-    package = clib_package_new_from_slug_with_package_name(slug, verbose, name);
-    if (NULL != package) {
-      package->filename = (char *)name;
+
+    if (locked && 0 != strcmp(file, name)) {
+      continue;
     }
+
+    package = clib_package_new_from_slug_with_package_name(
+        slug, verbose, name, locked, locked ? NULL : locked_slug);
   } while (NULL != manifest_names[++i] && NULL == package);
 
+  if (package && locked_slug) {
+    package->slug = strdup(locked_slug);
+    package->unchanged = locked && clib_lockfile_kept(lockfile, locked_slug);
+  }
+
+  if (package && canonical) {
+    remember_package(canonical, package);
+  }
+
+cleanup:
+  free(canonical);
+  free(locked);
+  free(file);
   return package;
 }
 
+/**
+ * Resolve slugs through `lock` and record new resolutions in it. When
+ * `frozen` is set, slugs missing from it fail to resolve.
+ */
+
+void clib_package_set_lockfile(clib_lockfile_t *lock, int frozen) {
+  // they were resolved without it
+  forget_resolved_packages();
+  lockfile = lock;
+  lockfile_frozen = lock && frozen;
+}
+
 /**
  * Get a slug for the package `author/name@version`
  */
@@ -911,20 +1765,676 @@ clib_package_dependency_t *clib_package_dependency_new(const char *repo,
   return dep;
 }
 
-static int fetch_package_file_work(clib_package_t *pkg, const char *dir,
-                                   char *file, int verbose) {
-  char *url = NULL;
-  char *path = NULL;
-  int saved = 0;
-  int rc = 0;
+clib_package_dependency_t *
+clib_package_dependency_new_in(clib_arena_t *arena, const char *repo,
+                               const char *version) {
+  clib_package_dependency_t *dep = NULL;
+  parse_repo_t parts;
 
-  _debug("fetch file: %s/%s", pkg->repo, file);
+  if (!repo || !version)
+    return NULL;
 
-  if (NULL == pkg) {
-    return 1;
+  if (!(dep = clib_arena_alloc(arena, sizeof(clib_package_dependency_t)))) {
+    return NULL;
   }
 
-  if (NULL == pkg->url) {
+  // interned straight from `repo`, without copies of its parts
+  dep->author = NULL;
+  dep->name = NULL;
+  if (0 == parse_repo(repo, &parts)) {
+    dep->author =
+        (char *)(parts.owner.length
+                     ? clib_intern_n(repo, parts.owner.length)
+                     : clib_intern(DEFAULT_REPO_OWNER));
+    dep->name = (char *)clib_intern_n(repo + parts.name.offset,
+                                      parts.name.length);
+  }
+
+  dep->version = (char *)clib_intern(
+      0 == strcmp("*", version) ? DEFAULT_REPO_VERSION : version);
+
+  _debug("dependency: %s/%s@%s", dep->author, dep->name, dep->version);
+  return dep;
+}
+
+int clib_package_downloads(int *peak) {
+  int concurrency = 0;
+
+  if (peak) {
+    *peak = 0;
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock.init);
+#endif
+  if (0 != downloads) {
+    concurrency = clib_download_concurrency(downloads, peak);
+  }
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.init);
+#endif
+
+  return concurrency;
+}
+
+/**
+ * Lazily create the download engine shared by every package install.
+ */
+
+clib_pool_t *clib_package_pool(void) {
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock.init);
+#endif
+  // threads waiting on the pool run its tasks, hence one less
+  if (0 == pool) {
+    pool = clib_pool_new(opts.concurrency - 1);
+  }
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.init);
+#endif
+  return pool;
+}
+
+typedef struct {
+  char *author;
+  char *name;
+  char *version;
+  char *pkg_dir;
+  int fetch_lock;
+} pending_save_t;
+
+/**
+ * Nothing changes the files of a package that is neither configured nor
+ * built any more, so the cache gets them while the install goes on.
+ * Those of the others are copied to it, as configuring edits them.
+ *
+ * @return 1 if the files of `pkg` stay as they were fetched
+ */
+
+static int saved_as_fetched(clib_package_t *pkg) {
+  return opts.prefetch_only ||
+         (!pkg->configure && !(opts.build && pkg->makefile));
+}
+
+/**
+ * Saves a package queued by `queue_save()` and frees it
+ */
+
+static int run_save(void *arg) {
+  pending_save_t *save = arg;
+  int rc = 0;
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(cache_lock(save->author, save->name, save->version));
+#endif
+  rc = clib_cache_save_package(save->author, save->name, save->version,
+                               save->pkg_dir);
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(cache_lock(save->author, save->name, save->version));
+#endif
+
+  // installs of it elsewhere waited to find it in the cache
+  clib_cache_unlock_fetch(save->fetch_lock);
+
+  free(save->author);
+  free(save->name);
+  free(save->version);
+  free(save->pkg_dir);
+  free(save);
+  return rc;
+}
+
+/**
+ * Queues saving `pkg` from `pkg_dir` to the cache, so that the install
+ * goes on meanwhile. The save takes over `fetch_lock`.
+ *
+ * @return 0 if it is queued, -1 if it is to be saved right away
+ */
+
+static int queue_save(clib_package_t *pkg, const char *pkg_dir,
+                      int fetch_lock) {
+  pending_save_t *save = NULL;
+  clib_pool_group_t *group = NULL;
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock.init);
+#endif
+  // one save at a time, each walks the package with the cache's threads
+  if (0 == save_pool && (save_pool = clib_pool_new(1))) {
+    saves = clib_pool_group_new(save_pool);
+  }
+  group = saves;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.init);
+#endif
+
+  if (!group || !pkg->author || !pkg->name || !pkg->version ||
+      !(save = calloc(1, sizeof(pending_save_t)))) {
+    return -1;
+  }
+
+  save->author = strdup(pkg->author);
+  save->name = strdup(pkg->name);
+  save->version = strdup(pkg->version);
+  save->pkg_dir = strdup(pkg_dir);
+  save->fetch_lock = fetch_lock;
+
+  if (!save->author || !save->name || !save->version || !save->pkg_dir ||
+      0 != clib_pool_submit(group, run_save, save)) {
+    free(save->author);
+    free(save->name);
+    free(save->version);
+    free(save->pkg_dir);
+    free(save);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Waits until the packages queued so far are saved to the cache
+ */
+
+static void wait_saves(void) {
+  clib_pool_group_t *group = NULL;
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock.init);
+#endif
+  group = saves;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.init);
+#endif
+
+  clib_pool_wait(group);
+}
+
+static void format_size(char *buffer, unsigned long long size) {
+  const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+  double value = size;
+  int i = 0;
+
+  while (value >= 1024 && i < 4) {
+    value /= 1024;
+    i++;
+  }
+
+  sprintf(buffer, 0 == i ? "%.0f %s" : "%.1f %s", value, units[i]);
+}
+
+/**
+ * Logs where the install is at, in place of a line for each file. It is
+ * called by the thread driving the downloads, only every so often.
+ */
+
+static void report_progress(const clib_download_progress_t *transfers,
+                            void *data) {
+  char bytes[32];
+  char rate[32];
+
+  format_size(bytes, transfers->bytes);
+  format_size(rate, transfers->rate);
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock.output);
+#endif
+  logger_info("progress",
+              "%llu/%llu packages, %llu/%llu files, %s at %s/s, %d active",
+              COUNT(progress.done, 0), COUNT(progress.packages, 0),
+              transfers->done, transfers->transfers, bytes, rate,
+              transfers->active);
+  fflush(stdout);
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.output);
+#endif
+}
+
+/**
+ * Whether the files of packages are logged one by one, unless the
+ * progress reports stand in for them.
+ */
+
+static int log_files(int verbose) { return verbose && 0 == opts.progress; }
+
+static clib_download_t *get_downloads(void) {
+#ifdef HAVE_PTHREADS
+  init_curl_share();
+  pthread_mutex_lock(&lock.init);
+#endif
+  if (0 == downloads) {
+    downloads = clib_download_new(opts.concurrency, clib_package_curl_share);
+    clib_download_set_bounds(downloads, opts.min_downloads,
+                             opts.max_downloads);
+    if (opts.progress) {
+      clib_download_set_progress(downloads, opts.progress, report_progress,
+                                 NULL);
+    }
+  }
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.init);
+#endif
+  return downloads;
+}
+
+static void prefetch_manifest_done(http_get_response_t *res, const char *url,
+                                   void *data) {
+  prefetched_manifest_t *entry = data;
+  entry->res = res;
+}
+
+/**
+ * Makes the response the regular fetch would have had for a manifest
+ * GitHub returned as `text`, or said is missing when it is NULL.
+ */
+
+static http_get_response_t *github_manifest_response(const char *text) {
+  http_get_response_t *res = calloc(1, sizeof(http_get_response_t));
+
+  if (!res || !text) {
+    if (res) {
+      res->status = 404;
+    }
+    return res;
+  }
+
+  if (!(res->data = strdup(text))) {
+    free(res);
+    return NULL;
+  }
+
+  res->size = strlen(text);
+  res->status = 200;
+  res->ok = 1;
+  return res;
+}
+
+/**
+ * Asks GitHub for the manifests of every dependency in `deps` that
+ * needs a request, in a few batched queries, when there is a token to
+ * authenticate them and no mirror to ask instead.
+ *
+ * Returns what GitHub answered, see `clib_github_resolve()`, or NULL.
+ */
+
+static hash_t *resolve_github_manifests(list_t *deps) {
+  list_node_t *node = NULL;
+  hash_t *versions = NULL;
+  list_t *slugs = NULL;
+
+  if (!opts.token || 0 != clib_mirror_count() || !(slugs = list_new())) {
+    goto cleanup;
+  }
+
+  slugs->free = free;
+
+  list_each(deps, node) {
+    clib_package_dependency_t *dep = node->val;
+    char *slug = clib_package_slug(dep->author, dep->name, dep->version);
+    char *author = slug ? parse_repo_owner(slug, DEFAULT_REPO_OWNER) : NULL;
+    char *name = slug ? parse_repo_name(slug) : NULL;
+    char *version = slug ? parse_repo_version(slug, DEFAULT_REPO_VERSION) : NULL;
+    int cached = 1;
+
+    if (author && name && version) {
+#ifdef HAVE_PTHREADS
+      pthread_mutex_lock(cache_lock(author, name, version));
+#endif
+      cached = clib_lockfile_has(lockfile, slug) ||
+               has_cached_json(author, name, version);
+#ifdef HAVE_PTHREADS
+      pthread_mutex_unlock(cache_lock(author, name, version));
+#endif
+    }
+
+    if (!cached) {
+      list_rpush(slugs, list_node_new(slug));
+      slug = NULL;
+    }
+
+    free(slug);
+    free(author);
+    free(name);
+    free(version);
+  }
+
+  if (slugs->len > 0) {
+#ifdef HAVE_PTHREADS
+    init_curl_share();
+#endif
+    versions = clib_github_resolve(slugs, manifest_names, opts.token,
+                                   clib_package_curl_share);
+    _debug("resolved %d of %d manifests on GitHub",
+           versions ? (int)hash_size(versions) : 0, (int)slugs->len);
+  }
+
+cleanup:
+  if (slugs) {
+    list_destroy(slugs);
+  }
+  return versions;
+}
+
+/**
+ * Request every manifest name of every dependency in `deps` concurrently
+ * and keep the answers for `clib_package_new_from_slug()`. Dependencies
+ * with a fresh cached manifest are skipped.
+ *
+ * Returns the URLs that were prefetched, for
+ * `forget_prefetched_manifests()`.
+ */
+
+static list_t *prefetch_manifests(list_t *deps) {
+  list_node_t *node = NULL;
+  list_t *entries = NULL;
+  list_t *urls = NULL;
+  clib_download_t *engine = NULL;
+  hash_t *github = NULL;
+
+  if (!deps || !(engine = get_downloads()) || !(entries = list_new())) {
+    return NULL;
+  }
+
+  github = resolve_github_manifests(deps);
+
+  list_each(deps, node) {
+    clib_package_dependency_t *dep = node->val;
+    char *slug = clib_package_slug(dep->author, dep->name, dep->version);
+    char *author = slug ? parse_repo_owner(slug, DEFAULT_REPO_OWNER) : NULL;
+    char *name = slug ? parse_repo_name(slug) : NULL;
+    char *version = slug ? parse_repo_version(slug, DEFAULT_REPO_VERSION) : NULL;
+    char *url = NULL;
+    char *etag = NULL;
+    char *last_modified = NULL;
+    int cached = 0;
+
+    if (!author || !name || !version ||
+        !(url = clib_package_url(author, name, version))) {
+      goto loop_cleanup;
+    }
+
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(cache_lock(author, name, version));
+#endif
+    // locked manifests need no request at all
+    cached = clib_lockfile_has(lockfile, slug) ||
+             has_cached_json(author, name, version);
+    if (!cached) {
+      clib_cache_read_json_validators(author, name, version, &etag,
+                                      &last_modified);
+    }
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(cache_lock(author, name, version));
+#endif
+
+    for (int i = 0; !cached && NULL != manifest_names[i]; i++) {
+      prefetched_manifest_t *entry = NULL;
+      clib_github_version_t *answer = github ? hash_get(github, slug) : NULL;
+      char *json_url = clib_package_file_url(url, manifest_names[i]);
+      char *mirror_url = NULL;
+      int mirror = clib_mirror_next(-1);
+
+      // left to the regular fetch, which knows it's missing
+      if (!opts.skip_cache &&
+          clib_cache_has_missing_json(author, name, version,
+                                      manifest_names[i])) {
+        free(json_url);
+        continue;
+      }
+
+      if (!json_url || !(entry = malloc(sizeof(prefetched_manifest_t)))) {
+        free(json_url);
+        break;
+      }
+
+      entry->url = json_url;
+      entry->res = NULL;
+
+      // answered in a batch already, unless it was too large for it
+      if (answer && (answer->files[i] || answer->missing[i])) {
+        entry->res = github_manifest_response(answer->files[i]);
+        list_rpush(entries, list_node_new(entry));
+        continue;
+      }
+
+      if (-1 != mirror) {
+        mirror_url = clib_mirror_url(json_url, mirror);
+      }
+
+      // what no mirror serves is left to the regular fetch
+      if (!mirror_url && clib_mirror_only()) {
+        free(entry->url);
+        free(entry);
+        continue;
+      }
+
+      if (0 != clib_download_get(engine, mirror_url ? mirror_url : json_url,
+                                 etag, last_modified, prefetch_manifest_done,
+                                 entry)) {
+        free(entry->url);
+        free(entry);
+      } else {
+        list_rpush(entries, list_node_new(entry));
+      }
+
+      free(mirror_url);
+    }
+
+  loop_cleanup:
+    free(slug);
+    free(author);
+    free(name);
+    free(version);
+    free(url);
+    free(etag);
+    free(last_modified);
+  }
+
+  clib_download_wait(engine);
+  clib_github_free(github);
+
+  urls = list_new();
+  urls->free = free;
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock.prefetched);
+#endif
+  if (0 == prefetched_manifests) {
+    prefetched_manifests = hash_new();
+  }
+
+  list_each(entries, node) {
+    prefetched_manifest_t *entry = node->val;
+    http_get_response_t *res = entry->res;
+
+    // keep what the regular fetch would accept, plus a missing manifest
+    // when there are no mirrors that could be lacking it, or only mirrors
+    if (res && (res->ok || 304 == res->status ||
+                (404 == res->status &&
+                 (0 == clib_mirror_count() || clib_mirror_only()))) &&
+        NULL == hash_get(prefetched_manifests, entry->url)) {
+      hash_set(prefetched_manifests, entry->url, entry);
+      list_rpush(urls, list_node_new(strdup(entry->url)));
+    } else {
+      http_get_free(res);
+      free(entry->url);
+      free(entry);
+    }
+  }
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.prefetched);
+#endif
+
+  list_destroy(entries);
+
+  return urls;
+}
+
+/**
+ * Remove the prefetched answer for `url`, or return NULL if there is none
+ */
+
+static prefetched_manifest_t *take_prefetched_manifest(const char *url) {
+  prefetched_manifest_t *entry = NULL;
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock.prefetched);
+#endif
+  if (0 != prefetched_manifests &&
+      (entry = hash_get(prefetched_manifests, (char *)url))) {
+    hash_del(prefetched_manifests, (char *)url);
+  }
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.prefetched);
+#endif
+
+  return entry;
+}
+
+/**
+ * Drop the prefetched answers for `urls` that were never used and free
+ * the list.
+ */
+
+static void forget_prefetched_manifests(list_t *urls) {
+  list_node_t *node = NULL;
+
+  if (!urls) {
+    return;
+  }
+
+  list_each(urls, node) {
+    prefetched_manifest_t *entry = take_prefetched_manifest(node->val);
+    if (entry) {
+      http_get_free(entry->res);
+      free(entry->url);
+      free(entry);
+    }
+  }
+
+  list_destroy(urls);
+}
+
+/**
+ * Pick the URL `fetch` should be requested from next: the first healthy
+ * mirror after the current one that can serve it, or else the origin,
+ * unless only mirrors may be asked.
+ */
+
+static char *fetch_package_file_next_url(fetch_package_file_data_t *fetch) {
+  char *url = NULL;
+
+  while (-1 != (fetch->mirror = clib_mirror_next(fetch->mirror))) {
+    if ((url = clib_mirror_url(fetch->origin, fetch->mirror))) {
+      return url;
+    }
+  }
+
+  return clib_mirror_only() ? NULL : strdup(fetch->origin);
+}
+
+/**
+ * Logs that the file of `fetch` was fetched into `path` as `log`, unless
+ * the progress reports stand in for it, or that it wasn't when not `ok`.
+ */
+
+static void log_fetched(fetch_package_file_data_t *fetch, int ok,
+                        const char *log, const char *path) {
+  if (ok ? !log_files(fetch->verbose) : !fetch->verbose) {
+    return;
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock.output);
+#endif
+
+  if (!ok) {
+    logger_error("error", "unable to fetch %s:%s", fetch->pkg->repo,
+                 fetch->file);
+    fflush(stderr);
+  } else {
+    logger_info(log, path);
+    fflush(stdout);
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.output);
+#endif
+}
+
+static void fetch_package_file_done(int rc, const char *url, const char *path,
+                                    const char *etag, void *arg) {
+  fetch_package_file_data_t *fetch = arg;
+  char hash[CLIB_HASH_HEX_SIZE];
+  char *next = NULL;
+
+  // fail over to the next mirror, and finally to the origin
+  if (-1 != fetch->mirror) {
+    clib_mirror_report(fetch->mirror, 0 == rc);
+
+    if (0 != rc && (next = fetch_package_file_next_url(fetch))) {
+      _debug_file("retry %s from %s", fetch->file, next);
+      COUNT(totals.retries, 1);
+      rc = clib_download_add(downloads, next, path, fetch_package_file_done,
+                             fetch);
+      free(next);
+      if (0 == rc) {
+        return;
+      }
+    }
+  }
+
+  if (0 == rc && (lockfile || fetch->pkg->src) &&
+      0 == clib_hash_file(path, hash)) {
+    // what it was served as makes the next refetch a conditional request
+    if (lockfile && fetch->pkg->slug) {
+      clib_lockfile_set_source(lockfile, fetch->pkg->slug, fetch->file, hash,
+                               etag);
+    }
+
+    // the files of a package saved as fetched go to the store as they
+    // arrive, linked to it rather than copied there by the save
+    if (!opts.skip_cache && fetch->pkg->src && saved_as_fetched(fetch->pkg)) {
+      clib_cache_store_file(path, hash);
+    }
+  }
+
+  if (0 != rc) {
+    (void)(*fetch->failures)++;
+  }
+
+  log_fetched(fetch, 0 == rc, "save", path);
+  free(fetch->origin);
+  free(fetch);
+}
+
+/**
+ * Queue a file associated with the given `pkg` on the download engine.
+ * Failed downloads are counted in `failures` once the engine is drained
+ * with `clib_download_wait()`. A file that is there already is left as it
+ * is, unless forced, when it is revalidated with the ETag it was served
+ * with if the lockfile records one.
+ *
+ * Returns 0 on success.
+ */
+
+static int fetch_package_file(clib_package_t *pkg, const char *dir, char *file,
+                              int verbose, int *failures) {
+  fetch_package_file_data_t *fetch = NULL;
+  clib_download_t *engine = NULL;
+  char *hash = NULL;
+  char *etag = NULL;
+  char *url = NULL;
+  char *path = NULL;
+  int rc = 0;
+
+  if (NULL == pkg) {
+    return 1;
+  }
+
+  _debug_file("fetch file: %s/%s", pkg->repo, file);
+
+  if (NULL == pkg->url) {
     return 1;
   }
 
@@ -934,155 +2444,709 @@ static int fetch_package_file_work(clib_package_t *pkg, const char *dir,
     return 1;
   }
 
-  _debug("file URL: %s", url);
+  _debug_file("file URL: %s", url);
+
+  if (!(path = path_join(dir, basename(file)))) {
+    rc = 1;
+    goto cleanup;
+  }
+
+  if (0 == fs_exists(path)) {
+    if (0 == opts.force) {
+      goto cleanup;
+    }
+
+    if (0 == clib_lockfile_source(lockfile, pkg->slug, file, &hash, &etag) &&
+        etag) {
+      rc = sync_package_file(pkg, dir, file, verbose, failures);
+      goto cleanup;
+    }
+  }
+
+  if (!(engine = get_downloads())) {
+    rc = 1;
+    goto cleanup;
+  }
+
+  if (!(fetch = malloc(sizeof(fetch_package_file_data_t)))) {
+    rc = 1;
+    goto cleanup;
+  }
+
+  fetch->pkg = pkg;
+  fetch->file = file;
+  fetch->origin = url;
+  fetch->mirror = -1;
+  fetch->verbose = verbose;
+  fetch->failures = failures;
+  fetch->path = NULL;
+  fetch->hash = NULL;
+  fetch->etag = NULL;
+  url = NULL;
+
+  if (!(url = fetch_package_file_next_url(fetch))) {
+    free(fetch->origin);
+    free(fetch);
+    rc = 1;
+    goto cleanup;
+  }
+
+  if (log_files(verbose)) {
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&lock.output);
+#endif
+    logger_info("fetch", "%s:%s", pkg->repo, file);
+    fflush(stdout);
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&lock.output);
+#endif
+  }
+
+  if (0 != clib_download_add(engine, url, path, fetch_package_file_done,
+                             fetch)) {
+    free(fetch->origin);
+    free(fetch);
+    rc = 1;
+  }
+
+cleanup:
+  free(hash);
+  free(etag);
+  free(url);
+  free(path);
+  return rc;
+}
+
+static void sync_package_file_free(fetch_package_file_data_t *fetch) {
+  free(fetch->origin);
+  free(fetch->path);
+  free(fetch->hash);
+  free(fetch->etag);
+  free(fetch);
+}
+
+static void sync_package_file_done(http_get_response_t *res, const char *url,
+                                   void *arg) {
+  fetch_package_file_data_t *fetch = arg;
+  char hash[CLIB_HASH_HEX_SIZE];
+  const char *log = NULL;
+  char *next = NULL;
+  int ok = res && (res->ok || 304 == res->status);
+
+  // fail over to the next mirror, and finally to the origin
+  if (-1 != fetch->mirror) {
+    clib_mirror_report(fetch->mirror, ok);
+
+    if (!ok && (next = fetch_package_file_next_url(fetch))) {
+      _debug_file("retry %s from %s", fetch->file, next);
+      COUNT(totals.retries, 1);
+      http_get_free(res);
+      res = NULL;
+      ok = 0 == clib_download_get(downloads, next, fetch->etag, NULL,
+                                  sync_package_file_done, fetch);
+      free(next);
+      if (ok) {
+        return;
+      }
+    }
+  }
+
+  if (ok && 304 == res->status) {
+    log = "unchanged";
+  } else if (ok) {
+    clib_hash_buffer(res->data, res->size, hash);
+
+    // the same content is left as it is, and so is its mtime
+    if (fetch->hash && 0 == strcmp(hash, fetch->hash)) {
+      log = "unchanged";
+    } else {
+      // it may be hard linked to the cache store
+      unlink(fetch->path);
+      if (-1 == fs_nwrite(fetch->path, res->data, res->size)) {
+        ok = 0;
+      } else {
+        log = "save";
+      }
+    }
+
+    if (ok) {
+      clib_lockfile_set_source(lockfile, fetch->pkg->slug, fetch->file, hash,
+                               res->etag);
+    }
+  }
+
+  if (!ok) {
+    (void)(*fetch->failures)++;
+  }
+
+  log_fetched(fetch, ok, log, fetch->path);
+  http_get_free(res);
+  sync_package_file_free(fetch);
+}
+
+/**
+ * Queue a request for a file of `pkg` that was installed in `dir` before,
+ * which is written only if its content changed. The request is
+ * conditional when the file is still as it was installed, so that an
+ * unchanged file isn't even downloaded.
+ *
+ * Returns 0 on success.
+ */
+
+static int sync_package_file(clib_package_t *pkg, const char *dir, char *file,
+                             int verbose, int *failures) {
+  fetch_package_file_data_t *fetch = NULL;
+  char hash[CLIB_HASH_HEX_SIZE];
+  char *installed = NULL;
+  char *url = NULL;
+  int rc = 0;
+
+  if (!(fetch = malloc(sizeof(fetch_package_file_data_t)))) {
+    return 1;
+  }
+
+  memset(fetch, 0, sizeof(fetch_package_file_data_t));
+  fetch->pkg = pkg;
+  fetch->file = file;
+  fetch->mirror = -1;
+  fetch->verbose = verbose;
+  fetch->failures = failures;
+
+  if (0 == strncmp(file, "http", 4)) {
+    fetch->origin = strdup(file);
+  } else {
+    fetch->origin = clib_package_file_url(pkg->url, file);
+  }
+
+  if (!fetch->origin || !(fetch->path = path_join(dir, basename(file)))) {
+    rc = 1;
+    goto cleanup;
+  }
+
+  if (0 == clib_hash_file(fetch->path, hash)) {
+    fetch->hash = strdup(hash);
+  }
+
+  clib_lockfile_source(lockfile, pkg->slug, file, &installed, &fetch->etag);
+
+  // what was edited since is fetched whole, to be put back
+  if (!installed || !fetch->hash || 0 != strcmp(installed, fetch->hash)) {
+    free(fetch->etag);
+    fetch->etag = NULL;
+  }
+
+  if (!(url = fetch_package_file_next_url(fetch))) {
+    rc = 1;
+    goto cleanup;
+  }
+
+  _debug_file("sync file: %s/%s", pkg->repo, file);
+
+  if (0 != clib_download_get(get_downloads(), url, fetch->etag, NULL,
+                             sync_package_file_done, fetch)) {
+    rc = 1;
+  } else {
+    fetch = NULL;
+  }
+
+cleanup:
+  if (fetch) {
+    sync_package_file_free(fetch);
+  }
+  free(installed);
+  free(url);
+  return rc;
+}
+
+/**
+ * Brings the sources of `pkg` in `dir` up to date file by file, when its
+ * lockfile entry records what was installed of them.
+ *
+ * Returns 0 on success, 1 when nothing is recorded, -1 on error.
+ */
+
+static int sync_package_files(clib_package_t *pkg, const char *dir,
+                              int verbose) {
+  list_iterator_t iterator;
+  list_node_t *node = NULL;
+  char *hash = NULL;
+  char *etag = NULL;
+  int recorded = 0;
+  int failures = 0;
+  int rc = 0;
+
+  if (!lockfile || !pkg->slug || !pkg->src || !get_downloads()) {
+    return 1;
+  }
+
+  list_iterator_init(&iterator, pkg->src, LIST_HEAD);
+
+  while (!recorded && (node = list_iterator_next(&iterator))) {
+    recorded = 0 == clib_lockfile_source(lockfile, pkg->slug, node->val,
+                                         &hash, &etag);
+    free(hash);
+    free(etag);
+  }
+
+  if (!recorded) {
+    return 1;
+  }
+
+  list_iterator_init(&iterator, pkg->src, LIST_HEAD);
+
+  while (0 == rc && (node = list_iterator_next(&iterator))) {
+    rc = sync_package_file(pkg, dir, node->val, verbose, &failures);
+  }
+
+  // queued requests reference the counter on this stack frame
+  clib_download_wait(downloads);
+
+  return 0 == rc && 0 == failures ? 0 : -1;
+}
+
+/**
+ * Records the hashes of the sources of `pkg` as installed in `dir`, for
+ * the next install to sync them. The ETag a file was downloaded with is
+ * kept as long as the file is what was downloaded.
+ */
+
+static void record_package_files(clib_package_t *pkg, const char *dir) {
+  list_node_t *node = NULL;
+  char hash[CLIB_HASH_HEX_SIZE];
+
+  if (!lockfile || !pkg->slug || !pkg->src) {
+    return;
+  }
+
+  list_each(pkg->src, node) {
+    char *path = path_join(dir, basename(node->val));
+    char *recorded = NULL;
+    char *etag = NULL;
+
+    if (path && 0 == clib_hash_file(path, hash)) {
+      clib_lockfile_source(lockfile, pkg->slug, node->val, &recorded, &etag);
+      if (!recorded || 0 != strcmp(recorded, hash)) {
+        free(etag);
+        etag = NULL;
+      }
+
+      clib_lockfile_set_source(lockfile, pkg->slug, node->val, hash, etag);
+    }
+
+    free(recorded);
+    free(etag);
+    free(path);
+  }
+}
+
+#ifdef HAVE_ZLIB
+typedef struct {
+  clib_archive_t *archive;
+  size_t received;
+  size_t budget;
+} fetch_package_archive_data_t;
+
+static int fetch_package_archive_chunk(const char *buffer, size_t size,
+                                       void *data) {
+  fetch_package_archive_data_t *fetch = data;
+
+  fetch->received += size;
+  if (fetch->received > fetch->budget) {
+    return -1;
+  }
+
+  return clib_archive_write(fetch->archive, buffer, size);
+}
+#endif
+
+/**
+ * Fetch the sources of `pkg` that `fetch_package_file()` would, with a
+ * single request for the tarball of its repository, when there are enough
+ * of them. Only the sources are extracted, and the download stops once
+ * they are, or once it costs more than the requests it replaces.
+ *
+ * Returns 0 when every source was fetched.
+ */
+
+static int fetch_package_archive(clib_package_t *pkg, const char *dir,
+                                 int verbose) {
+#ifdef HAVE_ZLIB
+  fetch_package_archive_data_t fetch = {0};
+  http_get_response_t *res = NULL;
+  list_node_t *source = NULL;
+  list_t *paths = NULL;
+  char *url = NULL;
+  int rc = -1;
+
+  // mirrors and private repositories are only served file by file
+  if (opts.token || 0 != clib_mirror_count() || NULL == pkg->url ||
+      0 != strncmp(pkg->url, GITHUB_CONTENT_URL,
+                   strlen(GITHUB_CONTENT_URL)) ||
+      pkg->src->len < CLIB_PACKAGE_ARCHIVE_MIN_FILES) {
+    return -1;
+  }
+
+  if (!(fetch.archive = clib_archive_new(dir)) || !(paths = list_new())) {
+    goto cleanup;
+  }
+
+  paths->free = free;
+
+  list_each(pkg->src, source) {
+    char *path = NULL;
+
+    if (0 == strncmp(source->val, "http", 4)) {
+      goto cleanup;
+    }
+
+    if (!(path = path_join(dir, basename(source->val)))) {
+      goto cleanup;
+    }
+
+    if (0 == opts.force && 0 == fs_exists(path)) {
+      free(path);
+      continue;
+    }
+
+    if (!list_rpush(paths, list_node_new(path))) {
+      free(path);
+      goto cleanup;
+    }
+
+    if (0 != clib_archive_select(fetch.archive, source->val, path)) {
+      goto cleanup;
+    }
+  }
+
+  if (paths->len < CLIB_PACKAGE_ARCHIVE_MIN_FILES) {
+    goto cleanup;
+  }
+
+  if (-1 == asprintf(&url, GITHUB_ARCHIVE_URL, pkg->author, pkg->repo_name,
+                     pkg->version)) {
+    url = NULL;
+    goto cleanup;
+  }
+
+  if (verbose) {
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&lock.output);
+#endif
+    logger_info("fetch", "%s (%u files)", url, paths->len);
+    fflush(stdout);
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&lock.output);
+#endif
+  }
+
+#ifdef HAVE_PTHREADS
+  init_curl_share();
+#endif
+
+  fetch.budget = paths->len * CLIB_PACKAGE_ARCHIVE_REQUEST_COST;
+  res = http_get_stream_shared(url, clib_package_curl_share,
+                               fetch_package_archive_chunk, &fetch);
+
+  // the transfer is cut short once the sources are extracted
+  rc = res && 0 == clib_archive_finish(fetch.archive) ? 0 : -1;
+
+  _debug("archive %s: %d (%zu bytes)", url, rc, fetch.received);
+
+  // don't leave partial sources for the file by file fetch to skip
+  list_each(paths, source) {
+    if (0 != rc) {
+      unlink(source->val);
+    } else if (log_files(verbose)) {
+#ifdef HAVE_PTHREADS
+      pthread_mutex_lock(&lock.output);
+#endif
+      logger_info("save", source->val);
+      fflush(stdout);
+#ifdef HAVE_PTHREADS
+      pthread_mutex_unlock(&lock.output);
+#endif
+    }
+  }
+
+cleanup:
+  if (paths) {
+    list_destroy(paths);
+  }
+  clib_archive_free(fetch.archive);
+  http_get_free(res);
+  free(url);
+  return rc;
+#else
+  return -1;
+#endif
+}
+
+/**
+ * Fetch the sources of `pkg`, or its whole tree when `sources` is 0, into
+ * `dir` from its repository with git, when `opts.git` is set. Every
+ * version of the package shares a bare repository in the cache, so a new
+ * one only transfers the objects that changed.
+ *
+ * Returns 0 when everything was fetched.
+ */
+
+static int fetch_package_git(clib_package_t *pkg, const char *dir,
+                             int sources, int verbose) {
+  list_node_t *source = NULL;
+  char *repo = NULL;
+  char *url = NULL;
+  int repo_lock = -1;
+  int rc = -1;
+
+  // mirrors and private repositories are only served over http
+  if (!opts.git || opts.token || 0 != clib_mirror_count() ||
+      NULL == pkg->url || NULL == pkg->author || NULL == pkg->repo_name ||
+      0 != strncmp(pkg->url, GITHUB_CONTENT_URL,
+                   strlen(GITHUB_CONTENT_URL)) ||
+      (sources && NULL == pkg->src) || !clib_git_available()) {
+    return -1;
+  }
+
+  if (sources) {
+    list_each(pkg->src, source) {
+      if (0 == strncmp(source->val, "http", 4)) {
+        return -1;
+      }
+    }
+  }
+
+  if (-1 == asprintf(&url, GITHUB_GIT_URL, pkg->author, pkg->repo_name)) {
+    return -1;
+  }
 
-  if (!(path = path_join(dir, basename(file)))) {
-    rc = 1;
-    goto cleanup;
+  if (!(repo = clib_cache_git_repo(pkg->author, pkg->repo_name))) {
+    free(url);
+    return -1;
   }
 
+  if (verbose) {
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&lock.output);
+#endif
+    logger_info("fetch", "%s@%s (git)", url, pkg->version);
+    fflush(stdout);
 #ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&lock.mutex);
+    pthread_mutex_unlock(&lock.output);
 #endif
+  }
 
-  if (1 == opts.force || -1 == fs_exists(path)) {
-    if (verbose) {
-      logger_info("fetch", "%s:%s", pkg->repo, file);
-      fflush(stdout);
+  repo_lock = clib_cache_lock_git(pkg->author, pkg->repo_name);
+  rc = clib_git_checkout(repo, url, pkg->version, sources ? pkg->src : NULL,
+                         dir);
+  clib_cache_unlock_git(repo_lock);
+
+  _debug("git %s@%s: %d", url, pkg->version, rc);
+
+  free(repo);
+  free(url);
+  return rc;
+}
+
+/**
+ * The `PREFIX` of the commands of `pkg`, from the options or else its
+ * manifest, making the directory. It goes into the environment of each
+ * command rather than of the process, which other threads are installing
+ * other packages in.
+ *
+ * @return A new `PREFIX=` entry, or NULL when there is no prefix
+ */
+
+static char *prefix_env(clib_package_t *pkg, long path_max) {
+  char *entry = NULL;
+
+  if (NULL != opts.prefix || NULL != pkg->prefix) {
+    char path[path_max];
+    memset(path, 0, path_max);
+
+    if (opts.prefix) {
+      realpath(opts.prefix, path);
+    } else {
+      realpath(pkg->prefix, path);
     }
 
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
-#endif
+    _debug("env: PREFIX: %s", path);
+    clib_mkdirp(path, 0777);
 
-    rc = http_get_file_shared(url, path, clib_package_curl_share);
-    saved = 1;
-  } else {
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
-#endif
+    if (-1 == asprintf(&entry, "PREFIX=%s", path)) {
+      entry = NULL;
+    }
   }
 
-  if (-1 == rc) {
-    if (verbose) {
-#ifdef HAVE_PTHREADS
-      pthread_mutex_lock(&lock.mutex);
-#endif
-      logger_error("error", "unable to fetch %s:%s", pkg->repo, file);
-      fflush(stderr);
-      rc = 1;
+  return entry;
+}
+
+/**
+ * Download the tarball at `url` into `file`, resuming a partial download
+ * and retrying with jittered exponential backoff up to `opts.retries`
+ * times.
+ *
+ * Returns 0 on success.
+ */
+
+static int fetch_tarball(const char *url, const char *file, int verbose) {
+  int rc = -1;
+
 #ifdef HAVE_PTHREADS
-      pthread_mutex_unlock(&lock.mutex);
+  init_curl_share();
 #endif
-      goto cleanup;
+
+  for (int attempt = 0; attempt <= opts.retries; attempt++) {
+    if (attempt > 0) {
+      if (verbose) {
+        logger_warn("retry", "%s (%d/%d)", url, attempt, opts.retries);
+      }
+      COUNT(totals.retries, 1);
+      usleep(1000 * clib_retry_backoff(attempt));
+    }
+
+    rc = http_get_file_resume_shared(url, file, clib_package_curl_share);
+    if (0 == rc) {
+      break;
     }
   }
 
-  if (saved) {
-    if (verbose) {
-#ifdef HAVE_PTHREADS
-      pthread_mutex_lock(&lock.mutex);
-#endif
-      logger_info("save", path);
-      fflush(stdout);
+  return rc;
+}
+
+#ifdef HAVE_ZLIB
+static int extract_tarball_chunk(const char *buffer, size_t size,
+                                 void *data) {
+  return clib_archive_write(data, buffer, size);
+}
+
+/**
+ * Download the tarball at `url` and extract it into `dir` as it arrives
+ */
+
+static int fetch_archive(const char *url, const char *dir, int verbose) {
+  clib_retry_class_t kind = CLIB_RETRY_OK;
+  int rc = -1;
+
 #ifdef HAVE_PTHREADS
-      pthread_mutex_unlock(&lock.mutex);
+  init_curl_share();
 #endif
+
+  for (int attempt = 0; attempt <= opts.retries; attempt++) {
+    clib_archive_t *archive = NULL;
+    http_get_response_t *res = NULL;
+
+    if (attempt > 0) {
+      if (verbose) {
+        logger_warn("retry", "%s (%d/%d)", url, attempt, opts.retries);
+      }
+      COUNT(totals.retries, 1);
+      usleep(1000 * clib_retry_backoff(attempt));
     }
-  }
 
-cleanup:
+    if (!(archive = clib_archive_new(dir))) {
+      return -1;
+    }
+
+    res = http_get_stream_shared(url, clib_package_curl_share,
+                                 extract_tarball_chunk, archive);
+    rc = res && res->ok && 0 == clib_archive_finish(archive) ? 0 : -1;
+    kind = clib_retry_classify(res ? res->code : -1, res ? res->status : 0);
+
+    http_get_free(res);
+    clib_archive_free(archive);
+
+    // a missing tarball stays missing
+    if (0 == rc || !clib_retry_again(kind, attempt + 1)) {
+      break;
+    }
+  }
 
-  free(url);
-  free(path);
   return rc;
 }
+#endif
 
-#ifdef HAVE_PTHREADS
-static void *fetch_package_file_thread(void *arg) {
-  fetch_package_file_thread_data_t *data = arg;
-  int *status = malloc(sizeof(int));
-  int rc =
-      fetch_package_file_work(data->pkg, data->dir, data->file, data->verbose);
-  *status = rc;
-  (void)data->pkg->refs--;
-  pthread_exit((void *)status);
-  return (void *)(intptr_t)rc;
+/**
+ * @return 1 if `url` is a gzip compressed tarball, going by its name
+ */
+
+static int is_tarball_url(const char *url) {
+  const char *end = url + strcspn(url, "?#");
+  size_t len = end - url;
+
+  return (len > 7 && 0 == strncmp(end - 7, ".tar.gz", 7)) ||
+         (len > 4 && 0 == strncmp(end - 4, ".tgz", 4));
 }
-#endif
 
 /**
- * Fetch a file associated with the given `pkg`.
+ * Download the prebuilt binary of `pkg` for this platform and place it
+ * into the prefix, a tarball extracted into it as it is and a lone file
+ * as `bin/<name>`, once it matches the SHA-256 of its manifest.
  *
- * Returns 0 on success.
+ * Returns 0 on success, -1 to build the package from source instead.
  */
 
-static int fetch_package_file(clib_package_t *pkg, const char *dir, char *file,
-                              int verbose, void **data) {
-#ifndef HAVE_PTHREADS
-  return fetch_package_file_work(pkg, dir, file, verbose);
-#else
-  fetch_package_file_thread_data_t *fetch = malloc(sizeof(*fetch));
-  int rc = 0;
+static int install_binary(clib_package_t *pkg, const char *tmp,
+                          int verbose) {
+  char hash[CLIB_HASH_HEX_SIZE];
+  char *prefix = NULL;
+  char *file = NULL;
+  char *bin = NULL;
+  char *target = NULL;
+  uint64_t started = clib_trace_clock();
+  int rc = -1;
 
-  if (0 == fetch) {
+  if (!pkg->binary || !pkg->binary_sha256 || !pkg->name) {
     return -1;
   }
 
-  *data = 0;
+  prefix = opts.prefix ? opts.prefix
+           : pkg->prefix ? pkg->prefix
+                         : CLIB_PACKAGE_BINARY_PREFIX;
 
-  memset(fetch, 0, sizeof(*fetch));
-
-  fetch->pkg = pkg;
-  fetch->dir = dir;
-  fetch->file = file;
-  fetch->verbose = verbose;
+  if (-1 == asprintf(&file, "%s/%s-%s-%s.bin", tmp, pkg->name, pkg->version,
+                     clib_manifest_platform())) {
+    return -1;
+  }
 
-  rc = pthread_attr_init(&fetch->attr);
+  if (verbose) {
+    logger_info("fetch", "%s (%s)", pkg->binary, clib_manifest_platform());
+  }
 
-  if (0 != rc) {
-    free(fetch);
-    return rc;
+  if (0 != fetch_tarball(pkg->binary, file, verbose) ||
+      0 != clib_hash_file(file, hash)) {
+    goto cleanup;
   }
 
-  (void)pkg->refs++;
-  rc = pthread_create(&fetch->thread, NULL, fetch_package_file_thread, fetch);
+  if (0 != strcasecmp(hash, pkg->binary_sha256)) {
+    if (verbose) {
+      logger_warn("warning", "checksum mismatch for '%s', building it",
+                  pkg->binary);
+    }
+    goto cleanup;
+  }
 
-  if (0 != rc) {
-    pthread_attr_destroy(&fetch->attr);
-    free(fetch);
-    return rc;
+  if (is_tarball_url(pkg->binary)) {
+    rc = clib_archive_extract(file, prefix);
+  } else if (-1 != asprintf(&bin, "%s/bin", prefix) &&
+             -1 != asprintf(&target, "%s/%s", bin, pkg->name) &&
+             0 == clib_mkdirp(bin, 0777) && 0 == copy_file(file, target)) {
+    rc = chmod(target, 0755);
   }
 
-  rc = pthread_attr_destroy(&fetch->attr);
+  _debug("binary %s: %d", pkg->binary, rc);
 
-  if (0 != rc) {
-    pthread_cancel(fetch->thread);
-    free(fetch);
-    return rc;
+  if (0 == rc && verbose) {
+    logger_info("install", "%s (prebuilt)", pkg->repo ? pkg->repo : pkg->name);
   }
 
-  *data = fetch;
+  clib_trace_span("build", "binary", pkg->name, started, "\"rc\":%d", rc);
 
+cleanup:
+  unlink(file);
+  free(target);
+  free(bin);
+  free(file);
   return rc;
-#endif
-}
-
-static void set_prefix(clib_package_t *pkg, long path_max) {
-  if (NULL != opts.prefix || NULL != pkg->prefix) {
-    char path[path_max];
-    memset(path, 0, path_max);
-
-    if (opts.prefix) {
-      realpath(opts.prefix, path);
-    } else {
-      realpath(pkg->prefix, path);
-    }
-
-    _debug("env: PREFIX: %s", path);
-    setenv("PREFIX", path, 1);
-    mkdirp(path, 0777);
-  }
 }
 
 int clib_package_install_executable(clib_package_t *pkg, const char *dir,
@@ -1099,11 +3163,15 @@ int clib_package_install_executable(clib_package_t *pkg, const char *dir,
   char *url = NULL;
   char *file = NULL;
   char *tarball = NULL;
-  char *command = NULL;
+  char *source = NULL;
+  char *target = NULL;
   char *unpack_dir = NULL;
   char *deps = NULL;
   char *tmp = NULL;
   char *reponame = NULL;
+  char *env[3] = {NULL, NULL, NULL};
+  clib_spawn_opts_t spawn = {0};
+  uint64_t started = 0;
   char dir_path[path_max];
 
   _debug("install executable %s", pkg->repo);
@@ -1135,6 +3203,12 @@ int clib_package_install_executable(clib_package_t *pkg, const char *dir,
     return -1;
   }
 
+  // falls back to building it from source
+  if (0 == install_binary(pkg, tmp, verbose)) {
+    rc = 0;
+    goto cleanup;
+  }
+
   E_FORMAT(&url, "https://github.com/%s/archive/%s.tar.gz", pkg->repo,
            pkg->version);
 
@@ -1142,7 +3216,33 @@ int clib_package_install_executable(clib_package_t *pkg, const char *dir,
 
   E_FORMAT(&tarball, "%s/%s", tmp, file);
 
-  rc = http_get_file_shared(url, tarball, clib_package_curl_share);
+  _debug("download url: %s", url);
+  _debug("file: %s", file);
+  _debug("tarball: %s", tarball);
+
+  char *version = pkg->version;
+  if ('v' == version[0]) {
+    (void)version++;
+  }
+
+  // where the tarball unpacks to
+  E_FORMAT(&unpack_dir, "%s/%s-%s", tmp, reponame, version);
+
+  _debug("dir: %s", unpack_dir);
+
+  if (0 == (rc = fetch_package_git(pkg, unpack_dir, 0, verbose))) {
+    goto fetched;
+  }
+
+#ifdef HAVE_ZLIB
+  // extracted as it downloads, the tarball never lands on disk
+  rc = fetch_archive(url, tmp, verbose);
+#else
+  rc = fetch_tarball(url, tarball, verbose);
+  if (0 == rc) {
+    rc = clib_archive_extract(tarball, tmp);
+  }
+#endif
 
   if (0 != rc) {
     if (verbose) {
@@ -1153,22 +3253,16 @@ int clib_package_install_executable(clib_package_t *pkg, const char *dir,
     goto cleanup;
   }
 
-  E_FORMAT(&command, "cd %s && gzip -dc %s | tar x", tmp, file);
-
-  _debug("download url: %s", url);
-  _debug("file: %s", file);
-  _debug("tarball: %s", tarball);
-  _debug("command(extract): %s", command);
-
-  // cheap untar
-  rc = system(command);
-  if (0 != rc)
-    goto cleanup;
+fetched:
 
-  free(command);
-  command = NULL;
+  // clib-uninstall runs the uninstall target of this tree
+  if (pkg->author) {
+    clib_cache_save_executable(pkg->author, reponame, pkg->version,
+                               unpack_dir);
+  }
 
-  set_prefix(pkg, path_max);
+  env[0] = prefix_env(pkg, path_max);
+  spawn.env = env;
 
   const char *configure = pkg->configure;
 
@@ -1179,15 +3273,6 @@ int clib_package_install_executable(clib_package_t *pkg, const char *dir,
   memset(dir_path, 0, path_max);
   realpath(dir, dir_path);
 
-  char *version = pkg->version;
-  if ('v' == version[0]) {
-    (void)version++;
-  }
-
-  E_FORMAT(&unpack_dir, "%s/%s-%s", tmp, reponame, version);
-
-  _debug("dir: %s", unpack_dir);
-
   if (pkg->dependencies) {
     E_FORMAT(&deps, "%s/deps", unpack_dir);
     _debug("deps: %s", deps);
@@ -1197,42 +3282,48 @@ int clib_package_install_executable(clib_package_t *pkg, const char *dir,
   }
 
   if (!opts.global && pkg->makefile) {
-    E_FORMAT(&command, "cp -fr %s/%s/%s %s", dir_path, pkg->name,
-             basename(pkg->makefile), unpack_dir);
+    char *makefile = basename(pkg->makefile);
 
-    rc = system(command);
+    E_FORMAT(&source, "%s/%s/%s", dir_path, pkg->name, makefile);
+    E_FORMAT(&target, "%s/%s", unpack_dir, makefile);
+
+    rc = copy_file(source, target);
     if (0 != rc) {
       goto cleanup;
     }
-
-    free(command);
   }
 
   if (pkg->flags) {
-    char *flags = NULL;
 #ifdef _GNU_SOURCE
     char *cflags = secure_getenv("CFLAGS");
 #else
     char *cflags = getenv("CFLAGS");
 #endif
 
+    // only the install command of this package sees its flags
+    char **entry = env[0] ? &env[1] : &env[0];
     if (cflags) {
-      asprintf(&flags, "%s %s", cflags, pkg->flags);
+      E_FORMAT(entry, "CFLAGS=%s %s", cflags, pkg->flags);
     } else {
-      asprintf(&flags, "%s", pkg->flags);
+      E_FORMAT(entry, "CFLAGS=%s", pkg->flags);
     }
-
-    setenv("CFLAGS", cflags, 1);
   }
 
-  E_FORMAT(&command, "cd %s && %s", unpack_dir, pkg->install);
-
-  _debug("command(install): %s", command);
-  rc = system(command);
+  _debug("command(install): %s in %s", pkg->install, unpack_dir);
+  spawn.dir = unpack_dir;
+  started = clib_trace_clock();
+  rc = clib_spawn_shell(pkg->install, &spawn);
+  COUNT_SINCE(totals.build_us, started);
+  clib_trace_span("build", "install", pkg->name, started, "\"rc\":%d", rc);
 
 cleanup:
   free(tmp);
-  free(command);
+  free(source);
+  free(target);
+  free(env[0]);
+  free(env[1]);
+  free(unpack_dir);
+  free(deps);
   free(tarball);
   free(file);
   free(url);
@@ -1240,17 +3331,174 @@ cleanup:
 }
 
 /**
- * Install the given `pkg` in `dir`
+ * Runs the makefile of `pkg` installed in `dir`, like `clib build` would,
+ * as soon as its files and its dependencies are in place, with `env` on
+ * top of the environment. The compiler flags are left to the caller,
+ * which knows where the headers are.
  */
 
-int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
-  list_iterator_t *iterator = NULL;
+static int build_package(clib_package_t *pkg, const char *dir,
+                         char *const *env, int verbose) {
+  clib_spawn_opts_t spawn = {0};
+  char *argv[] = {"make", "-C", NULL, "-f", NULL, NULL};
+  char *command = NULL;
+  uint64_t started = 0;
+  int rc = 0;
+
+  if (opts.global || NULL == pkg->makefile) {
+    return 0;
+  }
+
+  E_FORMAT(&command, "%s/%s", dir, pkg->name);
+  argv[2] = command;
+  argv[4] = basename(pkg->makefile);
+
+  if (verbose) {
+    logger_warn("build", "%s: %s", pkg->name, pkg->makefile);
+  }
+
+  _debug("command(build): make -C %s -f %s", argv[2], argv[4]);
+  started = clib_trace_clock();
+  spawn.env = env;
+  rc = clib_spawn(argv, &spawn);
+  COUNT_SINCE(totals.build_us, started);
+  clib_trace_span("build", "make", pkg->name, started, "\"rc\":%d", rc);
+
+  if (0 == rc) {
+    clib_timings_record("build", pkg->name, clib_trace_clock() - started);
+  }
+
+  if (0 != rc && verbose) {
+    logger_error("error", "Failed to build %s", pkg->name);
+  }
+
+cleanup:
+  free(command);
+  return rc;
+}
+
+/**
+ * @return 1 if the sources of `pkg` would be fetched in one request, as a
+ * shallow git checkout or an archive of the repository, 0 otherwise
+ */
+
+static int fetches_at_once(clib_package_t *pkg) {
+  if (opts.token || 0 != clib_mirror_count() || NULL == pkg->url ||
+      0 != strncmp(pkg->url, GITHUB_CONTENT_URL, strlen(GITHUB_CONTENT_URL))) {
+    return 0;
+  }
+
+  if (opts.git && pkg->author && pkg->repo_name && clib_git_available()) {
+    return 1;
+  }
+
+#ifdef HAVE_ZLIB
+  return pkg->src->len >= CLIB_PACKAGE_ARCHIVE_MIN_FILES;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Records what installing `pkg` would do, from the caches and its
+ * manifest, instead of doing it.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int plan_package(clib_package_t *pkg) {
+  clib_package_plan_t plan = {0};
+  int sources = 0;
+
+  if (!pkg->author || !pkg->name ||
+      !(plan.slug = clib_package_slug(pkg->author, pkg->name, pkg->version))) {
+    return -1;
+  }
+
+  if (!opts.global && pkg->src) {
+    sources = pkg->src->len;
+    plan.cached = !opts.skip_cache &&
+                  clib_cache_has_package(pkg->author, pkg->name, pkg->version);
+    plan.size = clib_cache_package_size(pkg->author, pkg->name, pkg->version,
+                                        &plan.exact);
+  }
+
+  plan.files = sources;
+
+  if (sources && !plan.cached) {
+    plan.requests = fetches_at_once(pkg) ? 1 : sources;
+  }
+
+  if (!opts.global && pkg->makefile && !(opts.prefetch_only && plan.cached)) {
+    plan.files++;
+    plan.requests++;
+  }
+
+  if (!opts.prefetch_only) {
+    plan.configure = NULL != pkg->configure;
+    plan.install = NULL != pkg->install;
+    plan.binary = plan.install && pkg->binary && pkg->binary_sha256;
+    plan.build = opts.build && !opts.global && NULL != pkg->makefile;
+    // the tarball or binary, or a checkout of the whole repository
+    plan.requests += plan.install;
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock.plans);
+#endif
+
+  if (plans_count == plans_size) {
+    size_t size = plans_size ? 2 * plans_size : 16;
+    clib_package_plan_t *grown = realloc(plans, size * sizeof(*plans));
+
+    if (!grown) {
+#ifdef HAVE_PTHREADS
+      pthread_mutex_unlock(&lock.plans);
+#endif
+      free(plan.slug);
+      return -1;
+    }
+
+    plans = grown;
+    plans_size = size;
+  }
+
+  plans[plans_count++] = plan;
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.plans);
+#endif
+
+  return 0;
+}
+
+size_t clib_package_plan(const clib_package_plan_t **out) {
+  *out = plans;
+  return plans_count;
+}
+
+/**
+ * Install the given `pkg` in `dir`, and its dependencies when
+ * `with_dependencies` is set
+ */
+
+static int install_package(clib_package_t *pkg, const char *dir, int verbose,
+                           int with_dependencies) {
   char *package_json = NULL;
+  char *json = NULL;
   char *pkg_dir = NULL;
   char *command = NULL;
+  char *env[2] = {NULL, NULL};
+  uint64_t fetching = 0;
+  int makefile_failures = 0;
+  int fetch_lock = -1;
+  int failures = 0;
   int pending = 0;
+  int counted = 0;
   int rc = 0;
-  int i = 0;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t *package_lock = NULL;
+#endif
 
 #ifdef PATH_MAX
   long path_max = PATH_MAX;
@@ -1260,25 +3508,21 @@ int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
   long path_max = 4096;
 #endif
 
-#ifdef HAVE_PTHREADS
-  int max = opts.concurrency;
-#endif
-
 #ifdef CLIB_PACKAGE_PREFIX
   if (0 == opts.prefix) {
 #ifdef HAVE_PTHREADS
-    pthread_mutex_lock(&lock.mutex);
+    pthread_mutex_lock(&lock.init);
 #endif
     opts.prefix = CLIB_PACKAGE_PREFIX;
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
+    pthread_mutex_unlock(&lock.init);
 #endif
   }
 #endif
 
   if (0 == opts.prefix) {
 #ifdef HAVE_PTHREADS
-    pthread_mutex_lock(&lock.mutex);
+    pthread_mutex_lock(&lock.init);
 #endif
 #ifdef _GNU_SOURCE
     char *prefix = secure_getenv("PREFIX");
@@ -1290,83 +3534,74 @@ int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
       opts.prefix = prefix;
     }
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
+    pthread_mutex_unlock(&lock.init);
 #endif
   }
 
-  if (0 == visited_packages) {
-#ifdef HAVE_PTHREADS
-    pthread_mutex_lock(&lock.mutex);
-#endif
-
-    visited_packages = hash_new();
-    // initial write because sometimes `hash_set()` crashes
-    hash_set(visited_packages, strdup(""), "");
-
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
-#endif
+  if (0 == opts.force && pkg && pkg->name && mark_visited(dir, pkg->name)) {
+    return 0;
   }
 
-  if (0 == opts.force && pkg && pkg->name) {
-#ifdef HAVE_PTHREADS
-    pthread_mutex_lock(&lock.mutex);
-#endif
-
-    if (hash_has(visited_packages, pkg->name)) {
-#ifdef HAVE_PTHREADS
-      pthread_mutex_unlock(&lock.mutex);
-#endif
-      return 0;
-    }
-
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
-#endif
+  if (!pkg || !dir) {
+    rc = -1;
+    goto cleanup;
   }
 
-#ifdef HAVE_PTHREADS
-  fetch_package_file_thread_data_t **fetchs = 0;
-  if (NULL != pkg && NULL != pkg->src) {
-    if (pkg->src->len > 0) {
-      fetchs = malloc(pkg->src->len * sizeof(fetch_package_file_thread_data_t));
+  if (opts.plan) {
+    rc = plan_package(pkg);
+    if (0 == rc && with_dependencies) {
+      rc = clib_package_install_dependencies(pkg, dir, verbose);
     }
+    goto cleanup;
   }
 
-  if (fetchs) {
-    memset(fetchs, 0, pkg->src->len * sizeof(fetch_package_file_thread_data_t));
-  }
+  COUNT(progress.packages, 1);
+  counted = 1;
 
+#ifdef HAVE_PTHREADS
+  package_lock = cache_lock(pkg->author, pkg->name, pkg->version);
 #endif
 
-  if (!pkg || !dir) {
+  env[0] = prefix_env(pkg, path_max);
+
+  if (!(pkg_dir = path_join(dir, pkg->name))) {
     rc = -1;
     goto cleanup;
   }
 
-  set_prefix(pkg, path_max);
-
-  if (!(pkg_dir = path_join(dir, pkg->name))) {
-    rc = -1;
+  // `clib install --link` put the sources of a local package there, which
+  // are not to be overwritten
+  if (!opts.global && clib_link_is_link(pkg_dir)) {
+    if (verbose) {
+      logger_info("linked", pkg->repo);
+    }
     goto cleanup;
   }
 
   if (!opts.global) {
     _debug("mkdir -p %s", pkg_dir);
     // create directory for pkg
-    if (-1 == mkdirp(pkg_dir, 0777)) {
+    if (-1 == clib_mkdirp(pkg_dir, 0777)) {
       rc = -1;
       goto cleanup;
     }
   }
 
   if (NULL == pkg->url) {
-    pkg->url = clib_package_url(pkg->author, pkg->repo_name, pkg->version);
+    rc = -1;
+    goto cleanup;
+  }
 
-    if (NULL == pkg->url) {
-      rc = -1;
-      goto cleanup;
+  // an update leaves what didn't change as it is, but not what it needs
+  if (!opts.global && pkg->unchanged && 0 == fs_exists(pkg_dir)) {
+    if (verbose) {
+      logger_info("unchanged", pkg->repo);
     }
+    COUNT(totals.packages_unchanged, 1);
+    if (pkg->name) {
+      mark_visited(dir, pkg->name);
+    }
+    goto dependencies;
   }
 
   // write clib.json or package.json
@@ -1376,70 +3611,91 @@ int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
   }
 
   if (!opts.global && NULL != pkg->src) {
-    _debug("write: %s", package_json);
-    if (-1 == fs_write(package_json, pkg->json)) {
-      if (verbose) {
-        logger_error("error", "Failed to write %s", package_json);
-      }
+    char *installed = NULL;
 
+    if (!(json = clib_package_read_json(pkg))) {
       rc = -1;
       goto cleanup;
     }
+
+    // a manifest that didn't change keeps its mtime
+    if (!(installed = fs_read(package_json)) || 0 != strcmp(installed, json)) {
+      _debug("write: %s", package_json);
+      // a previous install may have hard linked it to the cache store
+      unlink(package_json);
+      if (-1 == fs_write(package_json, json)) {
+        if (verbose) {
+          logger_error("error", "Failed to write %s", package_json);
+        }
+
+        free(installed);
+        rc = -1;
+        goto cleanup;
+      }
+    }
+
+    free(installed);
+    free(json);
+    json = NULL;
   }
 
   if (pkg->name) {
+    mark_visited(dir, pkg->name);
+  }
+
+  fetching = clib_trace_clock();
+
+  // a warm cache is all a prefetch needs
+  if (opts.prefetch_only && !opts.skip_cache && NULL != pkg->src) {
+    int cached = 0;
 #ifdef HAVE_PTHREADS
-    pthread_mutex_lock(&lock.mutex);
+    pthread_mutex_lock(package_lock);
 #endif
-    if (!hash_has(visited_packages, pkg->name)) {
-      hash_set(visited_packages, strdup(pkg->name), "t");
-    }
+    cached = clib_cache_has_package(pkg->author, pkg->name, pkg->version);
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
+    pthread_mutex_unlock(package_lock);
 #endif
+
+    if (cached) {
+      if (verbose) {
+        logger_info("cached", pkg->repo);
+      }
+      COUNT(totals.packages_cached, 1);
+      goto install;
+    }
   }
 
   // fetch makefile
   if (!opts.global && pkg->makefile) {
     _debug("fetch: %s/%s", pkg->repo, pkg->makefile);
-    void *fetch = 0;
-    rc = fetch_package_file(pkg, pkg_dir, pkg->makefile, verbose, &fetch);
+    rc = fetch_package_file(pkg, pkg_dir, pkg->makefile, verbose,
+                            &makefile_failures);
     if (0 != rc) {
       goto cleanup;
     }
 
-#ifdef HAVE_PTHREADS
-    if (0 != fetch) {
-      fetch_package_file_thread_data_t *data = fetch;
-      int *status;
-      pthread_join(data->thread, (void **)&status);
-      if (NULL != status) {
-        rc = *status;
-        free(status);
-        status = 0;
-        if (0 != rc) {
-          rc = 0;
-          logger_warn("warning", "unable to fetch Makefile (%s) for '%s'",
-                      pkg->makefile, pkg->name);
-        }
-      }
-    }
-#endif
+    (void)pending++;
   }
 
   // if no sources are listed, just install
   if (opts.global || NULL == pkg->src)
     goto install;
 
+  // another clib process fetching it too saves it to the cache, where it is
+  // found once it is done, rather than downloaded once more
+  if (!opts.skip_cache) {
+    fetch_lock = clib_cache_lock_fetch(pkg->author, pkg->name, pkg->version);
+  }
+
 #ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&lock.mutex);
+  pthread_mutex_lock(package_lock);
 #endif
 
   if (clib_cache_has_package(pkg->author, pkg->name, pkg->version)) {
     if (opts.skip_cache) {
       clib_cache_delete_package(pkg->author, pkg->name, pkg->version);
 #ifdef HAVE_PTHREADS
-      pthread_mutex_unlock(&lock.mutex);
+      pthread_mutex_unlock(package_lock);
 #endif
       goto download;
     }
@@ -1447,7 +3703,7 @@ int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
     if (0 != clib_cache_load_package(pkg->author, pkg->name, pkg->version,
                                      pkg_dir)) {
 #ifdef HAVE_PTHREADS
-      pthread_mutex_unlock(&lock.mutex);
+      pthread_mutex_unlock(package_lock);
 #endif
       goto download;
     }
@@ -1456,147 +3712,155 @@ int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
       logger_info("cache", pkg->repo);
     }
 
+    COUNT(totals.packages_cached, 1);
+    record_package_files(pkg, pkg_dir);
+
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
+    pthread_mutex_unlock(package_lock);
 #endif
 
     goto install;
   }
 
 #ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&lock.mutex);
+  pthread_mutex_unlock(package_lock);
 #endif
 
 download:
+  // what was installed before is brought up to date file by file
+  if (0 == (rc = sync_package_files(pkg, pkg_dir, verbose))) {
+    goto save;
+  }
+
+  if (-1 == rc) {
+    goto cleanup;
+  }
+
+  rc = 0;
+
+  if (0 == fetch_package_git(pkg, pkg_dir, 1, verbose) ||
+      0 == fetch_package_archive(pkg, pkg_dir, verbose)) {
+    goto fetched;
+  }
 
-  iterator = list_iterator_new(pkg->src, LIST_HEAD);
   list_node_t *source;
 
-  while ((source = list_iterator_next(iterator))) {
-    void *fetch = NULL;
-    rc = fetch_package_file(pkg, pkg_dir, source->val, verbose, &fetch);
+  list_each(pkg->src, source) {
+    rc = fetch_package_file(pkg, pkg_dir, source->val, verbose, &failures);
 
     if (0 != rc) {
-      list_iterator_destroy(iterator);
-      iterator = NULL;
       rc = -1;
       goto cleanup;
     }
 
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-    usleep(1024 * 10);
-#endif
-
-#ifdef HAVE_PTHREADS
-    if (i < 0) {
-      i = 0;
-    }
-
-    fetchs[i] = fetch;
-
     (void)pending++;
-
-    if (i < max) {
-      (void)i++;
-    } else {
-      while (--i >= 0) {
-        fetch_package_file_thread_data_t *data = fetchs[i];
-        int *status;
-        pthread_join(data->thread, (void **)&status);
-        free(data);
-        fetchs[i] = NULL;
-
-        (void)pending--;
-
-        if (NULL != status) {
-          rc = *status;
-          free(status);
-          status = 0;
-        }
-
-        if (0 != rc) {
-          rc = -1;
-          goto cleanup;
-        }
-
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-        usleep(1024 * 10);
-#endif
-      }
-    }
-#endif
   }
 
-#ifdef HAVE_PTHREADS
-  while (--i >= 0) {
-    fetch_package_file_thread_data_t *data = fetchs[i];
-    int *status;
+  clib_download_wait(downloads);
+  pending = 0;
 
-    pthread_join(data->thread, (void **)&status);
+  if (0 != failures) {
+    rc = -1;
+    goto cleanup;
+  }
 
-    (void)pending--;
-    free(data);
-    fetchs[i] = NULL;
+fetched:
+  record_package_files(pkg, pkg_dir);
 
-    if (NULL != status) {
-      rc = *status;
-      free(status);
-      status = 0;
-    }
+save:
+  COUNT(totals.packages_downloaded, 1);
 
-    if (0 != rc) {
-      rc = -1;
-      goto cleanup;
-    }
+  if (saved_as_fetched(pkg) && 0 == queue_save(pkg, pkg_dir, fetch_lock)) {
+    fetch_lock = -1;
+    goto install;
   }
-#endif
 
 #ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&lock.mutex);
+  pthread_mutex_lock(package_lock);
 #endif
   clib_cache_save_package(pkg->author, pkg->name, pkg->version, pkg_dir);
 #ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&lock.mutex);
+  pthread_mutex_unlock(package_lock);
 #endif
 
 install:
+  clib_cache_unlock_fetch(fetch_lock);
+  fetch_lock = -1;
+
+  if (pending > 0) {
+    clib_download_wait(downloads);
+    pending = 0;
+  }
+
+  COUNT_SINCE(totals.fetch_us, fetching);
+  clib_timings_record("fetch", pkg->name, clib_trace_clock() - fetching);
+
+  if (0 != makefile_failures) {
+    logger_warn("warning", "unable to fetch Makefile (%s) for '%s'",
+                pkg->makefile, pkg->name);
+  }
+
+  if (opts.prefetch_only) {
+    goto dependencies;
+  }
+
   if (pkg->configure) {
-    E_FORMAT(&command, "cd %s/%s && %s", dir, pkg->name, pkg->configure);
+    clib_spawn_opts_t spawn = {0};
 
-    _debug("command(configure): %s", command);
+    E_FORMAT(&command, "%s/%s", dir, pkg->name);
 
-    rc = system(command);
+    _debug("command(configure): %s in %s", pkg->configure, command);
+
+    spawn.dir = command;
+    spawn.env = env;
+    uint64_t started = clib_trace_clock();
+    rc = clib_spawn_shell(pkg->configure, &spawn);
+    COUNT_SINCE(totals.configure_us, started);
+    clib_trace_span("build", "configure", pkg->name, started, "\"rc\":%d",
+                    rc);
     if (0 != rc)
       goto cleanup;
+    clib_timings_record("configure", pkg->name, clib_trace_clock() - started);
   }
 
   if (0 == rc && pkg->install) {
     rc = clib_package_install_executable(pkg, dir, verbose);
   }
 
-  if (0 == rc) {
+dependencies:
+  if (0 == rc && with_dependencies) {
     rc = clib_package_install_dependencies(pkg, dir, verbose);
   }
 
+  // in the dependency graph, the dependencies were built before
+  if (0 == rc && opts.build && !opts.prefetch_only) {
+    rc = build_package(pkg, dir, env, verbose);
+  }
+
 cleanup:
+  // queued downloads reference `pkg` and the counters on this stack frame
+  if (pending > 0) {
+    clib_download_wait(downloads);
+  }
+  if (counted) {
+    COUNT(progress.done, 1);
+  }
+  clib_cache_unlock_fetch(fetch_lock);
   if (pkg_dir)
     free(pkg_dir);
   if (package_json)
     free(package_json);
-  if (iterator)
-    list_iterator_destroy(iterator);
+  if (json)
+    free(json);
   if (command)
     free(command);
-#ifdef HAVE_PTHREADS
-  if (NULL != pkg && NULL != pkg->src) {
-    if (pkg->src->len > 0) {
-      if (fetchs) {
-        free(fetchs);
-      }
-    }
-  }
-  fetchs = NULL;
-#endif
+  free(env[0]);
+  return rc;
+}
+
+int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
+  int rc = install_package(pkg, dir, verbose, 1);
+  wait_saves();
   return rc;
 }
 
@@ -1611,7 +3875,9 @@ int clib_package_install_dependencies(clib_package_t *pkg, const char *dir,
   if (NULL == pkg->dependencies)
     return 0;
 
-  return install_packages(pkg->dependencies, dir, verbose);
+  int rc = install_packages(pkg->dependencies, dir, verbose);
+  wait_saves();
+  return rc;
 }
 
 /**
@@ -1625,7 +3891,186 @@ int clib_package_install_development(clib_package_t *pkg, const char *dir,
   if (NULL == pkg->development)
     return 0;
 
-  return install_packages(pkg->development, dir, verbose);
+  int rc = install_packages(pkg->development, dir, verbose);
+  wait_saves();
+  return rc;
+}
+
+typedef enum {
+  FUTURE_RESOLVE,
+  FUTURE_INSTALL,
+  FUTURE_DEPENDENCIES,
+  FUTURE_DEVELOPMENT,
+} future_kind_t;
+
+struct clib_package_future {
+  future_kind_t kind;
+  char *slug;
+  char *dir;
+  int verbose;
+  clib_package_t *pkg;
+  // the package was resolved by the future and not handed over yet
+  int owned;
+  int rc;
+  int done;
+  clib_package_future_cb cb;
+  void *data;
+  clib_pool_group_t *group;
+};
+
+static int run_future(void *arg) {
+  clib_package_future_t *future = arg;
+
+  switch (future->kind) {
+  case FUTURE_RESOLVE:
+    future->pkg = clib_package_new_from_slug(future->slug, future->verbose);
+    future->owned = NULL != future->pkg;
+    future->rc = future->pkg ? 0 : -1;
+    break;
+
+  case FUTURE_INSTALL:
+    future->rc =
+        clib_package_install(future->pkg, future->dir, future->verbose);
+    break;
+
+  case FUTURE_DEPENDENCIES:
+    future->rc = clib_package_install_dependencies(future->pkg, future->dir,
+                                                   future->verbose);
+    break;
+
+  case FUTURE_DEVELOPMENT:
+    future->rc = clib_package_install_development(future->pkg, future->dir,
+                                                  future->verbose);
+    break;
+  }
+
+  if (future->cb) {
+    future->cb(future, future->data);
+  }
+
+  __sync_lock_test_and_set(&future->done, 1);
+  return -1 == future->rc;
+}
+
+/**
+ * Queues `future` on the package pool, or runs it right away when it
+ * can't be
+ */
+
+static clib_package_future_t *start_future(clib_package_future_t *future) {
+  future->group = clib_pool_group_new(clib_package_pool());
+
+  if (!future->group || 0 != clib_pool_submit(future->group, run_future,
+                                              future)) {
+    run_future(future);
+  }
+
+  return future;
+}
+
+static clib_package_future_t *
+new_future(future_kind_t kind, clib_package_t *pkg, const char *dir,
+           int verbose, clib_package_future_cb cb, void *data) {
+  clib_package_future_t *future = NULL;
+
+  if (!pkg || !dir || !(future = calloc(1, sizeof(clib_package_future_t)))) {
+    return NULL;
+  }
+
+  if (!(future->dir = strdup(dir))) {
+    free(future);
+    return NULL;
+  }
+
+  future->kind = kind;
+  future->pkg = pkg;
+  future->verbose = verbose;
+  future->cb = cb;
+  future->data = data;
+
+  return start_future(future);
+}
+
+clib_package_future_t *
+clib_package_new_from_slug_async(const char *slug, int verbose,
+                                 clib_package_future_cb cb, void *data) {
+  clib_package_future_t *future = NULL;
+
+  if (!slug || !(future = calloc(1, sizeof(clib_package_future_t)))) {
+    return NULL;
+  }
+
+  if (!(future->slug = strdup(slug))) {
+    free(future);
+    return NULL;
+  }
+
+  future->kind = FUTURE_RESOLVE;
+  future->verbose = verbose;
+  future->cb = cb;
+  future->data = data;
+
+  return start_future(future);
+}
+
+clib_package_future_t *clib_package_install_async(clib_package_t *pkg,
+                                                  const char *dir, int verbose,
+                                                  clib_package_future_cb cb,
+                                                  void *data) {
+  return new_future(FUTURE_INSTALL, pkg, dir, verbose, cb, data);
+}
+
+clib_package_future_t *
+clib_package_install_dependencies_async(clib_package_t *pkg, const char *dir,
+                                        int verbose, clib_package_future_cb cb,
+                                        void *data) {
+  return new_future(FUTURE_DEPENDENCIES, pkg, dir, verbose, cb, data);
+}
+
+clib_package_future_t *
+clib_package_install_development_async(clib_package_t *pkg, const char *dir,
+                                       int verbose, clib_package_future_cb cb,
+                                       void *data) {
+  return new_future(FUTURE_DEVELOPMENT, pkg, dir, verbose, cb, data);
+}
+
+int clib_package_future_done(clib_package_future_t *future) {
+  return future ? __sync_fetch_and_add(&future->done, 0) : 1;
+}
+
+int clib_package_future_wait(clib_package_future_t *future) {
+  if (!future) {
+    return -1;
+  }
+
+  clib_pool_wait(future->group);
+  return future->rc;
+}
+
+clib_package_t *clib_package_future_package(clib_package_future_t *future) {
+  if (!future) {
+    return NULL;
+  }
+
+  future->owned = 0;
+  return future->pkg;
+}
+
+void clib_package_future_free(clib_package_future_t *future) {
+  if (!future) {
+    return;
+  }
+
+  clib_pool_wait(future->group);
+  clib_pool_group_free(future->group);
+
+  if (future->owned) {
+    clib_package_free(future->pkg);
+  }
+
+  free(future->slug);
+  free(future->dir);
+  free(future);
 }
 
 /**
@@ -1637,13 +4082,14 @@ void clib_package_free(clib_package_t *pkg) {
     return;
   }
 
-  if (0 != pkg->refs) {
+  if (release_package(pkg)) {
     return;
   }
 
 #define FREE(k)                                                                \
   if (pkg->k) {                                                                \
-    free(pkg->k);                                                              \
+    if (!clib_arena_owns(pkg->arena, pkg->k))                                  \
+      free(pkg->k);                                                            \
     pkg->k = 0;                                                                \
   }
   FREE(author);
@@ -1659,19 +4105,24 @@ void clib_package_free(clib_package_t *pkg) {
   FREE(url);
   FREE(version);
   FREE(flags);
+  FREE(prefix);
+  FREE(binary);
+  FREE(binary_sha256);
+  FREE(slug);
 #undef FREE
 
-  if (pkg->src)
-    list_destroy(pkg->src);
-  pkg->src = 0;
+  // lists read from the manifest go with the arena, without a walk
+#define DESTROY(k)                                                             \
+  if (pkg->k && !clib_arena_owns(pkg->arena, pkg->k))                          \
+    list_destroy(pkg->k);                                                      \
+  pkg->k = 0;
+  DESTROY(src);
+  DESTROY(dependencies);
+  DESTROY(development);
+#undef DESTROY
 
-  if (pkg->dependencies)
-    list_destroy(pkg->dependencies);
-  pkg->dependencies = 0;
-
-  if (pkg->development)
-    list_destroy(pkg->development);
-  pkg->development = 0;
+  clib_arena_free(pkg->arena);
+  pkg->arena = 0;
 
   free(pkg);
   pkg = 0;
@@ -1685,16 +4136,168 @@ void clib_package_dependency_free(void *_dep) {
   free(dep);
 }
 
-void clib_package_cleanup() {
+/**
+ * Copies the counters of everything installed so far into `stats`
+ */
+
+void clib_package_stats(clib_package_stats_t *stats) {
+  stats->manifests_cached = COUNT(totals.manifests_cached, 0);
+  stats->manifests_revalidated = COUNT(totals.manifests_revalidated, 0);
+  stats->manifests_stale = COUNT(totals.manifests_stale, 0);
+  stats->manifests_fetched = COUNT(totals.manifests_fetched, 0);
+  stats->manifests_locked = COUNT(totals.manifests_locked, 0);
+  stats->manifests_failed = COUNT(totals.manifests_failed, 0);
+  stats->packages_cached = COUNT(totals.packages_cached, 0);
+  stats->packages_downloaded = COUNT(totals.packages_downloaded, 0);
+  stats->packages_unchanged = COUNT(totals.packages_unchanged, 0);
+  stats->retries = COUNT(totals.retries, 0);
+  stats->downloads_held = 0;
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock.init);
+#endif
+  if (0 != downloads) {
+    stats->downloads_held = clib_download_held(downloads);
+  }
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.init);
+#endif
+
+  stats->manifest_us = COUNT(totals.manifest_us, 0);
+  stats->fetch_us = COUNT(totals.fetch_us, 0);
+  stats->configure_us = COUNT(totals.configure_us, 0);
+  stats->build_us = COUNT(totals.build_us, 0);
+}
+
+/**
+ * @return What `counter` grew by since it was `before`, all of it when it
+ * was reset meanwhile
+ */
+
+static unsigned long long grown(unsigned long long counter,
+                                unsigned long long before) {
+  return counter >= before ? counter - before : counter;
+}
+
+void clib_package_publish_metrics(void) {
+  clib_package_stats_t stats;
+  http_get_stats_t http;
+
+  clib_package_stats(&stats);
+  http_get_stats(&http);
+
+  clib_metrics_count(
+      CLIB_METRICS_MANIFEST_HITS,
+      grown(stats.manifests_cached + stats.manifests_revalidated +
+                stats.manifests_stale,
+            published.manifests_cached + published.manifests_revalidated +
+                published.manifests_stale));
+  clib_metrics_count(
+      CLIB_METRICS_MANIFEST_MISSES,
+      grown(stats.manifests_fetched, published.manifests_fetched));
+  clib_metrics_count(
+      CLIB_METRICS_MANIFEST_FAILURES,
+      grown(stats.manifests_failed, published.manifests_failed));
+  clib_metrics_count(CLIB_METRICS_PACKAGE_HITS,
+                     grown(stats.packages_cached, published.packages_cached));
+  clib_metrics_count(
+      CLIB_METRICS_PACKAGE_MISSES,
+      grown(stats.packages_downloaded, published.packages_downloaded));
+  clib_metrics_count(CLIB_METRICS_HTTP_RETRIES,
+                     grown(stats.retries, published.retries));
+  clib_metrics_count(CLIB_METRICS_HTTP_REQUESTS,
+                     grown(http.requests, published_http.requests));
+  clib_metrics_count(CLIB_METRICS_WIRE_BYTES,
+                     grown(http.wire_bytes, published_http.wire_bytes));
+  clib_metrics_count(CLIB_METRICS_BODY_BYTES,
+                     grown(http.body_bytes, published_http.body_bytes));
+
+  published = stats;
+  published_http = http;
+}
+
+/**
+ * Forgets the installs so far, waiting for the queued ones.
+ */
+
+static void forget_installs(void) {
+  // queued installs may still use everything below
+  if (0 != pool) {
+    clib_pool_free(pool);
+    pool = 0;
+  }
+
+  if (0 != save_pool) {
+    clib_pool_wait(saves);
+    clib_pool_group_free(saves);
+    clib_pool_free(save_pool);
+    saves = 0;
+    save_pool = 0;
+  }
+
   if (0 != visited_packages) {
-    hash_each(visited_packages, {
-      free((void *)key);
-      (void)val;
+    concurrent_hash_free(visited_packages);
+    visited_packages = 0;
+  }
+
+  forget_resolved_packages();
+
+  if (0 != prefetched_manifests) {
+    hash_each(prefetched_manifests, {
+      prefetched_manifest_t *entry = val;
+      (void)key;
+      http_get_free(entry->res);
+      free(entry->url);
+      free(entry);
     });
 
-    hash_free(visited_packages);
-    visited_packages = 0;
+    hash_free(prefetched_manifests);
+    prefetched_manifests = 0;
+  }
+
+  for (size_t i = 0; i < plans_count; i++) {
+    free(plans[i].slug);
+  }
+
+  free(plans);
+  plans = 0;
+  plans_count = 0;
+  plans_size = 0;
+}
+
+void clib_package_reset(void) {
+  clib_package_opts_t defaults = DEFAULT_OPTS;
+
+  forget_installs();
+
+  lockfile = 0;
+  lockfile_frozen = 0;
+  memset(&totals, 0, sizeof(totals));
+  memset(&progress, 0, sizeof(progress));
+  opts = defaults;
+}
+
+void clib_package_cleanup() {
+  forget_installs();
+
+#ifdef HAVE_PTHREADS
+  join_manifest_refreshes();
+#endif
+
+  if (0 != downloads) {
+    clib_download_free(downloads);
+    downloads = 0;
   }
 
+  clib_package_publish_metrics();
+  clib_mirror_cleanup();
+
+  clib_session_save(clib_package_curl_share);
+  clib_timings_save();
   curl_share_cleanup(clib_package_curl_share);
+  clib_package_curl_share = 0;
+
+  // dependencies read from manifests share these
+  clib_intern_cleanup();
+  clib_mkdirp_cleanup();
 }
@@ -18,12 +18,14 @@ typedef struct {
   char *version;
 } clib_package_dependency_t;
 
+struct clib_arena;
+
 typedef struct {
   char *author;
   char *description;
   char *install;
   char *configure;
-  char *json;
+  char *json; // NULL once cached, see clib_package_read_json()
   char *license;
   char *name;
   char *repo;
@@ -34,13 +36,31 @@ typedef struct {
   char *filename; // `package.json` or `clib.json`
   char *flags;
   char *prefix;
+  char *binary;        // url of the prebuilt executable for this platform
+  char *binary_sha256; // of `binary`, which isn't used without it
+  // lists read from the manifest, with their nodes, are in the arena
   list_t *dependencies;
   list_t *development;
   list_t *src;
   void *data; // user data
-  unsigned int refs;
+  unsigned int refs; // holders besides the first, see clib_package_free()
+  char *slug;    // of its lockfile entry, NULL without a lockfile
+  int unchanged; // locked and kept, see clib_lockfile_keep()
+  unsigned int lint; // CLIB_MANIFEST_* noted by clib_manifest_read()
+  struct clib_arena *arena; // the strings read from the manifest
 } clib_package_t;
 
+// what requests are limited to unless `clib_package_opts_t` says otherwise
+#define CLIB_PACKAGE_CONNECT_TIMEOUT 15
+#define CLIB_PACKAGE_LOW_SPEED_LIMIT 1024
+#define CLIB_PACKAGE_LOW_SPEED_TIME 30
+#define CLIB_PACKAGE_MIN_DOWNLOADS 1
+#define CLIB_PACKAGE_MAX_DOWNLOADS 32
+#define CLIB_PACKAGE_MEMORY_BUDGET 64
+
+// milliseconds between two progress reports, when they are asked for
+#define CLIB_PACKAGE_PROGRESS_INTERVAL 1000
+
 typedef struct {
   int skip_cache;
   int force;
@@ -48,14 +68,129 @@ typedef struct {
   char *prefix;
   int concurrency;
   char *token;
+  int retries;     // extra attempts for failed requests, -1 disables
+  int retry_delay; // first backoff delay in milliseconds, doubled per retry
+  int prefetch_only; // fill the caches, but neither configure nor install
+  int build; // run the makefile of each package once it and its deps are in
+  int connect_timeout; // seconds to connect, -1 disables
+  int timeout;         // seconds for a whole request, -1 disables
+  int low_speed_limit; // bytes per second below which a transfer stalls
+  int low_speed_time;  // seconds a transfer may stall, -1 disables
+  int git; // fetch sources and executables with git, when it can be run
+  int plan; // resolve, and record what installing would do instead
+  int min_downloads; // bounds of the downloads in flight, which start at
+  int max_downloads; // `concurrency` and adapt to the network in between
+  int http3; // move to HTTP/3 when a server offers it with alt-svc
+  int memory_budget; // megabytes of response bodies in memory, -1 disables
+  int progress; // milliseconds between reports instead of a line per file
 } clib_package_opts_t;
 
 extern CURLSH *clib_package_curl_share;
 
 void clib_package_set_opts(clib_package_opts_t opts);
 
+struct clib_lockfile;
+
+void clib_package_set_lockfile(struct clib_lockfile *lockfile, int frozen);
+
+/**
+ * Where the manifests and packages of installs came from, and what they
+ * took. Times are in microseconds and summed over threads, so together
+ * they may be more than the wall time.
+ */
+typedef struct {
+  unsigned long long manifests_cached;
+  unsigned long long manifests_revalidated; // the cached copy was current
+  unsigned long long manifests_stale; // expired, revalidated meanwhile
+  unsigned long long manifests_fetched;
+  unsigned long long manifests_locked;
+  unsigned long long manifests_failed;
+  unsigned long long packages_cached;
+  unsigned long long packages_downloaded;
+  unsigned long long packages_unchanged; // left as they were by an update
+  unsigned long long retries; // manifests, tarballs and files asked again
+  unsigned long long downloads_held; // for the memory budget
+  unsigned long long manifest_us;
+  unsigned long long fetch_us;
+  unsigned long long configure_us;
+  unsigned long long build_us;
+} clib_package_stats_t;
+
+/**
+ * Copies the counters of everything installed so far into `stats`
+ */
+void clib_package_stats(clib_package_stats_t *stats);
+
+/**
+ * Adds what those counters and the HTTP ones grew by since they were last
+ * added to the metrics, which is done on cleanup
+ */
+void clib_package_publish_metrics(void);
+
+/**
+ * What installing a package would do, as recorded with the `plan` option
+ */
+typedef struct {
+  char *slug;              // "author/name@version"
+  int cached;              // its files are loaded from the package cache
+  unsigned files;          // sources, and the makefile, to fetch or load
+  unsigned requests;       // to fetch its files and executable, estimated
+  unsigned long long size; // bytes of its files, 0 when unknown
+  int exact;               // `size` is of this version, not an older one
+  int configure;           // its configure command runs
+  int install;             // its install command runs, building it
+  int binary;              // a prebuilt binary is installed, unless broken
+  int build;               // its makefile runs, with the `build` option
+} clib_package_plan_t;
+
+/**
+ * Sets `plans` to what the installs with the `plan` option would have
+ * done so far, one entry per package, dependencies after dependents. The
+ * entries are valid until the next `clib_package_reset()`.
+ *
+ * @return The number of entries
+ */
+size_t clib_package_plan(const clib_package_plan_t **plans);
+
+/**
+ * @return How many downloads are let in flight now, as the download engine
+ * adapted them to the network, or 0 before the first one, and sets `peak`
+ * to the most it let in flight, unless NULL
+ */
+int clib_package_downloads(int *peak);
+
+struct clib_pool;
+
+/**
+ * @return The pool dependency graphs are installed on, started with the
+ * configured concurrency on first use, so callers can queue their own
+ * installs next to them
+ */
+struct clib_pool *clib_package_pool(void);
+
 clib_package_t *clib_package_new(const char *, int);
 
+/**
+ * Reads the manifest of `pkg`. Packages built from a slug only keep it
+ * until it is cached, and it is then read back from the cache.
+ *
+ * @return A new string, or NULL on error
+ */
+char *clib_package_read_json(clib_package_t *pkg);
+
+/**
+ * Replaces the string `field` of `pkg` with `value`, which it then owns.
+ * The previous string is freed unless it is in the arena of `pkg`.
+ */
+void clib_package_set_string(clib_package_t *pkg, char **field, char *value);
+
+/**
+ * Resolves a package from its slug, once per run: later calls for the same
+ * slug return the same package, with another reference to it. As it is
+ * shared between callers and threads, it must not be changed.
+ *
+ * @return The package, or NULL on error
+ */
 clib_package_t *clib_package_new_from_slug(const char *, int);
 
 clib_package_t *clib_package_load_from_manifest(const char *, int);
@@ -75,6 +210,14 @@ char *clib_package_parse_name(const char *);
 clib_package_dependency_t *clib_package_dependency_new(const char *,
                                                        const char *);
 
+/**
+ * Like `clib_package_dependency_new()`, with the dependency in `arena`
+ * and its strings interned, so it must not be freed on its own.
+ */
+clib_package_dependency_t *
+clib_package_dependency_new_in(struct clib_arena *arena, const char *repo,
+                               const char *version);
+
 int clib_package_install_executable(clib_package_t *pkg, const char *dir,
                                     int verbose);
 
@@ -84,10 +227,104 @@ int clib_package_install_dependencies(clib_package_t *, const char *, int);
 
 int clib_package_install_development(clib_package_t *, const char *, int);
 
+/**
+ * A resolution or install running on the package pool
+ */
+typedef struct clib_package_future clib_package_future_t;
+
+/**
+ * Invoked on the thread that ran the request of `future` once it is done,
+ * where its result can be read but the future not freed
+ */
+typedef void (*clib_package_future_cb)(clib_package_future_t *future,
+                                       void *data);
+
+/**
+ * Like `clib_package_new_from_slug()`, without waiting for it. Like every
+ * request below, it is queued on `clib_package_pool()`, and its downloads
+ * share the engine of all installs, so a single thread can have many in
+ * flight. With a concurrency of 1 the pool has no workers, and requests
+ * only run while one of them is waited for. `cb` is called once it is
+ * done, unless NULL.
+ *
+ * @return A new future, or NULL on error
+ */
+clib_package_future_t *
+clib_package_new_from_slug_async(const char *slug, int verbose,
+                                 clib_package_future_cb cb, void *data);
+
+/**
+ * Like `clib_package_install()`, without waiting for it. `pkg` must be
+ * kept until the future is done.
+ *
+ * @return A new future, or NULL on error
+ */
+clib_package_future_t *clib_package_install_async(clib_package_t *pkg,
+                                                  const char *dir, int verbose,
+                                                  clib_package_future_cb cb,
+                                                  void *data);
+
+/**
+ * Like `clib_package_install_dependencies()`, without waiting for it
+ *
+ * @return A new future, or NULL on error
+ */
+clib_package_future_t *
+clib_package_install_dependencies_async(clib_package_t *pkg, const char *dir,
+                                        int verbose, clib_package_future_cb cb,
+                                        void *data);
+
+/**
+ * Like `clib_package_install_development()`, without waiting for it
+ *
+ * @return A new future, or NULL on error
+ */
+clib_package_future_t *
+clib_package_install_development_async(clib_package_t *pkg, const char *dir,
+                                       int verbose, clib_package_future_cb cb,
+                                       void *data);
+
+/**
+ * @return 1 if the request of `future` is done, 0 if it is still queued
+ * or running
+ */
+int clib_package_future_done(clib_package_future_t *future);
+
+/**
+ * Waits for the request of `future`, running queued requests of the pool
+ * meanwhile.
+ *
+ * @return What the blocking call would have returned, 0 for a resolved
+ * package and -1 if it could not be resolved
+ */
+int clib_package_future_wait(clib_package_future_t *future);
+
+/**
+ * @return The package `future` resolved or installs, once done, or NULL. A
+ * resolved package belongs to the caller once returned, otherwise it is
+ * freed with the future.
+ */
+clib_package_t *clib_package_future_package(clib_package_future_t *future);
+
+/**
+ * Waits for the request of `future` if needed, then frees it
+ */
+void clib_package_future_free(clib_package_future_t *future);
+
+/**
+ * Drops a reference to a package, freeing it with the last one
+ */
 void clib_package_free(clib_package_t *);
 
 void clib_package_dependency_free(void *);
 
+/**
+ * Forgets the packages installed so far, along with the options, stats
+ * and lockfile, so that the next installs start over like in a new
+ * process. The connections and the downloads are kept for them.
+ */
+void clib_package_reset(void);
+
 void clib_package_cleanup();
 
 #endif
@@ -0,0 +1,356 @@
+//
+// clib-pool.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-pool.h"
+#include "clib-metrics.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+typedef struct clib_pool_task clib_pool_task_t;
+struct clib_pool_task {
+  clib_pool_fn fn;
+  void *arg;
+  clib_pool_group_t *group;
+  clib_pool_task_t *prev;
+  clib_pool_task_t *next;
+};
+
+struct clib_pool_group {
+  clib_pool_t *pool;
+  int pending;
+  int failures;
+};
+
+#ifdef HAVE_PTHREADS
+typedef struct {
+  clib_pool_task_t *head; // oldest task, taken by other workers
+  clib_pool_task_t *tail; // newest task, taken by the owner
+  pthread_mutex_t mutex;
+} clib_pool_queue_t;
+
+typedef struct {
+  clib_pool_t *pool;
+  int index;
+} clib_pool_worker_t;
+#endif
+
+struct clib_pool {
+#ifdef HAVE_PTHREADS
+  clib_pool_queue_t *queues;
+  clib_pool_worker_t *workers;
+  pthread_t *threads;
+  int count;
+  int started;
+  // queue of the next task submitted from outside the pool
+  unsigned int next;
+  // tasks in all queues, guarded by `mutex` like the groups
+  int queued;
+  int stop;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  // index + 1 of the queue owned by the calling worker thread
+  pthread_key_t worker;
+#else
+  int count;
+#endif
+};
+
+#ifdef HAVE_PTHREADS
+static void push_task(clib_pool_queue_t *queue, clib_pool_task_t *task) {
+  pthread_mutex_lock(&queue->mutex);
+  task->next = NULL;
+  task->prev = queue->tail;
+  if (queue->tail) {
+    queue->tail->next = task;
+  } else {
+    queue->head = task;
+  }
+  queue->tail = task;
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+static clib_pool_task_t *pop_task(clib_pool_queue_t *queue, int newest) {
+  clib_pool_task_t *task = NULL;
+
+  pthread_mutex_lock(&queue->mutex);
+  if ((task = newest ? queue->tail : queue->head)) {
+    if (task->prev) {
+      task->prev->next = task->next;
+    } else {
+      queue->head = task->next;
+    }
+    if (task->next) {
+      task->next->prev = task->prev;
+    } else {
+      queue->tail = task->prev;
+    }
+  }
+  pthread_mutex_unlock(&queue->mutex);
+
+  return task;
+}
+
+static int current_worker(clib_pool_t *self) {
+  return (int)(intptr_t)pthread_getspecific(self->worker) - 1;
+}
+
+/**
+ * Takes the newest task of the queue of worker `index`, or the oldest
+ * task of any other queue. Threads outside the pool pass -1.
+ */
+
+static clib_pool_task_t *take_task(clib_pool_t *self, int index) {
+  clib_pool_task_t *task = NULL;
+
+  if (index >= 0) {
+    task = pop_task(&self->queues[index], 1);
+  }
+
+  for (int i = 1; !task && i <= self->count; i++) {
+    int victim = (index + i) % self->count;
+    if (victim != index) {
+      task = pop_task(&self->queues[victim], 0);
+    }
+  }
+
+  if (task) {
+    pthread_mutex_lock(&self->mutex);
+    (void)self->queued--;
+    pthread_mutex_unlock(&self->mutex);
+    clib_metrics_queue(-1);
+  }
+
+  return task;
+}
+
+static void run_task(clib_pool_t *self, clib_pool_task_t *task) {
+  clib_pool_group_t *group = task->group;
+  int rc = task->fn(task->arg);
+
+  free(task);
+
+  pthread_mutex_lock(&self->mutex);
+  (void)group->pending--;
+  if (0 != rc) {
+    (void)group->failures++;
+  }
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+}
+
+static void *run_worker(void *arg) {
+  clib_pool_worker_t *worker = arg;
+  clib_pool_t *self = worker->pool;
+  int stop = 0;
+
+  pthread_setspecific(self->worker, (void *)(intptr_t)(worker->index + 1));
+
+  while (!stop) {
+    clib_pool_task_t *task = take_task(self, worker->index);
+
+    if (task) {
+      run_task(self, task);
+      continue;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+    while (0 == self->queued && !self->stop) {
+      pthread_cond_wait(&self->cond, &self->mutex);
+    }
+    stop = self->stop && 0 == self->queued;
+    pthread_mutex_unlock(&self->mutex);
+  }
+
+  return NULL;
+}
+#endif
+
+clib_pool_t *clib_pool_new(int concurrency) {
+  clib_pool_t *self = malloc(sizeof(clib_pool_t));
+
+  if (NULL == self) {
+    return NULL;
+  }
+
+  memset(self, 0, sizeof(clib_pool_t));
+  self->count = concurrency > 0 ? concurrency : 1;
+
+#ifdef HAVE_PTHREADS
+  self->queues = calloc(self->count, sizeof(clib_pool_queue_t));
+  self->workers = calloc(self->count, sizeof(clib_pool_worker_t));
+  self->threads = calloc(self->count, sizeof(pthread_t));
+
+  if (!self->queues || !self->workers || !self->threads ||
+      0 != pthread_key_create(&self->worker, NULL)) {
+    free(self->queues);
+    free(self->workers);
+    free(self->threads);
+    free(self);
+    return NULL;
+  }
+
+  pthread_mutex_init(&self->mutex, NULL);
+  pthread_cond_init(&self->cond, NULL);
+
+  for (int i = 0; i < self->count; i++) {
+    pthread_mutex_init(&self->queues[i].mutex, NULL);
+    self->workers[i].pool = self;
+    self->workers[i].index = i;
+  }
+
+  // tasks still run on the waiting threads if no worker starts
+  for (int i = 0; i < concurrency; i++) {
+    if (0 != pthread_create(&self->threads[self->started], NULL, run_worker,
+                            &self->workers[i])) {
+      break;
+    }
+    (void)self->started++;
+  }
+#endif
+
+  return self;
+}
+
+clib_pool_group_t *clib_pool_group_new(clib_pool_t *pool) {
+  clib_pool_group_t *self = NULL;
+
+  if (NULL == pool || NULL == (self = malloc(sizeof(clib_pool_group_t)))) {
+    return NULL;
+  }
+
+  memset(self, 0, sizeof(clib_pool_group_t));
+  self->pool = pool;
+  return self;
+}
+
+int clib_pool_submit(clib_pool_group_t *group, clib_pool_fn fn, void *arg) {
+  if (NULL == group || NULL == fn) {
+    return -1;
+  }
+
+#ifdef HAVE_PTHREADS
+  clib_pool_t *self = group->pool;
+  clib_pool_task_t *task = malloc(sizeof(clib_pool_task_t));
+  int index = current_worker(self);
+
+  if (NULL == task) {
+    return -1;
+  }
+
+  task->fn = fn;
+  task->arg = arg;
+  task->group = group;
+
+  if (index < 0) {
+    index = __sync_fetch_and_add(&self->next, 1) % self->count;
+  }
+
+  // counted before it can be taken, so that the count isn't below zero
+  clib_metrics_queue(1);
+
+  pthread_mutex_lock(&self->mutex);
+  (void)group->pending++;
+  (void)self->queued++;
+  push_task(&self->queues[index], task);
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+#else
+  if (0 != fn(arg)) {
+    (void)group->failures++;
+  }
+#endif
+
+  return 0;
+}
+
+int clib_pool_wait(clib_pool_group_t *group) {
+  int failures = 0;
+
+  if (NULL == group) {
+    return 0;
+  }
+
+#ifdef HAVE_PTHREADS
+  clib_pool_t *self = group->pool;
+  int index = current_worker(self);
+
+  for (;;) {
+    clib_pool_task_t *task = NULL;
+    int done = 0;
+
+    pthread_mutex_lock(&self->mutex);
+    done = 0 == group->pending;
+    pthread_mutex_unlock(&self->mutex);
+
+    if (done) {
+      break;
+    }
+
+    // help instead of blocking, the task may be waiting on this thread
+    if ((task = take_task(self, index))) {
+      run_task(self, task);
+      continue;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+    while (group->pending > 0 && 0 == self->queued) {
+      pthread_cond_wait(&self->cond, &self->mutex);
+    }
+    pthread_mutex_unlock(&self->mutex);
+  }
+
+  pthread_mutex_lock(&self->mutex);
+  failures = group->failures;
+  pthread_mutex_unlock(&self->mutex);
+#else
+  failures = group->failures;
+#endif
+
+  return failures;
+}
+
+void clib_pool_group_free(clib_pool_group_t *group) { free(group); }
+
+void clib_pool_free(clib_pool_t *self) {
+  if (NULL == self) {
+    return;
+  }
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&self->mutex);
+  self->stop = 1;
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+
+  for (int i = 0; i < self->started; i++) {
+    pthread_join(self->threads[i], NULL);
+  }
+
+  // without workers, whatever is left is run here
+  for (clib_pool_task_t *task = NULL; (task = take_task(self, -1));) {
+    run_task(self, task);
+  }
+
+  for (int i = 0; i < self->count; i++) {
+    pthread_mutex_destroy(&self->queues[i].mutex);
+  }
+
+  pthread_key_delete(self->worker);
+  pthread_cond_destroy(&self->cond);
+  pthread_mutex_destroy(&self->mutex);
+  free(self->queues);
+  free(self->workers);
+  free(self->threads);
+#endif
+
+  free(self);
+}
@@ -0,0 +1,64 @@
+//
+// clib-pool.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_POOL_H
+#define CLIB_POOL_H 1
+
+typedef struct clib_pool clib_pool_t;
+typedef struct clib_pool_group clib_pool_group_t;
+
+/**
+ * A task run by the pool.
+ *
+ * @return 0 on success, anything else counts as a failure of its group
+ */
+typedef int (*clib_pool_fn)(void *arg);
+
+/**
+ * Starts `concurrency` worker threads, each with its own queue of tasks.
+ * A worker runs the tasks it submitted last first, and takes the oldest
+ * tasks of the other queues once its own is empty, so a slot is refilled
+ * as soon as any task finishes. Threads waiting on a group run tasks
+ * too, and with a `concurrency` of 0 they are the only ones. Without
+ * threads, tasks run as they are submitted.
+ *
+ * @return A new pool, or NULL on error
+ */
+clib_pool_t *clib_pool_new(int concurrency);
+
+/**
+ * @return A new group collecting the tasks to wait for, or NULL on error
+ */
+clib_pool_group_t *clib_pool_group_new(clib_pool_t *pool);
+
+/**
+ * Queues `fn(arg)` on the pool as part of `group`. Tasks may submit
+ * more tasks, to their own group or a new one.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_pool_submit(clib_pool_group_t *group, clib_pool_fn fn, void *arg);
+
+/**
+ * Waits until every task of `group` finished, running queued tasks of
+ * the pool meanwhile, so tasks can wait on the tasks they submitted.
+ *
+ * @return Number of tasks of the group that failed
+ */
+int clib_pool_wait(clib_pool_group_t *group);
+
+/**
+ * Frees a group that has no pending tasks
+ */
+void clib_pool_group_free(clib_pool_group_t *group);
+
+/**
+ * Runs the queued tasks, then stops the workers and frees the pool
+ */
+void clib_pool_free(clib_pool_t *pool);
+
+#endif
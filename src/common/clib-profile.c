@@ -0,0 +1,136 @@
+//
+// clib-profile.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifdef CLIB_PROFILE
+
+#include "clib-profile.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#define MAX_PHASES 32
+
+typedef struct {
+  const char *name;
+  unsigned long long allocs;
+  unsigned long long frees;
+  unsigned long long bytes;
+  long long peak;
+} phase_t;
+
+static phase_t phases[MAX_PHASES] = {{"startup", 0, 0, 0, 0}};
+static int current = 0;
+static long long live = 0;
+static long long peak = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static void raise_peak(long long *max, long long value) {
+  long long seen = *max;
+  while (value > seen && !__sync_bool_compare_and_swap(max, seen, value)) {
+    seen = *max;
+  }
+}
+
+/**
+ * Counts an allocation of `size` bytes that changed the live memory by
+ * `delta`, which is what the allocator handed out rather than asked for.
+ */
+
+static void track(size_t size, long long delta) {
+  phase_t *phase = &phases[current];
+  long long now = __sync_add_and_fetch(&live, delta);
+
+  __sync_fetch_and_add(&phase->allocs, 1);
+  __sync_fetch_and_add(&phase->bytes, size);
+  raise_peak(&phase->peak, now);
+  raise_peak(&peak, now);
+}
+
+void *__wrap_malloc(size_t size) {
+  void *ptr = __real_malloc(size);
+  if (ptr) {
+    track(size, malloc_usable_size(ptr));
+  }
+  return ptr;
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  void *ptr = __real_calloc(count, size);
+  if (ptr) {
+    track(count * size, malloc_usable_size(ptr));
+  }
+  return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  long long before = ptr ? (long long)malloc_usable_size(ptr) : 0;
+  void *res = __real_realloc(ptr, size);
+
+  if (res) {
+    track(size, (long long)malloc_usable_size(res) - before);
+  } else if (0 == size && ptr) {
+    __sync_fetch_and_add(&phases[current].frees, 1);
+    __sync_sub_and_fetch(&live, before);
+  }
+
+  return res;
+}
+
+void __wrap_free(void *ptr) {
+  if (ptr) {
+    __sync_fetch_and_add(&phases[current].frees, 1);
+    __sync_sub_and_fetch(&live, (long long)malloc_usable_size(ptr));
+  }
+  __real_free(ptr);
+}
+
+void clib_profile_phase(const char *name) {
+  if (current + 1 >= MAX_PHASES) {
+    return;
+  }
+
+  // a phase starts with what the one before it left
+  phases[current + 1].name = name;
+  phases[current + 1].peak = live;
+  __sync_synchronize();
+  current++;
+}
+
+static void report(void) {
+  struct rusage usage;
+  phase_t total = {"total", 0, 0, 0, peak};
+
+  fprintf(stderr, "\n%-16s %12s %12s %14s %14s\n", "phase", "allocs", "frees",
+          "bytes", "peak live");
+
+  for (int i = 0; i <= current; i++) {
+    fprintf(stderr, "%-16s %12llu %12llu %14llu %14lld\n", phases[i].name,
+            phases[i].allocs, phases[i].frees, phases[i].bytes,
+            phases[i].peak);
+    total.allocs += phases[i].allocs;
+    total.frees += phases[i].frees;
+    total.bytes += phases[i].bytes;
+  }
+
+  fprintf(stderr, "%-16s %12llu %12llu %14llu %14lld\n", total.name,
+          total.allocs, total.frees, total.bytes, total.peak);
+
+  // what the sandbox sees, libcurl and libc included
+  if (0 == getrusage(RUSAGE_SELF, &usage)) {
+    fprintf(stderr, "peak RSS %ld KiB, %lld bytes still live at exit\n",
+            usage.ru_maxrss, live);
+  }
+}
+
+__attribute__((constructor)) static void profile_init(void) { atexit(report); }
+
+#endif
@@ -0,0 +1,33 @@
+//
+// clib-profile.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_PROFILE_H
+#define CLIB_PROFILE_H 1
+
+/**
+ * Allocation counts of a `make PROFILE=1` build, which wraps the
+ * allocator at link time, so that parson, gumbo and the rest of the deps
+ * are counted along with clib. At exit the allocations, bytes and peak
+ * live memory of every phase are printed to stderr, with the peak RSS of
+ * the process. In other builds, phases cost nothing.
+ */
+
+#ifdef CLIB_PROFILE
+
+/**
+ * Ends the current phase and starts `name`, which has to outlive the
+ * process. Phases are of the whole process, whichever thread allocates.
+ */
+void clib_profile_phase(const char *name);
+
+#else
+
+#define clib_profile_phase(name) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,291 @@
+//
+// clib-ratelimit.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+// usleep()
+#define _DEFAULT_SOURCE
+
+#include "clib-ratelimit.h"
+#include "http-get/http-get.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+// how often a request waiting for the cap of its host looks again
+#define CLIB_RATELIMIT_POLL_INTERVAL 50
+
+// the first backoff of a host that throttles without a `Retry-After`
+#define CLIB_RATELIMIT_BACKOFF 1000
+
+typedef struct {
+  char *name;
+  int active;
+  int strikes;
+  long long not_before;
+} host_t;
+
+static host_t *hosts = NULL;
+static int hosts_count = 0;
+static int initialized = 0;
+static int host_connections = CLIB_RATELIMIT_DEFAULT_HOST_CONNECTIONS;
+
+// the bucket, off while `rate` is 0, and what it may grow back to
+static int adaptive = 1;
+static double max_rate = 0;
+static double rate = 0;
+static double tokens = 0;
+static long long refilled = 0;
+
+// requests started in the current and the last second
+static long long window = 0;
+static int window_count = 0;
+static int last_count = 0;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK() pthread_mutex_lock(&mutex)
+#define UNLOCK() pthread_mutex_unlock(&mutex)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+// the slots the current thread holds
+#if defined(HAVE_PTHREADS) && defined(__GNUC__)
+static __thread int held = 0;
+#else
+static int held = 0;
+#endif
+
+static long long now_ms(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+static void configure(void) {
+  const char *env = NULL;
+
+  if (initialized) {
+    return;
+  }
+
+  if ((env = getenv("CLIB_RATE_LIMIT")) && *env) {
+    max_rate = atof(env) > 0 ? atof(env) : 0;
+    adaptive = max_rate > 0;
+  }
+
+  if ((env = getenv("CLIB_HOST_CONNECTIONS")) && *env) {
+    host_connections = atoi(env) > 0 ? atoi(env) : 0;
+  }
+
+  // a full bucket to start with, so that small installs never wait
+  rate = tokens = max_rate;
+  refilled = now_ms();
+  initialized = 1;
+}
+
+/**
+ * Finds the host of `url`, which is added when it's new.
+ *
+ * @return The host, or NULL when out of memory
+ */
+
+static host_t *find_host(const char *url) {
+  const char *start = strstr(url, "://");
+  size_t len = 0;
+  host_t *list = NULL;
+  char *name = NULL;
+
+  start = start ? start + 3 : url;
+  len = strcspn(start, "/?#");
+
+  for (int i = 0; i < hosts_count; i++) {
+    if (len == strlen(hosts[i].name) && 0 == strncmp(hosts[i].name, start, len)) {
+      return &hosts[i];
+    }
+  }
+
+  if (!(name = malloc(len + 1))) {
+    return NULL;
+  }
+
+  memcpy(name, start, len);
+  name[len] = '\0';
+
+  if (!(list = realloc(hosts, (hosts_count + 1) * sizeof(host_t)))) {
+    free(name);
+    return NULL;
+  }
+
+  hosts = list;
+  memset(&hosts[hosts_count], 0, sizeof(host_t));
+  hosts[hosts_count].name = name;
+  return &hosts[hosts_count++];
+}
+
+/**
+ * Takes a slot for `url` when it may start, holding the lock.
+ *
+ * @return 0 when the slot was taken, otherwise the milliseconds to wait
+ */
+
+static long take(const char *url, int capped) {
+  long long now = 0;
+  host_t *host = NULL;
+
+  configure();
+  now = now_ms();
+
+  if (rate > 0) {
+    tokens += rate * (now - refilled) / 1000.0;
+    if (tokens > rate) {
+      tokens = rate;
+    }
+  }
+  refilled = now;
+
+  if (!(host = find_host(url))) {
+    return 0;
+  }
+
+  if (host->not_before > now) {
+    return (long)(host->not_before - now);
+  }
+
+  if (capped && host_connections > 0 && host->active >= host_connections) {
+    return CLIB_RATELIMIT_POLL_INTERVAL;
+  }
+
+  if (rate > 0) {
+    if (tokens < 1) {
+      long wait = (long)((1 - tokens) * 1000 / rate);
+      return wait > 0 ? wait : 1;
+    }
+    tokens -= 1;
+  }
+
+  if (now - window >= 1000) {
+    last_count = now - window < 2000 ? window_count : 0;
+    window = now;
+    window_count = 0;
+  }
+
+  (void)window_count++;
+  (void)host->active++;
+  (void)held++;
+  return 0;
+}
+
+long clib_ratelimit_try(const char *url) {
+  long wait = 0;
+
+  if (!url) {
+    return 0;
+  }
+
+  LOCK();
+  wait = take(url, 1);
+  UNLOCK();
+  return wait;
+}
+
+void clib_ratelimit_acquire(const char *url) {
+  long wait = 0;
+
+  if (!url) {
+    return;
+  }
+
+  for (;;) {
+    LOCK();
+    wait = take(url, 0 == held);
+    UNLOCK();
+
+    if (0 == wait) {
+      return;
+    }
+
+    usleep(wait * 1000);
+  }
+}
+
+int clib_ratelimit_throttled(long status, long retry_after) {
+  return 429 == status || 503 == status || (403 == status && retry_after > 0);
+}
+
+void clib_ratelimit_release(const char *url, long status, long retry_after) {
+  host_t *host = NULL;
+  int throttled = clib_ratelimit_throttled(status, retry_after);
+
+  if (!url) {
+    return;
+  }
+
+  LOCK();
+  configure();
+
+  if ((host = find_host(url))) {
+    if (host->active > 0) {
+      (void)host->active--;
+    }
+
+    if (throttled) {
+      long long delay = retry_after > 0
+                            ? retry_after * 1000LL
+                            : (long long)CLIB_RATELIMIT_BACKOFF << host->strikes;
+      long long until = 0;
+
+      if (delay > CLIB_RATELIMIT_MAX_BACKOFF * 1000LL) {
+        delay = CLIB_RATELIMIT_MAX_BACKOFF * 1000LL;
+      }
+
+      until = now_ms() + delay;
+      if (until > host->not_before) {
+        host->not_before = until;
+      }
+      if (host->strikes < 16) {
+        (void)host->strikes++;
+      }
+    } else if (status >= 200 && status < 400) {
+      host->strikes = 0;
+    }
+  }
+
+  if (throttled && adaptive) {
+    // the bucket comes on below what the servers just refused
+    if (0 == rate) {
+      rate = last_count > window_count ? last_count : window_count;
+      tokens = 0;
+    }
+    rate = rate / 2 > 1 ? rate / 2 : 1;
+  } else if (rate > 0 && status >= 200 && status < 400) {
+    rate += 1 / rate;
+  }
+
+  if (max_rate > 0 && rate > max_rate) {
+    rate = max_rate;
+  }
+
+  if (held > 0) {
+    (void)held--;
+  }
+
+  UNLOCK();
+}
+
+void clib_ratelimit_init(void) {
+  LOCK();
+  configure();
+  UNLOCK();
+
+  http_get_set_limiter(clib_ratelimit_acquire, clib_ratelimit_release);
+}
@@ -0,0 +1,63 @@
+//
+// clib-ratelimit.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_RATELIMIT_H
+#define CLIB_RATELIMIT_H 1
+
+// requests in flight to one host, `CLIB_HOST_CONNECTIONS`
+#define CLIB_RATELIMIT_DEFAULT_HOST_CONNECTIONS 16
+
+// the longest a throttled host is waited for, in seconds
+#define CLIB_RATELIMIT_MAX_BACKOFF 60
+
+/**
+ * Paces every request of the process, whichever thread or download
+ * engine makes it: each host has a cap on the requests in flight, a host
+ * that throttles (429, 503 or a `Retry-After`) isn't asked again until it
+ * said so, or for a backoff that doubles while it keeps throttling, and a
+ * token bucket bounds the requests per second.
+ *
+ * The bucket starts out at `CLIB_RATE_LIMIT` requests per second, or is
+ * left off until the first throttle when that isn't set. A throttle
+ * halves the rate, down from the rate of the last second when the bucket
+ * was off, and every success grows it back, so that the process settles
+ * at the rate the servers sustain.
+ *
+ * Reads `CLIB_RATE_LIMIT` and `CLIB_HOST_CONNECTIONS`, 0 disables either
+ * for good, and paces the requests `http_get*()` perform from now on.
+ */
+void clib_ratelimit_init(void);
+
+/**
+ * Takes a slot for a request to `url` when it may start now.
+ *
+ * @return 0 when the slot was taken, otherwise the milliseconds to wait
+ * before trying again
+ */
+long clib_ratelimit_try(const char *url);
+
+/**
+ * Takes a slot for a request to `url`, waiting until it may start. A
+ * thread that holds a slot already isn't made to wait for the cap of a
+ * host, so that it can't wait on itself.
+ */
+void clib_ratelimit_acquire(const char *url);
+
+/**
+ * Gives back the slot of a request to `url` that is over with `status`,
+ * 0 when it failed without one, and `retry_after` the seconds the server
+ * asked to wait, or 0.
+ */
+void clib_ratelimit_release(const char *url, long status, long retry_after);
+
+/**
+ * @return 1 when a response with `status` and `retry_after` was the
+ * server throttling, 0 otherwise
+ */
+int clib_ratelimit_throttled(long status, long retry_after);
+
+#endif
@@ -0,0 +1,266 @@
+//
+// clib-refs.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-refs.h"
+#include "asprintf/asprintf.h"
+#include "clib-download.h"
+#include "parse-repo/parse-repo.h"
+#include "strdup/strdup.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef DEFAULT_REPO_VERSION
+#define DEFAULT_REPO_VERSION "master"
+#endif
+
+#ifndef DEFAULT_REPO_OWNER
+#define DEFAULT_REPO_OWNER "clibs"
+#endif
+
+#define REFS_URL "https://github.com/%s.git/info/refs?service=git-upload-pack"
+
+#define COMMIT_LENGTH 40
+
+typedef struct {
+  hash_t *refs;
+  list_t *slugs; // of the repo, owned by the caller
+} lookup_t;
+
+static int is_commit(const char *str, size_t length) {
+  if (COMMIT_LENGTH != length) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    if (!isxdigit((unsigned char)str[i])) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Finds the commit of `version` in the refs advertised in `data`, one
+ * pkt-line per ref. The commit an annotated tag peels to is preferred
+ * over the tag, and a tag over a branch of the same name.
+ *
+ * @return A new commit, or NULL if `version` is not a ref
+ */
+
+static char *find_commit(const char *data, size_t size, const char *version) {
+  char *wanted[3] = {NULL};
+  const char *found = NULL;
+  char *commit = NULL;
+  size_t pos = 0;
+  int best = 3;
+
+  if (-1 == asprintf(&wanted[0], "refs/tags/%s^{}", version) ||
+      -1 == asprintf(&wanted[1], "refs/tags/%s", version) ||
+      -1 == asprintf(&wanted[2], "refs/heads/%s", version)) {
+    goto cleanup;
+  }
+
+  while (pos + 4 <= size) {
+    char hex[5] = {0};
+    char *end = NULL;
+    unsigned long length = 0;
+
+    memcpy(hex, data + pos, 4);
+    length = strtoul(hex, &end, 16);
+
+    if (end != hex + 4) {
+      break;
+    }
+
+    // a flush between sections
+    if (length < 4) {
+      pos += 4;
+      continue;
+    }
+
+    if (pos + length > size) {
+      break;
+    }
+
+    const char *line = data + pos + 4;
+    size_t line_length = length - 4;
+
+    if (line_length > COMMIT_LENGTH + 1 && ' ' == line[COMMIT_LENGTH] &&
+        is_commit(line, COMMIT_LENGTH)) {
+      const char *ref = line + COMMIT_LENGTH + 1;
+      size_t ref_length = 0;
+
+      // the first ref is followed by the capabilities of the server
+      while (ref + ref_length < line + line_length &&
+             '\0' != ref[ref_length] && '\n' != ref[ref_length]) {
+        ref_length++;
+      }
+
+      for (int i = 0; i < best; i++) {
+        if (ref_length == strlen(wanted[i]) &&
+            0 == memcmp(ref, wanted[i], ref_length)) {
+          found = line;
+          best = i;
+          break;
+        }
+      }
+    }
+
+    pos += length;
+  }
+
+  if (found && (commit = malloc(COMMIT_LENGTH + 1))) {
+    memcpy(commit, found, COMMIT_LENGTH);
+    commit[COMMIT_LENGTH] = '\0';
+  }
+
+cleanup:
+  for (int i = 0; i < 3; i++) {
+    free(wanted[i]);
+  }
+  return commit;
+}
+
+static void lookup_done(http_get_response_t *res, const char *url,
+                        void *data) {
+  lookup_t *lookup = data;
+  list_iterator_t *iterator = NULL;
+  list_node_t *node = NULL;
+
+  if (!res || !res->ok || !res->data) {
+    http_get_free(res);
+    return;
+  }
+
+  if ((iterator = list_iterator_new(lookup->slugs, LIST_HEAD))) {
+    while ((node = list_iterator_next(iterator))) {
+      char *version = parse_repo_version(node->val, DEFAULT_REPO_VERSION);
+      char *commit = NULL;
+      char *slug = NULL;
+
+      if (version && (commit = find_commit(res->data, res->size, version)) &&
+          (slug = strdup(node->val))) {
+        hash_set(lookup->refs, slug, commit);
+        commit = NULL;
+      }
+
+      free(version);
+      free(commit);
+    }
+    list_iterator_destroy(iterator);
+  }
+
+  http_get_free(res);
+}
+
+hash_t *clib_refs_resolve(list_t *slugs, int concurrency, CURLSH *share) {
+  list_iterator_t *iterator = NULL;
+  list_node_t *node = NULL;
+  clib_download_t *engine = NULL;
+  hash_t *repos = NULL;
+  hash_t *refs = NULL;
+
+  if (!slugs || !(refs = hash_new()) || !(repos = hash_new()) ||
+      !(engine = clib_download_new(concurrency, share)) ||
+      !(iterator = list_iterator_new(slugs, LIST_HEAD))) {
+    goto error;
+  }
+
+  // the versions of a repo are all in one advertisement of its refs
+  while ((node = list_iterator_next(iterator))) {
+    char *slug = node->val;
+    char *author = parse_repo_owner(slug, DEFAULT_REPO_OWNER);
+    char *name = parse_repo_name(slug);
+    char *version = parse_repo_version(slug, DEFAULT_REPO_VERSION);
+    char *repo = NULL;
+    lookup_t *lookup = NULL;
+
+    if (!author || !name || !version || hash_get(refs, slug)) {
+      goto loop_cleanup;
+    }
+
+    if (is_commit(version, strlen(version))) {
+      char *key = strdup(slug);
+      if (key) {
+        hash_set(refs, key, version);
+        version = NULL;
+      }
+      goto loop_cleanup;
+    }
+
+    if (-1 == asprintf(&repo, "%s/%s", author, name)) {
+      goto loop_cleanup;
+    }
+
+    if (!(lookup = hash_get(repos, repo))) {
+      if (!(lookup = malloc(sizeof(lookup_t))) ||
+          !(lookup->slugs = list_new())) {
+        free(lookup);
+        goto loop_cleanup;
+      }
+
+      lookup->refs = refs;
+      hash_set(repos, repo, lookup);
+      repo = NULL;
+    }
+
+    list_rpush(lookup->slugs, list_node_new(slug));
+
+  loop_cleanup:
+    free(author);
+    free(name);
+    free(version);
+    free(repo);
+  }
+
+  list_iterator_destroy(iterator);
+
+  hash_each(repos, {
+    char *url = NULL;
+    if (-1 != asprintf(&url, REFS_URL, key)) {
+      clib_download_get(engine, url, NULL, NULL, lookup_done, val);
+      free(url);
+    }
+  });
+
+  clib_download_wait(engine);
+
+  hash_each(repos, {
+    free((char *)key);
+    list_destroy(((lookup_t *)val)->slugs);
+    free(val);
+  });
+
+  hash_free(repos);
+  clib_download_free(engine);
+  return refs;
+
+error:
+  if (repos) {
+    hash_free(repos);
+  }
+  if (engine) {
+    clib_download_free(engine);
+  }
+  clib_refs_free(refs);
+  return NULL;
+}
+
+void clib_refs_free(hash_t *refs) {
+  if (NULL == refs) {
+    return;
+  }
+
+  hash_each(refs, {
+    free((char *)key);
+    free(val);
+  });
+
+  hash_free(refs);
+}
@@ -0,0 +1,29 @@
+//
+// clib-refs.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_REFS_H
+#define CLIB_REFS_H 1
+
+#include "hash/hash.h"
+#include "list/list.h"
+#include <curl/curl.h>
+
+/**
+ * Looks up the commits that the versions of `slugs`, each one
+ * `author/name@version`, are at. The versions of a repo are found with
+ * one request for its refs, as `git ls-remote` does, and the requests of
+ * all the repos are made at once. A version is a tag, a branch or a
+ * commit.
+ *
+ * @return A new hash of the slugs that were found to their commits, to
+ * be freed with `clib_refs_free()`, or NULL on error
+ */
+hash_t *clib_refs_resolve(list_t *slugs, int concurrency, CURLSH *share);
+
+void clib_refs_free(hash_t *refs);
+
+#endif
@@ -0,0 +1,223 @@
+//
+// clib-registry.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-registry.h"
+#include "http-get/http-get.h"
+#include "parson/parson.h"
+#include "strdup/strdup.h"
+#include "wiki-registry/wiki-registry.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+const char *clib_registry_url(void) {
+  const char *url = getenv("CLIB_REGISTRY_URL");
+  return url && *url ? url : NULL;
+}
+
+/**
+ * Inflates the gzipped `size` bytes of `body`.
+ *
+ * @return A new null-terminated string, with its length in `length`, or
+ * NULL on error or when clib was built without zlib
+ */
+
+static char *gunzip(const char *body, size_t size, size_t *length) {
+#ifdef HAVE_ZLIB
+  z_stream stream = {0};
+  size_t capacity = size * 4 + 1;
+  char *data = malloc(capacity);
+  int rc = Z_OK;
+
+  // 16 for the gzip header
+  if (!data || Z_OK != inflateInit2(&stream, 16 + MAX_WBITS)) {
+    free(data);
+    return NULL;
+  }
+
+  stream.next_in = (Bytef *)body;
+  stream.avail_in = (uInt)size;
+
+  while (Z_OK == rc) {
+    if (stream.total_out + 1 >= capacity) {
+      char *grown = realloc(data, capacity * 2);
+
+      if (!grown) {
+        break;
+      }
+
+      data = grown;
+      capacity *= 2;
+    }
+
+    stream.next_out = (Bytef *)data + stream.total_out;
+    stream.avail_out = (uInt)(capacity - stream.total_out - 1);
+    rc = inflate(&stream, Z_NO_FLUSH);
+  }
+
+  inflateEnd(&stream);
+
+  if (Z_STREAM_END != rc) {
+    free(data);
+    return NULL;
+  }
+
+  *length = stream.total_out;
+  data[*length] = 0;
+  return data;
+#else
+  (void)body;
+  (void)size;
+  (void)length;
+  return NULL;
+#endif
+}
+
+/**
+ * Adds the package of `value` to `pkgs`, unless it isn't one.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int add_package(list_t *pkgs, JSON_Value *value) {
+  JSON_Object *object = json_value_get_object(value);
+  const char *repo = json_object_get_string(object, "repo");
+  const char *description = json_object_get_string(object, "description");
+  const char *category = json_object_get_string(object, "category");
+  wiki_package_t *pkg = NULL;
+  list_node_t *node = NULL;
+
+  if (!repo || !*repo || !description) {
+    return 0;
+  }
+
+  if (!(pkg = wiki_package_new(repo, description, category ? category : ""))) {
+    return -1;
+  }
+
+  if (!(node = list_node_new(pkg))) {
+    wiki_package_free(pkg);
+    return -1;
+  }
+
+  list_rpush(pkgs, node);
+  return 0;
+}
+
+static void free_packages(list_t *pkgs) {
+  list_node_t *node = NULL;
+
+  list_each(pkgs, node) {
+    wiki_package_free(node->val);
+  }
+
+  list_destroy(pkgs);
+}
+
+list_t *clib_registry_parse(char *body, size_t size) {
+  char *inflated = NULL;
+  char *cursor = body;
+  list_t *pkgs = NULL;
+  int failed = 0;
+
+  if (!body) {
+    return NULL;
+  }
+
+  // served as a .gz file rather than with a Content-Encoding
+  if (size >= 2 && 0x1f == (unsigned char)body[0] &&
+      0x8b == (unsigned char)body[1]) {
+    if (!(cursor = inflated = gunzip(body, size, &size))) {
+      return NULL;
+    }
+  }
+
+  while (isspace((unsigned char)*cursor)) {
+    cursor++;
+  }
+
+  if (!(pkgs = list_new())) {
+    free(inflated);
+    return NULL;
+  }
+
+  if ('[' == *cursor) {
+    JSON_Value *root = json_parse_string(cursor);
+    JSON_Array *packages = json_value_get_array(root);
+    size_t count = json_array_get_count(packages);
+
+    failed = NULL == packages;
+
+    for (size_t i = 0; !failed && i < count; i++) {
+      failed = 0 != add_package(pkgs, json_array_get_value(packages, i));
+    }
+
+    json_value_free(root);
+  } else {
+    // a package on each line, each parsed on its own
+    while (!failed && *cursor) {
+      char *end = strchr(cursor, '\n');
+      JSON_Value *value = NULL;
+
+      if (end) {
+        *end = 0;
+      }
+
+      while (isspace((unsigned char)*cursor)) {
+        cursor++;
+      }
+
+      if (*cursor) {
+        value = json_parse_string(cursor);
+        failed = !value || 0 != add_package(pkgs, value);
+        json_value_free(value);
+      }
+
+      if (end) {
+        *end = '\n';
+      }
+
+      cursor = end ? end + 1 : cursor + strlen(cursor);
+    }
+  }
+
+  free(inflated);
+
+  if (failed || 0 == pkgs->len) {
+    free_packages(pkgs);
+    return NULL;
+  }
+
+  return pkgs;
+}
+
+int clib_registry_fetch(const char *etag, list_t **pkgs, char **new_etag) {
+  const char *url = clib_registry_url();
+  http_get_response_t *res = NULL;
+  int rc = -1;
+
+  *pkgs = NULL;
+  *new_etag = NULL;
+
+  if (!url || !(res = http_get_conditional_shared(url, NULL, etag, NULL))) {
+    return -1;
+  }
+
+  if (etag && 304 == res->status) {
+    rc = 1;
+  } else if (res->ok && (*pkgs = clib_registry_parse(res->data, res->size))) {
+    *new_etag = res->etag ? strdup(res->etag) : NULL;
+    rc = 0;
+  }
+
+  http_get_free(res);
+  return rc;
+}
@@ -0,0 +1,48 @@
+//
+// clib-registry.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_REGISTRY_H
+#define CLIB_REGISTRY_H 1
+
+#include "list/list.h"
+#include <stddef.h>
+
+/**
+ * A registry of packages in JSON, read by search before the GitHub wiki
+ * is scraped. It is served at the URL of the `CLIB_REGISTRY_URL`
+ * environment variable, as a JSON array of packages or as NDJSON with a
+ * package on each line, and may be gzipped:
+ *
+ *   {"repo": "clibs/list", "description": "...", "category": "..."}
+ *
+ * Like on the wiki, the `href` of a package is its repo on GitHub.
+ */
+
+/**
+ * @return The URL of the registry, or NULL if none is configured
+ */
+const char *clib_registry_url(void);
+
+/**
+ * Parses `body`, null-terminated after its `size` bytes, into a list of
+ * `wiki_package_t`. Entries without a repo or description are skipped.
+ *
+ * @return A new list, or NULL if `body` isn't a registry or has no packages
+ */
+list_t *clib_registry_parse(char *body, size_t size);
+
+/**
+ * Fetches the registry, unless it still has the ETag `etag`, which may be
+ * NULL.
+ *
+ * @return 0 with the packages in `pkgs` and the new ETag, if any, in
+ * `new_etag`, 1 if the registry didn't change, -1 on error or if none is
+ * configured
+ */
+int clib_registry_fetch(const char *etag, list_t **pkgs, char **new_etag);
+
+#endif
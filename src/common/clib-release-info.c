@@ -5,10 +5,19 @@
 // MIT licensed
 //
 
+#include "clib-release-info.h"
+#include "clib-ratelimit.h"
+#include "asprintf/asprintf.h"
 #include "debug/debug.h"
+#include "fs/fs.h"
 #include "http-get/http-get.h"
 #include "parson/parson.h"
 #include "strdup/strdup.h"
+#include "trim/trim.h"
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 #define LATEST_RELEASE_ENDPOINT                                                \
   "https://api.github.com/repos/clibs/clib/releases/latest"
@@ -16,15 +25,35 @@
 static debug_t debugger;
 
 const char *clib_release_get_latest_tag(void) {
+  return clib_release_get_latest_tag_timeout(0);
+}
+
+const char *clib_release_get_latest_tag_timeout(long timeout) {
   debug_init(&debugger, "clib-release-info");
 
-  http_get_response_t *res = http_get(LATEST_RELEASE_ENDPOINT);
+  http_get_transfer_t *transfer =
+      http_get_transfer_new(LATEST_RELEASE_ENDPOINT, NULL, NULL, NULL);
+  http_get_response_t *res = NULL;
 
   JSON_Value *root_json = NULL;
   JSON_Object *json_object = NULL;
   char *tag_name = NULL;
 
-  if (!res->ok) {
+  if (!transfer) {
+    return NULL;
+  }
+
+  if (timeout > 0) {
+    curl_easy_setopt(transfer->req, CURLOPT_CONNECTTIMEOUT, timeout);
+    curl_easy_setopt(transfer->req, CURLOPT_TIMEOUT, timeout);
+  }
+
+  clib_ratelimit_acquire(LATEST_RELEASE_ENDPOINT);
+  res = http_get_transfer_finish(transfer, curl_easy_perform(transfer->req));
+  clib_ratelimit_release(LATEST_RELEASE_ENDPOINT, res ? res->status : 0,
+                         res ? res->retry_after : 0);
+
+  if (!res || !res->ok) {
     debug(&debugger, "Couldn't lookup latest release");
     goto cleanup;
   }
@@ -54,3 +83,37 @@ cleanup:
 
   return tag_name;
 }
+
+const char *clib_release_get_latest_tag_cached(const char *path, long max_age,
+                                               long timeout) {
+  fs_stats *stats = NULL;
+  char *cached = NULL;
+  char *tmp = NULL;
+  const char *tag_name = NULL;
+
+  if (path && max_age > 0 && (stats = fs_stat(path))) {
+    if (time(NULL) - stats->st_mtime < max_age && (cached = fs_read(path)) &&
+        *trim(cached)) {
+      tag_name = strdup(trim(cached));
+    }
+
+    free(stats);
+    free(cached);
+
+    if (tag_name) {
+      return tag_name;
+    }
+  }
+
+  tag_name = clib_release_get_latest_tag_timeout(timeout);
+
+  // readers see all of it or nothing
+  if (tag_name && path && -1 != asprintf(&tmp, "%s.tmp", path)) {
+    if (-1 != fs_write(tmp, tag_name)) {
+      rename(tmp, path);
+    }
+    free(tmp);
+  }
+
+  return tag_name;
+}
@@ -8,9 +8,30 @@
 #ifndef CLIB_RELEASE_INFO_H
 #define CLIB_RELEASE_INFO_H
 
+// where in the meta cache dir the latest tag is kept between lookups
+#define CLIB_RELEASE_TAG_FILE "release-tag"
+
 /**
  * @return NULL on failure, char * otherwise that must be freed
  */
 const char *clib_release_get_latest_tag(void);
 
+/**
+ * Like `clib_release_get_latest_tag()`, giving up after `timeout` seconds
+ * unless it is 0.
+ *
+ * @return NULL on failure, char * otherwise that must be freed
+ */
+const char *clib_release_get_latest_tag_timeout(long timeout);
+
+/**
+ * The tag cached in `path` by an earlier lookup when it is less than
+ * `max_age` seconds old, or else the tag looked up as with
+ * `clib_release_get_latest_tag_timeout()` and cached there.
+ *
+ * @return NULL on failure, char * otherwise that must be freed
+ */
+const char *clib_release_get_latest_tag_cached(const char *path, long max_age,
+                                               long timeout);
+
 #endif
@@ -0,0 +1,157 @@
+//
+// clib-remote.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-remote.h"
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define CLIB_REMOTE_TIMEOUT 60L
+
+static const char *base_url = NULL;
+static char authorization[BUFSIZ];
+static int readonly = 0;
+
+int clib_remote_init(void) {
+  const char *token = NULL;
+  const char *flag = NULL;
+
+  if (base_url) {
+    return 1;
+  }
+
+  if (!(base_url = getenv("CLIB_REMOTE_CACHE")) || 0 == *base_url) {
+    base_url = NULL;
+    return 0;
+  }
+
+  token = getenv("CLIB_REMOTE_CACHE_TOKEN");
+  if (token && *token &&
+      sizeof(authorization) <= (size_t)snprintf(authorization,
+                                                sizeof(authorization),
+                                                "Authorization: Bearer %s",
+                                                token)) {
+    authorization[0] = 0;
+  }
+
+  flag = getenv("CLIB_REMOTE_CACHE_READONLY");
+  readonly = flag && 0 == strcmp(flag, "1");
+
+  return 1;
+}
+
+int clib_remote_writable(void) { return base_url && !readonly; }
+
+/**
+ * Perform `method` on the entry `key`, reading the request body from or
+ * writing the response body to `file`
+ *
+ * @return The HTTP status, or -1 if the request failed
+ */
+
+static long request(const char *method, const char *key, FILE *file,
+                    curl_off_t size) {
+  struct curl_slist *headers = NULL;
+  char url[BUFSIZ * 2];
+  long status = -1;
+  CURL *req = NULL;
+  size_t len = 0;
+
+  if (!base_url) {
+    return -1;
+  }
+
+  len = strlen(base_url);
+  if (sizeof(url) <= (size_t)snprintf(url, sizeof(url), "%s%s%s", base_url,
+                                      len && '/' == base_url[len - 1] ? ""
+                                                                      : "/",
+                                      key)) {
+    return -1;
+  }
+
+  if (!(req = curl_easy_init())) {
+    return -1;
+  }
+
+  if (*authorization) {
+    headers = curl_slist_append(headers, authorization);
+  }
+
+  curl_easy_setopt(req, CURLOPT_URL, url);
+  curl_easy_setopt(req, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(req, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(req, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(req, CURLOPT_TIMEOUT, CLIB_REMOTE_TIMEOUT);
+
+  if (0 == strcmp(method, "HEAD")) {
+    curl_easy_setopt(req, CURLOPT_NOBODY, 1L);
+  } else if (0 == strcmp(method, "PUT")) {
+    curl_easy_setopt(req, CURLOPT_UPLOAD, 1L);
+    curl_easy_setopt(req, CURLOPT_READDATA, file);
+    curl_easy_setopt(req, CURLOPT_INFILESIZE_LARGE, size);
+  } else {
+    curl_easy_setopt(req, CURLOPT_WRITEDATA, file);
+  }
+
+  if (CURLE_OK == curl_easy_perform(req)) {
+    curl_easy_getinfo(req, CURLINFO_RESPONSE_CODE, &status);
+  }
+
+  curl_slist_free_all(headers);
+  curl_easy_cleanup(req);
+  return status;
+}
+
+int clib_remote_get(const char *key, const char *file) {
+  FILE *fp = fopen(file, "wb");
+  long status = -1;
+
+  if (!fp) {
+    return -1;
+  }
+
+  status = request("GET", key, fp, 0);
+
+  if (0 != fclose(fp)) {
+    status = -1;
+  }
+
+  if (200 == status) {
+    return 0;
+  }
+
+  remove(file);
+  return 404 == status || 410 == status ? 1 : -1;
+}
+
+int clib_remote_has(const char *key) {
+  long status = request("HEAD", key, NULL, 0);
+
+  if (200 == status) {
+    return 1;
+  }
+
+  return 404 == status || 410 == status ? 0 : -1;
+}
+
+int clib_remote_put(const char *key, const char *file) {
+  struct stat st;
+  long status = -1;
+  FILE *fp = NULL;
+
+  if (!clib_remote_writable() || 0 != stat(file, &st) ||
+      !(fp = fopen(file, "rb"))) {
+    return -1;
+  }
+
+  status = request("PUT", key, fp, (curl_off_t)st.st_size);
+  fclose(fp);
+
+  return status >= 200 && status < 300 ? 0 : -1;
+}
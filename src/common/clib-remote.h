@@ -0,0 +1,55 @@
+//
+// clib-remote.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_REMOTE_H
+#define CLIB_REMOTE_H 1
+
+/**
+ * A shared cache served over HTTP that sits between the local cache and
+ * the package sources. Entries are plain files addressed by a relative
+ * `key`, read with GET and written with PUT, so any web server, or an
+ * object store gateway that accepts them, can host it.
+ *
+ * It is configured with the environment variables:
+ *
+ *   CLIB_REMOTE_CACHE           base URL, the tier is off without it
+ *   CLIB_REMOTE_CACHE_TOKEN     sent as a bearer `Authorization` header
+ *   CLIB_REMOTE_CACHE_READONLY  when set to 1, nothing is uploaded
+ */
+
+/**
+ * Reads the configuration, safe to call more than once
+ *
+ * @return 1 if a remote cache is configured, 0 otherwise
+ */
+int clib_remote_init(void);
+
+/**
+ * @return 1 if entries should be uploaded to the remote cache
+ */
+int clib_remote_writable(void);
+
+/**
+ * Downloads the entry `key` into `file`
+ *
+ * @return 0 on success, 1 if there is no such entry, -1 on error
+ */
+int clib_remote_get(const char *key, const char *file);
+
+/**
+ * @return 1 if the entry `key` exists, 0 if it doesn't, -1 on error
+ */
+int clib_remote_has(const char *key);
+
+/**
+ * Uploads `file` as the entry `key`
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_remote_put(const char *key, const char *file);
+
+#endif
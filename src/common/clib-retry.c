@@ -0,0 +1,195 @@
+//
+// clib-retry.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-retry.h"
+#include <curl/curl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// latencies are counted in buckets a quarter of a power of two wide, so
+// that a percentile is off by 25 percent at most
+#define BUCKETS 252
+
+static int retries = CLIB_RETRY_DEFAULT_RETRIES;
+static long delay = CLIB_RETRY_DEFAULT_DELAY;
+
+// -1 until first asked for
+static int hedging = -1;
+
+static uint64_t latencies[BUCKETS];
+static uint64_t observed = 0;
+
+#if defined(HAVE_PTHREADS) && defined(__GNUC__)
+static __thread uint64_t seed = 0;
+#else
+static uint64_t seed = 0;
+#endif
+
+void clib_retry_set_policy(int value, long first_delay) {
+  if (value >= 0) {
+    retries = value;
+  }
+
+  if (first_delay >= 0) {
+    delay = first_delay;
+  }
+}
+
+void clib_retry_set_hedging(int value) { hedging = value ? 1 : 0; }
+
+static int get_hedging(void) {
+  if (-1 == hedging) {
+    const char *env = getenv("CLIB_HEDGE");
+    hedging = env && *env && 0 != strcmp("0", env);
+  }
+
+  return hedging;
+}
+
+clib_retry_class_t clib_retry_classify(int code, long status) {
+  // all there is to go by is the answer, if there was one
+  if (-1 == code) {
+    code = 0 == status ? CURLE_COULDNT_CONNECT : CURLE_OK;
+  }
+
+  switch (code) {
+  case CURLE_OK:
+    break;
+  case CURLE_COULDNT_RESOLVE_HOST:
+  case CURLE_COULDNT_RESOLVE_PROXY:
+    return CLIB_RETRY_DNS;
+  case CURLE_COULDNT_CONNECT:
+  case CURLE_SSL_CONNECT_ERROR:
+    return CLIB_RETRY_CONNECT;
+  case CURLE_OPERATION_TIMEDOUT:
+  case CURLE_PARTIAL_FILE:
+  case CURLE_GOT_NOTHING:
+  case CURLE_SEND_ERROR:
+  case CURLE_RECV_ERROR:
+#if LIBCURL_VERSION_NUM >= 0x073100
+  case CURLE_HTTP2_STREAM:
+#endif
+  case CURLE_HTTP2:
+    return CLIB_RETRY_TRANSFER;
+  default:
+    return CLIB_RETRY_FATAL;
+  }
+
+  if (404 == status || 410 == status) {
+    return CLIB_RETRY_MISSING;
+  }
+
+  if (429 == status) {
+    return CLIB_RETRY_THROTTLED;
+  }
+
+  if (status >= 500) {
+    return CLIB_RETRY_SERVER;
+  }
+
+  return status >= 200 && status < 400 ? CLIB_RETRY_OK : CLIB_RETRY_FATAL;
+}
+
+int clib_retry_again(clib_retry_class_t kind, int attempts) {
+  switch (kind) {
+  case CLIB_RETRY_DNS:
+    // a name that didn't resolve rarely does a moment later
+    return attempts < 2 && retries > 0;
+  case CLIB_RETRY_CONNECT:
+  case CLIB_RETRY_TRANSFER:
+  case CLIB_RETRY_SERVER:
+  case CLIB_RETRY_THROTTLED:
+    return attempts <= retries;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * @return The next number of a xorshift sequence of the calling thread
+ */
+
+static uint64_t next_random(void) {
+  if (0 == seed) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    seed = ((uint64_t)tv.tv_sec << 20) ^ (uint64_t)tv.tv_usec ^
+           ((uint64_t)getpid() << 32) ^ (uint64_t)(uintptr_t)&seed;
+    seed = seed ? seed : 1;
+  }
+
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+long clib_retry_backoff(int attempts) {
+  long ceiling = delay;
+
+  for (int i = 1; i < attempts && ceiling < CLIB_RETRY_MAX_DELAY; i++) {
+    ceiling *= 2;
+  }
+
+  if (ceiling > CLIB_RETRY_MAX_DELAY) {
+    ceiling = CLIB_RETRY_MAX_DELAY;
+  }
+
+  if (ceiling < 2) {
+    return ceiling;
+  }
+
+  return ceiling / 2 + (long)(next_random() % (uint64_t)(ceiling / 2 + 1));
+}
+
+static int bucket_of(uint64_t elapsed) {
+  int msb = 0;
+
+  if (elapsed < 4) {
+    return (int)elapsed;
+  }
+
+  msb = 63 - __builtin_clzll(elapsed);
+  return 4 * (msb - 1) + (int)((elapsed >> (msb - 2)) & 3);
+}
+
+/**
+ * @return The largest latency counted in `bucket`
+ */
+
+static uint64_t bucket_limit(int bucket) {
+  if (bucket < 4) {
+    return (uint64_t)bucket;
+  }
+
+  return ((uint64_t)(5 + bucket % 4) << (bucket / 4 - 1)) - 1;
+}
+
+void clib_retry_observe(uint64_t elapsed) {
+  __sync_fetch_and_add(&latencies[bucket_of(elapsed)], 1);
+  __sync_fetch_and_add(&observed, 1);
+}
+
+uint64_t clib_retry_hedge_after(void) {
+  uint64_t count = __sync_fetch_and_add(&observed, 0);
+  uint64_t seen = 0;
+
+  if (!get_hedging() || count < CLIB_RETRY_HEDGE_SAMPLES) {
+    return 0;
+  }
+
+  for (int i = 0; i < BUCKETS; i++) {
+    seen += __sync_fetch_and_add(&latencies[i], 0);
+    if (seen * 100 >= count * 95) {
+      return bucket_limit(i) + 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+//
+// clib-retry.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_RETRY_H
+#define CLIB_RETRY_H 1
+
+#include <stdint.h>
+
+// tries of a request after the first
+#define CLIB_RETRY_DEFAULT_RETRIES 3
+
+// milliseconds before the first try again, doubling for the next ones
+#define CLIB_RETRY_DEFAULT_DELAY 500
+
+// the longest wait before a try again, in milliseconds
+#define CLIB_RETRY_MAX_DELAY 10000
+
+// requests that have to be through before the slow ones are hedged
+#define CLIB_RETRY_HEDGE_SAMPLES 20
+
+/**
+ * What a request that is over ran into, and so whether it is worth
+ * another try.
+ */
+typedef enum {
+  CLIB_RETRY_OK = 0,
+  CLIB_RETRY_DNS,       // the host didn't resolve, tried once more
+  CLIB_RETRY_CONNECT,   // no connection to the host
+  CLIB_RETRY_TRANSFER,  // the connection broke or timed out on the way
+  CLIB_RETRY_SERVER,    // a 5xx
+  CLIB_RETRY_THROTTLED, // a 429, paced by the rate limiter
+  CLIB_RETRY_MISSING,   // a 404 or 410, never tried again
+  CLIB_RETRY_FATAL,     // anything else, never tried again
+} clib_retry_class_t;
+
+/**
+ * Sets how many times a request is tried again, and the milliseconds
+ * before the first of them, doubling for each one after it up to
+ * `CLIB_RETRY_MAX_DELAY`. A negative value leaves a setting as it is.
+ */
+void clib_retry_set_policy(int retries, long delay);
+
+/**
+ * Hedges requests from now on, see `clib_retry_hedge_after()`. It is off
+ * unless `CLIB_HEDGE=1` is set.
+ */
+void clib_retry_set_hedging(int hedging);
+
+/**
+ * Classifies a request that ended with the `CURLcode` `code` and the HTTP
+ * `status`, 0 when there was no response. A `code` of -1 stands for a
+ * request that failed for a reason that isn't known.
+ */
+clib_retry_class_t clib_retry_classify(int code, long status);
+
+/**
+ * @return 1 when a request that ended with `kind` after `attempts` tries
+ * is to be tried again, 0 otherwise
+ */
+int clib_retry_again(clib_retry_class_t kind, int attempts);
+
+/**
+ * The milliseconds to wait before try `attempts` + 1: a random share
+ * between half and all of the exponential backoff, so that the requests
+ * that failed together don't come back together.
+ */
+long clib_retry_backoff(int attempts);
+
+/**
+ * Records a request that went through in `elapsed` microseconds.
+ */
+void clib_retry_observe(uint64_t elapsed);
+
+/**
+ * @return The microseconds after which a request still in flight takes
+ * longer than 95 percent of those that went through in this run, and is
+ * hedged with a duplicate over a new connection, or 0 while hedging is
+ * off or fewer than `CLIB_RETRY_HEDGE_SAMPLES` requests went through
+ */
+uint64_t clib_retry_hedge_after(void);
+
+#endif
@@ -0,0 +1,1091 @@
+//
+// clib-search-index.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-search-index.h"
+#include "case/case.h"
+#include "parse-repo/parse-repo.h"
+#include "parson/parson.h"
+#include "str-find/str-find.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// a trigram is written as the hex of its three bytes
+#define TRIGRAM_KEY_SIZE 6
+
+// the ranges of the categories are written before the trigrams, on lines
+// "#<first package> <packages>", which sort before every trigram
+#define RANGE_PREFIX '#'
+
+// the weights of the ranked search, for each term
+#define RANK_EXACT 100
+#define RANK_PREFIX 40
+#define RANK_NAME 20
+#define RANK_FUZZY 16
+#define RANK_FUZZY_EDIT 4
+#define RANK_REPO 8
+#define RANK_DESCRIPTION 2
+#define RANK_DESCRIPTION_MAX 5
+#define RANK_HREF 1
+
+// names and terms longer than that aren't compared by edit distance
+#define RANK_FUZZY_LENGTH 64
+
+// `count` packages of a same category, from package `first` on
+typedef struct {
+  int first;
+  int count;
+} range_t;
+
+// the fields of a package which are strings of its own
+enum { FIELD_NAME, FIELD_REPO, FIELD_HREF, FIELD_DESCRIPTION, FIELD_COUNT };
+
+static const char *field_keys[FIELD_COUNT] = {"name", "repo", "href",
+                                              "description"};
+
+struct clib_search_index {
+  // every string of the packages, null-terminated, one after the other
+  char *strings;
+  // for each field, its offset in `strings` for every package
+  uint32_t *fields[FIELD_COUNT];
+  // for every package, the index of its category in `categories`, the
+  // offsets of the distinct ones
+  int *category;
+  uint32_t *categories;
+  int categories_count;
+  // the runs of packages of a same category, in order
+  range_t *ranges;
+  int ranges_count;
+  // when `filtered`, for every category, whether it is searched
+  char *selected;
+  int filtered;
+  int size;
+  // the lines "<trigram> <package> <package>...", sorted
+  fs_mapping trigrams;
+  char **lines;
+  size_t lines_count;
+};
+
+typedef struct {
+  uint32_t trigram;
+  int package;
+} posting_t;
+
+typedef struct {
+  int package;
+  int score;
+} result_t;
+
+static uint32_t trigram_at(const char *text) {
+  return (uint32_t)tolower((unsigned char)text[0]) << 16 |
+         (uint32_t)tolower((unsigned char)text[1]) << 8 |
+         (uint32_t)tolower((unsigned char)text[2]);
+}
+
+/**
+ * Appends the trigrams of `text` in `package` to `postings`.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int add_postings(posting_t **postings, size_t *count,
+                        size_t *capacity, const char *text, int package) {
+  size_t length = text ? strlen(text) : 0;
+
+  for (size_t i = 0; i + 3 <= length; i++) {
+    if (*count == *capacity) {
+      size_t grown = *capacity ? *capacity * 2 : 4096;
+      posting_t *resized = realloc(*postings, grown * sizeof(posting_t));
+
+      if (NULL == resized) {
+        return -1;
+      }
+
+      *postings = resized;
+      *capacity = grown;
+    }
+
+    (*postings)[*count].trigram = trigram_at(text + i);
+    (*postings)[*count].package = package;
+    (*count)++;
+  }
+
+  return 0;
+}
+
+static int compare_postings(const void *a, const void *b) {
+  const posting_t *left = a;
+  const posting_t *right = b;
+
+  if (left->trigram != right->trigram) {
+    return left->trigram < right->trigram ? -1 : 1;
+  }
+
+  return left->package - right->package;
+}
+
+/**
+ * Writes the `ranges` of the categories, then the posting lists of the
+ * sorted `postings`, a line for each trigram.
+ *
+ * @return A new string, or NULL on error
+ */
+
+static char *write_trigrams(range_t *ranges, int ranges_count,
+                            posting_t *postings, size_t count) {
+  // room for every key and package, each up to 10 digits and a space,
+  // and every range, two of them, a prefix and a space
+  char *trigrams = malloc(count * (TRIGRAM_KEY_SIZE + 1 + 11) +
+                          ranges_count * (2 + 2 * 11) + 1);
+  char *cursor = trigrams;
+
+  if (NULL == trigrams) {
+    return NULL;
+  }
+
+  for (int i = 0; i < ranges_count; i++) {
+    cursor += sprintf(cursor, "%s%c%d %d", 0 == i ? "" : "\n", RANGE_PREFIX,
+                      ranges[i].first, ranges[i].count);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (0 == i || postings[i].trigram != postings[i - 1].trigram) {
+      cursor += sprintf(cursor, "%s%06x", cursor == trigrams ? "" : "\n",
+                        postings[i].trigram);
+    } else if (postings[i].package == postings[i - 1].package) {
+      continue;
+    }
+
+    cursor += sprintf(cursor, " %d", postings[i].package);
+  }
+
+  *cursor = 0;
+  return trigrams;
+}
+
+int clib_search_index_build(list_t *pkgs, char **packages_json,
+                            char **trigrams) {
+  JSON_Value *root = json_value_init_array();
+  JSON_Array *packages = json_value_get_array(root);
+  list_node_t *node = NULL;
+  const char *category = NULL;
+  posting_t *postings = NULL;
+  range_t *ranges = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  int ranges_count = 0;
+  int size = 0;
+  int rc = -1;
+
+  *packages_json = *trigrams = NULL;
+
+  // there are at most as many ranges as packages
+  if (!packages || !(ranges = malloc((pkgs->len + 1) * sizeof(range_t)))) {
+    goto cleanup;
+  }
+
+  list_each(pkgs, node) {
+    wiki_package_t *pkg = node->val;
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *object = json_value_get_object(value);
+    char *name = parse_repo_name(pkg->repo);
+    int failed = 0;
+
+    if (!object || !name) {
+      json_value_free(value);
+      free(name);
+      goto cleanup;
+    }
+
+    if (!category || 0 != strcmp(category, pkg->category)) {
+      ranges[ranges_count].first = size;
+      ranges[ranges_count++].count = 0;
+      category = pkg->category;
+    }
+
+    ranges[ranges_count - 1].count++;
+
+    json_object_set_string(object, "name", name);
+    json_object_set_string(object, "repo", pkg->repo);
+    json_object_set_string(object, "href", pkg->href);
+    json_object_set_string(object, "description", pkg->description);
+    json_object_set_string(object, "category", pkg->category);
+    json_array_append_value(packages, value);
+
+    failed |= add_postings(&postings, &count, &capacity, name, size);
+    failed |= add_postings(&postings, &count, &capacity, pkg->repo, size);
+    failed |=
+        add_postings(&postings, &count, &capacity, pkg->description, size);
+    failed |= add_postings(&postings, &count, &capacity, pkg->href, size);
+    free(name);
+
+    if (0 != failed) {
+      goto cleanup;
+    }
+
+    size++;
+  }
+
+  qsort(postings, count, sizeof(posting_t), compare_postings);
+
+  if (!(*trigrams = write_trigrams(ranges, ranges_count, postings, count)) ||
+      !(*packages_json = json_serialize_to_string(root))) {
+    free(*trigrams);
+    *trigrams = NULL;
+    goto cleanup;
+  }
+
+  rc = 0;
+
+cleanup:
+  json_value_free(root);
+  free(postings);
+  free(ranges);
+  return rc;
+}
+
+/**
+ * @return Field `field` of package `index`
+ */
+
+static const char *field_of(clib_search_index_t *self, int index, int field) {
+  return self->strings + self->fields[field][index];
+}
+
+/**
+ * Reads the ranges of the categories written before the trigrams, which
+ * only count when they cover all the packages, one after the other.
+ * Indexes written before there were any have none.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int read_ranges(clib_search_index_t *self) {
+  int count = 0;
+  int next = 0;
+
+  while ((size_t)count < self->lines_count &&
+         RANGE_PREFIX == self->lines[count][0]) {
+    count++;
+  }
+
+  if (0 == count) {
+    return 0;
+  }
+
+  if (!(self->ranges = malloc(count * sizeof(range_t)))) {
+    return -1;
+  }
+
+  for (int i = 0; i < count; i++) {
+    range_t *range = &self->ranges[i];
+
+    if (2 != sscanf(self->lines[i] + 1, "%d %d", &range->first,
+                    &range->count) ||
+        range->first != next || range->count <= 0 ||
+        range->count > self->size - next) {
+      break;
+    }
+
+    next += range->count;
+  }
+
+  if (next == self->size) {
+    self->ranges_count = count;
+  }
+
+  return 0;
+}
+
+/**
+ * Finds the runs of packages of a same category, for an index that
+ * doesn't have them.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int find_ranges(clib_search_index_t *self) {
+  free(self->ranges);
+
+  if (!(self->ranges = malloc((self->size + 1) * sizeof(range_t)))) {
+    return -1;
+  }
+
+  self->ranges_count = 0;
+
+  for (int i = 0; i < self->size; i++) {
+    if (0 == i || self->category[i] != self->category[i - 1]) {
+      self->ranges[self->ranges_count].first = i;
+      self->ranges[self->ranges_count++].count = 0;
+    }
+
+    self->ranges[self->ranges_count - 1].count++;
+  }
+
+  return 0;
+}
+
+/**
+ * Copies the strings of the `packages` of a parsed index into the pool of
+ * `self`, each category only once. With the ranges of the categories,
+ * only the first package of each is looked at for its category.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int load_packages(clib_search_index_t *self, JSON_Array *packages) {
+  const char **categories = NULL;
+  size_t length = 0;
+  int rc = -1;
+
+  for (int i = 0; i < FIELD_COUNT; i++) {
+    if (!(self->fields[i] = malloc((self->size + 1) * sizeof(uint32_t)))) {
+      return -1;
+    }
+  }
+
+  self->category = malloc((self->size + 1) * sizeof(int));
+  // there are at most as many categories as packages
+  categories = malloc((self->size + 1) * sizeof(char *));
+
+  if (!self->category || !categories) {
+    goto cleanup;
+  }
+
+  // how long the pool is, and which category each package is in
+  for (int i = 0, range = 0; i < self->size; i++) {
+    JSON_Object *object = json_array_get_object(packages, i);
+    const char *category = NULL;
+    int found = self->categories_count - 1;
+
+    for (int j = 0; j < FIELD_COUNT; j++) {
+      const char *value = json_object_get_string(object, field_keys[j]);
+
+      if (!value) {
+        goto cleanup;
+      }
+
+      length += strlen(value) + 1;
+    }
+
+    // a range is all of one category, which only its first package tells
+    if (range < self->ranges_count &&
+        i == self->ranges[range].first + self->ranges[range].count) {
+      range++;
+    }
+
+    if (range < self->ranges_count && i > self->ranges[range].first) {
+      self->category[i] = self->category[i - 1];
+      continue;
+    }
+
+    if (!(category = json_object_get_string(object, "category"))) {
+      goto cleanup;
+    }
+
+    // the packages of a category follow each other, so the last one it is
+    // most of the time
+    while (found >= 0 && 0 != strcmp(categories[found], category)) {
+      found--;
+    }
+
+    if (found < 0) {
+      found = self->categories_count++;
+      categories[found] = category;
+      length += strlen(category) + 1;
+    }
+
+    self->category[i] = found;
+  }
+
+  if (length > UINT32_MAX ||
+      !(self->categories =
+            malloc((self->categories_count + 1) * sizeof(uint32_t))) ||
+      !(self->strings = malloc(length + 1))) {
+    goto cleanup;
+  }
+
+  length = 0;
+
+  for (int i = 0; i < self->categories_count; i++) {
+    size_t size = strlen(categories[i]) + 1;
+    memcpy(self->strings + length, categories[i], size);
+    self->categories[i] = (uint32_t)length;
+    length += size;
+  }
+
+  for (int i = 0; i < self->size; i++) {
+    JSON_Object *object = json_array_get_object(packages, i);
+
+    for (int j = 0; j < FIELD_COUNT; j++) {
+      const char *value = json_object_get_string(object, field_keys[j]);
+      size_t size = strlen(value) + 1;
+      memcpy(self->strings + length, value, size);
+      self->fields[j][i] = (uint32_t)length;
+      length += size;
+    }
+  }
+
+  rc = 0;
+
+cleanup:
+  free(categories);
+  return rc;
+}
+
+clib_search_index_t *clib_search_index_parse(const char *packages_json,
+                                             fs_mapping trigrams) {
+  clib_search_index_t *self = calloc(1, sizeof(clib_search_index_t));
+  JSON_Value *root = NULL;
+  JSON_Array *packages = NULL;
+  size_t capacity = 0;
+
+  if (NULL == self) {
+    fs_unmap(&trigrams);
+    return NULL;
+  }
+
+  self->trigrams = trigrams;
+  root = json_parse_string(packages_json);
+  packages = json_value_get_array(root);
+
+  if (!packages || !trigrams.data) {
+    json_value_free(root);
+    clib_search_index_free(self);
+    return NULL;
+  }
+
+  // every line is a string of its own then, found by binary search
+  // a mapping is private, so the lines can be cut in place
+  for (char *line = trigrams.data; line && *line;) {
+    char *end = strchr(line, '\n');
+
+    if (self->lines_count == capacity) {
+      size_t grown = capacity ? capacity * 2 : 1024;
+      char **resized = realloc(self->lines, grown * sizeof(char *));
+
+      if (NULL == resized) {
+        json_value_free(root);
+        clib_search_index_free(self);
+        return NULL;
+      }
+
+      self->lines = resized;
+      capacity = grown;
+    }
+
+    self->lines[self->lines_count++] = line;
+
+    if (end) {
+      *end = 0;
+    }
+
+    line = end ? end + 1 : NULL;
+  }
+
+  self->size = (int)json_array_get_count(packages);
+
+  // the pool is all that's kept of the parsed packages
+  if (0 != read_ranges(self) || 0 != load_packages(self, packages) ||
+      (0 == self->ranges_count && 0 != find_ranges(self))) {
+    json_value_free(root);
+    clib_search_index_free(self);
+    return NULL;
+  }
+
+  json_value_free(root);
+  return self;
+}
+
+int clib_search_index_size(clib_search_index_t *self) {
+  return self ? self->size : 0;
+}
+
+int clib_search_index_package(clib_search_index_t *self, int index,
+                              wiki_package_t *pkg) {
+  if (!self || index < 0 || index >= self->size) {
+    return -1;
+  }
+
+  pkg->repo = (char *)field_of(self, index, FIELD_REPO);
+  pkg->href = (char *)field_of(self, index, FIELD_HREF);
+  pkg->description = (char *)field_of(self, index, FIELD_DESCRIPTION);
+  pkg->category = self->strings + self->categories[self->category[index]];
+  return 0;
+}
+
+int clib_search_index_filter_category(clib_search_index_t *self,
+                                      const char *category) {
+  int count = 0;
+
+  if (!self) {
+    return -1;
+  }
+
+  free(self->selected);
+  self->selected = NULL;
+  self->filtered = 0;
+
+  if (!category) {
+    return self->size;
+  }
+
+  if (!(self->selected = calloc(self->categories_count + 1, 1))) {
+    return -1;
+  }
+
+  self->filtered = 1;
+
+  for (int i = 0; i < self->categories_count; i++) {
+    self->selected[i] =
+        NULL != strstr(self->strings + self->categories[i], category);
+  }
+
+  for (int i = 0; i < self->ranges_count; i++) {
+    if (self->selected[self->category[self->ranges[i].first]]) {
+      count += self->ranges[i].count;
+    }
+  }
+
+  return count;
+}
+
+/**
+ * @return Whether package `index` is in the categories searched
+ */
+
+static int is_selected(clib_search_index_t *self, int index) {
+  return !self->filtered || self->selected[self->category[index]];
+}
+
+/**
+ * Reads the packages of the categories searched into `packages`, a range
+ * at a time.
+ *
+ * @return Their number
+ */
+
+static int read_selected(clib_search_index_t *self, int *packages) {
+  int count = 0;
+
+  for (int i = 0; i < self->ranges_count; i++) {
+    const range_t *range = &self->ranges[i];
+
+    if (!is_selected(self, range->first)) {
+      continue;
+    }
+
+    for (int j = 0; j < range->count; j++) {
+      packages[count++] = range->first + j;
+    }
+  }
+
+  return count;
+}
+
+/**
+ * Reads the packages that contain the trigram at `text` into `packages`.
+ *
+ * @return Their number, 0 if there are none
+ */
+
+static int read_postings(clib_search_index_t *self, const char *text,
+                         int *packages) {
+  char key[TRIGRAM_KEY_SIZE + 1];
+  size_t low = 0;
+  size_t high = self->lines_count;
+  int count = 0;
+
+  sprintf(key, "%06x", trigram_at(text));
+
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    const char *line = self->lines[middle];
+    int order = strncmp(line, key, TRIGRAM_KEY_SIZE);
+
+    if (0 == order) {
+      char *cursor = (char *)line + TRIGRAM_KEY_SIZE;
+      char *end = NULL;
+      long package = 0;
+
+      while (count < self->size && (package = strtol(cursor, &end, 10)) >= 0 &&
+             end != cursor) {
+        if (package < self->size) {
+          packages[count++] = (int)package;
+        }
+        cursor = end;
+      }
+
+      return count;
+    }
+
+    if (order < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Narrows `candidates` down to the packages containing every trigram of
+ * `term`, of at least 3 characters.
+ *
+ * @return Number of candidates left
+ */
+
+static int find_candidates(clib_search_index_t *self, const char *term,
+                           int *candidates, int *postings) {
+  size_t length = strlen(term);
+  int count = read_postings(self, term, candidates);
+
+  if (self->filtered) {
+    int kept = 0;
+
+    for (int i = 0; i < count; i++) {
+      if (is_selected(self, candidates[i])) {
+        candidates[kept++] = candidates[i];
+      }
+    }
+
+    count = kept;
+  }
+
+  for (size_t i = 1; count > 0 && i + 3 <= length; i++) {
+    int found = read_postings(self, term + i, postings);
+    int kept = 0;
+
+    // both are sorted
+    for (int j = 0, k = 0; j < count && k < found;) {
+      if (candidates[j] < postings[k]) {
+        j++;
+      } else if (candidates[j] > postings[k]) {
+        k++;
+      } else {
+        candidates[kept++] = candidates[j];
+        j++;
+        k++;
+      }
+    }
+
+    count = kept;
+  }
+
+  return count;
+}
+
+static int contains(const char *text, const char *term) {
+  return NULL != case_find(text, term);
+}
+
+/**
+ * @return How well `term` matches the package, by the field it is in, 0
+ * if it doesn't
+ */
+
+static int score(clib_search_index_t *self, int index, const char *term) {
+  if (contains(field_of(self, index, FIELD_NAME), term)) {
+    return 4;
+  }
+
+  if (contains(field_of(self, index, FIELD_REPO), term)) {
+    return 3;
+  }
+
+  if (contains(field_of(self, index, FIELD_DESCRIPTION), term)) {
+    return 2;
+  }
+
+  return contains(field_of(self, index, FIELD_HREF), term) ? 1 : 0;
+}
+
+static int compare_results(const void *a, const void *b) {
+  const result_t *left = a;
+  const result_t *right = b;
+
+  if (left->score != right->score) {
+    return right->score - left->score;
+  }
+
+  return left->package - right->package;
+}
+
+int *clib_search_index_query(clib_search_index_t *self, int count,
+                             char *terms[], int *found) {
+  result_t *results = NULL;
+  int *candidates = NULL;
+  int *postings = NULL;
+  int *scores = NULL;
+  int *packages = NULL;
+  int size = 0;
+
+  *found = 0;
+
+  if (!self || !(packages = malloc((self->size + 1) * sizeof(int)))) {
+    return NULL;
+  }
+
+  if (0 == count) {
+    *found = read_selected(self, packages);
+    return packages;
+  }
+
+  candidates = malloc((self->size + 1) * sizeof(int));
+  postings = malloc((self->size + 1) * sizeof(int));
+  scores = calloc(self->size + 1, sizeof(int));
+  results = malloc((self->size + 1) * sizeof(result_t));
+
+  if (!candidates || !postings || !scores || !results) {
+    free(packages);
+    packages = NULL;
+    goto cleanup;
+  }
+
+  for (int i = 0; i < count; i++) {
+    int matched = 0;
+
+    // too short for a trigram, every package may contain it
+    if (strlen(terms[i]) < 3) {
+      matched = read_selected(self, candidates);
+    } else {
+      matched = find_candidates(self, terms[i], candidates, postings);
+    }
+
+    for (int j = 0; j < matched; j++) {
+      int value = score(self, candidates[j], terms[i]);
+
+      if (value > scores[candidates[j]]) {
+        scores[candidates[j]] = value;
+      }
+    }
+  }
+
+  for (int i = 0; i < self->size; i++) {
+    if (scores[i] > 0) {
+      results[size].package = i;
+      results[size].score = scores[i];
+      size++;
+    }
+  }
+
+  qsort(results, size, sizeof(result_t), compare_results);
+
+  for (int i = 0; i < size; i++) {
+    packages[i] = results[i].package;
+  }
+
+  *found = size;
+
+cleanup:
+  free(candidates);
+  free(postings);
+  free(scores);
+  free(results);
+  return packages;
+}
+
+/**
+ * @return The edit distance between `name` and the lowercase `term`,
+ * ignoring case, or `max` + 1 if it would be over `max`
+ */
+
+static int edit_distance(const char *name, const char *term, int max) {
+  int row[RANK_FUZZY_LENGTH + 1];
+  int name_length = (int)strlen(name);
+  int term_length = (int)strlen(term);
+
+  if (name_length > RANK_FUZZY_LENGTH || term_length > RANK_FUZZY_LENGTH ||
+      abs(name_length - term_length) > max) {
+    return max + 1;
+  }
+
+  for (int j = 0; j <= term_length; j++) {
+    row[j] = j;
+  }
+
+  for (int i = 1; i <= name_length; i++) {
+    int diagonal = row[0];
+    int smallest = row[0] = i;
+
+    for (int j = 1; j <= term_length; j++) {
+      int above = row[j];
+      int cost = tolower((unsigned char)name[i - 1]) != term[j - 1];
+      int value = diagonal + cost;
+
+      if (above + 1 < value) {
+        value = above + 1;
+      }
+
+      if (row[j - 1] + 1 < value) {
+        value = row[j - 1] + 1;
+      }
+
+      row[j] = value;
+      diagonal = above;
+
+      if (value < smallest) {
+        smallest = value;
+      }
+    }
+
+    if (smallest > max) {
+      return max + 1;
+    }
+  }
+
+  return row[term_length];
+}
+
+/**
+ * @return How many times `term` is in `text`, up to `max`
+ */
+
+static int occurrences(const char *text, const char *term, int max) {
+  const char *end = text + strlen(text);
+  size_t length = strlen(term);
+  int count = 0;
+
+  if (0 == length) {
+    return 0;
+  }
+
+  while (count < max &&
+         (text = str_case_find(text, end - text, term, length))) {
+    count++;
+    text += length;
+  }
+
+  return count;
+}
+
+/**
+ * @return The ranked score of `term` for the package, 0 if it doesn't
+ * match. Unless `contained`, the term is in none of its fields and only
+ * the edit distance of its name is worth looking at.
+ */
+
+static int rank_score(clib_search_index_t *self, int index, const char *term,
+                      int contained) {
+  const char *name = field_of(self, index, FIELD_NAME);
+  size_t length = strlen(term);
+  // a typo or two, depending on how long the term is
+  int max = length < 3 ? 0 : length < 6 ? 1 : 2;
+  int value = 0;
+
+  if (contained && 0 == strcasecmp(name, term)) {
+    value = RANK_EXACT;
+  } else if (contained && 0 == strncasecmp(name, term, length)) {
+    value = RANK_PREFIX;
+  } else if (contained && case_find(name, term)) {
+    value = RANK_NAME;
+  } else if (max > 0) {
+    int distance = edit_distance(name, term, max);
+
+    if (distance <= max) {
+      value = RANK_FUZZY - distance * RANK_FUZZY_EDIT;
+    }
+  }
+
+  if (!contained) {
+    return value;
+  }
+
+  // the name is in the repo, which only counts when the name didn't
+  if (0 == value && case_find(field_of(self, index, FIELD_REPO), term)) {
+    value = RANK_REPO;
+  }
+
+  value += RANK_DESCRIPTION *
+           occurrences(field_of(self, index, FIELD_DESCRIPTION), term,
+                       RANK_DESCRIPTION_MAX);
+
+  if (0 == value && case_find(field_of(self, index, FIELD_HREF), term)) {
+    value = RANK_HREF;
+  }
+
+  return value;
+}
+
+/**
+ * @return Whether result `a` ranks below `b`, the one to drop first
+ */
+
+static int ranks_below(const result_t *a, const result_t *b) {
+  if (a->score != b->score) {
+    return a->score < b->score;
+  }
+
+  return a->package > b->package;
+}
+
+/**
+ * Keeps `result` in the bounded heap `heap` of up to `limit` results, of
+ * which the lowest ranking is on top.
+ */
+
+static void heap_offer(result_t *heap, int *size, int limit,
+                       result_t result) {
+  int i = *size;
+
+  if (*size == limit) {
+    if (!ranks_below(&heap[0], &result)) {
+      return;
+    }
+
+    // replace the top, and sift it down
+    i = 0;
+
+    for (;;) {
+      int child = 2 * i + 1;
+
+      if (child >= limit) {
+        break;
+      }
+
+      if (child + 1 < limit && ranks_below(&heap[child + 1], &heap[child])) {
+        child++;
+      }
+
+      if (!ranks_below(&heap[child], &result)) {
+        break;
+      }
+
+      heap[i] = heap[child];
+      i = child;
+    }
+
+    heap[i] = result;
+    return;
+  }
+
+  (*size)++;
+
+  // sift up
+  while (i > 0 && ranks_below(&result, &heap[(i - 1) / 2])) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+
+  heap[i] = result;
+}
+
+int *clib_search_index_rank(clib_search_index_t *self, int count,
+                            char *terms[], int limit, int *found) {
+  result_t *heap = NULL;
+  int *candidates = NULL;
+  int *postings = NULL;
+  int *scores = NULL;
+  char *contained = NULL;
+  int *selected = NULL;
+  int *packages = NULL;
+  int selected_count = 0;
+  int size = 0;
+
+  *found = 0;
+
+  if (!self) {
+    return NULL;
+  }
+
+  if (limit <= 0 || limit > self->size) {
+    limit = self->size;
+  }
+
+  if (0 == count) {
+    if ((packages = clib_search_index_query(self, 0, terms, found)) &&
+        *found > limit) {
+      *found = limit;
+    }
+
+    return packages;
+  }
+
+  packages = malloc((limit + 1) * sizeof(int));
+  heap = malloc((limit + 1) * sizeof(result_t));
+  candidates = malloc((self->size + 1) * sizeof(int));
+  postings = malloc((self->size + 1) * sizeof(int));
+  scores = calloc(self->size + 1, sizeof(int));
+  contained = malloc(self->size + 1);
+  selected = malloc((self->size + 1) * sizeof(int));
+
+  if (!packages || !heap || !candidates || !postings || !scores ||
+      !contained || !selected) {
+    free(packages);
+    packages = NULL;
+    goto cleanup;
+  }
+
+  // only the packages of the categories searched are scored
+  selected_count = read_selected(self, selected);
+
+  for (int i = 0; i < count; i++) {
+    // too short for a trigram, every package may contain it
+    int all = strlen(terms[i]) < 3;
+    int matched = all ? 0 : find_candidates(self, terms[i], candidates,
+                                            postings);
+
+    memset(contained, all, self->size);
+
+    for (int j = 0; j < matched; j++) {
+      contained[candidates[j]] = 1;
+    }
+
+    for (int j = 0; j < selected_count; j++) {
+      int package = selected[j];
+      scores[package] += rank_score(self, package, terms[i],
+                                    contained[package]);
+    }
+  }
+
+  for (int i = 0; i < self->size; i++) {
+    if (scores[i] > 0) {
+      result_t result = {i, scores[i]};
+      heap_offer(heap, &size, limit, result);
+    }
+  }
+
+  qsort(heap, size, sizeof(result_t), compare_results);
+
+  for (int i = 0; i < size; i++) {
+    packages[i] = heap[i].package;
+  }
+
+  *found = size;
+
+cleanup:
+  free(heap);
+  free(candidates);
+  free(postings);
+  free(scores);
+  free(contained);
+  free(selected);
+  return packages;
+}
+
+void clib_search_index_free(clib_search_index_t *self) {
+  if (NULL == self) {
+    return;
+  }
+
+  for (int i = 0; i < FIELD_COUNT; i++) {
+    free(self->fields[i]);
+  }
+
+  free(self->strings);
+  free(self->category);
+  free(self->categories);
+  free(self->ranges);
+  free(self->selected);
+  free(self->lines);
+  fs_unmap(&self->trigrams);
+  free(self);
+}
@@ -0,0 +1,94 @@
+//
+// clib-search-index.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_SEARCH_INDEX_H
+#define CLIB_SEARCH_INDEX_H 1
+
+#include "fs/fs.h"
+#include "list/list.h"
+#include "wiki-registry/wiki-registry.h"
+
+/**
+ * The packages of the registry along with the lowercase trigrams of their
+ * name, repo, description and url, each with the packages it occurs in,
+ * and the range of packages of each category
+ */
+
+typedef struct clib_search_index clib_search_index_t;
+
+/**
+ * Builds the index of the `wiki_package_t` of `pkgs`, as new strings to
+ * store: the packages in `packages_json`, and their trigrams, which can be
+ * looked up without parsing, in `trigrams`.
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_search_index_build(list_t *pkgs, char **packages_json,
+                            char **trigrams);
+
+/**
+ * Loads an index written by `clib_search_index_build()`. `trigrams`, mapped
+ * from the cache or allocated, then belongs to the index, which is looked
+ * up in place and releases it with `fs_unmap()`.
+ *
+ * @return A new index, or NULL if it can't be read
+ */
+clib_search_index_t *clib_search_index_parse(const char *packages_json,
+                                             fs_mapping trigrams);
+
+/**
+ * @return Number of packages in the index
+ */
+int clib_search_index_size(clib_search_index_t *self);
+
+/**
+ * Fills `pkg` with package `index`, its strings being views into the
+ * index, valid as long as it is.
+ *
+ * @return 0 on success, -1 if there's no such package
+ */
+int clib_search_index_package(clib_search_index_t *self, int index,
+                              wiki_package_t *pkg);
+
+/**
+ * Keeps the queries and rankings that follow to the packages of the
+ * categories whose name contains the lowercase `category`, which are
+ * ranges of packages read one after the other. A NULL `category` drops
+ * the filter.
+ *
+ * @return Number of packages in those categories, -1 on error
+ */
+int clib_search_index_filter_category(clib_search_index_t *self,
+                                      const char *category);
+
+/**
+ * Finds the packages that contain any of the lowercase `terms`, those
+ * matching by name first, then by repo, description and url. Without
+ * terms, that's all of them.
+ *
+ * @return A new array of package indexes, with their number in `found`, or
+ * NULL on error
+ */
+int *clib_search_index_query(clib_search_index_t *self, int count,
+                             char *terms[], int *found);
+
+/**
+ * Scores every package against the lowercase `terms`: an exact name
+ * beats a name starting with a term, which beats a name containing it or
+ * a few edits away from it, then come the repo and how often a term is in
+ * the description. Only the `limit` best are kept, all of them when
+ * `limit` isn't positive.
+ *
+ * @return A new array of package indexes, the best first, with their
+ * number in `found`, or NULL on error
+ */
+int *clib_search_index_rank(clib_search_index_t *self, int count,
+                            char *terms[], int limit, int *found);
+
+void clib_search_index_free(clib_search_index_t *self);
+
+#endif
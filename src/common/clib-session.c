@@ -0,0 +1,329 @@
+//
+// clib-session.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "clib-session.h"
+#include "clib-cache.h"
+#include "fs/fs.h"
+#include "path-join/path-join.h"
+#include "strbuf/strbuf.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK() pthread_mutex_lock(&mutex)
+#define UNLOCK() pthread_mutex_unlock(&mutex)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+// in the meta cache dir
+#define HSTS_CACHE_FILE "hsts"
+#define ALTSVC_CACHE_FILE "alt-svc"
+#define TLS_SESSIONS_FILE "tls-sessions"
+
+// libcurl can only hand its TLS sessions out from 8.12.0 on
+#if LIBCURL_VERSION_NUM >= 0x080c00
+#define HAVE_SSLS_EXPORT 1
+#endif
+
+// NULL until first asked for, or when the meta cache dir can't be made
+static char *hsts_path = NULL;
+static char *altsvc_path = NULL;
+static int paths_done = 0;
+
+/**
+ * Works out where the caches are kept, once.
+ */
+
+static void init_paths(void) {
+  LOCK();
+
+  if (!paths_done) {
+    paths_done = 1;
+
+    if (0 == clib_cache_meta_init()) {
+      hsts_path = path_join(clib_cache_meta_dir(), HSTS_CACHE_FILE);
+      altsvc_path = path_join(clib_cache_meta_dir(), ALTSVC_CACHE_FILE);
+    }
+  }
+
+  UNLOCK();
+}
+
+#ifdef HAVE_SSLS_EXPORT
+
+static int sessions_enabled(void) {
+  const char *env = getenv("CLIB_TLS_SESSIONS");
+
+  if (env && 0 == strcmp(env, "0")) {
+    return 0;
+  }
+
+  // the libcurl it runs with can be older than the one it was built with
+  return curl_version_info(CURLVERSION_NOW)->version_num >= 0x080c00;
+}
+
+static char *sessions_path(void) {
+  if (0 != clib_cache_meta_init()) {
+    return NULL;
+  }
+
+  return path_join(clib_cache_meta_dir(), TLS_SESSIONS_FILE);
+}
+
+static int append_hex(strbuf_t *buf, const unsigned char *data, size_t len) {
+  static const char digits[] = "0123456789abcdef";
+
+  // an empty field still needs a token of its own
+  if (0 == len) {
+    return strbuf_append_char(buf, '-');
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    if (-1 == strbuf_append_char(buf, digits[data[i] >> 4]) ||
+        -1 == strbuf_append_char(buf, digits[data[i] & 0xf])) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int nibble(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+
+  return -1;
+}
+
+/**
+ * Decodes the hex field `hex` in place.
+ *
+ * @return its length in bytes, or -1 when it isn't hex
+ */
+
+static long from_hex(char *hex) {
+  size_t len = strlen(hex);
+  long n = 0;
+
+  if (0 == strcmp(hex, "-")) {
+    return 0;
+  }
+
+  if (0 != len % 2) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < len; i += 2) {
+    int hi = nibble(hex[i]);
+    int lo = nibble(hex[i + 1]);
+
+    if (-1 == hi || -1 == lo) {
+      return -1;
+    }
+
+    hex[n++] = (char)(hi << 4 | lo);
+  }
+
+  return n;
+}
+
+static CURLcode export_session(CURL *handle, void *userptr,
+                               const char *session_key,
+                               const unsigned char *shmac, size_t shmac_len,
+                               const unsigned char *sdata, size_t sdata_len,
+                               curl_off_t valid_until, int ietf_tls_id,
+                               const char *alpn, size_t earlydata_max) {
+  strbuf_t *content = userptr;
+  char until[32];
+
+  (void)handle;
+  (void)ietf_tls_id;
+  (void)alpn;
+  (void)earlydata_max;
+
+  // nothing to resume later on
+  if (valid_until <= (curl_off_t)time(NULL) || !session_key) {
+    return CURLE_OK;
+  }
+
+  snprintf(until, sizeof(until), "%lld ", (long long)valid_until);
+
+  if (-1 == strbuf_append(content, until) ||
+      -1 == append_hex(content, (const unsigned char *)session_key,
+                       strlen(session_key)) ||
+      -1 == strbuf_append_char(content, ' ') ||
+      -1 == append_hex(content, shmac, shmac_len) ||
+      -1 == strbuf_append_char(content, ' ') ||
+      -1 == append_hex(content, sdata, sdata_len) ||
+      -1 == strbuf_append_char(content, '\n')) {
+    return CURLE_OUT_OF_MEMORY;
+  }
+
+  return CURLE_OK;
+}
+
+/**
+ * Imports the sessions of the file at `path` that are still valid into
+ * the share of `req`.
+ */
+
+static void import_sessions(CURL *req, const char *path) {
+  char *content = fs_read(path);
+  char *line = NULL;
+  char *next = NULL;
+
+  if (!content) {
+    return;
+  }
+
+  for (line = strtok_r(content, "\n", &next); line;
+       line = strtok_r(NULL, "\n", &next)) {
+    long long until = 0;
+    char *key = NULL;
+    char *shmac = NULL;
+    char *sdata = NULL;
+    char *rest = NULL;
+    char *field = NULL;
+    long key_len = 0;
+    long shmac_len = 0;
+    long sdata_len = 0;
+
+    if (!(field = strtok_r(line, " ", &rest)) ||
+        (until = atoll(field)) <= (long long)time(NULL)) {
+      continue;
+    }
+
+    if (!(key = strtok_r(NULL, " ", &rest)) ||
+        (key_len = from_hex(key)) <= 0) {
+      continue;
+    }
+
+    // decoded in place, so there is room for its end
+    key[key_len] = 0;
+
+    if (!(shmac = strtok_r(NULL, " ", &rest)) ||
+        !(sdata = strtok_r(NULL, " ", &rest)) ||
+        -1 == (shmac_len = from_hex(shmac)) ||
+        -1 == (sdata_len = from_hex(sdata)) || 0 == sdata_len) {
+      continue;
+    }
+
+    curl_easy_ssls_import(req, key, (unsigned char *)shmac, shmac_len,
+                          (unsigned char *)sdata, sdata_len);
+  }
+
+  free(content);
+}
+
+#endif
+
+void clib_session_load(CURLSH *share) {
+  if (!share) {
+    return;
+  }
+
+#if LIBCURL_VERSION_NUM >= 0x075800
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_HSTS);
+#endif
+
+#ifdef HAVE_SSLS_EXPORT
+  CURL *req = NULL;
+  char *path = NULL;
+
+  if (!sessions_enabled() || !(path = sessions_path())) {
+    return;
+  }
+
+  if ((req = curl_easy_init())) {
+    curl_easy_setopt(req, CURLOPT_SHARE, share);
+    import_sessions(req, path);
+    curl_easy_cleanup(req);
+  }
+
+  free(path);
+#endif
+}
+
+void clib_session_save(CURLSH *share) {
+#ifdef HAVE_SSLS_EXPORT
+  strbuf_t content = STRBUF_INIT;
+  char *staged = NULL;
+  char *path = NULL;
+  CURL *req = NULL;
+  int fd = -1;
+
+  if (!share || !sessions_enabled() || !(path = sessions_path()) ||
+      !(staged = malloc(strlen(path) + 32)) || !(req = curl_easy_init())) {
+    goto cleanup;
+  }
+
+  curl_easy_setopt(req, CURLOPT_SHARE, share);
+
+  if (CURLE_OK != curl_easy_ssls_export(req, export_session, &content) ||
+      !content.data) {
+    goto cleanup;
+  }
+
+  // readers in other processes see the old or the new file, and no other
+  // user ever sees the sessions
+  sprintf(staged, "%s.%ld", path, (long)getpid());
+
+  if (-1 == (fd = open(staged, O_WRONLY | O_CREAT | O_TRUNC, 0600))) {
+    goto cleanup;
+  }
+
+  int written = (ssize_t)content.len == write(fd, content.data, content.len);
+
+  if (0 != close(fd) || !written || 0 != rename(staged, path)) {
+    unlink(staged);
+  }
+
+cleanup:
+  if (req) {
+    curl_easy_cleanup(req);
+  }
+
+  strbuf_free(&content);
+  free(staged);
+  free(path);
+#else
+  (void)share;
+#endif
+}
+
+void clib_session_prepare(void *req) {
+  init_paths();
+
+#if LIBCURL_VERSION_NUM >= 0x074a00
+  if (hsts_path) {
+    curl_easy_setopt(req, CURLOPT_HSTS_CTRL, (long)CURLHSTS_ENABLE);
+    curl_easy_setopt(req, CURLOPT_HSTS, hsts_path);
+  }
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x074001
+  // which protocols it may move to was set with the defaults of http-get
+  if (altsvc_path) {
+    curl_easy_setopt(req, CURLOPT_ALTSVC, altsvc_path);
+  }
+#endif
+}
@@ -0,0 +1,35 @@
+//
+// clib-session.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_SESSION_H
+#define CLIB_SESSION_H 1
+
+#include <curl/curl.h>
+
+/**
+ * Has the handles of `share` share what they learn of HSTS, and loads
+ * into it the TLS sessions that earlier runs saved in the meta cache dir
+ * and are still valid, so the first connection of a short run resumes a
+ * session instead of a full handshake. `CLIB_TLS_SESSIONS=0` leaves the
+ * sessions in memory, as they are secrets.
+ */
+void clib_session_load(CURLSH *share);
+
+/**
+ * Saves the TLS sessions of `share` in the meta cache dir, readable only
+ * by its user, for the next runs.
+ */
+void clib_session_save(CURLSH *share);
+
+/**
+ * Has the curl easy handle `req` read and write its HSTS and alt-svc
+ * caches in the meta cache dir, so that a run knows the hosts to go to
+ * over https and the protocols they offer from the start.
+ */
+void clib_session_prepare(void *req);
+
+#endif
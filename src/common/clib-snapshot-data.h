@@ -0,0 +1,5 @@
+// written by `make snapshot`, see clib-snapshot.h
+#define CLIB_SNAPSHOT_DEFLATED 0
+#define CLIB_SNAPSHOT_SIZE 0
+static const unsigned char clib_snapshot_data[] = {0};
+static const size_t clib_snapshot_data_size = 0;
@@ -0,0 +1,149 @@
+//
+// clib-snapshot.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "clib-snapshot-data.h"
+
+// bytes written on each line of the header
+#define BYTES_PER_LINE 16
+
+/**
+ * Deflates the `size` bytes of `data` when there is zlib.
+ *
+ * @return A new buffer with its length in `length`, or NULL on error or
+ * without zlib
+ */
+
+static unsigned char *deflate_snapshot(const char *data, size_t size,
+                                       size_t *length) {
+#ifdef HAVE_ZLIB
+  uLongf bound = compressBound(size);
+  unsigned char *out = malloc(bound);
+
+  if (!out) {
+    return NULL;
+  }
+
+  if (Z_OK != compress2(out, &bound, (const Bytef *)data, size,
+                        Z_BEST_COMPRESSION)) {
+    free(out);
+    return NULL;
+  }
+
+  *length = bound;
+  return out;
+#else
+  (void)data;
+  (void)size;
+  (void)length;
+  return NULL;
+#endif
+}
+
+int clib_snapshot_write(const char *file, const char *packages_json,
+                        const char *trigrams) {
+  size_t trigrams_len = strlen(trigrams);
+  size_t size = trigrams_len + strlen(packages_json) + 2;
+  unsigned char *deflated = NULL;
+  const unsigned char *bytes = NULL;
+  size_t length = 0;
+  char *raw = NULL;
+  FILE *out = NULL;
+  int rc = -1;
+
+  if (!(raw = malloc(size))) {
+    return -1;
+  }
+
+  // the trigrams first, so the index can own the whole of it
+  memcpy(raw, trigrams, trigrams_len + 1);
+  memcpy(raw + trigrams_len + 1, packages_json, size - trigrams_len - 1);
+
+  deflated = deflate_snapshot(raw, size, &length);
+  bytes = deflated ? deflated : (const unsigned char *)raw;
+  length = deflated ? length : size;
+
+  if (!(out = fopen(file, "w"))) {
+    goto cleanup;
+  }
+
+  fprintf(out, "// written by `make snapshot`, see clib-snapshot.h\n");
+  fprintf(out, "#define CLIB_SNAPSHOT_DEFLATED %d\n", deflated ? 1 : 0);
+  fprintf(out, "#define CLIB_SNAPSHOT_SIZE %lu\n", (unsigned long)size);
+  fprintf(out, "static const unsigned char clib_snapshot_data[] = {");
+
+  for (size_t i = 0; i < length; i++) {
+    fprintf(out, "%s0x%02x,", 0 == i % BYTES_PER_LINE ? "\n  " : " ",
+            bytes[i]);
+  }
+
+  fprintf(out, "\n};\n");
+  fprintf(out, "static const size_t clib_snapshot_data_size = %lu;\n",
+          (unsigned long)length);
+
+  rc = 0 == ferror(out) ? 0 : -1;
+
+  if (0 != fclose(out)) {
+    rc = -1;
+  }
+
+cleanup:
+  free(deflated);
+  free(raw);
+  return rc;
+}
+
+clib_search_index_t *clib_snapshot_search_index(void) {
+  char *raw = NULL;
+
+  if (0 == clib_snapshot_data_size || CLIB_SNAPSHOT_SIZE < 2) {
+    return NULL;
+  }
+
+  // the index cuts the trigrams in place, so they are always a copy
+  if (!(raw = malloc(CLIB_SNAPSHOT_SIZE))) {
+    return NULL;
+  }
+
+#if CLIB_SNAPSHOT_DEFLATED
+#ifdef HAVE_ZLIB
+  uLongf size = CLIB_SNAPSHOT_SIZE;
+
+  if (Z_OK != uncompress((Bytef *)raw, &size, clib_snapshot_data,
+                         clib_snapshot_data_size) ||
+      CLIB_SNAPSHOT_SIZE != size) {
+    free(raw);
+    return NULL;
+  }
+#else
+  (void)clib_snapshot_data;
+  free(raw);
+  return NULL;
+#endif
+#else
+  memcpy(raw, clib_snapshot_data, CLIB_SNAPSHOT_SIZE);
+#endif
+
+  // both end in a 0 already
+  size_t trigrams_len = strlen(raw);
+
+  if (trigrams_len + 2 > CLIB_SNAPSHOT_SIZE) {
+    free(raw);
+    return NULL;
+  }
+
+  return clib_search_index_parse(raw + trigrams_len + 1,
+                                 (fs_mapping){raw, trigrams_len, 0});
+}
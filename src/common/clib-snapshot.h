@@ -0,0 +1,35 @@
+//
+// clib-snapshot.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_SNAPSHOT_H
+#define CLIB_SNAPSHOT_H 1
+
+#include "clib-search-index.h"
+
+/**
+ * The search index of the registry as it was when clib was built, which
+ * `make snapshot` writes into `clib-snapshot-data.h` with
+ * `scripts/registry-snapshot.c`, deflated when it has zlib. It is what a
+ * search finds before it ever made a search cache of its own.
+ */
+
+/**
+ * Writes the snapshot of the index of `packages_json` and `trigrams`, as
+ * made by `clib_search_index_build()`, as the C header `file`.
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_snapshot_write(const char *file, const char *packages_json,
+                        const char *trigrams);
+
+/**
+ * @return A new index of the snapshot built in, or NULL if there is none
+ * or it can't be read, as when it is deflated and clib has no zlib
+ */
+clib_search_index_t *clib_snapshot_search_index(void);
+
+#endif
@@ -0,0 +1,359 @@
+//
+// clib-spawn.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _GNU_SOURCE
+#include "clib-spawn.h"
+#include "asprintf/asprintf.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+extern char **environ;
+#endif
+
+// glibc 2.29 can enter the directory of the command itself
+#if defined(__GLIBC__) &&                                                      \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define HAVE_SPAWN_CHDIR 1
+#endif
+
+static const clib_spawn_opts_t defaults = {0};
+
+#ifndef _WIN32
+/**
+ * @return A copy of the environment with the entries of `env` in place of
+ * the variables they set, or NULL on error. Only the array is allocated.
+ */
+
+static char **spawn_environment(char *const *env) {
+  char **envp = NULL;
+  int count = 0;
+  int extra = 0;
+  int size = 0;
+
+  while (environ[count]) {
+    (void)count++;
+  }
+
+  while (env[extra]) {
+    (void)extra++;
+  }
+
+  if (!(envp = malloc((count + extra + 1) * sizeof(char *)))) {
+    return NULL;
+  }
+
+  for (int i = 0; i < count; i++) {
+    int replaced = 0;
+
+    for (int j = 0; j < extra && !replaced; j++) {
+      const char *equals = strchr(env[j], '=');
+      size_t length = equals ? (size_t)(equals - env[j]) + 1 : 0;
+
+      replaced = length > 0 && 0 == strncmp(environ[i], env[j], length);
+    }
+
+    if (!replaced) {
+      envp[size++] = environ[i];
+    }
+  }
+
+  for (int j = 0; j < extra; j++) {
+    envp[size++] = env[j];
+  }
+
+  envp[size] = NULL;
+  return envp;
+}
+
+/**
+ * Reads `fd` until the end into a new string at `output`.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+
+static int read_output(int fd, char **output) {
+  char *buffer = NULL;
+  size_t capacity = 0;
+  size_t length = 0;
+
+  for (;;) {
+    ssize_t size = 0;
+
+    if (capacity - length < BUFSIZ) {
+      char *grown = realloc(buffer, capacity + BUFSIZ + 1);
+
+      if (NULL == grown) {
+        free(buffer);
+        return -1;
+      }
+
+      buffer = grown;
+      capacity += BUFSIZ;
+    }
+
+    if (0 == (size = read(fd, buffer + length, capacity - length))) {
+      break;
+    }
+
+    if (size > 0) {
+      length += (size_t)size;
+    } else if (EINTR != errno) {
+      free(buffer);
+      return -1;
+    }
+  }
+
+  buffer[length] = 0;
+  *output = buffer;
+  return 0;
+}
+
+int clib_spawn(char *const argv[], const clib_spawn_opts_t *opts) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  char **envp = NULL;
+  char **args = NULL;
+  char **capture = NULL;
+  pid_t pid = 0;
+  int fds[2] = {-1, -1};
+  int status = 0;
+  int rc = -1;
+
+  if (NULL == opts) {
+    opts = &defaults;
+  }
+
+  if (!argv || !argv[0]) {
+    return -1;
+  }
+
+  capture = opts->output ? opts->output : opts->log;
+
+  if (capture) {
+    *capture = NULL;
+  }
+
+  if (opts->env && !(envp = spawn_environment(opts->env))) {
+    return -1;
+  }
+
+#ifndef HAVE_SPAWN_CHDIR
+  // a shell enters the directory, then becomes the command
+  if (opts->dir) {
+    int count = 0;
+
+    while (argv[count]) {
+      (void)count++;
+    }
+
+    if (!(args = malloc((count + 5) * sizeof(char *)))) {
+      free(envp);
+      return -1;
+    }
+
+    args[0] = "sh";
+    args[1] = "-c";
+    args[2] = "cd -- \"$0\" && exec \"$@\"";
+    args[3] = (char *)opts->dir;
+    memcpy(args + 4, argv, (count + 1) * sizeof(char *));
+    argv = args;
+  }
+#endif
+
+  if (capture) {
+    if (0 != pipe(fds)) {
+      free(envp);
+      free(args);
+      return -1;
+    }
+
+    // commands spawned by other threads meanwhile mustn't keep it open
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  }
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attr);
+
+#ifdef POSIX_SPAWN_USEVFORK
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_USEVFORK);
+#endif
+
+#ifdef HAVE_SPAWN_CHDIR
+  if (opts->dir) {
+    posix_spawn_file_actions_addchdir_np(&actions, opts->dir);
+  }
+#endif
+
+  if (opts->quiet) {
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                     O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+  }
+
+  if (capture) {
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  }
+
+  if (capture && !opts->output) {
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+  }
+
+  rc = posix_spawnp(&pid, argv[0], &actions, &attr, argv,
+                    envp ? envp : environ);
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+
+  if (-1 != fds[1]) {
+    close(fds[1]);
+  }
+
+  if (0 == rc && capture && 0 != read_output(fds[0], capture)) {
+    // the command still has to be waited for
+    *capture = NULL;
+  }
+
+  if (-1 != fds[0]) {
+    close(fds[0]);
+  }
+
+  free(envp);
+  free(args);
+
+  if (0 != rc) {
+    return -1;
+  }
+
+  while (-1 == waitpid(pid, &status, 0)) {
+    if (EINTR != errno) {
+      return -1;
+    }
+  }
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int clib_spawn_shell(const char *command, const clib_spawn_opts_t *opts) {
+  char *argv[] = {"sh", "-c", (char *)command, NULL};
+
+  if (NULL == command) {
+    return -1;
+  }
+
+  return clib_spawn(argv, opts);
+}
+
+#else
+
+int clib_spawn_shell(const char *command, const clib_spawn_opts_t *opts) {
+  char **capture = NULL;
+  char *line = NULL;
+  int rc = -1;
+
+  if (NULL == opts) {
+    opts = &defaults;
+  }
+
+  if (NULL == command) {
+    return -1;
+  }
+
+  capture = opts->output ? opts->output : opts->log;
+
+  if (capture) {
+    *capture = NULL;
+  }
+
+  // there is no environment of its own for a command through the shell
+  for (int i = 0; opts->env && opts->env[i]; i++) {
+    _putenv(opts->env[i]);
+  }
+
+  if (-1 == asprintf(&line, "%s%s%s%s%s%s", opts->dir ? "cd /d \"" : "",
+                     opts->dir ? opts->dir : "", opts->dir ? "\" && " : "",
+                     command, opts->quiet ? " > NUL 2>&1" : "",
+                     capture && !opts->output ? " 2>&1" : "")) {
+    return -1;
+  }
+
+  if (capture) {
+    FILE *pipe = _popen(line, "r");
+    char *buffer = NULL;
+    size_t length = 0;
+    size_t size = 0;
+
+    if (pipe) {
+      while ((buffer = realloc(buffer, length + BUFSIZ + 1)) &&
+             (size = fread(buffer + length, 1, BUFSIZ, pipe)) > 0) {
+        length += size;
+      }
+
+      if (buffer) {
+        buffer[length] = 0;
+        *capture = buffer;
+      }
+
+      rc = _pclose(pipe);
+    }
+  } else {
+    rc = system(line);
+  }
+
+  free(line);
+  return rc;
+}
+
+int clib_spawn(char *const argv[], const clib_spawn_opts_t *opts) {
+  char *line = NULL;
+  int rc = -1;
+
+  if (NULL == opts) {
+    opts = &defaults;
+  }
+
+  if (!argv || !argv[0]) {
+    return -1;
+  }
+
+  if (!opts->dir && !opts->env && !opts->output && !opts->log &&
+      !opts->quiet) {
+    return (int)_spawnvp(_P_WAIT, argv[0], (const char *const *)argv);
+  }
+
+  // the shell does what spawning directly can't here
+  for (int i = 0; argv[i]; i++) {
+    char *joined = NULL;
+
+    if (-1 == asprintf(&joined, "%s%s\"%s\"", line ? line : "",
+                       line ? " " : "", argv[i])) {
+      free(line);
+      return -1;
+    }
+
+    free(line);
+    line = joined;
+  }
+
+  rc = clib_spawn_shell(line, opts);
+  free(line);
+  return rc;
+}
+
+#endif
@@ -0,0 +1,49 @@
+//
+// clib-spawn.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_SPAWN_H
+#define CLIB_SPAWN_H 1
+
+/**
+ * How a command runs, all optional
+ */
+
+typedef struct {
+  // the directory to run in, instead of the current one
+  const char *dir;
+  // `NAME=value` entries put into its environment, NULL terminated
+  char *const *env;
+  // both outputs go to /dev/null, only the errors when capturing `output`
+  int quiet;
+  // when set, the standard output is captured into a new string here
+  char **output;
+  // when set, both outputs are captured together into a new string here,
+  // in the order they were written, unless `output` is set too
+  char **log;
+} clib_spawn_opts_t;
+
+/**
+ * Runs `argv` directly with `posix_spawn()`, without a shell in between,
+ * looking `argv[0]` up in `PATH`, and waits for it. Unlike `system()` it
+ * can be called from any thread, and neither copies this process nor
+ * starts a shell.
+ *
+ * @return The exit status of the command, or -1 if it didn't run or was
+ * killed
+ */
+int clib_spawn(char *const argv[], const clib_spawn_opts_t *opts);
+
+/**
+ * Runs `command` with the shell, for the commands of manifests, which
+ * may use its syntax, like `clib_spawn()` otherwise.
+ *
+ * @return The exit status of the command, or -1 if it didn't run or was
+ * killed
+ */
+int clib_spawn_shell(const char *command, const clib_spawn_opts_t *opts);
+
+#endif
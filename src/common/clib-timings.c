@@ -0,0 +1,218 @@
+//
+// clib-timings.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "clib-timings.h"
+#include "asprintf/asprintf.h"
+#include "clib-cache.h"
+#include "clib-metrics.h"
+#include "fs/fs.h"
+#include "hash/hash.h"
+#include "path-join/path-join.h"
+#include "strbuf/strbuf.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK() pthread_mutex_lock(&mutex)
+#define UNLOCK() pthread_mutex_unlock(&mutex)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+// in the meta cache dir, a "<phase> <name> <microseconds>" line each
+#define TIMINGS_FILE "timings"
+
+// "<phase> <name>" to a heap allocated uint64_t, NULL until first asked for
+static hash_t *timings = NULL;
+static int changed = 0;
+
+static char *timings_path(void) {
+  if (0 != clib_cache_meta_init()) {
+    return NULL;
+  }
+
+  return path_join(clib_cache_meta_dir(), TIMINGS_FILE);
+}
+
+static void set_timing(char *key, uint64_t us) {
+  uint64_t *value = hash_get(timings, key);
+
+  if (value) {
+    *value = us;
+    free(key);
+    return;
+  }
+
+  if (!(value = malloc(sizeof(uint64_t)))) {
+    free(key);
+    return;
+  }
+
+  *value = us;
+  hash_set(timings, key, value);
+}
+
+/**
+ * Reads the timings of earlier runs, once. Must hold the lock.
+ */
+
+static int load(void) {
+  char *path = NULL;
+  char *content = NULL;
+  char *line = NULL;
+  char *next = NULL;
+
+  if (timings) {
+    return 0;
+  }
+
+  if (!(timings = hash_new())) {
+    return -1;
+  }
+
+  if (!(path = timings_path()) || !(content = fs_read(path))) {
+    free(path);
+    return 0;
+  }
+
+  for (line = strtok_r(content, "\n", &next); line;
+       line = strtok_r(NULL, "\n", &next)) {
+    char *space = strrchr(line, ' ');
+    char *key = NULL;
+    uint64_t us = 0;
+
+    if (!space || space == line || 0 == (us = strtoull(space + 1, NULL, 10))) {
+      continue;
+    }
+
+    *space = 0;
+
+    if ((key = strdup(line))) {
+      set_timing(key, us);
+    }
+  }
+
+  free(content);
+  free(path);
+  return 0;
+}
+
+uint64_t clib_timings_get(const char *phase, const char *name) {
+  char *key = NULL;
+  uint64_t *value = NULL;
+  uint64_t us = 0;
+
+  if (!phase || !name || -1 == asprintf(&key, "%s %s", phase, name)) {
+    return 0;
+  }
+
+  LOCK();
+
+  if (0 == load() && (value = hash_get(timings, key))) {
+    us = *value;
+  }
+
+  UNLOCK();
+
+  free(key);
+  return us;
+}
+
+void clib_timings_record(const char *phase, const char *name, uint64_t us) {
+  char *key = NULL;
+  uint64_t *value = NULL;
+
+  clib_metrics_observe_phase(phase, name, us);
+
+  // a name with a space could not be read back
+  if (!phase || !name || strchr(name, ' ') || 0 == us ||
+      -1 == asprintf(&key, "%s %s", phase, name)) {
+    return;
+  }
+
+  LOCK();
+
+  if (0 == load()) {
+    // halfway towards the latest, so one odd run doesn't count for all
+    if ((value = hash_get(timings, key))) {
+      us = *value / 2 + us / 2;
+    }
+
+    set_timing(key, us ? us : 1);
+    key = NULL;
+    changed = 1;
+  }
+
+  UNLOCK();
+
+  free(key);
+}
+
+void clib_timings_save(void) {
+  strbuf_t content = STRBUF_INIT;
+  char *staged = NULL;
+  char *path = NULL;
+  FILE *file = NULL;
+
+  LOCK();
+
+  if (!timings) {
+    goto cleanup;
+  }
+
+  if (!changed || !(path = timings_path()) ||
+      -1 == asprintf(&staged, "%s.%ld", path, (long)getpid())) {
+    goto cleanup;
+  }
+
+  hash_each(timings, {
+    char line[32];
+
+    snprintf(line, sizeof(line), " %" PRIu64 "\n", *(uint64_t *)val);
+
+    if (-1 == strbuf_append(&content, key) ||
+        -1 == strbuf_append(&content, line)) {
+      goto cleanup;
+    }
+  });
+
+  // other processes read the old or the new file, never half of one
+  if (!content.data || !(file = fopen(staged, "w"))) {
+    goto cleanup;
+  }
+
+  int written = 1 == fwrite(content.data, content.len, 1, file);
+
+  if (0 != fclose(file) || !written || 0 != rename(staged, path)) {
+    unlink(staged);
+  }
+
+cleanup:
+  if (timings) {
+    hash_each(timings, {
+      free((char *)key);
+      free(val);
+    });
+    hash_free(timings);
+    timings = NULL;
+  }
+
+  changed = 0;
+  UNLOCK();
+
+  strbuf_free(&content);
+  free(staged);
+  free(path);
+}
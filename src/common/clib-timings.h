@@ -0,0 +1,34 @@
+//
+// clib-timings.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_TIMINGS_H
+#define CLIB_TIMINGS_H 1
+
+#include <stdint.h>
+
+/**
+ * How long `phase` ("fetch", "configure", "build") took for the package
+ * `name` on earlier runs, as kept in the meta cache dir. Safe to call
+ * from any thread.
+ *
+ * @return Microseconds, or 0 when it never ran
+ */
+uint64_t clib_timings_get(const char *phase, const char *name);
+
+/**
+ * Records that `phase` took `us` microseconds for the package `name`
+ * this time, averaged with what earlier runs took.
+ */
+void clib_timings_record(const char *phase, const char *name, uint64_t us);
+
+/**
+ * Saves what was recorded since the timings were loaded, if anything,
+ * and forgets them until they are asked for again.
+ */
+void clib_timings_save(void);
+
+#endif
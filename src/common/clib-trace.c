@@ -0,0 +1,180 @@
+//
+// clib-trace.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "clib-trace.h"
+#include "http-get/http-get.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+static FILE *out = NULL;
+static uint64_t opened = 0;
+static int events = 0;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static long threads = 0;
+#define LOCK() pthread_mutex_lock(&lock)
+#define UNLOCK() pthread_mutex_unlock(&lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+static uint64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+#ifdef HAVE_PTHREADS
+static void create_thread_key(void) { pthread_key_create(&thread_key, NULL); }
+#endif
+
+/**
+ * @return A small number for the calling thread, in the order threads
+ * first wrote to the trace. Called with the lock held.
+ */
+
+static long thread_id(void) {
+#ifdef HAVE_PTHREADS
+  long id = 0;
+
+  pthread_once(&thread_key_once, create_thread_key);
+
+  if (!(id = (long)(intptr_t)pthread_getspecific(thread_key))) {
+    id = ++threads;
+    pthread_setspecific(thread_key, (void *)(intptr_t)id);
+  }
+
+  return id;
+#else
+  return 1;
+#endif
+}
+
+static void write_string(const char *str) {
+  fputc('"', out);
+
+  for (; *str; str++) {
+    unsigned char c = (unsigned char)*str;
+
+    if ('"' == c || '\\' == c) {
+      fputc('\\', out);
+      fputc(c, out);
+    } else if (c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+
+  fputc('"', out);
+}
+
+static void observe_http(const char *url, long status,
+                         unsigned long long wire_bytes,
+                         unsigned long long body_bytes, int reused,
+                         double seconds) {
+  uint64_t start = clib_trace_now();
+
+  if (start) {
+    start -= (uint64_t)(seconds * 1000000);
+    clib_trace_span("http", "GET", url, start,
+                    "\"status\":%ld,\"wire_bytes\":%llu,\"body_bytes\":%llu,"
+                    "\"reused\":%s",
+                    status, wire_bytes, body_bytes, reused ? "true" : "false");
+  }
+}
+
+int clib_trace_open(const char *path) {
+  FILE *file = NULL;
+
+  if (!path || !(file = fopen(path, "w"))) {
+    return -1;
+  }
+
+  LOCK();
+  opened = now();
+  events = 0;
+  out = file;
+  fputs("{\"traceEvents\":[", out);
+  UNLOCK();
+
+  http_get_set_observer(observe_http);
+  return 0;
+}
+
+void clib_trace_close(void) {
+  http_get_set_observer(NULL);
+
+  LOCK();
+  if (out) {
+    fputs("\n]}\n", out);
+    fclose(out);
+    out = NULL;
+  }
+  UNLOCK();
+}
+
+uint64_t clib_trace_now(void) { return out ? now() : 0; }
+
+uint64_t clib_trace_clock(void) { return now(); }
+
+void clib_trace_span(const char *category, const char *name,
+                     const char *detail, uint64_t start, const char *args,
+                     ...) {
+  uint64_t end = 0;
+  va_list ap;
+
+  if (0 == start) {
+    return;
+  }
+
+  end = now();
+
+  LOCK();
+
+  if (out) {
+    if (start < opened) {
+      start = opened;
+    }
+
+    fprintf(out,
+            "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+            "\"tid\":%ld,\"ts\":%llu,\"dur\":%llu,\"args\":{",
+            events++ ? "," : "", name, category, thread_id(),
+            (unsigned long long)(start - opened),
+            (unsigned long long)(end - start));
+
+    if (detail) {
+      fputs("\"detail\":", out);
+      write_string(detail);
+    }
+
+    if (args) {
+      if (detail) {
+        fputc(',', out);
+      }
+      va_start(ap, args);
+      vfprintf(out, args, ap);
+      va_end(ap);
+    }
+
+    fputs("}}", out);
+  }
+
+  UNLOCK();
+}
@@ -0,0 +1,55 @@
+//
+// clib-trace.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_TRACE_H
+#define CLIB_TRACE_H 1
+
+#include <stdint.h>
+
+/**
+ * Timings of where a command spends its time, written as Chrome trace
+ * events for chrome://tracing or https://ui.perfetto.dev. Each span is
+ * tagged with the thread it ran on, and every HTTP request is one. Until
+ * `clib_trace_open()` nothing is measured. Safe to use from several
+ * threads.
+ */
+
+/**
+ * Starts writing the trace to `path`.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_trace_open(const char *path);
+
+/**
+ * Finishes the trace, after which nothing more is written.
+ */
+void clib_trace_close(void);
+
+/**
+ * @return The start of a span, or 0 when no trace is being written
+ */
+uint64_t clib_trace_now(void);
+
+/**
+ * @return Monotonic microseconds, whether or not a trace is being written,
+ * for spans that are also measured for other reasons
+ */
+uint64_t clib_trace_clock(void);
+
+/**
+ * Writes the span `name` of `category` from `start` until now, unless
+ * `start` is 0. A span started before the trace was opened starts with
+ * it. `detail` says what it was about, a package or a URL, and may be
+ * NULL. `args` may give more members of its JSON arguments, with
+ * `printf()` formatting, such as `"\"bytes\":%zu"`.
+ */
+void clib_trace_span(const char *category, const char *name,
+                     const char *detail, uint64_t start, const char *args,
+                     ...);
+
+#endif
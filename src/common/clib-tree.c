@@ -0,0 +1,531 @@
+//
+// clib-tree.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#endif
+
+#include "clib-tree.h"
+#include "asprintf/asprintf.h"
+#include "clib-dag.h"
+#include "clib-package.h"
+#include "clib-pool.h"
+#include "clib-spawn.h"
+#include "clib-timings.h"
+#include "clib-trace.h"
+#include "fs/fs.h"
+#include "hash/hash.h"
+#include "logger/logger.h"
+#include "path-join/path-join.h"
+#include "strbuf/strbuf.h"
+#include "strdup/strdup.h"
+#include "trim/trim.h"
+#include <libgen.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32) || defined(WIN32) || defined(__MINGW32__) ||               \
+    defined(__MINGW64__)
+#define realpath(a, b) _fullpath(a, b, strlen(a))
+#endif
+
+#ifdef PATH_MAX
+#define TREE_PATH_MAX PATH_MAX
+#else
+#define TREE_PATH_MAX 4096
+#endif
+
+static const char *manifest_names[] = {"clib.json", "package.json", NULL};
+
+struct clib_tree {
+  const char *dir;
+  int dev;
+  clib_dag_t *graph;
+  // node index + 1 of every manifest in the tree
+  hash_t *indexes;
+};
+
+typedef struct {
+  clib_tree_t *tree;
+  clib_tree_fn fn;
+  void *data;
+  // timed and ordered by earlier timings when set
+  const char *phase;
+} run_t;
+
+static void node_free(clib_tree_node_t *node) {
+  if (node) {
+    clib_package_free(node->package);
+    free(node->deps);
+    free(node->dir);
+    free(node->path);
+    free(node);
+  }
+}
+
+clib_tree_t *clib_tree_new(const char *dir, int dev) {
+  clib_tree_t *self = malloc(sizeof(clib_tree_t));
+
+  if (NULL == self) {
+    return NULL;
+  }
+
+  memset(self, 0, sizeof(clib_tree_t));
+  self->dir = dir;
+  self->dev = dev;
+  self->graph = clib_dag_new();
+  self->indexes = hash_new();
+
+  if (!self->graph || !self->indexes) {
+    clib_tree_free(self);
+    return NULL;
+  }
+
+  return self;
+}
+
+/**
+ * Appends `file` to the directory in `path`, as `path_join()` does.
+ *
+ * @return 0 on success, -1 on error
+ */
+
+static int append_path(strbuf_t *path, const char *file) {
+  if ((0 == path->len || '/' != path->data[path->len - 1]) &&
+      -1 == strbuf_append_char(path, '/')) {
+    return -1;
+  }
+
+  return strbuf_append(path, '/' == file[0] ? file + 1 : file);
+}
+
+/**
+ * Finds where `dep` was installed in the directory of the tree. That's
+ * the directory named after it, unless it isn't there, as its manifest
+ * may name the package otherwise, which then has to be fetched to know.
+ *
+ * @return A new path, or NULL if it can't be found
+ */
+
+static char *dependency_dir(clib_tree_t *self, clib_package_dependency_t *dep) {
+  clib_package_t *dependency = NULL;
+  char *dep_dir = NULL;
+  char *slug = NULL;
+  strbuf_t path = STRBUF_INIT;
+
+  if (0 == strbuf_append(&path, self->dir) &&
+      0 == append_path(&path, dep->name)) {
+    size_t dir_len = path.len;
+
+    // the manifests are tried in the same buffer
+    for (int i = 0; manifest_names[i]; i++) {
+      strbuf_truncate(&path, dir_len);
+
+      if (0 == append_path(&path, manifest_names[i]) &&
+          0 == fs_exists(path.data)) {
+        strbuf_truncate(&path, dir_len);
+        return strbuf_detach(&path);
+      }
+    }
+  }
+
+  strbuf_free(&path);
+
+  asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version);
+  dependency = slug ? clib_package_new_from_slug(slug, 0) : NULL;
+
+  if (dependency && dependency->name) {
+    dep_dir = path_join(self->dir, dependency->name);
+  }
+
+  free(slug);
+  clib_package_free(dependency);
+  return dep_dir;
+}
+
+/**
+ * Adds the packages of `dependencies` to the tree, each before node
+ * `index`.
+ */
+
+static void add_dependencies(clib_tree_t *self, int index,
+                             list_t *dependencies) {
+  list_iterator_t *iterator = NULL;
+  list_node_t *node = NULL;
+
+  if (!dependencies) {
+    return;
+  }
+
+  iterator = list_iterator_new(dependencies, LIST_HEAD);
+
+  while ((node = list_iterator_next(iterator))) {
+    clib_package_dependency_t *dep = node->val;
+    char *dep_dir = dependency_dir(self, dep);
+    int prerequisite = dep_dir ? clib_tree_add(self, dep_dir) : -1;
+
+    if (-1 != prerequisite &&
+        0 == clib_dag_depend(self->graph, index, prerequisite)) {
+      clib_tree_node_t *item = clib_dag_item(self->graph, index);
+      int *deps = realloc(item->deps, (item->deps_count + 1) * sizeof(int));
+
+      if (deps) {
+        item->deps = deps;
+        item->deps[item->deps_count++] = prerequisite;
+      }
+    }
+
+    free(dep_dir);
+  }
+
+  list_iterator_destroy(iterator);
+}
+
+int clib_tree_add_manifest(clib_tree_t *self, const char *dir,
+                           const char *file) {
+  clib_tree_node_t *node = NULL;
+  char *path = path_join(dir, file);
+  fs_mapping json = {0};
+  void *known = NULL;
+  int index = -1;
+
+  if (0 == path) {
+    return -1;
+  }
+
+  // hash_has() can't look into an empty hash
+  if ((known = hash_get(self->indexes, path))) {
+    free(path);
+    return (int)(intptr_t)known - 1;
+  }
+
+  if (0 == fs_exists(path)) {
+    fs_map(path, &json);
+  }
+
+  if (!(node = malloc(sizeof(clib_tree_node_t)))) {
+    fs_unmap(&json);
+    free(path);
+    return -1;
+  }
+
+  memset(node, 0, sizeof(clib_tree_node_t));
+  node->path = path;
+  node->dir = strdup(dir);
+
+  if (0 != json.data) {
+#ifdef DEBUG
+    node->package = clib_package_new(json.data, 1);
+#else
+    node->package = clib_package_new(json.data, 0);
+#endif
+  } else {
+#ifdef DEBUG
+    node->package = clib_package_new_from_slug(dir, 1);
+#else
+    node->package = clib_package_new_from_slug(dir, 0);
+#endif
+  }
+
+  fs_unmap(&json);
+
+  if (!node->dir || !node->package ||
+      -1 == (index = clib_dag_add(self->graph, node))) {
+    node_free(node);
+    return -1;
+  }
+
+  // before the dependencies, so a cycle ends here
+  hash_set(self->indexes, node->path, (void *)(intptr_t)(index + 1));
+
+  add_dependencies(self, index, node->package->dependencies);
+
+  if (self->dev) {
+    add_dependencies(self, index, node->package->development);
+  }
+
+  return index;
+}
+
+int clib_tree_add(clib_tree_t *self, const char *dir) {
+  strbuf_t path = STRBUF_INIT;
+  size_t dir_len = 0;
+  int rc = -1;
+
+  if (0 == strbuf_append(&path, dir)) {
+    dir_len = path.len;
+  }
+
+  for (int i = 0; -1 == rc && path.data && manifest_names[i]; i++) {
+    strbuf_truncate(&path, dir_len);
+
+    if (0 == append_path(&path, manifest_names[i]) &&
+        0 == fs_exists(path.data)) {
+      rc = clib_tree_add_manifest(self, dir, manifest_names[i]);
+    }
+  }
+
+  strbuf_free(&path);
+
+  if (-1 == rc) {
+    rc = clib_tree_add_manifest(self, dir, manifest_names[0]);
+  }
+
+  return rc;
+}
+
+int clib_tree_add_name(clib_tree_t *self, const char *name) {
+  char dir[TREE_PATH_MAX];
+  char *dep = (char *)name;
+  char *joined = 0;
+  fs_stats *stats = 0;
+  int index = -1;
+
+  if ('.' == dep[0]) {
+    memset(dir, 0, sizeof(dir));
+    dep = realpath(dep, dir);
+  } else if (!(stats = fs_stat(dep))) {
+    dep = joined = path_join(self->dir, dep);
+  } else {
+    free(stats);
+  }
+
+  stats = dep ? fs_stat(dep) : 0;
+
+  if (stats && (S_IFREG == (stats->st_mode & S_IFMT)
+#if defined(__unix__) || defined(__linux__) || defined(_POSIX_VERSION)
+                || S_IFLNK == (stats->st_mode & S_IFMT)
+#endif
+                    )) {
+    // dirname() and basename() may change what they are given
+    char *parent = strdup(dep);
+    char *file = strdup(dep);
+
+    if (parent && file) {
+      index = clib_tree_add_manifest(self, dirname(parent), basename(file));
+    }
+
+    free(parent);
+    free(file);
+  } else if (dep) {
+    index = clib_tree_add(self, dep);
+  }
+
+  // try with slug
+  if (-1 == index) {
+    index = clib_tree_add(self, name);
+  }
+
+  free(stats);
+  free(joined);
+  return index;
+}
+
+int clib_tree_size(clib_tree_t *self) {
+  return self ? clib_dag_size(self->graph) : 0;
+}
+
+clib_tree_node_t *clib_tree_node(clib_tree_t *self, int index) {
+  return self ? clib_dag_item(self->graph, index) : NULL;
+}
+
+static const char *node_name(clib_tree_node_t *node) {
+  return node && node->package ? node->package->name : NULL;
+}
+
+static int run_node(void *item, void *data) {
+  run_t *run = data;
+  uint64_t started = clib_trace_clock();
+  int rc = run->fn(item, run->data);
+
+  if (0 == rc && run->phase) {
+    clib_timings_record(run->phase, node_name(item),
+                        clib_trace_clock() - started);
+  }
+
+  return rc;
+}
+
+int clib_tree_run(clib_tree_t *self, clib_pool_t *pool, const char *phase,
+                  clib_tree_fn fn, void *data) {
+  run_t run = {self, fn, data, phase};
+
+  if (!self || !fn) {
+    return -1;
+  }
+
+  for (int i = 0; phase && i < clib_tree_size(self); i++) {
+    const char *name = node_name(clib_tree_node(self, i));
+    clib_dag_set_cost(self->graph, i, clib_timings_get(phase, name));
+  }
+
+  if (pool) {
+    return clib_dag_run_pool(self->graph, pool, run_node, &run);
+  }
+
+  return clib_dag_run(self->graph, 1, run_node, &run);
+}
+
+void clib_tree_free(clib_tree_t *self) {
+  if (NULL == self) {
+    return;
+  }
+
+  for (int i = 0; i < clib_tree_size(self); i++) {
+    node_free(clib_dag_item(self->graph, i));
+  }
+
+  // the keys belong to the nodes
+  if (self->indexes) {
+    hash_free(self->indexes);
+  }
+
+  clib_dag_free(self->graph);
+  free(self);
+}
+
+clib_package_t *clib_tree_load_root(int verbose) {
+  clib_package_t *root = NULL;
+  fs_mapping json = {0};
+
+  for (int i = 0; !json.data && manifest_names[i]; i++) {
+    fs_map(manifest_names[i], &json);
+  }
+
+  if (json.data) {
+    root = clib_package_new(json.data, verbose);
+    fs_unmap(&json);
+  }
+
+  if (root && root->prefix) {
+    char prefix[TREE_PATH_MAX];
+    char *copy = NULL;
+
+    memset(prefix, 0, sizeof(prefix));
+    realpath(root->prefix, prefix);
+
+    if ((copy = strdup(prefix))) {
+      clib_package_set_string(root, &root->prefix, copy);
+    }
+  }
+
+  return root;
+}
+
+void clib_tree_print_log(const char *phase, clib_package_t *package,
+                         const char *log, int rc) {
+  FILE *stream = 0 == rc ? stdout : stderr;
+  size_t length = log ? strlen(log) : 0;
+
+  if (0 == rc && 0 == length) {
+    return;
+  }
+
+  // other threads wait to print anything on it meanwhile
+#ifdef _WIN32
+  _lock_file(stream);
+#else
+  flockfile(stream);
+#endif
+
+  if (0 != rc) {
+    logger_error("error", "Failed to %s %s%s", phase, package->name,
+                 length ? ":" : "");
+  } else {
+    logger_info(phase, "%s:", package->name);
+  }
+
+  if (length) {
+    fwrite(log, 1, length, stream);
+
+    if ('\n' != log[length - 1]) {
+      fputc('\n', stream);
+    }
+  }
+
+  fflush(stream);
+
+#ifdef _WIN32
+  _unlock_file(stream);
+#else
+  funlockfile(stream);
+#endif
+}
+
+int clib_tree_configure(clib_tree_node_t *node, void *data) {
+  clib_tree_configure_opts_t *opts = data;
+  clib_package_t *package = node->package;
+  clib_spawn_opts_t spawn = {0};
+  char *env[2] = {0};
+  char *command = 0;
+  char *log = 0;
+  uint64_t started = 0;
+  int rc = 0;
+
+  if (0 != package->flags && opts->flags) {
+    if (opts->output) {
+      if (0 != strbuf_append(opts->output, trim(package->flags)) ||
+          0 != strbuf_append_char(opts->output, ' ')) {
+        return -1;
+      }
+    } else {
+      fprintf(stdout, "%s ", trim(package->flags));
+      fflush(stdout);
+    }
+    __sync_fetch_and_add(&opts->configured, 1);
+    return 0;
+  }
+
+  if (0 == package->configure) {
+    return 0;
+  }
+
+  asprintf(&command, "%s %s", package->configure, opts->args ? opts->args : "");
+
+  // each command gets its own PREFIX, as packages configure concurrently
+  if (opts->prefix) {
+    asprintf(&env[0], "PREFIX=%s", opts->prefix);
+  } else if (package->prefix) {
+    char prefix[TREE_PATH_MAX];
+    memset(prefix, 0, sizeof(prefix));
+    realpath(package->prefix, prefix);
+    asprintf(&env[0], "PREFIX=%s", prefix);
+  }
+
+  if (0 == command) {
+    free(env[0]);
+    return -1;
+  }
+
+  if (0 != opts->verbose) {
+    logger_warn("configure", "%s: %s", package->name, package->configure);
+  }
+
+  spawn.dir = node->dir;
+  spawn.env = env;
+  spawn.log = opts->capture ? &log : 0;
+  started = clib_trace_now();
+  rc = clib_spawn_shell(command, &spawn);
+  clib_trace_span("build", "configure", package->name, started, "\"rc\":%d",
+                  rc);
+  free(command);
+  free(env[0]);
+
+  clib_tree_print_log("configure", package, log, rc);
+  free(log);
+
+  if (0 != rc) {
+    return rc;
+  }
+
+  __sync_fetch_and_add(&opts->configured, 1);
+  return 0;
+}
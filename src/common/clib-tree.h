@@ -0,0 +1,147 @@
+//
+// clib-tree.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_TREE_H
+#define CLIB_TREE_H 1
+
+#include "clib-package.h"
+#include "strbuf/strbuf.h"
+
+struct clib_pool;
+
+/**
+ * A package of the tree, loaded once for every phase run over it
+ */
+
+typedef struct {
+  char *dir;
+  // the manifest, which tells packages apart
+  char *path;
+  clib_package_t *package;
+  // nodes of the dependencies
+  int *deps;
+  int deps_count;
+  // state of the phase running over the tree
+  void *data;
+} clib_tree_node_t;
+
+typedef struct clib_tree clib_tree_t;
+
+/**
+ * Work done for a package once the phase is done for all its
+ * dependencies.
+ *
+ * @return 0 on success, anything else skips the packages depending on it
+ */
+typedef int (*clib_tree_fn)(clib_tree_node_t *node, void *data);
+
+/**
+ * Options of the configure phase
+ */
+
+typedef struct {
+  // given to the commands in `PREFIX`, instead of the package's own
+  const char *prefix;
+  // arguments added to every command, joined by spaces
+  const char *args;
+  // print the compiler flags of the packages instead
+  int flags;
+  // the flags are appended here rather than printed when set, by a phase
+  // run without a pool
+  strbuf_t *output;
+  int verbose;
+  // the output of each command is held until it is done, for packages
+  // configuring concurrently
+  int capture;
+  // packages configured so far
+  int configured;
+} clib_tree_configure_opts_t;
+
+/**
+ * Starts a tree of installed packages, whose dependencies are looked up
+ * in `dir`, with the development dependencies too when `dev` is set.
+ *
+ * @return A new empty tree, or NULL on error
+ */
+clib_tree_t *clib_tree_new(const char *dir, int dev);
+
+/**
+ * Adds the package of manifest `file` in `dir`, or of the slug `dir` if
+ * there is no such file, along with all of its dependencies. A package
+ * added before isn't added or parsed again.
+ *
+ * @return Index of its node, or -1 on error
+ */
+int clib_tree_add_manifest(clib_tree_t *self, const char *dir,
+                           const char *file);
+
+/**
+ * Adds the package in `dir`, whatever its manifest is named, like
+ * `clib_tree_add_manifest()`.
+ *
+ * @return Index of its node, or -1 on error
+ */
+int clib_tree_add(clib_tree_t *self, const char *dir);
+
+/**
+ * Adds the package `name` given on the command line, which may be a
+ * directory, a manifest, a package in the tree's directory or a slug.
+ *
+ * @return Index of its node, or -1 if it can't be found
+ */
+int clib_tree_add_name(clib_tree_t *self, const char *name);
+
+/**
+ * @return Number of packages in the tree
+ */
+int clib_tree_size(clib_tree_t *self);
+
+/**
+ * @return The node at `index`, or NULL if out of range
+ */
+clib_tree_node_t *clib_tree_node(clib_tree_t *self, int index);
+
+/**
+ * Runs the phase `fn` for every package, each as soon as it is done for
+ * all of its dependencies, on the threads of `pool` when there are any.
+ * When `phase` is given, the packages that took longest for it before,
+ * with all that waits on them, start first, and how long each takes is
+ * recorded for the next runs. A tree may run one phase after another.
+ *
+ * @return Number of packages that failed or were skipped
+ */
+int clib_tree_run(clib_tree_t *self, struct clib_pool *pool,
+                  const char *phase, clib_tree_fn fn, void *data);
+
+void clib_tree_free(clib_tree_t *self);
+
+/**
+ * Loads the manifest of the current directory, with its prefix made
+ * absolute.
+ *
+ * @return A new package, or NULL if there is none
+ */
+clib_package_t *clib_tree_load_root(int verbose);
+
+/**
+ * Prints the output `log` captured while running `phase` for `package`,
+ * all of it at once so that it doesn't run into the output of the others.
+ * When `rc` isn't 0 it goes to stderr after the error, which is printed
+ * even without output.
+ */
+void clib_tree_print_log(const char *phase, clib_package_t *package,
+                         const char *log, int rc);
+
+/**
+ * The configure phase, which runs the `configure` command of a package,
+ * or prints its `flags`, with a `clib_tree_configure_opts_t` as `data`.
+ *
+ * @return 0 on success, the status of the command otherwise
+ */
+int clib_tree_configure(clib_tree_node_t *node, void *data);
+
+#endif
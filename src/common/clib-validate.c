@@ -8,16 +8,14 @@
 // MIT licensed
 //
 
+#include "clib-validate.h"
+#include "clib-manifest.h"
 #include "fs/fs.h"
 #include "logger/logger.h"
 #include "parse-repo/parse-repo.h"
-#include "parson/parson.h"
-#include "path-join/path-join.h"
-#include "strdup/strdup.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 
 #define ERROR_FORMAT(err, ...)                                                 \
   ({                                                                           \
@@ -36,60 +34,71 @@
 
 #define require_string(name, file)                                             \
   ({                                                                           \
-    const char *__##name = json_object_get_string(obj, #name);                 \
-    if (!(__##name))                                                           \
+    if (!pkg->name)                                                            \
       WARN_MISSING(#name, file);                                               \
   })
 
-int clib_validate(const char *file) {
-  const char *repo = NULL;
+clib_package_t *clib_validate_load(const char *file) {
+  clib_package_t *pkg = NULL;
+  char *json = NULL;
+
+  if (0 == fs_exists(file) && (json = fs_read(file))) {
+    pkg = clib_package_new(json, 0);
+  }
+
+  free(json);
+  return pkg;
+}
+
+int clib_validate_package(const clib_package_t *pkg, const char *file) {
   char *repo_owner = NULL;
   char *repo_name = NULL;
   int rc = 0;
-  JSON_Value *root = NULL;
-  JSON_Object *obj = NULL;
-  JSON_Value *src = NULL;
 
   if (-1 == fs_exists(file))
     ERROR_FORMAT("no such file: %s", file);
-  if (!(root = json_parse_file(file)))
-    ERROR_FORMAT("malformed file: %s", file);
-  if (!(obj = json_value_get_object(root)))
+  if (!pkg)
     ERROR_FORMAT("malformed file: %s", file);
 
   require_string(name, file);
   require_string(version, file);
   // TODO: validate semver
 
-  repo = json_object_get_string(obj, "repo");
-  if (!repo) {
+  if (!pkg->repo) {
     WARN_MISSING("repo", file);
   } else {
-    if (!(repo_name = parse_repo_name(repo)))
+    if (!(repo_name = parse_repo_name(pkg->repo)))
       WARN("invalid repo");
-    if (!(repo_owner = parse_repo_owner(repo, NULL)))
+    if (!(repo_owner = parse_repo_owner(pkg->repo, NULL)))
       WARN("invalid repo");
   }
 
   require_string(description, file);
   require_string(license, file);
 
-  if (!json_object_get_array(obj, "keywords")) {
+  if (!(pkg->lint & CLIB_MANIFEST_KEYWORDS)) {
     WARN_MISSING("keywords", file);
   }
 
-  src = json_object_get_value(obj, "src");
-  if (!src) {
+  if (!(pkg->lint & (CLIB_MANIFEST_SRC_ARRAY | CLIB_MANIFEST_SRC_OTHER))) {
 
-    if (!json_object_get_string(obj, "install"))
+    if (!pkg->install)
       ERROR_FORMAT("Must have either src or install defined in %s", file);
 
-  } else if (json_value_get_type(src) != JSONArray) {
+  } else if (pkg->lint & CLIB_MANIFEST_SRC_OTHER) {
     WARN("src should be an array")
   }
 
 done:
-  if (root)
-    json_value_free(root);
+  free(repo_owner);
+  free(repo_name);
+  return rc;
+}
+
+int clib_validate(const char *file) {
+  clib_package_t *pkg = clib_validate_load(file);
+  int rc = clib_validate_package(pkg, file);
+
+  clib_package_free(pkg);
   return rc;
 }
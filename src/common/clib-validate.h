@@ -8,9 +8,27 @@
 #ifndef CLIB_VALIDATE_H
 #define CLIB_VALIDATE_H
 
+#include "clib-package.h"
+
 /**
  * @return 0 if the file is valid
  */
 int clib_validate(const char *file);
 
+/**
+ * Reads the manifest `file` into a package, parsing it once for
+ * `clib_validate_package()` and whatever the package is read for.
+ *
+ * @return The package, or NULL if `file` is missing or malformed
+ */
+clib_package_t *clib_validate_load(const char *file);
+
+/**
+ * Validates `pkg` as read from the manifest `file` by
+ * `clib_validate_load()`, or reports `file` when that failed.
+ *
+ * @return 0 if it is valid
+ */
+int clib_validate_package(const clib_package_t *pkg, const char *file);
+
 #endif
@@ -0,0 +1,404 @@
+//
+// clib-walk.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _POSIX_C_SOURCE 200809L
+// for the entry types of readdir()
+#define _DEFAULT_SOURCE
+
+#include "clib-walk.h"
+#include "clib-mkdir.h"
+#include "copy/copy.h"
+#include "strbuf/strbuf.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+typedef struct clib_walk_dir clib_walk_dir_t;
+struct clib_walk_dir {
+  int fd;
+  char *name; // entry name in the parent directory
+  char *path; // relative to the root, "" for the root itself
+  clib_walk_dir_t *parent;
+  // subdirectories not finished yet, plus one while being listed
+  int pending;
+  clib_walk_dir_t *next;
+};
+
+typedef struct {
+  clib_walk_t *walk;
+  clib_walk_dir_t *head;
+  clib_walk_dir_t *tail;
+  // directories created and not finished yet
+  int outstanding;
+  int failed;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+} walk_state_t;
+
+#ifdef HAVE_PTHREADS
+#define LOCK(s) pthread_mutex_lock(&(s)->mutex)
+#define UNLOCK(s) pthread_mutex_unlock(&(s)->mutex)
+#define SIGNAL(s) pthread_cond_broadcast(&(s)->cond)
+#else
+#define LOCK(s)
+#define UNLOCK(s)
+#define SIGNAL(s)
+#endif
+
+static char *join(const char *path, const char *name) {
+  size_t size = strlen(path) + strlen(name) + 2;
+  char *res = malloc(size);
+
+  if (res) {
+    snprintf(res, size, "%s%s%s", path, *path ? "/" : "", name);
+  }
+
+  return res;
+}
+
+static clib_walk_dir_t *dir_new(int fd, const char *name, const char *path,
+                                clib_walk_dir_t *parent) {
+  clib_walk_dir_t *dir = malloc(sizeof(clib_walk_dir_t));
+
+  if (NULL == dir) {
+    return NULL;
+  }
+
+  memset(dir, 0, sizeof(clib_walk_dir_t));
+  dir->fd = fd;
+  dir->name = strdup(name);
+  dir->path = strdup(path);
+  dir->parent = parent;
+  dir->pending = 1;
+
+  if (!dir->name || !dir->path) {
+    free(dir->name);
+    free(dir->path);
+    free(dir);
+    return NULL;
+  }
+
+  return dir;
+}
+
+static void dir_free(clib_walk_dir_t *dir) {
+  close(dir->fd);
+  free(dir->name);
+  free(dir->path);
+  free(dir);
+}
+
+/**
+ * Drops one reference to `dir`, leaving every directory whose entries
+ * are all done. Called with the state locked.
+ */
+
+static void finish(walk_state_t *state, clib_walk_dir_t *dir) {
+  while (dir && 0 == --dir->pending) {
+    clib_walk_dir_t *parent = dir->parent;
+    clib_walk_t *walk = state->walk;
+
+    if (parent && !state->failed && walk->leave &&
+        0 != walk->leave(parent->fd, dir->name, dir->path, walk->data)) {
+      state->failed = 1;
+    }
+
+    dir_free(dir);
+    (void)state->outstanding--;
+    dir = parent;
+  }
+}
+
+/**
+ * @return 1 if the entry is a directory, 0 if not, -1 on error. Most file
+ * systems say so in the listing, which saves a `fstatat()` per entry.
+ */
+
+static int is_dir(int dirfd, struct dirent *entry) {
+  struct stat st;
+
+#ifdef DT_UNKNOWN
+  if (DT_UNKNOWN != entry->d_type) {
+    return DT_DIR == entry->d_type;
+  }
+#endif
+
+  if (0 != fstatat(dirfd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+    return -1;
+  }
+
+  return S_ISDIR(st.st_mode);
+}
+
+static void list(walk_state_t *state, clib_walk_dir_t *dir) {
+  clib_walk_t *walk = state->walk;
+  struct dirent *entry = NULL;
+  strbuf_t buf = STRBUF_INIT;
+  size_t base = 0;
+  int fd = dup(dir->fd);
+  DIR *d = -1 == fd ? NULL : fdopendir(fd);
+
+  // every entry's path is this directory's plus its name
+  if (NULL == d || -1 == strbuf_append(&buf, dir->path) ||
+      (*dir->path && -1 == strbuf_append_char(&buf, '/'))) {
+    if (d) {
+      closedir(d);
+    } else if (-1 != fd) {
+      close(fd);
+    }
+    strbuf_free(&buf);
+    state->failed = 1;
+    return;
+  }
+
+  base = buf.len;
+
+  while (!state->failed && (entry = readdir(d))) {
+    const char *path = NULL;
+    int subdir = 0;
+    int rc = 0;
+
+    if (0 == strcmp(".", entry->d_name) || 0 == strcmp("..", entry->d_name)) {
+      continue;
+    }
+
+    strbuf_truncate(&buf, base);
+
+    if (-1 == (subdir = is_dir(dir->fd, entry)) ||
+        -1 == strbuf_append(&buf, entry->d_name)) {
+      state->failed = 1;
+      break;
+    }
+
+    path = buf.data;
+
+    if (!subdir) {
+      if (walk->file) {
+        rc = walk->file(dir->fd, entry->d_name, path, walk->data);
+      }
+    } else if (walk->enter &&
+               CLIB_WALK_SKIP == (rc = walk->enter(dir->fd, entry->d_name,
+                                                   path, walk->data))) {
+      rc = 0;
+    } else if (0 == rc) {
+      int child_fd = openat(dir->fd, entry->d_name,
+                            O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+      clib_walk_dir_t *child =
+          -1 == child_fd ? NULL : dir_new(child_fd, entry->d_name, path, dir);
+
+      if (NULL == child) {
+        if (-1 != child_fd) {
+          close(child_fd);
+        }
+        rc = -1;
+      } else {
+        LOCK(state);
+        (void)dir->pending++;
+        (void)state->outstanding++;
+        if (state->tail) {
+          state->tail->next = child;
+        } else {
+          state->head = child;
+        }
+        state->tail = child;
+        SIGNAL(state);
+        UNLOCK(state);
+      }
+    }
+
+    if (0 != rc) {
+      state->failed = 1;
+    }
+  }
+
+  closedir(d);
+  strbuf_free(&buf);
+}
+
+static void *worker(void *arg) {
+  walk_state_t *state = arg;
+
+  LOCK(state);
+
+  while (state->outstanding > 0) {
+    clib_walk_dir_t *dir = state->head;
+
+    if (NULL == dir) {
+#ifdef HAVE_PTHREADS
+      pthread_cond_wait(&state->cond, &state->mutex);
+      continue;
+#else
+      break;
+#endif
+    }
+
+    if (!(state->head = dir->next)) {
+      state->tail = NULL;
+    }
+
+    // a failed walk only drains the queue
+    if (!state->failed) {
+      UNLOCK(state);
+      list(state, dir);
+      LOCK(state);
+    }
+
+    finish(state, dir);
+    SIGNAL(state);
+  }
+
+  UNLOCK(state);
+  return NULL;
+}
+
+int clib_walk(const char *root, int concurrency, clib_walk_t *walk) {
+  walk_state_t state;
+  clib_walk_dir_t *dir = NULL;
+  int fd = -1;
+
+  if (!root || !walk) {
+    return -1;
+  }
+
+  if (-1 == (fd = open(root, O_RDONLY | O_DIRECTORY))) {
+    return -1;
+  }
+
+  if (!(dir = dir_new(fd, "", "", NULL))) {
+    close(fd);
+    return -1;
+  }
+
+  memset(&state, 0, sizeof(walk_state_t));
+  state.walk = walk;
+  state.head = state.tail = dir;
+  state.outstanding = 1;
+
+#ifdef HAVE_PTHREADS
+  pthread_t *threads = NULL;
+  int started = 0;
+
+  pthread_mutex_init(&state.mutex, NULL);
+  pthread_cond_init(&state.cond, NULL);
+
+  // the calling thread is a worker too
+  if (concurrency > 1 &&
+      (threads = malloc((concurrency - 1) * sizeof(pthread_t)))) {
+    for (int i = 0; i < concurrency - 1; i++) {
+      if (0 != pthread_create(&threads[started], NULL, worker, &state)) {
+        break;
+      }
+      (void)started++;
+    }
+  }
+
+  worker(&state);
+
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  free(threads);
+  pthread_cond_destroy(&state.cond);
+  pthread_mutex_destroy(&state.mutex);
+#else
+  (void)concurrency;
+  worker(&state);
+#endif
+
+  return state.failed ? -1 : 0;
+}
+
+static int remove_file(int dirfd, const char *name, const char *path,
+                       void *data) {
+  return unlinkat(dirfd, name, 0);
+}
+
+static int remove_dir(int dirfd, const char *name, const char *path,
+                      void *data) {
+  return unlinkat(dirfd, name, AT_REMOVEDIR);
+}
+
+int clib_walk_remove(const char *path, int concurrency) {
+  clib_walk_t walk = {remove_file, NULL, remove_dir, NULL};
+  struct stat st;
+
+  if (!path || 0 != lstat(path, &st)) {
+    return -1;
+  }
+
+  if (!S_ISDIR(st.st_mode)) {
+    return unlink(path);
+  }
+
+  clib_mkdirp_forget();
+
+  if (0 != clib_walk(path, concurrency, &walk)) {
+    return -1;
+  }
+
+  return rmdir(path);
+}
+
+typedef struct {
+  const char *from;
+  const char *to;
+} copy_data_t;
+
+static int copy_entry(int dirfd, const char *name, const char *path,
+                      void *data) {
+  copy_data_t *copy = data;
+  char *from = join(copy->from, path);
+  char *to = join(copy->to, path);
+  int rc = -1;
+
+  if (from && to) {
+    rc = copy_file(from, to);
+  }
+
+  free(from);
+  free(to);
+  return rc;
+}
+
+static int copy_enter(int dirfd, const char *name, const char *path,
+                      void *data) {
+  copy_data_t *copy = data;
+  char *to = join(copy->to, path);
+  int rc = -1;
+
+  if (to) {
+    rc = mkdir(to, 0777);
+    if (0 != rc && 0 == access(to, F_OK)) {
+      rc = 0;
+    }
+  }
+
+  free(to);
+  return rc;
+}
+
+int clib_walk_copy(const char *from, const char *to, int concurrency) {
+  copy_data_t data = {from, to};
+  clib_walk_t walk = {copy_entry, copy_enter, NULL, &data};
+
+  if (!from || !to || 0 != clib_mkdirp(to, 0777)) {
+    return -1;
+  }
+
+  return clib_walk(from, concurrency, &walk);
+}
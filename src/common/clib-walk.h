@@ -0,0 +1,59 @@
+//
+// clib-walk.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_WALK_H
+#define CLIB_WALK_H 1
+
+/**
+ * Callbacks of a tree walk. Each gets the descriptor of the directory
+ * holding the entry, the entry `name` for use with the `*at()` calls, and
+ * its `path` relative to the root. Any of them may be NULL, and a non-zero
+ * return stops the walk, except `CLIB_WALK_SKIP` from `enter`, which
+ * leaves that directory out.
+ */
+
+#define CLIB_WALK_SKIP 1
+
+typedef int (*clib_walk_fn)(int dirfd, const char *name, const char *path,
+                            void *data);
+
+typedef struct {
+  // every entry that isn't a directory
+  clib_walk_fn file;
+  // a directory, before any of its entries
+  clib_walk_fn enter;
+  // a directory, after all of its entries
+  clib_walk_fn leave;
+  void *data;
+} clib_walk_t;
+
+/**
+ * Walks the tree under `root` with up to `concurrency` threads, each
+ * taking the next directory from a shared queue. Entries of different
+ * directories are visited in no particular order, but a directory's
+ * `enter` comes before and its `leave` after all of its entries. `root`
+ * itself gets no callbacks.
+ *
+ * @return 0 on success, -1 if the tree can't be read or a callback fails
+ */
+int clib_walk(const char *root, int concurrency, clib_walk_t *walk);
+
+/**
+ * Removes `path` and everything under it, like `rm -rf`.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_walk_remove(const char *path, int concurrency);
+
+/**
+ * Copies the tree under `from` into `to`, creating it if needed.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_walk_copy(const char *from, const char *to, int concurrency);
+
+#endif
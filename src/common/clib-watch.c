@@ -0,0 +1,450 @@
+//
+// clib-watch.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "clib-watch.h"
+#include "asprintf/asprintf.h"
+#include "clib-walk.h"
+#include "hash/hash.h"
+#include "path-join/path-join.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#define HAVE_INOTIFY 1
+#include <poll.h>
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS                                                           \
+  (IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM |       \
+   IN_MOVED_TO | IN_ATTRIB)
+#else
+// how often the files are compared, in milliseconds
+#define WATCH_POLL_MS 500
+#endif
+
+struct clib_watch {
+#ifdef HAVE_INOTIFY
+  int fd;
+  // the directory of each watch descriptor
+  char **dirs;
+  int dirs_count;
+#else
+  char **roots;
+  int roots_count;
+  // "<size> <mtime>" of every file by path, as last seen
+  hash_t *files;
+#endif
+};
+
+typedef struct {
+  clib_watch_t *self;
+  const char *root;
+  // where the files are noted while comparing, by path
+  hash_t *files;
+} watch_walk_t;
+
+static int is_hidden(const char *name) { return '.' == name[0]; }
+
+#ifdef HAVE_INOTIFY
+
+/**
+ * Watches the directory `dir` itself.
+ */
+
+static int watch_dir(clib_watch_t *self, const char *dir) {
+  int wd = inotify_add_watch(self->fd, dir, WATCH_EVENTS);
+  char *copy = NULL;
+
+  if (-1 == wd) {
+    return -1;
+  }
+
+  // the same directory added twice keeps its descriptor
+  if (wd >= self->dirs_count) {
+    int count = wd + 16;
+    char **dirs = realloc(self->dirs, count * sizeof(char *));
+
+    if (!dirs) {
+      return -1;
+    }
+
+    memset(dirs + self->dirs_count, 0,
+           (count - self->dirs_count) * sizeof(char *));
+    self->dirs = dirs;
+    self->dirs_count = count;
+  }
+
+  if (!(copy = strdup(dir))) {
+    return -1;
+  }
+
+  free(self->dirs[wd]);
+  self->dirs[wd] = copy;
+  return 0;
+}
+
+static int enter_dir(int dirfd, const char *name, const char *path,
+                     void *data) {
+  watch_walk_t *walk = data;
+  char *full = NULL;
+
+  (void)dirfd;
+
+  if (is_hidden(name)) {
+    return CLIB_WALK_SKIP;
+  }
+
+  if ((full = path_join(walk->root, path))) {
+    watch_dir(walk->self, full);
+    free(full);
+  }
+
+  return 0;
+}
+
+/**
+ * Reads the events waiting, reporting them to `fn` when there is one.
+ *
+ * @return Number of changes, or -1 on error
+ */
+
+static int read_events(clib_watch_t *self, clib_watch_fn fn, void *data) {
+  char buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  int changes = 0;
+
+  for (;;) {
+    ssize_t size = read(self->fd, buffer, sizeof(buffer));
+
+    if (-1 == size && EINTR == errno) {
+      continue;
+    }
+
+    if (-1 == size && EAGAIN == errno) {
+      return changes;
+    }
+
+    if (size <= 0) {
+      return -1;
+    }
+
+    for (char *p = buffer; p < buffer + size;) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      const char *dir = event->wd >= 0 && event->wd < self->dirs_count
+                            ? self->dirs[event->wd]
+                            : NULL;
+      char *path = NULL;
+
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (!dir || 0 == event->len || is_hidden(event->name)) {
+        continue;
+      }
+
+      if (!(path = path_join(dir, event->name))) {
+        continue;
+      }
+
+      // the files of new directories are watched too
+      if ((event->mask & IN_ISDIR) &&
+          (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+        clib_watch_add(self, path);
+      }
+
+      if (fn) {
+        fn(path, data);
+      }
+
+      (void)changes++;
+      free(path);
+    }
+  }
+}
+
+clib_watch_t *clib_watch_new(void) {
+  clib_watch_t *self = calloc(1, sizeof(clib_watch_t));
+
+  if (!self) {
+    return NULL;
+  }
+
+  if (-1 == (self->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC))) {
+    free(self);
+    return NULL;
+  }
+
+  return self;
+}
+
+int clib_watch_add(clib_watch_t *self, const char *dir) {
+  watch_walk_t data = {self, dir, NULL};
+  clib_walk_t walk = {NULL, enter_dir, NULL, &data};
+
+  if (!self || !dir || 0 != watch_dir(self, dir)) {
+    return -1;
+  }
+
+  return clib_walk(dir, 1, &walk);
+}
+
+int clib_watch_wait(clib_watch_t *self, int settle_ms, clib_watch_fn fn,
+                    void *data) {
+  struct pollfd pfd = {0};
+  int timeout = -1;
+
+  if (!self) {
+    return -1;
+  }
+
+  pfd.fd = self->fd;
+  pfd.events = POLLIN;
+
+  for (;;) {
+    int ready = poll(&pfd, 1, timeout);
+    int changes = 0;
+
+    if (-1 == ready && EINTR == errno) {
+      continue;
+    }
+
+    if (-1 == ready) {
+      return -1;
+    }
+
+    // quiet for long enough after a change
+    if (0 == ready) {
+      return 0;
+    }
+
+    if (-1 == (changes = read_events(self, fn, data))) {
+      return -1;
+    }
+
+    if (changes > 0) {
+      timeout = settle_ms;
+    }
+  }
+}
+
+void clib_watch_drain(clib_watch_t *self) {
+  if (self) {
+    read_events(self, NULL, NULL);
+  }
+}
+
+void clib_watch_free(clib_watch_t *self) {
+  if (!self) {
+    return;
+  }
+
+  close(self->fd);
+
+  for (int i = 0; i < self->dirs_count; i++) {
+    free(self->dirs[i]);
+  }
+
+  free(self->dirs);
+  free(self);
+}
+
+#else
+
+static void sleep_ms(int ms) {
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+}
+
+static int enter_dir(int dirfd, const char *name, const char *path,
+                     void *data) {
+  (void)dirfd;
+  (void)path;
+  (void)data;
+  return is_hidden(name) ? CLIB_WALK_SKIP : 0;
+}
+
+static int note_file(int dirfd, const char *name, const char *path,
+                     void *data) {
+  watch_walk_t *walk = data;
+  char record[64];
+  char *full = NULL;
+  char *copy = NULL;
+  struct stat st;
+
+  if (is_hidden(name) || 0 != fstatat(dirfd, name, &st, 0)) {
+    return 0;
+  }
+
+  if (!(full = path_join(walk->root, path))) {
+    return -1;
+  }
+
+  snprintf(record, sizeof(record), "%lld %lld", (long long)st.st_size,
+           (long long)st.st_mtime);
+
+  // hash_has() can't be asked about missing keys
+  if (hash_get(walk->files, full) || !(copy = strdup(record))) {
+    free(full);
+    return 0;
+  }
+
+  hash_set(walk->files, full, copy);
+  return 0;
+}
+
+static void free_files(hash_t *files) {
+  if (files) {
+    hash_each(files, {
+      free((char *)key);
+      free(val);
+    });
+    hash_free(files);
+  }
+}
+
+/**
+ * @return The files under all the roots as they are now, or NULL on error
+ */
+
+static hash_t *snapshot(clib_watch_t *self) {
+  hash_t *files = hash_new();
+
+  for (int i = 0; files && i < self->roots_count; i++) {
+    watch_walk_t data = {self, self->roots[i], files};
+    clib_walk_t walk = {note_file, enter_dir, NULL, &data};
+
+    clib_walk(self->roots[i], 1, &walk);
+  }
+
+  return files;
+}
+
+/**
+ * Compares the files as they are now with what was seen last, reporting
+ * the changes to `fn` when there is one.
+ *
+ * @return Number of changes, or -1 on error
+ */
+
+static int compare(clib_watch_t *self, clib_watch_fn fn, void *data) {
+  hash_t *files = snapshot(self);
+  int changes = 0;
+
+  if (!files) {
+    return -1;
+  }
+
+  hash_each(files, {
+    const char *seen = hash_get(self->files, (char *)key);
+
+    if (!seen || 0 != strcmp(seen, val)) {
+      if (fn) {
+        fn(key, data);
+      }
+      (void)changes++;
+    }
+  });
+
+  hash_each_key(self->files, {
+    if (!hash_get(files, (char *)key)) {
+      if (fn) {
+        fn(key, data);
+      }
+      (void)changes++;
+    }
+  });
+
+  free_files(self->files);
+  self->files = files;
+  return changes;
+}
+
+clib_watch_t *clib_watch_new(void) {
+  clib_watch_t *self = calloc(1, sizeof(clib_watch_t));
+
+  if (self && !(self->files = hash_new())) {
+    free(self);
+    return NULL;
+  }
+
+  return self;
+}
+
+int clib_watch_add(clib_watch_t *self, const char *dir) {
+  char **roots = NULL;
+
+  if (!self || !dir) {
+    return -1;
+  }
+
+  if (!(roots = realloc(self->roots,
+                        (self->roots_count + 1) * sizeof(char *)))) {
+    return -1;
+  }
+
+  self->roots = roots;
+
+  if (!(self->roots[self->roots_count] = strdup(dir))) {
+    return -1;
+  }
+
+  (void)self->roots_count++;
+  return -1 == compare(self, NULL, NULL) ? -1 : 0;
+}
+
+int clib_watch_wait(clib_watch_t *self, int settle_ms, clib_watch_fn fn,
+                    void *data) {
+  int changed = 0;
+
+  if (!self) {
+    return -1;
+  }
+
+  for (;;) {
+    int changes = 0;
+
+    sleep_ms(changed ? settle_ms : WATCH_POLL_MS);
+
+    if (-1 == (changes = compare(self, fn, data))) {
+      return -1;
+    }
+
+    if (changed && 0 == changes) {
+      return 0;
+    }
+
+    changed = changed || changes > 0;
+  }
+}
+
+void clib_watch_drain(clib_watch_t *self) {
+  if (self) {
+    compare(self, NULL, NULL);
+  }
+}
+
+void clib_watch_free(clib_watch_t *self) {
+  if (!self) {
+    return;
+  }
+
+  for (int i = 0; i < self->roots_count; i++) {
+    free(self->roots[i]);
+  }
+
+  free(self->roots);
+  free_files(self->files);
+  free(self);
+}
+
+#endif
@@ -0,0 +1,53 @@
+//
+// clib-watch.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_WATCH_H
+#define CLIB_WATCH_H 1
+
+typedef struct clib_watch clib_watch_t;
+
+/**
+ * Gets the path of a file that was written, created, removed or moved.
+ */
+typedef void (*clib_watch_fn)(const char *path, void *data);
+
+/**
+ * Starts watching nothing yet. Changes are noticed as they happen with
+ * inotify on Linux, and by comparing the files every so often elsewhere.
+ *
+ * @return A new watch, or NULL on error
+ */
+clib_watch_t *clib_watch_new(void);
+
+/**
+ * Watches the files under `dir`, and under directories made in it later,
+ * leaving hidden directories out. The paths given to callbacks start
+ * with `dir` as given.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_watch_add(clib_watch_t *self, const char *dir);
+
+/**
+ * Waits for changes, then until nothing changed for `settle_ms`, so that
+ * a save of several files is seen all at once, calling `fn` for each
+ * change on the way.
+ *
+ * @return 0 on success, -1 if changes can no longer be watched
+ */
+int clib_watch_wait(clib_watch_t *self, int settle_ms, clib_watch_fn fn,
+                    void *data);
+
+/**
+ * Forgets the changes made so far, such as those of a build that just
+ * ran, without waiting.
+ */
+void clib_watch_drain(clib_watch_t *self);
+
+void clib_watch_free(clib_watch_t *self);
+
+#endif
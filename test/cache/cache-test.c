@@ -1,10 +1,14 @@
+#define _POSIX_C_SOURCE 200809L
 #include "../../src/common/clib-cache.h"
+#include "../../src/common/clib-hash.h"
+#include "../../src/common/clib-mkdir.h"
 #include "fs/fs.h"
 #include "rimraf/rimraf.h"
 #include <describe/describe.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #define assert_exists(f) assert_equal(0, fs_exists(f));
@@ -13,6 +17,12 @@ static void assert_cached_dir(char *pkg_dir, int exists) {
   assert_equal(exists, fs_exists(pkg_dir));
 }
 
+// the cache remembers the directories it made
+static void remove_dir(char *dir) {
+  rimraf(dir);
+  clib_mkdirp_forget();
+}
+
 static void assert_cached_file(char *pkg_dir, char *file) {
   char path[BUFSIZ];
   sprintf(path, "%s/%s", pkg_dir, file);
@@ -27,8 +37,15 @@ static void assert_cached_files(char *pkg_dir) {
 }
 
 int main() {
+  char home[BUFSIZ];
 
-  rimraf(clib_cache_dir());
+  // keep the user's cache out of reach, and start from an empty one
+  rimraf("./tmp-home");
+  mkdir("./tmp-home", 0700);
+  if (getcwd(home, sizeof(home) - sizeof("/tmp-home"))) {
+    strcat(home, "/tmp-home");
+    setenv("HOME", home, 1);
+  }
 
   describe("clib-cache opearions") {
 
@@ -46,13 +63,167 @@ int main() {
     sprintf(pkg_dir, "%s/author_pkg_1.2.0", clib_cache_dir());
 
     it("should manage the package cache") {
+      char *original = NULL;
+      char *loaded = NULL;
+
       assert_equal(
           0, clib_cache_save_package(author, name, version, "../../deps/copy"));
       assert_equal(1, clib_cache_has_package(author, name, version));
       assert_equal(0, clib_cache_is_expired_package(author, name, version));
 
-      assert_cached_dir(pkg_dir, 0);
-      assert_cached_files(pkg_dir);
+      remove_dir("./tmp-pkg");
+      assert_equal(0, clib_cache_load_package(author, name, version,
+                                              "./tmp-pkg"));
+      assert_cached_dir("./tmp-pkg", 0);
+      assert_cached_files("./tmp-pkg");
+
+      original = fs_read("../../deps/copy/copy.c");
+      loaded = fs_read("./tmp-pkg/copy.c");
+      assert_equal(0, strcmp(original, loaded));
+      free(original);
+      free(loaded);
+
+      // files are stored once however many packages contain them
+      assert_equal(0, clib_cache_save_package(author, "other", version,
+                                              "../../deps/copy"));
+      assert_equal(0, clib_cache_delete_package(author, "other", version));
+      assert_equal(0, clib_cache_has_package(author, "other", version));
+
+      remove_dir("./tmp-pkg");
+    }
+
+    it("should manage packed packages") {
+      char *original = NULL;
+      char *loaded = NULL;
+
+      clib_cache_set_packed(1);
+      assert_equal(0, clib_cache_save_package(author, "packed", version,
+                                              "../../deps/copy"));
+      assert_equal(1, clib_cache_has_package(author, "packed", version));
+      assert_equal(0, clib_cache_verify(0));
+
+      remove_dir("./tmp-pkg");
+      assert_equal(0, clib_cache_load_package(author, "packed", version,
+                                              "./tmp-pkg"));
+      assert_cached_files("./tmp-pkg");
+
+      original = fs_read("../../deps/copy/copy.c");
+      loaded = fs_read("./tmp-pkg/copy.c");
+      assert_equal(0, strcmp(original, loaded));
+      free(original);
+      free(loaded);
+
+      assert_equal(0, clib_cache_delete_package(author, "packed", version));
+      assert_equal(0, clib_cache_has_package(author, "packed", version));
+      clib_cache_set_packed(0);
+
+      remove_dir("./tmp-pkg");
+    }
+
+    it("should manage builds by key") {
+      struct stat st;
+
+      assert_equal(0, clib_cache_save_build(author, name, version, "k1",
+                                            "../../deps/copy"));
+      assert_equal(-1, clib_cache_load_build(author, name, version, "k2",
+                                             "./tmp-pkg"));
+
+      remove_dir("./tmp-pkg");
+      assert_equal(0, clib_cache_load_build(author, name, version, "k1",
+                                            "./tmp-pkg"));
+      assert_cached_files("./tmp-pkg");
+
+      // builds replace what they restored
+      assert_equal(0, stat("./tmp-pkg/copy.c", &st));
+      assert(0 != (st.st_mode & S_IWUSR));
+
+      remove_dir("./tmp-pkg");
+    }
+
+    it("should link downloaded files into the store") {
+      char hash[CLIB_HASH_HEX_SIZE];
+      char object[BUFSIZ * 2];
+      char *stored = NULL;
+
+      remove_dir("./tmp-download");
+      mkdir("./tmp-download", 0700);
+      assert_ok(-1 != fs_write("./tmp-download/fetched.c", "int fetched;\n"));
+      assert_equal(0, clib_hash_file("./tmp-download/fetched.c", hash));
+
+      clib_cache_set_packed(1);
+      assert_equal(-1, clib_cache_store_file("./tmp-download/fetched.c", hash));
+      clib_cache_set_packed(0);
+
+      assert_equal(0, clib_cache_store_file("./tmp-download/fetched.c", hash));
+      sprintf(object, "%s/.cache/clib/store/%.2s/%s", getenv("HOME"), hash,
+              hash + 2);
+      stored = fs_read(object);
+      assert_equal(0, strcmp("int fetched;\n", stored));
+      free(stored);
+
+      // the save finds the file in the store already
+      assert_equal(0, clib_cache_save_package(author, "fetched", version,
+                                              "./tmp-download"));
+      remove_dir("./tmp-pkg");
+      assert_equal(0, clib_cache_load_package(author, "fetched", version,
+                                              "./tmp-pkg"));
+      assert_cached_file("./tmp-pkg", "fetched.c");
+      assert_equal(0, clib_cache_delete_package(author, "fetched", version));
+
+      remove_dir("./tmp-download");
+      remove_dir("./tmp-pkg");
+    }
+
+    it("should evict packages over the size budget") {
+      clib_cache_stats_t stats;
+      uint64_t size = 0;
+
+      assert_equal(0, clib_cache_parse_size("2G", &size));
+      assert_ok(size == 2ULL * 1024 * 1024 * 1024);
+      assert_equal(0, clib_cache_parse_size("512", &size));
+      assert_ok(512 == size);
+      assert_equal(-1, clib_cache_parse_size("big", &size));
+
+      assert_equal(
+          0, clib_cache_save_package(author, name, version, "../../deps/copy"));
+      assert_equal(0, clib_cache_verify(0));
+      assert_equal(0, clib_cache_stats(&stats));
+      assert_ok(stats.packages >= 1 && stats.size > 0);
+
+      // nothing is expired yet and there is no budget
+      assert_equal(0, clib_cache_prune(0, NULL));
+      assert_equal(1, clib_cache_has_package(author, name, version));
+
+      assert_equal(0, clib_cache_prune(1, &size));
+      assert_ok(size > 0);
+      assert_equal(0, clib_cache_has_package(author, name, version));
+      assert_equal(0, clib_cache_stats(&stats));
+      assert_ok(0 == stats.size);
+    }
+
+    it("should delete packages with broken files when verifying") {
+      char hash[CLIB_HASH_HEX_SIZE];
+      char object[BUFSIZ * 2];
+
+      assert_equal(0, clib_cache_save_package(author, "verified", version,
+                                              "../../deps/copy"));
+      assert_equal(0, clib_hash_file("../../deps/copy/copy.c", hash));
+      sprintf(object, "%s/.cache/clib/store/%.2s/%s", getenv("HOME"), hash,
+              hash + 2);
+      chmod(object, 0600);
+      assert_ok(-1 != fs_write(object, "broken"));
+      assert_equal(1, clib_cache_verify(0));
+
+      clib_cache_set_verify(1);
+      remove_dir("./tmp-pkg");
+      assert_equal(-2, clib_cache_load_package(author, "verified", version,
+                                               "./tmp-pkg"));
+      assert_ok(0 != fs_exists("./tmp-pkg/copy.c"));
+      assert_equal(0, clib_cache_has_package(author, "verified", version));
+      assert_equal(0, clib_cache_verify(0));
+      clib_cache_set_verify(0);
+
+      remove_dir("./tmp-pkg");
     }
 
     it("should manage the json cache") {
@@ -72,6 +243,119 @@ int main() {
       assert_null(clib_cache_read_json("a", "n", "v"));
     }
 
+    it("should remember missing manifests") {
+      assert_equal(0, clib_cache_has_missing_json("a", "n", "v", "clib.json"));
+
+      assert_equal(0, clib_cache_save_missing_json("a", "n", "v", "clib.json"));
+      assert_equal(1, clib_cache_has_missing_json("a", "n", "v", "clib.json"));
+      assert_equal(0,
+                   clib_cache_has_missing_json("a", "n", "v", "package.json"));
+      assert_equal(0, clib_cache_has_missing_json("a", "n", "v2", "clib.json"));
+    }
+
+    it("should manage the json cache validators") {
+      char *etag = NULL;
+      char *last_modified = NULL;
+      char *cached_json;
+
+      assert_equal(-1, clib_cache_read_json_validators("a", "n", "v", &etag,
+                                                       &last_modified));
+
+      assert_equal(2, clib_cache_save_json("a", "n", "v", "{}"));
+      assert_equal(-1, clib_cache_read_json_validators("a", "n", "v", &etag,
+                                                       &last_modified));
+
+      assert_equal(6, clib_cache_save_json_validators("a", "n", "v",
+                                                      "\"e1\"", NULL));
+      assert_equal(0, clib_cache_read_json_validators("a", "n", "v", &etag,
+                                                      &last_modified));
+      assert_equal(0, strcmp("\"e1\"", etag));
+      assert_null(last_modified);
+      free(etag);
+
+      sleep(expiraton + 1);
+      assert_null(clib_cache_read_json("a", "n", "v"));
+      cached_json = clib_cache_read_stale_json("a", "n", "v");
+      assert_equal(0, strcmp("{}", cached_json));
+      free(cached_json);
+
+      assert_equal(0, clib_cache_delete_json("a", "n", "v"));
+      assert_equal(-1, clib_cache_read_json_validators("a", "n", "v", &etag,
+                                                       &last_modified));
+      assert_null(clib_cache_read_stale_json("a", "n", "v"));
+    }
+
+    it("should use an expired json cache while it is refreshed") {
+      fs_mapping mapping;
+      int lock;
+
+      assert_equal(2, clib_cache_save_json("a", "n", "v", "{}"));
+      assert_equal(0, clib_cache_has_expired_json("a", "n", "v"));
+
+      sleep(expiraton + 1);
+
+      assert_equal(0, clib_cache_has_json("a", "n", "v"));
+      assert_equal(1, clib_cache_has_expired_json("a", "n", "v"));
+      assert_equal(0, clib_cache_map_expired_json("a", "n", "v", &mapping));
+      assert_equal(0, strncmp("{}", mapping.data, mapping.size));
+      fs_unmap(&mapping);
+
+      // one refresh at a time
+      assert_ok(-1 != (lock = clib_cache_begin_refresh_json("a", "n", "v")));
+      assert_equal(-1, clib_cache_begin_refresh_json("a", "n", "v"));
+      clib_cache_end_refresh(lock);
+      assert_ok(-1 != (lock = clib_cache_begin_refresh_json("a", "n", "v")));
+      clib_cache_end_refresh(lock);
+
+      assert_equal(0, clib_cache_renew_json("a", "n", "v"));
+      assert_equal(1, clib_cache_has_json("a", "n", "v"));
+      assert_equal(0, clib_cache_has_expired_json("a", "n", "v"));
+
+      assert_equal(0, clib_cache_delete_json("a", "n", "v"));
+      assert_equal(-1, clib_cache_map_expired_json("a", "n", "v", &mapping));
+    }
+
+    it("should only expire the versions of refs that move") {
+      char *commit = "0123456789abcdef0123456789abcdef01234567";
+
+      assert_equal(2, clib_cache_save_json("a", "n", "1.0.0", "{}"));
+      assert_equal(2, clib_cache_save_json("a", "n", "v1.0.0", "{}"));
+      assert_equal(2, clib_cache_save_json("a", "n", commit, "{}"));
+      assert_equal(2, clib_cache_save_json("a", "n", "master", "{}"));
+
+      sleep(expiraton + 1);
+
+      assert_equal(1, clib_cache_has_json("a", "n", "1.0.0"));
+      assert_equal(1, clib_cache_has_json("a", "n", "v1.0.0"));
+      assert_equal(1, clib_cache_has_json("a", "n", commit));
+      assert_equal(0, clib_cache_has_expired_json("a", "n", "1.0.0"));
+      assert_equal(0, clib_cache_has_json("a", "n", "master"));
+      assert_equal(1, clib_cache_has_expired_json("a", "n", "master"));
+
+      assert_equal(0, clib_cache_delete_json("a", "n", "1.0.0"));
+      assert_equal(0, clib_cache_delete_json("a", "n", "v1.0.0"));
+      assert_equal(0, clib_cache_delete_json("a", "n", commit));
+      assert_equal(0, clib_cache_delete_json("a", "n", "master"));
+    }
+
+    it("should move a flat cache into shards") {
+      char json_dir[BUFSIZ];
+      char path[BUFSIZ * 2];
+
+      sprintf(json_dir, "%s/.cache/clib/json", getenv("HOME"));
+      sprintf(path, "%s/.sharded", json_dir);
+      unlink(path);
+      sprintf(path, "%s/m_n_v.json", json_dir);
+      assert_equal(2, (int)fs_write(path, "{}"));
+      assert_equal(0, clib_cache_has_json("m", "n", "v"));
+
+      assert_equal(0, clib_cache_init(expiraton));
+      assert_equal(1, clib_cache_has_json("m", "n", "v"));
+      assert_equal(-1, fs_exists(path));
+
+      assert_equal(0, clib_cache_delete_json("m", "n", "v"));
+    }
+
     it("should manage the search cache") {
       char *cached_search;
 
@@ -102,8 +386,40 @@ int main() {
       assert_equal(0, clib_cache_has_search());
     }
 
+    it("should revalidate the search cache") {
+      fs_mapping mapping;
+      char *etag;
+
+      clib_cache_delete_search();
+      assert_null(clib_cache_read_search_etag());
+
+      assert_equal(13, clib_cache_save_search("<html></html>"));
+      assert_equal(3, clib_cache_save_search_index("abc"));
+      assert_equal(5, clib_cache_save_search_etag("\"v1\""));
+
+      sleep(expiraton + 1);
+
+      assert_equal(0, clib_cache_has_search());
+      assert_equal(0, strcmp("\"v1\"", etag = clib_cache_read_search_etag()));
+      free(etag);
+
+      assert_equal(0, clib_cache_map_expired_search(&mapping));
+      assert_equal(0, strncmp("<html></html>", mapping.data, mapping.size));
+      fs_unmap(&mapping);
+      assert_equal(0, clib_cache_map_expired_search_index(&mapping));
+      fs_unmap(&mapping);
+
+      assert_equal(0, clib_cache_renew_search());
+      assert_equal(1, clib_cache_has_search());
+
+      assert_equal(0, clib_cache_delete_search());
+      assert_null(clib_cache_read_search_etag());
+    }
+
     clib_cache_delete_search();
   }
 
+  rimraf("./tmp-home");
+
   return assert_failures();
 }
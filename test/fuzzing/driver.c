@@ -0,0 +1,285 @@
+//
+// driver.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "fs/fs.h"
+#include "tinydir/tinydir.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Runs a fuzz target without libFuzzer: the inputs of the corpus given on
+ * the command line, and `FUZZ_RUNS` mutations of them, made the same way
+ * for the same `FUZZ_SEED`. Mutations may repeat a part of an input up to
+ * `FUZZ_MAX_LEN` bytes, so that a parser which is quadratic in something
+ * gets to show it.
+ *
+ * Every input has a budget of time and allocations that grows linearly
+ * with its size. An input over budget is written to `slow-unit-<n>`, as
+ * libFuzzer would, and fails the run.
+ */
+
+#define MAX_INPUTS 1024
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+} input_t;
+
+static input_t inputs[MAX_INPUTS];
+static int count = 0;
+static unsigned long long state = 0;
+static unsigned long long allocs = 0;
+
+#ifdef FUZZ_ALLOCS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  __sync_fetch_and_add(&allocs, 1);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  __sync_fetch_and_add(&allocs, 1);
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  __sync_fetch_and_add(&allocs, 1);
+  return __real_realloc(ptr, size);
+}
+#endif
+
+static unsigned long env(const char *name, unsigned long fallback) {
+  const char *value = getenv(name);
+  return value && *value ? strtoul(value, NULL, 10) : fallback;
+}
+
+static size_t next(size_t bound) {
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return bound ? (size_t)(state >> 33) % bound : 0;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void add_input(uint8_t *data, size_t size) {
+  if (count < MAX_INPUTS) {
+    inputs[count].data = data;
+    inputs[count].size = size;
+    count++;
+  } else {
+    free(data);
+  }
+}
+
+static void add_file(const char *path) {
+  FILE *file = fs_open(path, "rb");
+  long size = file ? fs_fsize(file) : -1;
+  uint8_t *data = NULL;
+
+  if (size >= 0 && (data = malloc(size + 1)) &&
+      (size_t)size == fread(data, 1, size, file)) {
+    add_input(data, size);
+    data = NULL;
+  } else {
+    fprintf(stderr, "unable to read %s\n", path);
+  }
+
+  free(data);
+  if (file) {
+    fs_close(file);
+  }
+}
+
+static void add_path(const char *path) {
+  tinydir_dir dir;
+
+  if (-1 == tinydir_open_sorted(&dir, path)) {
+    add_file(path);
+    return;
+  }
+
+  for (size_t i = 0; i < dir.n_files; i++) {
+    tinydir_file file;
+    tinydir_readfile_n(&dir, &file, i);
+    if (file.is_reg) {
+      add_file(file.path);
+    }
+  }
+
+  tinydir_close(&dir);
+}
+
+/**
+ * Makes a new input of `input` with one to four changes to its bytes.
+ */
+
+static input_t mutate(input_t input, size_t max) {
+  input_t res = {malloc(max + 1), 0};
+  int changes = 1 + next(4);
+
+  if (!res.data) {
+    return res;
+  }
+
+  res.size = input.size < max ? input.size : max;
+  memcpy(res.data, input.data, res.size);
+
+  for (int i = 0; i < changes; i++) {
+    size_t at = next(res.size + 1);
+    size_t length = 1 + next(res.size - at + 1);
+
+    switch (next(res.size ? 5 : 1)) {
+    case 0: // insert a byte, often one that means something to a parser
+      if (res.size < max) {
+        static const char special[] = "{}[]\":,<>/@#\\ \n";
+        memmove(res.data + at + 1, res.data + at, res.size - at);
+        res.data[at] = next(2) ? (uint8_t)next(256)
+                               : (uint8_t)special[next(sizeof(special) - 1)];
+        res.size++;
+      }
+      break;
+
+    case 1: // change a byte
+      if (at < res.size) {
+        res.data[at] ^= 1 << next(8);
+      }
+      break;
+
+    case 2: // remove some
+      if (at < res.size) {
+        length = length > res.size - at ? res.size - at : length;
+        memmove(res.data + at, res.data + at + length,
+                res.size - at - length);
+        res.size -= length;
+      }
+      break;
+
+    case 3: // repeat some, many times over
+      if (at < res.size) {
+        size_t times = 1 + next(64);
+        length = length > res.size - at ? res.size - at : length;
+        length = length > 64 ? 64 : length;
+        while (times-- > 0 && res.size + length <= max) {
+          memmove(res.data + at + length, res.data + at, res.size - at);
+          res.size += length;
+        }
+      }
+      break;
+
+    case 4: // take the end of another input
+      if (count > 0) {
+        input_t other = inputs[next(count)];
+        size_t from = next(other.size + 1);
+        length = other.size - from;
+        length = length > max - at ? max - at : length;
+        memcpy(res.data + at, other.data + from, length);
+        res.size = at + length;
+      }
+      break;
+    }
+  }
+
+  return res;
+}
+
+/**
+ * Runs `input` through the target, failing when it went over budget.
+ *
+ * @return 0 within budget, -1 otherwise
+ */
+
+static int run(input_t input, int n) {
+  uint64_t budget_ns = env("FUZZ_BUDGET_US", 20000) * 1000 +
+                       env("FUZZ_BUDGET_NS_PER_BYTE", 2000) * input.size;
+  unsigned long long budget_allocs =
+      env("FUZZ_BUDGET_ALLOCS", 1024) +
+      env("FUZZ_BUDGET_ALLOCS_PER_BYTE", 4) * input.size;
+  unsigned long long before = allocs;
+  uint64_t started = now_ns();
+  uint64_t elapsed = 0;
+  char name[64];
+
+  LLVMFuzzerTestOneInput(input.data, input.size);
+  elapsed = now_ns() - started;
+
+  if (elapsed <= budget_ns && allocs - before <= budget_allocs) {
+    return 0;
+  }
+
+  snprintf(name, sizeof(name), "slow-unit-%d", n);
+  fs_nwrite(name, (const char *)input.data, input.size);
+  fprintf(stderr,
+          "input %d of %zu bytes took %llu us and %llu allocations, over a "
+          "budget of %llu us and %llu allocations, written to %s\n",
+          n, input.size, (unsigned long long)(elapsed / 1000),
+          allocs - before, (unsigned long long)(budget_ns / 1000),
+          budget_allocs, name);
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  unsigned long runs = env("FUZZ_RUNS", 1000);
+  size_t max = env("FUZZ_MAX_LEN", 64 * 1024);
+  unsigned long done = 0;
+  int seeds = 0;
+  int rc = 0;
+
+  state = env("FUZZ_SEED", 1);
+
+  for (int i = 1; i < argc; i++) {
+    add_path(argv[i]);
+  }
+
+  // something to start from
+  if (0 == count) {
+    add_input(calloc(1, 1), 0);
+  }
+
+  seeds = count;
+
+  for (int i = 0; i < seeds && 0 == rc; i++) {
+    rc = run(inputs[i], i);
+  }
+
+  for (; done < runs && 0 == rc; done++) {
+    int parent = next(count);
+    input_t input = mutate(inputs[parent], max);
+
+    if (!input.data) {
+      continue;
+    }
+
+    rc = run(input, seeds + done);
+
+    // what grew is mutated further, so that repeats compound
+    if (0 == rc && input.size > inputs[parent].size) {
+      add_input(input.data, input.size);
+    } else {
+      free(input.data);
+    }
+  }
+
+  printf("%s: %d inputs and %lu mutations, %s\n", argv[0], seeds, done,
+         0 == rc ? "all within budget" : "stopped over budget");
+
+  for (int i = 0; i < count; i++) {
+    free(inputs[i].data);
+  }
+
+  return 0 == rc ? 0 : 1;
+}
@@ -1,27 +1,31 @@
-#include <stdio.h>
+//
+// fuzz_manifest.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-package.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdint.h>
-#include "../../src/common/clib-package.h"
 
 int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
-    if(size<3){
-            return 0;
-    }
-    char filename[256];
-    sprintf(filename, "libfuzzer.json");
+  clib_package_t *pkg = NULL;
+  char *json = NULL;
 
-    FILE *fp = fopen(filename, "wb");
-    if (!fp)
-            return 0;
-    fwrite(data, size, 1, fp);
-    fclose(fp);
-    
-    clib_package_t *pkg = 
-	    clib_package_load_from_manifest(filename, 0);
-    if(pkg) {
-	    clib_package_free(pkg);
-    }
-    unlink(filename);
+  // a manifest is parsed from a string, which the input isn't yet
+  if (!(json = malloc(size + 1))) {
     return 0;
+  }
+
+  memcpy(json, data, size);
+  json[size] = '\0';
+
+  if ((pkg = clib_package_new(json, 0))) {
+    clib_package_free(pkg);
+  }
+
+  free(json);
+  return 0;
 }
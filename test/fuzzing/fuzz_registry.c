@@ -0,0 +1,38 @@
+//
+// fuzz_registry.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "list/list.h"
+#include "wiki-registry/wiki-registry.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  list_iterator_t *it = NULL;
+  list_node_t *node = NULL;
+  list_t *pkgs = NULL;
+  char *html = NULL;
+
+  if (!(html = malloc(size + 1))) {
+    return 0;
+  }
+
+  memcpy(html, data, size);
+  html[size] = '\0';
+
+  if ((pkgs = wiki_registry_parse(html))) {
+    it = list_iterator_new(pkgs, LIST_HEAD);
+    while ((node = list_iterator_next(it))) {
+      wiki_package_free(node->val);
+    }
+    list_iterator_destroy(it);
+    list_destroy(pkgs);
+  }
+
+  free(html);
+  return 0;
+}
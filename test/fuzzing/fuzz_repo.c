@@ -0,0 +1,42 @@
+//
+// fuzz_repo.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "parse-repo/parse-repo.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int within(parse_repo_span_t span, size_t length) {
+  return span.offset <= length && span.length <= length - span.offset;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  parse_repo_t repo;
+  char *slug = NULL;
+  size_t length = 0;
+
+  if (!(slug = malloc(size + 1))) {
+    return 0;
+  }
+
+  memcpy(slug, data, size);
+  slug[size] = '\0';
+  length = strlen(slug);
+
+  // the spans are read without copying, so they had better be in the slug
+  if (0 == parse_repo(slug, &repo) &&
+      (!within(repo.owner, length) || !within(repo.name, length) ||
+       !within(repo.version, length))) {
+    abort();
+  }
+
+  free(parse_repo_owner(slug, "clibs"));
+  free(parse_repo_name(slug));
+  free(parse_repo_version(slug, "master"));
+  free(slug);
+  return 0;
+}
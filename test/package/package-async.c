@@ -0,0 +1,62 @@
+#include "clib-package.h"
+#include "describe/describe.h"
+#include <curl/curl.h>
+
+static int called = 0;
+
+static void count_call(clib_package_future_t *future, void *data) {
+  assert(future);
+  assert(&called == data);
+  __sync_fetch_and_add(&called, 1);
+}
+
+int main() {
+  curl_global_init(CURL_GLOBAL_ALL);
+  clib_package_set_opts((clib_package_opts_t){
+      .skip_cache = 1,
+      .prefix = 0,
+      .force = 1,
+      .concurrency = 4,
+  });
+
+  describe("clib_package_*_async") {
+    it("should return NULL when given bad arguments") {
+      assert(NULL == clib_package_new_from_slug_async(NULL, 0, NULL, NULL));
+      assert(NULL == clib_package_install_async(NULL, "./deps", 0, NULL,
+                                                NULL));
+      assert(NULL == clib_package_install_dependencies_async(
+                         NULL, "./deps", 0, NULL, NULL));
+    }
+
+    it("should resolve to what the blocking call returns") {
+      clib_package_t *pkg = clib_package_new("{\"name\": \"foo\","
+                                             "\"repo\": \"foobar/foo\","
+                                             "\"version\": \"1.0.0\"}",
+                                             0);
+      clib_package_future_t *futures[8];
+
+      assert(pkg);
+      called = 0;
+
+      for (int i = 0; i < 8; i++) {
+        futures[i] = clib_package_install_dependencies_async(
+            pkg, "./test/fixtures", 0, count_call, &called);
+        assert(futures[i]);
+      }
+
+      for (int i = 0; i < 8; i++) {
+        assert(0 == clib_package_future_wait(futures[i]));
+        assert(clib_package_future_done(futures[i]));
+        assert(pkg == clib_package_future_package(futures[i]));
+        clib_package_future_free(futures[i]);
+      }
+
+      assert(8 == called);
+      clib_package_free(pkg);
+    }
+  }
+
+  clib_package_cleanup();
+  curl_global_cleanup();
+  return assert_failures();
+}
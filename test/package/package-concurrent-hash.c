@@ -0,0 +1,153 @@
+#include "describe/describe.h"
+#include "hash/concurrent-hash.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS 8
+#define KEYS 1000
+
+typedef struct {
+  concurrent_hash_t *hash;
+  int won[KEYS];
+} racer_t;
+
+static racer_t racers[THREADS];
+
+// every thread tries every key, as threads resolving the same slugs do
+static void *race(void *arg) {
+  racer_t *racer = arg;
+  char key[16];
+
+  for (int i = 0; i < KEYS; i++) {
+    snprintf(key, sizeof(key), "key-%d", i);
+    racer->won[i] = concurrent_hash_insert(racer->hash, key, racer);
+  }
+
+  return NULL;
+}
+
+int main() {
+  describe("concurrent_hash") {
+    it("should insert each key once when threads race for it") {
+      concurrent_hash_t *hash = concurrent_hash_new();
+      pthread_t threads[THREADS];
+      char key[16];
+
+      assert(hash);
+
+      for (int t = 0; t < THREADS; t++) {
+        racers[t].hash = hash;
+        assert(0 == pthread_create(&threads[t], NULL, race, &racers[t]));
+      }
+
+      for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+      }
+
+      assert(KEYS == concurrent_hash_size(hash));
+
+      for (int i = 0; i < KEYS; i++) {
+        racer_t *winner = NULL;
+        int wins = 0;
+
+        for (int t = 0; t < THREADS; t++) {
+          assert(0 == racers[t].won[i] || 1 == racers[t].won[i]);
+          if (racers[t].won[i]) {
+            winner = &racers[t];
+            wins++;
+          }
+        }
+
+        snprintf(key, sizeof(key), "key-%d", i);
+        assert(1 == wins);
+        assert(winner == concurrent_hash_get(hash, key));
+      }
+
+      concurrent_hash_free(hash);
+    }
+
+    it("should get and remove keys") {
+      concurrent_hash_t *hash = concurrent_hash_new();
+      char key[16];
+
+      assert(NULL == concurrent_hash_get(hash, "foo"));
+      assert(NULL == concurrent_hash_del(hash, "foo"));
+
+      assert(0 == concurrent_hash_set(hash, "foo", "bar"));
+      assert(0 == concurrent_hash_set(hash, "foo", "baz"));
+      assert_str_equal("baz", (char *)concurrent_hash_get(hash, "foo"));
+      assert_str_equal("baz", (char *)concurrent_hash_del(hash, "foo"));
+      assert(NULL == concurrent_hash_get(hash, "foo"));
+      assert(0 == concurrent_hash_size(hash));
+
+      // enough for the stripes to grow, with keys sharing buckets
+      for (int i = 0; i < KEYS; i++) {
+        snprintf(key, sizeof(key), "%d", i);
+        assert(1 == concurrent_hash_insert(hash, key, "t"));
+      }
+
+      for (int i = 0; i < KEYS; i += 2) {
+        snprintf(key, sizeof(key), "%d", i);
+        assert_str_equal("t", (char *)concurrent_hash_del(hash, key));
+      }
+
+      assert(KEYS / 2 == concurrent_hash_size(hash));
+
+      for (int i = 0; i < KEYS; i++) {
+        snprintf(key, sizeof(key), "%d", i);
+        if (i % 2) {
+          assert_str_equal("t", (char *)concurrent_hash_get(hash, key));
+        } else {
+          assert(NULL == concurrent_hash_get(hash, key));
+        }
+      }
+
+      concurrent_hash_free(hash);
+    }
+
+    it("should clear every pair and take new ones") {
+      concurrent_hash_t *hash = concurrent_hash_new();
+
+      concurrent_hash_clear(hash);
+      assert(0 == concurrent_hash_size(hash));
+
+      assert(1 == concurrent_hash_insert(hash, "foo", "bar"));
+      assert(1 == concurrent_hash_insert(hash, "baz", "qux"));
+      concurrent_hash_clear(hash);
+
+      assert(0 == concurrent_hash_size(hash));
+      assert(NULL == concurrent_hash_get(hash, "foo"));
+
+      assert(1 == concurrent_hash_insert(hash, "foo", "baz"));
+      assert_str_equal("baz", (char *)concurrent_hash_get(hash, "foo"));
+      concurrent_hash_free(hash);
+    }
+
+    it("should keep copies of the keys") {
+      concurrent_hash_t *hash = concurrent_hash_new();
+      char buffer[] = "name";
+      int n = 0;
+
+      assert(0 == concurrent_hash_set(hash, buffer, "tobi"));
+      strcpy(buffer, "kind");
+      assert(1 == concurrent_hash_insert(hash, buffer, "ferret"));
+      memset(buffer, 0, sizeof(buffer));
+
+      assert_str_equal("tobi", (char *)concurrent_hash_get(hash, "name"));
+      assert_str_equal("ferret", (char *)concurrent_hash_get(hash, "kind"));
+
+      concurrent_hash_each(hash, {
+        assert(key != buffer);
+        assert(0 == strcmp("name", key) || 0 == strcmp("kind", key));
+        assert(val);
+        n++;
+      });
+
+      assert(2 == n);
+      concurrent_hash_free(hash);
+    }
+  }
+
+  return assert_failures();
+}
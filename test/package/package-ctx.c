@@ -0,0 +1,57 @@
+#include "clib-ctx.h"
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include <stdio.h>
+
+int main() {
+  fs_write("./ctx-manifest.json", "{\"name\":\"foo\",\"version\":\"1.0.0\"}");
+
+  describe("clib_ctx") {
+    it("should return -1 when given a missing manifest") {
+      clib_ctx_t *ctx = clib_ctx_new(NULL);
+      assert(ctx);
+      assert(-1 ==
+             clib_ctx_install_manifest(ctx, "./ctx-missing.json", "./deps", 0,
+                                       0));
+      clib_ctx_free(ctx);
+    }
+
+    it("should install a manifest without dependencies") {
+      clib_package_stats_t stats;
+      clib_ctx_t *ctx = clib_ctx_new(NULL);
+      assert(ctx);
+      assert(0 == clib_ctx_install_manifest(ctx, "./ctx-manifest.json",
+                                            "./deps", 0, 0));
+      clib_ctx_stats(ctx, &stats);
+      assert(0 == stats.manifests_fetched);
+      clib_ctx_free(ctx);
+    }
+
+    it("should keep contexts apart") {
+      clib_package_opts_t opts = {.force = 1, .prefix = "/tmp/foo"};
+      clib_ctx_t *a = clib_ctx_new(&opts);
+      clib_ctx_t *b = clib_ctx_new(NULL);
+      assert(a);
+      assert(b);
+      assert(0 ==
+             clib_ctx_install_manifest(a, "./ctx-manifest.json", "./deps", 0,
+                                       0));
+      assert(0 ==
+             clib_ctx_install_manifest(b, "./ctx-manifest.json", "./deps", 1,
+                                       0));
+      clib_ctx_free(a);
+      clib_ctx_free(b);
+    }
+
+    it("should refuse a frozen lockfile that is missing") {
+      clib_ctx_t *ctx = clib_ctx_new(NULL);
+      assert(ctx);
+      assert(-1 == clib_ctx_set_lockfile(ctx, "./ctx-missing.lock", 1));
+      assert(0 == clib_ctx_set_lockfile(ctx, "./ctx-missing.lock", 0));
+      clib_ctx_free(ctx);
+    }
+  }
+
+  remove("./ctx-manifest.json");
+  return assert_failures();
+}
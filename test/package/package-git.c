@@ -0,0 +1,80 @@
+#define _POSIX_C_SOURCE 200809L
+#include "clib-cache.h"
+#include "clib-package.h"
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "rimraf/rimraf.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define GIT "git -c user.name=clib -c user.email=clib@localhost -C "
+#define SOURCE "./git-fixtures/clib-test/git-pkg.git"
+
+// a repository of its own stands in for the one on github.com
+static int make_source(void) {
+  rimraf("./git-fixtures");
+  return system("git init -q " SOURCE " && "
+                "echo '/* from git */' > " SOURCE "/git-pkg.c && " GIT SOURCE
+                " add git-pkg.c && " GIT SOURCE " commit -q -m init && " GIT
+                SOURCE " tag 1.0.0");
+}
+
+int main() {
+  char cwd[PATH_MAX];
+  char home[PATH_MAX + 16];
+  char key[PATH_MAX + 64];
+
+  if (!getcwd(cwd, sizeof(cwd))) {
+    return 1;
+  }
+
+  // keep the user's cache out of reach, and fetch from the local source
+  snprintf(home, sizeof(home), "%s/tmp-git-home", cwd);
+  snprintf(key, sizeof(key), "url.file://%s/git-fixtures/.insteadOf", cwd);
+  rimraf(home);
+  setenv("HOME", home, 1);
+  setenv("GIT_CONFIG_COUNT", "1", 1);
+  setenv("GIT_CONFIG_KEY_0", key, 1);
+  setenv("GIT_CONFIG_VALUE_0", "https://github.com/", 1);
+
+  curl_global_init(CURL_GLOBAL_ALL);
+  clib_cache_init(30 * 24 * 60 * 60);
+
+  describe("clib_package_set_opts") {
+    it("should fetch with git when the git option is set") {
+      clib_package_t *pkg = NULL;
+      char *source = NULL;
+
+      assert(0 == make_source());
+
+      clib_package_set_opts((clib_package_opts_t){
+          .skip_cache = 1,
+          .force = 1,
+          .git = 1,
+      });
+
+      pkg = clib_package_new("{\"name\":\"git-pkg\","
+                             "\"repo\":\"clib-test/git-pkg\","
+                             "\"version\":\"1.0.0\","
+                             "\"src\":[\"git-pkg.c\"]}",
+                             0);
+      assert(pkg);
+      pkg->filename = "clib.json";
+      assert(0 == clib_package_install(pkg, "./git-deps", 0));
+
+      source = fs_read("./git-deps/git-pkg/git-pkg.c");
+      assert(source && 0 == strcmp("/* from git */\n", source));
+      free(source);
+      clib_package_free(pkg);
+    }
+  }
+
+  rimraf("./git-deps");
+  rimraf("./git-fixtures");
+  rimraf(home);
+  curl_global_cleanup();
+  return assert_failures();
+}
@@ -0,0 +1,92 @@
+#define _POSIX_C_SOURCE 200809L
+#include "describe/describe.h"
+#include "gumbo-parser/gumbo.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+/**
+ * @return The tag named `name`, as gumbo_tag_enum() found it before it
+ * had a hash table, by comparing the name with each tag in turn
+ */
+
+static GumboTag linear_tag_enum(const char *name) {
+  for (int tag = 0; tag < GUMBO_TAG_UNKNOWN; tag++) {
+    if (0 == strcasecmp(name, gumbo_normalized_tagname(tag))) {
+      return tag;
+    }
+  }
+
+  return GUMBO_TAG_UNKNOWN;
+}
+
+static int agrees(const char *name) {
+  return linear_tag_enum(name) == gumbo_tag_enum(name);
+}
+
+int main() {
+  describe("gumbo_tag_enum") {
+    char name[64];
+
+    it("should find every tag by its name") {
+      for (int tag = 0; tag < GUMBO_TAG_UNKNOWN; tag++) {
+        assert(tag == gumbo_tag_enum(gumbo_normalized_tagname(tag)));
+      }
+    }
+
+    it("should find every tag in upper and mixed case") {
+      for (int tag = 0; tag < GUMBO_TAG_UNKNOWN; tag++) {
+        size_t length = strlen(gumbo_normalized_tagname(tag));
+
+        for (size_t i = 0; i < length; i++) {
+          name[i] = toupper((unsigned char)gumbo_normalized_tagname(tag)[i]);
+        }
+        name[length] = 0;
+        assert(tag == gumbo_tag_enum(name));
+
+        for (size_t i = 0; i < length; i += 2) {
+          name[i] = tolower((unsigned char)name[i]);
+        }
+        assert(tag == gumbo_tag_enum(name));
+      }
+    }
+
+    it("should agree with a linear search one character off") {
+      for (int tag = 0; tag < GUMBO_TAG_UNKNOWN; tag++) {
+        const char *tagname = gumbo_normalized_tagname(tag);
+        size_t length = strlen(tagname);
+
+        // one shorter, which is another tag for some, like "b" of "br"
+        snprintf(name, sizeof(name), "%.*s", (int)length - 1, tagname);
+        assert(agrees(name));
+
+        // one longer, with every letter and digit last
+        for (int c = 0; c < 128; c++) {
+          if (!isalnum(c)) {
+            continue;
+          }
+          snprintf(name, sizeof(name), "%s%c", tagname, c);
+          assert(agrees(name));
+          name[0] = toupper((unsigned char)name[0]);
+          assert(agrees(name));
+        }
+
+        // the same length, with the last character changed
+        snprintf(name, sizeof(name), "%s", tagname);
+        name[length - 1] = 'q' == name[length - 1] ? 'z' : 'q';
+        assert(agrees(name));
+      }
+    }
+
+    it("should know no tag by an empty or long name") {
+      assert(GUMBO_TAG_UNKNOWN == gumbo_tag_enum(""));
+
+      memset(name, 'a', sizeof(name) - 1);
+      name[sizeof(name) - 1] = 0;
+      assert(GUMBO_TAG_UNKNOWN == gumbo_tag_enum(name));
+    }
+  }
+
+  return assert_failures();
+}
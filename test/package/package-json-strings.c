@@ -0,0 +1,192 @@
+#define _DEFAULT_SOURCE
+#include "describe/describe.h"
+#include "parson/parson.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// where the special byte goes, past the first blocks of 16 either way
+#define LENGTH 48
+
+static char buffer[LENGTH * 4 + 64];
+
+/**
+ * @return The string in the array `json` parses to, which the caller
+ * frees, or NULL if there is none
+ */
+
+static char *parse_string(const char *json) {
+  JSON_Value *value = json_parse_string(json);
+  const char *string = json_array_get_string(json_array(value), 0);
+  char *copy = string ? strdup(string) : NULL;
+
+  json_value_free(value);
+  return copy;
+}
+
+/**
+ * Parses the JSON string `json` in an array, with its opening quote at
+ * `offset` from a 16 byte boundary.
+ *
+ * @return What `parse_string()` returns
+ */
+
+static char *parse_at(const char *json, size_t offset) {
+  char *aligned = (char *)(((uintptr_t)buffer + 31) & ~(uintptr_t)15);
+
+  aligned[offset - 1] = '[';
+  strcpy(aligned + offset, json);
+  strcat(aligned + offset, "]");
+  return parse_string(aligned + offset - 1);
+}
+
+int main() {
+  describe("json_parse_string") {
+    char json[LENGTH * 4];
+    char expected[LENGTH * 2];
+
+    it("should end a string at its quote from every offset of a block") {
+      for (size_t offset = 0; offset < 16; offset++) {
+        for (size_t at = 0; at < LENGTH; at++) {
+          char *string = NULL;
+
+          memset(expected, 'a', at);
+          expected[at] = 0;
+          snprintf(json, sizeof(json), "\"%s\"", expected);
+
+          string = parse_at(json, offset);
+          assert(string && 0 == strcmp(expected, string));
+          free(string);
+        }
+      }
+    }
+
+    it("should decode a backslash at every offset of a block") {
+      for (size_t offset = 0; offset < 16; offset++) {
+        for (size_t at = 0; at < LENGTH; at++) {
+          char *string = NULL;
+
+          memset(json, 'a', sizeof(json));
+          json[0] = '"';
+          json[1 + at] = '\\';
+          json[2 + at] = 'n';
+          json[LENGTH + 2] = '"';
+          json[LENGTH + 3] = 0;
+
+          memset(expected, 'a', LENGTH);
+          expected[at] = '\n';
+          expected[LENGTH] = 0;
+
+          string = parse_at(json, offset);
+          assert(string && strlen(string) == LENGTH &&
+                 0 == memcmp(expected, string, LENGTH));
+          free(string);
+        }
+      }
+    }
+
+    it("should reject a control byte at every offset of a block") {
+      for (size_t offset = 0; offset < 16; offset++) {
+        for (size_t at = 0; at < LENGTH; at++) {
+          char *string = NULL;
+
+          memset(json, 'a', LENGTH + 2);
+          json[0] = '"';
+          json[1 + at] = '\x1f';
+          json[LENGTH + 1] = '"';
+          json[LENGTH + 2] = 0;
+
+          assert(NULL == parse_at(json, offset));
+
+          // the first byte past them is taken
+          json[1 + at] = ' ';
+          string = parse_at(json, offset);
+          assert(string && LENGTH == strlen(string));
+          free(string);
+        }
+      }
+    }
+
+    it("should stop at the end of a buffer before an unmapped page") {
+      long page = sysconf(_SC_PAGESIZE);
+      const char *inputs[] = {"[\"abc\"]", "[\"abc", "[\"ab\\",
+                              "[\"ab\\u00", "{\"key\":\"value\"}", NULL};
+      char *pages = mmap(NULL, page * 2, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+      assert(MAP_FAILED != pages);
+      assert(0 == mprotect(pages + page, page, PROT_NONE));
+
+      for (int i = 0; inputs[i]; i++) {
+        size_t size = strlen(inputs[i]) + 1;
+        char *end = pages + page - size;
+        JSON_Value *value = NULL;
+
+        memcpy(end, inputs[i], size);
+        value = json_parse_string(end);
+        assert((0 == i || 4 == i) == (NULL != value));
+        json_value_free(value);
+      }
+
+      // strings filling the page up to its last byte, from every offset
+      for (int i = 0; i < 16; i++) {
+        char *string = NULL;
+
+        memset(pages, 'a', page);
+        pages[i] = '[';
+        pages[i + 1] = '"';
+        pages[page - 3] = '"';
+        pages[page - 2] = ']';
+        pages[page - 1] = 0;
+
+        string = parse_string(pages + i);
+        assert(string && strlen(string) == (size_t)(page - 5 - i));
+        free(string);
+      }
+
+      munmap(pages, page * 2);
+    }
+
+    it("should copy a string without escapes like its escaped spelling") {
+      const char *plain = "clib/package-1.0.0 \xc3\xa9t\xc3\xa9 <a href='x'>";
+
+      for (size_t offset = 0; offset < 16; offset++) {
+        char *copied = NULL;
+        char *decoded = NULL;
+        char *p = json;
+
+        snprintf(json, sizeof(json), "\"%s\"", plain);
+        copied = parse_at(json, offset);
+
+        // every third ascii byte escaped, '/' the way JSON allows
+        *p++ = '"';
+        for (size_t i = 0; plain[i]; i++) {
+          if ('/' == plain[i]) {
+            p += sprintf(p, "\\/");
+          } else if (0 == i % 3 && (unsigned char)plain[i] < 0x80) {
+            p += sprintf(p, "\\u%04x", (unsigned char)plain[i]);
+          } else {
+            *p++ = plain[i];
+          }
+        }
+        strcpy(p, "\"");
+        decoded = parse_at(json, offset);
+
+        assert(copied && decoded);
+        assert(0 == strcmp(plain, copied));
+        assert(0 == strcmp(copied, decoded));
+        free(copied);
+        free(decoded);
+      }
+    }
+  }
+
+  return assert_failures();
+}
@@ -0,0 +1,109 @@
+#include "describe/describe.h"
+#include "list/list.h"
+#include <string.h>
+
+static list_t *list_of(const char **values) {
+  list_t *list = list_new();
+
+  for (int i = 0; values[i]; i++) {
+    list_rpush(list, list_node_new((void *)values[i]));
+  }
+
+  return list;
+}
+
+int main() {
+  describe("list_each") {
+    it("should visit nothing in an empty list") {
+      list_t *list = list_new();
+      list_node_t *node = NULL;
+      int n = 0;
+
+      list_each(list, node) { n++; }
+
+      assert(0 == n);
+      assert(NULL == node);
+      list_destroy(list);
+    }
+
+    it("should visit a single node once") {
+      const char *values[] = {"a", NULL};
+      list_t *list = list_of(values);
+      list_node_t *node = NULL;
+      int n = 0;
+
+      list_each(list, node) {
+        assert(list->head == node);
+        n++;
+      }
+
+      assert(1 == n);
+      assert(NULL == node);
+      list_destroy(list);
+    }
+
+    it("should visit the nodes from head to tail") {
+      const char *values[] = {"a", "b", "c", NULL};
+      list_t *list = list_of(values);
+      list_node_t *node = NULL;
+      int n = 0;
+
+      list_each(list, node) { assert(values[n++] == node->val); }
+
+      assert(3 == n);
+      list_destroy(list);
+    }
+  }
+
+  describe("list_iterator_init") {
+    it("should end right away on an empty list") {
+      list_t *list = list_new();
+      list_iterator_t it;
+
+      list_iterator_init(&it, list, LIST_HEAD);
+      assert(NULL == list_iterator_next(&it));
+      list_iterator_init(&it, list, LIST_TAIL);
+      assert(NULL == list_iterator_next(&it));
+      list_destroy(list);
+    }
+
+    it("should give a single node once either way") {
+      const char *values[] = {"a", NULL};
+      list_t *list = list_of(values);
+      list_iterator_t it;
+
+      list_iterator_init(&it, list, LIST_HEAD);
+      assert(list->head == list_iterator_next(&it));
+      assert(NULL == list_iterator_next(&it));
+
+      list_iterator_init(&it, list, LIST_TAIL);
+      assert(list->head == list_iterator_next(&it));
+      assert(NULL == list_iterator_next(&it));
+      list_destroy(list);
+    }
+
+    it("should stop early and go on from where it stopped") {
+      const char *values[] = {"a", "b", "c", "d", NULL};
+      list_t *list = list_of(values);
+      list_node_t *node = NULL;
+      list_iterator_t it;
+
+      list_iterator_init(&it, list, LIST_HEAD);
+      while ((node = list_iterator_next(&it))) {
+        if (0 == strcmp("b", node->val)) {
+          break;
+        }
+      }
+
+      assert(node && values[1] == node->val);
+      assert(values[2] == list_iterator_next(&it)->val);
+
+      list_iterator_init(&it, list, LIST_TAIL);
+      assert(values[3] == list_iterator_next(&it)->val);
+      assert(values[2] == list_iterator_next(&it)->val);
+      list_destroy(list);
+    }
+  }
+
+  return assert_failures();
+}
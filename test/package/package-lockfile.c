@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+#include "clib-lockfile.h"
+#include "clib-package.h"
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "parson/parson.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOCKFILE "./tmp-clib.lock"
+#define SLUG "clibs/foo@1.0.0"
+
+static const char *manifest = "{\"name\":\"foo\","
+                              "\"repo\":\"clibs/foo\","
+                              "\"version\":\"1.0.0\","
+                              "\"src\":[\"foo.c\",\"foo.h\"],"
+                              "\"dependencies\":{\"clibs/bar\":\"2.0.0\"}}";
+
+/**
+ * @return A lockfile with `SLUG` locked at a commit, with a source with an
+ * ETag and one without
+ */
+
+static clib_lockfile_t *locked(void) {
+  clib_lockfile_t *lockfile = clib_lockfile_new();
+  clib_package_t *pkg = clib_package_new(manifest, 0);
+
+  assert(lockfile && pkg);
+  clib_package_set_string(pkg, &pkg->filename, strdup("clib.json"));
+
+  assert(0 == clib_lockfile_add(lockfile, SLUG, pkg));
+  assert(0 == clib_lockfile_set_commit(lockfile, SLUG, "0123abcd"));
+  assert(0 == clib_lockfile_set_source(lockfile, SLUG, "foo.c", "h1",
+                                       "\"etag-1\""));
+  assert(0 == clib_lockfile_set_source(lockfile, SLUG, "foo.h", "h2", NULL));
+
+  clib_package_free(pkg);
+  return lockfile;
+}
+
+static void assert_source(clib_lockfile_t *lockfile, const char *file,
+                          const char *expected_hash,
+                          const char *expected_etag) {
+  char *hash = NULL;
+  char *etag = NULL;
+
+  assert(0 == clib_lockfile_source(lockfile, SLUG, file, &hash, &etag));
+  assert_str_equal(expected_hash, hash);
+  if (expected_etag) {
+    assert(etag && 0 == strcmp(expected_etag, etag));
+  } else {
+    assert(NULL == etag);
+  }
+
+  free(hash);
+  free(etag);
+}
+
+int main() {
+  describe("clib_lockfile") {
+    it("should read back what it saved") {
+      clib_lockfile_t *lockfile = locked();
+      clib_lockfile_t *loaded = NULL;
+      list_t *slugs = NULL;
+      char *hash = NULL;
+      char *etag = NULL;
+      char *file = NULL;
+      char *json = NULL;
+      char *commit = NULL;
+
+      unlink(LOCKFILE);
+      assert(0 == clib_lockfile_save(lockfile, LOCKFILE));
+      clib_lockfile_free(lockfile);
+
+      loaded = clib_lockfile_load(LOCKFILE);
+      assert(loaded);
+      assert(1 == clib_lockfile_has(loaded, SLUG));
+      assert(0 == clib_lockfile_has(loaded, "clibs/bar@2.0.0"));
+
+      json = clib_lockfile_manifest(loaded, SLUG, &file);
+      assert(json && file);
+      assert_str_equal(manifest, json);
+      assert_str_equal("clib.json", file);
+
+      slugs = clib_lockfile_slugs(loaded);
+      assert(slugs && 1 == slugs->len);
+      assert_str_equal(SLUG, (char *)slugs->head->val);
+
+      commit = clib_lockfile_commit(loaded, SLUG);
+      assert(commit);
+      assert_str_equal("0123abcd", commit);
+
+      assert_source(loaded, "foo.c", "h1", "\"etag-1\"");
+      assert_source(loaded, "foo.h", "h2", NULL);
+      assert(-1 == clib_lockfile_source(loaded, SLUG, "bar.c", &hash, &etag));
+      assert(NULL == hash && NULL == etag);
+
+      list_destroy(slugs);
+      free(commit);
+      free(json);
+      free(file);
+      clib_lockfile_free(loaded);
+    }
+
+    it("should keep the sources of a slug resolved again") {
+      clib_lockfile_t *lockfile = locked();
+      clib_package_t *pkg = clib_package_new(manifest, 0);
+
+      assert(pkg);
+      clib_package_set_string(pkg, &pkg->filename, strdup("clib.json"));
+
+      clib_lockfile_remove(lockfile, SLUG);
+      assert(0 == clib_lockfile_has(lockfile, SLUG));
+      assert(NULL == clib_lockfile_manifest(lockfile, SLUG, NULL));
+      assert(NULL == clib_lockfile_commit(lockfile, SLUG));
+      assert_source(lockfile, "foo.c", "h1", "\"etag-1\"");
+
+      assert(0 == clib_lockfile_add(lockfile, SLUG, pkg));
+      assert(1 == clib_lockfile_has(lockfile, SLUG));
+      assert_source(lockfile, "foo.h", "h2", NULL);
+
+      clib_package_free(pkg);
+      clib_lockfile_free(lockfile);
+    }
+
+    it("should not save the slugs kept") {
+      clib_lockfile_t *lockfile = locked();
+      clib_lockfile_t *loaded = NULL;
+
+      clib_lockfile_keep(lockfile, SLUG);
+      assert(1 == clib_lockfile_kept(lockfile, SLUG));
+      assert(0 == clib_lockfile_save(lockfile, LOCKFILE));
+      clib_lockfile_free(lockfile);
+
+      loaded = clib_lockfile_load(LOCKFILE);
+      assert(loaded);
+      assert(0 == clib_lockfile_kept(loaded, SLUG));
+      clib_lockfile_free(loaded);
+    }
+
+    it("should not load a malformed lockfile") {
+      assert(NULL == clib_lockfile_load(NULL));
+
+      unlink(LOCKFILE);
+      assert(NULL == clib_lockfile_load(LOCKFILE));
+
+      fs_write(LOCKFILE, "{\"lockfileVersion\": 1, \"packages\": {");
+      assert(NULL == clib_lockfile_load(LOCKFILE));
+
+      fs_write(LOCKFILE, "[1]");
+      assert(NULL == clib_lockfile_load(LOCKFILE));
+
+      fs_write(LOCKFILE, "{\"lockfileVersion\": 2, \"packages\": {}}");
+      assert(NULL == clib_lockfile_load(LOCKFILE));
+    }
+
+    it("should not trust an entry edited by hand") {
+      clib_lockfile_t *lockfile = locked();
+      JSON_Value *root = NULL;
+      JSON_Object *entry = NULL;
+
+      assert(0 == clib_lockfile_save(lockfile, LOCKFILE));
+      clib_lockfile_free(lockfile);
+
+      root = json_parse_file(LOCKFILE);
+      entry = json_object_dotget_object(json_value_get_object(root),
+                                        "packages");
+      entry = json_object_get_object(entry, SLUG);
+      assert(entry);
+      json_object_set_string(entry, "json", "{\"name\":\"evil\"}");
+      assert(JSONSuccess == json_serialize_to_file(root, LOCKFILE));
+      json_value_free(root);
+
+      lockfile = clib_lockfile_load(LOCKFILE);
+      assert(lockfile);
+      assert(NULL == clib_lockfile_manifest(lockfile, SLUG, NULL));
+      clib_lockfile_free(lockfile);
+    }
+  }
+
+  unlink(LOCKFILE);
+  return assert_failures();
+}
@@ -50,7 +50,9 @@ int main() {
       clib_package_t *pkg = clib_package_new_from_slug(
           "stephenmathieson/str-replace.c@8ca90fb", 0);
       assert(pkg);
-      assert(pkg->json);
+
+      char *json = clib_package_read_json(pkg);
+      assert(json);
 
       char expected[] = "{\n"
                         "  \"name\": \"str-replace\",\n"
@@ -67,7 +69,8 @@ int main() {
                         "  ]\n"
                         "}\n";
 
-      assert_str_equal(expected, pkg->json);
+      assert_str_equal(expected, json);
+      free(json);
       clib_package_free(pkg);
     }
   }
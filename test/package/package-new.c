@@ -1,6 +1,9 @@
+// setenv()
+#define _POSIX_C_SOURCE 200809L
 
 #include "clib-package.h"
 #include "describe/describe.h"
+#include <stdlib.h>
 
 int main() {
   describe("clib_package_new") {
@@ -77,6 +80,59 @@ int main() {
       assert(pkg);
       clib_package_free(pkg);
     }
+
+    it("should read flags and files in either form") {
+      char json[] = "{"
+                    "  \"name\": \"f\\u00f6o\","
+                    "  \"keywords\": [{\"nested\": [1, -2.5e3, null]}],"
+                    "  \"flags\": [\"-O2\", 1, \"-DA=\\\"b\\\"\"],"
+                    "  \"cflags\": [\"-g\"],"
+                    "  \"src\": \"ignored\","
+                    "  \"files\": [\"foo.c\"],"
+                    "  \"development\": []"
+                    "}";
+
+      clib_package_t *pkg = clib_package_new(json, 0);
+      assert(pkg);
+
+      assert_str_equal("f\xc3\xb6o", pkg->name);
+      assert_str_equal(" -O2 -DA=\"b\"", pkg->flags);
+      assert(1 == pkg->src->len);
+      assert_str_equal("foo.c", (char *)list_at(pkg->src, 0)->val);
+      assert(NULL == pkg->development);
+
+      clib_package_free(pkg);
+    }
+
+    it("should read the prebuilt binary of this platform") {
+      char json[] = "{"
+                    "  \"name\": \"foo\","
+                    "  \"binaries\": {"
+                    "    \"a-b\": {\"url\": \"https://a/b\"},"
+                    "    \"c-d\": {\"url\": \"https://c/d\", "
+                    "\"sha256\": \"ab12\", \"size\": 3}"
+                    "  }"
+                    "}";
+
+      setenv("CLIB_PLATFORM", "c-d", 1);
+      clib_package_t *pkg = clib_package_new(json, 0);
+      assert(pkg);
+      assert_str_equal("https://c/d", pkg->binary);
+      assert_str_equal("ab12", pkg->binary_sha256);
+      clib_package_free(pkg);
+
+      setenv("CLIB_PLATFORM", "e-f", 1);
+      pkg = clib_package_new(json, 0);
+      assert(pkg);
+      assert(NULL == pkg->binary);
+      clib_package_free(pkg);
+      unsetenv("CLIB_PLATFORM");
+    }
+
+    it("should return NULL when given an array or duplicate keys") {
+      assert(NULL == clib_package_new("[{\"name\": \"foo\"}]", 0));
+      assert(NULL == clib_package_new("{\"name\": \"a\", \"name\": \"b\"}", 0));
+    }
   }
 
   return assert_failures();
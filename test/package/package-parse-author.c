@@ -38,6 +38,15 @@ int main() {
       free(author);
     }
 
+    it("should not look for the author in the version") {
+      author = clib_package_parse_author("name@feature/foo");
+      assert_str_equal("clibs", author);
+      free(author);
+      author = clib_package_parse_author("author/name@feature/foo");
+      assert_str_equal("author", author);
+      free(author);
+    }
+
     // this was a bug in parse-repo.c...
     it("should not be affected after the slug is freed") {
       char *slug = malloc(48);
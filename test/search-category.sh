@@ -0,0 +1,26 @@
+#!/bin/sh
+
+ALL=$(clib search | wc -l)
+N=$(clib search --category "string manipulation" | wc -l)
+[ "$N" -gt 0 ] && [ "$N" -lt "$ALL" ] || {
+  echo >&2 "Expected \`clib search --category\` to return some of the packages"
+  exit 1
+}
+
+TRIM=$(clib search -g string trim)
+case "$TRIM" in
+  *"stephenmathieson/trim.c"*)
+    :
+    ;;
+  *)
+    echo >&2 "Expected \`clib search -g string trim\` to output trim.c"
+    exit 1
+    ;;
+esac
+
+clib search --json -g string | grep '"category"' | grep -qv string && {
+  echo >&2 "Expected \`clib search --json -g string\` to keep to its categories"
+  exit 1
+}
+
+exit 0
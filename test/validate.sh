@@ -0,0 +1,38 @@
+#!/bin/sh
+
+rm -rf tmp/validate
+mkdir -p tmp/validate/deps/good tmp/validate/deps/bad
+
+cat > tmp/validate/clib.json <<JSON
+{
+  "name": "project",
+  "version": "0.0.1",
+  "repo": "clibs/project",
+  "description": "a project",
+  "license": "MIT",
+  "keywords": ["project"],
+  "src": ["project.c"]
+}
+JSON
+cp tmp/validate/clib.json tmp/validate/deps/good/clib.json
+echo '{"name": "bad", "version": "0.0.1"}' > tmp/validate/deps/bad/clib.json
+
+clib validate tmp/validate tmp/validate/deps/good > /dev/null 2>&1 || {
+  echo >&2 "Expected valid manifests to pass"
+  exit 1
+}
+
+(cd tmp/validate && clib validate -q) > /dev/null 2>&1 && {
+  echo >&2 "Expected a package without src or install to fail"
+  exit 1
+}
+
+echo '[]' > tmp/validate/deps/bad/clib.json
+
+clib validate tmp/validate/deps/bad > /dev/null 2>&1 && {
+  echo >&2 "Expected a malformed manifest to fail"
+  exit 1
+}
+
+rm -rf tmp/validate
+exit 0